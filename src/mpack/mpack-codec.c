@@ -0,0 +1,242 @@
+/*
+ * Copyright (c) 2015-2018 Nicholas Fraser
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#define MPACK_INTERNAL 1
+
+#include "mpack-codec.h"
+
+#if MPACK_CODEC && defined(MPACK_MALLOC) && (MPACK_EXPECT || MPACK_WRITER)
+
+// Returns the size of a member of the given field type, or 0 if it varies.
+static size_t mpack_field_type_size(mpack_field_type_t type) {
+    switch (type) {
+        case mpack_field_bool:   return sizeof(bool);
+        case mpack_field_i8:     return sizeof(int8_t);
+        case mpack_field_i16:    return sizeof(int16_t);
+        case mpack_field_i32:    return sizeof(int32_t);
+        case mpack_field_i64:    return sizeof(int64_t);
+        case mpack_field_u8:     return sizeof(uint8_t);
+        case mpack_field_u16:    return sizeof(uint16_t);
+        case mpack_field_u32:    return sizeof(uint32_t);
+        case mpack_field_u64:    return sizeof(uint64_t);
+        case mpack_field_float:  return sizeof(float);
+        case mpack_field_double: return sizeof(double);
+        case mpack_field_cstr:   return 0;
+        case mpack_field_struct: return 0;
+    }
+    return 0;
+}
+
+static bool mpack_field_valid(const mpack_field_t* field) {
+    if (field->key == NULL)
+        return false;
+    if (field->type == mpack_field_struct)
+        return field->codec != NULL;
+    if (field->type == mpack_field_cstr)
+        return field->size > 0;
+    return field->size == mpack_field_type_size(field->type);
+}
+
+bool mpack_codec_init(mpack_codec_t* codec, const mpack_field_t* fields, size_t count) {
+    return mpack_codec_init_allocator(codec, fields, count, NULL);
+}
+
+bool mpack_codec_init_allocator(mpack_codec_t* codec, const mpack_field_t* fields, size_t count,
+        const mpack_allocator_t* allocator)
+{
+    mpack_memset(codec, 0, sizeof(*codec));
+    if (allocator != NULL)
+        codec->allocator = *allocator;
+    if (count == 0 || count > MPACK_CODEC_MAX_FIELDS)
+        return false;
+    mpack_assert(fields != NULL, "fields cannot be NULL");
+
+    size_t i;
+    size_t keys_length = 0;
+    for (i = 0; i < count; ++i) {
+        if (!mpack_field_valid(&fields[i])) {
+            mpack_break("field %i is invalid", (int)i);
+            return false;
+        }
+        keys_length += mpack_strlen(fields[i].key);
+    }
+
+    // the key pointers, key set slots, encoded key offsets and encoded keys
+    // are allocated in a single block, in order of alignment
+    size_t keys_size = sizeof(const char*) * count;
+    #if MPACK_EXPECT
+    size_t slot_count = MPACK_KEYSET_SLOT_COUNT(count);
+    size_t slots_size = sizeof(mpack_keyset_slot_t) * slot_count;
+    #else
+    size_t slots_size = 0;
+    #endif
+    #if MPACK_WRITER
+    size_t offsets_size = sizeof(uint32_t) * (count + 1);
+    size_t headers_size = keys_length + MPACK_TAG_SIZE_STR32 * count;
+    if ((uint64_t)headers_size > UINT32_MAX)
+        return false;
+    #else
+    size_t offsets_size = 0;
+    size_t headers_size = 0;
+    #endif
+
+    char* storage = (char*)mpack_allocator_alloc(&codec->allocator,
+            keys_size + slots_size + offsets_size + headers_size);
+    if (storage == NULL)
+        return false;
+    codec->storage = storage;
+    codec->fields = fields;
+    codec->count = count;
+
+    const char** keys = (const char**)(void*)storage;
+    for (i = 0; i < count; ++i)
+        keys[i] = fields[i].key;
+
+    #if MPACK_EXPECT
+    mpack_keyset_slot_t* slots = (mpack_keyset_slot_t*)(void*)(storage + keys_size);
+    if (!mpack_keyset_init(&codec->keyset, keys, count, slots, slot_count)) {
+        mpack_codec_destroy(codec);
+        return false;
+    }
+    for (i = 0; i < count; ++i)
+        if (!fields[i].optional)
+            codec->required |= (uint64_t)1 << i;
+    #endif
+
+    #if MPACK_WRITER
+    uint32_t* offsets = (uint32_t*)(void*)(storage + keys_size + slots_size);
+    char* headers = storage + keys_size + slots_size + offsets_size;
+    mpack_writer_t writer;
+    mpack_writer_init(&writer, headers, headers_size);
+    for (i = 0; i < count; ++i) {
+        offsets[i] = (uint32_t)mpack_writer_buffer_used(&writer);
+        mpack_write_str(&writer, keys[i], (uint32_t)mpack_strlen(keys[i]));
+    }
+    offsets[count] = (uint32_t)mpack_writer_buffer_used(&writer);
+    if (mpack_writer_destroy(&writer) != mpack_ok) {
+        mpack_codec_destroy(codec);
+        return false;
+    }
+    codec->headers = headers;
+    codec->offsets = offsets;
+    #endif
+
+    return true;
+}
+
+void mpack_codec_destroy(mpack_codec_t* codec) {
+    if (codec->storage != NULL)
+        mpack_allocator_free(&codec->allocator, codec->storage);
+    mpack_memset(codec, 0, sizeof(*codec));
+}
+
+#if MPACK_EXPECT
+static void mpack_expect_field(mpack_reader_t* reader, const mpack_field_t* field, char* p) {
+    switch (field->type) {
+        case mpack_field_bool:   *(bool*)(void*)p     = mpack_expect_bool(reader);   return;
+        case mpack_field_i8:     *(int8_t*)(void*)p   = mpack_expect_i8(reader);     return;
+        case mpack_field_i16:    *(int16_t*)(void*)p  = mpack_expect_i16(reader);    return;
+        case mpack_field_i32:    *(int32_t*)(void*)p  = mpack_expect_i32(reader);    return;
+        case mpack_field_i64:    *(int64_t*)(void*)p  = mpack_expect_i64(reader);    return;
+        case mpack_field_u8:     *(uint8_t*)(void*)p  = mpack_expect_u8(reader);     return;
+        case mpack_field_u16:    *(uint16_t*)(void*)p = mpack_expect_u16(reader);    return;
+        case mpack_field_u32:    *(uint32_t*)(void*)p = mpack_expect_u32(reader);    return;
+        case mpack_field_u64:    *(uint64_t*)(void*)p = mpack_expect_u64(reader);    return;
+        case mpack_field_float:  *(float*)(void*)p    = mpack_expect_float(reader);  return;
+        case mpack_field_double: *(double*)(void*)p   = mpack_expect_double(reader); return;
+        case mpack_field_cstr:   mpack_expect_cstr(reader, p, field->size);          return;
+        case mpack_field_struct: mpack_expect_struct(reader, field->codec, p);       return;
+    }
+    mpack_reader_flag_error(reader, mpack_error_bug);
+}
+
+void mpack_expect_struct(mpack_reader_t* reader, const mpack_codec_t* codec, void* object) {
+    mpack_assert(codec->count != 0, "codec is not initialized");
+
+    uint64_t found = 0;
+    uint32_t count = mpack_expect_map(reader);
+    for (; count > 0 && mpack_reader_error(reader) == mpack_ok; --count) {
+        size_t i = mpack_expect_enum_set_optional(reader, &codec->keyset);
+        if (i == codec->count) {
+            mpack_discard(reader);
+            continue;
+        }
+
+        uint64_t bit = (uint64_t)1 << i;
+        if (found & bit) {
+            mpack_reader_flag_error(reader, mpack_error_invalid);
+            return;
+        }
+        found |= bit;
+
+        const mpack_field_t* field = &codec->fields[i];
+        mpack_expect_field(reader, field, (char*)object + field->offset);
+    }
+    mpack_done_map(reader);
+
+    if (mpack_reader_error(reader) == mpack_ok && (found & codec->required) != codec->required)
+        mpack_reader_flag_error(reader, mpack_error_data);
+}
+#endif
+
+#if MPACK_WRITER
+static void mpack_write_field(mpack_writer_t* writer, const mpack_field_t* field, const char* p) {
+    switch (field->type) {
+        case mpack_field_bool:   mpack_write_bool(writer, *(const bool*)(const void*)p);       return;
+        case mpack_field_i8:     mpack_write_i8(writer, *(const int8_t*)(const void*)p);       return;
+        case mpack_field_i16:    mpack_write_i16(writer, *(const int16_t*)(const void*)p);     return;
+        case mpack_field_i32:    mpack_write_i32(writer, *(const int32_t*)(const void*)p);     return;
+        case mpack_field_i64:    mpack_write_i64(writer, *(const int64_t*)(const void*)p);     return;
+        case mpack_field_u8:     mpack_write_u8(writer, *(const uint8_t*)(const void*)p);      return;
+        case mpack_field_u16:    mpack_write_u16(writer, *(const uint16_t*)(const void*)p);    return;
+        case mpack_field_u32:    mpack_write_u32(writer, *(const uint32_t*)(const void*)p);    return;
+        case mpack_field_u64:    mpack_write_u64(writer, *(const uint64_t*)(const void*)p);    return;
+        case mpack_field_float:  mpack_write_float(writer, *(const float*)(const void*)p);     return;
+        case mpack_field_double: mpack_write_double(writer, *(const double*)(const void*)p);   return;
+        case mpack_field_struct: mpack_write_struct(writer, field->codec, p);                  return;
+        case mpack_field_cstr: {
+            // the string is bounded by its array in case it isn't terminated
+            size_t length = 0;
+            while (length < field->size && p[length] != '\0')
+                ++length;
+            mpack_write_str(writer, p, (uint32_t)length);
+            return;
+        }
+    }
+    mpack_writer_flag_error(writer, mpack_error_bug);
+}
+
+void mpack_write_struct(mpack_writer_t* writer, const mpack_codec_t* codec, const void* object) {
+    mpack_assert(codec->count != 0, "codec is not initialized");
+
+    mpack_start_map(writer, (uint32_t)codec->count);
+    size_t i;
+    for (i = 0; i < codec->count && mpack_writer_error(writer) == mpack_ok; ++i) {
+        const mpack_field_t* field = &codec->fields[i];
+        uint32_t offset = codec->offsets[i];
+        mpack_write_object_bytes(writer, codec->headers + offset, codec->offsets[i + 1] - offset);
+        mpack_write_field(writer, field, (const char*)object + field->offset);
+    }
+    mpack_finish_map(writer);
+}
+#endif
+
+#endif
@@ -0,0 +1,238 @@
+/*
+ * Copyright (c) 2015-2018 Nicholas Fraser
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * @file
+ *
+ * Declares the MPack struct codec API.
+ */
+
+#ifndef MPACK_CODEC_H
+#define MPACK_CODEC_H 1
+
+#include "mpack-writer.h"
+#include "mpack-expect.h"
+
+MPACK_HEADER_START
+MPACK_EXTERN_C_START
+
+#if MPACK_CODEC && defined(MPACK_MALLOC) && (MPACK_EXPECT || MPACK_WRITER)
+
+/**
+ * @defgroup codec Struct Codec API
+ *
+ * The struct codec API reads and writes C structs as MessagePack maps,
+ * driven by a table of field descriptors rather than hand-written code.
+ *
+ * Each field descriptor gives the map key of a struct member, its type and
+ * its offset in the struct. A table of descriptors is compiled once into a
+ * codec with mpack_codec_init(). The codec contains a key set (see
+ * mpack_keyset_init()) for matching keys when reading, and the keys
+ * pre-encoded as MessagePack strings so each is written with a single copy.
+ *
+ * @code{.c}
+ * typedef struct point_t {
+ *     int32_t x;
+ *     int32_t y;
+ *     char label[16];
+ * } point_t;
+ *
+ * static const mpack_field_t point_fields[] = {
+ *     MPACK_FIELD(point_t, x, mpack_field_i32),
+ *     MPACK_FIELD(point_t, y, mpack_field_i32),
+ *     MPACK_FIELD_OPTIONAL(point_t, label, mpack_field_cstr),
+ * };
+ *
+ * mpack_codec_t point_codec;
+ * mpack_codec_init(&point_codec, point_fields, sizeof(point_fields) / sizeof(*point_fields));
+ *
+ * point_t point;
+ * mpack_expect_struct(reader, &point_codec, &point);
+ * mpack_write_struct(writer, &point_codec, &point);
+ * @endcode
+ *
+ * @note This requires @ref MPACK_MALLOC. Reading requires @ref MPACK_EXPECT
+ * and writing requires @ref MPACK_WRITER.
+ *
+ * @{
+ */
+
+/**
+ * The maximum number of fields in a codec.
+ */
+#define MPACK_CODEC_MAX_FIELDS 64
+
+/**
+ * The type of a struct member described by a field descriptor.
+ */
+typedef enum mpack_field_type_t {
+    mpack_field_bool,   /**< A bool. */
+    mpack_field_i8,     /**< An int8_t. */
+    mpack_field_i16,    /**< An int16_t. */
+    mpack_field_i32,    /**< An int32_t. */
+    mpack_field_i64,    /**< An int64_t. */
+    mpack_field_u8,     /**< A uint8_t. */
+    mpack_field_u16,    /**< A uint16_t. */
+    mpack_field_u32,    /**< A uint32_t. */
+    mpack_field_u64,    /**< A uint64_t. */
+    mpack_field_float,  /**< A float. */
+    mpack_field_double, /**< A double. */
+    mpack_field_cstr,   /**< A char array holding a null-terminated string. */
+    mpack_field_struct, /**< A nested struct, described by another codec. */
+} mpack_field_type_t;
+
+struct mpack_codec_t;
+
+/**
+ * Describes a struct member to be read from or written to a map key.
+ *
+ * These are normally declared with MPACK_FIELD() and related macros.
+ */
+typedef struct mpack_field_t {
+    const char* key;                   /**< The map key. */
+    mpack_field_type_t type;           /**< The type of the member. */
+    size_t offset;                     /**< The offset of the member in the struct. */
+    size_t size;                       /**< The size of the member. */
+    const struct mpack_codec_t* codec; /**< The codec of a nested struct, or NULL. */
+    bool optional;                     /**< Whether the key may be missing when reading. */
+} mpack_field_t;
+
+/**
+ * Declares a field descriptor for the given member of the given struct.
+ * The map key is the name of the member.
+ */
+#define MPACK_FIELD(type, member, field_type) \
+    {#member, field_type, offsetof(type, member), sizeof(((type*)0)->member), NULL, false}
+
+/**
+ * Declares a field descriptor for the given member of the given struct that
+ * is left unchanged when its key is missing.
+ */
+#define MPACK_FIELD_OPTIONAL(type, member, field_type) \
+    {#member, field_type, offsetof(type, member), sizeof(((type*)0)->member), NULL, true}
+
+/**
+ * Declares a field descriptor for a nested struct member described by the
+ * given codec.
+ */
+#define MPACK_FIELD_STRUCT(type, member, codec) \
+    {#member, mpack_field_struct, offsetof(type, member), sizeof(((type*)0)->member), codec, false}
+
+/**
+ * A table of field descriptors compiled for reading and writing.
+ *
+ * @see mpack_codec_init()
+ */
+typedef struct mpack_codec_t {
+    const mpack_field_t* fields;
+    size_t count;
+    void* storage;
+    mpack_allocator_t allocator; /* The allocator of storage */
+
+    #if MPACK_EXPECT
+    mpack_keyset_t keyset;
+    uint64_t required;       /* A bit for each field that is not optional */
+    #endif
+
+    #if MPACK_WRITER
+    const char* headers;     /* The keys encoded as MessagePack strings */
+    const uint32_t* offsets; /* Offsets of each encoded key in headers */
+    #endif
+} mpack_codec_t;
+
+/**
+ * Compiles a table of field descriptors into a codec.
+ *
+ * The fields (and their keys and nested codecs) must remain valid for the
+ * lifetime of the codec. A codec is not modified by reading or writing, so
+ * it can be shared across readers, writers and threads.
+ *
+ * @param codec The codec to initialize
+ * @param fields The field descriptors
+ * @param count The number of fields, at most @ref MPACK_CODEC_MAX_FIELDS
+ *
+ * @return true if the codec was compiled, or false if the keys are not
+ *         unique, a field is invalid (such as a member size that doesn't
+ *         match its type), there are too many fields or memory could not be
+ *         allocated.
+ */
+bool mpack_codec_init(mpack_codec_t* codec, const mpack_field_t* fields, size_t count);
+
+/**
+ * Compiles a table of field descriptors into a codec, allocating with the
+ * given allocator.
+ *
+ * This is the same as mpack_codec_init() except that the codec is allocated
+ * with @p allocator instead of @ref MPACK_MALLOC.
+ *
+ * @param allocator The allocator to use, or NULL to use @ref MPACK_MALLOC.
+ *     It is copied, so it does not need to outlive the call.
+ */
+bool mpack_codec_init_allocator(mpack_codec_t* codec, const mpack_field_t* fields, size_t count,
+        const mpack_allocator_t* allocator);
+
+/**
+ * Frees the memory of a codec compiled with mpack_codec_init() or
+ * mpack_codec_init_allocator().
+ */
+void mpack_codec_destroy(mpack_codec_t* codec);
+
+#if MPACK_EXPECT
+/**
+ * Reads a map into the given struct with the given codec.
+ *
+ * Each key of the map that matches a field is read into the struct as the
+ * field's type, with the same conversions as the corresponding expect
+ * function (for example mpack_expect_i32() for @ref mpack_field_i32.)
+ * Unrecognized keys are skipped.
+ *
+ * @throws mpack_error_type if the value is not a map or a value has the
+ *         wrong type.
+ * @throws mpack_error_invalid if a key is found twice.
+ * @throws mpack_error_data if a key that is not optional is missing.
+ *
+ * @note This requires @ref MPACK_EXPECT.
+ */
+void mpack_expect_struct(mpack_reader_t* reader, const mpack_codec_t* codec, void* object);
+#endif
+
+#if MPACK_WRITER
+/**
+ * Writes the given struct as a map with the given codec.
+ *
+ * Every field is written, in the order of the field descriptors.
+ *
+ * @note This requires @ref MPACK_WRITER.
+ */
+void mpack_write_struct(mpack_writer_t* writer, const mpack_codec_t* codec, const void* object);
+#endif
+
+/**
+ * @}
+ */
+
+#endif
+
+MPACK_EXTERN_C_END
+MPACK_HEADER_END
+
+#endif
+
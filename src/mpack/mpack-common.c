@@ -41,6 +41,7 @@ const char* mpack_error_to_string(mpack_error_t error) {
         MPACK_ERROR_STRING_CASE(mpack_error_bug);
         MPACK_ERROR_STRING_CASE(mpack_error_data);
         MPACK_ERROR_STRING_CASE(mpack_error_eof);
+        MPACK_ERROR_STRING_CASE(mpack_error_would_block);
         #undef MPACK_ERROR_STRING_CASE
     }
     mpack_assert(0, "unrecognized error %i", (int)error);
@@ -341,6 +342,42 @@ void mpack_tag_debug_describe(mpack_tag_t tag, char* buffer, size_t buffer_size)
 
 
 
+#ifdef MPACK_MALLOC
+void* mpack_allocator_alloc(const mpack_allocator_t* allocator, size_t size) {
+    if (allocator == NULL || allocator->alloc_fn == NULL)
+        return MPACK_MALLOC(size);
+    return allocator->alloc_fn(allocator->context, size);
+}
+
+void* mpack_allocator_realloc(const mpack_allocator_t* allocator, void* ptr, size_t used_size, size_t new_size) {
+    if (allocator == NULL || allocator->alloc_fn == NULL)
+        return mpack_realloc(ptr, used_size, new_size);
+    if (allocator->realloc_fn != NULL)
+        return allocator->realloc_fn(allocator->context, ptr, used_size, new_size);
+
+    void* new_ptr = allocator->alloc_fn(allocator->context, new_size);
+    if (new_ptr == NULL)
+        return NULL;
+    if (ptr != NULL) {
+        mpack_memcpy(new_ptr, ptr, used_size);
+        if (allocator->free_fn != NULL)
+            allocator->free_fn(allocator->context, ptr);
+    }
+    return new_ptr;
+}
+
+void mpack_allocator_free(const mpack_allocator_t* allocator, void* ptr) {
+    if (allocator == NULL || allocator->alloc_fn == NULL) {
+        MPACK_FREE(ptr);
+        return;
+    }
+    if (allocator->free_fn != NULL)
+        allocator->free_fn(allocator->context, ptr);
+}
+#endif
+
+
+
 #if MPACK_READ_TRACKING || MPACK_WRITE_TRACKING
 
 #ifndef MPACK_TRACKING_INITIAL_CAPACITY
@@ -349,10 +386,12 @@ void mpack_tag_debug_describe(mpack_tag_t tag, char* buffer, size_t buffer_size)
 #define MPACK_TRACKING_INITIAL_CAPACITY 8
 #endif
 
-mpack_error_t mpack_track_init(mpack_track_t* track) {
+mpack_error_t mpack_track_init(mpack_track_t* track, const mpack_allocator_t* allocator) {
     track->count = 0;
     track->capacity = MPACK_TRACKING_INITIAL_CAPACITY;
-    track->elements = (mpack_track_element_t*)MPACK_MALLOC(sizeof(mpack_track_element_t) * track->capacity);
+    track->allocator = allocator;
+    track->elements = (mpack_track_element_t*)mpack_allocator_alloc(allocator,
+            sizeof(mpack_track_element_t) * track->capacity);
     if (track->elements == NULL)
         return mpack_error_memory;
     return mpack_ok;
@@ -364,7 +403,7 @@ mpack_error_t mpack_track_grow(mpack_track_t* track) {
 
     size_t new_capacity = track->capacity * 2;
 
-    mpack_track_element_t* new_elements = (mpack_track_element_t*)mpack_realloc(track->elements,
+    mpack_track_element_t* new_elements = (mpack_track_element_t*)mpack_allocator_realloc(track->allocator, track->elements,
             sizeof(mpack_track_element_t) * track->count, sizeof(mpack_track_element_t) * new_capacity);
     if (new_elements == NULL)
         return mpack_error_memory;
@@ -374,9 +413,10 @@ mpack_error_t mpack_track_grow(mpack_track_t* track) {
     return mpack_ok;
 }
 
-mpack_error_t mpack_track_push(mpack_track_t* track, mpack_type_t type, uint32_t count) {
+static mpack_error_t mpack_track_push_impl(mpack_track_t* track, mpack_type_t type, uint32_t count, bool builder) {
     mpack_assert(track->elements, "null track elements!");
-    mpack_log("track pushing %s count %i\n", mpack_type_to_string(type), (int)count);
+    mpack_log("track pushing %s count %i%s\n", mpack_type_to_string(type), (int)count,
+            builder ? " (builder)" : "");
 
     // grow if needed
     if (track->count == track->capacity) {
@@ -389,13 +429,24 @@ mpack_error_t mpack_track_push(mpack_track_t* track, mpack_type_t type, uint32_t
     track->elements[track->count].type = type;
     track->elements[track->count].left = count;
     track->elements[track->count].key_needs_value = false;
+    track->elements[track->count].builder = builder;
     ++track->count;
     return mpack_ok;
 }
 
-mpack_error_t mpack_track_pop(mpack_track_t* track, mpack_type_t type) {
+mpack_error_t mpack_track_push(mpack_track_t* track, mpack_type_t type, uint32_t count) {
+    return mpack_track_push_impl(track, type, count, false);
+}
+
+mpack_error_t mpack_track_push_builder(mpack_track_t* track, mpack_type_t type) {
+    mpack_assert(type == mpack_type_map || type == mpack_type_array,
+            "builders can only build maps or arrays, not %s", mpack_type_to_string(type));
+    return mpack_track_push_impl(track, type, 0, true);
+}
+
+static mpack_error_t mpack_track_pop_impl(mpack_track_t* track, mpack_type_t type, bool builder) {
     mpack_assert(track->elements, "null track elements!");
-    mpack_log("track popping %s\n", mpack_type_to_string(type));
+    mpack_log("track popping %s%s\n", mpack_type_to_string(type), builder ? " (builder)" : "");
 
     if (track->count == 0) {
         mpack_break("attempting to close a %s but nothing was opened!", mpack_type_to_string(type));
@@ -410,6 +461,12 @@ mpack_error_t mpack_track_pop(mpack_track_t* track, mpack_type_t type) {
         return mpack_error_bug;
     }
 
+    if (element->builder != builder) {
+        mpack_break("attempting to %s a %s but it was %s!", builder ? "complete" : "finish",
+                mpack_type_to_string(type), element->builder ? "built" : "started");
+        return mpack_error_bug;
+    }
+
     if (element->key_needs_value) {
         mpack_assert(type == mpack_type_map, "key_needs_value can only be true for maps!");
         mpack_break("attempting to close a %s but an odd number of elements were written",
@@ -417,7 +474,7 @@ mpack_error_t mpack_track_pop(mpack_track_t* track, mpack_type_t type) {
         return mpack_error_bug;
     }
 
-    if (element->left != 0) {
+    if (!builder && element->left != 0) {
         mpack_break("attempting to close a %s but there are %i %s left",
                 mpack_type_to_string(type), element->left,
                 (type == mpack_type_map || type == mpack_type_array) ? "elements" : "bytes");
@@ -428,6 +485,14 @@ mpack_error_t mpack_track_pop(mpack_track_t* track, mpack_type_t type) {
     return mpack_ok;
 }
 
+mpack_error_t mpack_track_pop(mpack_track_t* track, mpack_type_t type) {
+    return mpack_track_pop_impl(track, type, false);
+}
+
+mpack_error_t mpack_track_pop_builder(mpack_track_t* track, mpack_type_t type) {
+    return mpack_track_pop_impl(track, type, true);
+}
+
 mpack_error_t mpack_track_peek_element(mpack_track_t* track, bool read) {
     MPACK_UNUSED(read);
     mpack_assert(track->elements, "null track elements!");
@@ -444,7 +509,7 @@ mpack_error_t mpack_track_peek_element(mpack_track_t* track, bool read) {
         return mpack_error_bug;
     }
 
-    if (element->left == 0 && !element->key_needs_value) {
+    if (!element->builder && element->left == 0 && !element->key_needs_value) {
         mpack_break("too many elements %s for %s", read ? "read" : "written",
                 mpack_type_to_string(element->type));
         return mpack_error_bug;
@@ -468,7 +533,8 @@ mpack_error_t mpack_track_element(mpack_track_t* track, bool read) {
         element->key_needs_value = false;
     }
 
-    --element->left;
+    if (!element->builder)
+        --element->left;
     return mpack_ok;
 }
 
@@ -536,7 +602,7 @@ mpack_error_t mpack_track_check_empty(mpack_track_t* track) {
 mpack_error_t mpack_track_destroy(mpack_track_t* track, bool cancel) {
     mpack_error_t error = cancel ? mpack_ok : mpack_track_check_empty(track);
     if (track->elements) {
-        MPACK_FREE(track->elements);
+        mpack_allocator_free(track->allocator, track->elements);
         track->elements = NULL;
     }
     return error;
@@ -545,6 +611,55 @@ mpack_error_t mpack_track_destroy(mpack_track_t* track, bool cancel) {
 
 
 
+/*
+ * Returns the length of the run of ASCII bytes at the start of str, stopping
+ * at NUL if allow_null is false.
+ *
+ * Strings are usually mostly ASCII so this checks a block at a time using
+ * SSE2 or NEON if available, or a word at a time otherwise. The block
+ * containing the end of the run is scanned byte by byte.
+ */
+MPACK_STATIC_INLINE size_t mpack_utf8_ascii_run(const uint8_t* str, size_t count, bool allow_null) {
+    size_t i = 0;
+
+    #if MPACK_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    while (count - i >= 16) {
+        __m128i block = _mm_loadu_si128((const __m128i*)(const void*)(str + i));
+        if (!allow_null)
+            block = _mm_or_si128(block, _mm_cmpeq_epi8(block, zero));
+        if (_mm_movemask_epi8(block) != 0)
+            break;
+        i += 16;
+    }
+
+    #elif MPACK_NEON
+    const uint8x16_t zero = vdupq_n_u8(0);
+    while (count - i >= 16) {
+        uint8x16_t block = vld1q_u8(str + i);
+        if (!allow_null)
+            block = vorrq_u8(block, vceqq_u8(block, zero));
+        if (vmaxvq_u8(block) >= 0x80)
+            break;
+        i += 16;
+    }
+
+    #elif !MPACK_OPTIMIZE_FOR_SIZE
+    while (count - i >= 8) {
+        uint64_t word = mpack_load_u64((const char*)str + i);
+        if (!allow_null) // sets the high bit of NUL bytes (if all are ASCII)
+            word |= (word - UINT64_C(0x0101010101010101)) & ~word;
+        if ((word & UINT64_C(0x8080808080808080)) != 0)
+            break;
+        i += 8;
+    }
+    #endif
+
+    while (i < count && str[i] <= 0x7F && (allow_null || str[i] != '\0'))
+        ++i;
+    return i;
+}
+
 static bool mpack_utf8_check_impl(const uint8_t* str, size_t count, bool allow_null) {
     while (count > 0) {
         uint8_t lead = str[0];
@@ -555,8 +670,9 @@ static bool mpack_utf8_check_impl(const uint8_t* str, size_t count, bool allow_n
 
         // ASCII
         if (lead <= 0x7F) {
-            ++str;
-            --count;
+            size_t run = mpack_utf8_ascii_run(str, count, allow_null);
+            str += run;
+            count -= run;
 
         // 2-byte sequence
         } else if ((lead & 0xE0) == 0xC0) {
@@ -650,6 +766,237 @@ bool mpack_str_check_no_null(const char* str, size_t bytes) {
     return true;
 }
 
+#define MPACK_TD(type, header, width, fixed) {(uint8_t)mpack_type_##type, header, width, fixed}
+#define MPACK_TD_EXT(header, width, fixed) {MPACK_TAG_DESC_EXT, header, width, fixed}
+
+// sixteen single byte tags storing consecutive values from first
+#define MPACK_TD_FIX16(type, first) \
+    MPACK_TD(type, 1, 0, (first) + 0x0), MPACK_TD(type, 1, 0, (first) + 0x1), \
+    MPACK_TD(type, 1, 0, (first) + 0x2), MPACK_TD(type, 1, 0, (first) + 0x3), \
+    MPACK_TD(type, 1, 0, (first) + 0x4), MPACK_TD(type, 1, 0, (first) + 0x5), \
+    MPACK_TD(type, 1, 0, (first) + 0x6), MPACK_TD(type, 1, 0, (first) + 0x7), \
+    MPACK_TD(type, 1, 0, (first) + 0x8), MPACK_TD(type, 1, 0, (first) + 0x9), \
+    MPACK_TD(type, 1, 0, (first) + 0xa), MPACK_TD(type, 1, 0, (first) + 0xb), \
+    MPACK_TD(type, 1, 0, (first) + 0xc), MPACK_TD(type, 1, 0, (first) + 0xd), \
+    MPACK_TD(type, 1, 0, (first) + 0xe), MPACK_TD(type, 1, 0, (first) + 0xf)
+
+const mpack_tag_desc_t mpack_tag_descs[256] = {
+    // 0x00 - 0x7f: positive fixint
+    MPACK_TD_FIX16(uint, 0x00), MPACK_TD_FIX16(uint, 0x10), MPACK_TD_FIX16(uint, 0x20), MPACK_TD_FIX16(uint, 0x30),
+    MPACK_TD_FIX16(uint, 0x40), MPACK_TD_FIX16(uint, 0x50), MPACK_TD_FIX16(uint, 0x60), MPACK_TD_FIX16(uint, 0x70),
+
+    // 0x80 - 0x8f: fixmap
+    MPACK_TD_FIX16(map, 0),
+
+    // 0x90 - 0x9f: fixarray
+    MPACK_TD_FIX16(array, 0),
+
+    // 0xa0 - 0xbf: fixstr
+    MPACK_TD_FIX16(str, 0), MPACK_TD_FIX16(str, 16),
+
+    // 0xc0 - 0xc3: nil, reserved, false, true
+    MPACK_TD(nil, 1, 0, 0), MPACK_TD(missing, 1, 0, 0), MPACK_TD(bool, 1, 0, 0), MPACK_TD(bool, 1, 0, 1),
+
+    // 0xc4 - 0xc6: bin8, bin16, bin32
+    MPACK_TD(bin, 2, 1, 0), MPACK_TD(bin, 3, 2, 0), MPACK_TD(bin, 5, 4, 0),
+
+    // 0xc7 - 0xc9: ext8, ext16, ext32 (the exttype follows the length)
+    MPACK_TD_EXT(3, 1, 0), MPACK_TD_EXT(4, 2, 0), MPACK_TD_EXT(6, 4, 0),
+
+    // 0xca - 0xcb: float, double
+    MPACK_TD(float, 5, 4, 0), MPACK_TD(double, 9, 8, 0),
+
+    // 0xcc - 0xcf: uint8, uint16, uint32, uint64
+    MPACK_TD(uint, 2, 1, 0), MPACK_TD(uint, 3, 2, 0), MPACK_TD(uint, 5, 4, 0), MPACK_TD(uint, 9, 8, 0),
+
+    // 0xd0 - 0xd3: int8, int16, int32, int64
+    MPACK_TD(int, 2, 1, 0), MPACK_TD(int, 3, 2, 0), MPACK_TD(int, 5, 4, 0), MPACK_TD(int, 9, 8, 0),
+
+    // 0xd4 - 0xd8: fixext1, fixext2, fixext4, fixext8, fixext16
+    MPACK_TD_EXT(2, 0, 1), MPACK_TD_EXT(2, 0, 2), MPACK_TD_EXT(2, 0, 4), MPACK_TD_EXT(2, 0, 8), MPACK_TD_EXT(2, 0, 16),
+
+    // 0xd9 - 0xdb: str8, str16, str32
+    MPACK_TD(str, 2, 1, 0), MPACK_TD(str, 3, 2, 0), MPACK_TD(str, 5, 4, 0),
+
+    // 0xdc - 0xdf: array16, array32, map16, map32
+    MPACK_TD(array, 3, 2, 0), MPACK_TD(array, 5, 4, 0), MPACK_TD(map, 3, 2, 0), MPACK_TD(map, 5, 4, 0),
+
+    // 0xe0 - 0xff: negative fixint
+    MPACK_TD_FIX16(int, 0xe0), MPACK_TD_FIX16(int, 0xf0),
+};
+
+#undef MPACK_TD
+#undef MPACK_TD_EXT
+#undef MPACK_TD_FIX16
+
+mpack_error_t mpack_scan(mpack_scan_t* scan, const char* data, size_t length, bool extensions, size_t* used) {
+    #if MPACK_EXTENSIONS
+    MPACK_STATIC_ASSERT(MPACK_TAG_DESC_EXT == (uint8_t)mpack_type_ext, "ext descriptors have the wrong type");
+    #endif
+
+    const char* p = data;
+    const char* end = data + length;
+
+    // finish skipping the payload of the previous element
+    size_t skip = (scan->skip < length) ? scan->skip : length;
+    scan->skip -= skip;
+    scan->need = 0;
+    *used = skip;
+    if (scan->skip > 0)
+        return mpack_ok;
+    p += skip;
+
+    uint64_t left = scan->left;
+    while (left > 0) {
+        if (p == end) {
+            scan->need = 1;
+            break;
+        }
+
+        // the fix types are checked by range since they are by far the most
+        // common. the rest are decoded through their descriptors.
+        uint8_t type = (uint8_t)*p;
+        size_t header = 1;
+        size_t bytes = 0;
+        uint64_t children = 0;
+
+        if (type <= 0x7f || type >= 0xe0) {
+            // fixints
+        } else if (type <= 0x8f) {
+            children = 2 * (uint64_t)(type & 0xf);
+        } else if (type <= 0x9f) {
+            children = type & 0xf;
+        } else if (type <= 0xbf) {
+            bytes = type & 0x1f;
+        } else {
+            const mpack_tag_desc_t* desc = &mpack_tag_descs[type];
+            if (desc->type == mpack_type_missing)
+                return mpack_error_invalid;
+            if (desc->type == MPACK_TAG_DESC_EXT && !extensions)
+                return mpack_error_unsupported;
+
+            header = desc->header;
+            if (header > (size_t)(end - p)) {
+                scan->need = header;
+                break;
+            }
+
+            uint64_t value = mpack_tag_desc_value(desc, p, (size_t)(end - p));
+            switch (desc->type) {
+                case mpack_type_str: case mpack_type_bin: case MPACK_TAG_DESC_EXT:
+                    bytes = (size_t)value;
+                    break;
+                case mpack_type_array:
+                    children = value;
+                    break;
+                case mpack_type_map:
+                    children = 2 * value;
+                    break;
+                default:
+                    break;
+            }
+        }
+
+        left = left - 1 + children;
+        p += header;
+        if (bytes > (size_t)(end - p)) {
+            scan->skip = bytes - (size_t)(end - p);
+            p = end;
+            break;
+        }
+        p += bytes;
+    }
+
+    scan->left = left;
+    *used = (size_t)(p - data);
+    return mpack_ok;
+}
+
+mpack_error_t mpack_validate(const char* data, size_t length, const mpack_validate_limits_t* limits) {
+    mpack_validate_limits_t none;
+    if (limits == NULL) {
+        mpack_memset(&none, 0, sizeof(none));
+        none.extensions = true;
+        limits = &none;
+    }
+
+    size_t max_depth = limits->max_depth;
+    if (max_depth == 0 || max_depth > MPACK_VALIDATE_MAX_DEPTH)
+        max_depth = MPACK_VALIDATE_MAX_DEPTH;
+    uint64_t max_length = (limits->max_length != 0) ? limits->max_length : UINT64_MAX;
+    uint64_t elements = (limits->max_elements != 0) ? limits->max_elements : UINT64_MAX;
+    if (limits->max_size != 0 && length > limits->max_size)
+        return mpack_error_too_big;
+
+    // the elements left in each open map or array, excluding the innermost
+    // one which is in left
+    uint64_t stack[MPACK_VALIDATE_MAX_DEPTH];
+    size_t depth = 0;
+    uint64_t left = 1;
+
+    const char* p = data;
+    const char* end = data + length;
+    while (true) {
+        while (left == 0) {
+            if (depth == 0)
+                return (p == end) ? mpack_ok : mpack_error_invalid;
+            left = stack[--depth];
+        }
+        if (p == end)
+            return mpack_error_eof;
+        if (elements-- == 0)
+            return mpack_error_too_big;
+        --left;
+
+        // fixints are by far the most common and have nothing to check
+        uint8_t type = (uint8_t)*p;
+        if (type <= 0x7f || type >= 0xe0) {
+            ++p;
+            continue;
+        }
+
+        const mpack_tag_desc_t* desc = &mpack_tag_descs[type];
+        if (desc->type == mpack_type_missing)
+            return mpack_error_invalid;
+        if (desc->type == MPACK_TAG_DESC_EXT && !limits->extensions)
+            return mpack_error_unsupported;
+        size_t available = (size_t)(end - p);
+        if (desc->header > available)
+            return mpack_error_eof;
+        uint64_t value = mpack_tag_desc_value(desc, p, available);
+        p += desc->header;
+
+        switch (desc->type) {
+            case mpack_type_str:
+            case mpack_type_bin:
+            case MPACK_TAG_DESC_EXT:
+                if (value > max_length)
+                    return mpack_error_too_big;
+                if (value > (uint64_t)(end - p))
+                    return mpack_error_eof;
+                if (desc->type == mpack_type_str && limits->utf8 && !mpack_utf8_check(p, (size_t)value))
+                    return mpack_error_invalid;
+                p += value;
+                break;
+
+            case mpack_type_array:
+            case mpack_type_map:
+                if (value > max_length)
+                    return mpack_error_too_big;
+                if (value == 0)
+                    break;
+                if (depth == max_depth)
+                    return mpack_error_too_big;
+                stack[depth++] = left;
+                left = (desc->type == mpack_type_map) ? value * 2 : value;
+                break;
+
+            default:
+                break;
+        }
+    }
+}
+
 #if MPACK_DEBUG && MPACK_STDIO
 void mpack_print_append(mpack_print_t* print, const char* data, size_t count) {
 
@@ -169,6 +169,7 @@ typedef enum mpack_error_t {
     mpack_error_bug,     /**< The MPack API was used incorrectly. (This will always assert in debug mode.) */
     mpack_error_data,    /**< The contained data is not valid. */
     mpack_error_eof,     /**< The reader failed to read because of file or socket EOF */
+    mpack_error_would_block, /**< The reader's source has no data available yet. (See mpack_reader_checkpoint().) */
 } mpack_error_t;
 
 /**
@@ -1030,6 +1031,217 @@ MPACK_INLINE void mpack_store_double(char* p, double value) {
 
 
 
+#ifdef MPACK_MALLOC
+/**
+ * @name Allocators
+ * @{
+ */
+
+/**
+ * A custom memory allocator.
+ *
+ * An allocator can be attached to a tree, reader or writer with
+ * mpack_tree_set_allocator(), mpack_reader_set_allocator() or
+ * mpack_writer_set_allocator(). All memory it allocates from then on comes
+ * from the allocator instead of @ref MPACK_MALLOC. This allows for example
+ * a request arena to own all memory used to parse or encode a message.
+ *
+ * Only @p alloc_fn is required:
+ *
+ * - If @p realloc_fn is NULL, memory is grown by allocating a new block,
+ *   copying the used bytes and freeing the old block.
+ * - If @p free_fn is NULL, memory is never freed individually. This is
+ *   suitable for an arena that releases all of its memory at once.
+ *
+ * An allocator with a NULL @p alloc_fn uses @ref MPACK_MALLOC, @ref
+ * MPACK_REALLOC and @ref MPACK_FREE.
+ *
+ * @note This requires @ref MPACK_MALLOC.
+ */
+typedef struct mpack_allocator_t {
+
+    /** Allocates @p size bytes, returning NULL on failure. */
+    void* (*alloc_fn)(void* context, size_t size);
+
+    /**
+     * Resizes a block to @p new_size bytes, returning NULL on failure. Only
+     * the first @p used_size bytes of the block need to be preserved.
+     */
+    void* (*realloc_fn)(void* context, void* ptr, size_t used_size, size_t new_size);
+
+    /** Frees a block. */
+    void (*free_fn)(void* context, void* ptr);
+
+    /** The context passed to the allocator functions. */
+    void* context;
+
+} mpack_allocator_t;
+
+/**
+ * @}
+ */
+
+#if MPACK_INTERNAL
+/** @cond */
+/* Allocation through an optional allocator; a NULL allocator or NULL */
+/* alloc_fn uses MPACK_MALLOC */
+void* mpack_allocator_alloc(const mpack_allocator_t* allocator, size_t size);
+void* mpack_allocator_realloc(const mpack_allocator_t* allocator, void* ptr, size_t used_size, size_t new_size);
+void mpack_allocator_free(const mpack_allocator_t* allocator, void* ptr);
+/** @endcond */
+#endif
+#endif
+
+
+
+#if MPACK_STATS
+/**
+ * @name Statistics
+ * @{
+ */
+
+/**
+ * Statistics counters for a reader, writer or tree.
+ *
+ * These count the work done behind the scenes by the buffering of a reader,
+ * writer or tree, which can help tune buffer sizes and limits. Query them
+ * with mpack_reader_stats(), mpack_writer_stats() or mpack_tree_stats(),
+ * and reset them with the corresponding reset function.
+ *
+ * Counters that do not apply to a given object are always zero.
+ *
+ * @note This requires @ref MPACK_STATS.
+ */
+typedef struct mpack_stats_t {
+
+    /** Calls to the fill function of a reader or the read function of a tree. */
+    size_t fills;
+
+    /** Calls to the flush function of a writer. */
+    size_t flushes;
+
+    /** Bytes received from fills or passed to flushes. */
+    size_t bytes;
+
+    /**
+     * Bytes moved or copied within buffers to make room for more data,
+     * including the used bytes of buffers being grown (even if the
+     * reallocation doesn't need to copy them.)
+     */
+    size_t bytes_copied;
+
+    /** Allocations to grow a buffer or parsing stack. */
+    size_t growths;
+
+    /** Node pages allocated by a tree or builder pages allocated by a writer. */
+    size_t pages;
+
+    /**
+     * Bytes saved by a writer by writing doubles in a smaller exact
+     * encoding. See mpack_writer_set_compact_doubles().
+     */
+    size_t bytes_saved;
+
+    /** Messages parsed by a tree. */
+    size_t messages;
+
+    /** Nodes in the messages parsed by a tree. */
+    size_t nodes;
+
+    /** The deepest nesting of compound types parsed by a tree. */
+    size_t max_depth;
+
+} mpack_stats_t;
+
+/**
+ * @}
+ */
+
+#if MPACK_INTERNAL
+/** @cond */
+#define mpack_stats_add(stats, field, count) ((void)((stats)->field += (count)))
+#define mpack_stats_max(stats, field, value) \
+    ((void)((stats)->field < (value) ? ((stats)->field = (value)) : 0))
+/** @endcond */
+#endif
+#elif MPACK_INTERNAL
+/** @cond */
+#define mpack_stats_add(stats, field, count) ((void)0)
+#define mpack_stats_max(stats, field, value) ((void)0)
+/** @endcond */
+#endif
+
+
+
+/**
+ * @name Validation
+ * @{
+ */
+
+/**
+ * Limits on the messages accepted by mpack_validate().
+ *
+ * A limit of zero means no limit, so an all-zero struct accepts any well
+ * formed message without ext types up to @ref MPACK_VALIDATE_MAX_DEPTH deep.
+ */
+typedef struct mpack_validate_limits_t {
+
+    /**
+     * The maximum nesting depth of maps and arrays. This cannot exceed @ref
+     * MPACK_VALIDATE_MAX_DEPTH.
+     */
+    size_t max_depth;
+
+    /** The maximum total number of elements, counting map keys and values separately. */
+    size_t max_elements;
+
+    /** The maximum size of the message in bytes. */
+    size_t max_size;
+
+    /**
+     * The maximum length of a str, bin or ext, and the maximum number of
+     * elements of an array or pairs of a map.
+     */
+    size_t max_length;
+
+    /** Whether strings must be valid UTF-8. */
+    bool utf8;
+
+    /** Whether ext types are allowed. */
+    bool extensions;
+
+} mpack_validate_limits_t;
+
+/**
+ * Checks that the given data is exactly one well formed message within the
+ * given limits, without parsing it or allocating memory.
+ *
+ * This makes a single pass over the data that is much cheaper than parsing
+ * a tree or reading with tracking. It can be used to validate untrusted data
+ * on arrival so that it can then be read without checking every element.
+ *
+ * @param data The data to validate.
+ * @param length The length of the message in bytes.
+ * @param limits The limits to check, or NULL to apply no limits (and allow
+ *     ext types.)
+ *
+ * @return mpack_ok if the data is valid, or:
+ *     - @ref mpack_error_eof if the data ends before the message is complete;
+ *     - @ref mpack_error_invalid if the message contains an invalid type
+ *       byte, is followed by more data or (if checked) contains a string
+ *       that is not valid UTF-8;
+ *     - @ref mpack_error_unsupported if the message contains an ext type but
+ *       they are not allowed;
+ *     - @ref mpack_error_too_big if the message exceeds a limit.
+ */
+mpack_error_t mpack_validate(const char* data, size_t length, const mpack_validate_limits_t* limits);
+
+/**
+ * @}
+ */
+
+
+
 #if MPACK_READ_TRACKING || MPACK_WRITE_TRACKING
 /* Tracks the write state of compound elements (maps, arrays, */
 /* strings, binary blobs and extension types) */
@@ -1043,19 +1255,26 @@ typedef struct mpack_track_element_t {
     // read/written key. left is not decremented until both key and value are
     // read/written.
     bool key_needs_value;
+
+    // indicates that the element is a map or array being written by a
+    // builder, so its number of elements is not known. left is unused.
+    bool builder;
 } mpack_track_element_t;
 
 typedef struct mpack_track_t {
     size_t count;
     size_t capacity;
     mpack_track_element_t* elements;
+    const mpack_allocator_t* allocator;
 } mpack_track_t;
 
 #if MPACK_INTERNAL
-mpack_error_t mpack_track_init(mpack_track_t* track);
+mpack_error_t mpack_track_init(mpack_track_t* track, const mpack_allocator_t* allocator);
 mpack_error_t mpack_track_grow(mpack_track_t* track);
 mpack_error_t mpack_track_push(mpack_track_t* track, mpack_type_t type, uint32_t count);
 mpack_error_t mpack_track_pop(mpack_track_t* track, mpack_type_t type);
+mpack_error_t mpack_track_push_builder(mpack_track_t* track, mpack_type_t type);
+mpack_error_t mpack_track_pop_builder(mpack_track_t* track, mpack_type_t type);
 mpack_error_t mpack_track_element(mpack_track_t* track, bool read);
 mpack_error_t mpack_track_peek_element(mpack_track_t* track, bool read);
 mpack_error_t mpack_track_bytes(mpack_track_t* track, bool read, size_t count);
@@ -1093,6 +1312,103 @@ bool mpack_str_check_no_null(const char* str, size_t bytes);
 
 
 
+/* Tag descriptors */
+
+/*
+ * The descriptor type of the ext type bytes. This is mpack_type_ext if @ref
+ * MPACK_EXTENSIONS is enabled.
+ */
+#define MPACK_TAG_DESC_EXT ((uint8_t)mpack_type_map + 1)
+
+/*
+ * Describes how to decode the tag starting with a given type byte.
+ *
+ * The value, length or count of the tag (the length of the payload of a str,
+ * bin or ext, the number of elements or pairs of an array or map, or the
+ * number itself) is the big-endian integer of width bytes that follows the
+ * type byte. If width is zero it is fixed instead, which holds the value
+ * stored in the type byte of fix types and the payload length of fixexts.
+ */
+typedef struct mpack_tag_desc_t {
+    uint8_t type;   // the mpack_type_t of the tag, MPACK_TAG_DESC_EXT, or mpack_type_missing if reserved
+    uint8_t header; // the size of the tag in bytes, including the type byte
+    uint8_t width;  // the width in bytes of the value, length or count, or zero
+    uint8_t fixed;  // the value, length or count if width is zero
+} mpack_tag_desc_t;
+
+/*
+ * The descriptors of all type bytes, shared by the reader, the tree parser
+ * and mpack_scan().
+ */
+extern const mpack_tag_desc_t mpack_tag_descs[256];
+
+/*
+ * Returns the value, length or count of the tag with the given descriptor
+ * starting at the given data, which must contain the whole tag.
+ *
+ * If at least MPACK_TAG_DESC_LOAD_SIZE bytes are available, the value is
+ * loaded without branching on its width (the mixed widths of numbers would
+ * otherwise mispredict.) The bytes past the tag are read but not used.
+ */
+#define MPACK_TAG_DESC_LOAD_SIZE 9
+
+MPACK_INLINE uint64_t mpack_tag_desc_value(const mpack_tag_desc_t* desc, const char* data, size_t available) {
+    if (available >= MPACK_TAG_DESC_LOAD_SIZE) {
+        uint64_t loaded = mpack_load_u64(data + 1) >> (((8u - desc->width) & 7u) * 8u);
+        return (desc->width != 0) ? loaded : desc->fixed;
+    }
+
+    switch (desc->width) {
+        case 0: return desc->fixed;
+        case 1: return mpack_load_u8(data + 1);
+        case 2: return mpack_load_u16(data + 1);
+        case 4: return mpack_load_u32(data + 1);
+        default: return mpack_load_u64(data + 1);
+    }
+}
+
+/*
+ * Sign-extends the value of an int tag with the given descriptor. The value
+ * of a negative fixint is its type byte.
+ */
+MPACK_INLINE int64_t mpack_tag_desc_int(const mpack_tag_desc_t* desc, uint64_t value) {
+    uint64_t sign = (uint64_t)1 << (((desc->width == 0) ? 8 : desc->width * 8) - 1);
+    return (int64_t)((value ^ sign) - sign);
+}
+
+/* Structure scanning */
+
+/**
+ * The state of a scan over the structure of MessagePack elements. See
+ * mpack_scan().
+ */
+typedef struct mpack_scan_t {
+    uint64_t left; // elements left to scan
+    size_t skip;   // bytes left in the payload of the last scanned element
+    size_t need;   // bytes needed for the next element's header, if data ran out
+} mpack_scan_t;
+
+/**
+ * Skips over as many elements as possible in the given data without tracking
+ * or checking their contents.
+ *
+ * Only a count of the elements left is kept rather than a nesting depth, so
+ * whole subtrees are skipped in a single loop. The scan stops when no
+ * elements are left or the data runs out, in which case either the rest of
+ * a payload must be skipped or more data is needed for a header. The scan
+ * can then be continued with data that follows.
+ *
+ * @param scan The scan state, updated with the elements and bytes left.
+ * @param data The data to scan.
+ * @param length The length of the data.
+ * @param extensions Whether ext types are allowed. If not, they flag
+ *        mpack_error_unsupported.
+ * @param used The number of bytes scanned is placed here.
+ */
+mpack_error_t mpack_scan(mpack_scan_t* scan, const char* data, size_t length, bool extensions, size_t* used);
+
+
+
 /** @endcond */
 #endif
 
@@ -73,6 +73,118 @@
 #define MPACK_WRITER 1
 #endif
 
+/**
+ * @def MPACK_CODEC
+ *
+ * Enables compilation of the Struct Codec API.
+ *
+ * This requires @ref MPACK_MALLOC. Reading structs requires @ref MPACK_EXPECT
+ * and writing them requires @ref MPACK_WRITER.
+ */
+#ifndef MPACK_CODEC
+#define MPACK_CODEC 1
+#endif
+
+/**
+ * @def MPACK_JSON
+ *
+ * Enables compilation of the JSON transcoder.
+ *
+ * This requires @ref MPACK_READER and @ref MPACK_STDIO.
+ */
+#ifndef MPACK_JSON
+#define MPACK_JSON 1
+#endif
+
+/**
+ * The maximum nesting depth of maps and arrays transcoded by
+ * mpack_json_transcode(). Deeper elements flag @ref mpack_error_too_big.
+ *
+ * The transcoder recurses into maps and arrays, so this bounds the amount of
+ * stack it uses.
+ */
+#ifndef MPACK_JSON_MAX_DEPTH
+#define MPACK_JSON_MAX_DEPTH 256
+#endif
+
+/**
+ * @def MPACK_QUERY
+ *
+ * Enables compilation of path queries over the Reader API.
+ *
+ * This requires @ref MPACK_READER.
+ */
+#ifndef MPACK_QUERY
+#define MPACK_QUERY 1
+#endif
+
+/**
+ * The maximum total number of steps in all paths of a path query. See
+ * mpack_query_compile().
+ *
+ * The steps are stored inline in each @ref mpack_query_t.
+ */
+#ifndef MPACK_QUERY_MAX_STEPS
+#define MPACK_QUERY_MAX_STEPS 64
+#endif
+
+/**
+ * @def MPACK_FRAME
+ *
+ * Enables compilation of framed compression adapters for the writer, reader
+ * and tree (see @ref frame.) The compression algorithm (e.g. LZ4 or zstd) is
+ * supplied by the application as a @ref mpack_frame_codec_t.
+ *
+ * The adapters require @ref MPACK_MALLOC.
+ */
+#ifndef MPACK_FRAME
+#define MPACK_FRAME 1
+#endif
+
+/**
+ * The default target size in bytes of the uncompressed data in each frame
+ * written by mpack_writer_init_frame().
+ */
+#ifndef MPACK_FRAME_SIZE
+#define MPACK_FRAME_SIZE 65536
+#endif
+
+/**
+ * The maximum size in bytes of the uncompressed data in a frame.
+ *
+ * Frames whose header claims a larger size are rejected with @ref
+ * mpack_error_too_big rather than allocating a buffer for them, and writing
+ * a larger frame (a single message larger than this) flags the same error.
+ * This cannot be larger than UINT32_MAX.
+ */
+#ifndef MPACK_FRAME_MAX_SIZE
+#define MPACK_FRAME_MAX_SIZE (64 * 1024 * 1024)
+#endif
+
+/**
+ * @def MPACK_PATCH
+ *
+ * Enables compilation of patches, which edit a parsed tree and write it out
+ * again without re-encoding the parts that did not change (see @ref patch.)
+ *
+ * Patches require @ref MPACK_NODE_SPANS, @ref MPACK_WRITER and @ref
+ * MPACK_MALLOC.
+ */
+#ifndef MPACK_PATCH
+#define MPACK_PATCH 1
+#endif
+
+/**
+ * The maximum depth of maps and arrays containing an edit that can be
+ * written by mpack_patch_write(). Deeper edits flag @ref mpack_error_too_big.
+ *
+ * The patch writer recurses into the maps and arrays that contain edits, so
+ * this bounds the amount of stack it uses.
+ */
+#ifndef MPACK_PATCH_MAX_DEPTH
+#define MPACK_PATCH_MAX_DEPTH 256
+#endif
+
 /**
  * @def MPACK_COMPATIBILITY
  *
@@ -146,6 +258,35 @@
 #define MPACK_STDIO 1
 #endif
 
+/**
+ * @def MPACK_FD
+ *
+ * Enables helpers for reading and writing POSIX file descriptors directly
+ * (see mpack_reader_init_fd(), mpack_writer_init_fd() and
+ * mpack_tree_init_fd().) These call read(), writev() and lseek() on the
+ * descriptor with a buffer of configurable size, avoiding the second layer
+ * of buffering of a libc FILE. They work with files, pipes and sockets.
+ *
+ * This requires @ref MPACK_MALLOC and a POSIX system. The helpers use
+ * posix_fadvise(), which C libraries may hide in strict ISO C modes (e.g.
+ * -std=c99.) In that case you must define _POSIX_C_SOURCE to at least
+ * 200112L when compiling MPack.
+ */
+#ifndef MPACK_FD
+#define MPACK_FD 0
+#endif
+
+/**
+ * The default size of the buffer allocated by mpack_reader_init_fd() and
+ * mpack_writer_init_fd() when no size is given.
+ *
+ * This is larger than @ref MPACK_BUFFER_SIZE since each refill or flush of
+ * these buffers is a system call.
+ */
+#ifndef MPACK_FD_BUFFER_SIZE
+#define MPACK_FD_BUFFER_SIZE 65536
+#endif
+
 /**
  * @}
  */
@@ -277,6 +418,21 @@
 #define MPACK_WRITE_TRACKING 1
 #endif
 
+/**
+ * Enables statistics counters for readers, writers and trees.
+ *
+ * When enabled, each reader, writer and tree counts calls to its fill or
+ * flush function, bytes moved or copied within its buffers, buffer growths
+ * and page allocations, and trees also count the messages, nodes and depth
+ * they parse. See @ref mpack_stats_t.
+ *
+ * This is disabled by default since it adds a bit of work to fills,
+ * flushes and parsing.
+ */
+#ifndef MPACK_STATS
+#define MPACK_STATS 0
+#endif
+
 /**
  * @}
  */
@@ -337,6 +493,9 @@
  * Using as many nodes fit in one memory page seems to provide the
  * best performance, and has very little waste when parsing small
  * messages.
+ *
+ * This is the default. The page size of a tree can be changed with
+ * mpack_tree_set_page_size().
  */
 #ifndef MPACK_NODE_PAGE_SIZE
 #define MPACK_NODE_PAGE_SIZE 4096
@@ -358,6 +517,220 @@
 #define MPACK_NODE_MAX_DEPTH_WITHOUT_MALLOC 32
 #endif
 
+/**
+ * The maximum nesting depth of maps and arrays accepted by mpack_validate().
+ * Deeper elements flag @ref mpack_error_too_big, and a smaller depth can be
+ * set in its limits.
+ *
+ * The validator does not allocate; it keeps 8 bytes per level of depth on
+ * the call stack.
+ */
+#ifndef MPACK_VALIDATE_MAX_DEPTH
+#define MPACK_VALIDATE_MAX_DEPTH 256
+#endif
+
+/**
+ * Enables memory-mapping files in mpack_tree_init_filename() and
+ * mpack_tree_init_stdfile().
+ *
+ * When enabled, regular files are mapped read-only (with mmap() on POSIX
+ * systems or MapViewOfFile() on Windows) and the tree parses directly from
+ * the mapped pages instead of reading the whole file into an allocated
+ * buffer. The file is unmapped when the tree is destroyed. Files that cannot
+ * be mapped (such as pipes or stdin) are read as usual.
+ *
+ * This requires @ref MPACK_STDIO. Note that the file must not be truncated
+ * while the tree is in use.
+ *
+ * On POSIX systems this uses fileno() and posix_madvise(), which C libraries
+ * may hide in strict ISO C modes (e.g. -std=c99.) In that case you must
+ * define _POSIX_C_SOURCE to at least 200112L when compiling MPack.
+ */
+#ifndef MPACK_MMAP
+#define MPACK_MMAP 0
+#endif
+
+/**
+ * Enables a compact node layout for the Node API.
+ *
+ * When enabled, each @ref mpack_node_data_t is 8 bytes instead of 16. The
+ * type and length are packed into a single 32-bit word, and the value is
+ * stored in 32 bits: small scalars are stored inline, and children are
+ * referenced by a 32-bit node index rather than a pointer. Integers that
+ * don't fit in 32 bits and doubles are instead read from the message data
+ * when accessed. The Node API is otherwise unchanged.
+ *
+ * This halves the memory used by parsed trees and fits twice as many nodes
+ * in each cache line, at the cost of a small amount of work in accessors.
+ * Note that a message parsed this way must be smaller than 4 GiB and
+ * strings, binary blobs, arrays and maps must have fewer than 2^28 elements
+ * or bytes; otherwise @ref mpack_error_too_big is flagged.
+ *
+ * This is not compatible with @ref MPACK_NODE_MAP_INDEX, which is disabled
+ * by default when this is enabled.
+ */
+#ifndef MPACK_NODE_COMPACT
+#define MPACK_NODE_COMPACT 0
+#endif
+
+/**
+ * Enables hash indices for map lookups in the Node API.
+ *
+ * When enabled, maps with at least @ref MPACK_NODE_MAP_INDEX_THRESHOLD
+ * key/value pairs get a hash table of their keys the first time a key is
+ * looked up (or when the tree is parsed, see
+ * mpack_tree_set_eager_map_index().) Repeated lookups in large maps then run
+ * in constant time rather than scanning all keys.
+ *
+ * The index is stored in the tree's node pages, so this requires @ref
+ * MPACK_MALLOC, and it is not used for trees parsed into a fixed node pool.
+ * If the index cannot be allocated, lookups silently fall back to a linear
+ * search.
+ *
+ * This is disabled by default when @ref MPACK_NODE_COMPACT is enabled.
+ */
+#ifndef MPACK_NODE_MAP_INDEX
+#if MPACK_NODE_COMPACT
+#define MPACK_NODE_MAP_INDEX 0
+#else
+#define MPACK_NODE_MAP_INDEX 1
+#endif
+#endif
+
+/**
+ * The minimum number of key/value pairs a map must have to be given a hash
+ * index. Smaller maps are searched linearly. See @ref MPACK_NODE_MAP_INDEX.
+ */
+#ifndef MPACK_NODE_MAP_INDEX_THRESHOLD
+#define MPACK_NODE_MAP_INDEX_THRESHOLD 16
+#endif
+
+/**
+ * Enables lazy parsing of deeply nested maps and arrays in the Node API.
+ *
+ * When enabled, a tree can be given a lazy depth with
+ * mpack_tree_set_lazy_depth(). Maps and arrays nested that deep are only
+ * scanned for their size when the message is parsed. Their contents are
+ * parsed into nodes the first time they are accessed.
+ */
+#ifndef MPACK_NODE_LAZY
+#define MPACK_NODE_LAZY 1
+#endif
+
+/**
+ * Enables key interning in the Node API.
+ *
+ * When enabled, an intern table (see mpack_intern_init()) can be attached to
+ * trees with mpack_tree_set_intern(). Map keys are then given small integer
+ * IDs while parsing, and values can be looked up by ID with
+ * mpack_node_map_key_id().
+ *
+ * This requires @ref MPACK_MALLOC.
+ */
+#ifndef MPACK_NODE_INTERN
+#define MPACK_NODE_INTERN 1
+#endif
+
+/**
+ * Enables tracking the source bytes of each node in the Node API.
+ *
+ * When enabled, each node records the offset in the message data at which
+ * it starts. This allows mpack_node_bytes() to return the encoded bytes of
+ * any node, and mpack_write_node() to forward a parsed subtree to a writer
+ * verbatim without re-encoding it.
+ *
+ * This adds 4 bytes to each @ref mpack_node_data_t if @ref
+ * MPACK_NODE_COMPACT is enabled, or the size of a pointer otherwise.
+ */
+#ifndef MPACK_NODE_SPANS
+#define MPACK_NODE_SPANS 0
+#endif
+
+/**
+ * The maximum number of borrowed writes a writer can hold until its next
+ * flush. See mpack_write_bytes_borrowed().
+ *
+ * Borrowed data is flushed through the writer's vectored flush function,
+ * and each one adds up to two spans to the flush. When this many are
+ * pending, the writer is flushed before another can be accepted.
+ */
+#ifndef MPACK_WRITER_BORROWED_MAX
+#define MPACK_WRITER_BORROWED_MAX 8
+#endif
+
+/**
+ * The maximum size in bytes of a chunk of a chunked writer. See
+ * mpack_writer_init_chunked().
+ *
+ * The first chunk is @ref MPACK_BUFFER_SIZE bytes and each following chunk
+ * doubles in size up to this limit, so a message of n bytes takes O(log n)
+ * chunks until it reaches it. Set this to @ref MPACK_BUFFER_SIZE to use
+ * fixed-size chunks.
+ */
+#ifndef MPACK_WRITER_CHUNK_MAX_SIZE
+#define MPACK_WRITER_CHUNK_MAX_SIZE (1024 * 1024)
+#endif
+
+/**
+ * The maximum size in bytes of the encoded data of a @ref mpack_token_t.
+ *
+ * Each token stores this many bytes inline and is copied into the writer
+ * with a single fixed-size copy. The default makes a token 32 bytes, which
+ * fits map keys of up to 29 characters.
+ */
+#ifndef MPACK_TOKEN_SIZE
+#define MPACK_TOKEN_SIZE 30
+#endif
+
+/**
+ * Enables a first builder page stored inside the mpack_writer_t, sized by
+ * @ref MPACK_BUILDER_INTERNAL_STORAGE_SIZE. Builds that fit in it do not
+ * allocate memory at all. Without @ref MPACK_MALLOC, builds that do not fit
+ * in it flag @ref mpack_error_too_big.
+ *
+ * This is disabled by default since it makes the writer larger.
+ */
+#ifndef MPACK_BUILDER_INTERNAL_STORAGE
+#define MPACK_BUILDER_INTERNAL_STORAGE 0
+#endif
+
+/**
+ * @def MPACK_BUILDER
+ *
+ * Enables the builder API in the Writer for maps and arrays whose number of
+ * elements is not known in advance. See mpack_build_map() and
+ * mpack_build_array().
+ *
+ * The contents of builds are written into builder pages and the smallest
+ * correct headers are emitted when the outermost build is completed. This
+ * requires @ref MPACK_MALLOC unless @ref MPACK_BUILDER_INTERNAL_STORAGE is
+ * enabled, and it is enabled by default if either is available.
+ */
+#ifndef MPACK_BUILDER
+#if defined(MPACK_MALLOC) || MPACK_BUILDER_INTERNAL_STORAGE
+#define MPACK_BUILDER 1
+#else
+#define MPACK_BUILDER 0
+#endif
+#endif
+
+/**
+ * The size in bytes of the builder's internal storage. See
+ * @ref MPACK_BUILDER_INTERNAL_STORAGE.
+ */
+#ifndef MPACK_BUILDER_INTERNAL_STORAGE_SIZE
+#define MPACK_BUILDER_INTERNAL_STORAGE_SIZE 256
+#endif
+
+/**
+ * The size in bytes of allocated builder pages. Builds that overflow a page
+ * continue in another page; pages are kept for reuse by later builds until
+ * the writer is destroyed.
+ */
+#ifndef MPACK_BUILDER_PAGE_SIZE
+#define MPACK_BUILDER_PAGE_SIZE 4096
+#endif
+
 /**
  * Whether to support reading/writing doubles (disable on 8-bit microcontrollers).
  */
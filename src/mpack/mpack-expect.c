@@ -409,6 +409,119 @@ bool mpack_expect_array_max_or_nil(mpack_reader_t* reader, uint32_t max_count, u
     return has_array;
 }
 
+// Consumes the longest run of at most count elements at the start of the
+// buffer whose type bytes match the given type under the given mask and
+// which all have the given encoded size. The run is returned so it can be
+// decoded in bulk, and its length is placed in run.
+static const char* mpack_expect_array_run(mpack_reader_t* reader, size_t count,
+        uint8_t type, uint8_t mask, size_t size, size_t* run)
+{
+    const char* p = reader->data;
+    size_t available = (size_t)(reader->end - reader->data) / size;
+    if (count > available)
+        count = available;
+
+    size_t i = 0;
+    while (i < count && ((uint8_t)p[i * size] & mask) == type)
+        ++i;
+
+    #if MPACK_READ_TRACKING
+    for (size_t j = 0; j < i; ++j)
+        mpack_reader_track_element(reader);
+    #endif
+
+    reader->data += i * size;
+    *run = i;
+    return p;
+}
+
+// Reads the start of an array for a bulk read.
+static size_t mpack_expect_array_into_start(mpack_reader_t* reader, size_t max_count) {
+    if (max_count > UINT32_MAX)
+        max_count = UINT32_MAX;
+    return mpack_expect_array_max(reader, (uint32_t)max_count);
+}
+
+static size_t mpack_expect_array_into_done(mpack_reader_t* reader, size_t count) {
+    if (mpack_reader_error(reader) != mpack_ok)
+        return 0;
+    mpack_done_array(reader);
+    return count;
+}
+
+size_t mpack_expect_array_double_into(mpack_reader_t* reader, double* out, size_t max_count) {
+    size_t count = mpack_expect_array_into_start(reader, max_count);
+    size_t i = 0;
+    while (i < count && mpack_reader_error(reader) == mpack_ok) {
+        #if MPACK_DOUBLES
+        size_t run;
+        const char* p = mpack_expect_array_run(reader, count - i, 0xcb, 0xff, 9, &run);
+        for (size_t j = 0; j < run; ++j)
+            out[i + j] = mpack_load_double(p + j * 9 + 1);
+        i += run;
+        if (i == count)
+            break;
+        #endif
+        out[i++] = mpack_expect_double(reader);
+    }
+    return mpack_expect_array_into_done(reader, count);
+}
+
+size_t mpack_expect_array_float_into(mpack_reader_t* reader, float* out, size_t max_count) {
+    size_t count = mpack_expect_array_into_start(reader, max_count);
+    size_t i = 0;
+    while (i < count && mpack_reader_error(reader) == mpack_ok) {
+        size_t run;
+        const char* p = mpack_expect_array_run(reader, count - i, 0xca, 0xff, 5, &run);
+        for (size_t j = 0; j < run; ++j)
+            out[i + j] = mpack_load_float(p + j * 5 + 1);
+        i += run;
+        if (i == count)
+            break;
+        out[i++] = mpack_expect_float(reader);
+    }
+    return mpack_expect_array_into_done(reader, count);
+}
+
+// Integer arrays are decoded in bulk when they consist of positive fixints
+// or of the natural encoding of the type.
+#define MPACK_EXPECT_ARRAY_INTS_INTO(type, load, tag, size, expect) \
+    size_t count = mpack_expect_array_into_start(reader, max_count); \
+    size_t i = 0; \
+    while (i < count && mpack_reader_error(reader) == mpack_ok) { \
+        size_t run; \
+        const char* p = mpack_expect_array_run(reader, count - i, 0x00, 0x80, 1, &run); \
+        for (size_t j = 0; j < run; ++j) \
+            out[i + j] = (type)(uint8_t)p[j]; \
+        i += run; \
+        p = mpack_expect_array_run(reader, count - i, tag, 0xff, size, &run); \
+        for (size_t j = 0; j < run; ++j) \
+            out[i + j] = load(p + j * size + 1); \
+        i += run; \
+        if (i == count) \
+            break; \
+        out[i++] = expect(reader); \
+    } \
+    return mpack_expect_array_into_done(reader, count)
+
+size_t mpack_expect_array_i64_into(mpack_reader_t* reader, int64_t* out, size_t max_count) {
+    MPACK_EXPECT_ARRAY_INTS_INTO(int64_t, mpack_load_i64, 0xd3, 9, mpack_expect_i64);
+}
+
+size_t mpack_expect_array_i32_into(mpack_reader_t* reader, int32_t* out, size_t max_count) {
+    MPACK_EXPECT_ARRAY_INTS_INTO(int32_t, mpack_load_i32, 0xd2, 5, mpack_expect_i32);
+}
+
+size_t mpack_expect_array_u64_into(mpack_reader_t* reader, uint64_t* out, size_t max_count) {
+    MPACK_EXPECT_ARRAY_INTS_INTO(uint64_t, mpack_load_u64, 0xcf, 9, mpack_expect_u64);
+}
+
+size_t mpack_expect_array_u32_into(mpack_reader_t* reader, uint32_t* out, size_t max_count) {
+    MPACK_EXPECT_ARRAY_INTS_INTO(uint32_t, mpack_load_u32, 0xce, 5, mpack_expect_u32);
+}
+
+#undef MPACK_EXPECT_ARRAY_INTS_INTO
+
 #ifdef MPACK_MALLOC
 void* mpack_expect_array_alloc_impl(mpack_reader_t* reader, size_t element_size, uint32_t max_count, uint32_t* out_count, bool allow_nil) {
     mpack_assert(out_count != NULL, "out_count cannot be NULL");
@@ -433,7 +546,7 @@ void* mpack_expect_array_alloc_impl(mpack_reader_t* reader, size_t element_size,
         return NULL;
     }
 
-    void* p = MPACK_MALLOC(element_size * count);
+    void* p = mpack_allocator_alloc(&reader->allocator, element_size * count);
     if (p == NULL) {
         mpack_reader_flag_error(reader, mpack_error_memory);
         return NULL;
@@ -617,7 +730,7 @@ char* mpack_expect_cstr_alloc(mpack_reader_t* reader, size_t maxsize) {
     char* str = mpack_expect_cstr_alloc_unchecked(reader, maxsize, &length);
 
     if (str && !mpack_str_check_no_null(str, length)) {
-        MPACK_FREE(str);
+        mpack_allocator_free(&reader->allocator, str);
         mpack_reader_flag_error(reader, mpack_error_type);
         return NULL;
     }
@@ -630,7 +743,7 @@ char* mpack_expect_utf8_cstr_alloc(mpack_reader_t* reader, size_t maxsize) {
     char* str = mpack_expect_cstr_alloc_unchecked(reader, maxsize, &length);
 
     if (str && !mpack_utf8_check_no_null(str, length)) {
-        MPACK_FREE(str);
+        mpack_allocator_free(&reader->allocator, str);
         mpack_reader_flag_error(reader, mpack_error_type);
         return NULL;
     }
@@ -820,5 +933,168 @@ size_t mpack_expect_key_cstr(mpack_reader_t* reader, const char* keys[], bool fo
     return i;
 }
 
+
+
+/* Key sets */
+
+// The number of seeds to try when searching for a perfect hash.
+#define MPACK_KEYSET_SEEDS 64
+
+MPACK_STATIC_INLINE uint32_t mpack_keyset_hash(uint32_t seed, const char* str, size_t length) {
+    // FNV-1a with a seeded basis and a final mix, since we reduce the hash to
+    // a slot index with its high bits
+    uint32_t hash = UINT32_C(2166136261) ^ (seed * UINT32_C(0x9e3779b9));
+    for (size_t i = 0; i < length; ++i) {
+        hash ^= (uint8_t)str[i];
+        hash *= UINT32_C(16777619);
+    }
+    hash ^= hash >> 16;
+    hash *= UINT32_C(0x85ebca6b);
+    hash ^= hash >> 13;
+    return hash;
+}
+
+MPACK_STATIC_INLINE size_t mpack_keyset_slot(const mpack_keyset_t* keyset, uint32_t hash) {
+    return (size_t)(((uint64_t)hash * keyset->slot_count) >> 32);
+}
+
+// Fills the slots with the current seed, returning the total number of
+// slots probed past the preferred slot of each key, or SIZE_MAX if two keys
+// are equal.
+static size_t mpack_keyset_fill(mpack_keyset_t* keyset) {
+    mpack_memset(keyset->slots, 0, sizeof(*keyset->slots) * keyset->slot_count);
+
+    size_t displacement = 0;
+    for (size_t i = 0; i < keyset->count; ++i) {
+        const char* key = keyset->keys[i];
+        size_t length = mpack_strlen(key);
+        size_t slot = mpack_keyset_slot(keyset, mpack_keyset_hash(keyset->seed, key, length));
+
+        while (keyset->slots[slot].key != 0) {
+            mpack_keyset_slot_t* other = &keyset->slots[slot];
+            if (other->length == length && mpack_memcmp(keyset->keys[other->key - 1], key, length) == 0)
+                return SIZE_MAX;
+            ++displacement;
+            if (++slot == keyset->slot_count)
+                slot = 0;
+        }
+
+        keyset->slots[slot].key = (uint32_t)(i + 1);
+        keyset->slots[slot].length = (uint32_t)length;
+    }
+
+    return displacement;
+}
+
+bool mpack_keyset_init(mpack_keyset_t* keyset, const char* keys[], size_t count,
+        mpack_keyset_slot_t* slots, size_t slot_count)
+{
+    mpack_memset(keyset, 0, sizeof(*keyset));
+    if (count == 0 || slot_count < count || (uint64_t)slot_count > UINT32_MAX)
+        return false;
+    mpack_assert(keys != NULL && slots != NULL, "keys and slots cannot be NULL");
+    for (size_t i = 0; i < count; ++i)
+        if ((uint64_t)mpack_strlen(keys[i]) > UINT32_MAX)
+            return false;
+
+    keyset->keys = keys;
+    keyset->count = count;
+    keyset->slots = slots;
+    keyset->slot_count = slot_count;
+
+    uint32_t best_seed = 0;
+    size_t best = SIZE_MAX;
+    for (uint32_t seed = 0; seed < MPACK_KEYSET_SEEDS; ++seed) {
+        keyset->seed = seed;
+        size_t displacement = mpack_keyset_fill(keyset);
+        if (displacement == SIZE_MAX) {
+            mpack_memset(keyset, 0, sizeof(*keyset));
+            return false;
+        }
+        if (displacement < best) {
+            best = displacement;
+            best_seed = seed;
+            if (best == 0)
+                return true;
+        }
+    }
+
+    keyset->seed = best_seed;
+    mpack_keyset_fill(keyset);
+    return true;
+}
+
+size_t mpack_keyset_find(const mpack_keyset_t* keyset, const char* str, size_t length) {
+    mpack_assert(keyset->count != 0, "key set is not initialized");
+
+    // the table may be full, so we probe each slot at most once
+    size_t slot = mpack_keyset_slot(keyset, mpack_keyset_hash(keyset->seed, str, length));
+    for (size_t i = 0; i < keyset->slot_count && keyset->slots[slot].key != 0; ++i) {
+        const mpack_keyset_slot_t* candidate = &keyset->slots[slot];
+        if (candidate->length == length &&
+                mpack_memcmp(keyset->keys[candidate->key - 1], str, length) == 0)
+            return candidate->key - 1;
+        if (++slot == keyset->slot_count)
+            slot = 0;
+    }
+    return keyset->count;
+}
+
+size_t mpack_expect_enum_set(mpack_reader_t* reader, const mpack_keyset_t* keyset) {
+    size_t count = keyset->count;
+
+    // read the string in-place
+    size_t keylen = mpack_expect_str(reader);
+    const char* key = mpack_read_bytes_inplace(reader, keylen);
+    mpack_done_str(reader);
+    if (mpack_reader_error(reader) != mpack_ok)
+        return count;
+
+    size_t i = mpack_keyset_find(keyset, key, keylen);
+    if (i == count)
+        mpack_reader_flag_error(reader, mpack_error_type);
+    return i;
+}
+
+size_t mpack_expect_enum_set_optional(mpack_reader_t* reader, const mpack_keyset_t* keyset) {
+    size_t count = keyset->count;
+    if (mpack_reader_error(reader) != mpack_ok)
+        return count;
+
+    // the key is only recognized if it is a string
+    if (mpack_peek_tag(reader).type != mpack_type_str) {
+        mpack_discard(reader);
+        return count;
+    }
+
+    // read the string in-place
+    size_t keylen = mpack_expect_str(reader);
+    const char* key = mpack_read_bytes_inplace(reader, keylen);
+    mpack_done_str(reader);
+    if (mpack_reader_error(reader) != mpack_ok)
+        return count;
+
+    return mpack_keyset_find(keyset, key, keylen);
+}
+
+size_t mpack_expect_key_set(mpack_reader_t* reader, const mpack_keyset_t* keyset, bool found[]) {
+    size_t count = keyset->count;
+    size_t i = mpack_expect_enum_set_optional(reader, keyset);
+
+    // unrecognized keys are fine, we just return count
+    if (i == count)
+        return count;
+
+    // check if this key is a duplicate
+    mpack_assert(found != NULL, "found cannot be NULL");
+    if (found[i]) {
+        mpack_reader_flag_error(reader, mpack_error_invalid);
+        return count;
+    }
+
+    found[i] = true;
+    return i;
+}
+
 #endif
 
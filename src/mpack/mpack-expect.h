@@ -832,7 +832,8 @@ bool mpack_expect_array_max_or_nil(mpack_reader_t* reader, uint32_t max_count, u
  * check the reader's error state.
  *
  * The allocated array must be freed with MPACK_FREE() (or simply free()
- * if MPack's allocator hasn't been customized.)
+ * if MPack's allocator hasn't been customized), or with the reader's
+ * allocator if one was set with mpack_reader_set_allocator().
  *
  * @throws mpack_error_type if the value is not an array or if its size is
  * greater than max_count.
@@ -856,7 +857,8 @@ bool mpack_expect_array_max_or_nil(mpack_reader_t* reader, uint32_t max_count, u
  * to check for errors; only check the reader's error state.
  *
  * The allocated array must be freed with MPACK_FREE() (or simply free()
- * if MPack's allocator hasn't been customized.)
+ * if MPack's allocator hasn't been customized), or with the reader's
+ * allocator if one was set with mpack_reader_set_allocator().
  *
  * @warning You must call @ref mpack_done_array() if and only if a non-zero
  * element count is read. This function does not differentiate between nil
@@ -869,6 +871,74 @@ bool mpack_expect_array_max_or_nil(mpack_reader_t* reader, uint32_t max_count, u
     ((Type*)mpack_expect_array_alloc_impl(reader, sizeof(Type), max_count, out_count, true))
 #endif
 
+/**
+ * Reads an array of at most @p max_count numbers into the given buffer as
+ * doubles, returning the number of elements. This reads the whole array,
+ * including calling mpack_done_array(). Elements may be of any number type,
+ * as with mpack_expect_double().
+ *
+ * This is much faster than calling mpack_expect_double() for each element.
+ * Runs of elements encoded the same way are decoded in bulk straight from
+ * the reader's buffer.
+ *
+ * The contents of the buffer are unspecified if an error occurs.
+ *
+ * @throws mpack_error_type if the value is not an array, if its size is
+ * greater than max_count, or if any element is not a number.
+ *
+ * @param reader The MPack reader.
+ * @param out The buffer to read elements into.
+ * @param max_count The maximum number of elements that fit in the buffer.
+ *
+ * @return The number of elements read, or zero if an error occurs.
+ */
+size_t mpack_expect_array_double_into(mpack_reader_t* reader, double* out, size_t max_count);
+
+/**
+ * Reads an array of at most @p max_count numbers into the given buffer as
+ * floats, returning the number of elements. Elements may be of any number
+ * type, as with mpack_expect_float().
+ *
+ * @see mpack_expect_array_double_into()
+ */
+size_t mpack_expect_array_float_into(mpack_reader_t* reader, float* out, size_t max_count);
+
+/**
+ * Reads an array of at most @p max_count integers into the given buffer as
+ * int64_t, returning the number of elements. Each element must be an integer
+ * in range, as with mpack_expect_i64().
+ *
+ * @see mpack_expect_array_double_into()
+ */
+size_t mpack_expect_array_i64_into(mpack_reader_t* reader, int64_t* out, size_t max_count);
+
+/**
+ * Reads an array of at most @p max_count integers into the given buffer as
+ * int32_t, returning the number of elements. Each element must be an integer
+ * in range, as with mpack_expect_i32().
+ *
+ * @see mpack_expect_array_double_into()
+ */
+size_t mpack_expect_array_i32_into(mpack_reader_t* reader, int32_t* out, size_t max_count);
+
+/**
+ * Reads an array of at most @p max_count integers into the given buffer as
+ * uint64_t, returning the number of elements. Each element must be an integer
+ * in range, as with mpack_expect_u64().
+ *
+ * @see mpack_expect_array_double_into()
+ */
+size_t mpack_expect_array_u64_into(mpack_reader_t* reader, uint64_t* out, size_t max_count);
+
+/**
+ * Reads an array of at most @p max_count integers into the given buffer as
+ * uint32_t, returning the number of elements. Each element must be an integer
+ * in range, as with mpack_expect_u32().
+ *
+ * @see mpack_expect_array_double_into()
+ */
+size_t mpack_expect_array_u32_into(mpack_reader_t* reader, uint32_t* out, size_t max_count);
+
 /**
  * @}
  */
@@ -1001,7 +1071,8 @@ void mpack_expect_utf8_cstr(mpack_reader_t* reader, char* buf, size_t size);
  * returned pointer if reading succeeds.
  *
  * The allocated string must be freed with MPACK_FREE() (or simply free()
- * if MPack's allocator hasn't been customized.)
+ * if MPack's allocator hasn't been customized), or with the reader's
+ * allocator if one was set with mpack_reader_set_allocator().
  *
  * @throws mpack_error_too_big If the string plus null-terminator is larger than the given maxsize.
  * @throws mpack_error_type If the value is not a string or contains a null byte.
@@ -1022,7 +1093,8 @@ char* mpack_expect_cstr_alloc(mpack_reader_t* reader, size_t maxsize);
  * it cannot be represented in a null-terminated string.
  *
  * The allocated string must be freed with MPACK_FREE() (or simply free()
- * if MPack's allocator hasn't been customized.)
+ * if MPack's allocator hasn't been customized), or with the reader's
+ * allocator if one was set with mpack_reader_set_allocator().
  * if you want a null-terminator.
  *
  * @throws mpack_error_too_big If the string plus null-terminator is larger
@@ -1435,6 +1507,138 @@ size_t mpack_expect_key_uint(mpack_reader_t* reader, bool found[], size_t count)
 size_t mpack_expect_key_cstr(mpack_reader_t* reader, const char* keys[],
         bool found[], size_t count);
 
+/**
+ * @}
+ */
+
+/**
+ * @name Key Sets
+ *
+ * A key set is a hash table of a fixed list of strings (such as the keys of
+ * a struct) built once with mpack_keyset_init(). Matching a string against
+ * the set then takes one hash and usually one comparison, rather than a
+ * comparison against every string in the list as with mpack_expect_enum()
+ * and mpack_expect_key_cstr().
+ *
+ * @code{.c}
+ * typedef enum           {KEY_ID, KEY_NAME, KEY_TAGS, KEY_COUNT} field_key_t;
+ * static const char* keys[] = {"id", "name", "tags"};
+ *
+ * mpack_keyset_slot_t slots[MPACK_KEYSET_SLOT_COUNT(KEY_COUNT)];
+ * mpack_keyset_t keyset;
+ * mpack_keyset_init(&keyset, keys, KEY_COUNT, slots, MPACK_KEYSET_SLOT_COUNT(KEY_COUNT));
+ *
+ * bool found[KEY_COUNT] = {0};
+ * for (size_t i = mpack_expect_map(reader); i > 0; --i) {
+ *     switch ((field_key_t)mpack_expect_key_set(reader, &keyset, found)) {
+ *         case KEY_ID:   id = mpack_expect_u32(reader); break;
+ *         // ...
+ *         default:       mpack_discard(reader); break;
+ *     }
+ * }
+ * @endcode
+ *
+ * @{
+ */
+
+/**
+ * The recommended number of slots for a key set of the given number of keys.
+ *
+ * A key set needs at least one slot per key. With this many the hash table
+ * is a quarter full, so a seed that places every key in its own preferred
+ * slot can usually be found.
+ */
+#define MPACK_KEYSET_SLOT_COUNT(count) ((count) * 4)
+
+/**
+ * A slot in a key set hash table. The contents are internal.
+ */
+typedef struct mpack_keyset_slot_t {
+    uint32_t key;    /* Index of the key plus one, or zero if empty */
+    uint32_t length; /* Length of the key */
+} mpack_keyset_slot_t;
+
+/**
+ * A precompiled set of strings for fast matching.
+ *
+ * @see mpack_keyset_init()
+ */
+typedef struct mpack_keyset_t {
+    const char** keys;
+    size_t count;
+    mpack_keyset_slot_t* slots;
+    size_t slot_count;
+    uint32_t seed;
+} mpack_keyset_t;
+
+/**
+ * Builds a key set of the given strings in the given slots.
+ *
+ * The strings and slots must remain valid for the lifetime of the key set.
+ * A key set is not modified by lookups, so it can be built once and shared
+ * across readers (and threads.)
+ *
+ * This searches for a hash seed for which no two keys collide, falling back
+ * to the seed with the fewest collisions if none is found. Lookups are
+ * correct either way.
+ *
+ * @param keyset The key set to initialize
+ * @param keys An array of unique strings of length count
+ * @param count The number of strings
+ * @param slots Storage for the hash table
+ * @param slot_count The number of slots, at least count (see
+ *        @ref MPACK_KEYSET_SLOT_COUNT())
+ *
+ * @return true if the key set was built, or false if there are not enough
+ *         slots, too many keys or if the keys are not unique.
+ */
+bool mpack_keyset_init(mpack_keyset_t* keyset, const char* keys[], size_t count,
+        mpack_keyset_slot_t* slots, size_t slot_count);
+
+/**
+ * Returns the index of the key matching the given string, or the key count
+ * if it does not match any key.
+ */
+size_t mpack_keyset_find(const mpack_keyset_t* keyset, const char* str, size_t length);
+
+/**
+ * Expects a string matching one of the keys in the given key set, returning
+ * its index.
+ *
+ * This is equivalent to mpack_expect_enum() with the key set's strings.
+ *
+ * @throws mpack_error_type if the value is not a string or does not match.
+ *
+ * @return The index of the matched string, or the key count in case of error
+ */
+size_t mpack_expect_enum_set(mpack_reader_t* reader, const mpack_keyset_t* keyset);
+
+/**
+ * Expects a string matching one of the keys in the given key set, returning
+ * its index, or the key count if it does not match.
+ *
+ * This is equivalent to mpack_expect_enum_optional() with the key set's
+ * strings.
+ *
+ * @return The index of the matched string, or the key count if it does not
+ * match or an error occurs
+ */
+size_t mpack_expect_enum_set_optional(mpack_reader_t* reader, const mpack_keyset_t* keyset);
+
+/**
+ * Expects a string map key matching one of the keys in the given key set,
+ * marking it as found in the given bool array and returning its index.
+ *
+ * This is equivalent to mpack_expect_key_cstr() with the key set's strings.
+ * The found array must be cleared before expecting the first key, and it
+ * must have one flag per key. If a key is found twice, mpack_error_invalid
+ * is flagged.
+ *
+ * @return The index of the matched key, or the key count if it is
+ * unrecognized or an error occurs
+ */
+size_t mpack_expect_key_set(mpack_reader_t* reader, const mpack_keyset_t* keyset, bool found[]);
+
 /**
  * @}
  */
@@ -0,0 +1,564 @@
+/*
+ * Copyright (c) 2015-2018 Nicholas Fraser
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#define MPACK_INTERNAL 1
+
+#include "mpack-frame.h"
+
+#if MPACK_FRAME
+
+// Parses a frame header, placing the sizes of the payload and of the
+// uncompressed data in stored_size and raw_size.
+static mpack_error_t mpack_frame_parse_header(const char* header, size_t* stored_size, size_t* raw_size) {
+    *stored_size = mpack_load_u32(header);
+    *raw_size = mpack_load_u32(header + 4);
+
+    // the writer never writes empty frames, and stores data uncompressed
+    // rather than letting it grow
+    if (*raw_size == 0 || *stored_size == 0 || *stored_size > *raw_size)
+        return mpack_error_invalid;
+    if (*raw_size > MPACK_FRAME_MAX_SIZE)
+        return mpack_error_too_big;
+    return mpack_ok;
+}
+
+mpack_error_t mpack_frame_size(const char* data, size_t length, size_t* size, size_t* raw_size) {
+    if (length < MPACK_FRAME_HEADER_SIZE)
+        return mpack_error_eof;
+
+    size_t stored_size;
+    mpack_error_t error = mpack_frame_parse_header(data, &stored_size, raw_size);
+    if (error != mpack_ok)
+        return error;
+    if (length - MPACK_FRAME_HEADER_SIZE < stored_size)
+        return mpack_error_eof;
+
+    *size = MPACK_FRAME_HEADER_SIZE + stored_size;
+    return mpack_ok;
+}
+
+mpack_error_t mpack_frame_decode(const mpack_frame_codec_t* codec, const char* frame, size_t size,
+        char* buffer, size_t raw_size)
+{
+    mpack_assert(size > MPACK_FRAME_HEADER_SIZE && mpack_load_u32(frame + 4) == raw_size,
+            "frame size %i or raw size %i does not match its header", (int)size, (int)raw_size);
+    const char* payload = frame + MPACK_FRAME_HEADER_SIZE;
+    size_t stored_size = size - MPACK_FRAME_HEADER_SIZE;
+
+    if (stored_size == raw_size) {
+        mpack_memcpy(buffer, payload, raw_size);
+        return mpack_ok;
+    }
+    if (!codec->decompress(codec->context, payload, stored_size, buffer, raw_size))
+        return mpack_error_invalid;
+    return mpack_ok;
+}
+
+#ifdef MPACK_MALLOC
+
+#if MPACK_WRITER
+typedef struct mpack_frame_writer_t {
+    mpack_frame_codec_t codec;
+    mpack_frame_output_t output;
+    void* context;
+    size_t frame_size;
+    bool flushing;  // whether mpack_writer_flush_frame() is flushing the buffer
+    char* out;      // the buffer for compressed frames
+    size_t out_size;
+} mpack_frame_writer_t;
+
+// The size of the buffer allocated along with the frame writer. The writer
+// starts in it so that the growable buffer is allocated with the writer's
+// allocator, which is only set after init.
+#define MPACK_FRAME_WRITER_INITIAL_SIZE MPACK_WRITER_MINIMUM_BUFFER_SIZE
+
+MPACK_STATIC_INLINE char* mpack_frame_writer_initial(mpack_frame_writer_t* frame_writer) {
+    return (char*)(frame_writer + 1);
+}
+
+// Compresses the given data into a frame and passes it to the output function.
+static void mpack_frame_writer_emit(mpack_writer_t* writer, mpack_frame_writer_t* frame_writer,
+        const char* data, size_t count)
+{
+    if (count == 0)
+        return;
+    if (count > MPACK_FRAME_MAX_SIZE) {
+        mpack_writer_flag_error(writer, mpack_error_too_big);
+        return;
+    }
+
+    size_t stored_size = 0;
+    size_t bound = frame_writer->codec.bound(frame_writer->codec.context, count);
+    if (bound != 0) {
+        if (frame_writer->out_size < MPACK_FRAME_HEADER_SIZE + bound) {
+            // the previous contents don't need to be preserved
+            if (frame_writer->out)
+                mpack_allocator_free(&writer->allocator, frame_writer->out);
+            frame_writer->out_size = MPACK_FRAME_HEADER_SIZE + bound;
+            frame_writer->out = (char*)mpack_allocator_alloc(&writer->allocator, frame_writer->out_size);
+            if (frame_writer->out == NULL) {
+                frame_writer->out_size = 0;
+                mpack_writer_flag_error(writer, mpack_error_memory);
+                return;
+            }
+        }
+        stored_size = frame_writer->codec.compress(frame_writer->codec.context, data, count,
+                frame_writer->out + MPACK_FRAME_HEADER_SIZE, bound);
+    }
+
+    bool ok;
+    if (stored_size == 0 || stored_size >= count) {
+        // store the data uncompressed, straight from the writer's buffer
+        char header[MPACK_FRAME_HEADER_SIZE];
+        mpack_store_u32(header, (uint32_t)count);
+        mpack_store_u32(header + 4, (uint32_t)count);
+        ok = frame_writer->output(frame_writer->context, header, sizeof(header)) &&
+                frame_writer->output(frame_writer->context, data, count);
+    } else {
+        mpack_store_u32(frame_writer->out, (uint32_t)stored_size);
+        mpack_store_u32(frame_writer->out + 4, (uint32_t)count);
+        ok = frame_writer->output(frame_writer->context, frame_writer->out,
+                MPACK_FRAME_HEADER_SIZE + stored_size);
+    }
+
+    mpack_log("wrote frame of %i bytes, %i stored\n", (int)count, (int)stored_size);
+    if (!ok)
+        mpack_writer_flag_error(writer, mpack_error_io);
+}
+
+static void mpack_frame_writer_flush(mpack_writer_t* writer, const char* data, size_t count) {
+    mpack_frame_writer_t* frame_writer = (mpack_frame_writer_t*)writer->context;
+
+    // Like mpack_growable_writer_flush(), this grows the buffer rather than
+    // emptying it so that a message is never split across frames. The
+    // buffer is only written out as a frame when flushed by
+    // mpack_writer_flush_frame() or during teardown.
+    if (data == writer->buffer) {
+        if (frame_writer->flushing || mpack_writer_buffer_used(writer) == count) {
+            mpack_frame_writer_emit(writer, frame_writer, data, count);
+            return;
+        }
+
+        // otherwise leave the data in the buffer and just grow
+        writer->current = writer->buffer + count;
+        count = 0;
+    }
+
+    size_t used = mpack_writer_buffer_used(writer);
+    size_t size = mpack_writer_buffer_size(writer);
+    if (count > SIZE_MAX - used) {
+        mpack_writer_flag_error(writer, mpack_error_memory);
+        return;
+    }
+
+    // the first growable buffer has room for the message that crosses the
+    // frame size
+    char* initial = mpack_frame_writer_initial(frame_writer);
+    size_t new_size = size;
+    if (writer->buffer == initial && new_size < frame_writer->frame_size)
+        new_size = frame_writer->frame_size;
+    do {
+        if (new_size > SIZE_MAX / 2) {
+            mpack_writer_flag_error(writer, mpack_error_memory);
+            return;
+        }
+        new_size *= 2;
+    } while (new_size < used + count);
+
+    char* new_buffer;
+    if (writer->buffer == initial) {
+        new_buffer = (char*)mpack_allocator_alloc(&writer->allocator, new_size);
+        if (new_buffer != NULL)
+            mpack_memcpy(new_buffer, writer->buffer, used);
+    } else {
+        new_buffer = (char*)mpack_allocator_realloc(&writer->allocator, writer->buffer, used, new_size);
+    }
+    if (new_buffer == NULL) {
+        mpack_writer_flag_error(writer, mpack_error_memory);
+        return;
+    }
+    writer->current = new_buffer + used;
+    writer->buffer = new_buffer;
+    writer->end = writer->buffer + new_size;
+
+    if (count > 0) {
+        mpack_memcpy(writer->current, data, count);
+        writer->current += count;
+    }
+}
+
+static void mpack_frame_writer_teardown(mpack_writer_t* writer) {
+    mpack_frame_writer_t* frame_writer = (mpack_frame_writer_t*)writer->context;
+    if (frame_writer->out)
+        mpack_allocator_free(&writer->allocator, frame_writer->out);
+    if (writer->buffer != mpack_frame_writer_initial(frame_writer))
+        mpack_allocator_free(&writer->allocator, writer->buffer);
+    MPACK_FREE(frame_writer);
+    writer->buffer = NULL;
+    writer->context = NULL;
+}
+
+void mpack_writer_init_frame(mpack_writer_t* writer, const mpack_frame_codec_t* codec, size_t frame_size,
+        mpack_frame_output_t output, void* context)
+{
+    mpack_assert(codec != NULL, "cannot initialize frame writer without a codec");
+    mpack_assert(output != NULL, "cannot initialize frame writer without an output function");
+
+    MPACK_STATIC_ASSERT(MPACK_FRAME_MAX_SIZE <= UINT32_MAX, "MPACK_FRAME_MAX_SIZE must fit in a frame header!");
+
+    if (frame_size == 0)
+        frame_size = MPACK_FRAME_SIZE;
+    if (frame_size > MPACK_FRAME_MAX_SIZE)
+        frame_size = MPACK_FRAME_MAX_SIZE;
+
+    mpack_frame_writer_t* frame_writer = (mpack_frame_writer_t*)MPACK_MALLOC(
+            sizeof(mpack_frame_writer_t) + MPACK_FRAME_WRITER_INITIAL_SIZE);
+    if (frame_writer == NULL) {
+        mpack_writer_init_error(writer, mpack_error_memory);
+        return;
+    }
+    frame_writer->codec = *codec;
+    frame_writer->output = output;
+    frame_writer->context = context;
+    frame_writer->frame_size = frame_size;
+    frame_writer->flushing = false;
+    frame_writer->out = NULL;
+    frame_writer->out_size = 0;
+
+    mpack_writer_init(writer, mpack_frame_writer_initial(frame_writer), MPACK_FRAME_WRITER_INITIAL_SIZE);
+    mpack_writer_set_context(writer, frame_writer);
+    mpack_writer_set_flush(writer, mpack_frame_writer_flush);
+    mpack_writer_set_teardown(writer, mpack_frame_writer_teardown);
+}
+
+void mpack_writer_flush_frame(mpack_writer_t* writer) {
+    if (mpack_writer_error(writer) != mpack_ok)
+        return;
+    if (writer->flush != mpack_frame_writer_flush) {
+        mpack_break("writer is not a frame writer!");
+        mpack_writer_flag_error(writer, mpack_error_bug);
+        return;
+    }
+
+    mpack_frame_writer_t* frame_writer = (mpack_frame_writer_t*)writer->context;
+    frame_writer->flushing = true;
+    mpack_writer_flush_message(writer);
+    frame_writer->flushing = false;
+}
+
+void mpack_writer_frame_message(mpack_writer_t* writer) {
+    if (mpack_writer_error(writer) != mpack_ok)
+        return;
+    if (writer->flush != mpack_frame_writer_flush) {
+        mpack_break("writer is not a frame writer!");
+        mpack_writer_flag_error(writer, mpack_error_bug);
+        return;
+    }
+
+    mpack_frame_writer_t* frame_writer = (mpack_frame_writer_t*)writer->context;
+    if (mpack_writer_buffer_used(writer) >= frame_writer->frame_size)
+        mpack_writer_flush_frame(writer);
+}
+#endif
+
+#if MPACK_READER || MPACK_NODE
+// The state shared by frame readers and trees.
+typedef struct mpack_frame_source_t {
+    mpack_frame_codec_t codec;
+    mpack_frame_input_t input;
+    void* context;
+    char* stored;         // the buffer for compressed payloads
+    size_t stored_size;
+    char* raw;            // the buffer for uncompressed data that isn't decoded in place
+    size_t raw_size;
+    const char* pending;  // uncompressed data in raw not yet passed to a tree
+    size_t pending_count;
+} mpack_frame_source_t;
+
+static void mpack_frame_source_init(mpack_frame_source_t* source, const mpack_frame_codec_t* codec,
+        mpack_frame_input_t input, void* context)
+{
+    mpack_memset(source, 0, sizeof(*source));
+    source->codec = *codec;
+    source->input = input;
+    source->context = context;
+}
+
+static void mpack_frame_source_destroy(mpack_frame_source_t* source, const mpack_allocator_t* allocator) {
+    if (source->stored)
+        mpack_allocator_free(allocator, source->stored);
+    if (source->raw)
+        mpack_allocator_free(allocator, source->raw);
+}
+
+// Reads exactly count bytes from the input, returning the number of bytes
+// read before the input ended or (size_t)-1 on error.
+static size_t mpack_frame_source_read(mpack_frame_source_t* source, char* buffer, size_t count) {
+    size_t total = 0;
+    while (total < count) {
+        size_t read = source->input(source->context, buffer + total, count - total);
+        if (read == (size_t)(-1))
+            return read;
+        if (read == 0)
+            break;
+        total += read;
+    }
+    return total;
+}
+
+// Makes sure the given buffer has room for size bytes. The contents are not
+// preserved.
+static bool mpack_frame_source_reserve(const mpack_allocator_t* allocator, char** buffer,
+        size_t* buffer_size, size_t size)
+{
+    if (*buffer_size >= size)
+        return true;
+    if (*buffer)
+        mpack_allocator_free(allocator, *buffer);
+    *buffer = (char*)mpack_allocator_alloc(allocator, size);
+    *buffer_size = (*buffer == NULL) ? 0 : size;
+    return *buffer != NULL;
+}
+
+// Reads and decodes the next frame. The data is decompressed directly into
+// the given target if it fits, or into the source's own buffer otherwise,
+// which is allocated with the given allocator. A pointer to the data and its
+// size are placed in data and size.
+static mpack_error_t mpack_frame_source_next(mpack_frame_source_t* source, const mpack_allocator_t* allocator,
+        char* target, size_t target_size, char** data, size_t* size)
+{
+    char header[MPACK_FRAME_HEADER_SIZE];
+    size_t read = mpack_frame_source_read(source, header, sizeof(header));
+    if (read == (size_t)(-1))
+        return mpack_error_io;
+    if (read == 0)
+        return mpack_error_eof;
+    if (read != sizeof(header))
+        return mpack_error_invalid;
+
+    size_t stored_size, raw_size;
+    mpack_error_t error = mpack_frame_parse_header(header, &stored_size, &raw_size);
+    if (error != mpack_ok)
+        return error;
+
+    char* buffer = target;
+    if (raw_size > target_size) {
+        if (!mpack_frame_source_reserve(allocator, &source->raw, &source->raw_size, raw_size))
+            return mpack_error_memory;
+        buffer = source->raw;
+    }
+
+    if (stored_size == raw_size) {
+        read = mpack_frame_source_read(source, buffer, raw_size);
+    } else {
+        if (!mpack_frame_source_reserve(allocator, &source->stored, &source->stored_size, stored_size))
+            return mpack_error_memory;
+        read = mpack_frame_source_read(source, source->stored, stored_size);
+    }
+    if (read == (size_t)(-1))
+        return mpack_error_io;
+    if (read != stored_size)
+        return mpack_error_invalid;
+    if (stored_size != raw_size && !source->codec.decompress(source->codec.context,
+                source->stored, stored_size, buffer, raw_size))
+        return mpack_error_invalid;
+
+    mpack_log("read frame of %i bytes, %i stored\n", (int)raw_size, (int)stored_size);
+    *data = buffer;
+    *size = raw_size;
+    return mpack_ok;
+}
+#endif
+
+#if MPACK_READER
+static size_t mpack_frame_reader_borrow(mpack_reader_t* reader, const char** data) {
+    mpack_frame_source_t* source = (mpack_frame_source_t*)reader->context;
+
+    // The previous frame has already been released, so the frame buffer can
+    // be reused.
+    char* frame;
+    size_t size;
+    mpack_error_t error = mpack_frame_source_next(source, &reader->allocator, NULL, 0, &frame, &size);
+    if (error != mpack_ok) {
+        mpack_reader_flag_error(reader, error);
+        return 0;
+    }
+    *data = frame;
+    return size;
+}
+
+static void mpack_frame_reader_teardown(mpack_reader_t* reader) {
+    mpack_frame_source_t* source = (mpack_frame_source_t*)reader->context;
+    mpack_frame_source_destroy(source, &reader->allocator);
+
+    // the buffer is allocated along with the context
+    MPACK_FREE(source);
+    reader->buffer = NULL;
+    reader->context = NULL;
+    reader->size = 0;
+    reader->teardown = NULL;
+}
+
+void mpack_reader_init_frame(mpack_reader_t* reader, const mpack_frame_codec_t* codec,
+        mpack_frame_input_t input, void* context)
+{
+    mpack_assert(codec != NULL, "cannot initialize frame reader without a codec");
+    mpack_assert(input != NULL, "cannot initialize frame reader without an input function");
+
+    // The reader's own buffer is only used for data that spans frames,
+    // which only happens in corrupt data since frames hold whole messages.
+    size_t buffer_size = MPACK_READER_MINIMUM_BUFFER_SIZE;
+    mpack_frame_source_t* source = (mpack_frame_source_t*)MPACK_MALLOC(sizeof(mpack_frame_source_t) + buffer_size);
+    if (source == NULL) {
+        mpack_reader_init_error(reader, mpack_error_memory);
+        return;
+    }
+    mpack_frame_source_init(source, codec, input, context);
+
+    mpack_reader_init(reader, (char*)(source + 1), buffer_size, 0);
+    mpack_reader_set_context(reader, source);
+    mpack_reader_set_borrow(reader, mpack_frame_reader_borrow, NULL);
+    mpack_reader_set_teardown(reader, mpack_frame_reader_teardown);
+}
+#endif
+
+#if MPACK_NODE
+static size_t mpack_frame_tree_read(mpack_tree_t* tree, char* buffer, size_t count) {
+    mpack_frame_source_t* source = (mpack_frame_source_t*)tree->context;
+
+    if (source->pending_count == 0) {
+        char* frame;
+        size_t size;
+        mpack_error_t error = mpack_frame_source_next(source, &tree->allocator, buffer, count, &frame, &size);
+        if (error != mpack_ok) {
+            mpack_tree_flag_error(tree, error);
+            return 0;
+        }
+
+        // the frame was decompressed directly into the tree's buffer
+        if (frame == buffer)
+            return size;
+
+        source->pending = frame;
+        source->pending_count = size;
+    }
+
+    if (count > source->pending_count)
+        count = source->pending_count;
+    mpack_memcpy(buffer, source->pending, count);
+    source->pending += count;
+    source->pending_count -= count;
+    return count;
+}
+
+static void mpack_frame_tree_teardown(mpack_tree_t* tree) {
+    mpack_frame_source_t* source = (mpack_frame_source_t*)tree->context;
+    mpack_frame_source_destroy(source, &tree->allocator);
+    MPACK_FREE(source);
+    tree->context = NULL;
+}
+
+void mpack_tree_init_frame(mpack_tree_t* tree, const mpack_frame_codec_t* codec,
+        mpack_frame_input_t input, void* context,
+        size_t max_message_size, size_t max_message_nodes)
+{
+    mpack_assert(codec != NULL, "cannot initialize frame tree without a codec");
+    mpack_assert(input != NULL, "cannot initialize frame tree without an input function");
+
+    mpack_frame_source_t* source = (mpack_frame_source_t*)MPACK_MALLOC(sizeof(mpack_frame_source_t));
+    if (source == NULL) {
+        mpack_tree_init_error(tree, mpack_error_memory);
+        return;
+    }
+    mpack_frame_source_init(source, codec, input, context);
+
+    mpack_tree_init_stream(tree, mpack_frame_tree_read, source, max_message_size, max_message_nodes);
+    mpack_tree_set_teardown(tree, mpack_frame_tree_teardown);
+}
+#endif
+
+void mpack_frame_index_init(mpack_frame_index_t* index, const char* data, size_t length) {
+    mpack_frame_index_init_allocator(index, data, length, NULL);
+}
+
+void mpack_frame_index_init_allocator(mpack_frame_index_t* index, const char* data, size_t length,
+        const mpack_allocator_t* allocator)
+{
+    mpack_memset(index, 0, sizeof(*index));
+    index->data = data;
+    if (allocator != NULL)
+        index->allocator = *allocator;
+
+    size_t capacity = 64;
+    index->offsets = (size_t*)mpack_allocator_alloc(&index->allocator, sizeof(size_t) * capacity);
+    if (index->offsets == NULL) {
+        index->error = mpack_error_memory;
+        return;
+    }
+    index->offsets[0] = 0;
+
+    size_t pos = 0;
+    while (pos < length) {
+        size_t size, raw_size;
+        mpack_error_t error = mpack_frame_size(data + pos, length - pos, &size, &raw_size);
+        if (error != mpack_ok) {
+            index->error = error;
+            return;
+        }
+
+        if (index->count + 1 == capacity) {
+            size_t* offsets = (size_t*)mpack_allocator_realloc(&index->allocator, index->offsets,
+                    sizeof(size_t) * capacity, sizeof(size_t) * capacity * 2);
+            if (offsets == NULL) {
+                index->error = mpack_error_memory;
+                return;
+            }
+            index->offsets = offsets;
+            capacity *= 2;
+        }
+
+        pos += size;
+        index->offsets[++index->count] = pos;
+    }
+}
+
+mpack_error_t mpack_frame_index_destroy(mpack_frame_index_t* index) {
+    if (index->offsets)
+        mpack_allocator_free(&index->allocator, index->offsets);
+    index->offsets = NULL;
+    index->count = 0;
+    return index->error;
+}
+
+const char* mpack_frame_index_frame(const mpack_frame_index_t* index, size_t frame,
+        size_t* size, size_t* raw_size)
+{
+    mpack_assert(frame < index->count, "frame %i is out of bounds of index with %i frames",
+            (int)frame, (int)index->count);
+    const char* data = index->data + index->offsets[frame];
+    *size = index->offsets[frame + 1] - index->offsets[frame];
+    *raw_size = mpack_load_u32(data + 4);
+    return data;
+}
+
+#endif
+
+#endif
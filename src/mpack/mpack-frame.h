@@ -0,0 +1,369 @@
+/*
+ * Copyright (c) 2015-2018 Nicholas Fraser
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * @file
+ *
+ * Declares the MPack framed compression adapters.
+ */
+
+#ifndef MPACK_FRAME_H
+#define MPACK_FRAME_H 1
+
+#include "mpack-node.h"
+
+MPACK_HEADER_START
+MPACK_EXTERN_C_START
+
+#if MPACK_FRAME
+
+/**
+ * @defgroup frame Compressed Frames
+ *
+ * Compressed frames store a stream of messages as a sequence of
+ * independently compressed blocks, each containing only whole messages.
+ *
+ * The compression algorithm is supplied by the application as a @ref
+ * mpack_frame_codec_t, so MPack does not depend on any compression library.
+ * The writer adapter compresses directly from the writer's buffer, and the
+ * reader and tree adapters decompress directly into the buffer that is
+ * parsed, so there is no extra copy at each layer as there is when wrapping
+ * fill and flush functions by hand.
+ *
+ * Each frame starts with a header of @ref MPACK_FRAME_HEADER_SIZE bytes: the
+ * size of the stored payload and the size of the uncompressed data, both as
+ * big-endian 32-bit integers. If the two sizes are equal, the payload is
+ * stored uncompressed.
+ *
+ * Since frames start at message boundaries, any frame can be decoded on its
+ * own. A @ref mpack_frame_index_t finds the frames of compressed data so
+ * they can be decoded in parallel, each with its own @ref
+ * mpack_message_index_t.
+ *
+ * For example, a codec for LZ4 can be written as:
+ *
+ * @code{.c}
+ * static size_t lz4_bound(void* context, size_t size) {
+ *     return (size_t)LZ4_compressBound((int)size);
+ * }
+ * static size_t lz4_compress(void* context, const char* src, size_t src_size, char* dst, size_t dst_size) {
+ *     return (size_t)LZ4_compress_default(src, dst, (int)src_size, (int)dst_size);
+ * }
+ * static bool lz4_decompress(void* context, const char* src, size_t src_size, char* dst, size_t dst_size) {
+ *     return LZ4_decompress_safe(src, dst, (int)src_size, (int)dst_size) == (int)dst_size;
+ * }
+ * static const mpack_frame_codec_t lz4_codec = {lz4_bound, lz4_compress, lz4_decompress, NULL};
+ * @endcode
+ *
+ * A codec for zstd is similar, using ZSTD_compressBound(), ZSTD_compress()
+ * (returning 0 if ZSTD_isError()) and ZSTD_decompress().
+ *
+ * @{
+ */
+
+/**
+ * The size in bytes of the header of a frame.
+ */
+#define MPACK_FRAME_HEADER_SIZE 8
+
+/**
+ * A function to return the maximum compressed size of @p size bytes of
+ * data, or 0 if the data should not be compressed.
+ */
+typedef size_t (*mpack_frame_bound_t)(void* context, size_t size);
+
+/**
+ * A function to compress @p src_size bytes from @p src into @p dst, which
+ * has room for @p dst_size bytes (the bound of @p src_size.)
+ *
+ * @return The compressed size, or 0 if the data could not be compressed (in
+ *         which case it is stored uncompressed.)
+ */
+typedef size_t (*mpack_frame_compress_t)(void* context, const char* src, size_t src_size,
+        char* dst, size_t dst_size);
+
+/**
+ * A function to decompress @p src_size bytes from @p src into exactly
+ * @p dst_size bytes at @p dst.
+ *
+ * @return true if the data was decompressed to exactly @p dst_size bytes,
+ *         or false if it is corrupt.
+ */
+typedef bool (*mpack_frame_decompress_t)(void* context, const char* src, size_t src_size,
+        char* dst, size_t dst_size);
+
+/**
+ * A compression algorithm for frames.
+ */
+typedef struct mpack_frame_codec_t {
+    mpack_frame_bound_t bound;
+    mpack_frame_compress_t compress;
+    mpack_frame_decompress_t decompress;
+    void* context; /**< The context passed to the codec functions. */
+} mpack_frame_codec_t;
+
+/**
+ * A function to receive frames written by a frame writer.
+ *
+ * @return true if all of the data was written, or false on error (in which
+ *         case @ref mpack_error_io is flagged on the writer.)
+ */
+typedef bool (*mpack_frame_output_t)(void* context, const char* data, size_t count);
+
+/**
+ * A function to read up to @p count bytes of frames for a frame reader or
+ * tree. It can return fewer bytes than requested.
+ *
+ * @return The number of bytes read, 0 at the end of the input, or
+ *         <tt>(size_t)-1</tt> on error.
+ */
+typedef size_t (*mpack_frame_input_t)(void* context, char* buffer, size_t count);
+
+/**
+ * Finds the size of the first frame in the given data.
+ *
+ * @param data The data to scan.
+ * @param length The length of the data in bytes.
+ * @param size The size in bytes of the frame including its header is placed
+ *        here on success.
+ * @param raw_size The size in bytes of the frame's uncompressed data is
+ *        placed here on success.
+ *
+ * @return mpack_ok if a complete frame was found, mpack_error_eof if the
+ *         data ends before the frame is complete, mpack_error_invalid if the
+ *         header is malformed, or mpack_error_too_big if the frame is larger
+ *         than @ref MPACK_FRAME_MAX_SIZE.
+ */
+mpack_error_t mpack_frame_size(const char* data, size_t length, size_t* size, size_t* raw_size);
+
+/**
+ * Decodes a complete frame into the given buffer.
+ *
+ * @param codec The codec with which the frame was written.
+ * @param frame The frame, including its header.
+ * @param size The size of the frame as found by mpack_frame_size().
+ * @param buffer The buffer in which to place the uncompressed data.
+ * @param raw_size The size of the buffer, which must be the uncompressed size
+ *        found by mpack_frame_size().
+ *
+ * @return mpack_ok on success, or mpack_error_invalid if the frame is corrupt.
+ */
+mpack_error_t mpack_frame_decode(const mpack_frame_codec_t* codec, const char* frame, size_t size,
+        char* buffer, size_t raw_size);
+
+#ifdef MPACK_MALLOC
+
+#if MPACK_WRITER
+/**
+ * Initializes a writer that writes compressed frames to the given output
+ * function.
+ *
+ * Messages are collected in a growable buffer. Call
+ * mpack_writer_frame_message() after each complete message; once the
+ * buffer holds at least @p frame_size bytes its contents are compressed
+ * directly into a frame and passed to the output function. The last frame
+ * is written when the writer is destroyed. A message is never split across
+ * frames.
+ *
+ * The buffer and the compressed frames are allocated with the writer's
+ * allocator (see mpack_writer_set_allocator().) Only the writer's small
+ * fixed state is allocated with @ref MPACK_MALLOC, since it is allocated
+ * before an allocator can be set.
+ *
+ * @param writer The MPack writer.
+ * @param codec The codec with which to compress frames. It is copied.
+ * @param frame_size The target size of the uncompressed data of each frame,
+ *        or 0 to use @ref MPACK_FRAME_SIZE.
+ * @param output The function to receive frames.
+ * @param context The context passed to the output function.
+ */
+void mpack_writer_init_frame(mpack_writer_t* writer, const mpack_frame_codec_t* codec, size_t frame_size,
+        mpack_frame_output_t output, void* context);
+
+/**
+ * Marks the end of a message on a frame writer, writing a frame if the
+ * buffered messages have reached the frame size.
+ */
+void mpack_writer_frame_message(mpack_writer_t* writer);
+
+/**
+ * Writes the buffered messages of a frame writer as a frame immediately,
+ * regardless of their size. Nothing is written if no data is buffered.
+ */
+void mpack_writer_flush_frame(mpack_writer_t* writer);
+#endif
+
+#if MPACK_READER
+/**
+ * Initializes a reader that reads compressed frames from the given input
+ * function.
+ *
+ * Each frame is decompressed into a buffer which is lent to the reader as a
+ * chunk (see mpack_reader_set_borrow()), so the reader parses the
+ * uncompressed data in place.
+ *
+ * If the input ends between frames, mpack_error_eof is flagged on the reader
+ * when it tries to read more data. A truncated or corrupt frame flags
+ * mpack_error_invalid.
+ *
+ * Frames are decompressed into buffers allocated with the reader's allocator
+ * (see mpack_reader_set_allocator().) Only the reader's small fixed state is
+ * allocated with @ref MPACK_MALLOC, since it is allocated before an
+ * allocator can be set.
+ *
+ * @param reader The MPack reader.
+ * @param codec The codec with which the frames were written. It is copied.
+ * @param input The function to read frames.
+ * @param context The context passed to the input function.
+ */
+void mpack_reader_init_frame(mpack_reader_t* reader, const mpack_frame_codec_t* codec,
+        mpack_frame_input_t input, void* context);
+#endif
+
+#if MPACK_NODE
+/**
+ * Initializes a tree to parse a stream of messages from compressed frames
+ * read from the given input function.
+ *
+ * This is like mpack_tree_init_stream(). Each frame is decompressed
+ * directly into the tree's buffer if it fits in the space available;
+ * otherwise it is decompressed into a separate buffer and copied as the tree
+ * needs it.
+ *
+ * If the input ends between frames, mpack_error_eof is flagged on the tree.
+ *
+ * The separate buffers are allocated with the tree's allocator (see
+ * mpack_tree_set_allocator().) Only the tree's small fixed state is
+ * allocated with @ref MPACK_MALLOC, since it is allocated before an
+ * allocator can be set.
+ *
+ * @param tree The tree parser.
+ * @param codec The codec with which the frames were written. It is copied.
+ * @param input The function to read frames.
+ * @param context The context passed to the input function.
+ * @param max_message_size The maximum size of a message in bytes.
+ * @param max_message_nodes The maximum number of nodes per message.
+ */
+void mpack_tree_init_frame(mpack_tree_t* tree, const mpack_frame_codec_t* codec,
+        mpack_frame_input_t input, void* context,
+        size_t max_message_size, size_t max_message_nodes);
+#endif
+
+/**
+ * An index of the frames in a buffer of compressed data.
+ *
+ * @code{.c}
+ * mpack_frame_index_t frames;
+ * mpack_frame_index_init(&frames, data, length);
+ *
+ * // on each worker thread, for each of its frames
+ * size_t size, raw_size;
+ * const char* frame = mpack_frame_index_frame(&frames, i, &size, &raw_size);
+ * char* buffer = (char*)malloc(raw_size);
+ * if (mpack_frame_decode(&codec, frame, size, buffer, raw_size) == mpack_ok) {
+ *     mpack_message_index_t messages;
+ *     mpack_message_index_init(&messages, buffer, raw_size);
+ *     mpack_message_index_parse(&messages, 0, mpack_message_index_count(&messages),
+ *             &handle_message, results);
+ *     mpack_message_index_destroy(&messages);
+ * }
+ * free(buffer);
+ * @endcode
+ *
+ * @see mpack_frame_index_init()
+ */
+typedef struct mpack_frame_index_t {
+    const char* data;
+    size_t* offsets; // count + 1 offsets; the last is the end of the last frame
+    size_t count;
+    mpack_error_t error;
+    mpack_allocator_t allocator; // allocator of the offsets
+} mpack_frame_index_t;
+
+/**
+ * Builds an index of all complete frames in the given data.
+ *
+ * The data must remain valid and unchanged for the lifetime of the index.
+ *
+ * If the data contains a malformed frame or ends with an incomplete one,
+ * the index is placed in an error state (see mpack_frame_size().) The
+ * frames before it are still indexed. The index is placed in
+ * mpack_error_memory if it could not be allocated.
+ *
+ * The index must be destroyed with mpack_frame_index_destroy().
+ */
+void mpack_frame_index_init(mpack_frame_index_t* index, const char* data, size_t length);
+
+/**
+ * Builds an index of all complete frames in the given data, allocating with
+ * the given allocator.
+ *
+ * This is the same as mpack_frame_index_init() except that the index is
+ * allocated with @p allocator instead of @ref MPACK_MALLOC.
+ *
+ * @param allocator The allocator to use, or NULL to use @ref MPACK_MALLOC.
+ *     It is copied, so it does not need to outlive the call.
+ */
+void mpack_frame_index_init_allocator(mpack_frame_index_t* index, const char* data, size_t length,
+        const mpack_allocator_t* allocator);
+
+/**
+ * Destroys the index, returning its error state.
+ */
+mpack_error_t mpack_frame_index_destroy(mpack_frame_index_t* index);
+
+/**
+ * Returns the error state of the index.
+ */
+MPACK_INLINE mpack_error_t mpack_frame_index_error(const mpack_frame_index_t* index) {
+    return index->error;
+}
+
+/**
+ * Returns the number of complete frames in the index.
+ */
+MPACK_INLINE size_t mpack_frame_index_count(const mpack_frame_index_t* index) {
+    return index->count;
+}
+
+/**
+ * Returns a pointer to the frame with the given number, placing its size
+ * in @p size and the size of its uncompressed data in @p raw_size. These can
+ * be passed to mpack_frame_decode().
+ *
+ * The frame number must be less than mpack_frame_index_count().
+ */
+const char* mpack_frame_index_frame(const mpack_frame_index_t* index, size_t frame,
+        size_t* size, size_t* raw_size);
+
+#endif
+
+/**
+ * @}
+ */
+
+#endif
+
+MPACK_EXTERN_C_END
+MPACK_HEADER_END
+
+#endif
+
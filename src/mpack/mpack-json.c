@@ -0,0 +1,678 @@
+/*
+ * Copyright (c) 2015-2018 Nicholas Fraser
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#define MPACK_INTERNAL 1
+
+#include "mpack-json.h"
+
+#if MPACK_JSON && MPACK_READER && MPACK_STDIO
+
+void mpack_json_init(mpack_json_t* json, char* buffer, size_t size) {
+    mpack_assert(buffer != NULL, "cannot initialize JSON transcoder with empty buffer");
+    mpack_memset(json, 0, sizeof(*json));
+    json->buffer = buffer;
+    json->size = size;
+
+    if (size < MPACK_JSON_MINIMUM_BUFFER_SIZE) {
+        mpack_break("buffer size is %i, but minimum buffer size is %i",
+                (int)size, (int)MPACK_JSON_MINIMUM_BUFFER_SIZE);
+        json->error = mpack_error_bug;
+    }
+}
+
+void mpack_json_flag_error(mpack_json_t* json, mpack_error_t error) {
+    mpack_log("json %p setting error %i: %s\n", (void*)json, (int)error, mpack_error_to_string(error));
+    if (json->error == mpack_ok)
+        json->error = error;
+}
+
+void mpack_json_flush(mpack_json_t* json) {
+    if (json->error != mpack_ok || json->used == 0 || json->flush == NULL)
+        return;
+    size_t used = json->used;
+    json->used = 0;
+    json->flush(json, json->buffer, used);
+}
+
+mpack_error_t mpack_json_destroy(mpack_json_t* json) {
+    mpack_json_flush(json);
+    return json->error;
+}
+
+
+
+/*
+ * Output
+ */
+
+static bool mpack_json_reserve_slow(mpack_json_t* json) {
+    if (json->error != mpack_ok)
+        return false;
+    if (json->flush == NULL) {
+        mpack_json_flag_error(json, mpack_error_too_big);
+        return false;
+    }
+    mpack_json_flush(json);
+    return json->error == mpack_ok;
+}
+
+// Makes room for the given number of bytes (at most the minimum buffer size)
+// in the buffer, returning false if an error is flagged.
+MPACK_STATIC_INLINE bool mpack_json_reserve(mpack_json_t* json, size_t count) {
+    mpack_assert(count <= MPACK_JSON_MINIMUM_BUFFER_SIZE);
+    if (count <= json->size - json->used)
+        return true;
+    return mpack_json_reserve_slow(json);
+}
+
+void mpack_json_write_raw(mpack_json_t* json, const char* data, size_t count) {
+    if (json->error != mpack_ok)
+        return;
+
+    if (count <= json->size - json->used) {
+        mpack_memcpy(json->buffer + json->used, data, count);
+        json->used += count;
+        return;
+    }
+
+    if (!mpack_json_reserve_slow(json))
+        return;
+
+    // text larger than the buffer is flushed directly
+    if (count >= json->size) {
+        json->flush(json, data, count);
+        return;
+    }
+    mpack_memcpy(json->buffer, data, count);
+    json->used = count;
+}
+
+MPACK_STATIC_INLINE void mpack_json_write_char(mpack_json_t* json, char c) {
+    if (mpack_json_reserve(json, 1))
+        json->buffer[json->used++] = c;
+}
+
+#define mpack_json_write_literal(json, literal) \
+    mpack_json_write_raw((json), (literal), sizeof(literal) - 1)
+
+
+
+/*
+ * Numbers
+ */
+
+static const char mpack_json_digits[] =
+    "0001020304050607080910111213141516171819"
+    "2021222324252627282930313233343536373839"
+    "4041424344454647484950515253545556575859"
+    "6061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+// Formats the given value into the digits ending at end, returning the start.
+static char* mpack_json_format_u64(char* end, uint64_t value) {
+    while (value >= 100) {
+        size_t i = (size_t)(value % 100) * 2;
+        value /= 100;
+        *--end = mpack_json_digits[i + 1];
+        *--end = mpack_json_digits[i];
+    }
+    if (value >= 10) {
+        size_t i = (size_t)value * 2;
+        *--end = mpack_json_digits[i + 1];
+        *--end = mpack_json_digits[i];
+    } else {
+        *--end = (char)('0' + value);
+    }
+    return end;
+}
+
+static void mpack_json_write_u64(mpack_json_t* json, uint64_t value) {
+    char buffer[20];
+    char* end = buffer + sizeof(buffer);
+    char* start = mpack_json_format_u64(end, value);
+    mpack_json_write_raw(json, start, (size_t)(end - start));
+}
+
+static void mpack_json_write_i64(mpack_json_t* json, int64_t value) {
+    char buffer[21];
+    char* end = buffer + sizeof(buffer);
+    char* start;
+    if (value < 0) {
+        start = mpack_json_format_u64(end, (uint64_t)0 - (uint64_t)value);
+        *--start = '-';
+    } else {
+        start = mpack_json_format_u64(end, (uint64_t)value);
+    }
+    mpack_json_write_raw(json, start, (size_t)(end - start));
+}
+
+// Writes a real number formatted with snprintf(), making sure the decimal
+// separator is a period regardless of locale.
+static void mpack_json_write_real(mpack_json_t* json, const char* format, double value) {
+    char buffer[32];
+    int count = mpack_snprintf(buffer, sizeof(buffer), format, value);
+    if (count <= 0 || (size_t)count >= sizeof(buffer)) {
+        mpack_json_flag_error(json, mpack_error_bug);
+        return;
+    }
+    for (int i = 0; i < count; ++i)
+        if (buffer[i] == ',')
+            buffer[i] = '.';
+    mpack_json_write_raw(json, buffer, (size_t)count);
+}
+
+// infinities and NaN are detected from their bits (an exponent of all ones)
+// rather than with floating point comparisons since those may be optimized
+// away under -ffinite-math-only.
+static bool mpack_json_float_is_finite(float value) {
+    union {
+        float f;
+        uint32_t u;
+    } v;
+    v.f = value;
+    return (v.u & UINT32_C(0x7f800000)) != UINT32_C(0x7f800000);
+}
+
+static bool mpack_json_double_is_finite(double value) {
+    #if MPACK_DOUBLES
+    union {
+        double d;
+        uint64_t u;
+    } v;
+    v.d = value;
+    return (v.u & UINT64_C(0x7ff0000000000000)) != UINT64_C(0x7ff0000000000000);
+    #else
+    return mpack_json_float_is_finite((float)value);
+    #endif
+}
+
+static void mpack_json_write_double(mpack_json_t* json, double value) {
+    // infinities and NaN have no JSON representation
+    if (!mpack_json_double_is_finite(value)) {
+        mpack_json_write_literal(json, "null");
+        return;
+    }
+
+    // integral values are formatted as integers, which is much faster than
+    // snprintf(). (zero is excluded to keep the sign of negative zero.)
+    if (value != 0.0 && value >= -9007199254740992.0 && value <= 9007199254740992.0 &&
+            value == (double)(int64_t)value) {
+        mpack_json_write_i64(json, (int64_t)value);
+        return;
+    }
+
+    // 17 significant digits are enough to round-trip any double
+    mpack_json_write_real(json, "%.17g", value);
+}
+
+static void mpack_json_write_float(mpack_json_t* json, float value) {
+    if (!mpack_json_float_is_finite(value)) {
+        mpack_json_write_literal(json, "null");
+        return;
+    }
+
+    if (value != 0.0f && value >= -16777216.0f && value <= 16777216.0f &&
+            value == (float)(int32_t)value) {
+        mpack_json_write_i64(json, (int32_t)value);
+        return;
+    }
+
+    // 9 significant digits are enough to round-trip any float
+    mpack_json_write_real(json, "%.9g", (double)value);
+}
+
+
+
+/*
+ * Strings
+ */
+
+// Bytes that can be copied into a JSON string without escaping or UTF-8
+// decoding.
+static const uint8_t mpack_json_plain[256] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    1, 1, 0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+};
+
+// The UTF-8 decoding state of a string, which is carried across chunks.
+typedef struct mpack_json_utf8_t {
+    char pending[4]; // the bytes of an incomplete character
+    uint8_t count;   // the number of pending bytes
+    uint8_t needed;  // the number of continuation bytes still needed
+    uint8_t low;     // the range of the next continuation byte
+    uint8_t high;
+} mpack_json_utf8_t;
+
+static void mpack_json_write_invalid(mpack_json_t* json) {
+    if (json->replace_invalid)
+        mpack_json_write_literal(json, "\\ufffd");
+    else
+        mpack_json_flag_error(json, mpack_error_invalid);
+}
+
+static void mpack_json_write_escape(mpack_json_t* json, uint8_t c) {
+    switch (c) {
+        case '"':  mpack_json_write_literal(json, "\\\""); return;
+        case '\\': mpack_json_write_literal(json, "\\\\"); return;
+        case '\b': mpack_json_write_literal(json, "\\b"); return;
+        case '\f': mpack_json_write_literal(json, "\\f"); return;
+        case '\n': mpack_json_write_literal(json, "\\n"); return;
+        case '\r': mpack_json_write_literal(json, "\\r"); return;
+        case '\t': mpack_json_write_literal(json, "\\t"); return;
+        default:
+            break;
+    }
+
+    static const char hex[] = "0123456789abcdef";
+    char escape[6] = {'\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xf]};
+    mpack_json_write_raw(json, escape, sizeof(escape));
+}
+
+// Starts decoding a character from its first byte, returning false if the
+// byte cannot start a character.
+static bool mpack_json_utf8_start(mpack_json_utf8_t* utf8, uint8_t c) {
+    utf8->low = 0x80;
+    utf8->high = 0xbf;
+    if (c >= 0xc2 && c <= 0xdf) {
+        utf8->needed = 1;
+    } else if (c >= 0xe0 && c <= 0xef) {
+        utf8->needed = 2;
+        if (c == 0xe0)
+            utf8->low = 0xa0; // overlong
+        else if (c == 0xed)
+            utf8->high = 0x9f; // surrogate
+    } else if (c >= 0xf0 && c <= 0xf4) {
+        utf8->needed = 3;
+        if (c == 0xf0)
+            utf8->low = 0x90; // overlong
+        else if (c == 0xf4)
+            utf8->high = 0x8f; // above U+10FFFF
+    } else {
+        return false;
+    }
+    utf8->pending[0] = (char)c;
+    utf8->count = 1;
+    return true;
+}
+
+static void mpack_json_write_str_chunk(mpack_json_t* json, mpack_json_utf8_t* utf8,
+        const char* data, size_t length)
+{
+    const char* p = data;
+    const char* end = data + length;
+    while (p != end && json->error == mpack_ok) {
+        if (utf8->needed == 0) {
+            const char* run = p;
+            while (p != end && mpack_json_plain[(uint8_t)*p])
+                ++p;
+            if (p != run) {
+                mpack_json_write_raw(json, run, (size_t)(p - run));
+                continue;
+            }
+
+            uint8_t c = (uint8_t)*p++;
+            if (c < 0x80)
+                mpack_json_write_escape(json, c);
+            else if (!mpack_json_utf8_start(utf8, c))
+                mpack_json_write_invalid(json);
+            continue;
+        }
+
+        // a byte that doesn't continue the character is decoded again on
+        // its own after the invalid character
+        uint8_t c = (uint8_t)*p;
+        if (c < utf8->low || c > utf8->high) {
+            utf8->needed = 0;
+            mpack_json_write_invalid(json);
+            continue;
+        }
+
+        ++p;
+        utf8->pending[utf8->count++] = (char)c;
+        utf8->low = 0x80;
+        utf8->high = 0xbf;
+        if (--utf8->needed == 0)
+            mpack_json_write_raw(json, utf8->pending, utf8->count);
+    }
+}
+
+static void mpack_json_write_str_end(mpack_json_t* json, mpack_json_utf8_t* utf8) {
+    if (utf8->needed != 0)
+        mpack_json_write_invalid(json);
+    mpack_json_write_char(json, '"');
+}
+
+void mpack_json_write_str(mpack_json_t* json, const char* str, size_t length) {
+    mpack_assert(length == 0 || str != NULL, "str of length %i is NULL", (int)length);
+    mpack_json_utf8_t utf8;
+    mpack_memset(&utf8, 0, sizeof(utf8));
+    mpack_json_write_char(json, '"');
+    mpack_json_write_str_chunk(json, &utf8, str, length);
+    mpack_json_write_str_end(json, &utf8);
+}
+
+
+
+/*
+ * Base64
+ */
+
+static const char mpack_json_base64_chars[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+// The bytes of an incomplete group, which are carried across chunks.
+typedef struct mpack_json_base64_t {
+    uint8_t carry[3];
+    uint8_t count;
+} mpack_json_base64_t;
+
+static void mpack_json_base64_group(mpack_json_t* json, const uint8_t* group) {
+    if (!mpack_json_reserve(json, 4))
+        return;
+    char* p = json->buffer + json->used;
+    p[0] = mpack_json_base64_chars[group[0] >> 2];
+    p[1] = mpack_json_base64_chars[((group[0] & 0x3) << 4) | (group[1] >> 4)];
+    p[2] = mpack_json_base64_chars[((group[1] & 0xf) << 2) | (group[2] >> 6)];
+    p[3] = mpack_json_base64_chars[group[2] & 0x3f];
+    json->used += 4;
+}
+
+static void mpack_json_base64_chunk(mpack_json_t* json, mpack_json_base64_t* base64,
+        const char* data, size_t length)
+{
+    const uint8_t* p = (const uint8_t*)data;
+    const uint8_t* end = p + length;
+
+    // complete the group carried from the previous chunk
+    if (base64->count != 0) {
+        while (base64->count < 3 && p != end)
+            base64->carry[base64->count++] = *p++;
+        if (base64->count < 3)
+            return;
+        mpack_json_base64_group(json, base64->carry);
+        base64->count = 0;
+    }
+
+    for (; end - p >= 3 && json->error == mpack_ok; p += 3)
+        mpack_json_base64_group(json, p);
+
+    while (p != end)
+        base64->carry[base64->count++] = *p++;
+}
+
+static void mpack_json_base64_end(mpack_json_t* json, mpack_json_base64_t* base64) {
+    if (base64->count == 0)
+        return;
+    uint8_t group[3] = {base64->carry[0], 0, 0};
+    if (base64->count == 2)
+        group[1] = base64->carry[1];
+    mpack_json_base64_group(json, group);
+    if (json->error != mpack_ok)
+        return;
+
+    // replace the characters past the end of the data with padding
+    json->buffer[json->used - 1] = '=';
+    if (base64->count == 1)
+        json->buffer[json->used - 2] = '=';
+}
+
+
+
+/*
+ * Transcoding
+ */
+
+// Returns true if neither the transcoder nor the reader is in an error state.
+MPACK_STATIC_INLINE bool mpack_json_ok(mpack_json_t* json, mpack_reader_t* reader) {
+    return json->error == mpack_ok && mpack_reader_error(reader) == mpack_ok;
+}
+
+// Returns the size of the chunks in which the bytes of large strs, bins and
+// exts are read in place.
+MPACK_STATIC_INLINE size_t mpack_json_chunk_size(mpack_reader_t* reader, size_t length) {
+    if (mpack_should_read_bytes_inplace(reader, length))
+        return length;
+    size_t chunk = reader->size / MPACK_READER_SMALL_FRACTION_DENOMINATOR;
+    return (chunk == 0) ? 1 : chunk;
+}
+
+static void mpack_json_transcode_str(mpack_json_t* json, mpack_reader_t* reader, uint32_t length) {
+    mpack_json_utf8_t utf8;
+    mpack_memset(&utf8, 0, sizeof(utf8));
+    mpack_json_write_char(json, '"');
+
+    size_t chunk = mpack_json_chunk_size(reader, length);
+    size_t left = length;
+    while (left > 0 && mpack_json_ok(json, reader)) {
+        size_t count = (left < chunk) ? left : chunk;
+        const char* data = mpack_read_bytes_inplace(reader, count);
+        if (data == NULL)
+            return;
+        mpack_json_write_str_chunk(json, &utf8, data, count);
+        left -= count;
+    }
+
+    mpack_json_write_str_end(json, &utf8);
+    if (json->error == mpack_error_invalid)
+        mpack_reader_flag_error(reader, mpack_error_invalid);
+    mpack_done_str(reader);
+}
+
+// Writes the bytes of a bin or ext as a base64 string.
+static void mpack_json_transcode_base64(mpack_json_t* json, mpack_reader_t* reader, uint32_t length) {
+    mpack_json_base64_t base64;
+    mpack_memset(&base64, 0, sizeof(base64));
+    mpack_json_write_char(json, '"');
+
+    size_t chunk = mpack_json_chunk_size(reader, length);
+    size_t left = length;
+    while (left > 0 && mpack_json_ok(json, reader)) {
+        size_t count = (left < chunk) ? left : chunk;
+        const char* data = mpack_read_bytes_inplace(reader, count);
+        if (data == NULL)
+            return;
+        mpack_json_base64_chunk(json, &base64, data, count);
+        left -= count;
+    }
+
+    mpack_json_base64_end(json, &base64);
+    mpack_json_write_char(json, '"');
+}
+
+#if MPACK_EXTENSIONS
+static void mpack_json_transcode_ext(mpack_json_t* json, mpack_reader_t* reader, mpack_tag_t tag) {
+    if (json->ext_fn) {
+        json->ext_fn(json, reader, tag);
+        return;
+    }
+
+    switch (json->ext_mode) {
+        case mpack_json_ext_null:
+            mpack_skip_bytes(reader, mpack_tag_bytes(&tag));
+            mpack_json_write_literal(json, "null");
+            break;
+        case mpack_json_ext_object:
+            mpack_json_write_literal(json, "{\"type\":");
+            mpack_json_write_i64(json, mpack_tag_ext_exttype(&tag));
+            mpack_json_write_literal(json, ",\"data\":");
+            mpack_json_transcode_base64(json, reader, mpack_tag_bytes(&tag));
+            mpack_json_write_char(json, '}');
+            break;
+        default:
+            mpack_reader_flag_error(reader, mpack_error_type);
+            return;
+    }
+    mpack_done_ext(reader);
+}
+#endif
+
+// Writes a scalar that needs no reading past its tag, returning false if the
+// tag is not one.
+static bool mpack_json_write_scalar(mpack_json_t* json, mpack_tag_t* tag) {
+    switch (tag->type) {
+        case mpack_type_nil:
+            mpack_json_write_literal(json, "null");
+            return true;
+        case mpack_type_bool:
+            if (tag->v.b)
+                mpack_json_write_literal(json, "true");
+            else
+                mpack_json_write_literal(json, "false");
+            return true;
+        case mpack_type_int:
+            mpack_json_write_i64(json, tag->v.i);
+            return true;
+        case mpack_type_uint:
+            mpack_json_write_u64(json, tag->v.u);
+            return true;
+        case mpack_type_float:
+            mpack_json_write_float(json, tag->v.f);
+            return true;
+        case mpack_type_double:
+            mpack_json_write_double(json, tag->v.d);
+            return true;
+        default:
+            break;
+    }
+    return false;
+}
+
+static void mpack_json_transcode_element(mpack_json_t* json, mpack_reader_t* reader, size_t depth);
+
+// JSON keys must be strings, so other scalars and bins are quoted.
+static void mpack_json_transcode_key(mpack_json_t* json, mpack_reader_t* reader) {
+    mpack_tag_t tag = mpack_read_tag(reader);
+    if (mpack_reader_error(reader) != mpack_ok)
+        return;
+
+    switch (tag.type) {
+        case mpack_type_str:
+            mpack_json_transcode_str(json, reader, tag.v.l);
+            return;
+        case mpack_type_bin:
+            mpack_json_transcode_base64(json, reader, tag.v.l);
+            mpack_done_bin(reader);
+            return;
+        case mpack_type_array:
+        case mpack_type_map:
+        #if MPACK_EXTENSIONS
+        case mpack_type_ext:
+        #endif
+            mpack_reader_flag_error(reader, mpack_error_type);
+            return;
+        default:
+            break;
+    }
+
+    mpack_json_write_char(json, '"');
+    mpack_json_write_scalar(json, &tag);
+    mpack_json_write_char(json, '"');
+}
+
+static void mpack_json_transcode_array(mpack_json_t* json, mpack_reader_t* reader, uint32_t count, size_t depth) {
+    mpack_json_write_char(json, '[');
+    for (uint32_t i = 0; i < count; ++i) {
+        if (i != 0)
+            mpack_json_write_char(json, ',');
+        mpack_json_transcode_element(json, reader, depth + 1);
+        if (!mpack_json_ok(json, reader))
+            return;
+    }
+    mpack_json_write_char(json, ']');
+    mpack_done_array(reader);
+}
+
+static void mpack_json_transcode_map(mpack_json_t* json, mpack_reader_t* reader, uint32_t count, size_t depth) {
+    mpack_json_write_char(json, '{');
+    for (uint32_t i = 0; i < count; ++i) {
+        if (i != 0)
+            mpack_json_write_char(json, ',');
+        mpack_json_transcode_key(json, reader);
+        mpack_json_write_char(json, ':');
+        mpack_json_transcode_element(json, reader, depth + 1);
+        if (!mpack_json_ok(json, reader))
+            return;
+    }
+    mpack_json_write_char(json, '}');
+    mpack_done_map(reader);
+}
+
+static void mpack_json_transcode_element(mpack_json_t* json, mpack_reader_t* reader, size_t depth) {
+    mpack_tag_t tag = mpack_read_tag(reader);
+    if (mpack_reader_error(reader) != mpack_ok)
+        return;
+
+    switch (tag.type) {
+        case mpack_type_str:
+            mpack_json_transcode_str(json, reader, tag.v.l);
+            return;
+        case mpack_type_bin:
+            mpack_json_transcode_base64(json, reader, tag.v.l);
+            mpack_done_bin(reader);
+            return;
+        #if MPACK_EXTENSIONS
+        case mpack_type_ext:
+            mpack_json_transcode_ext(json, reader, tag);
+            return;
+        #endif
+        case mpack_type_array:
+        case mpack_type_map:
+            if (depth >= MPACK_JSON_MAX_DEPTH) {
+                mpack_reader_flag_error(reader, mpack_error_too_big);
+                return;
+            }
+            if (tag.type == mpack_type_array)
+                mpack_json_transcode_array(json, reader, tag.v.n, depth);
+            else
+                mpack_json_transcode_map(json, reader, tag.v.n, depth);
+            return;
+        default:
+            break;
+    }
+
+    if (!mpack_json_write_scalar(json, &tag)) {
+        mpack_break("unhandled type %i", (int)tag.type);
+        mpack_reader_flag_error(reader, mpack_error_bug);
+    }
+}
+
+mpack_error_t mpack_json_transcode(mpack_json_t* json, mpack_reader_t* reader) {
+    if (json->error != mpack_ok)
+        return json->error;
+
+    mpack_json_transcode_element(json, reader, 0);
+
+    // an error on either side stops the transcoder part way through the
+    // message, so it is flagged on both
+    if (mpack_reader_error(reader) != mpack_ok)
+        mpack_json_flag_error(json, mpack_reader_error(reader));
+    else if (json->error != mpack_ok)
+        mpack_reader_flag_error(reader, json->error);
+    return json->error;
+}
+
+#endif
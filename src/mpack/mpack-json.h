@@ -0,0 +1,259 @@
+/*
+ * Copyright (c) 2015-2018 Nicholas Fraser
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * @file
+ *
+ * Declares the MPack JSON transcoder.
+ */
+
+#ifndef MPACK_JSON_H
+#define MPACK_JSON_H 1
+
+#include "mpack-reader.h"
+
+MPACK_HEADER_START
+MPACK_EXTERN_C_START
+
+#if MPACK_JSON && MPACK_READER && MPACK_STDIO
+
+/**
+ * @defgroup json JSON Transcoder
+ *
+ * The JSON transcoder converts MessagePack read from an @ref mpack_reader_t
+ * into strict JSON (RFC 8259) text, which is written to a buffer and
+ * flushed to a callback as it fills.
+ *
+ * Unlike the debug printers (such as mpack_print_data_to_callback()), the
+ * output is always valid JSON. Strings are checked for valid UTF-8 and are
+ * escaped as needed, bins are written as base64 strings, and the handling of
+ * exts is configurable. No tree is built: data is streamed straight from the
+ * reader to the output, so memory use does not depend on the size of the
+ * input. Strings, bins and exts of any size are transcoded in chunks.
+ *
+ * Map keys that are not strings are converted to strings: numbers, booleans
+ * and nil are written as their JSON text in quotes, and bins as base64.
+ * Other keys flag @ref mpack_error_type. Floating point infinities and NaNs
+ * have no JSON representation and are written as null.
+ *
+ * @code{.c}
+ * char buffer[65536];
+ * mpack_json_t json;
+ * mpack_json_init(&json, buffer, sizeof(buffer));
+ * mpack_json_set_flush(&json, &my_flush);
+ *
+ * // one line of JSON per message
+ * while (mpack_reader_remaining(&reader, NULL) > 0) {
+ *     if (mpack_json_transcode(&json, &reader) != mpack_ok)
+ *         break;
+ *     mpack_json_write_raw(&json, "\n", 1);
+ * }
+ *
+ * mpack_error_t error = mpack_json_destroy(&json);
+ * @endcode
+ *
+ * @note This requires @ref MPACK_READER and @ref MPACK_STDIO (for
+ * formatting floating point numbers.)
+ *
+ * @{
+ */
+
+/**
+ * A JSON transcoder. See @ref json.
+ */
+typedef struct mpack_json_t mpack_json_t;
+
+/**
+ * The JSON transcoder's flush function. It should write out the given
+ * text, flagging an error with mpack_json_flag_error() if it fails.
+ */
+typedef void (*mpack_json_flush_t)(mpack_json_t* json, const char* data, size_t count);
+
+/**
+ * A function to transcode an ext into JSON.
+ *
+ * The ext's tag has already been read. The function must read exactly the
+ * ext's bytes from the reader (for example with mpack_read_bytes() in
+ * chunks), call mpack_done_ext(), and write exactly one JSON value with
+ * mpack_json_write_raw() and mpack_json_write_str().
+ *
+ * @see mpack_json_set_ext_handler()
+ */
+typedef void (*mpack_json_ext_t)(mpack_json_t* json, mpack_reader_t* reader, mpack_tag_t tag);
+
+/**
+ * How exts are transcoded if no handler is set with
+ * mpack_json_set_ext_handler().
+ */
+typedef enum mpack_json_ext_mode_t {
+    mpack_json_ext_error = 0, /**< Exts flag @ref mpack_error_type. This is the default. */
+    mpack_json_ext_null,      /**< Exts are written as null. */
+    mpack_json_ext_object,    /**< Exts are written as {"type": <exttype>, "data": "<base64>"}. */
+} mpack_json_ext_mode_t;
+
+/**
+ * The minimum size of a JSON transcoder's buffer.
+ */
+#define MPACK_JSON_MINIMUM_BUFFER_SIZE 32
+
+/* Hide internals from documentation */
+/** @cond */
+
+struct mpack_json_t {
+    char* buffer;
+    size_t size;
+    size_t used;
+    mpack_json_flush_t flush;
+    mpack_json_ext_t ext_fn;
+    mpack_json_ext_mode_t ext_mode;
+    bool replace_invalid;
+    void* context;
+    mpack_error_t error;
+};
+
+/** @endcond */
+
+/**
+ * Initializes a JSON transcoder that writes to the given buffer.
+ *
+ * The buffer must be at least @ref MPACK_JSON_MINIMUM_BUFFER_SIZE bytes.
+ * For high throughput it should be large (tens of kilobytes or more) so
+ * that the flush function is called rarely. Text that does not fit in the
+ * buffer flags @ref mpack_error_too_big unless a flush function is set.
+ */
+void mpack_json_init(mpack_json_t* json, char* buffer, size_t size);
+
+/**
+ * Flushes any buffered text and destroys the transcoder, returning its
+ * error state.
+ */
+mpack_error_t mpack_json_destroy(mpack_json_t* json);
+
+/**
+ * Sets the function to write out text when the buffer is full.
+ */
+MPACK_INLINE void mpack_json_set_flush(mpack_json_t* json, mpack_json_flush_t flush) {
+    json->flush = flush;
+}
+
+/**
+ * Sets the custom pointer to pass to the transcoder's callbacks.
+ */
+MPACK_INLINE void mpack_json_set_context(mpack_json_t* json, void* context) {
+    json->context = context;
+}
+
+/**
+ * Returns the custom context set with mpack_json_set_context().
+ */
+MPACK_INLINE void* mpack_json_context(mpack_json_t* json) {
+    return json->context;
+}
+
+/**
+ * Sets how exts are transcoded. See @ref mpack_json_ext_mode_t.
+ */
+MPACK_INLINE void mpack_json_set_ext_mode(mpack_json_t* json, mpack_json_ext_mode_t mode) {
+    json->ext_mode = mode;
+}
+
+/**
+ * Sets a function to transcode exts, overriding the ext mode, or NULL to
+ * use the ext mode again.
+ */
+MPACK_INLINE void mpack_json_set_ext_handler(mpack_json_t* json, mpack_json_ext_t ext_fn) {
+    json->ext_fn = ext_fn;
+}
+
+/**
+ * Sets whether invalid UTF-8 in strings is replaced with U+FFFD.
+ *
+ * By default, invalid UTF-8 flags @ref mpack_error_invalid.
+ */
+MPACK_INLINE void mpack_json_set_replace_invalid(mpack_json_t* json, bool replace) {
+    json->replace_invalid = replace;
+}
+
+/**
+ * Places the transcoder in the given error state.
+ */
+void mpack_json_flag_error(mpack_json_t* json, mpack_error_t error);
+
+/**
+ * Returns the error state of the transcoder.
+ */
+MPACK_INLINE mpack_error_t mpack_json_error(mpack_json_t* json) {
+    return json->error;
+}
+
+/**
+ * Returns the number of bytes of text in the buffer that have not been
+ * flushed. Without a flush function, this is the length of all text written.
+ */
+MPACK_INLINE size_t mpack_json_buffer_used(mpack_json_t* json) {
+    return json->used;
+}
+
+/**
+ * Flushes the buffered text to the flush function, if any.
+ */
+void mpack_json_flush(mpack_json_t* json);
+
+/**
+ * Reads one complete MessagePack element from the reader and writes it as
+ * JSON.
+ *
+ * Errors flagged on either the reader or the transcoder (such as a map key
+ * that cannot be converted, or output that does not fit in a buffer without
+ * a flush function) are flagged on both, since the element is left partly
+ * read.
+ *
+ * Elements nested more than @ref MPACK_JSON_MAX_DEPTH deep flag
+ * @ref mpack_error_too_big, bounding the stack used by the transcoder.
+ *
+ * @return The error state of the transcoder.
+ */
+mpack_error_t mpack_json_transcode(mpack_json_t* json, mpack_reader_t* reader);
+
+/**
+ * Writes raw text to the output, for example a separator between
+ * transcoded messages. The text is not escaped.
+ */
+void mpack_json_write_raw(mpack_json_t* json, const char* data, size_t count);
+
+/**
+ * Writes the given UTF-8 string as a quoted and escaped JSON string.
+ *
+ * Invalid UTF-8 is handled as configured by mpack_json_set_replace_invalid().
+ */
+void mpack_json_write_str(mpack_json_t* json, const char* str, size_t length);
+
+/**
+ * @}
+ */
+
+#endif
+
+MPACK_EXTERN_C_END
+MPACK_HEADER_END
+
+#endif
+
@@ -23,12 +23,77 @@
 
 #include "mpack-node.h"
 
+#if MPACK_NODE && MPACK_STDIO && MPACK_MMAP
+#if defined(_WIN32)
+#include <windows.h>
+#include <io.h>
+#else
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#endif
+#endif
+
+#if MPACK_NODE && MPACK_FD
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+
 #if MPACK_NODE
 
+// Returns the value of an int or uint node. (Either type can be read as
+// either, as with the value union.)
+MPACK_STATIC_INLINE uint64_t mpack_node_data_u64(mpack_tree_t* tree, mpack_node_data_t* data) {
+    #if MPACK_NODE_COMPACT
+    if (data->len != 0)
+        return mpack_load_u64(tree->data + data->value.offset);
+    return (data->type == mpack_type_int) ? (uint64_t)(int64_t)data->value.i : data->value.u;
+    #else
+    MPACK_UNUSED(tree);
+    return data->value.u;
+    #endif
+}
+
+MPACK_STATIC_INLINE int64_t mpack_node_data_i64(mpack_tree_t* tree, mpack_node_data_t* data) {
+    #if MPACK_NODE_COMPACT
+    if (data->len != 0)
+        return mpack_load_i64(tree->data + data->value.offset);
+    return (data->type == mpack_type_int) ? (int64_t)data->value.i : (int64_t)data->value.u;
+    #else
+    MPACK_UNUSED(tree);
+    return data->value.i;
+    #endif
+}
+
+// Returns the value of a double node.
+MPACK_STATIC_INLINE double mpack_node_data_double(mpack_tree_t* tree, mpack_node_data_t* data) {
+    #if MPACK_NODE_COMPACT
+    return mpack_load_double(tree->data + data->value.offset);
+    #else
+    MPACK_UNUSED(tree);
+    return data->value.d;
+    #endif
+}
+
+MPACK_STATIC_INLINE uint64_t mpack_node_value_u(mpack_node_t node) {
+    return mpack_node_data_u64(node.tree, node.data);
+}
+
+MPACK_STATIC_INLINE int64_t mpack_node_value_i(mpack_node_t node) {
+    return mpack_node_data_i64(node.tree, node.data);
+}
+
+MPACK_STATIC_INLINE double mpack_node_value_d(mpack_node_t node) {
+    return mpack_node_data_double(node.tree, node.data);
+}
+
 MPACK_STATIC_INLINE const char* mpack_node_data_unchecked(mpack_node_t node) {
     mpack_assert(mpack_node_error(node) == mpack_ok, "tree is in an error state!");
 
-    mpack_type_t type = node.data->type;
+    mpack_type_t type = mpack_node_data_type(node.data);
     MPACK_UNUSED(type);
     #if MPACK_EXTENSIONS
     mpack_assert(type == mpack_type_str || type == mpack_type_bin || type == mpack_type_ext,
@@ -45,7 +110,7 @@ MPACK_STATIC_INLINE const char* mpack_node_data_unchecked(mpack_node_t node) {
 MPACK_STATIC_INLINE int8_t mpack_node_exttype_unchecked(mpack_node_t node) {
     mpack_assert(mpack_node_error(node) == mpack_ok, "tree is in an error state!");
 
-    mpack_type_t type = node.data->type;
+    mpack_type_t type = mpack_node_data_type(node.data);
     MPACK_UNUSED(type);
     mpack_assert(type == mpack_type_ext, "node of type %i (%s) is not an ext type!",
             type, mpack_type_to_string(type));
@@ -58,24 +123,487 @@ MPACK_STATIC_INLINE int8_t mpack_node_exttype_unchecked(mpack_node_t node) {
 
 
 /*
- * Tree Parsing
+ * Map Hash Index
+ *
+ * Maps with at least MPACK_NODE_MAP_INDEX_THRESHOLD pairs are given a hidden
+ * header node directly before their children in the node pages. The first
+ * lookup in the map (or the end of parsing, if eager indexing is enabled)
+ * builds an open-addressed hash table of its keys in a separate node page,
+ * referenced from the header.
+ *
+ * Each slot of the table contains the index of a key/value pair plus one, or
+ * zero if empty. Duplicate keys are found once while building; the slot of
+ * a duplicated key is marked so that looking it up still flags
+ * mpack_error_data exactly as the linear search does.
+ *
+ * The header node's type tracks the state of the index: nil if it has not
+ * been built yet, array if it has been built (in which case len is the slot
+ * mask and children points to the slots), or missing if it could not be
+ * allocated (in which case we always do a linear search.)
  */
 
-#ifdef MPACK_MALLOC
+#if defined(MPACK_MALLOC) && (MPACK_NODE_MAP_INDEX || MPACK_NODE_INTERN)
+MPACK_STATIC_INLINE uint32_t mpack_node_map_hash_str(const char* str, size_t length) {
+    // FNV-1a
+    uint32_t hash = UINT32_C(2166136261);
+    for (size_t i = 0; i < length; ++i) {
+        hash ^= (uint8_t)str[i];
+        hash *= UINT32_C(16777619);
+    }
+    return hash;
+}
+#endif
+
+#if defined(MPACK_MALLOC) && MPACK_NODE_MAP_INDEX
+
+#define MPACK_NODE_MAP_INDEX_DUPLICATE UINT32_C(0x80000000)
+
+MPACK_STATIC_INLINE bool mpack_tree_map_has_index(mpack_tree_t* tree, mpack_node_data_t* map) {
+    // the slot count must fit in a uint32_t with room for the duplicate bit
+    return tree->pool == NULL &&
+            map->len >= MPACK_NODE_MAP_INDEX_THRESHOLD &&
+            map->len <= (UINT32_MAX >> 2);
+}
+
+MPACK_STATIC_INLINE uint32_t mpack_node_map_hash_num(uint64_t num) {
+    // non-negative signed keys hash the same as the equivalent unsigned keys
+    num ^= num >> 33;
+    num *= UINT64_C(0xff51afd7ed558ccd);
+    num ^= num >> 33;
+    return (uint32_t)num;
+}
+
+// Returns true if the given map key matches the given lookup key. A number
+// lookup key is passed in num as a uint64_t (cast from int64_t if type is int.)
+static bool mpack_node_map_key_matches(mpack_tree_t* tree, mpack_node_data_t* key,
+        mpack_type_t type, uint64_t num, const char* str, size_t length)
+{
+    switch (type) {
+        case mpack_type_str:
+            return key->type == mpack_type_str && key->len == length &&
+                    mpack_memcmp(str, mpack_node_data_unchecked(mpack_node(tree, key)), length) == 0;
+        case mpack_type_int:
+            return (key->type == mpack_type_int && key->value.i == (int64_t)num) ||
+                (key->type == mpack_type_uint && (int64_t)num >= 0 && key->value.u == num);
+        case mpack_type_uint:
+            return (key->type == mpack_type_uint && key->value.u == num) ||
+                (key->type == mpack_type_int && key->value.i >= 0 && (uint64_t)key->value.i == num);
+        default:
+            break;
+    }
+    return false;
+}
+
+static void mpack_node_map_index_insert(mpack_tree_t* tree, mpack_node_data_t* map,
+        uint32_t* slots, uint32_t mask, uint32_t pair)
+{
+    mpack_node_data_t* key = map->value.children + pair * 2;
+
+    uint32_t hash;
+    uint64_t num = 0;
+    const char* str = NULL;
+    switch (key->type) {
+        case mpack_type_str:
+            str = mpack_node_data_unchecked(mpack_node(tree, key));
+            hash = mpack_node_map_hash_str(str, key->len);
+            break;
+        case mpack_type_int:
+            num = (uint64_t)key->value.i;
+            hash = mpack_node_map_hash_num(num);
+            break;
+        case mpack_type_uint:
+            num = key->value.u;
+            hash = mpack_node_map_hash_num(num);
+            break;
+        default:
+            // other key types cannot be looked up
+            return;
+    }
+
+    uint32_t i = hash & mask;
+    while (slots[i] != 0) {
+        uint32_t other = (slots[i] & ~MPACK_NODE_MAP_INDEX_DUPLICATE) - 1;
+        if (mpack_node_map_key_matches(tree, map->value.children + other * 2, key->type, num, str, key->len)) {
+            slots[i] |= MPACK_NODE_MAP_INDEX_DUPLICATE;
+            return;
+        }
+        i = (i + 1) & mask;
+    }
+    slots[i] = pair + 1;
+}
+
+static void mpack_node_map_index_build(mpack_tree_t* tree, mpack_node_data_t* map, mpack_node_data_t* header) {
+    mpack_assert(header->type == mpack_type_nil, "index is already built");
+
+    // we keep the table at most half full
+    uint32_t count = 1;
+    while (count < map->len * 2)
+        count *= 2;
+
+    mpack_tree_page_t* page = NULL;
+    if ((uint64_t)count * sizeof(uint32_t) <= SIZE_MAX - sizeof(mpack_tree_page_t))
+        page = (mpack_tree_page_t*)mpack_allocator_alloc(&tree->allocator, sizeof(mpack_tree_page_t) + sizeof(uint32_t) * count);
+    if (page == NULL) {
+        mpack_log("failed to allocate index for map %p; using linear search\n", (void*)map);
+        header->type = mpack_type_missing;
+        return;
+    }
+    mpack_log("allocated index page %p of %i slots for map %p\n", (void*)page, (int)count, (void*)map);
+
+    // the slots are stored in place of the page's nodes
+    uint32_t* slots = (uint32_t*)(void*)page->nodes;
+    mpack_memset(slots, 0, sizeof(uint32_t) * count);
+    for (uint32_t pair = 0; pair < map->len; ++pair)
+        mpack_node_map_index_insert(tree, map, slots, count - 1, pair);
+
+    page->next = tree->next;
+    tree->next = page;
+    mpack_stats_add(&tree->stats, pages, 1);
+
+    header->type = mpack_type_array;
+    header->len = count - 1;
+    header->value.children = page->nodes;
+}
+
+// Returns the header of the map's index, building it if needed, or NULL if
+// the map has no index.
+static mpack_node_data_t* mpack_node_map_index(mpack_node_t node) {
+    mpack_node_data_t* map = node.data;
+    if (!mpack_tree_map_has_index(node.tree, map))
+        return NULL;
+
+    mpack_node_data_t* header = map->value.children - 1;
+    if (header->type == mpack_type_nil)
+        mpack_node_map_index_build(node.tree, map, header);
+    return (header->type == mpack_type_array) ? header : NULL;
+}
+
+static mpack_node_data_t* mpack_node_map_index_find(mpack_node_t node, mpack_node_data_t* header,
+        uint32_t hash, mpack_type_t type, uint64_t num, const char* str, size_t length)
+{
+    const uint32_t* slots = (const uint32_t*)(const void*)header->value.children;
+    uint32_t mask = header->len;
+
+    for (uint32_t i = hash & mask; slots[i] != 0; i = (i + 1) & mask) {
+        uint32_t pair = (slots[i] & ~MPACK_NODE_MAP_INDEX_DUPLICATE) - 1;
+        if (mpack_node_map_key_matches(node.tree, mpack_node_child(node, pair * 2), type, num, str, length)) {
+            if (slots[i] & MPACK_NODE_MAP_INDEX_DUPLICATE) {
+                mpack_node_flag_error(node, mpack_error_data);
+                return NULL;
+            }
+            return mpack_node_child(node, pair * 2 + 1);
+        }
+    }
+
+    return NULL;
+}
+
+#endif
+
+
+
+/*
+ * Key Interning
+ *
+ * The bytes of all interned keys are stored back to back in a single buffer,
+ * and each ID has an entry with the offset, length and hash of its key. The
+ * hash table holds IDs in open-addressed slots, and it grows to stay at most
+ * half full. The entries are sized to match so they never grow separately.
+ *
+ * When a tree parses with an intern table, each map with at least one pair
+ * is given hidden nodes in front of its children (and in front of its index
+ * header, if any) which store the IDs of its keys as an array of uint32_t.
+ */
+
+#if defined(MPACK_MALLOC) && MPACK_NODE_INTERN
+
+// the slot count must fit in a uint32_t
+#define MPACK_INTERN_MAX (UINT32_C(1) << 30)
+
+#define MPACK_NODE_IDS_PER_NODE (sizeof(mpack_node_data_t) / sizeof(uint32_t))
+
+void mpack_intern_init(mpack_intern_t* intern) {
+    mpack_memset(intern, 0, sizeof(*intern));
+    intern->limit = MPACK_INTERN_MAX;
+}
+
+void mpack_intern_set_allocator(mpack_intern_t* intern, const mpack_allocator_t* allocator) {
+    if (intern->slots != NULL || intern->strings != NULL) {
+        mpack_break("cannot set the allocator after keys have been interned!");
+        if (intern->error == mpack_ok)
+            intern->error = mpack_error_bug;
+        return;
+    }
+
+    if (allocator != NULL)
+        intern->allocator = *allocator;
+    else
+        mpack_memset(&intern->allocator, 0, sizeof(intern->allocator));
+}
+
+mpack_error_t mpack_intern_destroy(mpack_intern_t* intern) {
+    if (intern->strings)
+        mpack_allocator_free(&intern->allocator, intern->strings);
+    if (intern->entries)
+        mpack_allocator_free(&intern->allocator, intern->entries);
+    if (intern->slots)
+        mpack_allocator_free(&intern->allocator, intern->slots);
+    return intern->error;
+}
+
+// Returns the ID of the given key, or zero if it isn't in the table, in which
+// case the empty slot where it would go is placed in slot.
+static uint32_t mpack_intern_lookup(const mpack_intern_t* intern, const char* str, uint32_t length,
+        uint32_t hash, uint32_t* slot)
+{
+    if (intern->slots == NULL)
+        return 0;
+
+    uint32_t i = hash & intern->mask;
+    for (; intern->slots[i] != 0; i = (i + 1) & intern->mask) {
+        uint32_t id = intern->slots[i];
+        const mpack_intern_entry_t* entry = &intern->entries[id - 1];
+        if (entry->hash == hash && entry->length == length &&
+                mpack_memcmp(intern->strings + entry->offset, str, length) == 0)
+            return id;
+    }
+
+    *slot = i;
+    return 0;
+}
+
+static bool mpack_intern_grow(mpack_intern_t* intern) {
+    uint32_t capacity = (intern->slots == NULL) ? 64 : (intern->mask + 1) * 2;
+    uint32_t* slots = (uint32_t*)mpack_allocator_alloc(&intern->allocator, sizeof(uint32_t) * capacity);
+    if (slots == NULL)
+        return false;
+
+    mpack_intern_entry_t* entries;
+    if (intern->entries == NULL)
+        entries = (mpack_intern_entry_t*)mpack_allocator_alloc(&intern->allocator,
+                sizeof(mpack_intern_entry_t) * (capacity / 2));
+    else
+        entries = (mpack_intern_entry_t*)mpack_allocator_realloc(&intern->allocator, intern->entries,
+                sizeof(mpack_intern_entry_t) * intern->count, sizeof(mpack_intern_entry_t) * (capacity / 2));
+    if (entries == NULL) {
+        mpack_allocator_free(&intern->allocator, slots);
+        return false;
+    }
+    intern->entries = entries;
+
+    mpack_memset(slots, 0, sizeof(uint32_t) * capacity);
+    for (uint32_t id = 1; id <= intern->count; ++id) {
+        uint32_t i = entries[id - 1].hash & (capacity - 1);
+        while (slots[i] != 0)
+            i = (i + 1) & (capacity - 1);
+        slots[i] = id;
+    }
+
+    if (intern->slots)
+        mpack_allocator_free(&intern->allocator, intern->slots);
+    intern->slots = slots;
+    intern->mask = capacity - 1;
+    return true;
+}
 
-// fix up the alloc size to make sure it exactly fits the
-// maximum number of nodes it can contain (the allocator will
-// waste it back anyway, but we round it down just in case)
+static bool mpack_intern_reserve_strings(mpack_intern_t* intern, size_t length) {
+    if (length <= intern->strings_capacity - intern->strings_used)
+        return true;
+
+    size_t capacity = (intern->strings_capacity == 0) ? 256 : intern->strings_capacity;
+    while (length > capacity - intern->strings_used) {
+        if (capacity > SIZE_MAX / 2)
+            return false;
+        capacity *= 2;
+    }
+
+    char* strings;
+    if (intern->strings == NULL)
+        strings = (char*)mpack_allocator_alloc(&intern->allocator, capacity);
+    else
+        strings = (char*)mpack_allocator_realloc(&intern->allocator, intern->strings, intern->strings_used, capacity);
+    if (strings == NULL)
+        return false;
+
+    intern->strings = strings;
+    intern->strings_capacity = capacity;
+    return true;
+}
+
+uint32_t mpack_intern(mpack_intern_t* intern, const char* str, size_t length) {
+    if (intern->error != mpack_ok || length > UINT32_MAX)
+        return 0;
+
+    uint32_t hash = mpack_node_map_hash_str(str, length);
+    uint32_t slot = 0;
+    uint32_t id = mpack_intern_lookup(intern, str, (uint32_t)length, hash, &slot);
+    if (id != 0)
+        return id;
+
+    if (intern->count >= intern->limit || intern->count >= MPACK_INTERN_MAX)
+        return 0;
+
+    if (intern->slots == NULL || intern->count + 1 > (intern->mask + 1) / 2) {
+        if (!mpack_intern_grow(intern)) {
+            intern->error = mpack_error_memory;
+            return 0;
+        }
+        for (slot = hash & intern->mask; intern->slots[slot] != 0; slot = (slot + 1) & intern->mask)
+            {}
+    }
+
+    if (!mpack_intern_reserve_strings(intern, length)) {
+        intern->error = mpack_error_memory;
+        return 0;
+    }
+
+    mpack_intern_entry_t* entry = &intern->entries[intern->count];
+    entry->offset = intern->strings_used;
+    entry->length = (uint32_t)length;
+    entry->hash = hash;
+    if (length > 0)
+        mpack_memcpy(intern->strings + intern->strings_used, str, length);
+    intern->strings_used += length;
+
+    id = ++intern->count;
+    intern->slots[slot] = id;
+    mpack_log("interned key %i of %i bytes\n", (int)id, (int)length);
+    return id;
+}
+
+uint32_t mpack_intern_cstr(mpack_intern_t* intern, const char* cstr) {
+    mpack_assert(cstr != NULL, "cstr is NULL");
+    return mpack_intern(intern, cstr, mpack_strlen(cstr));
+}
+
+uint32_t mpack_intern_find(const mpack_intern_t* intern, const char* str, size_t length) {
+    if (length > UINT32_MAX)
+        return 0;
+    uint32_t slot;
+    return mpack_intern_lookup(intern, str, (uint32_t)length, mpack_node_map_hash_str(str, length), &slot);
+}
+
+const char* mpack_intern_key(const mpack_intern_t* intern, uint32_t id, size_t* length) {
+    mpack_assert(id != 0 && id <= intern->count, "id %u is not in the table", (unsigned)id);
+    const mpack_intern_entry_t* entry = &intern->entries[id - 1];
+    *length = entry->length;
+    if (intern->strings == NULL)
+        return "";
+    return intern->strings + entry->offset;
+}
+
+// Returns the number of hidden nodes that store the key IDs of an interned
+// map with the given number of pairs.
+MPACK_STATIC_INLINE size_t mpack_tree_map_id_nodes(uint32_t len) {
+    return ((size_t)len + MPACK_NODE_IDS_PER_NODE - 1) / MPACK_NODE_IDS_PER_NODE;
+}
+
+// Returns the key IDs of the given interned map.
+static uint32_t* mpack_node_map_ids(mpack_tree_t* tree, mpack_node_data_t* map) {
+    mpack_node_data_t* first = mpack_node_data_children(tree, map);
+    #if MPACK_NODE_MAP_INDEX
+    if (mpack_tree_map_has_index(tree, map))
+        --first;
+    #endif
+    return (uint32_t*)(void*)(first - mpack_tree_map_id_nodes(map->len));
+}
+
+// Interns the given parsed map key, storing its ID.
+static bool mpack_tree_intern_key(mpack_tree_t* tree, mpack_node_data_t* key, uint32_t* id) {
+    *id = 0;
+    if (key->type != mpack_type_str)
+        return true;
+
+    mpack_intern_t* intern = tree->parser.intern;
+    *id = mpack_intern(intern, tree->data + key->value.offset, key->len);
+    if (*id == 0 && mpack_intern_error(intern) != mpack_ok) {
+        mpack_tree_flag_error(tree, mpack_intern_error(intern));
+        return false;
+    }
+    return true;
+}
+#endif
 
-#define MPACK_NODES_PER_PAGE \
-    ((MPACK_NODE_PAGE_SIZE - sizeof(mpack_tree_page_t)) / sizeof(mpack_node_data_t) + 1)
 
-#define MPACK_PAGE_ALLOC_SIZE \
-    (sizeof(mpack_tree_page_t) + sizeof(mpack_node_data_t) * (MPACK_NODES_PER_PAGE - 1))
 
+/*
+ * Tree Parsing
+ */
+
+#if MPACK_NODE_LAZY
+// Returns true if the given node is an unexpanded lazy span. This is only
+// valid once the node's parent has been parsed completely.
+MPACK_STATIC_INLINE bool mpack_node_data_is_lazy(mpack_tree_t* tree, mpack_node_data_t* node) {
+    return (node->type == mpack_type_array || node->type == mpack_type_map) &&
+            node->len != 0 && mpack_node_data_children(tree, node)->type == mpack_type_missing;
+}
 #endif
 
 #ifdef MPACK_MALLOC
+/*
+ * The read function of a tree initialized with mpack_tree_init_feed(). Data
+ * is never read; it is passed to mpack_tree_feed() instead.
+ */
+static size_t mpack_tree_feed_read(mpack_tree_t* tree, char* buffer, size_t count) {
+    MPACK_UNUSED(tree);
+    MPACK_UNUSED(buffer);
+    MPACK_UNUSED(count);
+    return 0;
+}
+
+/*
+ * Makes room in the tree's buffer for the given number of bytes after its
+ * data, growing the buffer if needed.
+ *
+ * The data of a buffered tree starts wherever the previous message ended. It
+ * is moved back to the start of the buffer only when the new bytes would run
+ * past the end, so consecutive small messages can be parsed without
+ * repeatedly copying the data that follows them.
+ */
+static bool mpack_tree_buffer_reserve(mpack_tree_t* tree, size_t bytes) {
+    size_t offset = (tree->buffer == NULL) ? 0 : (size_t)(tree->data - tree->buffer);
+    if (tree->buffer != NULL && bytes <= tree->buffer_capacity - offset - tree->data_length)
+        return true;
+
+    // compact the data if it doesn't start the buffer
+    if (offset > 0) {
+        mpack_log("moving %i bytes back to start of buffer\n", (int)tree->data_length);
+        mpack_memmove(tree->buffer, tree->data, tree->data_length);
+        mpack_stats_add(&tree->stats, bytes_copied, tree->data_length);
+        tree->data = tree->buffer;
+        if (bytes <= tree->buffer_capacity - tree->data_length)
+            return true;
+    }
+
+    // expand the buffer
+    // TODO: check for overflow?
+    size_t new_capacity = (tree->buffer_capacity == 0) ? MPACK_BUFFER_SIZE : tree->buffer_capacity;
+    while (new_capacity < tree->data_length + bytes)
+        new_capacity *= 2;
+    if (new_capacity > tree->max_size)
+        new_capacity = tree->max_size;
+
+    mpack_log("expanding buffer from %i to %i\n", (int)tree->buffer_capacity, (int)new_capacity);
+
+    char* new_buffer;
+    if (tree->buffer == NULL)
+        new_buffer = (char*)mpack_allocator_alloc(&tree->allocator, new_capacity);
+    else
+        new_buffer = (char*)mpack_allocator_realloc(&tree->allocator, tree->buffer, tree->data_length, new_capacity);
+
+    if (new_buffer == NULL) {
+        mpack_tree_flag_error(tree, mpack_error_memory);
+        return false;
+    }
+
+    mpack_stats_add(&tree->stats, growths, 1);
+    mpack_stats_add(&tree->stats, bytes_copied, tree->data_length);
+    tree->data = new_buffer;
+    tree->buffer = new_buffer;
+    tree->buffer_capacity = new_capacity;
+    return true;
+}
+
 /*
  * Fills the tree until we have at least enough bytes for the current node.
  */
@@ -95,6 +623,12 @@ static bool mpack_tree_reserve_fill(mpack_tree_t* tree) {
         return false;
     }
 
+    // a fed tree waits for more data to be passed to mpack_tree_feed()
+    if (tree->read_fn == &mpack_tree_feed_read) {
+        mpack_log("not enough data fed.\n");
+        return false;
+    }
+
     // we'll need a read function to fetch more data. if there's
     // no read function, the data should contain an entire message
     // (or messages), so we flag it as invalid.
@@ -104,38 +638,14 @@ static bool mpack_tree_reserve_fill(mpack_tree_t* tree) {
         return false;
     }
 
-    // expand the buffer if needed
-    if (tree->data_length + bytes > tree->buffer_capacity) {
-
-        // TODO: check for overflow?
-        size_t new_capacity = (tree->buffer_capacity == 0) ? MPACK_BUFFER_SIZE : tree->buffer_capacity;
-        while (new_capacity < tree->data_length + bytes)
-            new_capacity *= 2;
-        if (new_capacity > tree->max_size)
-            new_capacity = tree->max_size;
-
-        mpack_log("expanding buffer from %i to %i\n", (int)tree->buffer_capacity, (int)new_capacity);
-
-        char* new_buffer;
-        if (tree->buffer == NULL)
-            new_buffer = (char*)MPACK_MALLOC(new_capacity);
-        else
-            new_buffer = (char*)mpack_realloc(tree->buffer, tree->data_length, new_capacity);
-
-        if (new_buffer == NULL) {
-            mpack_tree_flag_error(tree, mpack_error_memory);
-            return false;
-        }
-
-        tree->data = new_buffer;
-        tree->buffer = new_buffer;
-        tree->buffer_capacity = new_capacity;
-    }
+    if (!mpack_tree_buffer_reserve(tree, bytes))
+        return false;
 
     // request as much data as possible, looping until we have
     // all the data we need
     do {
-        size_t read = tree->read_fn(tree, tree->buffer + tree->data_length, tree->buffer_capacity - tree->data_length);
+        size_t end = (size_t)(tree->data - tree->buffer) + tree->data_length;
+        size_t read = tree->read_fn(tree, tree->buffer + end, tree->buffer_capacity - end);
 
         // If the fill function encounters an error, it should flag an error on
         // the tree.
@@ -156,6 +666,8 @@ static bool mpack_tree_reserve_fill(mpack_tree_t* tree) {
         }
 
         mpack_log("read %u more bytes\n", (uint32_t)read);
+        mpack_stats_add(&tree->stats, fills, 1);
+        mpack_stats_add(&tree->stats, bytes, read);
         tree->data_length += read;
         tree->parser.possible_nodes_left += read;
     } while (tree->parser.possible_nodes_left < bytes);
@@ -231,7 +743,7 @@ static bool mpack_tree_push_stack(mpack_tree_t* tree, mpack_node_data_t* first_c
 
         // Replace the stack-allocated parsing stack
         if (!parser->stack_owned) {
-            mpack_level_t* new_stack = (mpack_level_t*)MPACK_MALLOC(sizeof(mpack_level_t) * new_capacity);
+            mpack_level_t* new_stack = (mpack_level_t*)mpack_allocator_alloc(&tree->allocator, sizeof(mpack_level_t) * new_capacity);
             if (!new_stack) {
                 mpack_tree_flag_error(tree, mpack_error_memory);
                 return false;
@@ -242,7 +754,7 @@ static bool mpack_tree_push_stack(mpack_tree_t* tree, mpack_node_data_t* first_c
 
         // Realloc the allocated parsing stack
         } else {
-            mpack_level_t* new_stack = (mpack_level_t*)mpack_realloc(parser->stack,
+            mpack_level_t* new_stack = (mpack_level_t*)mpack_allocator_realloc(&tree->allocator, parser->stack,
                     sizeof(mpack_level_t) * parser->stack_capacity, sizeof(mpack_level_t) * new_capacity);
             if (!new_stack) {
                 mpack_tree_flag_error(tree, mpack_error_memory);
@@ -251,6 +763,7 @@ static bool mpack_tree_push_stack(mpack_tree_t* tree, mpack_node_data_t* first_c
             parser->stack = new_stack;
         }
         parser->stack_capacity = new_capacity;
+        mpack_stats_add(&tree->stats, growths, 1);
         #else
         mpack_tree_flag_error(tree, mpack_error_too_big);
         return false;
@@ -261,115 +774,474 @@ static bool mpack_tree_push_stack(mpack_tree_t* tree, mpack_node_data_t* first_c
     ++parser->level;
     parser->stack[parser->level].child = first_child;
     parser->stack[parser->level].left = total;
+    #if defined(MPACK_MALLOC) && MPACK_NODE_INTERN
+    parser->stack[parser->level].ids = NULL;
+    #endif
+    mpack_stats_max(&tree->stats, max_depth, parser->level);
     return true;
 }
 
-static bool mpack_tree_parse_children(mpack_tree_t* tree, mpack_node_data_t* node) {
-    mpack_tree_parser_t* parser = &tree->parser;
-    mpack_assert(parser->state == mpack_tree_parse_state_in_progress);
+#if defined(MPACK_MALLOC) && MPACK_NODE_COMPACT
+/*
+ * Adds storage for the given number of nodes to the node index table,
+ * returning the index of its first node. Storage larger than a page takes
+ * several consecutive entries.
+ */
+static bool mpack_tree_add_page(mpack_tree_t* tree, mpack_node_data_t* nodes, size_t count, uint32_t* index) {
+    size_t entries = (count + MPACK_NODES_PER_PAGE - 1) / MPACK_NODES_PER_PAGE;
+    if ((uint64_t)(tree->page_count + entries) * MPACK_NODES_PER_PAGE > (uint64_t)UINT32_MAX + 1) {
+        mpack_tree_flag_error(tree, mpack_error_too_big);
+        return false;
+    }
 
-    mpack_type_t type = node->type;
-    size_t total = node->len;
+    if (tree->page_count + entries > tree->page_capacity) {
+        size_t new_capacity = (tree->page_capacity == 0) ? 8 : tree->page_capacity * 2;
+        while (new_capacity < tree->page_count + entries)
+            new_capacity *= 2;
 
-    // Calculate total elements to read
-    if (type == mpack_type_map) {
-        if ((uint64_t)total * 2 > SIZE_MAX) {
-            mpack_tree_flag_error(tree, mpack_error_too_big);
+        mpack_node_data_t** new_pages;
+        if (tree->pages == NULL)
+            new_pages = (mpack_node_data_t**)mpack_allocator_alloc(&tree->allocator,
+                    sizeof(mpack_node_data_t*) * new_capacity);
+        else
+            new_pages = (mpack_node_data_t**)mpack_allocator_realloc(&tree->allocator, tree->pages,
+                    sizeof(mpack_node_data_t*) * tree->page_count, sizeof(mpack_node_data_t*) * new_capacity);
+        if (new_pages == NULL) {
+            mpack_tree_flag_error(tree, mpack_error_memory);
             return false;
         }
-        total *= 2;
-    }
 
-    // Make sure we are under our total node limit (TODO can this overflow?)
-    tree->node_count += total;
-    if (tree->node_count > tree->max_nodes) {
-        mpack_tree_flag_error(tree, mpack_error_too_big);
-        return false;
+        mpack_log("grew node index table from %i to %i pages\n", (int)tree->page_capacity, (int)new_capacity);
+        tree->pages = new_pages;
+        tree->page_capacity = new_capacity;
     }
 
-    // Each node is at least one byte. Count these bytes now to make
-    // sure there is enough data left.
-    if (!mpack_tree_reserve_bytes(tree, total))
-        return false;
+    *index = (uint32_t)(tree->page_count * MPACK_NODES_PER_PAGE);
+    for (size_t i = 0; i < entries; ++i)
+        tree->pages[tree->page_count++] = nodes + i * MPACK_NODES_PER_PAGE;
+    return true;
+}
+#endif
 
-    // If there are enough nodes left in the current page, no need to grow
-    if (total <= parser->nodes_left) {
-        node->value.children = parser->nodes;
-        parser->nodes += total;
-        parser->nodes_left -= total;
+#ifdef MPACK_MALLOC
+/*
+ * Returns the number of nodes that fit in a page of the given size in bytes.
+ */
+static size_t mpack_page_nodes(size_t page_size) {
+    if (page_size == 0)
+        return MPACK_NODES_PER_PAGE;
+    if (page_size < sizeof(mpack_tree_page_t))
+        return 1;
+    return (page_size - sizeof(mpack_tree_page_t)) / sizeof(mpack_node_data_t) + 1;
+}
 
-    } else {
+MPACK_STATIC_INLINE size_t mpack_page_alloc_size(size_t nodes) {
+    return sizeof(mpack_tree_page_t) + sizeof(mpack_node_data_t) * (nodes - 1);
+}
 
-        #ifdef MPACK_MALLOC
+void mpack_page_cache_init(mpack_page_cache_t* cache, size_t page_size, size_t max_pages) {
+    mpack_memset(cache, 0, sizeof(*cache));
+    cache->max_count = max_pages;
+    cache->page_nodes = mpack_page_nodes(page_size);
+}
 
-        // We can't grow if we're using a fixed pool (i.e. we didn't start with a page)
-        if (!tree->next) {
-            mpack_tree_flag_error(tree, mpack_error_too_big);
+void mpack_page_cache_destroy(mpack_page_cache_t* cache) {
+    mpack_tree_page_t* page = cache->pages;
+    while (page != NULL) {
+        mpack_tree_page_t* next = page->next;
+        MPACK_FREE(page);
+        page = next;
+    }
+    cache->pages = NULL;
+    cache->count = 0;
+}
+
+bool mpack_page_cache_reserve(mpack_page_cache_t* cache, size_t count) {
+    if (count > cache->max_count)
+        count = cache->max_count;
+    while (cache->count < count) {
+        mpack_tree_page_t* page = (mpack_tree_page_t*)MPACK_MALLOC(mpack_page_alloc_size(cache->page_nodes));
+        if (page == NULL)
             return false;
-        }
+        page->next = cache->pages;
+        cache->pages = page;
+        ++cache->count;
+    }
+    return true;
+}
 
-        // Otherwise we need to grow, and the node's children need to be contiguous.
-        // This is a heuristic to decide whether we should waste the remaining space
-        // in the current page and start a new one, or give the children their
-        // own page. With a fraction of 1/8, this causes at most 12% additional
-        // waste. Note that reducing this too much causes less cache coherence and
-        // more malloc() overhead due to smaller allocations, so there's a tradeoff
-        // here. This heuristic could use some improvement, especially with custom
-        // page sizes.
-
-        mpack_tree_page_t* page;
-
-        if (total > MPACK_NODES_PER_PAGE || parser->nodes_left > MPACK_NODES_PER_PAGE / 8) {
-            // TODO: this should check for overflow
-            page = (mpack_tree_page_t*)MPACK_MALLOC(
-                    sizeof(mpack_tree_page_t) + sizeof(mpack_node_data_t) * (total - 1));
-            if (page == NULL) {
-                mpack_tree_flag_error(tree, mpack_error_memory);
-                return false;
-            }
-            mpack_log("allocated seperate page %p for %i children, %i left in page of %i total\n",
-                    (void*)page, (int)total, (int)parser->nodes_left, (int)MPACK_NODES_PER_PAGE);
+/*
+ * Allocates a standard page, taking it from the page cache if the tree has
+ * one, and adds it to the tree's standard pages.
+ */
+static mpack_tree_page_t* mpack_tree_alloc_standard_page(mpack_tree_t* tree) {
+    mpack_page_cache_t* cache = tree->page_cache;
+    mpack_tree_page_t* page;
+    if (cache == NULL) {
+        page = (mpack_tree_page_t*)mpack_allocator_alloc(&tree->allocator, mpack_page_alloc_size(tree->page_nodes));
+    } else if (cache->pages != NULL) {
+        page = cache->pages;
+        cache->pages = page->next;
+        --cache->count;
+    } else {
+        page = (mpack_tree_page_t*)MPACK_MALLOC(mpack_page_alloc_size(cache->page_nodes));
+    }
 
-            node->value.children = page->nodes;
+    if (page == NULL) {
+        mpack_tree_flag_error(tree, mpack_error_memory);
+        return NULL;
+    }
+    page->next = tree->standard_pages;
+    tree->standard_pages = page;
+    mpack_stats_add(&tree->stats, pages, 1);
+    return page;
+}
 
-        } else {
-            page = (mpack_tree_page_t*)MPACK_MALLOC(MPACK_PAGE_ALLOC_SIZE);
-            if (page == NULL) {
-                mpack_tree_flag_error(tree, mpack_error_memory);
-                return false;
-            }
-            mpack_log("allocated new page %p for %i children, wasting %i in page of %i total\n",
-                    (void*)page, (int)total, (int)parser->nodes_left, (int)MPACK_NODES_PER_PAGE);
+/*
+ * Returns the number of nodes in the tree's standard pages.
+ */
+MPACK_STATIC_INLINE size_t mpack_tree_page_nodes(mpack_tree_t* tree) {
+    return (tree->page_cache != NULL) ? tree->page_cache->page_nodes : tree->page_nodes;
+}
+#endif
 
-            node->value.children = page->nodes;
-            parser->nodes = page->nodes + total;
-            parser->nodes_left = MPACK_NODES_PER_PAGE - total;
-        }
+/*
+ * Allocates contiguous storage for the given number of child nodes from the
+ * node pages or pool and stores it as the children of the given node,
+ * flagging an error and returning false if it fails.
+ */
+static bool mpack_tree_alloc_children(mpack_tree_t* tree, mpack_node_data_t* node, size_t count) {
+    mpack_tree_parser_t* parser = &tree->parser;
 
+    // If there are enough nodes left in the current page, no need to grow
+    if (count <= parser->nodes_left) {
+        #if MPACK_NODE_COMPACT
+        // empty containers refer to the first node since the next index may
+        // be past the last page when the current page is full
+        node->value.children = (count == 0) ? 0 : parser->nodes_index;
+        parser->nodes_index += (uint32_t)count;
+        #else
+        node->value.children = parser->nodes;
+        #endif
+        parser->nodes += count;
+        parser->nodes_left -= count;
+        return true;
+    }
+
+    #ifdef MPACK_MALLOC
+
+    // We can't grow if we're using a fixed pool
+    if (tree->pool != NULL) {
+        mpack_tree_flag_error(tree, mpack_error_too_big);
+        return false;
+    }
+
+    // Otherwise we need to grow, and the node's children need to be contiguous.
+    // This is a heuristic to decide whether we should waste the remaining space
+    // in the current page and start a new one, or give the children their
+    // own page. With a fraction of 1/8, this causes at most 12% additional
+    // waste. Note that reducing this too much causes less cache coherence and
+    // more malloc() overhead due to smaller allocations, so there's a tradeoff
+    // here. This heuristic could use some improvement, especially with custom
+    // page sizes.
+
+    mpack_tree_page_t* page;
+    size_t page_nodes = mpack_tree_page_nodes(tree);
+    bool separate = count > page_nodes || parser->nodes_left > page_nodes / 8;
+
+    if (separate) {
+        // TODO: this should check for overflow
+        page = (mpack_tree_page_t*)mpack_allocator_alloc(&tree->allocator, mpack_page_alloc_size(count));
+        if (page == NULL) {
+            mpack_tree_flag_error(tree, mpack_error_memory);
+            return false;
+        }
+        mpack_log("allocated seperate page %p for %i children, %i left in page of %i total\n",
+                (void*)page, (int)count, (int)parser->nodes_left, (int)page_nodes);
         page->next = tree->next;
         tree->next = page;
+        mpack_stats_add(&tree->stats, pages, 1);
 
-        #else
-        // We can't grow if we don't have an allocator
+    } else {
+        page = mpack_tree_alloc_standard_page(tree);
+        if (page == NULL)
+            return false;
+        mpack_log("allocated new page %p for %i children, wasting %i in page of %i total\n",
+                (void*)page, (int)count, (int)parser->nodes_left, (int)page_nodes);
+    }
+
+    #if MPACK_NODE_COMPACT
+    uint32_t index;
+    if (!mpack_tree_add_page(tree, page->nodes, separate ? count : page_nodes, &index))
+        return false;
+    node->value.children = index;
+    if (!separate)
+        parser->nodes_index = index + (uint32_t)count;
+    #else
+    node->value.children = page->nodes;
+    #endif
+
+    if (!separate) {
+        parser->nodes = page->nodes + count;
+        parser->nodes_left = page_nodes - count;
+    }
+    return true;
+
+    #else
+    // We can't grow if we don't have an allocator
+    mpack_tree_flag_error(tree, mpack_error_too_big);
+    return false;
+    #endif
+}
+
+/*
+ * Stores the given byte offset into the data in the node.
+ */
+MPACK_STATIC_INLINE bool mpack_tree_set_offset(mpack_tree_t* tree, mpack_node_data_t* node, size_t offset) {
+    #if MPACK_NODE_COMPACT
+    if (offset > UINT32_MAX) {
         mpack_tree_flag_error(tree, mpack_error_too_big);
         return false;
-        #endif
     }
+    node->value.offset = (uint32_t)offset;
+    #else
+    MPACK_UNUSED(tree);
+    node->value.offset = offset;
+    #endif
+    return true;
+}
+
+#if MPACK_NODE_SPANS
+/*
+ * Records the byte offset at which the node starts in the data.
+ */
+MPACK_STATIC_INLINE bool mpack_tree_set_start(mpack_tree_t* tree, mpack_node_data_t* node) {
+    #if MPACK_NODE_COMPACT
+    if (tree->size > UINT32_MAX) {
+        mpack_tree_flag_error(tree, mpack_error_too_big);
+        return false;
+    }
+    node->start = (uint32_t)tree->size;
+    #else
+    node->start = tree->size;
+    #endif
+    return true;
+}
+#endif
+
+#if MPACK_NODE_COMPACT
+#define MPACK_NODE_COMPACT_MAX_LEN UINT32_C(0x0fffffff)
+#endif
+
+/*
+ * Stores the given length in the node.
+ */
+MPACK_STATIC_INLINE bool mpack_tree_set_len(mpack_tree_t* tree, mpack_node_data_t* node, uint32_t len) {
+    #if MPACK_NODE_COMPACT
+    if (len > MPACK_NODE_COMPACT_MAX_LEN) {
+        mpack_tree_flag_error(tree, mpack_error_too_big);
+        return false;
+    }
+    node->len = len & MPACK_NODE_COMPACT_MAX_LEN;
+    #else
+    MPACK_UNUSED(tree);
+    node->len = len;
+    #endif
+    return true;
+}
+
+/*
+ * Stores a number that may not fit inline in a compact node. If it doesn't
+ * fit, the node instead references it in the data (right after the type byte
+ * of the current node.)
+ */
+
+MPACK_STATIC_INLINE bool mpack_tree_parse_u64(mpack_tree_t* tree, mpack_node_data_t* node, uint64_t value) {
+    #if MPACK_NODE_COMPACT
+    if (value <= UINT32_MAX) {
+        node->value.u = (uint32_t)value;
+        return true;
+    }
+    node->len = 1;
+    return mpack_tree_set_offset(tree, node, tree->size + 1);
+    #else
+    MPACK_UNUSED(tree);
+    node->value.u = value;
+    return true;
+    #endif
+}
+
+MPACK_STATIC_INLINE bool mpack_tree_parse_i64(mpack_tree_t* tree, mpack_node_data_t* node, int64_t value) {
+    #if MPACK_NODE_COMPACT
+    if (value >= INT32_MIN && value <= INT32_MAX) {
+        node->value.i = (int32_t)value;
+        return true;
+    }
+    node->len = 1;
+    return mpack_tree_set_offset(tree, node, tree->size + 1);
+    #else
+    MPACK_UNUSED(tree);
+    node->value.i = value;
+    return true;
+    #endif
+}
+
+#if MPACK_DOUBLES
+MPACK_STATIC_INLINE bool mpack_tree_parse_double(mpack_tree_t* tree, mpack_node_data_t* node) {
+    #if MPACK_NODE_COMPACT
+    return mpack_tree_set_offset(tree, node, tree->size + 1);
+    #else
+    node->value.d = mpack_load_double(tree->data + tree->size + 1);
+    return true;
+    #endif
+}
+#endif
+
+#if MPACK_NODE_LAZY
+/*
+ * Records a compound node below the lazy depth as an unparsed span. The
+ * whole span is scanned to find its size (reading more data if needed) and
+ * its children are given a single hidden marker node holding the offset of
+ * the span. The children are parsed later by mpack_tree_expand().
+ */
+static bool mpack_tree_parse_lazy(mpack_tree_t* tree, mpack_node_data_t* node, uint32_t len) {
+    mpack_tree_parser_t* parser = &tree->parser;
+
+    size_t size;
+    while (true) {
+        mpack_error_t error = mpack_message_size(tree->data + tree->size,
+                tree->data_length - tree->size, &size);
+        if (error == mpack_ok)
+            break;
+        if (error != mpack_error_eof) {
+            mpack_tree_flag_error(tree, error);
+            return false;
+        }
+
+        // reserve everything we have plus at least one byte to force a fill
+        if (!mpack_tree_reserve_bytes(tree, tree->data_length - tree->size - parser->current_node_reserved))
+            return false;
+    }
+
+    // we may have reserved more than the span while filling
+    if (size - 1 > parser->current_node_reserved) {
+        if (!mpack_tree_reserve_bytes(tree, size - 1 - parser->current_node_reserved))
+            return false;
+    } else {
+        parser->current_node_reserved = size - 1;
+    }
+
+    if (!mpack_tree_set_len(tree, node, len) || !mpack_tree_alloc_children(tree, node, 1))
+        return false;
+    mpack_node_data_t* marker = mpack_node_data_children(tree, node);
+    marker->type = mpack_type_missing;
+    marker->len = 0;
+    if (!mpack_tree_set_offset(tree, marker, tree->size))
+        return false;
+
+    // The whole span is reserved rather than one byte per child, so we
+    // offset the size that mpack_tree_parse_node() will subtract for the
+    // children.
+    tree->size += (node->type == mpack_type_map) ? (size_t)len * 2 : len;
+    return true;
+}
+#endif
+
+
+static bool mpack_tree_parse_children(mpack_tree_t* tree, mpack_node_data_t* node, uint32_t len) {
+    mpack_tree_parser_t* parser = &tree->parser;
+    mpack_assert(parser->state == mpack_tree_parse_state_in_progress);
+
+    mpack_type_t type = mpack_node_data_type(node);
+    size_t total = len;
+
+    #if MPACK_NODE_LAZY
+    if (tree->lazy_depth != 0 && parser->level >= tree->lazy_depth && total != 0)
+        return mpack_tree_parse_lazy(tree, node, len);
+    #endif
+
+    // Calculate total elements to read
+    if (type == mpack_type_map) {
+        if ((uint64_t)total * 2 > SIZE_MAX) {
+            mpack_tree_flag_error(tree, mpack_error_too_big);
+            return false;
+        }
+        total *= 2;
+    }
+
+    // Make sure we are under our total node limit (TODO can this overflow?)
+    tree->node_count += total;
+    if (tree->node_count > tree->max_nodes) {
+        mpack_tree_flag_error(tree, mpack_error_too_big);
+        return false;
+    }
+
+    // Each node is at least one byte. Count these bytes now to make
+    // sure there is enough data left.
+    if (!mpack_tree_reserve_bytes(tree, total))
+        return false;
+    if (!mpack_tree_set_len(tree, node, len))
+        return false;
+
+    // Large maps get a hidden header node in front of their children to
+    // reference their hash index, and maps parsed with an intern table get
+    // hidden nodes in front of that to store their key IDs. (These are not
+    // counted against the node limit.)
+    size_t count = total;
+    #if defined(MPACK_MALLOC) && MPACK_NODE_MAP_INDEX
+    bool has_index = type == mpack_type_map && mpack_tree_map_has_index(tree, node);
+    if (has_index)
+        ++count;
+    #endif
+    #if defined(MPACK_MALLOC) && MPACK_NODE_INTERN
+    size_t id_nodes = 0;
+    if (type == mpack_type_map && parser->intern != NULL)
+        id_nodes = mpack_tree_map_id_nodes(len);
+    count += id_nodes;
+    #endif
+
+    if (!mpack_tree_alloc_children(tree, node, count))
+        return false;
+
+    #if defined(MPACK_MALLOC) && MPACK_NODE_INTERN
+    uint32_t* ids = NULL;
+    if (id_nodes != 0) {
+        ids = (uint32_t*)(void*)mpack_node_data_children(tree, node);
+        node->value.children += (uint32_t)id_nodes;
+    }
+    #endif
+
+    #if defined(MPACK_MALLOC) && MPACK_NODE_MAP_INDEX
+    if (has_index) {
+        // the index is built later, on first lookup
+        node->value.children->type = mpack_type_nil;
+        ++node->value.children;
+    }
+    #endif
 
-    return mpack_tree_push_stack(tree, node->value.children, total);
+    if (!mpack_tree_push_stack(tree, mpack_node_data_children(tree, node), total))
+        return false;
+
+    #if defined(MPACK_MALLOC) && MPACK_NODE_INTERN
+    // the stack was pushed if the map has any pairs
+    if (ids != NULL)
+        parser->stack[parser->level].ids = ids;
+    #endif
+    return true;
 }
 
-static bool mpack_tree_parse_bytes(mpack_tree_t* tree, mpack_node_data_t* node) {
-    node->value.offset = tree->size + tree->parser.current_node_reserved + 1;
-    return mpack_tree_reserve_bytes(tree, node->len);
+static bool mpack_tree_parse_bytes(mpack_tree_t* tree, mpack_node_data_t* node, uint32_t len) {
+    if (!mpack_tree_set_offset(tree, node, tree->size + tree->parser.current_node_reserved + 1))
+        return false;
+    return mpack_tree_reserve_bytes(tree, len) && mpack_tree_set_len(tree, node, len);
 }
 
 #if MPACK_EXTENSIONS
-static bool mpack_tree_parse_ext(mpack_tree_t* tree, mpack_node_data_t* node) {
+static bool mpack_tree_parse_ext(mpack_tree_t* tree, mpack_node_data_t* node, uint32_t len) {
     // reserve space for exttype
     tree->parser.current_node_reserved += sizeof(int8_t);
     node->type = mpack_type_ext;
-    return mpack_tree_parse_bytes(tree, node);
+    return mpack_tree_parse_bytes(tree, node, len);
 }
 #endif
 
@@ -385,359 +1257,111 @@ static bool mpack_tree_parse_node_contents(mpack_tree_t* tree, mpack_node_data_t
     mpack_log("node type %x\n", type);
     tree->parser.current_node_reserved = 0;
 
-    // as with mpack_read_tag(), the fastest way to parse a node is to switch
-    // on the first byte, and to explicitly list every possible byte. we switch
-    // on the first four bits in size-optimized builds.
-
-    #if MPACK_OPTIMIZE_FOR_SIZE
-    switch (type >> 4) {
-
-        // positive fixnum
-        case 0x0: case 0x1: case 0x2: case 0x3:
-        case 0x4: case 0x5: case 0x6: case 0x7:
-            node->type = mpack_type_uint;
-            node->value.u = type;
-            return true;
-
-        // negative fixnum
-        case 0xe: case 0xf:
-            node->type = mpack_type_int;
-            node->value.i = (int8_t)type;
-            return true;
-
-        // fixmap
-        case 0x8:
-            node->type = mpack_type_map;
-            node->len = (uint32_t)(type & ~0xf0);
-            return mpack_tree_parse_children(tree, node);
-
-        // fixarray
-        case 0x9:
-            node->type = mpack_type_array;
-            node->len = (uint32_t)(type & ~0xf0);
-            return mpack_tree_parse_children(tree, node);
+    #if MPACK_NODE_COMPACT
+    // the length is also the flag for numbers stored in the data
+    node->len = 0;
+    #endif
 
-        // fixstr
-        case 0xa: case 0xb:
-            node->type = mpack_type_str;
-            node->len = (uint32_t)(type & ~0xe0);
-            return mpack_tree_parse_bytes(tree, node);
+    // the fix types are checked by range since they are the most common. as
+    // with mpack_read_tag(), the rest are decoded through their descriptors
+    // so we only need to switch on their type.
+    if (type <= 0x7f) {
+        node->type = mpack_type_uint;
+        node->value.u = type;
+        return true;
+    }
+    if (type >= 0xe0) {
+        node->type = mpack_type_int;
+        node->value.i = (int8_t)type;
+        return true;
+    }
+    if (type <= 0x8f) {
+        node->type = mpack_type_map;
+        return mpack_tree_parse_children(tree, node, (uint32_t)(type & 0xf));
+    }
+    if (type <= 0x9f) {
+        node->type = mpack_type_array;
+        return mpack_tree_parse_children(tree, node, (uint32_t)(type & 0xf));
+    }
+    if (type <= 0xbf) {
+        node->type = mpack_type_str;
+        return mpack_tree_parse_bytes(tree, node, (uint32_t)(type & 0x1f));
+    }
 
-        // not one of the common infix types
-        default:
-            break;
+    const mpack_tag_desc_t* desc = &mpack_tag_descs[type];
+    if (desc->type == mpack_type_missing) {
+        mpack_tree_flag_error(tree, mpack_error_invalid);
+        return false;
+    }
+    #if !MPACK_EXTENSIONS
+    if (desc->type == MPACK_TAG_DESC_EXT) {
+        mpack_tree_flag_error(tree, mpack_error_unsupported);
+        return false;
     }
     #endif
 
-    switch (type) {
-
-        #if !MPACK_OPTIMIZE_FOR_SIZE
-        // positive fixnum
-        case 0x00: case 0x01: case 0x02: case 0x03: case 0x04: case 0x05: case 0x06: case 0x07:
-        case 0x08: case 0x09: case 0x0a: case 0x0b: case 0x0c: case 0x0d: case 0x0e: case 0x0f:
-        case 0x10: case 0x11: case 0x12: case 0x13: case 0x14: case 0x15: case 0x16: case 0x17:
-        case 0x18: case 0x19: case 0x1a: case 0x1b: case 0x1c: case 0x1d: case 0x1e: case 0x1f:
-        case 0x20: case 0x21: case 0x22: case 0x23: case 0x24: case 0x25: case 0x26: case 0x27:
-        case 0x28: case 0x29: case 0x2a: case 0x2b: case 0x2c: case 0x2d: case 0x2e: case 0x2f:
-        case 0x30: case 0x31: case 0x32: case 0x33: case 0x34: case 0x35: case 0x36: case 0x37:
-        case 0x38: case 0x39: case 0x3a: case 0x3b: case 0x3c: case 0x3d: case 0x3e: case 0x3f:
-        case 0x40: case 0x41: case 0x42: case 0x43: case 0x44: case 0x45: case 0x46: case 0x47:
-        case 0x48: case 0x49: case 0x4a: case 0x4b: case 0x4c: case 0x4d: case 0x4e: case 0x4f:
-        case 0x50: case 0x51: case 0x52: case 0x53: case 0x54: case 0x55: case 0x56: case 0x57:
-        case 0x58: case 0x59: case 0x5a: case 0x5b: case 0x5c: case 0x5d: case 0x5e: case 0x5f:
-        case 0x60: case 0x61: case 0x62: case 0x63: case 0x64: case 0x65: case 0x66: case 0x67:
-        case 0x68: case 0x69: case 0x6a: case 0x6b: case 0x6c: case 0x6d: case 0x6e: case 0x6f:
-        case 0x70: case 0x71: case 0x72: case 0x73: case 0x74: case 0x75: case 0x76: case 0x77:
-        case 0x78: case 0x79: case 0x7a: case 0x7b: case 0x7c: case 0x7d: case 0x7e: case 0x7f:
-            node->type = mpack_type_uint;
-            node->value.u = type;
-            return true;
-
-        // negative fixnum
-        case 0xe0: case 0xe1: case 0xe2: case 0xe3: case 0xe4: case 0xe5: case 0xe6: case 0xe7:
-        case 0xe8: case 0xe9: case 0xea: case 0xeb: case 0xec: case 0xed: case 0xee: case 0xef:
-        case 0xf0: case 0xf1: case 0xf2: case 0xf3: case 0xf4: case 0xf5: case 0xf6: case 0xf7:
-        case 0xf8: case 0xf9: case 0xfa: case 0xfb: case 0xfc: case 0xfd: case 0xfe: case 0xff:
-            node->type = mpack_type_int;
-            node->value.i = (int8_t)type;
-            return true;
-
-        // fixmap
-        case 0x80: case 0x81: case 0x82: case 0x83: case 0x84: case 0x85: case 0x86: case 0x87:
-        case 0x88: case 0x89: case 0x8a: case 0x8b: case 0x8c: case 0x8d: case 0x8e: case 0x8f:
-            node->type = mpack_type_map;
-            node->len = (uint32_t)(type & ~0xf0);
-            return mpack_tree_parse_children(tree, node);
-
-        // fixarray
-        case 0x90: case 0x91: case 0x92: case 0x93: case 0x94: case 0x95: case 0x96: case 0x97:
-        case 0x98: case 0x99: case 0x9a: case 0x9b: case 0x9c: case 0x9d: case 0x9e: case 0x9f:
-            node->type = mpack_type_array;
-            node->len = (uint32_t)(type & ~0xf0);
-            return mpack_tree_parse_children(tree, node);
-
-        // fixstr
-        case 0xa0: case 0xa1: case 0xa2: case 0xa3: case 0xa4: case 0xa5: case 0xa6: case 0xa7:
-        case 0xa8: case 0xa9: case 0xaa: case 0xab: case 0xac: case 0xad: case 0xae: case 0xaf:
-        case 0xb0: case 0xb1: case 0xb2: case 0xb3: case 0xb4: case 0xb5: case 0xb6: case 0xb7:
-        case 0xb8: case 0xb9: case 0xba: case 0xbb: case 0xbc: case 0xbd: case 0xbe: case 0xbf:
-            node->type = mpack_type_str;
-            node->len = (uint32_t)(type & ~0xe0);
-            return mpack_tree_parse_bytes(tree, node);
-        #endif
+    // reserve the value or length (the exttype is reserved separately.) the
+    // data may move while reserving so we load the value afterwards.
+    if (desc->width != 0 && !mpack_tree_reserve_bytes(tree, desc->width))
+        return false;
+    uint64_t value = mpack_tag_desc_value(desc, tree->data + tree->size, tree->data_length - tree->size);
 
-        // nil
-        case 0xc0:
+    switch (desc->type) {
+        case mpack_type_nil:
             node->type = mpack_type_nil;
             return true;
 
-        // bool
-        case 0xc2: case 0xc3:
+        case mpack_type_bool:
             node->type = mpack_type_bool;
-            node->value.b = type & 1;
+            node->value.b = value != 0;
             return true;
 
-        // bin8
-        case 0xc4:
-            node->type = mpack_type_bin;
-            if (!mpack_tree_reserve_bytes(tree, sizeof(uint8_t)))
-                return false;
-            node->len = mpack_load_u8(tree->data + tree->size + 1);
-            return mpack_tree_parse_bytes(tree, node);
-
-        // bin16
-        case 0xc5:
-            node->type = mpack_type_bin;
-            if (!mpack_tree_reserve_bytes(tree, sizeof(uint16_t)))
-                return false;
-            node->len = mpack_load_u16(tree->data + tree->size + 1);
-            return mpack_tree_parse_bytes(tree, node);
-
-        // bin32
-        case 0xc6:
-            node->type = mpack_type_bin;
-            if (!mpack_tree_reserve_bytes(tree, sizeof(uint32_t)))
-                return false;
-            node->len = mpack_load_u32(tree->data + tree->size + 1);
-            return mpack_tree_parse_bytes(tree, node);
-
-        #if MPACK_EXTENSIONS
-        // ext8
-        case 0xc7:
-            if (!mpack_tree_reserve_bytes(tree, sizeof(uint8_t)))
-                return false;
-            node->len = mpack_load_u8(tree->data + tree->size + 1);
-            return mpack_tree_parse_ext(tree, node);
-
-        // ext16
-        case 0xc8:
-            if (!mpack_tree_reserve_bytes(tree, sizeof(uint16_t)))
-                return false;
-            node->len = mpack_load_u16(tree->data + tree->size + 1);
-            return mpack_tree_parse_ext(tree, node);
+        case mpack_type_uint:
+            node->type = mpack_type_uint;
+            return mpack_tree_parse_u64(tree, node, value);
 
-        // ext32
-        case 0xc9:
-            if (!mpack_tree_reserve_bytes(tree, sizeof(uint32_t)))
-                return false;
-            node->len = mpack_load_u32(tree->data + tree->size + 1);
-            return mpack_tree_parse_ext(tree, node);
-        #endif
+        case mpack_type_int:
+            node->type = mpack_type_int;
+            return mpack_tree_parse_i64(tree, node, mpack_tag_desc_int(desc, value));
 
-        // float
-        case 0xca:
-            if (!mpack_tree_reserve_bytes(tree, sizeof(float)))
-                return false;
+        case mpack_type_float:
             node->value.f = mpack_load_float(tree->data + tree->size + 1);
             node->type = mpack_type_float;
             return true;
 
-        // double
-        case 0xcb:
-            if (!mpack_tree_reserve_bytes(tree, sizeof(double)))
-                return false;
+        case mpack_type_double:
             #if MPACK_DOUBLES
-            node->value.d = mpack_load_double(tree->data + tree->size + 1);
             node->type = mpack_type_double;
-            return true;
+            return mpack_tree_parse_double(tree, node);
             #else
             node->value.f = mpack_load_double(tree->data + tree->size + 1);
             node->type = mpack_type_float;
             return true;
             #endif
 
-        // uint8
-        case 0xcc:
-            node->type = mpack_type_uint;
-            if (!mpack_tree_reserve_bytes(tree, sizeof(uint8_t)))
-                return false;
-            node->value.u = mpack_load_u8(tree->data + tree->size + 1);
-            return true;
-
-        // uint16
-        case 0xcd:
-            node->type = mpack_type_uint;
-            if (!mpack_tree_reserve_bytes(tree, sizeof(uint16_t)))
-                return false;
-            node->value.u = mpack_load_u16(tree->data + tree->size + 1);
-            return true;
-
-        // uint32
-        case 0xce:
-            node->type = mpack_type_uint;
-            if (!mpack_tree_reserve_bytes(tree, sizeof(uint32_t)))
-                return false;
-            node->value.u = mpack_load_u32(tree->data + tree->size + 1);
-            return true;
-
-        // uint64
-        case 0xcf:
-            node->type = mpack_type_uint;
-            if (!mpack_tree_reserve_bytes(tree, sizeof(uint64_t)))
-                return false;
-            node->value.u = mpack_load_u64(tree->data + tree->size + 1);
-            return true;
-
-        // int8
-        case 0xd0:
-            node->type = mpack_type_int;
-            if (!mpack_tree_reserve_bytes(tree, sizeof(int8_t)))
-                return false;
-            node->value.i = mpack_load_i8(tree->data + tree->size + 1);
-            return true;
-
-        // int16
-        case 0xd1:
-            node->type = mpack_type_int;
-            if (!mpack_tree_reserve_bytes(tree, sizeof(int16_t)))
-                return false;
-            node->value.i = mpack_load_i16(tree->data + tree->size + 1);
-            return true;
-
-        // int32
-        case 0xd2:
-            node->type = mpack_type_int;
-            if (!mpack_tree_reserve_bytes(tree, sizeof(int32_t)))
-                return false;
-            node->value.i = mpack_load_i32(tree->data + tree->size + 1);
-            return true;
-
-        // int64
-        case 0xd3:
-            node->type = mpack_type_int;
-            if (!mpack_tree_reserve_bytes(tree, sizeof(int64_t)))
-                return false;
-            node->value.i = mpack_load_i64(tree->data + tree->size + 1);
-            return true;
-
-        #if MPACK_EXTENSIONS
-        // fixext1
-        case 0xd4:
-            node->len = 1;
-            return mpack_tree_parse_ext(tree, node);
-
-        // fixext2
-        case 0xd5:
-            node->len = 2;
-            return mpack_tree_parse_ext(tree, node);
-
-        // fixext4
-        case 0xd6:
-            node->len = 4;
-            return mpack_tree_parse_ext(tree, node);
-
-        // fixext8
-        case 0xd7:
-            node->len = 8;
-            return mpack_tree_parse_ext(tree, node);
-
-        // fixext16
-        case 0xd8:
-            node->len = 16;
-            return mpack_tree_parse_ext(tree, node);
-        #endif
-
-        // str8
-        case 0xd9:
-            if (!mpack_tree_reserve_bytes(tree, sizeof(uint8_t)))
-                return false;
-            node->len = mpack_load_u8(tree->data + tree->size + 1);
-            node->type = mpack_type_str;
-            return mpack_tree_parse_bytes(tree, node);
-
-        // str16
-        case 0xda:
-            if (!mpack_tree_reserve_bytes(tree, sizeof(uint16_t)))
-                return false;
-            node->len = mpack_load_u16(tree->data + tree->size + 1);
-            node->type = mpack_type_str;
-            return mpack_tree_parse_bytes(tree, node);
-
-        // str32
-        case 0xdb:
-            if (!mpack_tree_reserve_bytes(tree, sizeof(uint32_t)))
-                return false;
-            node->len = mpack_load_u32(tree->data + tree->size + 1);
+        case mpack_type_str:
             node->type = mpack_type_str;
-            return mpack_tree_parse_bytes(tree, node);
+            return mpack_tree_parse_bytes(tree, node, (uint32_t)value);
 
-        // array16
-        case 0xdc:
-            if (!mpack_tree_reserve_bytes(tree, sizeof(uint16_t)))
-                return false;
-            node->len = mpack_load_u16(tree->data + tree->size + 1);
-            node->type = mpack_type_array;
-            return mpack_tree_parse_children(tree, node);
+        case mpack_type_bin:
+            node->type = mpack_type_bin;
+            return mpack_tree_parse_bytes(tree, node, (uint32_t)value);
 
-        // array32
-        case 0xdd:
-            if (!mpack_tree_reserve_bytes(tree, sizeof(uint32_t)))
-                return false;
-            node->len = mpack_load_u32(tree->data + tree->size + 1);
+        case mpack_type_array:
             node->type = mpack_type_array;
-            return mpack_tree_parse_children(tree, node);
-
-        // map16
-        case 0xde:
-            if (!mpack_tree_reserve_bytes(tree, sizeof(uint16_t)))
-                return false;
-            node->len = mpack_load_u16(tree->data + tree->size + 1);
-            node->type = mpack_type_map;
-            return mpack_tree_parse_children(tree, node);
+            return mpack_tree_parse_children(tree, node, (uint32_t)value);
 
-        // map32
-        case 0xdf:
-            if (!mpack_tree_reserve_bytes(tree, sizeof(uint32_t)))
-                return false;
-            node->len = mpack_load_u32(tree->data + tree->size + 1);
+        case mpack_type_map:
             node->type = mpack_type_map;
-            return mpack_tree_parse_children(tree, node);
+            return mpack_tree_parse_children(tree, node, (uint32_t)value);
 
-        // reserved
-        case 0xc1:
-            mpack_tree_flag_error(tree, mpack_error_invalid);
-            return false;
-
-        #if !MPACK_EXTENSIONS
-        // ext
-        case 0xc7: // fallthrough
-        case 0xc8: // fallthrough
-        case 0xc9: // fallthrough
-        // fixext
-        case 0xd4: // fallthrough
-        case 0xd5: // fallthrough
-        case 0xd6: // fallthrough
-        case 0xd7: // fallthrough
-        case 0xd8:
-            mpack_tree_flag_error(tree, mpack_error_unsupported);
-            return false;
+        #if MPACK_EXTENSIONS
+        case mpack_type_ext:
+            return mpack_tree_parse_ext(tree, node, (uint32_t)value);
         #endif
 
-        #if MPACK_OPTIMIZE_FOR_SIZE
-        // any other bytes should have been handled by the infix switch
         default:
             break;
-        #endif
     }
 
     mpack_assert(0, "unreachable");
@@ -748,6 +1372,11 @@ static bool mpack_tree_parse_node(mpack_tree_t* tree, mpack_node_data_t* node) {
     mpack_log("parsing a node at position %i in level %i\n",
             (int)tree->size, (int)tree->parser.level);
 
+    #if MPACK_NODE_SPANS
+    if (!mpack_tree_set_start(tree, node))
+        return false;
+    #endif
+
     if (!mpack_tree_parse_node_contents(tree, node)) {
         mpack_log("node parsing returned false\n");
         return false;
@@ -770,7 +1399,7 @@ static bool mpack_tree_parse_node(mpack_tree_t* tree, mpack_node_data_t* node) {
 
     mpack_log("parsed a node of type %s of %i bytes and "
             "%i additional bytes reserved for children.\n",
-            mpack_type_to_string(node->type), (int)node_size,
+            mpack_type_to_string(mpack_node_data_type(node)), (int)node_size,
             (int)tree->parser.current_node_reserved + 1 - (int)node_size);
 
     return true;
@@ -796,6 +1425,14 @@ static bool mpack_tree_continue_parsing(mpack_tree_t* tree) {
         size_t level = parser->level;
         if (!mpack_tree_parse_node(tree, node))
             return false;
+
+        #if defined(MPACK_MALLOC) && MPACK_NODE_INTERN
+        // keys of an interned map are at even counts of children left
+        if (parser->stack[level].ids != NULL && (parser->stack[level].left & 1) == 0)
+            if (!mpack_tree_intern_key(tree, node, parser->stack[level].ids++))
+                return false;
+        #endif
+
         --parser->stack[level].left;
         ++parser->stack[level].child;
 
@@ -816,12 +1453,102 @@ static bool mpack_tree_continue_parsing(mpack_tree_t* tree) {
     }
 }
 
+#if defined(MPACK_MALLOC) && MPACK_NODE_MAP_INDEX
+/*
+ * Builds the indices of all large maps in a parsed tree. We walk the tree
+ * with the parsing stack; it is guaranteed to be deep enough since it was
+ * just used to parse the same tree.
+ */
+static void mpack_tree_index_maps(mpack_tree_t* tree) {
+    mpack_tree_parser_t* parser = &tree->parser;
+    mpack_assert(parser->state == mpack_tree_parse_state_parsed);
+    mpack_assert(parser->level == 0);
+
+    parser->stack[0].child = tree->root;
+    parser->stack[0].left = 1;
+
+    while (true) {
+        mpack_node_data_t* node = parser->stack[parser->level].child;
+        --parser->stack[parser->level].left;
+        ++parser->stack[parser->level].child;
+
+        bool compound = node->type == mpack_type_map || node->type == mpack_type_array;
+        #if MPACK_NODE_LAZY
+        if (compound && mpack_node_data_is_lazy(tree, node))
+            compound = false;
+        #endif
+
+        if (compound) {
+            size_t total = node->len;
+            if (node->type == mpack_type_map) {
+                mpack_node_map_index(mpack_node(tree, node));
+                total *= 2;
+            }
+            if (total > 0) {
+                mpack_assert(parser->level + 1 < mpack_tree_parser_stack_capacity(tree));
+                ++parser->level;
+                parser->stack[parser->level].child = node->value.children;
+                parser->stack[parser->level].left = total;
+            }
+        }
+
+        while (parser->stack[parser->level].left == 0) {
+            if (parser->level == 0)
+                return;
+            --parser->level;
+        }
+    }
+}
+#endif
+
+#if MPACK_NODE_LAZY
+/*
+ * Parses the children of a lazy node from its span. The parser is idle once
+ * a tree is parsed, so we use it to parse the node again in place, with the
+ * tree temporarily positioned at the start of the span. The span has already
+ * been scanned so it cannot run out of data. Compound children below the lazy
+ * depth (relative to this node) are again left unparsed.
+ */
+static bool mpack_tree_expand(mpack_tree_t* tree, mpack_node_data_t* node) {
+    mpack_tree_parser_t* parser = &tree->parser;
+    mpack_assert(parser->state == mpack_tree_parse_state_parsed);
+    mpack_log("expanding lazy node %p\n", (void*)node);
+
+    size_t offset = mpack_node_data_children(tree, node)->value.offset;
+    size_t size = tree->size;
+    size_t possible_nodes_left = parser->possible_nodes_left;
+
+    parser->state = mpack_tree_parse_state_in_progress;
+    parser->current_node_reserved = 0;
+    parser->possible_nodes_left = size - offset - 1;
+    parser->level = 0;
+    parser->stack[0].child = node;
+    parser->stack[0].left = 1;
+    #if defined(MPACK_MALLOC) && MPACK_NODE_INTERN
+    parser->stack[0].ids = NULL;
+    #endif
+    tree->size = offset;
+
+    bool ok = mpack_tree_continue_parsing(tree);
+    if (!ok && mpack_tree_error(tree) == mpack_ok) {
+        mpack_break("lazy node span is incomplete!");
+        mpack_tree_flag_error(tree, mpack_error_bug);
+    }
+
+    parser->state = mpack_tree_parse_state_parsed;
+    parser->level = 0;
+    parser->possible_nodes_left = possible_nodes_left;
+    tree->size = size;
+    return ok;
+}
+#endif
+
 static void mpack_tree_cleanup(mpack_tree_t* tree) {
-    MPACK_UNUSED(tree);
+    tree->frozen = false;
 
     #ifdef MPACK_MALLOC
     if (tree->parser.stack_owned) {
-        MPACK_FREE(tree->parser.stack);
+        mpack_allocator_free(&tree->allocator, tree->parser.stack);
         tree->parser.stack = NULL;
         tree->parser.stack_owned = false;
     }
@@ -830,10 +1557,60 @@ static void mpack_tree_cleanup(mpack_tree_t* tree) {
     while (page != NULL) {
         mpack_tree_page_t* next = page->next;
         mpack_log("freeing page %p\n", (void*)page);
-        MPACK_FREE(page);
+        mpack_allocator_free(&tree->allocator, page);
         page = next;
     }
     tree->next = NULL;
+
+    // standard pages go back to the page cache while it has room
+    mpack_page_cache_t* cache = tree->page_cache;
+    page = tree->standard_pages;
+    while (page != NULL) {
+        mpack_tree_page_t* next = page->next;
+        if (cache == NULL) {
+            mpack_log("freeing page %p\n", (void*)page);
+            mpack_allocator_free(&tree->allocator, page);
+        } else if (cache->count < cache->max_count) {
+            page->next = cache->pages;
+            cache->pages = page;
+            ++cache->count;
+        } else {
+            MPACK_FREE(page);
+        }
+        page = next;
+    }
+    tree->standard_pages = NULL;
+    #if MPACK_NODE_COMPACT
+    tree->page_count = 0;
+    #endif
+    #endif
+}
+
+/*
+ * Drops the data of the previously parsed message (if any), leaving the tree's
+ * data starting with any data after it.
+ *
+ * If the tree is buffered, the remaining data is not moved here. It is only
+ * moved back to the start of the buffer if more data is needed and it would
+ * not fit (see mpack_tree_buffer_reserve().)
+ */
+static void mpack_tree_release_message(mpack_tree_t* tree) {
+    if (tree->size == 0)
+        return;
+
+    tree->data += tree->size;
+    tree->data_length -= tree->size;
+    tree->size = 0;
+    tree->node_count = 0;
+
+    #ifdef MPACK_MALLOC
+    // if nothing is left, we can start over at the start of the buffer for free
+    // TODO: We could consider shrinking the buffer here, especially if we
+    // determine that the fill function is providing less than a quarter of
+    // the buffer size or if messages take up less than a quarter of the
+    // buffer size. Maybe this should be configurable.
+    if (tree->buffer != NULL && !tree->data_borrowed && tree->data_length == 0)
+        tree->data = tree->buffer;
     #endif
 }
 
@@ -852,30 +1629,7 @@ static bool mpack_tree_parse_start(mpack_tree_t* tree) {
     tree->parser.state = mpack_tree_parse_state_in_progress;
     tree->parser.current_node_reserved = 0;
 
-    // check if we previously parsed a tree
-    if (tree->size > 0) {
-        #ifdef MPACK_MALLOC
-        // if we're buffered, move the remaining data back to the
-        // start of the buffer
-        // TODO: This is not ideal performance-wise. We should only move data
-        // when we need to call the fill function.
-        // TODO: We could consider shrinking the buffer here, especially if we
-        // determine that the fill function is providing less than a quarter of
-        // the buffer size or if messages take up less than a quarter of the
-        // buffer size. Maybe this should be configurable.
-        if (tree->buffer != NULL) {
-            mpack_memmove(tree->buffer, tree->buffer + tree->size, tree->data_length - tree->size);
-        }
-        else
-        #endif
-        // otherwise advance past the parsed data
-        {
-            tree->data += tree->size;
-        }
-        tree->data_length -= tree->size;
-        tree->size = 0;
-        tree->node_count = 0;
-    }
+    mpack_tree_release_message(tree);
 
     // make sure we have at least one byte available before allocating anything
     parser->possible_nodes_left = tree->data_length;
@@ -895,18 +1649,19 @@ static bool mpack_tree_parse_start(mpack_tree_t* tree) {
     if (tree->pool == NULL) {
 
         // allocate first page
-        mpack_tree_page_t* page = (mpack_tree_page_t*)MPACK_MALLOC(MPACK_PAGE_ALLOC_SIZE);
-        mpack_log("allocated initial page %p of size %i count %i\n",
-                (void*)page, (int)MPACK_PAGE_ALLOC_SIZE, (int)MPACK_NODES_PER_PAGE);
-        if (page == NULL) {
-            tree->error = mpack_error_memory;
+        mpack_tree_page_t* page = mpack_tree_alloc_standard_page(tree);
+        size_t page_nodes = mpack_tree_page_nodes(tree);
+        mpack_log("allocated initial page %p of count %i\n", (void*)page, (int)page_nodes);
+        if (page == NULL)
             return false;
-        }
-        page->next = NULL;
-        tree->next = page;
 
         parser->nodes = page->nodes;
-        parser->nodes_left = MPACK_NODES_PER_PAGE;
+        parser->nodes_left = page_nodes;
+
+        #if MPACK_NODE_COMPACT
+        if (!mpack_tree_add_page(tree, page->nodes, page_nodes, &parser->nodes_index))
+            return false;
+        #endif
     }
     else
     #endif
@@ -915,19 +1670,45 @@ static bool mpack_tree_parse_start(mpack_tree_t* tree) {
         mpack_assert(tree->pool != NULL, "no pool provided?");
         parser->nodes = tree->pool;
         parser->nodes_left = tree->pool_count;
+        #if MPACK_NODE_COMPACT
+        parser->nodes_index = 0;
+        #endif
     }
 
     tree->root = parser->nodes;
     ++parser->nodes;
     --parser->nodes_left;
+    #if MPACK_NODE_COMPACT
+    ++parser->nodes_index;
+    #endif
 
     parser->level = 0;
     parser->stack[0].child = tree->root;
     parser->stack[0].left = 1;
 
+    #if defined(MPACK_MALLOC) && MPACK_NODE_INTERN
+    parser->stack[0].ids = NULL;
+    parser->intern = tree->intern;
+    #endif
+
     return true;
 }
 
+static void mpack_tree_parse_finish(mpack_tree_t* tree) {
+    mpack_assert(mpack_tree_error(tree) == mpack_ok);
+    mpack_assert(tree->parser.level == 0);
+    tree->parser.state = mpack_tree_parse_state_parsed;
+    mpack_stats_add(&tree->stats, messages, 1);
+    mpack_stats_add(&tree->stats, nodes, tree->node_count);
+
+    #if defined(MPACK_MALLOC) && MPACK_NODE_MAP_INDEX
+    if (tree->eager_map_index)
+        mpack_tree_index_maps(tree);
+    #endif
+    mpack_log("parsed tree of %i bytes, %i bytes left\n", (int)tree->size, (int)tree->parser.possible_nodes_left);
+    mpack_log("%i nodes in final page\n", (int)tree->parser.nodes_left);
+}
+
 void mpack_tree_parse(mpack_tree_t* tree) {
     if (mpack_tree_error(tree) != mpack_ok)
         return;
@@ -952,11 +1733,7 @@ void mpack_tree_parse(mpack_tree_t* tree) {
         return;
     }
 
-    mpack_assert(mpack_tree_error(tree) == mpack_ok);
-    mpack_assert(tree->parser.level == 0);
-    tree->parser.state = mpack_tree_parse_state_parsed;
-    mpack_log("parsed tree of %i bytes, %i bytes left\n", (int)tree->size, (int)tree->parser.possible_nodes_left);
-    mpack_log("%i nodes in final page\n", (int)tree->parser.nodes_left);
+    mpack_tree_parse_finish(tree);
 }
 
 bool mpack_tree_try_parse(mpack_tree_t* tree) {
@@ -970,12 +1747,119 @@ bool mpack_tree_try_parse(mpack_tree_t* tree) {
     if (!mpack_tree_continue_parsing(tree))
         return false;
 
-    mpack_assert(mpack_tree_error(tree) == mpack_ok);
-    mpack_assert(tree->parser.level == 0);
-    tree->parser.state = mpack_tree_parse_state_parsed;
+    mpack_tree_parse_finish(tree);
+    return true;
+}
+
+#ifdef MPACK_MALLOC
+void mpack_tree_init_feed(mpack_tree_t* tree, size_t max_message_size, size_t max_message_nodes) {
+    mpack_tree_init_stream(tree, &mpack_tree_feed_read, NULL, max_message_size, max_message_nodes);
+}
+
+/*
+ * Moves the unparsed data of a fed tree into its own buffer (if it is still
+ * in the caller's chunk), making room for the given number of additional
+ * bytes.
+ *
+ * Since nodes store offsets into the data rather than pointers, a message
+ * that is partially parsed from a chunk remains valid once moved.
+ */
+static bool mpack_tree_feed_own(mpack_tree_t* tree, size_t extra) {
+    if (extra > tree->max_size || tree->data_length > tree->max_size - extra) {
+        mpack_tree_flag_error(tree, mpack_error_too_big);
+        return false;
+    }
+
+    if (!tree->data_borrowed)
+        return mpack_tree_buffer_reserve(tree, extra);
+
+    // the chunk is copied to the start of the buffer, so nothing in the
+    // buffer needs to be kept
+    const char* data = tree->data;
+    tree->data = tree->buffer;
+    tree->data_borrowed = false;
+    size_t data_length = tree->data_length;
+    tree->data_length = 0;
+    if (!mpack_tree_buffer_reserve(tree, data_length + extra))
+        return false;
+
+    mpack_log("copying %i unparsed bytes out of fed chunk\n", (int)data_length);
+    if (data_length > 0)
+        mpack_memcpy(tree->buffer, data, data_length);
+    mpack_stats_add(&tree->stats, bytes_copied, data_length);
+    tree->data_length = data_length;
     return true;
 }
 
+mpack_tree_feed_status_t mpack_tree_feed(mpack_tree_t* tree, const char* data, size_t length) {
+    if (mpack_tree_error(tree) != mpack_ok)
+        return mpack_tree_feed_error;
+
+    if (tree->read_fn != &mpack_tree_feed_read) {
+        mpack_break("tree was not initialized with mpack_tree_init_feed()!");
+        mpack_tree_flag_error(tree, mpack_error_bug);
+        return mpack_tree_feed_error;
+    }
+
+    // the previous message is invalidated
+    if (tree->parser.state == mpack_tree_parse_state_parsed) {
+        mpack_tree_cleanup(tree);
+        mpack_tree_release_message(tree);
+        tree->parser.state = mpack_tree_parse_state_not_started;
+    }
+
+    if (length > 0) {
+        mpack_stats_add(&tree->stats, fills, 1);
+        mpack_stats_add(&tree->stats, bytes, length);
+
+        if (tree->data_length == 0) {
+            // Nothing is pending, so we parse directly out of the chunk.
+            mpack_log("parsing fed chunk of %i bytes in place\n", (int)length);
+            tree->data = data;
+            tree->data_length = length;
+            tree->data_borrowed = true;
+        } else {
+            // Otherwise the chunk joins the pending data in our buffer.
+            if (!mpack_tree_feed_own(tree, length))
+                return mpack_tree_feed_error;
+            mpack_log("appending fed chunk of %i bytes to %i pending\n", (int)length, (int)tree->data_length);
+            size_t end = (size_t)(tree->data - tree->buffer) + tree->data_length;
+            mpack_memcpy(tree->buffer + end, data, length);
+            tree->data_length += length;
+        }
+
+        if (tree->parser.state == mpack_tree_parse_state_in_progress)
+            tree->parser.possible_nodes_left += length;
+    }
+
+    if (tree->parser.state != mpack_tree_parse_state_in_progress) {
+        if (tree->data_length == 0)
+            return mpack_tree_feed_incomplete;
+        if (!mpack_tree_parse_start(tree))
+            return mpack_tree_error(tree) == mpack_ok ? mpack_tree_feed_incomplete : mpack_tree_feed_error;
+    }
+
+    if (!mpack_tree_continue_parsing(tree)) {
+        if (mpack_tree_error(tree) != mpack_ok)
+            return mpack_tree_feed_error;
+
+        // We've used up all fed data. We keep the partial message in our own
+        // buffer so that the caller can reuse its chunk.
+        if (!mpack_tree_feed_own(tree, 0))
+            return mpack_tree_feed_error;
+        return mpack_tree_feed_incomplete;
+    }
+
+    if (tree->size > tree->max_size) {
+        mpack_tree_flag_error(tree, mpack_error_too_big);
+        return mpack_tree_feed_error;
+    }
+
+    mpack_tree_parse_finish(tree);
+    return mpack_tree_feed_complete;
+}
+#endif
+
 
 
 /*
@@ -999,12 +1883,145 @@ mpack_node_t mpack_tree_root(mpack_tree_t* tree) {
     return mpack_node(tree, tree->root);
 }
 
+#if MPACK_NODE_LAZY || (defined(MPACK_MALLOC) && MPACK_NODE_MAP_INDEX)
+typedef struct mpack_tree_freeze_level_t {
+    mpack_node_data_t* child;
+    size_t left;
+} mpack_tree_freeze_level_t;
+
+/*
+ * Walks the whole tree, expanding lazy nodes and building map indices. The
+ * expansions use the parsing stack so we walk with a separate stack, which
+ * starts out inline and is grown on the heap if needed. Lazy nodes are
+ * expanded completely since the walk descends into them anyway.
+ */
+static void mpack_tree_freeze_nodes(mpack_tree_t* tree) {
+    #ifdef MPACK_MALLOC
+    mpack_tree_freeze_level_t stack_local[MPACK_NODE_INITIAL_DEPTH];
+    #else
+    mpack_tree_freeze_level_t stack_local[MPACK_NODE_MAX_DEPTH_WITHOUT_MALLOC];
+    #endif
+    mpack_tree_freeze_level_t* stack = stack_local;
+    size_t capacity = sizeof(stack_local) / sizeof(*stack_local);
+    size_t level = 0;
+    stack[0].child = tree->root;
+    stack[0].left = 1;
+
+    #if MPACK_NODE_LAZY
+    size_t lazy_depth = tree->lazy_depth;
+    tree->lazy_depth = 0;
+    #endif
+
+    while (mpack_tree_error(tree) == mpack_ok) {
+        if (stack[level].left == 0) {
+            if (level == 0)
+                break;
+            --level;
+            continue;
+        }
+        mpack_node_data_t* node = stack[level].child++;
+        --stack[level].left;
+
+        mpack_type_t type = mpack_node_data_type(node);
+        if ((type != mpack_type_array && type != mpack_type_map) || node->len == 0)
+            continue;
+
+        #if MPACK_NODE_LAZY
+        if (mpack_node_data_is_lazy(tree, node) && !mpack_tree_expand(tree, node))
+            break;
+        #endif
+
+        size_t total = node->len;
+        if (type == mpack_type_map) {
+            #if defined(MPACK_MALLOC) && MPACK_NODE_MAP_INDEX
+            mpack_node_map_index(mpack_node(tree, node));
+            #endif
+            total *= 2;
+        }
+
+        if (level + 1 == capacity) {
+            #ifdef MPACK_MALLOC
+            size_t new_capacity = capacity * 2;
+            mpack_tree_freeze_level_t* new_stack;
+            if (stack == stack_local) {
+                new_stack = (mpack_tree_freeze_level_t*)mpack_allocator_alloc(&tree->allocator,
+                        sizeof(*stack) * new_capacity);
+                if (new_stack)
+                    mpack_memcpy(new_stack, stack, sizeof(*stack) * capacity);
+            } else {
+                new_stack = (mpack_tree_freeze_level_t*)mpack_allocator_realloc(&tree->allocator, stack,
+                        sizeof(*stack) * capacity, sizeof(*stack) * new_capacity);
+            }
+            if (!new_stack) {
+                mpack_tree_flag_error(tree, mpack_error_memory);
+                break;
+            }
+            stack = new_stack;
+            capacity = new_capacity;
+            #else
+            mpack_tree_flag_error(tree, mpack_error_too_big);
+            break;
+            #endif
+        }
+
+        ++level;
+        stack[level].child = mpack_node_data_children(tree, node);
+        stack[level].left = total;
+    }
+
+    #ifdef MPACK_MALLOC
+    if (stack != stack_local)
+        mpack_allocator_free(&tree->allocator, stack);
+    #endif
+    #if MPACK_NODE_LAZY
+    tree->lazy_depth = lazy_depth;
+    #endif
+}
+#endif
+
+mpack_error_t mpack_tree_freeze(mpack_tree_t* tree) {
+    if (mpack_tree_error(tree) != mpack_ok || tree->frozen)
+        return mpack_tree_error(tree);
+
+    if (tree->parser.state != mpack_tree_parse_state_parsed) {
+        mpack_break("Tree has not been parsed!");
+        mpack_tree_flag_error(tree, mpack_error_bug);
+        return mpack_tree_error(tree);
+    }
+
+    #if MPACK_NODE_LAZY || (defined(MPACK_MALLOC) && MPACK_NODE_MAP_INDEX)
+    mpack_tree_freeze_nodes(tree);
+    #endif
+
+    if (mpack_tree_error(tree) == mpack_ok)
+        tree->frozen = true;
+    return mpack_tree_error(tree);
+}
+
+void mpack_tree_view_init(mpack_tree_view_t* view, const mpack_tree_t* tree) {
+    mpack_assert(tree->frozen, "tree must be frozen before it is viewed!");
+    mpack_memcpy(&view->tree, tree, sizeof(*tree));
+
+    // the tree's callbacks are not ours to call
+    view->tree.error_fn = NULL;
+    view->tree.read_fn = NULL;
+    view->tree.teardown = NULL;
+    view->tree.context = NULL;
+    view->tree.error = mpack_ok;
+
+    if (!tree->frozen)
+        mpack_tree_flag_error(&view->tree, mpack_error_bug);
+}
+
 static void mpack_tree_init_clear(mpack_tree_t* tree) {
     mpack_memset(tree, 0, sizeof(*tree));
     tree->nil_node.type = mpack_type_nil;
     tree->missing_node.type = mpack_type_missing;
     tree->max_size = SIZE_MAX;
     tree->max_nodes = SIZE_MAX;
+    #ifdef MPACK_MALLOC
+    tree->page_nodes = MPACK_NODES_PER_PAGE;
+    #endif
 }
 
 #ifdef MPACK_MALLOC
@@ -1047,6 +2064,12 @@ void mpack_tree_init_pool(mpack_tree_t* tree, const char* data, size_t length,
     tree->pool = node_pool;
     tree->pool_count = node_pool_count;
 
+    #if MPACK_NODE_COMPACT
+    // nodes in the pool must be addressable by a 32-bit index
+    if ((uint64_t)node_pool_count > UINT32_MAX)
+        tree->pool_count = UINT32_MAX;
+    #endif
+
     mpack_log("===========================\n");
     mpack_log("initializing tree with data of size %i and pool of count %i\n",
             (int)length, (int)node_pool_count);
@@ -1085,19 +2108,131 @@ void mpack_tree_set_limits(mpack_tree_t* tree, size_t max_message_size, size_t m
     tree->max_nodes = max_message_nodes;
 }
 
+#ifdef MPACK_MALLOC
+void mpack_tree_set_allocator(mpack_tree_t* tree, const mpack_allocator_t* allocator) {
+    if (tree->next != NULL || tree->standard_pages != NULL || tree->buffer != NULL || tree->parser.stack_owned) {
+        mpack_break("cannot set the allocator after parsing has started!");
+        mpack_tree_flag_error(tree, mpack_error_bug);
+        return;
+    }
+
+    if (allocator != NULL)
+        tree->allocator = *allocator;
+    else
+        mpack_memset(&tree->allocator, 0, sizeof(tree->allocator));
+}
+
+void mpack_tree_set_page_size(mpack_tree_t* tree, size_t page_size) {
+    if (tree->standard_pages != NULL) {
+        mpack_break("cannot set the page size after parsing has started!");
+        mpack_tree_flag_error(tree, mpack_error_bug);
+        return;
+    }
+    tree->page_nodes = mpack_page_nodes(page_size);
+}
+
+void mpack_tree_set_page_cache(mpack_tree_t* tree, mpack_page_cache_t* cache) {
+    if (tree->standard_pages != NULL) {
+        mpack_break("cannot set the page cache after parsing has started!");
+        mpack_tree_flag_error(tree, mpack_error_bug);
+        return;
+    }
+    tree->page_cache = cache;
+}
+#endif
+
 #if MPACK_STDIO
 typedef struct mpack_file_tree_t {
     char* data;
     size_t size;
+    #if MPACK_MMAP
+    bool mapped; // whether data is a mapped view rather than an allocation
+    #endif
     char buffer[MPACK_BUFFER_SIZE];
 } mpack_file_tree_t;
 
 static void mpack_file_tree_teardown(mpack_tree_t* tree) {
     mpack_file_tree_t* file_tree = (mpack_file_tree_t*)tree->context;
-    MPACK_FREE(file_tree->data);
+
+    #if MPACK_MMAP
+    if (file_tree->mapped) {
+        #if defined(_WIN32)
+        UnmapViewOfFile(file_tree->data);
+        #else
+        munmap(file_tree->data, file_tree->size);
+        #endif
+    } else
+    #endif
+    {
+        MPACK_FREE(file_tree->data);
+    }
+
     MPACK_FREE(file_tree);
 }
 
+#if MPACK_MMAP
+/*
+ * Maps the entire contents of the given file read-only into memory. This
+ * returns false without flagging an error if the file cannot be mapped (for
+ * example if it's a pipe or it's empty); it should then be read normally,
+ * which will report the appropriate error if there is one.
+ *
+ * The mapping remains valid after the file is closed.
+ */
+static bool mpack_file_tree_map(mpack_file_tree_t* file_tree, FILE* file, size_t max_bytes) {
+    size_t size;
+    void* data;
+
+    #if defined(_WIN32)
+    HANDLE handle = (HANDLE)_get_osfhandle(_fileno(file));
+    if (handle == INVALID_HANDLE_VALUE || GetFileType(handle) != FILE_TYPE_DISK)
+        return false;
+
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(handle, &file_size) || file_size.QuadPart <= 0 ||
+            (uint64_t)file_size.QuadPart > (uint64_t)SIZE_MAX)
+        return false;
+    size = (size_t)file_size.QuadPart;
+    if (max_bytes != 0 && size > max_bytes)
+        return false;
+
+    HANDLE mapping = CreateFileMappingA(handle, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mapping == NULL)
+        return false;
+    data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping); // the view keeps the mapping open
+    if (data == NULL)
+        return false;
+
+    #else
+    int fd = fileno(file);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 0 ||
+            (uint64_t)st.st_size > (uint64_t)SIZE_MAX)
+        return false;
+    size = (size_t)st.st_size;
+    if (max_bytes != 0 && size > max_bytes)
+        return false;
+
+    data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED)
+        return false;
+
+    // the parser reads the file front to back
+    posix_madvise(data, size, POSIX_MADV_SEQUENTIAL);
+    #endif
+
+    mpack_log("mapped file of size %i at %p\n", (int)size, data);
+    file_tree->data = (char*)data;
+    file_tree->size = size;
+    file_tree->mapped = true;
+    return true;
+}
+#endif
+
 static bool mpack_file_tree_read(mpack_tree_t* tree, mpack_file_tree_t* file_tree, FILE* file, size_t max_bytes) {
 
     // get the file size
@@ -1171,10 +2306,16 @@ static void mpack_tree_init_stdfile_noclose(mpack_tree_t* tree, FILE* stdfile, s
         return;
     }
 
-    // read all data
-    if (!mpack_file_tree_read(tree, file_tree, stdfile, max_bytes)) {
-        MPACK_FREE(file_tree);
-        return;
+    // map the file if possible, otherwise read all data
+    #if MPACK_MMAP
+    file_tree->mapped = false;
+    if (!mpack_file_tree_map(file_tree, stdfile, max_bytes))
+    #endif
+    {
+        if (!mpack_file_tree_read(tree, file_tree, stdfile, max_bytes)) {
+            MPACK_FREE(file_tree);
+            return;
+        }
     }
 
     mpack_tree_init_data(tree, file_tree->data, file_tree->size);
@@ -1186,24 +2327,146 @@ void mpack_tree_init_stdfile(mpack_tree_t* tree, FILE* stdfile, size_t max_bytes
     if (!mpack_tree_file_check_max_bytes(tree, max_bytes))
         return;
 
-    mpack_tree_init_stdfile_noclose(tree, stdfile, max_bytes);
+    mpack_tree_init_stdfile_noclose(tree, stdfile, max_bytes);
+
+    if (close_when_done)
+        fclose(stdfile);
+}
+
+void mpack_tree_init_filename(mpack_tree_t* tree, const char* filename, size_t max_bytes) {
+    if (!mpack_tree_file_check_max_bytes(tree, max_bytes))
+        return;
+
+    // open the file
+    FILE* file = fopen(filename, "rb");
+    if (!file) {
+        mpack_tree_init_error(tree, mpack_error_io);
+        return;
+    }
+
+    mpack_tree_init_stdfile(tree, file, max_bytes, true);
+}
+#endif
+
+#if MPACK_FD
+static void mpack_fd_tree_teardown(mpack_tree_t* tree) {
+    MPACK_FREE(tree->context);
+}
+
+// Reads from the descriptor into the given buffer until it is full or the
+// descriptor reaches end of file, returning the number of bytes read or
+// SIZE_MAX on error.
+static size_t mpack_fd_tree_read_fully(int fd, char* buffer, size_t count) {
+    size_t total = 0;
+    while (total < count) {
+        ssize_t ret = read(fd, buffer + total, count - total);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret < 0)
+            return SIZE_MAX;
+        if (ret == 0)
+            break;
+        total += (size_t)ret;
+    }
+    return total;
+}
+
+// Reads the rest of the descriptor into an allocated buffer in doubling
+// chunks until end of file. The first chunk of a regular file is its
+// remaining size plus one byte, so that end of file is normally found
+// without growing; if the file grew since fstat(), the rest is still read.
+static mpack_error_t mpack_fd_tree_read(int fd, size_t max_bytes, char** out_data, size_t* out_size) {
+    size_t limit = (max_bytes == 0) ? SIZE_MAX : max_bytes;
+    size_t capacity = MPACK_FD_BUFFER_SIZE;
+
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        off_t position = lseek(fd, 0, SEEK_CUR);
+        if (position >= 0 && position <= st.st_size) {
+            if ((uint64_t)(st.st_size - position) > (uint64_t)limit)
+                return mpack_error_too_big;
+            if (st.st_size == position)
+                return mpack_error_invalid;
+            capacity = (size_t)(st.st_size - position);
+            if (capacity < limit)
+                ++capacity;
+            posix_fadvise(fd, position, 0, POSIX_FADV_SEQUENTIAL);
+        }
+    }
+    if (capacity > limit)
+        capacity = limit;
+
+    char* data = (char*)MPACK_MALLOC(capacity);
+    if (data == NULL)
+        return mpack_error_memory;
+
+    size_t used = 0;
+    mpack_error_t error = mpack_ok;
+    while (true) {
+        size_t count = mpack_fd_tree_read_fully(fd, data + used, capacity - used);
+        if (count == SIZE_MAX) {
+            error = mpack_error_io;
+            break;
+        }
+        used += count;
+        if (used < capacity)
+            break;
+
+        if (capacity == limit) {
+            // we're at the limit, so a single byte more is too much
+            char extra;
+            count = mpack_fd_tree_read_fully(fd, &extra, 1);
+            if (count != 0)
+                error = (count == SIZE_MAX) ? mpack_error_io : mpack_error_too_big;
+            break;
+        }
+
+        size_t new_capacity = (capacity > limit / 2) ? limit : capacity * 2;
+        char* new_data = (char*)mpack_realloc(data, used, new_capacity);
+        if (new_data == NULL) {
+            error = mpack_error_memory;
+            break;
+        }
+        data = new_data;
+        capacity = new_capacity;
+    }
+
+    if (error == mpack_ok && used == 0)
+        error = mpack_error_invalid;
+    if (error != mpack_ok) {
+        MPACK_FREE(data);
+        return error;
+    }
 
-    if (close_when_done)
-        fclose(stdfile);
+    *out_data = data;
+    *out_size = used;
+    return mpack_ok;
 }
 
-void mpack_tree_init_filename(mpack_tree_t* tree, const char* filename, size_t max_bytes) {
-    if (!mpack_tree_file_check_max_bytes(tree, max_bytes))
-        return;
+void mpack_tree_init_fd(mpack_tree_t* tree, int fd, size_t max_bytes, bool close_when_done) {
+    mpack_assert(fd >= 0, "fd is invalid");
 
-    // open the file
-    FILE* file = fopen(filename, "rb");
-    if (!file) {
-        mpack_tree_init_error(tree, mpack_error_io);
+    char* data = NULL;
+    size_t size = 0;
+    mpack_error_t error = mpack_fd_tree_read(fd, max_bytes, &data, &size);
+    if (close_when_done && close(fd) != 0 && error == mpack_ok) {
+        MPACK_FREE(data);
+        error = mpack_error_io;
+    }
+    if (error != mpack_ok) {
+        mpack_tree_init_error(tree, error);
         return;
     }
 
-    mpack_tree_init_stdfile(tree, file, max_bytes, true);
+    mpack_tree_init_data(tree, data, size);
+    mpack_tree_set_context(tree, data);
+    mpack_tree_set_teardown(tree, mpack_fd_tree_teardown);
+}
+#endif
+
+#if MPACK_STATS
+void mpack_tree_reset_stats(mpack_tree_t* tree) {
+    mpack_memset(&tree->stats, 0, sizeof(tree->stats));
 }
 #endif
 
@@ -1212,7 +2475,11 @@ mpack_error_t mpack_tree_destroy(mpack_tree_t* tree) {
 
     #ifdef MPACK_MALLOC
     if (tree->buffer)
-        MPACK_FREE(tree->buffer);
+        mpack_allocator_free(&tree->allocator, tree->buffer);
+    #if MPACK_NODE_COMPACT
+    if (tree->pages)
+        mpack_allocator_free(&tree->allocator, tree->pages);
+    #endif
     #endif
 
     if (tree->teardown)
@@ -1234,10 +2501,168 @@ void mpack_tree_flag_error(mpack_tree_t* tree, mpack_error_t error) {
 
 
 
+/*
+ * Message index
+ */
+
+mpack_error_t mpack_message_size(const char* data, size_t length, size_t* size) {
+    mpack_scan_t scan;
+    scan.left = 1;
+    scan.skip = 0;
+    size_t used = 0;
+    mpack_error_t error = mpack_scan(&scan, data, length, true, &used);
+    if (error != mpack_ok)
+        return error;
+    if (scan.left != 0 || scan.skip != 0)
+        return mpack_error_eof;
+    *size = used;
+    return mpack_ok;
+}
+
+#ifdef MPACK_MALLOC
+void mpack_message_index_init(mpack_message_index_t* index, const char* data, size_t length) {
+    mpack_message_index_init_allocator(index, data, length, NULL);
+}
+
+void mpack_message_index_init_allocator(mpack_message_index_t* index, const char* data, size_t length,
+        const mpack_allocator_t* allocator)
+{
+    mpack_memset(index, 0, sizeof(*index));
+    index->data = data;
+    if (allocator != NULL)
+        index->allocator = *allocator;
+
+    size_t capacity = 64;
+    index->offsets = (size_t*)mpack_allocator_alloc(&index->allocator, sizeof(size_t) * capacity);
+    if (index->offsets == NULL) {
+        index->error = mpack_error_memory;
+        return;
+    }
+    index->offsets[0] = 0;
+
+    size_t pos = 0;
+    while (pos < length) {
+        size_t size;
+        mpack_error_t error = mpack_message_size(data + pos, length - pos, &size);
+        if (error != mpack_ok) {
+            index->error = error;
+            return;
+        }
+
+        if (index->count + 1 == capacity) {
+            size_t* offsets = (size_t*)mpack_allocator_realloc(&index->allocator, index->offsets,
+                    sizeof(size_t) * capacity, sizeof(size_t) * capacity * 2);
+            if (offsets == NULL) {
+                index->error = mpack_error_memory;
+                return;
+            }
+            index->offsets = offsets;
+            capacity *= 2;
+        }
+
+        pos += size;
+        index->offsets[++index->count] = pos;
+    }
+}
+
+mpack_error_t mpack_message_index_destroy(mpack_message_index_t* index) {
+    if (index->offsets)
+        mpack_allocator_free(&index->allocator, index->offsets);
+    index->offsets = NULL;
+    index->count = 0;
+    return index->error;
+}
+
+const char* mpack_message_index_message(const mpack_message_index_t* index, size_t message, size_t* size) {
+    mpack_assert(message < index->count, "message %i is out of bounds of index with %i messages",
+            (int)message, (int)index->count);
+    *size = index->offsets[message + 1] - index->offsets[message];
+    return index->data + index->offsets[message];
+}
+
+// Returns the number of the first message that starts at or after the given
+// offset.
+static size_t mpack_message_index_find(const mpack_message_index_t* index, size_t offset) {
+    size_t low = 0;
+    size_t high = index->count;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        if (index->offsets[mid] < offset)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return low;
+}
+
+// Returns the byte offset at which the given part starts, avoiding overflow.
+static size_t mpack_message_index_split(const mpack_message_index_t* index, size_t part, size_t parts) {
+    size_t total = index->offsets[index->count];
+    return total / parts * part + total % parts * part / parts;
+}
+
+void mpack_message_index_partition(const mpack_message_index_t* index, size_t part, size_t parts,
+        size_t* first, size_t* count)
+{
+    mpack_assert(part < parts, "part %i is out of bounds of %i parts", (int)part, (int)parts);
+    *first = 0;
+    *count = 0;
+    if (index->count == 0)
+        return;
+
+    // split on the byte offsets rather than the message counts so that
+    // parts are balanced when message sizes vary
+    *first = (part == 0) ? 0 :
+        mpack_message_index_find(index, mpack_message_index_split(index, part, parts));
+    size_t last = (part + 1 == parts) ? index->count :
+        mpack_message_index_find(index, mpack_message_index_split(index, part + 1, parts));
+    *count = last - *first;
+}
+
+mpack_error_t mpack_message_index_parse(const mpack_message_index_t* index, size_t first, size_t count,
+        mpack_message_index_parse_t parse_fn, void* context)
+{
+    mpack_assert(first <= index->count && count <= index->count - first,
+            "range %i+%i is out of bounds of index with %i messages",
+            (int)first, (int)count, (int)index->count);
+
+    // a single tree parses the whole range so that its node pages are
+    // reused from one message to the next
+    size_t start = index->offsets[first];
+    mpack_tree_t tree;
+    mpack_tree_init_data(&tree, index->data + start, index->offsets[first + count] - start);
+    mpack_tree_set_allocator(&tree, &index->allocator);
+    for (size_t i = 0; i < count; ++i) {
+        mpack_tree_parse(&tree);
+        if (mpack_tree_error(&tree) != mpack_ok)
+            break;
+        parse_fn(&tree, first + i, context);
+        if (mpack_tree_error(&tree) != mpack_ok)
+            break;
+    }
+    return mpack_tree_destroy(&tree);
+}
+#endif
+
+
+
 /*
  * Node misc functions
  */
 
+// Expands a lazy node before descending into its children. The node must be
+// a map or array and the tree must not be in an error state. Returns false if
+// expansion failed.
+MPACK_STATIC_INLINE bool mpack_node_expand(mpack_node_t node) {
+    #if MPACK_NODE_LAZY
+    if (mpack_node_data_is_lazy(node.tree, node.data))
+        return mpack_tree_expand(node.tree, node.data);
+    #else
+    MPACK_UNUSED(node);
+    #endif
+    return true;
+}
+
 void mpack_node_flag_error(mpack_node_t node, mpack_error_t error) {
     mpack_tree_flag_error(node.tree, error);
 }
@@ -1248,7 +2673,7 @@ mpack_tag_t mpack_node_tag(mpack_node_t node) {
 
     mpack_tag_t tag = MPACK_TAG_ZERO;
 
-    tag.type = node.data->type;
+    tag.type = mpack_node_data_type(node.data);
     switch (node.data->type) {
         case mpack_type_missing:
             // If a node is missing, I don't know if it makes sense to ask for
@@ -1259,9 +2684,9 @@ mpack_tag_t mpack_node_tag(mpack_node_t node) {
         case mpack_type_nil:                                            break;
         case mpack_type_bool:    tag.v.b = node.data->value.b;          break;
         case mpack_type_float:   tag.v.f = node.data->value.f;          break;
-        case mpack_type_double:  tag.v.d = node.data->value.d;          break;
-        case mpack_type_int:     tag.v.i = node.data->value.i;          break;
-        case mpack_type_uint:    tag.v.u = node.data->value.u;          break;
+        case mpack_type_double:  tag.v.d = mpack_node_value_d(node);   break;
+        case mpack_type_int:     tag.v.i = mpack_node_value_i(node);   break;
+        case mpack_type_uint:    tag.v.u = mpack_node_value_u(node);   break;
 
         case mpack_type_str:     tag.v.l = node.data->len;     break;
         case mpack_type_bin:     tag.v.l = node.data->len;     break;
@@ -1310,7 +2735,7 @@ static void mpack_node_print_element(mpack_node_t node, mpack_print_t* print, si
                 for (size_t j = 0; j < depth + 1; ++j)
                     mpack_print_append_cstr(print, "    ");
                 mpack_node_print_element(mpack_node_array_at(node, i), print, depth + 1);
-                if (i != data->len - 1)
+                if (i + 1 != data->len)
                     mpack_print_append_cstr(print, ",");
                 mpack_print_append_cstr(print, "\n");
             }
@@ -1327,7 +2752,7 @@ static void mpack_node_print_element(mpack_node_t node, mpack_print_t* print, si
                 mpack_node_print_element(mpack_node_map_key_at(node, i), print, depth + 1);
                 mpack_print_append_cstr(print, ": ");
                 mpack_node_print_element(mpack_node_map_value_at(node, i), print, depth + 1);
-                if (i != data->len - 1)
+                if (i + 1 != data->len)
                     mpack_print_append_cstr(print, ",");
                 mpack_print_append_cstr(print, "\n");
             }
@@ -1408,6 +2833,92 @@ void mpack_node_print_to_file(mpack_node_t node, FILE* file) {
     mpack_print_flush(&print);
 }
 #endif
+
+#if MPACK_NODE_SPANS
+// Returns the size of the encoded header of a scalar or an empty map or
+// array from its type byte. (Strs, bins and exts are measured from their
+// data offset instead.)
+// Returns the offset just past the end of the given node's bytes. Rather than
+// scanning the node's contents, we descend through the last child of each
+// non-empty map or array; the node ends where its last leaf ends.
+static size_t mpack_node_data_end(mpack_tree_t* tree, mpack_node_data_t* node) {
+    while (true) {
+        mpack_type_t type = mpack_node_data_type(node);
+        if ((type != mpack_type_array && type != mpack_type_map) || node->len == 0)
+            break;
+
+        #if MPACK_NODE_LAZY
+        // an unexpanded span has no children to descend into, but its
+        // structure was already checked when it was scanned
+        if (mpack_node_data_is_lazy(tree, node)) {
+            size_t size = 0;
+            mpack_error_t error = mpack_message_size(tree->data + node->start,
+                    tree->size - node->start, &size);
+            MPACK_UNUSED(error);
+            mpack_assert(error == mpack_ok, "lazy node span is incomplete!");
+            return node->start + size;
+        }
+        #endif
+
+        size_t count = (type == mpack_type_map) ? (size_t)node->len * 2 : node->len;
+        node = mpack_node_data_children(tree, node) + count - 1;
+    }
+
+    switch (mpack_node_data_type(node)) {
+        case mpack_type_str:
+        case mpack_type_bin:
+        #if MPACK_EXTENSIONS
+        case mpack_type_ext:
+        #endif
+            return (size_t)node->value.offset + node->len;
+        default:
+            break;
+    }
+
+    return node->start + mpack_tag_descs[(uint8_t)tree->data[node->start]].header;
+}
+
+bool mpack_node_bytes(mpack_node_t node, const char** data, size_t* length) {
+    mpack_assert(data != NULL, "data is NULL");
+    mpack_assert(length != NULL, "length is NULL");
+    *data = NULL;
+    *length = 0;
+
+    if (mpack_node_error(node) != mpack_ok)
+        return false;
+
+    // the nil node is not part of the message
+    if (node.data == &node.tree->nil_node) {
+        *data = "\xc0";
+        *length = 1;
+        return true;
+    }
+
+    if (node.data == &node.tree->missing_node) {
+        mpack_node_flag_error(node, mpack_error_type);
+        return false;
+    }
+
+    size_t end = mpack_node_data_end(node.tree, node.data);
+    mpack_assert(end <= node.tree->size, "node ends at %i past the end of message of %i bytes",
+            (int)end, (int)node.tree->size);
+    *data = node.tree->data + node.data->start;
+    *length = end - node.data->start;
+    return true;
+}
+
+#if MPACK_WRITER
+void mpack_write_node(mpack_writer_t* writer, mpack_node_t node) {
+    const char* data;
+    size_t length;
+    if (!mpack_node_bytes(node, &data, &length)) {
+        mpack_writer_flag_error(writer, mpack_error_data);
+        return;
+    }
+    mpack_write_object_bytes(writer, data, length);
+}
+#endif
+#endif
  
 
  
@@ -1497,7 +3008,7 @@ size_t mpack_node_copy_data(mpack_node_t node, char* buffer, size_t bufsize) {
 
     mpack_assert(bufsize == 0 || buffer != NULL, "buffer is NULL for maximum of %i bytes", (int)bufsize);
 
-    mpack_type_t type = node.data->type;
+    mpack_type_t type = mpack_node_data_type(node.data);
     if (type != mpack_type_str && type != mpack_type_bin
             #if MPACK_EXTENSIONS
             && type != mpack_type_ext
@@ -1522,7 +3033,7 @@ size_t mpack_node_copy_utf8(mpack_node_t node, char* buffer, size_t bufsize) {
 
     mpack_assert(bufsize == 0 || buffer != NULL, "buffer is NULL for maximum of %i bytes", (int)bufsize);
 
-    mpack_type_t type = node.data->type;
+    mpack_type_t type = mpack_node_data_type(node.data);
     if (type != mpack_type_str) {
         mpack_node_flag_error(node, mpack_error_type);
         return 0;
@@ -1616,7 +3127,7 @@ char* mpack_node_data_alloc(mpack_node_t node, size_t maxlen) {
         return NULL;
 
     // make sure this is a valid data type
-    mpack_type_t type = node.data->type;
+    mpack_type_t type = mpack_node_data_type(node.data);
     if (type != mpack_type_str && type != mpack_type_bin
             #if MPACK_EXTENSIONS
             && type != mpack_type_ext
@@ -1631,7 +3142,7 @@ char* mpack_node_data_alloc(mpack_node_t node, size_t maxlen) {
         return NULL;
     }
 
-    char* ret = (char*) MPACK_MALLOC((size_t)node.data->len);
+    char* ret = (char*) mpack_allocator_alloc(&node.tree->allocator, (size_t)node.data->len);
     if (ret == NULL) {
         mpack_node_flag_error(node, mpack_error_memory);
         return NULL;
@@ -1667,7 +3178,7 @@ char* mpack_node_cstr_alloc(mpack_node_t node, size_t maxlen) {
         return NULL;
     }
 
-    char* ret = (char*) MPACK_MALLOC((size_t)(node.data->len + 1));
+    char* ret = (char*) mpack_allocator_alloc(&node.tree->allocator, (size_t)(node.data->len + 1));
     if (ret == NULL) {
         mpack_node_flag_error(node, mpack_error_memory);
         return NULL;
@@ -1704,7 +3215,7 @@ char* mpack_node_utf8_cstr_alloc(mpack_node_t node, size_t maxlen) {
         return NULL;
     }
 
-    char* ret = (char*) MPACK_MALLOC((size_t)(node.data->len + 1));
+    char* ret = (char*) mpack_allocator_alloc(&node.tree->allocator, (size_t)(node.data->len + 1));
     if (ret == NULL) {
         mpack_node_flag_error(node, mpack_error_memory);
         return NULL;
@@ -1730,13 +3241,23 @@ static mpack_node_data_t* mpack_node_map_int_impl(mpack_node_t node, int64_t num
         return NULL;
     }
 
+    if (!mpack_node_expand(node))
+        return NULL;
+
+    #if defined(MPACK_MALLOC) && MPACK_NODE_MAP_INDEX
+    mpack_node_data_t* index = mpack_node_map_index(node);
+    if (index)
+        return mpack_node_map_index_find(node, index, mpack_node_map_hash_num((uint64_t)num),
+                mpack_type_int, (uint64_t)num, NULL, 0);
+    #endif
+
     mpack_node_data_t* found = NULL;
 
     for (size_t i = 0; i < node.data->len; ++i) {
         mpack_node_data_t* key = mpack_node_child(node, i * 2);
 
-        if ((key->type == mpack_type_int && key->value.i == num) ||
-            (key->type == mpack_type_uint && num >= 0 && key->value.u == (uint64_t)num))
+        if ((key->type == mpack_type_int && mpack_node_data_i64(node.tree, key) == num) ||
+            (key->type == mpack_type_uint && num >= 0 && mpack_node_data_u64(node.tree, key) == (uint64_t)num))
         {
             if (found) {
                 mpack_node_flag_error(node, mpack_error_data);
@@ -1761,13 +3282,23 @@ static mpack_node_data_t* mpack_node_map_uint_impl(mpack_node_t node, uint64_t n
         return NULL;
     }
 
+    if (!mpack_node_expand(node))
+        return NULL;
+
+    #if defined(MPACK_MALLOC) && MPACK_NODE_MAP_INDEX
+    mpack_node_data_t* index = mpack_node_map_index(node);
+    if (index)
+        return mpack_node_map_index_find(node, index, mpack_node_map_hash_num(num),
+                mpack_type_uint, num, NULL, 0);
+    #endif
+
     mpack_node_data_t* found = NULL;
 
     for (size_t i = 0; i < node.data->len; ++i) {
         mpack_node_data_t* key = mpack_node_child(node, i * 2);
 
-        if ((key->type == mpack_type_uint && key->value.u == num) ||
-            (key->type == mpack_type_int && key->value.i >= 0 && (uint64_t)key->value.i == num))
+        if ((key->type == mpack_type_uint && mpack_node_data_u64(node.tree, key) == num) ||
+            (key->type == mpack_type_int && mpack_node_data_i64(node.tree, key) >= 0 && (uint64_t)mpack_node_data_i64(node.tree, key) == num))
         {
             if (found) {
                 mpack_node_flag_error(node, mpack_error_data);
@@ -1794,6 +3325,16 @@ static mpack_node_data_t* mpack_node_map_str_impl(mpack_node_t node, const char*
         return NULL;
     }
 
+    if (!mpack_node_expand(node))
+        return NULL;
+
+    #if defined(MPACK_MALLOC) && MPACK_NODE_MAP_INDEX
+    mpack_node_data_t* index = mpack_node_map_index(node);
+    if (index)
+        return mpack_node_map_index_find(node, index, mpack_node_map_hash_str(str, length),
+                mpack_type_str, 0, str, length);
+    #endif
+
     mpack_tree_t* tree = node.tree;
     mpack_node_data_t* found = NULL;
 
@@ -1885,6 +3426,66 @@ bool mpack_node_map_contains_cstr(mpack_node_t node, const char* cstr) {
     return mpack_node_map_contains_str(node, cstr, mpack_strlen(cstr));
 }
 
+#if defined(MPACK_MALLOC) && MPACK_NODE_INTERN
+// Checks that the given node is an interned map and expands it, returning
+// false if an error was flagged.
+static bool mpack_node_map_check_interned(mpack_node_t node) {
+    if (mpack_node_error(node) != mpack_ok)
+        return false;
+
+    if (node.data->type != mpack_type_map) {
+        mpack_node_flag_error(node, mpack_error_type);
+        return false;
+    }
+
+    if (node.tree->parser.intern == NULL) {
+        mpack_break("tree was not parsed with an intern table!");
+        mpack_node_flag_error(node, mpack_error_bug);
+        return false;
+    }
+
+    return mpack_node_expand(node);
+}
+
+static mpack_node_data_t* mpack_node_map_key_id_impl(mpack_node_t node, uint32_t id) {
+    if (!mpack_node_map_check_interned(node) || id == 0 || node.data->len == 0)
+        return NULL;
+
+    const uint32_t* ids = mpack_node_map_ids(node.tree, node.data);
+    mpack_node_data_t* found = NULL;
+    for (size_t i = 0; i < node.data->len; ++i) {
+        if (ids[i] == id) {
+            if (found) {
+                mpack_node_flag_error(node, mpack_error_data);
+                return NULL;
+            }
+            found = mpack_node_child(node, i * 2 + 1);
+        }
+    }
+    return found;
+}
+
+mpack_node_t mpack_node_map_key_id(mpack_node_t node, uint32_t id) {
+    return mpack_node_wrap_lookup(node.tree, mpack_node_map_key_id_impl(node, id));
+}
+
+mpack_node_t mpack_node_map_key_id_optional(mpack_node_t node, uint32_t id) {
+    return mpack_node_wrap_lookup_optional(node.tree, mpack_node_map_key_id_impl(node, id));
+}
+
+uint32_t mpack_node_map_key_id_at(mpack_node_t node, size_t index) {
+    if (!mpack_node_map_check_interned(node))
+        return 0;
+
+    if (index >= node.data->len) {
+        mpack_node_flag_error(node, mpack_error_data);
+        return 0;
+    }
+
+    return mpack_node_map_ids(node.tree, node.data)[index];
+}
+#endif
+
 size_t mpack_node_enum_optional(mpack_node_t node, const char* strings[], size_t count) {
     if (mpack_node_error(node) != mpack_ok)
         return count;
@@ -1920,7 +3521,7 @@ size_t mpack_node_enum(mpack_node_t node, const char* strings[], size_t count) {
 mpack_type_t mpack_node_type(mpack_node_t node) {
     if (mpack_node_error(node) != mpack_ok)
         return mpack_type_nil;
-    return node.data->type;
+    return mpack_node_data_type(node.data);
 }
 
 bool mpack_node_is_nil(mpack_node_t node) {
@@ -1979,11 +3580,11 @@ uint8_t mpack_node_u8(mpack_node_t node) {
         return 0;
 
     if (node.data->type == mpack_type_uint) {
-        if (node.data->value.u <= UINT8_MAX)
-            return (uint8_t)node.data->value.u;
+        if (mpack_node_value_u(node) <= UINT8_MAX)
+            return (uint8_t)mpack_node_value_u(node);
     } else if (node.data->type == mpack_type_int) {
-        if (node.data->value.i >= 0 && node.data->value.i <= UINT8_MAX)
-            return (uint8_t)node.data->value.i;
+        if (mpack_node_value_i(node) >= 0 && mpack_node_value_i(node) <= UINT8_MAX)
+            return (uint8_t)mpack_node_value_i(node);
     }
 
     mpack_node_flag_error(node, mpack_error_type);
@@ -1995,11 +3596,11 @@ int8_t mpack_node_i8(mpack_node_t node) {
         return 0;
 
     if (node.data->type == mpack_type_uint) {
-        if (node.data->value.u <= INT8_MAX)
-            return (int8_t)node.data->value.u;
+        if (mpack_node_value_u(node) <= INT8_MAX)
+            return (int8_t)mpack_node_value_u(node);
     } else if (node.data->type == mpack_type_int) {
-        if (node.data->value.i >= INT8_MIN && node.data->value.i <= INT8_MAX)
-            return (int8_t)node.data->value.i;
+        if (mpack_node_value_i(node) >= INT8_MIN && mpack_node_value_i(node) <= INT8_MAX)
+            return (int8_t)mpack_node_value_i(node);
     }
 
     mpack_node_flag_error(node, mpack_error_type);
@@ -2011,11 +3612,11 @@ uint16_t mpack_node_u16(mpack_node_t node) {
         return 0;
 
     if (node.data->type == mpack_type_uint) {
-        if (node.data->value.u <= UINT16_MAX)
-            return (uint16_t)node.data->value.u;
+        if (mpack_node_value_u(node) <= UINT16_MAX)
+            return (uint16_t)mpack_node_value_u(node);
     } else if (node.data->type == mpack_type_int) {
-        if (node.data->value.i >= 0 && node.data->value.i <= UINT16_MAX)
-            return (uint16_t)node.data->value.i;
+        if (mpack_node_value_i(node) >= 0 && mpack_node_value_i(node) <= UINT16_MAX)
+            return (uint16_t)mpack_node_value_i(node);
     }
 
     mpack_node_flag_error(node, mpack_error_type);
@@ -2027,11 +3628,11 @@ int16_t mpack_node_i16(mpack_node_t node) {
         return 0;
 
     if (node.data->type == mpack_type_uint) {
-        if (node.data->value.u <= INT16_MAX)
-            return (int16_t)node.data->value.u;
+        if (mpack_node_value_u(node) <= INT16_MAX)
+            return (int16_t)mpack_node_value_u(node);
     } else if (node.data->type == mpack_type_int) {
-        if (node.data->value.i >= INT16_MIN && node.data->value.i <= INT16_MAX)
-            return (int16_t)node.data->value.i;
+        if (mpack_node_value_i(node) >= INT16_MIN && mpack_node_value_i(node) <= INT16_MAX)
+            return (int16_t)mpack_node_value_i(node);
     }
 
     mpack_node_flag_error(node, mpack_error_type);
@@ -2043,11 +3644,11 @@ uint32_t mpack_node_u32(mpack_node_t node) {
         return 0;
 
     if (node.data->type == mpack_type_uint) {
-        if (node.data->value.u <= UINT32_MAX)
-            return (uint32_t)node.data->value.u;
+        if (mpack_node_value_u(node) <= UINT32_MAX)
+            return (uint32_t)mpack_node_value_u(node);
     } else if (node.data->type == mpack_type_int) {
-        if (node.data->value.i >= 0 && node.data->value.i <= UINT32_MAX)
-            return (uint32_t)node.data->value.i;
+        if (mpack_node_value_i(node) >= 0 && mpack_node_value_i(node) <= UINT32_MAX)
+            return (uint32_t)mpack_node_value_i(node);
     }
 
     mpack_node_flag_error(node, mpack_error_type);
@@ -2059,11 +3660,11 @@ int32_t mpack_node_i32(mpack_node_t node) {
         return 0;
 
     if (node.data->type == mpack_type_uint) {
-        if (node.data->value.u <= INT32_MAX)
-            return (int32_t)node.data->value.u;
+        if (mpack_node_value_u(node) <= INT32_MAX)
+            return (int32_t)mpack_node_value_u(node);
     } else if (node.data->type == mpack_type_int) {
-        if (node.data->value.i >= INT32_MIN && node.data->value.i <= INT32_MAX)
-            return (int32_t)node.data->value.i;
+        if (mpack_node_value_i(node) >= INT32_MIN && mpack_node_value_i(node) <= INT32_MAX)
+            return (int32_t)mpack_node_value_i(node);
     }
 
     mpack_node_flag_error(node, mpack_error_type);
@@ -2075,10 +3676,10 @@ uint64_t mpack_node_u64(mpack_node_t node) {
         return 0;
 
     if (node.data->type == mpack_type_uint) {
-        return node.data->value.u;
+        return mpack_node_value_u(node);
     } else if (node.data->type == mpack_type_int) {
-        if (node.data->value.i >= 0)
-            return (uint64_t)node.data->value.i;
+        if (mpack_node_value_i(node) >= 0)
+            return (uint64_t)mpack_node_value_i(node);
     }
 
     mpack_node_flag_error(node, mpack_error_type);
@@ -2090,10 +3691,10 @@ int64_t mpack_node_i64(mpack_node_t node) {
         return 0;
 
     if (node.data->type == mpack_type_uint) {
-        if (node.data->value.u <= (uint64_t)INT64_MAX)
-            return (int64_t)node.data->value.u;
+        if (mpack_node_value_u(node) <= (uint64_t)INT64_MAX)
+            return (int64_t)mpack_node_value_u(node);
     } else if (node.data->type == mpack_type_int) {
-        return node.data->value.i;
+        return mpack_node_value_i(node);
     }
 
     mpack_node_flag_error(node, mpack_error_type);
@@ -2135,13 +3736,13 @@ float mpack_node_float(mpack_node_t node) {
         return 0.0f;
 
     if (node.data->type == mpack_type_uint)
-        return (float)node.data->value.u;
+        return (float)mpack_node_value_u(node);
     else if (node.data->type == mpack_type_int)
-        return (float)node.data->value.i;
+        return (float)mpack_node_value_i(node);
     else if (node.data->type == mpack_type_float)
         return node.data->value.f;
     else if (node.data->type == mpack_type_double)
-        return (float)node.data->value.d;
+        return (float)mpack_node_value_d(node);
 
     mpack_node_flag_error(node, mpack_error_type);
     return 0.0f;
@@ -2152,13 +3753,13 @@ double mpack_node_double(mpack_node_t node) {
         return 0.0;
 
     if (node.data->type == mpack_type_uint)
-        return (double)node.data->value.u;
+        return (double)mpack_node_value_u(node);
     else if (node.data->type == mpack_type_int)
-        return (double)node.data->value.i;
+        return (double)mpack_node_value_i(node);
     else if (node.data->type == mpack_type_float)
         return (double)node.data->value.f;
     else if (node.data->type == mpack_type_double)
-        return node.data->value.d;
+        return mpack_node_value_d(node);
 
     mpack_node_flag_error(node, mpack_error_type);
     return 0.0;
@@ -2182,7 +3783,7 @@ double mpack_node_double_strict(mpack_node_t node) {
     if (node.data->type == mpack_type_float)
         return (double)node.data->value.f;
     else if (node.data->type == mpack_type_double)
-        return node.data->value.d;
+        return mpack_node_value_d(node);
 
     mpack_node_flag_error(node, mpack_error_type);
     return 0.0;
@@ -2205,7 +3806,7 @@ uint32_t mpack_node_data_len(mpack_node_t node) {
     if (mpack_node_error(node) != mpack_ok)
         return 0;
 
-    mpack_type_t type = node.data->type;
+    mpack_type_t type = mpack_node_data_type(node.data);
     if (type == mpack_type_str || type == mpack_type_bin
             #if MPACK_EXTENSIONS
             || type == mpack_type_ext
@@ -2232,7 +3833,7 @@ const char* mpack_node_str(mpack_node_t node) {
     if (mpack_node_error(node) != mpack_ok)
         return NULL;
 
-    mpack_type_t type = node.data->type;
+    mpack_type_t type = mpack_node_data_type(node.data);
     if (type == mpack_type_str)
         return mpack_node_data_unchecked(node);
 
@@ -2244,7 +3845,7 @@ const char* mpack_node_data(mpack_node_t node) {
     if (mpack_node_error(node) != mpack_ok)
         return NULL;
 
-    mpack_type_t type = node.data->type;
+    mpack_type_t type = mpack_node_data_type(node.data);
     if (type == mpack_type_str || type == mpack_type_bin
             #if MPACK_EXTENSIONS
             || type == mpack_type_ext
@@ -2304,9 +3905,264 @@ mpack_node_t mpack_node_array_at(mpack_node_t node, size_t index) {
         return mpack_tree_nil_node(node.tree);
     }
 
+    if (!mpack_node_expand(node))
+        return mpack_tree_nil_node(node.tree);
+
     return mpack_node(node.tree, mpack_node_child(node, index));
 }
 
+// Checks that a node is an array that fits in a buffer of the given count
+// for a bulk copy.
+static bool mpack_node_array_copy_start(mpack_node_t node, size_t count) {
+    if (mpack_node_error(node) != mpack_ok)
+        return false;
+
+    if (node.data->type != mpack_type_array) {
+        mpack_node_flag_error(node, mpack_error_type);
+        return false;
+    }
+
+    if (node.data->len > count) {
+        mpack_node_flag_error(node, mpack_error_too_big);
+        return false;
+    }
+
+    return mpack_node_expand(node);
+}
+
+// Checks that each element of an array is an integer within the given range.
+// (An int or uint within the range of the destination type can then be read
+// as either, as with the value union.)
+static bool mpack_node_array_check_ints(mpack_node_t node, int64_t min, uint64_t max) {
+    mpack_node_data_t* children = mpack_node_data_children(node.tree, node.data);
+    size_t len = node.data->len;
+    for (size_t i = 0; i < len; ++i) {
+        if (children[i].type == mpack_type_uint) {
+            if (mpack_node_data_u64(node.tree, &children[i]) <= max)
+                continue;
+        } else if (children[i].type == mpack_type_int) {
+            int64_t value = mpack_node_data_i64(node.tree, &children[i]);
+            if (value >= min && (value < 0 || (uint64_t)value <= max))
+                continue;
+        }
+        mpack_node_flag_error(node, mpack_error_type);
+        return false;
+    }
+    return true;
+}
+
+// Checks that each element of an array is a number, returning the common
+// type of all elements or mpack_type_missing if they differ.
+static mpack_type_t mpack_node_array_check_numbers(mpack_node_t node) {
+    mpack_node_data_t* children = mpack_node_data_children(node.tree, node.data);
+    size_t len = node.data->len;
+    mpack_type_t common = (len > 0) ? mpack_node_data_type(&children[0]) : mpack_type_missing;
+    for (size_t i = 0; i < len; ++i) {
+        mpack_type_t type = mpack_node_data_type(&children[i]);
+        if (type != mpack_type_uint && type != mpack_type_int &&
+                type != mpack_type_float && type != mpack_type_double)
+        {
+            mpack_node_flag_error(node, mpack_error_type);
+            return mpack_type_nil;
+        }
+        if (type != common)
+            common = mpack_type_missing;
+    }
+    return common;
+}
+
+size_t mpack_node_array_copy_double(mpack_node_t node, double* out, size_t count) {
+    if (!mpack_node_array_copy_start(node, count))
+        return 0;
+    mpack_type_t common = mpack_node_array_check_numbers(node);
+    if (common == mpack_type_nil)
+        return 0;
+
+    mpack_node_data_t* children = mpack_node_data_children(node.tree, node.data);
+    size_t len = node.data->len;
+    if (common == mpack_type_double) {
+        for (size_t i = 0; i < len; ++i)
+            out[i] = mpack_node_data_double(node.tree, &children[i]);
+    } else if (common == mpack_type_float) {
+        for (size_t i = 0; i < len; ++i)
+            out[i] = (double)children[i].value.f;
+    } else {
+        for (size_t i = 0; i < len; ++i)
+            out[i] = mpack_node_double(mpack_node(node.tree, children + i));
+    }
+    return len;
+}
+
+size_t mpack_node_array_copy_float(mpack_node_t node, float* out, size_t count) {
+    if (!mpack_node_array_copy_start(node, count))
+        return 0;
+    mpack_type_t common = mpack_node_array_check_numbers(node);
+    if (common == mpack_type_nil)
+        return 0;
+
+    mpack_node_data_t* children = mpack_node_data_children(node.tree, node.data);
+    size_t len = node.data->len;
+    if (common == mpack_type_float) {
+        for (size_t i = 0; i < len; ++i)
+            out[i] = children[i].value.f;
+    } else {
+        for (size_t i = 0; i < len; ++i)
+            out[i] = mpack_node_float(mpack_node(node.tree, children + i));
+    }
+    return len;
+}
+
+size_t mpack_node_array_copy_i64(mpack_node_t node, int64_t* out, size_t count) {
+    if (!mpack_node_array_copy_start(node, count) || !mpack_node_array_check_ints(node, INT64_MIN, INT64_MAX))
+        return 0;
+    mpack_node_data_t* children = mpack_node_data_children(node.tree, node.data);
+    size_t len = node.data->len;
+    for (size_t i = 0; i < len; ++i)
+        out[i] = mpack_node_data_i64(node.tree, &children[i]);
+    return len;
+}
+
+size_t mpack_node_array_copy_i32(mpack_node_t node, int32_t* out, size_t count) {
+    if (!mpack_node_array_copy_start(node, count) || !mpack_node_array_check_ints(node, INT32_MIN, INT32_MAX))
+        return 0;
+    mpack_node_data_t* children = mpack_node_data_children(node.tree, node.data);
+    size_t len = node.data->len;
+    for (size_t i = 0; i < len; ++i)
+        out[i] = (int32_t)mpack_node_data_i64(node.tree, &children[i]);
+    return len;
+}
+
+size_t mpack_node_array_copy_u64(mpack_node_t node, uint64_t* out, size_t count) {
+    if (!mpack_node_array_copy_start(node, count) || !mpack_node_array_check_ints(node, 0, UINT64_MAX))
+        return 0;
+    mpack_node_data_t* children = mpack_node_data_children(node.tree, node.data);
+    size_t len = node.data->len;
+    for (size_t i = 0; i < len; ++i)
+        out[i] = mpack_node_data_u64(node.tree, &children[i]);
+    return len;
+}
+
+size_t mpack_node_array_copy_u32(mpack_node_t node, uint32_t* out, size_t count) {
+    if (!mpack_node_array_copy_start(node, count) || !mpack_node_array_check_ints(node, 0, UINT32_MAX))
+        return 0;
+    mpack_node_data_t* children = mpack_node_data_children(node.tree, node.data);
+    size_t len = node.data->len;
+    for (size_t i = 0; i < len; ++i)
+        out[i] = (uint32_t)mpack_node_data_u64(node.tree, &children[i]);
+    return len;
+}
+
+// Finds the value of a column's key in a record, checking first the slot
+// at which the key was last found.
+static mpack_node_data_t* mpack_node_column_find(mpack_node_t record, mpack_column_t* column) {
+    mpack_node_data_t* children = mpack_node_data_children(record.tree, record.data);
+    size_t slot = column->slot;
+    if (slot < record.data->len) {
+        mpack_node_data_t* key = &children[slot * 2];
+        if (key->type == mpack_type_str && key->len == column->key_length &&
+                mpack_memcmp(column->key, mpack_node_data_unchecked(mpack_node(record.tree, key)),
+                    column->key_length) == 0)
+            return &children[slot * 2 + 1];
+    }
+
+    mpack_node_data_t* value = mpack_node_map_str_impl(record, column->key, column->key_length);
+    if (value != NULL)
+        column->slot = (size_t)(value - children) / 2;
+    return value;
+}
+
+// Stores the value of a column for the given record.
+static bool mpack_node_column_store(mpack_tree_t* tree, mpack_column_t* column, size_t row, mpack_node_data_t* value) {
+    bool null = (value == NULL || value->type == mpack_type_nil);
+    if (column->nulls != NULL) {
+        uint8_t bit = (uint8_t)(1u << (row % 8));
+        if (null)
+            column->nulls[row / 8] |= bit;
+        else
+            column->nulls[row / 8] &= (uint8_t)~bit;
+    }
+
+    if (null) {
+        if (column->nulls == NULL) {
+            mpack_tree_flag_error(tree, (value == NULL) ? mpack_error_data : mpack_error_type);
+            return false;
+        }
+        switch (column->type) {
+            case mpack_column_i64:
+                column->i64[row] = 0;
+                break;
+            case mpack_column_double:
+                column->f64[row] = 0.0;
+                break;
+            case mpack_column_str:
+                column->offsets[row] = 0;
+                column->lengths[row] = 0;
+                break;
+        }
+        return true;
+    }
+
+    switch (column->type) {
+        case mpack_column_i64:
+            if (value->type == mpack_type_int ||
+                    (value->type == mpack_type_uint && mpack_node_data_u64(tree, value) <= (uint64_t)INT64_MAX))
+            {
+                column->i64[row] = mpack_node_data_i64(tree, value);
+                return true;
+            }
+            break;
+
+        case mpack_column_double:
+            column->f64[row] = mpack_node_double(mpack_node(tree, value));
+            return mpack_tree_error(tree) == mpack_ok;
+
+        case mpack_column_str:
+            if (value->type == mpack_type_str) {
+                column->offsets[row] = (size_t)(mpack_node_data_unchecked(mpack_node(tree, value)) - tree->data);
+                column->lengths[row] = (uint32_t)value->len;
+                return true;
+            }
+            break;
+    }
+
+    mpack_tree_flag_error(tree, mpack_error_type);
+    return false;
+}
+
+size_t mpack_node_array_columns(mpack_node_t node, mpack_column_t* columns, size_t column_count, size_t count) {
+    if (!mpack_node_array_copy_start(node, count))
+        return 0;
+
+    for (size_t i = 0; i < column_count; ++i) {
+        mpack_assert(columns[i].key != NULL, "column %i has no key", (int)i);
+        columns[i].key_length = mpack_strlen(columns[i].key);
+        columns[i].slot = SIZE_MAX;
+    }
+
+    mpack_tree_t* tree = node.tree;
+    mpack_node_data_t* records = mpack_node_data_children(tree, node.data);
+    size_t rows = node.data->len;
+    for (size_t row = 0; row < rows; ++row) {
+        mpack_node_t record = mpack_node(tree, &records[row]);
+        if (record.data->type != mpack_type_map) {
+            mpack_tree_flag_error(tree, mpack_error_type);
+            return 0;
+        }
+        if (!mpack_node_expand(record))
+            return 0;
+
+        for (size_t i = 0; i < column_count; ++i) {
+            mpack_node_data_t* value = mpack_node_column_find(record, &columns[i]);
+            if (mpack_tree_error(tree) != mpack_ok)
+                return 0;
+            if (!mpack_node_column_store(tree, &columns[i], row, value))
+                return 0;
+        }
+    }
+
+    return rows;
+}
+
 size_t mpack_node_map_count(mpack_node_t node) {
     if (mpack_node_error(node) != mpack_ok)
         return 0;
@@ -2334,6 +4190,9 @@ static mpack_node_t mpack_node_map_at(mpack_node_t node, size_t index, size_t of
         return mpack_tree_nil_node(node.tree);
     }
 
+    if (!mpack_node_expand(node))
+        return mpack_tree_nil_node(node.tree);
+
     return mpack_node(node.tree, mpack_node_child(node, index * 2 + offset));
 }
 
@@ -29,6 +29,7 @@
 #define MPACK_NODE_H 1
 
 #include "mpack-reader.h"
+#include "mpack-writer.h"
 
 MPACK_HEADER_START
 MPACK_EXTERN_C_START
@@ -62,6 +63,11 @@ MPACK_EXTERN_C_START
  */
 typedef struct mpack_node_t mpack_node_t;
 
+/**
+ * A per-thread view of a frozen tree. See mpack_tree_freeze().
+ */
+typedef struct mpack_tree_view_t mpack_tree_view_t;
+
 /**
  * The storage for nodes in an MPack tree.
  *
@@ -69,7 +75,8 @@ typedef struct mpack_node_t mpack_node_t;
  * for nodes instead of letting the tree allocate it.
  *
  * @ref mpack_node_data_t is 16 bytes on most common architectures (32-bit
- * and 64-bit.)
+ * and 64-bit), or 8 bytes if @ref MPACK_NODE_COMPACT is enabled. It is
+ * larger if @ref MPACK_NODE_SPANS is enabled.
  */
 typedef struct mpack_node_data_t mpack_node_data_t;
 
@@ -107,6 +114,24 @@ typedef struct mpack_tree_t mpack_tree_t;
  */
 typedef void (*mpack_tree_error_t)(mpack_tree_t* tree, mpack_error_t error);
 
+#if defined(MPACK_MALLOC) && MPACK_NODE_INTERN
+/**
+ * A table of interned map keys shared across parsed trees.
+ *
+ * @see mpack_intern_init()
+ */
+typedef struct mpack_intern_t mpack_intern_t;
+#endif
+
+#ifdef MPACK_MALLOC
+/**
+ * A cache of node pages shared across trees.
+ *
+ * @see mpack_page_cache_init()
+ */
+typedef struct mpack_page_cache_t mpack_page_cache_t;
+#endif
+
 /**
  * The MPack tree's read function. It should fill the buffer with as many bytes
  * as are immediately available up to the given @c count, returning the number
@@ -145,6 +170,33 @@ struct mpack_node_t {
     mpack_tree_t* tree;
 };
 
+#if MPACK_NODE_COMPACT
+struct mpack_node_data_t {
+    uint32_t type : 4; /* The mpack_type_t of the node. */
+
+    /*
+     * The element count if the type is an array; the number of key/value
+     * pairs if the type is map; or the number of bytes if the type is str,
+     * bin or ext. If the type is int, uint or double, this is non-zero if
+     * the value is stored in the message data at value.offset.
+     */
+    uint32_t len : 28;
+
+    union
+    {
+        bool     b; /* The value if the type is bool. */
+        float    f; /* The value if the type is float. */
+        int32_t  i; /* The value if the type is signed int and len is 0. */
+        uint32_t u; /* The value if the type is unsigned int and len is 0. */
+        uint32_t offset; /* The byte offset for str, bin, ext and large numbers */
+        uint32_t children; /* The index of the first child for map or array */
+    } value;
+
+    #if MPACK_NODE_SPANS
+    uint32_t start; /* The byte offset at which the node starts */
+    #endif
+};
+#else
 struct mpack_node_data_t {
     mpack_type_t type;
 
@@ -165,13 +217,30 @@ struct mpack_node_data_t {
         size_t offset; /* The byte offset for str, bin and ext */
         mpack_node_data_t* children; /* The children for map or array */
     } value;
+
+    #if MPACK_NODE_SPANS
+    size_t start; /* The byte offset at which the node starts */
+    #endif
 };
+#endif
 
 typedef struct mpack_tree_page_t {
     struct mpack_tree_page_t* next;
     mpack_node_data_t nodes[1]; // variable size
 } mpack_tree_page_t;
 
+#ifdef MPACK_MALLOC
+// fix up the alloc size to make sure it exactly fits the
+// maximum number of nodes it can contain (the allocator will
+// waste it back anyway, but we round it down just in case)
+
+#define MPACK_NODES_PER_PAGE \
+    ((MPACK_NODE_PAGE_SIZE - sizeof(mpack_tree_page_t)) / sizeof(mpack_node_data_t) + 1)
+
+#define MPACK_PAGE_ALLOC_SIZE \
+    (sizeof(mpack_tree_page_t) + sizeof(mpack_node_data_t) * (MPACK_NODES_PER_PAGE - 1))
+#endif
+
 typedef enum mpack_tree_parse_state_t {
     mpack_tree_parse_state_not_started,
     mpack_tree_parse_state_in_progress,
@@ -181,6 +250,9 @@ typedef enum mpack_tree_parse_state_t {
 typedef struct mpack_level_t {
     mpack_node_data_t* child;
     size_t left; // children left in level
+    #if defined(MPACK_MALLOC) && MPACK_NODE_INTERN
+    uint32_t* ids; // the next key id to store if the level is an interned map, or NULL
+    #endif
 } mpack_level_t;
 
 typedef struct mpack_tree_parser_t {
@@ -208,10 +280,17 @@ typedef struct mpack_tree_parser_t {
 
     mpack_node_data_t* nodes; // next node in current page/pool
     size_t nodes_left; // nodes left in current page/pool
+    #if MPACK_NODE_COMPACT
+    uint32_t nodes_index; // index of the next node in current page/pool
+    #endif
 
     size_t current_node_reserved;
     size_t level;
 
+    #if defined(MPACK_MALLOC) && MPACK_NODE_INTERN
+    mpack_intern_t* intern; // the intern table the current message was parsed with
+    #endif
+
     #ifdef MPACK_MALLOC
     // It's much faster to allocate the initial parsing stack inline within the
     // parser. We replace it with a heap allocation if we need to grow it.
@@ -237,8 +316,10 @@ struct mpack_tree_t {
     mpack_error_t error;
 
     #ifdef MPACK_MALLOC
+    mpack_allocator_t allocator; /* Allocator for pages, buffers and allocated node data */
     char* buffer;
     size_t buffer_capacity;
+    bool data_borrowed; // whether data refers to a chunk passed to mpack_tree_feed()
     #endif
 
     const char* data;
@@ -257,8 +338,39 @@ struct mpack_tree_t {
     size_t pool_count;
 
     #ifdef MPACK_MALLOC
-    mpack_tree_page_t* next;
+    mpack_tree_page_t* next;           // separate pages for large children and map indices
+    mpack_tree_page_t* standard_pages; // pages of page_nodes nodes
+    mpack_page_cache_t* page_cache;    // the cache of standard pages, or NULL
+    size_t page_nodes;                 // the number of nodes in a standard page
+    #if MPACK_NODE_COMPACT
+    // The node index table. Entry i points to nodes i * MPACK_NODES_PER_PAGE
+    // and up. Children larger than a page span several consecutive entries.
+    mpack_node_data_t** pages;
+    size_t page_count;
+    size_t page_capacity;
+    #endif
+    #if MPACK_NODE_MAP_INDEX
+    bool eager_map_index; // whether to index all large maps when parsed
+    #endif
+    #endif
+
+    #if MPACK_NODE_LAZY
+    size_t lazy_depth; // depth at which compound nodes are left unparsed, or 0
+    #endif
+
+    #if defined(MPACK_MALLOC) && MPACK_NODE_INTERN
+    mpack_intern_t* intern; // the intern table for the next message, or NULL
     #endif
+
+    #if MPACK_STATS
+    mpack_stats_t stats; // statistics counters
+    #endif
+
+    bool frozen; // whether the parsed message can be shared with views
+};
+
+struct mpack_tree_view_t {
+    mpack_tree_t tree; // a copy of the frozen tree sharing its nodes and data
 };
 
 // internal functions
@@ -270,8 +382,35 @@ MPACK_INLINE mpack_node_t mpack_node(mpack_tree_t* tree, mpack_node_data_t* data
     return node;
 }
 
+#if MPACK_NODE_COMPACT
+MPACK_INLINE mpack_node_data_t* mpack_tree_node_at(mpack_tree_t* tree, uint32_t index) {
+    #ifdef MPACK_MALLOC
+    if (tree->pool == NULL)
+        return tree->pages[index / MPACK_NODES_PER_PAGE] + index % MPACK_NODES_PER_PAGE;
+    #endif
+    return tree->pool + index;
+}
+
+MPACK_INLINE mpack_node_data_t* mpack_node_data_children(mpack_tree_t* tree, mpack_node_data_t* data) {
+    return mpack_tree_node_at(tree, data->value.children);
+}
+
+MPACK_INLINE mpack_type_t mpack_node_data_type(mpack_node_data_t* data) {
+    return (mpack_type_t)data->type;
+}
+#else
+MPACK_INLINE mpack_node_data_t* mpack_node_data_children(mpack_tree_t* tree, mpack_node_data_t* data) {
+    MPACK_UNUSED(tree);
+    return data->value.children;
+}
+
+MPACK_INLINE mpack_type_t mpack_node_data_type(mpack_node_data_t* data) {
+    return data->type;
+}
+#endif
+
 MPACK_INLINE mpack_node_data_t* mpack_node_child(mpack_node_t node, size_t child) {
-    return node.data->value.children + child;
+    return mpack_node_data_children(node.tree, node.data) + child;
 }
 
 MPACK_INLINE mpack_node_t mpack_tree_nil_node(mpack_tree_t* tree) {
@@ -344,6 +483,26 @@ MPACK_INLINE void mpack_tree_init(mpack_tree_t* tree, const char* data, size_t l
  */
 void mpack_tree_init_stream(mpack_tree_t* tree, mpack_tree_read_t read_fn, void* context,
         size_t max_message_size, size_t max_message_nodes);
+
+/**
+ * Initializes a tree parser for data pushed to it with @ref mpack_tree_feed().
+ *
+ * This is like @ref mpack_tree_init_stream(), except that rather than pulling
+ * data from a read function, the tree parses whatever data the caller passes
+ * to it as it arrives. This suits event loops where data is received into
+ * the caller's own buffers on its own schedule.
+ *
+ * Maximum allowances for message size and node count must be specified in this
+ * function. They can be changed later with @ref mpack_tree_set_limits().
+ *
+ * @param tree The tree parser
+ * @param max_message_size The maximum size of a message in bytes
+ * @param max_message_nodes The maximum number of nodes per message. See
+ *        @ref mpack_node_data_t for the size of nodes.
+ *
+ * @see mpack_tree_feed()
+ */
+void mpack_tree_init_feed(mpack_tree_t* tree, size_t max_message_size, size_t max_message_nodes);
 #endif
 
 /**
@@ -373,7 +532,8 @@ void mpack_tree_init_error(mpack_tree_t* tree, mpack_error_t error);
  * mpack_tree_destroy(), even if parsing fails.
  *
  * The file is opened, loaded fully into memory, and closed before this call
- * returns.
+ * returns. If @ref MPACK_MMAP is enabled, a regular file is instead mapped
+ * read-only into memory and unmapped when the tree is destroyed.
  *
  * @param tree The tree to initialize
  * @param filename The filename passed to fopen() to read the file
@@ -397,7 +557,8 @@ MPACK_INLINE void mpack_tree_init_file(mpack_tree_t* tree, const char* filename,
  * The tree must be destroyed with mpack_tree_destroy(), even if parsing fails.
  *
  * The FILE is fully loaded fully into memory (and closed if requested) before
- * this call returns.
+ * this call returns. If @ref MPACK_MMAP is enabled and the FILE refers to a
+ * regular file, it is mapped read-only into memory instead.
  *
  * @param tree The tree to initialize.
  * @param stdfile The FILE.
@@ -413,6 +574,37 @@ MPACK_INLINE void mpack_tree_init_file(mpack_tree_t* tree, const char* filename,
 void mpack_tree_init_stdfile(mpack_tree_t* tree, FILE* stdfile, size_t max_bytes, bool close_when_done);
 #endif
 
+#if MPACK_FD
+/**
+ * Initializes a tree to parse the rest of the data readable from a POSIX file
+ * descriptor. The tree must be destroyed with mpack_tree_destroy(), even if
+ * parsing fails.
+ *
+ * The data is read with read() up to end of file, into a single buffer
+ * allocated with @ref MPACK_MALLOC, before this call returns. A regular
+ * file is normally read in one call of its remaining size; pipes and sockets
+ * are read in growing chunks of at least @ref MPACK_FD_BUFFER_SIZE bytes. If
+ * a regular file grows while it is read, the data appended to it is read as
+ * well, up to @p max_bytes.
+ *
+ * Since the data is read before the tree can be given an allocator, it is
+ * allocated with @ref MPACK_MALLOC even if mpack_tree_set_allocator() is
+ * called afterwards. The allocator is still used for the tree's nodes.
+ *
+ * @param tree The tree to initialize.
+ * @param fd The file descriptor.
+ * @param max_bytes The maximum number of bytes to load, or 0 for unlimited
+ *        size.
+ * @param close_when_done If true, close() will be called on the descriptor
+ *        when it is no longer needed.
+ *
+ * @warning The tree will read all data up to end of file before parsing it.
+ *          To parse a sequence of messages from a socket, use
+ *          mpack_tree_init_stream() instead.
+ */
+void mpack_tree_init_fd(mpack_tree_t* tree, int fd, size_t max_bytes, bool close_when_done);
+#endif
+
 /**
  * @}
  */
@@ -439,6 +631,132 @@ void mpack_tree_init_stdfile(mpack_tree_t* tree, FILE* stdfile, size_t max_bytes
 void mpack_tree_set_limits(mpack_tree_t* tree, size_t max_message_size,
         size_t max_message_nodes);
 
+#ifdef MPACK_MALLOC
+/**
+ * Sets the allocator for memory allocated by the tree.
+ *
+ * This is used for node pages, the parsing stack, the buffer of a stream
+ * tree (see mpack_tree_init_stream()), map indices and the results of
+ * allocating node functions such as mpack_node_cstr_alloc(), which must
+ * then be freed with the allocator rather than with MPACK_FREE().
+ *
+ * This must be called before the first message is parsed. The file data of
+ * a tree initialized with mpack_tree_init_filename() or
+ * mpack_tree_init_stdfile() is not affected.
+ *
+ * @param tree The tree parser.
+ * @param allocator The allocator to use, or NULL to use @ref MPACK_MALLOC.
+ *     It is copied into the tree.
+ *
+ * @note This requires @ref MPACK_MALLOC.
+ */
+void mpack_tree_set_allocator(mpack_tree_t* tree, const mpack_allocator_t* allocator);
+
+/**
+ * Sets the size in bytes of the node pages allocated by the tree, replacing
+ * the default of @ref MPACK_NODE_PAGE_SIZE.
+ *
+ * Larger pages mean fewer allocations for large messages, while smaller
+ * pages waste less memory for small ones. The children of a map or array
+ * must be contiguous, so larger pages are still allocated for them as
+ * needed. A size of zero restores the default.
+ *
+ * This must be called before the first message is parsed. It has no effect
+ * on a tree with a page cache, which uses the cache's page size (see
+ * mpack_tree_set_page_cache().)
+ *
+ * @note This requires @ref MPACK_MALLOC.
+ */
+void mpack_tree_set_page_size(mpack_tree_t* tree, size_t page_size);
+
+/**
+ * Attaches a page cache to the tree, or detaches it if NULL.
+ *
+ * The tree then takes its node pages from the cache, and gives them back to
+ * it when the tree parses its next message or is destroyed, so a tree
+ * parsing with a warm cache does not allocate pages. Pages are the size of
+ * the cache's pages. Children too large for a page and map indices are
+ * still allocated with the tree's allocator.
+ *
+ * The cache can be shared by any number of trees, but it is not thread-safe:
+ * trees sharing it must not parse or be destroyed concurrently. Use one
+ * cache per thread to share pages between the trees of each thread. The
+ * cache must outlive the trees attached to it.
+ *
+ * This must be called before the first message is parsed.
+ *
+ * @see mpack_page_cache_init()
+ * @note This requires @ref MPACK_MALLOC.
+ */
+void mpack_tree_set_page_cache(mpack_tree_t* tree, mpack_page_cache_t* cache);
+#endif
+
+#if defined(MPACK_MALLOC) && MPACK_NODE_MAP_INDEX
+/**
+ * Sets whether hash indices for large maps are built eagerly when a message
+ * is parsed, rather than lazily on the first lookup in each map.
+ *
+ * Eager indexing makes parsing slower but gives predictable lookup times,
+ * and it means lookups never allocate. It is disabled by default.
+ *
+ * @see MPACK_NODE_MAP_INDEX
+ */
+MPACK_INLINE void mpack_tree_set_eager_map_index(mpack_tree_t* tree, bool eager) {
+    tree->eager_map_index = eager;
+}
+#endif
+
+#if defined(MPACK_MALLOC) && MPACK_NODE_INTERN
+/**
+ * Attaches an intern table to the tree, or detaches it if NULL.
+ *
+ * Every str key of every map in messages parsed by the tree is interned in
+ * the table, and maps remember the ID of each of their keys. Values can then
+ * be looked up with mpack_node_map_key_id(), which compares key IDs rather
+ * than key bytes.
+ *
+ * The table can be shared by any number of trees, and IDs remain valid
+ * across messages, so the IDs of commonly used keys can be interned once up
+ * front with mpack_intern_cstr(). The table is not thread-safe: trees
+ * sharing it must not parse concurrently.
+ *
+ * This takes effect on the next call to mpack_tree_parse() or
+ * mpack_tree_try_parse(). The table must outlive the parsed message.
+ *
+ * @see MPACK_NODE_INTERN
+ */
+MPACK_INLINE void mpack_tree_set_intern(mpack_tree_t* tree, mpack_intern_t* intern) {
+    tree->intern = intern;
+}
+#endif
+
+#if MPACK_NODE_LAZY
+/**
+ * Sets the depth at which maps and arrays are parsed lazily.
+ *
+ * The root node is at depth zero. Maps and arrays at the given depth or
+ * deeper are not parsed into nodes when a message is parsed; they are only
+ * scanned to find their size. The first time a lazy map or array is
+ * descended into (for example with mpack_node_array_at() or
+ * mpack_node_map_cstr()), its contents are parsed down to the same relative
+ * depth. Their types and lengths are available without expanding them.
+ *
+ * This makes parsing much cheaper when only a few values are read from
+ * large messages, since memory and time then depend on the parts of the
+ * message that are accessed. Expanding a lazy node allocates from the tree's
+ * node pages (or pool), so node accessors may flag mpack_error_memory or
+ * mpack_error_too_big on the tree.
+ *
+ * A depth of zero (the default) disables lazy parsing. This takes effect on
+ * the next call to mpack_tree_parse() or mpack_tree_try_parse().
+ *
+ * @see MPACK_NODE_LAZY
+ */
+MPACK_INLINE void mpack_tree_set_lazy_depth(mpack_tree_t* tree, size_t depth) {
+    tree->lazy_depth = depth;
+}
+#endif
+
 /**
  * Parses a MessagePack message into a tree of immutable nodes.
  *
@@ -482,6 +800,51 @@ void mpack_tree_parse(mpack_tree_t* tree);
  */
 bool mpack_tree_try_parse(mpack_tree_t* tree);
 
+#ifdef MPACK_MALLOC
+/**
+ * The result of feeding data to a tree with @ref mpack_tree_feed().
+ */
+typedef enum mpack_tree_feed_status_t {
+    mpack_tree_feed_complete,   /**< A message was parsed and is available under @ref mpack_tree_root(). */
+    mpack_tree_feed_incomplete, /**< All data was consumed without completing a message. */
+    mpack_tree_feed_error,      /**< An error was flagged on the tree. */
+} mpack_tree_feed_status_t;
+
+/**
+ * Passes data to a tree initialized with @ref mpack_tree_init_feed() and
+ * resumes parsing.
+ *
+ * The data continues where the previously fed data left off. If the tree
+ * has no data pending (i.e. the chunk starts a new message), messages that
+ * lie entirely within the chunk are parsed in place without copying it.
+ * Otherwise the chunk is appended to a partial message in the tree's
+ * internal buffer.
+ *
+ * If this returns @ref mpack_tree_feed_complete, a message is available under
+ * @ref mpack_tree_root(). The chunk may contain further messages, so call
+ * this again with no data (a NULL pointer and a length of zero) to parse
+ * them, until it returns @ref mpack_tree_feed_incomplete. The chunk must
+ * remain valid until then since the nodes, and any data following the
+ * message, may still refer to it.
+ *
+ * If this returns @ref mpack_tree_feed_incomplete, the tree has copied any
+ * partial message into its own buffer and the chunk can be reused. Call this
+ * again when more data is available.
+ *
+ * All previous nodes from this tree and their contents (including the root
+ * node) are invalidated whenever this is called.
+ *
+ * There is no way to recover a tree in an error state. It must be destroyed.
+ *
+ * @param tree The tree parser
+ * @param data The data to parse, or NULL if length is zero
+ * @param length The length of the data in bytes
+ *
+ * @see mpack_tree_init_feed()
+ */
+mpack_tree_feed_status_t mpack_tree_feed(mpack_tree_t* tree, const char* data, size_t length);
+#endif
+
 /**
  * Returns the root node of the tree, if the tree is not in an error state.
  * Returns a nil node otherwise.
@@ -512,6 +875,44 @@ MPACK_INLINE size_t mpack_tree_size(mpack_tree_t* tree) {
     return tree->size;
 }
 
+/**
+ * Returns a pointer to the data of the current parsed message.
+ *
+ * The offsets of strings filled by mpack_node_array_columns() are relative
+ * to this pointer.
+ */
+MPACK_INLINE const char* mpack_tree_data(mpack_tree_t* tree) {
+    return tree->data;
+}
+
+#if MPACK_STATS
+/**
+ * Returns the statistics counters of the tree.
+ *
+ * The tree counts calls to its read function, the bytes they return, the
+ * bytes it moves or copies within its buffer, growths of its buffer and
+ * parsing stack, and node and map index pages allocated, as well as the
+ * messages and nodes it has parsed and their deepest nesting of compound
+ * types.
+ *
+ * The counters accumulate over all messages parsed by the tree until they
+ * are reset.
+ *
+ * @note This requires @ref MPACK_STATS.
+ * @see mpack_stats_t
+ */
+MPACK_INLINE const mpack_stats_t* mpack_tree_stats(mpack_tree_t* tree) {
+    return &tree->stats;
+}
+
+/**
+ * Resets the statistics counters of the tree to zero.
+ *
+ * @note This requires @ref MPACK_STATS.
+ */
+void mpack_tree_reset_stats(mpack_tree_t* tree);
+#endif
+
 /**
  * Destroys the tree.
  */
@@ -585,6 +986,469 @@ void mpack_tree_flag_error(mpack_tree_t* tree, mpack_error_t error);
  * @}
  */
 
+/**
+ * @name Tree Views
+ *
+ * Node accessors flag errors on their tree, and may also finish parsing work
+ * on demand (such as expanding lazy nodes or building map indices), so a
+ * tree cannot be read from several threads at once. To share one parsed
+ * message between threads, freeze the tree with mpack_tree_freeze() and give
+ * each thread its own @ref mpack_tree_view_t. A view has its own error state
+ * and error handler but shares the nodes and data of the tree, so it is
+ * cheap to create.
+ *
+ * @code{.c}
+ * // on the parsing thread
+ * mpack_tree_parse(&tree);
+ * if (mpack_tree_freeze(&tree) != mpack_ok)
+ *     return;
+ *
+ * // on each worker thread
+ * mpack_tree_view_t view;
+ * mpack_tree_view_init(&view, &tree);
+ * mpack_node_t root = mpack_tree_view_root(&view);
+ * int port = mpack_node_i32(mpack_node_map_cstr(root, "port"));
+ * if (mpack_tree_view_destroy(&view) != mpack_ok)
+ *     return;
+ * @endcode
+ *
+ * @{
+ */
+
+/**
+ * Prepares a parsed tree to be read concurrently through views.
+ *
+ * This expands all lazy nodes (see mpack_tree_set_lazy_depth()) and builds
+ * the indices of all large maps (see @ref MPACK_NODE_MAP_INDEX), so that
+ * node accessors no longer modify the tree's nodes. Errors are flagged on
+ * the tree as usual, for example if memory runs out.
+ *
+ * The tree must not be accessed directly, parsed again or destroyed while
+ * any of its views are in use. Parsing the next message unfreezes it.
+ *
+ * @return The error state of the tree.
+ */
+mpack_error_t mpack_tree_freeze(mpack_tree_t* tree);
+
+/**
+ * Initializes a view of a tree frozen with mpack_tree_freeze().
+ *
+ * The view starts without an error and without an error handler. Nodes
+ * returned from the view refer to the view, so errors flagged by accessors
+ * are flagged only on the view. The view can be initialized again to clear
+ * its error.
+ */
+void mpack_tree_view_init(mpack_tree_view_t* view, const mpack_tree_t* tree);
+
+/**
+ * Returns the root node of the view's tree, if the view is not in an error
+ * state. Returns a nil node otherwise.
+ */
+MPACK_INLINE mpack_node_t mpack_tree_view_root(mpack_tree_view_t* view) {
+    return mpack_tree_root(&view->tree);
+}
+
+/**
+ * Returns the error state of the view.
+ */
+MPACK_INLINE mpack_error_t mpack_tree_view_error(mpack_tree_view_t* view) {
+    return view->tree.error;
+}
+
+/**
+ * Sets the custom pointer to pass to the view's error handler.
+ *
+ * The handler receives a tree that belongs to the view, so this can be
+ * retrieved with mpack_tree_context().
+ */
+MPACK_INLINE void mpack_tree_view_set_context(mpack_tree_view_t* view, void* context) {
+    view->tree.context = context;
+}
+
+/**
+ * Sets the error function to call when an error is flagged on the view.
+ *
+ * @see mpack_tree_set_error_handler()
+ */
+MPACK_INLINE void mpack_tree_view_set_error_handler(mpack_tree_view_t* view, mpack_tree_error_t error_fn) {
+    view->tree.error_fn = error_fn;
+}
+
+/**
+ * Destroys the view. This does not affect the tree or its other views.
+ *
+ * @return The error state of the view.
+ */
+MPACK_INLINE mpack_error_t mpack_tree_view_destroy(mpack_tree_view_t* view) {
+    return view->tree.error;
+}
+
+/**
+ * @}
+ */
+
+/**
+ * @name Message Index
+ *
+ * A message index records the boundaries of the top-level messages in a
+ * buffer of concatenated messages (such as a log file opened with mmap())
+ * without parsing any nodes. Ranges of the index can then be parsed
+ * independently, each with its own tree. This allows a large buffer of
+ * messages to be split across threads while keeping results in order.
+ *
+ * @{
+ */
+
+/**
+ * Finds the size in bytes of the first complete message in the given data
+ * without parsing it into nodes.
+ *
+ * Only the structure of the message is scanned: lengths of strings, bins and
+ * exts are skipped without being checked, and ext types are accepted even if
+ * @ref MPACK_EXTENSIONS is disabled. A tree will still report errors in the
+ * contents of the message when it is parsed.
+ *
+ * @param data The data to scan.
+ * @param length The length of the data in bytes.
+ * @param size The size in bytes of the first message is placed here on success.
+ *
+ * @return mpack_ok if a complete message was found, mpack_error_eof if the
+ *         data ends before the message is complete, or mpack_error_invalid
+ *         if the message contains an invalid type byte.
+ */
+mpack_error_t mpack_message_size(const char* data, size_t length, size_t* size);
+
+#ifdef MPACK_MALLOC
+
+/**
+ * An index of the top-level messages in a buffer.
+ *
+ * @see mpack_message_index_init()
+ */
+typedef struct mpack_message_index_t {
+    const char* data;
+    size_t* offsets; // count + 1 offsets; the last is the end of the last message
+    size_t count;
+    mpack_error_t error;
+    mpack_allocator_t allocator; // allocator of the offsets and of parsing trees
+} mpack_message_index_t;
+
+/**
+ * A function to be called for each message parsed by
+ * mpack_message_index_parse().
+ *
+ * The tree contains the parsed message, and its root is the message's root
+ * node. The tree and its nodes are only valid until the function returns.
+ * Flag an error on the tree to stop parsing.
+ *
+ * @param tree The tree containing the parsed message.
+ * @param message The number of the message in the index.
+ * @param context The context passed to mpack_message_index_parse().
+ */
+typedef void (*mpack_message_index_parse_t)(mpack_tree_t* tree, size_t message, void* context);
+
+/**
+ * Builds an index of all complete messages in the given data.
+ *
+ * The data must remain valid and unchanged for the lifetime of the index.
+ *
+ * If the data contains an invalid message or ends with an incomplete one,
+ * the index is placed in an error state (mpack_error_invalid or
+ * mpack_error_eof respectively.) The messages before it are still indexed
+ * and can be parsed. The index is placed in mpack_error_memory if it could
+ * not be allocated.
+ *
+ * The index must be destroyed with mpack_message_index_destroy().
+ */
+void mpack_message_index_init(mpack_message_index_t* index, const char* data, size_t length);
+
+/**
+ * Builds an index of all complete messages in the given data, allocating
+ * with the given allocator.
+ *
+ * This is the same as mpack_message_index_init() except that the index is
+ * allocated with @p allocator instead of @ref MPACK_MALLOC. The trees of
+ * mpack_message_index_parse() use it as well.
+ *
+ * @param allocator The allocator to use, or NULL to use @ref MPACK_MALLOC.
+ *     It is copied, so it does not need to outlive the call.
+ */
+void mpack_message_index_init_allocator(mpack_message_index_t* index, const char* data, size_t length,
+        const mpack_allocator_t* allocator);
+
+/**
+ * Destroys the index, returning its error state.
+ */
+mpack_error_t mpack_message_index_destroy(mpack_message_index_t* index);
+
+/**
+ * Returns the error state of the index.
+ */
+MPACK_INLINE mpack_error_t mpack_message_index_error(const mpack_message_index_t* index) {
+    return index->error;
+}
+
+/**
+ * Returns the number of complete messages in the index.
+ */
+MPACK_INLINE size_t mpack_message_index_count(const mpack_message_index_t* index) {
+    return index->count;
+}
+
+/**
+ * Returns a pointer to the message with the given number and places its size
+ * in @p size.
+ *
+ * The message number must be less than mpack_message_index_count().
+ */
+const char* mpack_message_index_message(const mpack_message_index_t* index, size_t message, size_t* size);
+
+/**
+ * Splits the index into @p parts contiguous ranges of messages of roughly
+ * equal size in bytes, placing the range with the given part number in
+ * @p first and @p count.
+ *
+ * The ranges of all parts together cover every message exactly once, in
+ * order. A range may be empty if there are more parts than messages.
+ *
+ * @param index The message index.
+ * @param part The number of the part, less than @p parts.
+ * @param parts The total number of parts.
+ * @param first The number of the first message in the part is placed here.
+ * @param count The number of messages in the part is placed here.
+ */
+void mpack_message_index_partition(const mpack_message_index_t* index, size_t part, size_t parts,
+        size_t* first, size_t* count);
+
+/**
+ * Parses the given range of messages in order with a single tree, calling
+ * the given function with each one.
+ *
+ * The index is not modified and a new tree is used for each call, so
+ * separate ranges can be parsed concurrently from different threads. Since
+ * each message is passed with its number, results can be stored in their
+ * original order regardless of which thread parses them. For example:
+ *
+ * @code{.c}
+ * // on each of N worker threads
+ * size_t first, count;
+ * mpack_message_index_partition(&index, thread, N, &first, &count);
+ * mpack_message_index_parse(&index, first, count, &handle_message, results);
+ * @endcode
+ *
+ * @return The error state of the tree after parsing, or mpack_ok if all
+ *         messages were parsed and handled without errors.
+ */
+mpack_error_t mpack_message_index_parse(const mpack_message_index_t* index, size_t first, size_t count,
+        mpack_message_index_parse_t parse_fn, void* context);
+
+#endif
+
+/**
+ * @}
+ */
+
+#if defined(MPACK_MALLOC) && MPACK_NODE_INTERN
+
+/**
+ * @name Key Interning
+ *
+ * An intern table assigns a small integer ID to each distinct key string.
+ * Attached to trees with mpack_tree_set_intern(), it interns map keys while
+ * messages are parsed so that keys can be matched by ID rather than by
+ * comparing their bytes in every message.
+ *
+ * IDs start at 1 and are assigned in the order keys are first seen. Zero is
+ * never a valid ID.
+ *
+ * @{
+ */
+
+/* Hide internals from documentation */
+/** @cond */
+
+typedef struct mpack_intern_entry_t {
+    size_t offset; // offset of the key in strings
+    uint32_t length;
+    uint32_t hash;
+} mpack_intern_entry_t;
+
+struct mpack_intern_t {
+    char* strings; // the bytes of all keys, back to back
+    size_t strings_used;
+    size_t strings_capacity;
+    mpack_intern_entry_t* entries; // the entry for ID i is entries[i - 1]
+    uint32_t* slots; // open-addressed hash table of IDs, zero if empty
+    uint32_t count;
+    uint32_t mask;
+    uint32_t limit;
+    mpack_error_t error;
+    mpack_allocator_t allocator;
+};
+
+/** @endcond */
+
+/**
+ * Initializes an empty intern table.
+ *
+ * The table grows as keys are interned. It must be destroyed with
+ * mpack_intern_destroy().
+ */
+void mpack_intern_init(mpack_intern_t* intern);
+
+/**
+ * Sets the allocator for memory allocated by the intern table.
+ *
+ * By default the table is allocated with @ref MPACK_MALLOC. It does not use
+ * the allocators of the trees it is attached to since it outlives them.
+ *
+ * This must be called before any key is interned. Otherwise, an assert is
+ * raised and the table is placed in mpack_error_bug.
+ *
+ * @param intern The intern table.
+ * @param allocator The allocator to use, or NULL to use @ref MPACK_MALLOC.
+ *     It is copied, so it does not need to outlive the call.
+ */
+void mpack_intern_set_allocator(mpack_intern_t* intern, const mpack_allocator_t* allocator);
+
+/**
+ * Destroys the intern table, returning its error state.
+ */
+mpack_error_t mpack_intern_destroy(mpack_intern_t* intern);
+
+/**
+ * Returns the error state of the intern table.
+ *
+ * The table is placed in mpack_error_memory if it could not grow. Trees
+ * parsing with it then flag mpack_error_memory as well.
+ */
+MPACK_INLINE mpack_error_t mpack_intern_error(const mpack_intern_t* intern) {
+    return intern->error;
+}
+
+/**
+ * Returns the number of keys in the table. This is also the largest ID.
+ */
+MPACK_INLINE uint32_t mpack_intern_count(const mpack_intern_t* intern) {
+    return intern->count;
+}
+
+/**
+ * Sets the maximum number of keys the table can hold.
+ *
+ * Once the table is full, keys that are not already in it are not added:
+ * they are given ID zero, which never matches any lookup. This bounds the
+ * memory used by the table when parsing untrusted messages with arbitrary
+ * keys. The default is no limit.
+ */
+MPACK_INLINE void mpack_intern_set_limit(mpack_intern_t* intern, uint32_t limit) {
+    intern->limit = limit;
+}
+
+/**
+ * Returns the ID of the given key, adding it to the table if it isn't there.
+ *
+ * Zero is returned if the key is not in the table and could not be added,
+ * either because the table is full or because it is in an error state.
+ */
+uint32_t mpack_intern(mpack_intern_t* intern, const char* str, size_t length);
+
+/**
+ * Returns the ID of the given null-terminated key, adding it to the table if
+ * it isn't there.
+ *
+ * @see mpack_intern()
+ */
+uint32_t mpack_intern_cstr(mpack_intern_t* intern, const char* cstr);
+
+/**
+ * Returns the ID of the given key, or zero if it is not in the table.
+ */
+uint32_t mpack_intern_find(const mpack_intern_t* intern, const char* str, size_t length);
+
+/**
+ * Returns the bytes of the key with the given ID and places its length in
+ * @p length. The ID must be between 1 and mpack_intern_count().
+ */
+const char* mpack_intern_key(const mpack_intern_t* intern, uint32_t id, size_t* length);
+
+/**
+ * @}
+ */
+
+#endif
+
+#ifdef MPACK_MALLOC
+
+/**
+ * @name Page Caches
+ *
+ * A page cache keeps the node pages of destroyed trees for reuse by other
+ * trees. Attached to trees with mpack_tree_set_page_cache(), it removes
+ * the allocation and freeing of node pages from code that creates a tree
+ * for each message, so that once the cache is warm, small messages can be
+ * parsed without calling @ref MPACK_MALLOC.
+ *
+ * Cached pages are allocated with @ref MPACK_MALLOC regardless of the
+ * allocator of the trees using them, since they outlive the trees.
+ *
+ * @{
+ */
+
+/* Hide internals from documentation */
+/** @cond */
+
+struct mpack_page_cache_t {
+    mpack_tree_page_t* pages; // the free pages, linked by their next pointers
+    size_t count;             // the number of free pages
+    size_t max_count;         // the most free pages kept
+    size_t page_nodes;        // the number of nodes in each page
+};
+
+/** @endcond */
+
+/**
+ * Initializes an empty page cache.
+ *
+ * @param cache The page cache.
+ * @param page_size The size of each page in bytes, or zero for @ref
+ *     MPACK_NODE_PAGE_SIZE.
+ * @param max_pages The most free pages to keep. Pages given back while the
+ *     cache is full are freed, which bounds the memory held by the cache.
+ */
+void mpack_page_cache_init(mpack_page_cache_t* cache, size_t page_size, size_t max_pages);
+
+/**
+ * Destroys the page cache, freeing its pages.
+ *
+ * No tree may be attached to the cache when it is destroyed.
+ */
+void mpack_page_cache_destroy(mpack_page_cache_t* cache);
+
+/**
+ * Allocates free pages until the cache holds at least the given number of
+ * pages (or its maximum, if it is lower.)
+ *
+ * This warms up the cache ahead of time so that the first messages do not
+ * allocate pages either.
+ *
+ * @return false if a page could not be allocated.
+ */
+bool mpack_page_cache_reserve(mpack_page_cache_t* cache, size_t count);
+
+/**
+ * Returns the number of free pages in the cache.
+ */
+MPACK_INLINE size_t mpack_page_cache_count(const mpack_page_cache_t* cache) {
+    return cache->count;
+}
+
+/**
+ * @}
+ */
+
+#endif
+
 /**
  * @name Node Core Functions
  * @{
@@ -673,6 +1537,43 @@ MPACK_INLINE void mpack_node_print(mpack_node_t node) {
 
 /** @endcond */
 
+#if MPACK_NODE_SPANS
+/**
+ * Gets the encoded MessagePack bytes of the given node, including the
+ * contents of any map or array.
+ *
+ * The pointer is valid as long as the data backing the tree is valid. This
+ * works on any node of the tree, including lazy maps and arrays that have
+ * not been expanded.
+ *
+ * If the tree is in an error state, false is returned and @a data and
+ * @a length are set to NULL and zero. A missing node from an optional map
+ * lookup has no bytes; @ref mpack_error_type is flagged for it.
+ *
+ * @param node The node whose bytes to get.
+ * @param data The start of the node's bytes in the message data is placed here.
+ * @param length The number of bytes in the node is placed here.
+ *
+ * @see MPACK_NODE_SPANS
+ */
+bool mpack_node_bytes(mpack_node_t node, const char** data, size_t* length);
+
+#if MPACK_WRITER
+/**
+ * Writes the given node and all its contents to the writer without
+ * re-encoding them.
+ *
+ * The node's bytes are copied verbatim with mpack_write_object_bytes(), so
+ * they are tracked as a single element. If the tree is in an error state
+ * (or the node is missing, in which case @ref mpack_error_type is flagged on
+ * the tree), @ref mpack_error_data is flagged on the writer.
+ *
+ * @see mpack_node_bytes()
+ */
+void mpack_write_node(mpack_writer_t* writer, mpack_node_t node);
+#endif
+#endif
+
 /**
  * @}
  */
@@ -1070,7 +1971,8 @@ void mpack_node_copy_utf8_cstr(mpack_node_t node, char* buffer, size_t size);
  * contained by this node.
  *
  * The allocated data must be freed with MPACK_FREE() (or simply free()
- * if MPack's allocator hasn't been customized.)
+ * if MPack's allocator hasn't been customized), or with the tree's
+ * allocator if one was set with mpack_tree_set_allocator().
  *
  * @throws mpack_error_type If this node is not a str, bin or ext type
  * @throws mpack_error_too_big If the size of the data is larger than the
@@ -1089,7 +1991,8 @@ char* mpack_node_data_alloc(mpack_node_t node, size_t maxsize);
  * contained by this node.
  *
  * The allocated string must be freed with MPACK_FREE() (or simply free()
- * if MPack's allocator hasn't been customized.)
+ * if MPack's allocator hasn't been customized), or with the tree's
+ * allocator if one was set with mpack_tree_set_allocator().
  *
  * @throws mpack_error_type If this node is not a string or contains NUL bytes
  * @throws mpack_error_too_big If the size of the string plus null-terminator
@@ -1108,7 +2011,8 @@ char* mpack_node_cstr_alloc(mpack_node_t node, size_t maxsize);
  * string contained by this node.
  *
  * The allocated string must be freed with MPACK_FREE() (or simply free()
- * if MPack's allocator hasn't been customized.)
+ * if MPack's allocator hasn't been customized), or with the tree's
+ * allocator if one was set with mpack_tree_set_allocator().
  *
  * @throws mpack_error_type If this node is not a string, is not valid UTF-8,
  *     or contains NUL bytes
@@ -1206,6 +2110,155 @@ size_t mpack_node_array_length(mpack_node_t node);
  */
 mpack_node_t mpack_node_array_at(mpack_node_t node, size_t index);
 
+/**
+ * Copies the elements of the given array node into the given buffer as
+ * doubles, returning the number of elements. Elements may be of any number
+ * type, as with mpack_node_double().
+ *
+ * This is much faster than calling mpack_node_array_at() and
+ * mpack_node_double() for each element. All elements are checked before
+ * any are written, so the buffer is not modified if an error occurs.
+ *
+ * @throws mpack_error_type If the node is not an array, or if any element
+ *     is not a number.
+ * @throws mpack_error_too_big If the array has more than @p count elements.
+ *
+ * @param node The array node.
+ * @param out The buffer to write elements into.
+ * @param count The maximum number of elements that fit in the buffer.
+ *
+ * @return The number of elements copied, or zero if an error occurs.
+ */
+size_t mpack_node_array_copy_double(mpack_node_t node, double* out, size_t count);
+
+/**
+ * Copies the elements of the given array node into the given buffer as
+ * floats, returning the number of elements. Elements may be of any number
+ * type, as with mpack_node_float().
+ *
+ * @see mpack_node_array_copy_double()
+ */
+size_t mpack_node_array_copy_float(mpack_node_t node, float* out, size_t count);
+
+/**
+ * Copies the elements of the given array node into the given buffer as
+ * int64_t, returning the number of elements. Each element must be an
+ * integer in range, as with mpack_node_i64().
+ *
+ * @see mpack_node_array_copy_double()
+ */
+size_t mpack_node_array_copy_i64(mpack_node_t node, int64_t* out, size_t count);
+
+/**
+ * Copies the elements of the given array node into the given buffer as
+ * int32_t, returning the number of elements. Each element must be an
+ * integer in range, as with mpack_node_i32().
+ *
+ * @see mpack_node_array_copy_double()
+ */
+size_t mpack_node_array_copy_i32(mpack_node_t node, int32_t* out, size_t count);
+
+/**
+ * Copies the elements of the given array node into the given buffer as
+ * uint64_t, returning the number of elements. Each element must be an
+ * integer in range, as with mpack_node_u64().
+ *
+ * @see mpack_node_array_copy_double()
+ */
+size_t mpack_node_array_copy_u64(mpack_node_t node, uint64_t* out, size_t count);
+
+/**
+ * Copies the elements of the given array node into the given buffer as
+ * uint32_t, returning the number of elements. Each element must be an
+ * integer in range, as with mpack_node_u32().
+ *
+ * @see mpack_node_array_copy_double()
+ */
+size_t mpack_node_array_copy_u32(mpack_node_t node, uint32_t* out, size_t count);
+
+/**
+ * The type of a column filled by mpack_node_array_columns().
+ */
+typedef enum mpack_column_type_t {
+    mpack_column_i64,    /**< Integers in range, as with mpack_node_i64(), stored in mpack_column_t::i64. */
+    mpack_column_double, /**< Numbers of any type, as with mpack_node_double(), stored in mpack_column_t::f64. */
+    mpack_column_str,    /**< Strings, stored in mpack_column_t::offsets and mpack_column_t::lengths. */
+} mpack_column_type_t;
+
+/**
+ * A column of values to be extracted from an array of maps by
+ * mpack_node_array_columns().
+ *
+ * Set the key and type, and point the buffers for the type at arrays with
+ * room for a value of each record. The other buffers can be left NULL.
+ */
+typedef struct mpack_column_t {
+    const char* key;          /**< The key of the column in each record, as a null-terminated string. */
+    mpack_column_type_t type; /**< The type of the column. */
+    int64_t* i64;             /**< The values of an i64 column. */
+    double* f64;              /**< The values of a double column. */
+    size_t* offsets;          /**< The offsets of the strings of a str column from mpack_tree_data(). */
+    uint32_t* lengths;        /**< The lengths in bytes of the strings of a str column. */
+
+    /**
+     * A bitmap in which the bit of each record whose value is nil or
+     * missing is set, and the bits of other records are cleared. The bit
+     * of record @c i is <tt>(nulls[i / 8] >> (i % 8)) & 1</tt>. Null values
+     * are stored as zero (and empty strings.)
+     *
+     * If this is NULL, a nil value flags @ref mpack_error_type and a
+     * missing value flags @ref mpack_error_data.
+     */
+    uint8_t* nulls;
+
+    /* Used internally by mpack_node_array_columns() */
+    size_t key_length;
+    size_t slot;
+} mpack_column_t;
+
+/**
+ * Extracts columns of values from an array of maps, returning the number of
+ * records (maps) in the array.
+ *
+ * This is for arrays of records with a common set of keys, for example
+ * <tt>[{"ts": 1, "host": "a", "value": 0.5}, ...]</tt>. It is much faster
+ * than calling mpack_node_map_cstr() on each record for each key. The
+ * position of each key in the first record is remembered and checked
+ * first in the following records, so records with keys in the same order
+ * are never searched. Records with keys in a different order are still
+ * handled correctly, but are slower.
+ *
+ * Unlike the copy functions above, the buffers may be partly filled if an
+ * error occurs.
+ *
+ * @code{.c}
+ * int64_t ts[100];
+ * size_t host_offsets[100];
+ * uint32_t host_lengths[100];
+ * mpack_column_t columns[2] = {
+ *     {"ts", mpack_column_i64, ts},
+ *     {"host", mpack_column_str, NULL, NULL, host_offsets, host_lengths},
+ * };
+ * size_t rows = mpack_node_array_columns(root, columns, 2, 100);
+ * // the host of record i is at mpack_tree_data(&tree) + host_offsets[i]
+ * @endcode
+ *
+ * @throws mpack_error_type If the node is not an array, if any element is
+ *     not a map, or if any value does not match the type of its column.
+ * @throws mpack_error_data If a key is missing from a record of a column
+ *     without a null bitmap, or a record contains a key more than once.
+ *     (Duplicate keys are only detected in records that are searched.)
+ * @throws mpack_error_too_big If the array has more than @p count elements.
+ *
+ * @param node The array node.
+ * @param columns The columns to fill.
+ * @param column_count The number of columns.
+ * @param count The maximum number of records that fit in the column buffers.
+ *
+ * @return The number of records, or zero if an error occurs.
+ */
+size_t mpack_node_array_columns(mpack_node_t node, mpack_column_t* columns, size_t column_count, size_t count);
+
 /**
  * Returns the number of key/value pairs in the given map node. Raises
  * mpack_error_type and returns 0 if the given node is not a map.
@@ -1413,6 +2466,54 @@ bool mpack_node_map_contains_str(mpack_node_t node, const char* str, size_t leng
  */
 bool mpack_node_map_contains_cstr(mpack_node_t node, const char* cstr);
 
+#if defined(MPACK_MALLOC) && MPACK_NODE_INTERN
+/**
+ * Returns the value node in the given map for the given interned key ID.
+ *
+ * The tree must have been parsed with an intern table (see
+ * mpack_tree_set_intern()), and the ID must come from the same table. Keys
+ * are matched by comparing IDs only, so this is much faster than
+ * mpack_node_map_cstr() for maps with many keys.
+ *
+ * The key must exist within the map. Use mpack_node_map_key_id_optional() to
+ * allow the key to be missing.
+ *
+ * @throws mpack_error_type If the node is not a map
+ * @throws mpack_error_data If the node does not contain exactly one entry with the given key
+ * @throws mpack_error_bug If the tree was not parsed with an intern table
+ *
+ * @return The value node for the given key, or a nil node in case of error
+ */
+mpack_node_t mpack_node_map_key_id(mpack_node_t node, uint32_t id);
+
+/**
+ * Returns the value node in the given map for the given interned key ID, or
+ * a missing node if the map does not contain the given key.
+ *
+ * @see mpack_node_map_key_id()
+ *
+ * @throws mpack_error_type If the node is not a map
+ * @throws mpack_error_data If the node contains more than one entry with the given key
+ * @throws mpack_error_bug If the tree was not parsed with an intern table
+ *
+ * @return The value node for the given key, or a missing node if the key does
+ *         not exist, or a nil node in case of error
+ */
+mpack_node_t mpack_node_map_key_id_optional(mpack_node_t node, uint32_t id);
+
+/**
+ * Returns the interned ID of the key in the given map at the given index, or
+ * zero if the key is not a str or could not be interned.
+ *
+ * This can be used to dispatch on keys while iterating over a map.
+ *
+ * @throws mpack_error_type if the node is not a map
+ * @throws mpack_error_data if the given index is out of bounds
+ * @throws mpack_error_bug If the tree was not parsed with an intern table
+ */
+uint32_t mpack_node_map_key_id_at(mpack_node_t node, size_t index);
+#endif
+
 /**
  * @}
  */
@@ -0,0 +1,475 @@
+/*
+ * Copyright (c) 2015-2018 Nicholas Fraser
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#define MPACK_INTERNAL 1
+
+#include "mpack-patch.h"
+
+#if MPACK_PATCH && MPACK_NODE && MPACK_NODE_SPANS && MPACK_WRITER && defined(MPACK_MALLOC)
+
+void mpack_patch_init(mpack_patch_t* patch, mpack_tree_t* tree) {
+    mpack_memset(patch, 0, sizeof(*patch));
+    patch->tree = tree;
+}
+
+mpack_error_t mpack_patch_destroy(mpack_patch_t* patch) {
+    if (patch->edits)
+        mpack_allocator_free(&patch->tree->allocator, patch->edits);
+    if (patch->buffer)
+        mpack_allocator_free(&patch->tree->allocator, patch->buffer);
+    patch->edits = NULL;
+    patch->buffer = NULL;
+    return patch->error;
+}
+
+static void mpack_patch_flag_error(mpack_patch_t* patch, mpack_error_t error) {
+    mpack_log("patch %p setting error %i: %s\n", (void*)patch, (int)error, mpack_error_to_string(error));
+    if (patch->error == mpack_ok)
+        patch->error = error;
+}
+
+// Gets the range of the tree's data spanned by the given node, returning
+// false if the node has no bytes (in which case an error is flagged on the
+// tree.)
+static bool mpack_patch_span(mpack_patch_t* patch, mpack_node_t node, size_t* start, size_t* end) {
+    mpack_assert(node.tree == patch->tree, "node is not from the patched tree!");
+    const char* data;
+    size_t length;
+    if (!mpack_node_bytes(node, &data, &length))
+        return false;
+    *start = (size_t)(data - mpack_tree_data(patch->tree));
+    *end = *start + length;
+    return true;
+}
+
+// Checks that the given data contains exactly one complete element.
+static bool mpack_patch_check_value(mpack_patch_t* patch, const char* data, size_t length) {
+    size_t size = 0;
+    if (length == 0 || mpack_message_size(data, length, &size) != mpack_ok || size != length) {
+        mpack_patch_flag_error(patch, mpack_error_invalid);
+        return false;
+    }
+    return true;
+}
+
+// Encodes the header of a string key of the given length, returning its
+// size, or 0 if the key is too long.
+static size_t mpack_patch_key_header(char* header, size_t key_length) {
+    if (key_length <= 31) {
+        mpack_store_u8(header, (uint8_t)(0xa0 | key_length));
+        return 1;
+    }
+    if (key_length <= UINT8_MAX) {
+        mpack_store_u8(header, 0xd9);
+        mpack_store_u8(header + 1, (uint8_t)key_length);
+        return 2;
+    }
+    if (key_length <= UINT16_MAX) {
+        mpack_store_u8(header, 0xda);
+        mpack_store_u16(header + 1, (uint16_t)key_length);
+        return 3;
+    }
+    if (key_length <= UINT32_MAX) {
+        mpack_store_u8(header, 0xdb);
+        mpack_store_u32(header + 1, (uint32_t)key_length);
+        return 5;
+    }
+    return 0;
+}
+
+// Copies the given data to the end of the patch's buffer, preceded by the
+// given string key if it is not NULL, placing their offset in the buffer in
+// offset and the total length of the encoded key in encoded_key_length.
+static bool mpack_patch_store(mpack_patch_t* patch, const char* key, size_t key_length,
+        const char* data, size_t length, size_t* offset, size_t* encoded_key_length)
+{
+    char header[5];
+    size_t header_length = 0;
+    if (key != NULL) {
+        header_length = mpack_patch_key_header(header, key_length);
+        if (header_length == 0) {
+            mpack_patch_flag_error(patch, mpack_error_too_big);
+            return false;
+        }
+    } else {
+        key_length = 0;
+    }
+
+    size_t count = header_length + key_length + length;
+    if (count > SIZE_MAX - patch->used) {
+        mpack_patch_flag_error(patch, mpack_error_too_big);
+        return false;
+    }
+
+    if (patch->used + count > patch->size) {
+        size_t new_size = (patch->size == 0) ? 64 : patch->size;
+        while (new_size < patch->used + count) {
+            if (new_size > SIZE_MAX / 2) {
+                new_size = patch->used + count;
+                break;
+            }
+            new_size *= 2;
+        }
+
+        char* buffer;
+        if (patch->buffer == NULL)
+            buffer = (char*)mpack_allocator_alloc(&patch->tree->allocator, new_size);
+        else
+            buffer = (char*)mpack_allocator_realloc(&patch->tree->allocator, patch->buffer, patch->used, new_size);
+        if (buffer == NULL) {
+            mpack_patch_flag_error(patch, mpack_error_memory);
+            return false;
+        }
+        patch->buffer = buffer;
+        patch->size = new_size;
+    }
+
+    *offset = patch->used;
+    if (key != NULL) {
+        mpack_memcpy(patch->buffer + patch->used, header, header_length);
+        mpack_memcpy(patch->buffer + patch->used + header_length, key, key_length);
+        patch->used += header_length + key_length;
+    }
+    mpack_memcpy(patch->buffer + patch->used, data, length);
+    patch->used += length;
+
+    if (encoded_key_length)
+        *encoded_key_length = header_length + key_length;
+    return true;
+}
+
+static mpack_patch_edit_t* mpack_patch_find(mpack_patch_t* patch,
+        mpack_patch_edit_type_t type, size_t start, size_t index)
+{
+    for (size_t i = 0; i < patch->count; ++i) {
+        mpack_patch_edit_t* edit = &patch->edits[i];
+        if (edit->type == type && edit->start == start && edit->index == index)
+            return edit;
+    }
+    return NULL;
+}
+
+static mpack_patch_edit_t* mpack_patch_add(mpack_patch_t* patch,
+        mpack_patch_edit_type_t type, size_t start, size_t index)
+{
+    if (patch->count == patch->capacity) {
+        size_t capacity = (patch->capacity == 0) ? 8 : patch->capacity * 2;
+        mpack_patch_edit_t* edits;
+        if (patch->edits == NULL)
+            edits = (mpack_patch_edit_t*)mpack_allocator_alloc(&patch->tree->allocator,
+                    sizeof(mpack_patch_edit_t) * capacity);
+        else
+            edits = (mpack_patch_edit_t*)mpack_allocator_realloc(&patch->tree->allocator, patch->edits,
+                    sizeof(mpack_patch_edit_t) * patch->count, sizeof(mpack_patch_edit_t) * capacity);
+        if (edits == NULL) {
+            mpack_patch_flag_error(patch, mpack_error_memory);
+            return NULL;
+        }
+        patch->edits = edits;
+        patch->capacity = capacity;
+    }
+
+    mpack_patch_edit_t* edit = &patch->edits[patch->count++];
+    mpack_memset(edit, 0, sizeof(*edit));
+    edit->type = type;
+    edit->start = start;
+    edit->index = index;
+    return edit;
+}
+
+// Removes an edit, keeping the others in order.
+static void mpack_patch_drop(mpack_patch_t* patch, mpack_patch_edit_t* edit) {
+    size_t i = (size_t)(edit - patch->edits);
+    --patch->count;
+    if (i < patch->count)
+        mpack_memmove(edit, edit + 1, sizeof(mpack_patch_edit_t) * (patch->count - i));
+}
+
+void mpack_patch_set(mpack_patch_t* patch, mpack_node_t node, const char* data, size_t length) {
+    size_t start, end;
+    if (patch->error != mpack_ok || !mpack_patch_span(patch, node, &start, &end) ||
+            !mpack_patch_check_value(patch, data, length))
+        return;
+
+    size_t offset;
+    if (!mpack_patch_store(patch, NULL, 0, data, length, &offset, NULL))
+        return;
+
+    mpack_patch_edit_t* edit = mpack_patch_find(patch, mpack_patch_edit_set, start, 0);
+    if (edit == NULL)
+        edit = mpack_patch_add(patch, mpack_patch_edit_set, start, 0);
+    if (edit == NULL)
+        return;
+    edit->offset = offset;
+    edit->length = length;
+}
+
+// Finds the index of the pair with the given string key in a map, returning
+// the number of pairs if it is not found.
+static size_t mpack_patch_map_find(mpack_node_t map, const char* key, size_t key_length) {
+    size_t count = mpack_node_map_count(map);
+    for (size_t i = 0; i < count; ++i) {
+        mpack_node_t node = mpack_node_map_key_at(map, i);
+        if (mpack_node_type(node) == mpack_type_str && mpack_node_strlen(node) == key_length &&
+                mpack_memcmp(mpack_node_str(node), key, key_length) == 0)
+            return i;
+    }
+    return count;
+}
+
+// Finds a pair with the given string key inserted into a map by the patch.
+static mpack_patch_edit_t* mpack_patch_map_find_insert(mpack_patch_t* patch, size_t start,
+        const char* key, size_t key_length)
+{
+    char header[5];
+    size_t header_length = mpack_patch_key_header(header, key_length);
+    for (size_t i = 0; i < patch->count; ++i) {
+        mpack_patch_edit_t* edit = &patch->edits[i];
+        if (edit->type == mpack_patch_edit_insert && edit->start == start &&
+                edit->key_length == header_length + key_length &&
+                mpack_memcmp(patch->buffer + edit->offset, header, header_length) == 0 &&
+                mpack_memcmp(patch->buffer + edit->offset + header_length, key, key_length) == 0)
+            return edit;
+    }
+    return NULL;
+}
+
+void mpack_patch_map_set_str(mpack_patch_t* patch, mpack_node_t map,
+        const char* key, size_t key_length, const char* data, size_t length)
+{
+    size_t start, end;
+    if (patch->error != mpack_ok || !mpack_patch_span(patch, map, &start, &end) ||
+            !mpack_patch_check_value(patch, data, length))
+        return;
+    if (mpack_node_type(map) != mpack_type_map) {
+        mpack_node_flag_error(map, mpack_error_type);
+        return;
+    }
+
+    // an existing key gets a new value, and is restored if it was removed
+    size_t count = mpack_node_map_count(map);
+    size_t index = mpack_patch_map_find(map, key, key_length);
+    if (index < count) {
+        mpack_patch_edit_t* removed = mpack_patch_find(patch, mpack_patch_edit_remove, start, index);
+        if (removed != NULL)
+            mpack_patch_drop(patch, removed);
+        mpack_patch_set(patch, mpack_node_map_value_at(map, index), data, length);
+        return;
+    }
+
+    size_t offset, encoded_key_length;
+    if (!mpack_patch_store(patch, key, key_length, data, length, &offset, &encoded_key_length))
+        return;
+
+    mpack_patch_edit_t* edit = mpack_patch_map_find_insert(patch, start, key, key_length);
+    if (edit == NULL)
+        edit = mpack_patch_add(patch, mpack_patch_edit_insert, start, count);
+    if (edit == NULL)
+        return;
+    edit->offset = offset;
+    edit->length = encoded_key_length + length;
+    edit->key_length = encoded_key_length;
+}
+
+void mpack_patch_map_set_cstr(mpack_patch_t* patch, mpack_node_t map,
+        const char* key, const char* data, size_t length)
+{
+    mpack_assert(key != NULL, "key is NULL");
+    mpack_patch_map_set_str(patch, map, key, mpack_strlen(key), data, length);
+}
+
+void mpack_patch_map_remove_str(mpack_patch_t* patch, mpack_node_t map, const char* key, size_t key_length) {
+    size_t start, end;
+    if (patch->error != mpack_ok || !mpack_patch_span(patch, map, &start, &end))
+        return;
+    if (mpack_node_type(map) != mpack_type_map) {
+        mpack_node_flag_error(map, mpack_error_type);
+        return;
+    }
+
+    size_t index = mpack_patch_map_find(map, key, key_length);
+    if (index < mpack_node_map_count(map)) {
+        if (mpack_patch_find(patch, mpack_patch_edit_remove, start, index) == NULL)
+            mpack_patch_add(patch, mpack_patch_edit_remove, start, index);
+        return;
+    }
+
+    mpack_patch_edit_t* inserted = mpack_patch_map_find_insert(patch, start, key, key_length);
+    if (inserted != NULL)
+        mpack_patch_drop(patch, inserted);
+}
+
+void mpack_patch_map_remove_cstr(mpack_patch_t* patch, mpack_node_t map, const char* key) {
+    mpack_assert(key != NULL, "key is NULL");
+    mpack_patch_map_remove_str(patch, map, key, mpack_strlen(key));
+}
+
+void mpack_patch_array_insert(mpack_patch_t* patch, mpack_node_t array, size_t index,
+        const char* data, size_t length)
+{
+    size_t start, end;
+    if (patch->error != mpack_ok || !mpack_patch_span(patch, array, &start, &end) ||
+            !mpack_patch_check_value(patch, data, length))
+        return;
+    if (mpack_node_type(array) != mpack_type_array) {
+        mpack_node_flag_error(array, mpack_error_type);
+        return;
+    }
+    if (index > mpack_node_array_length(array)) {
+        mpack_node_flag_error(array, mpack_error_data);
+        return;
+    }
+
+    size_t offset;
+    if (!mpack_patch_store(patch, NULL, 0, data, length, &offset, NULL))
+        return;
+    mpack_patch_edit_t* edit = mpack_patch_add(patch, mpack_patch_edit_insert, start, index);
+    if (edit == NULL)
+        return;
+    edit->offset = offset;
+    edit->length = length;
+}
+
+void mpack_patch_array_remove(mpack_patch_t* patch, mpack_node_t array, size_t index) {
+    size_t start, end;
+    if (patch->error != mpack_ok || !mpack_patch_span(patch, array, &start, &end))
+        return;
+    if (mpack_node_type(array) != mpack_type_array) {
+        mpack_node_flag_error(array, mpack_error_type);
+        return;
+    }
+    if (index >= mpack_node_array_length(array)) {
+        mpack_node_flag_error(array, mpack_error_data);
+        return;
+    }
+
+    if (mpack_patch_find(patch, mpack_patch_edit_remove, start, index) == NULL)
+        mpack_patch_add(patch, mpack_patch_edit_remove, start, index);
+}
+
+// Returns true if any edit applies to the node spanning the given range or
+// to a node within it.
+static bool mpack_patch_contains(mpack_patch_t* patch, size_t start, size_t end) {
+    for (size_t i = 0; i < patch->count; ++i)
+        if (patch->edits[i].start >= start && patch->edits[i].start < end)
+            return true;
+    return false;
+}
+
+// Writes the elements or pairs inserted into the container at the given
+// offset before the given index.
+static void mpack_patch_write_inserts(mpack_patch_t* patch, mpack_writer_t* writer,
+        size_t start, size_t index)
+{
+    for (size_t i = 0; i < patch->count; ++i) {
+        const mpack_patch_edit_t* edit = &patch->edits[i];
+        if (edit->type != mpack_patch_edit_insert || edit->start != start || edit->index != index)
+            continue;
+        const char* data = patch->buffer + edit->offset;
+        if (edit->key_length > 0)
+            mpack_write_object_bytes(writer, data, edit->key_length);
+        mpack_write_object_bytes(writer, data + edit->key_length, edit->length - edit->key_length);
+    }
+}
+
+static void mpack_patch_write_node(mpack_patch_t* patch, mpack_writer_t* writer,
+        mpack_node_t node, size_t depth)
+{
+    if (mpack_writer_error(writer) != mpack_ok)
+        return;
+
+    size_t start, end;
+    if (!mpack_patch_span(patch, node, &start, &end)) {
+        mpack_writer_flag_error(writer, mpack_error_data);
+        return;
+    }
+
+    const mpack_patch_edit_t* replaced = mpack_patch_find(patch, mpack_patch_edit_set, start, 0);
+    if (replaced != NULL) {
+        mpack_write_object_bytes(writer, patch->buffer + replaced->offset, replaced->length);
+        return;
+    }
+
+    // unchanged subtrees are copied verbatim
+    if (!mpack_patch_contains(patch, start, end)) {
+        mpack_write_object_bytes(writer, mpack_tree_data(patch->tree) + start, end - start);
+        return;
+    }
+
+    if (depth == MPACK_PATCH_MAX_DEPTH) {
+        mpack_writer_flag_error(writer, mpack_error_too_big);
+        return;
+    }
+
+    // only maps and arrays can contain edits of other nodes
+    mpack_type_t type = mpack_node_type(node);
+    mpack_assert(type == mpack_type_map || type == mpack_type_array,
+            "edit inside a node of type %i", (int)type);
+    bool is_map = (type == mpack_type_map);
+    size_t length = is_map ? mpack_node_map_count(node) : mpack_node_array_length(node);
+
+    size_t count = length;
+    for (size_t i = 0; i < patch->count; ++i) {
+        const mpack_patch_edit_t* edit = &patch->edits[i];
+        if (edit->start != start)
+            continue;
+        if (edit->type == mpack_patch_edit_insert)
+            ++count;
+        else if (edit->type == mpack_patch_edit_remove)
+            --count;
+    }
+    if (count > UINT32_MAX) {
+        mpack_writer_flag_error(writer, mpack_error_too_big);
+        return;
+    }
+
+    if (is_map) {
+        mpack_start_map(writer, (uint32_t)count);
+        for (size_t i = 0; i < length; ++i) {
+            if (mpack_patch_find(patch, mpack_patch_edit_remove, start, i) != NULL)
+                continue;
+            mpack_patch_write_node(patch, writer, mpack_node_map_key_at(node, i), depth + 1);
+            mpack_patch_write_node(patch, writer, mpack_node_map_value_at(node, i), depth + 1);
+        }
+        mpack_patch_write_inserts(patch, writer, start, length);
+        mpack_finish_map(writer);
+        return;
+    }
+
+    mpack_start_array(writer, (uint32_t)count);
+    for (size_t i = 0; i < length; ++i) {
+        mpack_patch_write_inserts(patch, writer, start, i);
+        if (mpack_patch_find(patch, mpack_patch_edit_remove, start, i) == NULL)
+            mpack_patch_write_node(patch, writer, mpack_node_array_at(node, i), depth + 1);
+    }
+    mpack_patch_write_inserts(patch, writer, start, length);
+    mpack_finish_array(writer);
+}
+
+void mpack_patch_write(mpack_patch_t* patch, mpack_writer_t* writer) {
+    if (patch->error != mpack_ok) {
+        mpack_writer_flag_error(writer, patch->error);
+        return;
+    }
+    mpack_patch_write_node(patch, writer, mpack_tree_root(patch->tree), 0);
+}
+
+#endif
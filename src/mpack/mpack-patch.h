@@ -0,0 +1,247 @@
+/*
+ * Copyright (c) 2015-2018 Nicholas Fraser
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * @file
+ *
+ * Declares the MPack tree patches.
+ */
+
+#ifndef MPACK_PATCH_H
+#define MPACK_PATCH_H 1
+
+#include "mpack-node.h"
+
+MPACK_HEADER_START
+MPACK_EXTERN_C_START
+
+#if MPACK_PATCH && MPACK_NODE && MPACK_NODE_SPANS && MPACK_WRITER && defined(MPACK_MALLOC)
+
+/**
+ * @defgroup patch Tree Patches
+ *
+ * A patch records edits to a parsed @ref mpack_tree_t and writes the edited
+ * message to an @ref mpack_writer_t. The tree itself is not modified.
+ *
+ * Edits are stored sparsely, keyed by the nodes they change. When the patch
+ * is written, nodes that do not contain an edit are copied verbatim from the
+ * tree's data (see mpack_write_node()), and only the maps and arrays that
+ * contain an edit are re-encoded. The cost of writing a patch therefore
+ * depends on the size of the edited containers and the depth of the edits,
+ * not on the size of the message.
+ *
+ * New values are given as encoded MessagePack bytes, each containing exactly
+ * one complete element (which may be a map or array.) They can be written
+ * with an @ref mpack_writer_t into a buffer, or be a pre-encoded @ref
+ * mpack_token_t. The bytes are copied into the patch.
+ *
+ * @code{.c}
+ * mpack_patch_t patch;
+ * mpack_patch_init(&patch, &tree);
+ * mpack_node_t root = mpack_tree_root(&tree);
+ * mpack_patch_map_set_cstr(&patch, root, "status", "\xa4""done", 5);
+ * mpack_patch_map_remove_cstr(&patch, root, "lease");
+ * mpack_patch_array_insert(&patch, mpack_node_map_cstr(root, "log"), 0, "\x07", 1);
+ * mpack_patch_write(&patch, &writer);
+ * mpack_patch_destroy(&patch);
+ * @endcode
+ *
+ * Edits refer to the nodes of the original message, so indices passed to
+ * mpack_patch_array_insert() and mpack_patch_array_remove() are indices in
+ * the original array regardless of other edits to it. Edits inside a node
+ * replaced by mpack_patch_set() are ignored.
+ *
+ * Patches require @ref MPACK_NODE_SPANS.
+ *
+ * @{
+ */
+
+/** @cond */
+
+typedef enum mpack_patch_edit_type_t {
+    mpack_patch_edit_set,    /* replace a node */
+    mpack_patch_edit_insert, /* insert an element or pair into a container */
+    mpack_patch_edit_remove, /* remove an element or pair from a container */
+} mpack_patch_edit_type_t;
+
+typedef struct mpack_patch_edit_t {
+    size_t start;      /* The offset in the tree's data of the replaced node or edited container */
+    size_t index;      /* The element or pair index of an insert or remove */
+    size_t offset;     /* The offset of the new bytes in the patch's buffer */
+    size_t length;     /* The length of the new bytes */
+    size_t key_length; /* The length of the encoded key at the start of the bytes of an inserted pair */
+    mpack_patch_edit_type_t type;
+} mpack_patch_edit_t;
+
+typedef struct mpack_patch_t {
+    mpack_tree_t* tree;
+    mpack_error_t error;
+
+    mpack_patch_edit_t* edits; /* The edits in the order they were made */
+    size_t count;
+    size_t capacity;
+
+    char* buffer; /* The new bytes of all edits */
+    size_t used;
+    size_t size;
+} mpack_patch_t;
+
+/** @endcond */
+
+/**
+ * Initializes an empty patch of the given tree.
+ *
+ * The tree must have been parsed, and it and its data must remain valid
+ * (and must not parse another message) for as long as the patch is used.
+ *
+ * The patch's edits and new bytes are allocated with the tree's allocator
+ * (see mpack_tree_set_allocator().)
+ */
+void mpack_patch_init(mpack_patch_t* patch, mpack_tree_t* tree);
+
+/**
+ * Destroys a patch, freeing its edits.
+ *
+ * @return The error state of the patch.
+ */
+mpack_error_t mpack_patch_destroy(mpack_patch_t* patch);
+
+/**
+ * Returns the error state of the patch.
+ *
+ * An invalid edit flags an error on the patch and is not recorded. Errors
+ * of the tree (for example from looking up a node) are flagged on the tree
+ * as usual and cause the edit to be ignored.
+ */
+MPACK_INLINE mpack_error_t mpack_patch_error(const mpack_patch_t* patch) {
+    return patch->error;
+}
+
+/**
+ * Returns the number of edits recorded in the patch.
+ */
+MPACK_INLINE size_t mpack_patch_count(const mpack_patch_t* patch) {
+    return patch->count;
+}
+
+/**
+ * Replaces the given node and all its contents with the given encoded
+ * element.
+ *
+ * The node can be any node of the tree, including the root, a map key or a
+ * map value. Setting the same node again replaces the previous value.
+ *
+ * If the data does not contain exactly one complete element, @ref
+ * mpack_error_invalid is flagged on the patch.
+ */
+void mpack_patch_set(mpack_patch_t* patch, mpack_node_t node, const char* data, size_t length);
+
+/**
+ * Sets the value of the given string key in a map to the given encoded
+ * element.
+ *
+ * If the map contains the key, its value is replaced. Otherwise a new pair
+ * is added at the end of the map. If the key was removed from the map by the
+ * patch, it is restored with the new value.
+ *
+ * If the node is not a map, @ref mpack_error_type is flagged on the tree.
+ * If the data does not contain exactly one complete element, @ref
+ * mpack_error_invalid is flagged on the patch.
+ */
+void mpack_patch_map_set_str(mpack_patch_t* patch, mpack_node_t map,
+        const char* key, size_t key_length, const char* data, size_t length);
+
+/**
+ * Sets the value of the given null-terminated string key in a map to the
+ * given encoded element.
+ *
+ * @see mpack_patch_map_set_str()
+ */
+void mpack_patch_map_set_cstr(mpack_patch_t* patch, mpack_node_t map,
+        const char* key, const char* data, size_t length);
+
+/**
+ * Removes the pair with the given string key from a map.
+ *
+ * If neither the map nor the patch's additions to it contain the key, this
+ * does nothing. If the node is not a map, @ref mpack_error_type is flagged
+ * on the tree.
+ */
+void mpack_patch_map_remove_str(mpack_patch_t* patch, mpack_node_t map, const char* key, size_t key_length);
+
+/**
+ * Removes the pair with the given null-terminated string key from a map.
+ *
+ * @see mpack_patch_map_remove_str()
+ */
+void mpack_patch_map_remove_cstr(mpack_patch_t* patch, mpack_node_t map, const char* key);
+
+/**
+ * Inserts the given encoded element into an array before the element at the
+ * given index of the original array.
+ *
+ * The index may be equal to the length of the array to append the element.
+ * Several elements inserted at the same index are written in the order in
+ * which they were inserted.
+ *
+ * If the node is not an array, @ref mpack_error_type is flagged on the tree.
+ * If the index is past the end of the array, @ref mpack_error_data is flagged
+ * on the tree. If the data does not contain exactly one complete element,
+ * @ref mpack_error_invalid is flagged on the patch.
+ */
+void mpack_patch_array_insert(mpack_patch_t* patch, mpack_node_t array, size_t index,
+        const char* data, size_t length);
+
+/**
+ * Removes the element at the given index of the original array.
+ *
+ * Removing an element again does nothing. If the node is not an array, @ref
+ * mpack_error_type is flagged on the tree. If the index is out of bounds,
+ * @ref mpack_error_data is flagged on the tree.
+ */
+void mpack_patch_array_remove(mpack_patch_t* patch, mpack_node_t array, size_t index);
+
+/**
+ * Writes the tree's message with all edits of the patch applied to the
+ * writer as a single element.
+ *
+ * Nodes that do not contain an edit are copied verbatim. If the patch is in
+ * an error state, its error is flagged on the writer. If the tree is in an
+ * error state, @ref mpack_error_data is flagged as by mpack_write_node(). If an
+ * edited container would have more than UINT32_MAX elements or pairs, or an
+ * edit is nested more than @ref MPACK_PATCH_MAX_DEPTH maps and arrays deep,
+ * @ref mpack_error_too_big is flagged on the writer.
+ *
+ * The patch is not modified, so it can be written any number of times.
+ */
+void mpack_patch_write(mpack_patch_t* patch, mpack_writer_t* writer);
+
+/**
+ * @}
+ */
+
+#endif
+
+MPACK_EXTERN_C_END
+MPACK_HEADER_END
+
+#endif
+
@@ -503,6 +503,51 @@ MPACK_EXTERN_C_START
 
 
 
+/*
+ * SIMD
+ *
+ * MPack uses SSE2 or NEON when available to accelerate UTF-8 validation.
+ * These are detected at compile time from the target architecture (SSE2 is
+ * always available on x86-64, as is NEON on AArch64.) Define MPACK_SIMD to
+ * 0 to always use the portable implementation.
+ */
+
+#ifndef MPACK_SIMD
+    #if MPACK_NO_BUILTINS || MPACK_OPTIMIZE_FOR_SIZE
+        #define MPACK_SIMD 0
+    #else
+        #define MPACK_SIMD 1
+    #endif
+#endif
+
+#ifndef MPACK_SSE2
+    #if MPACK_SIMD && (defined(__SSE2__) || defined(_M_X64) || \
+            (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+        #define MPACK_SSE2 1
+    #else
+        #define MPACK_SSE2 0
+    #endif
+#endif
+
+#ifndef MPACK_NEON
+    #if MPACK_SIMD && !MPACK_SSE2 && defined(__ARM_NEON) && \
+            (defined(__aarch64__) || defined(_M_ARM64))
+        #define MPACK_NEON 1
+    #else
+        #define MPACK_NEON 0
+    #endif
+#endif
+
+#if MPACK_INTERNAL
+    #if MPACK_SSE2
+        #include <emmintrin.h>
+    #elif MPACK_NEON
+        #include <arm_neon.h>
+    #endif
+#endif
+
+
+
 /*
  * Finite Math
  *
@@ -837,10 +882,19 @@ size_t mpack_strlen(const char* s);
 #if MPACK_WRITE_TRACKING && !defined(MPACK_WRITER)
     #error "MPACK_WRITE_TRACKING requires MPACK_WRITER."
 #endif
+#if MPACK_NODE_COMPACT && MPACK_NODE_MAP_INDEX
+    #error "MPACK_NODE_MAP_INDEX is not supported with MPACK_NODE_COMPACT."
+#endif
 #ifndef MPACK_MALLOC
     #if MPACK_STDIO
         #error "MPACK_STDIO requires preprocessor definitions for MPACK_MALLOC and MPACK_FREE."
     #endif
+    #if MPACK_FD
+        #error "MPACK_FD requires preprocessor definitions for MPACK_MALLOC and MPACK_FREE."
+    #endif
+    #if MPACK_BUILDER && !MPACK_BUILDER_INTERNAL_STORAGE
+        #error "MPACK_BUILDER requires MPACK_MALLOC and MPACK_FREE or MPACK_BUILDER_INTERNAL_STORAGE."
+    #endif
     #if MPACK_READ_TRACKING
         #error "MPACK_READ_TRACKING requires preprocessor definitions for MPACK_MALLOC and MPACK_FREE."
     #endif
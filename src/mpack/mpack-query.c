@@ -0,0 +1,244 @@
+/*
+ * Copyright (c) 2015-2018 Nicholas Fraser
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#define MPACK_INTERNAL 1
+
+#include "mpack-query.h"
+
+#if MPACK_QUERY && MPACK_READER
+
+void mpack_query_init(mpack_query_t* query) {
+    mpack_memset(query, 0, sizeof(*query));
+}
+
+static void mpack_query_flag_error(mpack_query_t* query, mpack_error_t error) {
+    mpack_log("query %p setting error %i: %s\n", (void*)query, (int)error, mpack_error_to_string(error));
+    if (query->error == mpack_ok)
+        query->error = error;
+}
+
+// Parses the next step of a path into the given step, returning a pointer
+// past it or NULL if the step is malformed.
+static const char* mpack_query_parse_step(const char* p, bool first, mpack_query_step_t* step) {
+    if (*p == '[') {
+        ++p;
+        if (*p == '*') {
+            ++p;
+            step->type = mpack_query_step_any_index;
+        } else {
+            if (*p < '0' || *p > '9')
+                return NULL;
+            uint64_t index = 0;
+            while (*p >= '0' && *p <= '9') {
+                index = index * 10 + (uint64_t)(*p++ - '0');
+                if (index > UINT32_MAX)
+                    return NULL;
+            }
+            step->type = mpack_query_step_index;
+            step->value = (uint32_t)index;
+        }
+        return (*p == ']') ? p + 1 : NULL;
+    }
+
+    if (!first) {
+        if (*p != '.')
+            return NULL;
+        ++p;
+    }
+
+    const char* key = p;
+    while (*p != '\0' && *p != '.' && *p != '[')
+        ++p;
+    size_t length = (size_t)(p - key);
+    if (length == 0 || length > UINT32_MAX)
+        return NULL;
+
+    if (length == 1 && *key == '*') {
+        step->type = mpack_query_step_any_key;
+    } else {
+        step->type = mpack_query_step_key;
+        step->key = key;
+        step->value = (uint32_t)length;
+    }
+    return p;
+}
+
+size_t mpack_query_compile(mpack_query_t* query, const char* path) {
+    mpack_assert(path != NULL, "path is NULL");
+    if (query->error != mpack_ok)
+        return MPACK_QUERY_MAX_PATHS;
+    if (query->path_count == MPACK_QUERY_MAX_PATHS) {
+        mpack_query_flag_error(query, mpack_error_too_big);
+        return MPACK_QUERY_MAX_PATHS;
+    }
+
+    size_t count = query->step_count;
+    const char* p = path;
+    while (*p != '\0') {
+        if (count == MPACK_QUERY_MAX_STEPS) {
+            mpack_query_flag_error(query, mpack_error_too_big);
+            return MPACK_QUERY_MAX_PATHS;
+        }
+        mpack_query_step_t* step = &query->steps[count];
+        mpack_memset(step, 0, sizeof(*step));
+        p = mpack_query_parse_step(p, p == path, step);
+        if (p == NULL) {
+            mpack_query_flag_error(query, mpack_error_invalid);
+            return MPACK_QUERY_MAX_PATHS;
+        }
+        ++count;
+    }
+
+    query->step_count = count;
+    query->path_start[++query->path_count] = count;
+    return query->path_count - 1;
+}
+
+MPACK_STATIC_INLINE size_t mpack_query_path_length(mpack_query_t* query, size_t path) {
+    return query->path_start[path + 1] - query->path_start[path];
+}
+
+MPACK_STATIC_INLINE mpack_query_step_t* mpack_query_step(mpack_query_t* query, size_t path, size_t depth) {
+    return &query->steps[query->path_start[path] + depth];
+}
+
+static void mpack_query_deliver(mpack_query_t* query, mpack_reader_t* reader, size_t path) {
+    ++query->counts[path];
+    if (query->match) {
+        query->match(query, reader, path);
+        return;
+    }
+    query->tags[path] = mpack_peek_tag(reader);
+    mpack_discard(reader);
+}
+
+// Reads a map key, returning the paths in the given set whose step at the
+// given depth matches it. Keys are compared in chunks so that they need not
+// fit in the reader's buffer.
+static uint32_t mpack_query_key(mpack_query_t* query, mpack_reader_t* reader, size_t depth, uint32_t paths) {
+    uint32_t any = 0;
+    uint32_t keyed = 0;
+    for (size_t i = 0; i < query->path_count; ++i) {
+        if ((paths & (UINT32_C(1) << i)) == 0)
+            continue;
+        mpack_query_step_type_t type = mpack_query_step(query, i, depth)->type;
+        if (type == mpack_query_step_any_key)
+            any |= UINT32_C(1) << i;
+        else if (type == mpack_query_step_key)
+            keyed |= UINT32_C(1) << i;
+    }
+
+    if (keyed != 0) {
+        mpack_tag_t tag = mpack_peek_tag(reader);
+        if (tag.type != mpack_type_str)
+            keyed = 0;
+    }
+    if (keyed == 0) {
+        mpack_discard(reader);
+        return any;
+    }
+
+    mpack_tag_t tag = mpack_read_tag(reader);
+    uint32_t length = mpack_tag_str_length(&tag);
+    for (size_t i = 0; i < query->path_count; ++i)
+        if ((keyed & (UINT32_C(1) << i)) && mpack_query_step(query, i, depth)->value != length)
+            keyed &= ~(UINT32_C(1) << i);
+
+    size_t offset = 0;
+    while (keyed != 0 && offset < length) {
+        size_t chunk = length - offset;
+        if (reader->size != 0 && chunk > reader->size)
+            chunk = reader->size;
+        const char* data = mpack_read_bytes_inplace(reader, chunk);
+        if (mpack_reader_error(reader) != mpack_ok)
+            return 0;
+        for (size_t i = 0; i < query->path_count; ++i)
+            if ((keyed & (UINT32_C(1) << i)) && mpack_memcmp(mpack_query_step(query, i, depth)->key + offset, data, chunk) != 0)
+                keyed &= ~(UINT32_C(1) << i);
+        offset += chunk;
+    }
+    mpack_skip_bytes(reader, length - offset);
+    mpack_done_str(reader);
+    return any | keyed;
+}
+
+// Returns the paths in the given set whose step at the given depth matches
+// the given array index.
+static uint32_t mpack_query_index(mpack_query_t* query, size_t depth, uint32_t paths, uint32_t index) {
+    uint32_t matches = 0;
+    for (size_t i = 0; i < query->path_count; ++i) {
+        if ((paths & (UINT32_C(1) << i)) == 0)
+            continue;
+        mpack_query_step_t* step = mpack_query_step(query, i, depth);
+        if (step->type == mpack_query_step_any_index ||
+                (step->type == mpack_query_step_index && step->value == index))
+            matches |= UINT32_C(1) << i;
+    }
+    return matches;
+}
+
+// Reads one element whose position matches the first depth steps of the
+// given paths. We only recurse while some path has steps left, so the depth
+// is bounded by the longest path.
+static void mpack_query_element(mpack_query_t* query, mpack_reader_t* reader, size_t depth, uint32_t paths) {
+    for (size_t i = 0; i < query->path_count; ++i) {
+        if ((paths & (UINT32_C(1) << i)) && mpack_query_path_length(query, i) == depth) {
+            mpack_query_deliver(query, reader, i);
+            return;
+        }
+    }
+
+    mpack_tag_t tag = MPACK_TAG_ZERO;
+    if (paths != 0)
+        tag = mpack_peek_tag(reader);
+    if (tag.type != mpack_type_array && tag.type != mpack_type_map) {
+        mpack_discard(reader);
+        return;
+    }
+
+    mpack_read_tag(reader);
+    for (uint32_t i = 0; i < tag.v.n; ++i) {
+        uint32_t children = (tag.type == mpack_type_map) ?
+                mpack_query_key(query, reader, depth, paths) :
+                mpack_query_index(query, depth, paths, i);
+        mpack_query_element(query, reader, depth + 1, children);
+        if (mpack_reader_error(reader) != mpack_ok)
+            return;
+    }
+    mpack_done_type(reader, tag.type);
+}
+
+mpack_error_t mpack_query_run(mpack_query_t* query, mpack_reader_t* reader) {
+    if (query->error != mpack_ok)
+        mpack_reader_flag_error(reader, query->error);
+    if (mpack_reader_error(reader) != mpack_ok)
+        return mpack_reader_error(reader);
+
+    mpack_memset(query->counts, 0, sizeof(query->counts));
+    mpack_memset(query->tags, 0, sizeof(query->tags));
+
+    uint32_t paths = (query->path_count == 32) ? UINT32_MAX :
+            (UINT32_C(1) << query->path_count) - 1;
+    mpack_query_element(query, reader, 0, paths);
+    return mpack_reader_error(reader);
+}
+
+#endif
@@ -0,0 +1,230 @@
+/*
+ * Copyright (c) 2015-2018 Nicholas Fraser
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * @file
+ *
+ * Declares the MPack path query engine.
+ */
+
+#ifndef MPACK_QUERY_H
+#define MPACK_QUERY_H 1
+
+#include "mpack-reader.h"
+
+MPACK_HEADER_START
+MPACK_EXTERN_C_START
+
+#if MPACK_QUERY && MPACK_READER
+
+/**
+ * @defgroup query Path Queries
+ *
+ * A path query extracts a few values from a message in a single pass over
+ * an @ref mpack_reader_t, without building a tree. Subtrees that cannot
+ * contain a match are skipped with mpack_discard(), so the cost of a query
+ * is mostly that of scanning past the parts of the message that are not
+ * wanted.
+ *
+ * Paths are compiled with mpack_query_compile(). Each path is a sequence of
+ * steps:
+ *
+ * - @c key or @c .key matches the value of a map's string key;
+ * - @c * or @c .* matches the values of all keys of a map;
+ * - @c [3] matches an element of an array by index;
+ * - @c [*] matches all elements of an array.
+ *
+ * For example @c "meta.tenant", @c "items[*].price" or @c "[0].id". An empty
+ * path matches the whole message. Keys cannot contain @c . or @c [.
+ *
+ * Each matched element is passed to the match function (see
+ * mpack_query_set_match()), which must read or discard exactly one element.
+ * Without a match function, the tag of the last element matched by each
+ * path is recorded instead, and can be retrieved with mpack_query_tag().
+ *
+ * @code{.c}
+ * mpack_query_t query;
+ * mpack_query_init(&query);
+ * size_t tenant = mpack_query_compile(&query, "meta.tenant");
+ * size_t id = mpack_query_compile(&query, "trace.id");
+ *
+ * mpack_reader_t reader;
+ * mpack_reader_init_data(&reader, data, size);
+ * if (mpack_query_run(&query, &reader) != mpack_ok)
+ *     return;
+ * if (mpack_query_count(&query, id) > 0)
+ *     handle_id(mpack_tag_uint_value(mpack_query_tag(&query, id)));
+ * @endcode
+ *
+ * @{
+ */
+
+/**
+ * The maximum number of paths in a path query.
+ */
+#define MPACK_QUERY_MAX_PATHS 32
+
+/**
+ * A compiled path query. See @ref query.
+ */
+typedef struct mpack_query_t mpack_query_t;
+
+/**
+ * A function to receive an element matched by a path query.
+ *
+ * The reader is positioned at the matched element. The function must read
+ * exactly one complete element from it (for example with the Expect API or
+ * mpack_discard()), or flag an error on the reader.
+ *
+ * @param query The query.
+ * @param reader The reader, positioned at the matched element.
+ * @param path The index of the matching path, as returned by
+ *        mpack_query_compile().
+ */
+typedef void (*mpack_query_match_t)(mpack_query_t* query, mpack_reader_t* reader, size_t path);
+
+/** @cond */
+
+typedef enum mpack_query_step_type_t {
+    mpack_query_step_key,       /* a string key */
+    mpack_query_step_any_key,   /* any key */
+    mpack_query_step_index,     /* an array index */
+    mpack_query_step_any_index, /* any array index */
+} mpack_query_step_type_t;
+
+typedef struct mpack_query_step_t {
+    const char* key;              /* the key, pointing into the path */
+    uint32_t value;               /* the length of the key, or the array index */
+    mpack_query_step_type_t type;
+} mpack_query_step_t;
+
+struct mpack_query_t {
+    mpack_query_match_t match; /* Function to call with matched elements */
+    void* context;             /* Context for the match function */
+    mpack_error_t error;       /* Error state */
+
+    size_t path_count;
+    size_t step_count;
+    size_t path_start[MPACK_QUERY_MAX_PATHS + 1]; /* path i has the steps from path_start[i] to path_start[i + 1] */
+    mpack_query_step_t steps[MPACK_QUERY_MAX_STEPS];
+
+    size_t counts[MPACK_QUERY_MAX_PATHS]; /* matches of each path in the last run */
+    mpack_tag_t tags[MPACK_QUERY_MAX_PATHS]; /* the last tag matched by each path */
+};
+
+/** @endcond */
+
+/**
+ * Initializes an empty path query.
+ */
+void mpack_query_init(mpack_query_t* query);
+
+/**
+ * Compiles a path and adds it to the query.
+ *
+ * The path string is not copied; it must remain valid for as long as the
+ * query is used.
+ *
+ * If the path is malformed, @ref mpack_error_invalid is flagged on the
+ * query. If the query already has @ref MPACK_QUERY_MAX_PATHS paths or the
+ * path would exceed @ref MPACK_QUERY_MAX_STEPS steps, @ref
+ * mpack_error_too_big is flagged. The path is not added in either case.
+ *
+ * @return The index of the path, which is passed to the match function, or
+ *         @ref MPACK_QUERY_MAX_PATHS if an error is flagged.
+ */
+size_t mpack_query_compile(mpack_query_t* query, const char* path);
+
+/**
+ * Sets the function to call with each element matched by the query.
+ *
+ * @see mpack_query_match_t
+ */
+MPACK_INLINE void mpack_query_set_match(mpack_query_t* query, mpack_query_match_t match) {
+    query->match = match;
+}
+
+/**
+ * Sets the custom pointer to pass to the match function.
+ */
+MPACK_INLINE void mpack_query_set_context(mpack_query_t* query, void* context) {
+    query->context = context;
+}
+
+/**
+ * Returns the custom pointer passed to the match function.
+ */
+MPACK_INLINE void* mpack_query_context(mpack_query_t* query) {
+    return query->context;
+}
+
+/**
+ * Returns the error state of the query.
+ */
+MPACK_INLINE mpack_error_t mpack_query_error(mpack_query_t* query) {
+    return query->error;
+}
+
+/**
+ * Reads one complete element from the reader, passing the elements that
+ * match the query's paths to the match function.
+ *
+ * An element matched by a path is not searched for matches of other paths.
+ * If it matches several paths, only the first of them (in the order they
+ * were compiled) is counted.
+ *
+ * If the query is in an error state, its error is flagged on the reader.
+ *
+ * @return The error state of the reader.
+ */
+mpack_error_t mpack_query_run(mpack_query_t* query, mpack_reader_t* reader);
+
+/**
+ * Returns the number of elements matched by the given path in the last run.
+ */
+MPACK_INLINE size_t mpack_query_count(mpack_query_t* query, size_t path) {
+    mpack_assert(path < query->path_count, "path %i is out of range", (int)path);
+    return query->counts[path];
+}
+
+/**
+ * Returns the tag of the last element matched by the given path in the last
+ * run, or a tag of type @ref mpack_type_missing if it matched nothing.
+ *
+ * Tags are only recorded when no match function is set. The contents of
+ * matched strings, bins, exts, maps and arrays are skipped.
+ */
+MPACK_INLINE mpack_tag_t mpack_query_tag(mpack_query_t* query, size_t path) {
+    mpack_assert(path < query->path_count, "path %i is out of range", (int)path);
+    return query->tags[path];
+}
+
+/**
+ * @}
+ */
+
+#endif
+
+MPACK_EXTERN_C_END
+MPACK_HEADER_END
+
+#endif
+
@@ -23,6 +23,14 @@
 
 #include "mpack-reader.h"
 
+#if MPACK_READER && MPACK_FD
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+
 #if MPACK_READER
 
 static void mpack_reader_skip_using_fill(mpack_reader_t* reader, size_t count);
@@ -37,7 +45,7 @@ void mpack_reader_init(mpack_reader_t* reader, char* buffer, size_t size, size_t
     reader->end = buffer + count;
 
     #if MPACK_READ_TRACKING
-    mpack_reader_flag_if_error(reader, mpack_track_init(&reader->track));
+    mpack_reader_flag_if_error(reader, mpack_track_init(&reader->track, &reader->allocator));
     #endif
 
     mpack_log("===========================\n");
@@ -60,7 +68,7 @@ void mpack_reader_init_data(mpack_reader_t* reader, const char* data, size_t cou
     reader->end = data + count;
 
     #if MPACK_READ_TRACKING
-    mpack_reader_flag_if_error(reader, mpack_track_init(&reader->track));
+    mpack_reader_flag_if_error(reader, mpack_track_init(&reader->track, &reader->allocator));
     #endif
 
     mpack_log("===========================\n");
@@ -87,11 +95,122 @@ void mpack_reader_set_fill(mpack_reader_t* reader, mpack_reader_fill_t fill) {
     reader->fill = fill;
 }
 
+// Returns the current borrowed chunk to the source.
+static void mpack_reader_release_chunk(mpack_reader_t* reader) {
+    if (reader->chunk == NULL)
+        return;
+    mpack_log("releasing chunk %p of %i bytes\n", (const void*)reader->chunk, (int)reader->chunk_size);
+    if (reader->release)
+        reader->release(reader, reader->chunk, reader->chunk_size);
+    reader->chunk = NULL;
+    reader->chunk_size = 0;
+    reader->chunk_used = 0;
+}
+
+// Makes sure the borrowed chunk has unconsumed data, releasing it and
+// borrowing the next one if needed and flagging an error if it fails.
+static bool mpack_reader_borrow_next(mpack_reader_t* reader) {
+    if (reader->chunk_used < reader->chunk_size)
+        return true;
+    mpack_reader_release_chunk(reader);
+
+    const char* chunk = NULL;
+    size_t size = reader->borrow(reader, &chunk);
+
+    // Borrow functions can flag an error or return 0 on failure, like fill
+    // functions.
+    if (mpack_reader_error(reader) != mpack_ok)
+        return false;
+    if (size == 0 || size == ((size_t)(-1)) || chunk == NULL) {
+        mpack_reader_flag_error(reader, mpack_error_io);
+        return false;
+    }
+
+    mpack_log("borrowed chunk %p of %i bytes\n", (const void*)chunk, (int)size);
+    reader->chunk = chunk;
+    reader->chunk_size = size;
+    return true;
+}
+
+// Points the reader directly at the unconsumed data of the borrowed chunks.
+static bool mpack_reader_borrow_view(mpack_reader_t* reader) {
+    if (!mpack_reader_borrow_next(reader))
+        return false;
+    reader->data = reader->chunk + reader->chunk_used;
+    reader->end = reader->chunk + reader->chunk_size;
+    reader->chunk_used = reader->chunk_size;
+    return true;
+}
+
+// The fill function of a reader with borrowed chunks. This copies data out
+// of the chunks; it is only used for data that straddles two chunks.
+static size_t mpack_reader_borrow_fill(mpack_reader_t* reader, char* buffer, size_t count) {
+    if (!mpack_reader_borrow_next(reader))
+        return 0;
+    size_t left = reader->chunk_size - reader->chunk_used;
+    if (count > left)
+        count = left;
+    mpack_memcpy(buffer, reader->chunk + reader->chunk_used, count);
+    mpack_stats_add(&reader->stats, bytes_copied, count);
+    reader->chunk_used += count;
+    return count;
+}
+
+void mpack_reader_set_borrow(mpack_reader_t* reader, mpack_reader_borrow_t borrow, mpack_reader_release_t release) {
+    mpack_reader_set_fill(reader, &mpack_reader_borrow_fill);
+    if (mpack_reader_error(reader) != mpack_ok)
+        return;
+    reader->borrow = borrow;
+    reader->release = release;
+}
+
 void mpack_reader_set_skip(mpack_reader_t* reader, mpack_reader_skip_t skip) {
     mpack_assert(reader->size != 0, "cannot use skip function without a writeable buffer!");
     reader->skip = skip;
 }
 
+#ifdef MPACK_MALLOC
+#if MPACK_FD
+static bool mpack_fd_reader_move(mpack_reader_t* reader, const mpack_allocator_t* allocator);
+#endif
+
+void mpack_reader_set_allocator(mpack_reader_t* reader, const mpack_allocator_t* allocator) {
+    if (mpack_reader_error(reader) != mpack_ok)
+        return;
+
+    // the tracking stack (and the buffer of a file descriptor reader) are the
+    // only things allocated before reading, so we re-allocate them with the
+    // new allocator
+    #if MPACK_READ_TRACKING
+    if (reader->track.count != 0) {
+        mpack_break("cannot set the allocator after reading has started!");
+        mpack_reader_flag_error(reader, mpack_error_bug);
+        return;
+    }
+    #endif
+
+    mpack_allocator_t new_allocator;
+    if (allocator != NULL)
+        new_allocator = *allocator;
+    else
+        mpack_memset(&new_allocator, 0, sizeof(new_allocator));
+
+    #if MPACK_FD
+    if (!mpack_fd_reader_move(reader, &new_allocator))
+        return;
+    #endif
+
+    #if MPACK_READ_TRACKING
+    mpack_track_destroy(&reader->track, true);
+    #endif
+    reader->allocator = new_allocator;
+
+    #if MPACK_READ_TRACKING
+    mpack_reader_flag_if_error(reader, mpack_track_init(&reader->track, &reader->allocator));
+    #endif
+}
+#endif
+
 #if MPACK_STDIO
 static size_t mpack_file_reader_fill(mpack_reader_t* reader, char* buffer, size_t count) {
     if (feof((FILE *)reader->context)) {
@@ -180,6 +299,121 @@ void mpack_reader_init_filename(mpack_reader_t* reader, const char* filename) {
 }
 #endif
 
+#if MPACK_FD
+typedef struct mpack_fd_reader_t {
+    int fd;
+    bool close_when_done;
+} mpack_fd_reader_t;
+
+static size_t mpack_fd_reader_fill(mpack_reader_t* reader, char* buffer, size_t count) {
+    mpack_fd_reader_t* fd_reader = (mpack_fd_reader_t*)reader->context;
+    ssize_t ret;
+    do {
+        ret = read(fd_reader->fd, buffer, count);
+    } while (ret < 0 && errno == EINTR);
+
+    if (ret < 0) {
+        mpack_reader_flag_error(reader, (errno == EAGAIN || errno == EWOULDBLOCK) ?
+                mpack_error_would_block : mpack_error_io);
+        return 0;
+    }
+    if (ret == 0)
+        mpack_reader_flag_error(reader, mpack_error_eof);
+    return (size_t)ret;
+}
+
+static void mpack_fd_reader_skip(mpack_reader_t* reader, size_t count) {
+    if (mpack_reader_error(reader) != mpack_ok)
+        return;
+    mpack_fd_reader_t* fd_reader = (mpack_fd_reader_t*)reader->context;
+
+    // the skip function is only set for regular files, which can always seek
+    // (unless the count doesn't fit in off_t)
+    off_t offset = (off_t)count;
+    if (offset < 0 || (size_t)offset != count) {
+        mpack_reader_skip_using_fill(reader, count);
+        return;
+    }
+    mpack_log("seeking forward %i bytes\n", (int)count);
+    if (lseek(fd_reader->fd, offset, SEEK_CUR) == (off_t)-1)
+        mpack_reader_flag_error(reader, mpack_error_io);
+}
+
+static void mpack_fd_reader_teardown(mpack_reader_t* reader) {
+    mpack_fd_reader_t* fd_reader = (mpack_fd_reader_t*)reader->context;
+
+    if (fd_reader->close_when_done && close(fd_reader->fd) != 0)
+        mpack_reader_flag_error(reader, mpack_error_io);
+
+    // the buffer is allocated along with the context
+    mpack_allocator_free(&reader->allocator, fd_reader);
+    reader->buffer = NULL;
+    reader->context = NULL;
+    reader->size = 0;
+    reader->fill = NULL;
+    reader->skip = NULL;
+    reader->teardown = NULL;
+}
+
+// Moves the context and buffer of a file descriptor reader to the given
+// allocator. Returns false if the reader is placed in an error state. Other
+// readers are left alone.
+static bool mpack_fd_reader_move(mpack_reader_t* reader, const mpack_allocator_t* allocator) {
+    if (reader->teardown != mpack_fd_reader_teardown)
+        return true;
+    if (reader->end != reader->buffer) {
+        mpack_break("cannot set the allocator after reading has started!");
+        mpack_reader_flag_error(reader, mpack_error_bug);
+        return false;
+    }
+
+    mpack_fd_reader_t* fd_reader = (mpack_fd_reader_t*)mpack_allocator_alloc(allocator,
+            sizeof(mpack_fd_reader_t) + reader->size);
+    if (fd_reader == NULL) {
+        mpack_reader_flag_error(reader, mpack_error_memory);
+        return false;
+    }
+    *fd_reader = *(mpack_fd_reader_t*)reader->context;
+    mpack_allocator_free(&reader->allocator, reader->context);
+
+    reader->context = fd_reader;
+    reader->buffer = (char*)(fd_reader + 1);
+    reader->data = reader->buffer;
+    reader->end = reader->buffer;
+    if (reader->checkpoint != NULL)
+        reader->checkpoint = reader->buffer;
+    return true;
+}
+
+void mpack_reader_init_fd(mpack_reader_t* reader, int fd, size_t buffer_size, bool close_when_done) {
+    mpack_assert(fd >= 0, "fd is invalid");
+    if (buffer_size == 0)
+        buffer_size = MPACK_FD_BUFFER_SIZE;
+
+    mpack_fd_reader_t* fd_reader = (mpack_fd_reader_t*)MPACK_MALLOC(sizeof(mpack_fd_reader_t) + buffer_size);
+    if (fd_reader == NULL) {
+        mpack_reader_init_error(reader, mpack_error_memory);
+        if (close_when_done)
+            close(fd);
+        return;
+    }
+    fd_reader->fd = fd;
+    fd_reader->close_when_done = close_when_done;
+
+    mpack_reader_init(reader, (char*)(fd_reader + 1), buffer_size, 0);
+    mpack_reader_set_context(reader, fd_reader);
+    mpack_reader_set_fill(reader, mpack_fd_reader_fill);
+    mpack_reader_set_teardown(reader, mpack_fd_reader_teardown);
+
+    // pipes and sockets are skipped by reading, since they can't seek
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        mpack_reader_set_skip(reader, mpack_fd_reader_skip);
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+}
+#endif
+
 mpack_error_t mpack_reader_destroy(mpack_reader_t* reader) {
 
     // clean up tracking, asserting if we're not already in an error state
@@ -187,6 +421,9 @@ mpack_error_t mpack_reader_destroy(mpack_reader_t* reader) {
     mpack_reader_flag_if_error(reader, mpack_track_destroy(&reader->track, mpack_reader_error(reader) != mpack_ok));
     #endif
 
+    if (reader->borrow)
+        mpack_reader_release_chunk(reader);
+
     if (reader->teardown)
         reader->teardown(reader);
     reader->teardown = NULL;
@@ -194,6 +431,40 @@ mpack_error_t mpack_reader_destroy(mpack_reader_t* reader) {
     return reader->error;
 }
 
+void mpack_reader_checkpoint(mpack_reader_t* reader) {
+    if (mpack_reader_error(reader) != mpack_ok)
+        return;
+
+    if (reader->borrow != NULL) {
+        mpack_break("checkpoints are not supported with borrowed chunks!");
+        mpack_reader_flag_error(reader, mpack_error_bug);
+        return;
+    }
+
+    #if MPACK_READ_TRACKING
+    if (mpack_reader_flag_if_error(reader, mpack_track_check_empty(&reader->track)) != mpack_ok)
+        return;
+    #endif
+
+    reader->checkpoint = reader->data;
+}
+
+bool mpack_reader_rollback(mpack_reader_t* reader) {
+    if (reader->checkpoint == NULL || reader->error != mpack_error_would_block)
+        return false;
+
+    mpack_log("reader %p rolling back %i bytes\n", (void*)reader, (int)(reader->data - reader->checkpoint));
+    reader->error = mpack_ok;
+    reader->data = reader->checkpoint;
+    reader->end = reader->checkpoint_end;
+
+    // the checkpoint was set between messages, so nothing was open
+    #if MPACK_READ_TRACKING
+    reader->track.count = 0;
+    #endif
+    return true;
+}
+
 size_t mpack_reader_remaining(mpack_reader_t* reader, const char** data) {
     if (mpack_reader_error(reader) != mpack_ok)
         return 0;
@@ -208,11 +479,18 @@ size_t mpack_reader_remaining(mpack_reader_t* reader, const char** data) {
     return (size_t)(reader->end - reader->data);
 }
 
+#if MPACK_STATS
+void mpack_reader_reset_stats(mpack_reader_t* reader) {
+    mpack_memset(&reader->stats, 0, sizeof(reader->stats));
+}
+#endif
+
 void mpack_reader_flag_error(mpack_reader_t* reader, mpack_error_t error) {
     mpack_log("reader %p setting error %i: %s\n", (void*)reader, (int)error, mpack_error_to_string(error));
 
     if (reader->error == mpack_ok) {
         reader->error = error;
+        reader->checkpoint_end = reader->end;
         reader->end = reader->data;
         if (reader->error_fn)
             reader->error_fn(reader, error);
@@ -232,14 +510,17 @@ MPACK_NOINLINE static size_t mpack_fill_range(mpack_reader_t* reader, char* p, s
         size_t read = reader->fill(reader, p + count, max_bytes - count);
 
         // Reader fill functions can flag an error or return 0 on failure. We
-        // also guard against functions that return -1 just in case.
+        // also guard against functions that return -1 just in case. We still
+        // return the bytes filled so far; they are kept for a rollback.
         if (mpack_reader_error(reader) != mpack_ok)
-            return 0;
+            return count;
         if (read == 0 || read == ((size_t)(-1))) {
             mpack_reader_flag_error(reader, mpack_error_io);
-            return 0;
+            return count;
         }
 
+        mpack_stats_add(&reader->stats, fills, 1);
+        mpack_stats_add(&reader->stats, bytes, read);
         count += read;
     }
     return count;
@@ -263,26 +544,63 @@ MPACK_NOINLINE bool mpack_reader_ensure_straddle(mpack_reader_t* reader, size_t
         return false;
     }
 
-    // we need enough space in the buffer. if the buffer is not
-    // big enough, we return mpack_error_too_big (since this is
-    // for an in-place read larger than the buffer size.)
-    if (count > reader->size) {
+    // if we're borrowing chunks and there's nothing left, we read directly
+    // from the next chunk if it has enough data
+    if (reader->borrow != NULL && reader->data == reader->end) {
+        if (!mpack_reader_borrow_view(reader))
+            return false;
+        if (count <= (size_t)(reader->end - reader->data))
+            return true;
+    }
+
+    // we need enough space in the buffer (along with the data since the
+    // checkpoint, if any.) if the buffer is not big enough, we return
+    // mpack_error_too_big (since this is for an in-place read larger than
+    // the buffer size.)
+    const char* keep = (reader->checkpoint != NULL) ? reader->checkpoint : reader->data;
+    size_t kept = (size_t)(reader->data - keep);
+    if (count > reader->size - kept) {
         mpack_reader_flag_error(reader, mpack_error_too_big);
         return false;
     }
 
-    // move the existing data to the start of the buffer
+    // move the existing data to the start of the buffer, unless there is
+    // enough room after it for the needed bytes and a sizeable fill. this
+    // way pipelined data is only moved when it's about to run off the end
+    // of the buffer.
     size_t left = (size_t)(reader->end - reader->data);
-    mpack_memmove(reader->buffer, reader->data, left);
-    reader->end -= reader->data - reader->buffer;
-    reader->data = reader->buffer;
+    size_t offset = 0;
+    size_t room = 0;
+    // borrowed chunks aren't in the buffer, so their data is always moved.
+    // (the offset is only computed when the data is in the buffer since
+    // pointers into a chunk can't be compared with the buffer.)
+    bool move = reader->borrow != NULL || left + kept == 0;
+    if (!move) {
+        offset = (size_t)(reader->end - reader->buffer);
+        room = reader->size - offset;
+        move = room < count - left || room < reader->size / 2;
+    }
+    if (move) {
+        mpack_memmove(reader->buffer, keep, kept + left);
+        mpack_stats_add(&reader->stats, bytes_copied, kept + left);
+        if (reader->checkpoint != NULL)
+            reader->checkpoint = reader->buffer;
+        reader->data = reader->buffer + kept;
+        reader->end = reader->data + left;
+        offset = kept + left;
+        room = reader->size - offset;
+    }
 
     // read at least the necessary number of bytes, accepting up to the
-    // buffer size
-    size_t read = mpack_fill_range(reader, reader->buffer + left,
-            count - left, reader->size - left);
-    if (mpack_reader_error(reader) != mpack_ok)
+    // end of the buffer. we only copy what's needed out of borrowed chunks
+    // so that we can read the rest of the chunk directly.
+    size_t read = mpack_fill_range(reader, reader->buffer + offset,
+            count - left, (reader->borrow != NULL) ? count - left : room);
+    if (mpack_reader_error(reader) != mpack_ok) {
+        // whatever was filled is kept for a rollback
+        reader->checkpoint_end = reader->buffer + offset + read;
         return false;
+    }
     reader->end += read;
     return true;
 }
@@ -332,6 +650,18 @@ MPACK_NOINLINE void mpack_read_native_straddle(mpack_reader_t* reader, char* p,
         return;
     }
 
+    // with a checkpoint, the data must stay in the buffer so that it can be
+    // read again after a rollback
+    if (reader->checkpoint != NULL) {
+        if (!mpack_reader_ensure_straddle(reader, count)) {
+            mpack_memset(p, 0, count);
+            return;
+        }
+        mpack_memcpy(p, reader->data, count);
+        reader->data += count;
+        return;
+    }
+
     // flush what's left of the buffer
     if (left > 0) {
         mpack_log("flushing %i bytes remaining in buffer\n", (int)left);
@@ -341,6 +671,12 @@ MPACK_NOINLINE void mpack_read_native_straddle(mpack_reader_t* reader, char* p,
         reader->data += left;
     }
 
+    // copy the rest directly out of borrowed chunks
+    if (reader->borrow != NULL) {
+        mpack_fill_range(reader, p, count, count);
+        return;
+    }
+
     // if the remaining data needed is some small fraction of the
     // buffer size, we'll try to fill the buffer as much as possible
     // and copy the needed data out.
@@ -371,12 +707,33 @@ MPACK_NOINLINE static void mpack_skip_bytes_straddle(mpack_reader_t* reader, siz
         return;
     }
 
+    // with a checkpoint, the skipped data must stay in the buffer
+    if (reader->checkpoint != NULL) {
+        if (mpack_reader_ensure_straddle(reader, count))
+            reader->data += count;
+        return;
+    }
+
     // discard whatever's left in the buffer
     size_t left = (size_t)(reader->end - reader->data);
     mpack_log("discarding %i bytes still in buffer\n", (int)left);
     count -= left;
     reader->data = reader->end;
 
+    // skip through borrowed chunks without copying them
+    if (reader->borrow != NULL) {
+        while (count > 0) {
+            if (!mpack_reader_borrow_view(reader))
+                return;
+            size_t skipped = (size_t)(reader->end - reader->data);
+            if (skipped > count)
+                skipped = count;
+            reader->data += skipped;
+            count -= skipped;
+        }
+        return;
+    }
+
     // use the skip function if we've got one, and if we're trying
     // to skip a lot of data. if we only need to skip some tiny
     // fraction of the buffer size, it's probably better to just
@@ -515,7 +872,7 @@ char* mpack_read_bytes_alloc_impl(mpack_reader_t* reader, size_t count, bool nul
         return NULL;
 
     // allocate data
-    char* data = (char*)MPACK_MALLOC(count + (null_terminated ? 1 : 0)); // TODO: can this overflow?
+    char* data = (char*)mpack_allocator_alloc(&reader->allocator, count + (null_terminated ? 1 : 0)); // TODO: can this overflow?
     if (data == NULL) {
         mpack_reader_flag_error(reader, mpack_error_memory);
         return NULL;
@@ -526,7 +883,7 @@ char* mpack_read_bytes_alloc_impl(mpack_reader_t* reader, size_t count, bool nul
 
     // report flagged errors
     if (mpack_reader_error(reader) != mpack_ok) {
-        MPACK_FREE(data);
+        mpack_allocator_free(&reader->allocator, data);
         if (reader->error_fn)
             reader->error_fn(reader, mpack_reader_error(reader));
         return NULL;
@@ -578,346 +935,102 @@ const char* mpack_read_utf8_inplace(mpack_reader_t* reader, size_t count) {
 
 static size_t mpack_parse_tag(mpack_reader_t* reader, mpack_tag_t* tag) {
     mpack_assert(reader->error == mpack_ok, "reader cannot be in an error state!");
+    #if MPACK_EXTENSIONS
+    MPACK_STATIC_ASSERT(MPACK_TAG_DESC_EXT == (uint8_t)mpack_type_ext, "ext descriptors have the wrong type");
+    #endif
 
     if (!mpack_reader_ensure(reader, 1))
         return 0;
     uint8_t type = mpack_load_u8(reader->data);
 
-    // unfortunately, by far the fastest way to parse a tag is to switch
-    // on the first byte, and to explicitly list every possible byte. so for
-    // infix types, the list of cases is quite large.
-    //
-    // in size-optimized builds, we switch on the top four bits first to
-    // handle most infix types with a smaller jump table to save space.
-
-    #if MPACK_OPTIMIZE_FOR_SIZE
-    switch (type >> 4) {
-
-        // positive fixnum
-        case 0x0: case 0x1: case 0x2: case 0x3:
-        case 0x4: case 0x5: case 0x6: case 0x7:
-            *tag = mpack_tag_make_uint(type);
-            return 1;
-
-        // negative fixnum
-        case 0xe: case 0xf:
-            *tag = mpack_tag_make_int((int8_t)type);
-            return 1;
-
-        // fixmap
-        case 0x8:
-            *tag = mpack_tag_make_map(type & ~0xf0u);
-            return 1;
-
-        // fixarray
-        case 0x9:
-            *tag = mpack_tag_make_array(type & ~0xf0u);
-            return 1;
-
-        // fixstr
-        case 0xa: case 0xb:
-            *tag = mpack_tag_make_str(type & ~0xe0u);
-            return 1;
-
-        // not one of the common infix types
-        default:
-            break;
+    // the fix types are checked by range since they are by far the most
+    // common. the rest are decoded through their descriptors, which give the
+    // size and layout of the tag, so we only need to branch on their type to
+    // build them rather than on every type byte.
+    if (type <= 0x7f) {
+        *tag = mpack_tag_make_uint(type);
+        return 1;
+    }
+    if (type >= 0xe0) {
+        *tag = mpack_tag_make_int((int8_t)type);
+        return 1;
+    }
+    if (type <= 0x8f) {
+        *tag = mpack_tag_make_map(type & 0xfu);
+        return 1;
+    }
+    if (type <= 0x9f) {
+        *tag = mpack_tag_make_array(type & 0xfu);
+        return 1;
+    }
+    if (type <= 0xbf) {
+        *tag = mpack_tag_make_str(type & 0x1fu);
+        return 1;
+    }
 
+    const mpack_tag_desc_t* desc = &mpack_tag_descs[type];
+    if (desc->type == mpack_type_missing) {
+        mpack_reader_flag_error(reader, mpack_error_invalid);
+        return 0;
+    }
+    #if !MPACK_EXTENSIONS
+    if (desc->type == MPACK_TAG_DESC_EXT) {
+        mpack_reader_flag_error(reader, mpack_error_unsupported);
+        return 0;
     }
     #endif
 
-    // handle individual type tags
-    switch (type) {
-
-        #if !MPACK_OPTIMIZE_FOR_SIZE
-        // positive fixnum
-        case 0x00: case 0x01: case 0x02: case 0x03: case 0x04: case 0x05: case 0x06: case 0x07:
-        case 0x08: case 0x09: case 0x0a: case 0x0b: case 0x0c: case 0x0d: case 0x0e: case 0x0f:
-        case 0x10: case 0x11: case 0x12: case 0x13: case 0x14: case 0x15: case 0x16: case 0x17:
-        case 0x18: case 0x19: case 0x1a: case 0x1b: case 0x1c: case 0x1d: case 0x1e: case 0x1f:
-        case 0x20: case 0x21: case 0x22: case 0x23: case 0x24: case 0x25: case 0x26: case 0x27:
-        case 0x28: case 0x29: case 0x2a: case 0x2b: case 0x2c: case 0x2d: case 0x2e: case 0x2f:
-        case 0x30: case 0x31: case 0x32: case 0x33: case 0x34: case 0x35: case 0x36: case 0x37:
-        case 0x38: case 0x39: case 0x3a: case 0x3b: case 0x3c: case 0x3d: case 0x3e: case 0x3f:
-        case 0x40: case 0x41: case 0x42: case 0x43: case 0x44: case 0x45: case 0x46: case 0x47:
-        case 0x48: case 0x49: case 0x4a: case 0x4b: case 0x4c: case 0x4d: case 0x4e: case 0x4f:
-        case 0x50: case 0x51: case 0x52: case 0x53: case 0x54: case 0x55: case 0x56: case 0x57:
-        case 0x58: case 0x59: case 0x5a: case 0x5b: case 0x5c: case 0x5d: case 0x5e: case 0x5f:
-        case 0x60: case 0x61: case 0x62: case 0x63: case 0x64: case 0x65: case 0x66: case 0x67:
-        case 0x68: case 0x69: case 0x6a: case 0x6b: case 0x6c: case 0x6d: case 0x6e: case 0x6f:
-        case 0x70: case 0x71: case 0x72: case 0x73: case 0x74: case 0x75: case 0x76: case 0x77:
-        case 0x78: case 0x79: case 0x7a: case 0x7b: case 0x7c: case 0x7d: case 0x7e: case 0x7f:
-            *tag = mpack_tag_make_uint(type);
-            return 1;
-
-        // negative fixnum
-        case 0xe0: case 0xe1: case 0xe2: case 0xe3: case 0xe4: case 0xe5: case 0xe6: case 0xe7:
-        case 0xe8: case 0xe9: case 0xea: case 0xeb: case 0xec: case 0xed: case 0xee: case 0xef:
-        case 0xf0: case 0xf1: case 0xf2: case 0xf3: case 0xf4: case 0xf5: case 0xf6: case 0xf7:
-        case 0xf8: case 0xf9: case 0xfa: case 0xfb: case 0xfc: case 0xfd: case 0xfe: case 0xff:
-            *tag = mpack_tag_make_int((int8_t)type);
-            return 1;
-
-        // fixmap
-        case 0x80: case 0x81: case 0x82: case 0x83: case 0x84: case 0x85: case 0x86: case 0x87:
-        case 0x88: case 0x89: case 0x8a: case 0x8b: case 0x8c: case 0x8d: case 0x8e: case 0x8f:
-            *tag = mpack_tag_make_map(type & ~0xf0u);
-            return 1;
-
-        // fixarray
-        case 0x90: case 0x91: case 0x92: case 0x93: case 0x94: case 0x95: case 0x96: case 0x97:
-        case 0x98: case 0x99: case 0x9a: case 0x9b: case 0x9c: case 0x9d: case 0x9e: case 0x9f:
-            *tag = mpack_tag_make_array(type & ~0xf0u);
-            return 1;
-
-        // fixstr
-        case 0xa0: case 0xa1: case 0xa2: case 0xa3: case 0xa4: case 0xa5: case 0xa6: case 0xa7:
-        case 0xa8: case 0xa9: case 0xaa: case 0xab: case 0xac: case 0xad: case 0xae: case 0xaf:
-        case 0xb0: case 0xb1: case 0xb2: case 0xb3: case 0xb4: case 0xb5: case 0xb6: case 0xb7:
-        case 0xb8: case 0xb9: case 0xba: case 0xbb: case 0xbc: case 0xbd: case 0xbe: case 0xbf:
-            *tag = mpack_tag_make_str(type & ~0xe0u);
-            return 1;
-        #endif
+    size_t header = desc->header;
+    if (header > 1 && !mpack_reader_ensure(reader, header))
+        return 0;
+    const char* data = reader->data;
+    uint64_t value = mpack_tag_desc_value(desc, data, (size_t)(reader->end - data));
 
-        // nil
-        case 0xc0:
+    switch (desc->type) {
+        case mpack_type_nil:
             *tag = mpack_tag_make_nil();
-            return 1;
-
-        // bool
-        case 0xc2: case 0xc3:
-            *tag = mpack_tag_make_bool((bool)(type & 1));
-            return 1;
-
-        // bin8
-        case 0xc4:
-            if (!mpack_reader_ensure(reader, MPACK_TAG_SIZE_BIN8))
-                return 0;
-            *tag = mpack_tag_make_bin(mpack_load_u8(reader->data + 1));
-            return MPACK_TAG_SIZE_BIN8;
-
-        // bin16
-        case 0xc5:
-            if (!mpack_reader_ensure(reader, MPACK_TAG_SIZE_BIN16))
-                return 0;
-            *tag = mpack_tag_make_bin(mpack_load_u16(reader->data + 1));
-            return MPACK_TAG_SIZE_BIN16;
-
-        // bin32
-        case 0xc6:
-            if (!mpack_reader_ensure(reader, MPACK_TAG_SIZE_BIN32))
-                return 0;
-            *tag = mpack_tag_make_bin(mpack_load_u32(reader->data + 1));
-            return MPACK_TAG_SIZE_BIN32;
-
-        #if MPACK_EXTENSIONS
-        // ext8
-        case 0xc7:
-            if (!mpack_reader_ensure(reader, MPACK_TAG_SIZE_EXT8))
-                return 0;
-            *tag = mpack_tag_make_ext(mpack_load_i8(reader->data + 2), mpack_load_u8(reader->data + 1));
-            return MPACK_TAG_SIZE_EXT8;
-
-        // ext16
-        case 0xc8:
-            if (!mpack_reader_ensure(reader, MPACK_TAG_SIZE_EXT16))
-                return 0;
-            *tag = mpack_tag_make_ext(mpack_load_i8(reader->data + 3), mpack_load_u16(reader->data + 1));
-            return MPACK_TAG_SIZE_EXT16;
-
-        // ext32
-        case 0xc9:
-            if (!mpack_reader_ensure(reader, MPACK_TAG_SIZE_EXT32))
-                return 0;
-            *tag = mpack_tag_make_ext(mpack_load_i8(reader->data + 5), mpack_load_u32(reader->data + 1));
-            return MPACK_TAG_SIZE_EXT32;
-        #endif
-
-        // float
-        case 0xca:
-            if (!mpack_reader_ensure(reader, MPACK_TAG_SIZE_FLOAT))
-                return 0;
-            *tag = mpack_tag_make_float(mpack_load_float(reader->data + 1));
-            return MPACK_TAG_SIZE_FLOAT;
-
-        // double
-        case 0xcb:
-            if (!mpack_reader_ensure(reader, MPACK_TAG_SIZE_DOUBLE))
-                return 0;
-            *tag = mpack_tag_make_double(mpack_load_double(reader->data + 1));
-            return MPACK_TAG_SIZE_DOUBLE;
-
-        // uint8
-        case 0xcc:
-            if (!mpack_reader_ensure(reader, MPACK_TAG_SIZE_U8))
-                return 0;
-            *tag = mpack_tag_make_uint(mpack_load_u8(reader->data + 1));
-            return MPACK_TAG_SIZE_U8;
-
-        // uint16
-        case 0xcd:
-            if (!mpack_reader_ensure(reader, MPACK_TAG_SIZE_U16))
-                return 0;
-            *tag = mpack_tag_make_uint(mpack_load_u16(reader->data + 1));
-            return MPACK_TAG_SIZE_U16;
-
-        // uint32
-        case 0xce:
-            if (!mpack_reader_ensure(reader, MPACK_TAG_SIZE_U32))
-                return 0;
-            *tag = mpack_tag_make_uint(mpack_load_u32(reader->data + 1));
-            return MPACK_TAG_SIZE_U32;
-
-        // uint64
-        case 0xcf:
-            if (!mpack_reader_ensure(reader, MPACK_TAG_SIZE_U64))
-                return 0;
-            *tag = mpack_tag_make_uint(mpack_load_u64(reader->data + 1));
-            return MPACK_TAG_SIZE_U64;
-
-        // int8
-        case 0xd0:
-            if (!mpack_reader_ensure(reader, MPACK_TAG_SIZE_I8))
-                return 0;
-            *tag = mpack_tag_make_int(mpack_load_i8(reader->data + 1));
-            return MPACK_TAG_SIZE_I8;
-
-        // int16
-        case 0xd1:
-            if (!mpack_reader_ensure(reader, MPACK_TAG_SIZE_I16))
-                return 0;
-            *tag = mpack_tag_make_int(mpack_load_i16(reader->data + 1));
-            return MPACK_TAG_SIZE_I16;
-
-        // int32
-        case 0xd2:
-            if (!mpack_reader_ensure(reader, MPACK_TAG_SIZE_I32))
-                return 0;
-            *tag = mpack_tag_make_int(mpack_load_i32(reader->data + 1));
-            return MPACK_TAG_SIZE_I32;
-
-        // int64
-        case 0xd3:
-            if (!mpack_reader_ensure(reader, MPACK_TAG_SIZE_I64))
-                return 0;
-            *tag = mpack_tag_make_int(mpack_load_i64(reader->data + 1));
-            return MPACK_TAG_SIZE_I64;
+            break;
+        case mpack_type_bool:
+            *tag = mpack_tag_make_bool(value != 0);
+            break;
+        case mpack_type_uint:
+            *tag = mpack_tag_make_uint(value);
+            break;
+        case mpack_type_int:
+            *tag = mpack_tag_make_int(mpack_tag_desc_int(desc, value));
+            break;
+        case mpack_type_float:
+            *tag = mpack_tag_make_float(mpack_load_float(data + 1));
+            break;
+        case mpack_type_double:
+            *tag = mpack_tag_make_double(mpack_load_double(data + 1));
+            break;
+        case mpack_type_str:
+            *tag = mpack_tag_make_str((uint32_t)value);
+            break;
+        case mpack_type_bin:
+            *tag = mpack_tag_make_bin((uint32_t)value);
+            break;
+        case mpack_type_array:
+            *tag = mpack_tag_make_array((uint32_t)value);
+            break;
+        case mpack_type_map:
+            *tag = mpack_tag_make_map((uint32_t)value);
+            break;
 
         #if MPACK_EXTENSIONS
-        // fixext1
-        case 0xd4:
-            if (!mpack_reader_ensure(reader, MPACK_TAG_SIZE_FIXEXT1))
-                return 0;
-            *tag = mpack_tag_make_ext(mpack_load_i8(reader->data + 1), 1);
-            return MPACK_TAG_SIZE_FIXEXT1;
-
-        // fixext2
-        case 0xd5:
-            if (!mpack_reader_ensure(reader, MPACK_TAG_SIZE_FIXEXT2))
-                return 0;
-            *tag = mpack_tag_make_ext(mpack_load_i8(reader->data + 1), 2);
-            return MPACK_TAG_SIZE_FIXEXT2;
-
-        // fixext4
-        case 0xd6:
-            if (!mpack_reader_ensure(reader, MPACK_TAG_SIZE_FIXEXT4))
-                return 0;
-            *tag = mpack_tag_make_ext(mpack_load_i8(reader->data + 1), 4);
-            return 2;
-
-        // fixext8
-        case 0xd7:
-            if (!mpack_reader_ensure(reader, MPACK_TAG_SIZE_FIXEXT8))
-                return 0;
-            *tag = mpack_tag_make_ext(mpack_load_i8(reader->data + 1), 8);
-            return MPACK_TAG_SIZE_FIXEXT8;
-
-        // fixext16
-        case 0xd8:
-            if (!mpack_reader_ensure(reader, MPACK_TAG_SIZE_FIXEXT16))
-                return 0;
-            *tag = mpack_tag_make_ext(mpack_load_i8(reader->data + 1), 16);
-            return MPACK_TAG_SIZE_FIXEXT16;
-        #endif
-
-        // str8
-        case 0xd9:
-            if (!mpack_reader_ensure(reader, MPACK_TAG_SIZE_STR8))
-                return 0;
-            *tag = mpack_tag_make_str(mpack_load_u8(reader->data + 1));
-            return MPACK_TAG_SIZE_STR8;
-
-        // str16
-        case 0xda:
-            if (!mpack_reader_ensure(reader, MPACK_TAG_SIZE_STR16))
-                return 0;
-            *tag = mpack_tag_make_str(mpack_load_u16(reader->data + 1));
-            return MPACK_TAG_SIZE_STR16;
-
-        // str32
-        case 0xdb:
-            if (!mpack_reader_ensure(reader, MPACK_TAG_SIZE_STR32))
-                return 0;
-            *tag = mpack_tag_make_str(mpack_load_u32(reader->data + 1));
-            return MPACK_TAG_SIZE_STR32;
-
-        // array16
-        case 0xdc:
-            if (!mpack_reader_ensure(reader, MPACK_TAG_SIZE_ARRAY16))
-                return 0;
-            *tag = mpack_tag_make_array(mpack_load_u16(reader->data + 1));
-            return MPACK_TAG_SIZE_ARRAY16;
-
-        // array32
-        case 0xdd:
-            if (!mpack_reader_ensure(reader, MPACK_TAG_SIZE_ARRAY32))
-                return 0;
-            *tag = mpack_tag_make_array(mpack_load_u32(reader->data + 1));
-            return MPACK_TAG_SIZE_ARRAY32;
-
-        // map16
-        case 0xde:
-            if (!mpack_reader_ensure(reader, MPACK_TAG_SIZE_MAP16))
-                return 0;
-            *tag = mpack_tag_make_map(mpack_load_u16(reader->data + 1));
-            return MPACK_TAG_SIZE_MAP16;
-
-        // map32
-        case 0xdf:
-            if (!mpack_reader_ensure(reader, MPACK_TAG_SIZE_MAP32))
-                return 0;
-            *tag = mpack_tag_make_map(mpack_load_u32(reader->data + 1));
-            return MPACK_TAG_SIZE_MAP32;
-
-        // reserved
-        case 0xc1:
-            mpack_reader_flag_error(reader, mpack_error_invalid);
-            return 0;
-
-        #if !MPACK_EXTENSIONS
-        // ext
-        case 0xc7: // fallthrough
-        case 0xc8: // fallthrough
-        case 0xc9: // fallthrough
-        // fixext
-        case 0xd4: // fallthrough
-        case 0xd5: // fallthrough
-        case 0xd6: // fallthrough
-        case 0xd7: // fallthrough
-        case 0xd8:
-            mpack_reader_flag_error(reader, mpack_error_unsupported);
-            return 0;
+        case mpack_type_ext:
+            // the exttype is the last byte of the tag
+            *tag = mpack_tag_make_ext(mpack_load_i8(data + header - 1), (uint32_t)value);
+            break;
         #endif
 
-        #if MPACK_OPTIMIZE_FOR_SIZE
-        // any other bytes should have been handled by the infix switch
         default:
-            break;
-        #endif
+            mpack_assert(0, "unreachable");
+            return 0;
     }
 
-    mpack_assert(0, "unreachable");
-    return 0;
+    return header;
 }
 
 mpack_tag_t mpack_read_tag(mpack_reader_t* reader) {
@@ -978,46 +1091,45 @@ mpack_tag_t mpack_peek_tag(mpack_reader_t* reader) {
     return tag;
 }
 
+/*
+ * Rather than reading each tag of the discarded element, we scan the
+ * structure of as many elements as we can straight out of the buffer and skip
+ * them all at once. We only fall back to the straddling functions when a
+ * header runs off the end of the buffer or a payload needs to be skipped past
+ * it (which may use the skip function.) Nothing inside the element is
+ * tracked; it counts as a single element in its parent.
+ */
 void mpack_discard(mpack_reader_t* reader) {
-    mpack_tag_t var = mpack_read_tag(reader);
-    if (mpack_reader_error(reader))
+    if (mpack_reader_error(reader) != mpack_ok)
         return;
-    switch (var.type) {
-        case mpack_type_str:
-            mpack_skip_bytes(reader, var.v.l);
-            mpack_done_str(reader);
-            break;
-        case mpack_type_bin:
-            mpack_skip_bytes(reader, var.v.l);
-            mpack_done_bin(reader);
-            break;
-        #if MPACK_EXTENSIONS
-        case mpack_type_ext:
-            mpack_skip_bytes(reader, var.v.l);
-            mpack_done_ext(reader);
-            break;
-        #endif
-        case mpack_type_array: {
-            for (; var.v.n > 0; --var.v.n) {
-                mpack_discard(reader);
-                if (mpack_reader_error(reader))
-                    break;
-            }
-            mpack_done_array(reader);
-            break;
+    if (mpack_reader_track_element(reader) != mpack_ok)
+        return;
+
+    mpack_scan_t scan;
+    scan.left = 1;
+    scan.skip = 0;
+    while (true) {
+        size_t used = 0;
+        mpack_error_t error = mpack_scan(&scan, reader->data, (size_t)(reader->end - reader->data),
+                MPACK_EXTENSIONS != 0, &used);
+        if (error != mpack_ok) {
+            mpack_reader_flag_error(reader, error);
+            return;
         }
-        case mpack_type_map: {
-            for (; var.v.n > 0; --var.v.n) {
-                mpack_discard(reader);
-                mpack_discard(reader);
-                if (mpack_reader_error(reader))
-                    break;
-            }
-            mpack_done_map(reader);
-            break;
+        reader->data += used;
+
+        if (scan.skip > 0) {
+            size_t count = scan.skip;
+            scan.skip = 0;
+            mpack_skip_bytes_straddle(reader, count);
+        } else if (scan.left > 0) {
+            mpack_reader_ensure_straddle(reader, scan.need);
+        } else {
+            return;
         }
-        default:
-            break;
+
+        if (mpack_reader_error(reader) != mpack_ok)
+            return;
     }
 }
 
@@ -92,6 +92,11 @@ typedef struct mpack_reader_t mpack_reader_t;
  * (usually @ref mpack_error_io), or simply return zero. If zero is
  * returned, mpack_error_io is raised.
  *
+ * If the source is non-blocking and has no data available, it can flag
+ * @ref mpack_error_would_block and return zero. The reader can then be
+ * rolled back to its last checkpoint (see mpack_reader_checkpoint()) to
+ * retry once more data arrives.
+ *
  * @note When reading from a stream, you should only copy and return
  * the bytes that are immediately available. It is always safe to return
  * less than the requested count as long as some non-zero number of bytes
@@ -112,6 +117,30 @@ typedef size_t (*mpack_reader_fill_t)(mpack_reader_t* reader, char* buffer, size
  */
 typedef void (*mpack_reader_skip_t)(mpack_reader_t* reader, size_t count);
 
+/**
+ * The MPack reader's borrow function. It should point @p data at the next
+ * chunk of data from the source, returning its length in bytes.
+ *
+ * The chunk remains owned by the caller. The reader parses directly from it,
+ * and passes it to the release function once it no longer needs it.
+ *
+ * In case of error, it should flag an appropriate error on the reader
+ * (usually @ref mpack_error_io), or simply return zero. If zero is
+ * returned, mpack_error_io is raised.
+ *
+ * @see mpack_reader_set_borrow()
+ * @see mpack_reader_context()
+ */
+typedef size_t (*mpack_reader_borrow_t)(mpack_reader_t* reader, const char** data);
+
+/**
+ * The MPack reader's release function. It is called with each chunk
+ * returned by the borrow function once the reader is done with it.
+ *
+ * @see mpack_reader_set_borrow()
+ */
+typedef void (*mpack_reader_release_t)(mpack_reader_t* reader, const char* data, size_t count);
+
 /**
  * An error handler function to be called when an error is flagged on
  * the reader.
@@ -152,6 +181,8 @@ struct mpack_reader_t {
     mpack_reader_error_t error_fn;    /* Function to call on error */
     mpack_reader_teardown_t teardown; /* Function to teardown the context on destroy */
     mpack_reader_skip_t skip;         /* Function to skip bytes from the source */
+    mpack_reader_borrow_t borrow;     /* Function to borrow the next chunk from the source */
+    mpack_reader_release_t release;   /* Function to release a borrowed chunk */
 
     char* buffer;       /* Writeable byte buffer */
     size_t size;        /* Size of the buffer */
@@ -159,11 +190,26 @@ struct mpack_reader_t {
     const char* data;   /* Current data pointer (in the buffer, if it is used) */
     const char* end;    /* The end of available data (in the buffer, if it is used) */
 
+    const char* chunk;  /* The borrowed chunk, or NULL */
+    size_t chunk_size;  /* Size of the borrowed chunk */
+    size_t chunk_used;  /* Bytes of the borrowed chunk already consumed or viewed */
+
     mpack_error_t error;  /* Error state */
 
+    const char* checkpoint;     /* The data at the last checkpoint, or NULL */
+    const char* checkpoint_end; /* The end of available data when an error was flagged */
+
+    #ifdef MPACK_MALLOC
+    mpack_allocator_t allocator; /* Allocator for allocating reads */
+    #endif
+
     #if MPACK_READ_TRACKING
     mpack_track_t track; /* Stack of map/array/str/bin/ext reads */
     #endif
+
+    #if MPACK_STATS
+    mpack_stats_t stats; /* Statistics counters */
+    #endif
 };
 
 /** @endcond */
@@ -235,6 +281,37 @@ MPACK_INLINE void mpack_reader_init_file(mpack_reader_t* reader, const char* fil
 void mpack_reader_init_stdfile(mpack_reader_t* reader, FILE* stdfile, bool close_when_done);
 #endif
 
+#if MPACK_FD
+/**
+ * Initializes an MPack reader that reads from a POSIX file descriptor with
+ * read(). This can be used to read from a file, pipe or socket.
+ *
+ * The buffer is allocated with @ref MPACK_MALLOC. A large buffer means fewer
+ * system calls. If the descriptor refers to a regular file, the kernel is
+ * advised that it will be read sequentially, and data is skipped with
+ * lseek() rather than read.
+ *
+ * If the descriptor is non-blocking and no data is available, @ref
+ * mpack_error_would_block is flagged. See mpack_reader_checkpoint() to
+ * retry once more data arrives.
+ *
+ * @param reader The MPack reader.
+ * @param fd The file descriptor.
+ * @param buffer_size The size of the buffer to allocate, or 0 for @ref
+ *        MPACK_FD_BUFFER_SIZE. It must be at least @ref
+ *        MPACK_READER_MINIMUM_BUFFER_SIZE.
+ * @param close_when_done If true, close() will be called on the descriptor
+ *        when it is no longer needed.
+ *
+ * @throws mpack_error_memory if allocation fails
+ *
+ * @warning The reader is buffered. It will read data in advance of parsing it,
+ * and it may read more data than it parsed. See mpack_reader_remaining() to
+ * access the extra data.
+ */
+void mpack_reader_init_fd(mpack_reader_t* reader, int fd, size_t buffer_size, bool close_when_done);
+#endif
+
 /**
  * @def mpack_reader_init_stack(reader)
  * @hideinitializer
@@ -343,6 +420,55 @@ void mpack_reader_set_fill(mpack_reader_t* reader, mpack_reader_fill_t fill);
  */
 void mpack_reader_set_skip(mpack_reader_t* reader, mpack_reader_skip_t skip);
 
+/**
+ * Sets functions to borrow chunks of data from the source in place of a
+ * fill function.
+ *
+ * Rather than copying data into the reader's buffer, the borrow function
+ * lends the reader chunks of memory owned by the caller (for example
+ * received packets or slots of a ring buffer.) The reader parses directly
+ * from these chunks. It copies data into its own buffer only when a single
+ * tag or in-place read spans two chunks, so the buffer (which must be at
+ * least @ref MPACK_READER_MINIMUM_BUFFER_SIZE bytes) need only be large
+ * enough for the largest such read.
+ *
+ * Each chunk is passed to the release function once the reader has moved
+ * past it, or when the reader is destroyed. Data returned by in-place reads
+ * is valid until the next read, as usual.
+ *
+ * This replaces any fill function. This should normally be used with
+ * mpack_reader_set_context() to register a custom pointer to pass to the
+ * borrow and release functions.
+ *
+ * @param reader The MPack reader.
+ * @param borrow The function to borrow the next chunk of data.
+ * @param release The function to release a chunk, or NULL.
+ */
+void mpack_reader_set_borrow(mpack_reader_t* reader, mpack_reader_borrow_t borrow, mpack_reader_release_t release);
+
+#ifdef MPACK_MALLOC
+/**
+ * Sets the allocator for memory allocated by the reader.
+ *
+ * This is used for the results of allocating read and expect functions
+ * such as mpack_read_bytes_alloc() and mpack_expect_cstr_alloc(), which
+ * must then be freed with the allocator rather than with MPACK_FREE(). It
+ * is also used for read tracking in debug builds.
+ *
+ * This must be called before anything is read. The buffer of a reader
+ * initialized with mpack_reader_init_fd() is moved to the allocator. The
+ * buffer of a reader initialized with mpack_reader_init_filename() or
+ * mpack_reader_init_stdfile() is not affected.
+ *
+ * @param reader The MPack reader.
+ * @param allocator The allocator to use, or NULL to use @ref MPACK_MALLOC.
+ *     It is copied into the reader.
+ *
+ * @note This requires @ref MPACK_MALLOC.
+ */
+void mpack_reader_set_allocator(mpack_reader_t* reader, const mpack_allocator_t* allocator);
+#endif
+
 /**
  * Sets the error function to call when an error is flagged on the reader.
  *
@@ -440,6 +566,29 @@ MPACK_INLINE mpack_error_t mpack_reader_flag_if_error(mpack_reader_t* reader, mp
  */
 size_t mpack_reader_remaining(mpack_reader_t* reader, const char** data);
 
+#if MPACK_STATS
+/**
+ * Returns the statistics counters of the reader.
+ *
+ * The reader counts calls to its fill function, the bytes they return,
+ * and the bytes it moves within its buffer to read data that straddles
+ * fills.
+ *
+ * @note This requires @ref MPACK_STATS.
+ * @see mpack_stats_t
+ */
+MPACK_INLINE const mpack_stats_t* mpack_reader_stats(mpack_reader_t* reader) {
+    return &reader->stats;
+}
+
+/**
+ * Resets the statistics counters of the reader to zero.
+ *
+ * @note This requires @ref MPACK_STATS.
+ */
+void mpack_reader_reset_stats(mpack_reader_t* reader);
+#endif
+
 /**
  * Reads a MessagePack object header (an MPack tag.)
  *
@@ -481,6 +630,63 @@ mpack_tag_t mpack_read_tag(mpack_reader_t* reader);
  */
 mpack_tag_t mpack_peek_tag(mpack_reader_t* reader);
 
+/**
+ * @}
+ */
+
+/**
+ * @name Checkpoints
+ *
+ * Checkpoints allow a reader on a non-blocking source to give up on a
+ * message when data runs out partway through it, and to read the whole
+ * message again from the start once more data has arrived.
+ *
+ * @code{.c}
+ * mpack_reader_checkpoint(&reader);
+ * handle_message(&reader); // any Reader or Expect API calls
+ * if (mpack_reader_rollback(&reader))
+ *     return; // wait until the socket is readable, then call this again
+ * if (mpack_reader_error(&reader) != mpack_ok)
+ *     ...
+ * @endcode
+ *
+ * @{
+ */
+
+/**
+ * Sets a checkpoint at the current position of the reader, which should be
+ * between top-level messages.
+ *
+ * Until the checkpoint is cleared or another is set, all data read after it
+ * is kept in the reader's buffer, rather than being read directly into the
+ * destination or skipped with the skip function. The rest of a message
+ * must therefore fit in the buffer or @ref mpack_error_too_big is flagged.
+ *
+ * Checkpoints are not supported on readers that borrow chunks (see
+ * mpack_reader_set_borrow().)
+ */
+void mpack_reader_checkpoint(mpack_reader_t* reader);
+
+/**
+ * Clears the reader's checkpoint, if any.
+ */
+MPACK_INLINE void mpack_reader_clear_checkpoint(mpack_reader_t* reader) {
+    reader->checkpoint = NULL;
+}
+
+/**
+ * Rolls the reader back to its last checkpoint if it is in the
+ * @ref mpack_error_would_block state.
+ *
+ * The error is cleared and the data read since the checkpoint (including
+ * any data filled before the fill function ran out) will be read again.
+ * The checkpoint remains set.
+ *
+ * @return true if the reader was rolled back, or false if it has no
+ *         checkpoint or is not in the mpack_error_would_block state.
+ */
+bool mpack_reader_rollback(mpack_reader_t* reader);
+
 /**
  * @}
  */
@@ -614,7 +820,8 @@ char* mpack_read_bytes_alloc_impl(mpack_reader_t* reader, size_t count, bool nul
  * storage for them and returning the allocated pointer.
  *
  * The allocated string must be freed with MPACK_FREE() (or simply free()
- * if MPack's allocator hasn't been customized.)
+ * if MPack's allocator hasn't been customized), or with the reader's
+ * allocator if one was set with mpack_reader_set_allocator().
  *
  * Returns NULL if any error occurs, or if count is zero.
  */
@@ -813,6 +1020,12 @@ MPACK_INLINE void mpack_done_ext(mpack_reader_t* reader) {
 /**
  * Reads and discards the next object. This will read and discard all
  * contained data as well if it is a compound type.
+ *
+ * The object is skipped by scanning its structure directly in the buffer
+ * without reading each of its tags, and payloads that extend past the
+ * buffer are skipped with the skip function if one is set. The contents are
+ * not checked beyond their structure; for example strings are not checked
+ * for valid UTF-8.
  */
 void mpack_discard(mpack_reader_t* reader);
 
@@ -23,6 +23,17 @@
 
 #include "mpack-writer.h"
 
+#if MPACK_WRITER && MPACK_DOUBLES
+#include <float.h>
+#endif
+
+#if MPACK_WRITER && MPACK_FD
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+
 #if MPACK_WRITER
 
 #if MPACK_WRITE_TRACKING
@@ -41,22 +52,189 @@ void mpack_writer_track_pop(mpack_writer_t* writer, mpack_type_t type) {
         mpack_writer_flag_if_error(writer, mpack_track_pop(&writer->track, type));
 }
 
-void mpack_writer_track_element(mpack_writer_t* writer) {
-    if (writer->error == mpack_ok)
-        mpack_writer_flag_if_error(writer, mpack_track_element(&writer->track, false));
-}
-
 void mpack_writer_track_bytes(mpack_writer_t* writer, size_t count) {
     if (writer->error == mpack_ok)
         mpack_writer_flag_if_error(writer, mpack_track_bytes(&writer->track, false, count));
 }
 #endif
 
+#if MPACK_BUILDER
+/*
+ * Builds are written into builder pages as a sequence of build records, each
+ * followed by the raw bytes that come after it. A record is the header of a
+ * map or array whose count is filled in as elements are written, or a
+ * continuation (type missing) for the bytes of the parent build that follow
+ * a completed nested build. When the outermost build completes, the records
+ * are replayed into the writer's own buffer as headers followed by their
+ * bytes.
+ */
+struct mpack_build_t {
+    mpack_build_t* parent;    /* The enclosing build, or NULL for the outermost */
+    uint64_t nested_elements; /* Elements still owed to maps/arrays of known size within this build */
+    size_t bytes;             /* Bytes of data following this record */
+    uint32_t count;           /* Elements (or key/value pairs) written to this build */
+    uint8_t type;             /* The mpack_type_t: map or array, or missing for a continuation */
+    bool key_needs_value;     /* A key has been written to this map without a value */
+};
+
+struct mpack_builder_page_t {
+    mpack_builder_page_t* next; /* The next page, or NULL */
+    size_t bytes_used;          /* Bytes used in this page including this header */
+};
+
+// Records are aligned within pages (which are themselves aligned, being
+// either allocated or stored in a union.)
+#define MPACK_BUILDER_ALIGNMENT 8
+
+MPACK_STATIC_INLINE size_t mpack_builder_align(size_t offset) {
+    return (offset + (MPACK_BUILDER_ALIGNMENT - 1)) & ~(size_t)(MPACK_BUILDER_ALIGNMENT - 1);
+}
+
+#define MPACK_BUILDER_PAGE_HEADER_SIZE \
+    ((sizeof(mpack_builder_page_t) + (MPACK_BUILDER_ALIGNMENT - 1)) & ~(size_t)(MPACK_BUILDER_ALIGNMENT - 1))
+
+MPACK_STATIC_INLINE size_t mpack_builder_page_size(mpack_writer_t* writer, mpack_builder_page_t* page) {
+    #if MPACK_BUILDER_INTERNAL_STORAGE
+    if ((char*)page == writer->builder.internal.bytes)
+        return MPACK_BUILDER_INTERNAL_STORAGE_SIZE;
+    #else
+    MPACK_UNUSED(writer);
+    MPACK_UNUSED(page);
+    #endif
+    return MPACK_BUILDER_PAGE_SIZE;
+}
+
+// Adds the bytes written since the last record or page flip to the latest
+// build record.
+MPACK_STATIC_INLINE void mpack_builder_commit_bytes(mpack_writer_t* writer) {
+    writer->builder.latest_build->bytes += (size_t)(writer->current - writer->buffer);
+    writer->buffer = writer->current;
+}
+
+MPACK_STATIC_INLINE void mpack_builder_set_page(mpack_writer_t* writer, mpack_builder_page_t* page) {
+    writer->builder.current_page = page;
+    writer->buffer = (char*)page + MPACK_BUILDER_PAGE_HEADER_SIZE;
+    writer->current = writer->buffer;
+    writer->end = (char*)page + mpack_builder_page_size(writer, page);
+}
+
+// Moves the build to the next page (allocating it if necessary), leaving
+// the rest of the current page unused.
+MPACK_NOINLINE static bool mpack_builder_flip_page(mpack_writer_t* writer) {
+    mpack_builder_t* builder = &writer->builder;
+    mpack_builder_page_t* page = builder->current_page;
+
+    mpack_builder_commit_bytes(writer);
+    page->bytes_used = (size_t)(writer->current - (char*)page);
+
+    mpack_builder_page_t* next = page->next;
+    if (next == NULL) {
+        #ifdef MPACK_MALLOC
+        MPACK_STATIC_ASSERT(MPACK_BUILDER_PAGE_SIZE >= MPACK_BUILDER_PAGE_HEADER_SIZE +
+                sizeof(mpack_build_t) + MPACK_WRITER_MINIMUM_BUFFER_SIZE,
+                "builder page size is too small!");
+        next = (mpack_builder_page_t*)mpack_allocator_alloc(&writer->allocator, MPACK_BUILDER_PAGE_SIZE);
+        if (next == NULL) {
+            mpack_writer_flag_error(writer, mpack_error_memory);
+            return false;
+        }
+        next->next = NULL;
+        page->next = next;
+        mpack_stats_add(&writer->stats, pages, 1);
+        #else
+        mpack_writer_flag_error(writer, mpack_error_too_big);
+        return false;
+        #endif
+    }
+
+    mpack_log("builder flipping from page %p to page %p\n", (void*)page, (void*)next);
+    mpack_builder_set_page(writer, next);
+    return true;
+}
+
+// Adds a new build record at the current position in the current page.
+static mpack_build_t* mpack_builder_add_record(mpack_writer_t* writer, mpack_type_t type) {
+    mpack_builder_t* builder = &writer->builder;
+    if (builder->latest_build != NULL)
+        mpack_builder_commit_bytes(writer);
+
+    size_t offset = mpack_builder_align((size_t)(writer->current - (char*)builder->current_page));
+    if (offset + sizeof(mpack_build_t) > mpack_builder_page_size(writer, builder->current_page)) {
+        if (!mpack_builder_flip_page(writer))
+            return NULL;
+        offset = MPACK_BUILDER_PAGE_HEADER_SIZE;
+    }
+
+    mpack_build_t* build = (mpack_build_t*)(void*)((char*)builder->current_page + offset);
+    build->parent = builder->current_build;
+    build->nested_elements = 0;
+    build->bytes = 0;
+    build->count = 0;
+    build->type = (uint8_t)type;
+    build->key_needs_value = false;
+
+    builder->latest_build = build;
+    writer->buffer = (char*)(build + 1);
+    writer->current = writer->buffer;
+    return build;
+}
+#endif
+
+// Tracks an element being written. With tracking, this checks it against the
+// open compound type; with a build in progress, it counts the element towards
+// the current build.
+MPACK_STATIC_INLINE void mpack_writer_track_element(mpack_writer_t* writer) {
+    #if MPACK_WRITE_TRACKING
+    if (writer->error == mpack_ok)
+        mpack_writer_flag_if_error(writer, mpack_track_element(&writer->track, false));
+    #endif
+
+    #if MPACK_BUILDER
+    mpack_build_t* build = writer->builder.current_build;
+    if (build != NULL) {
+        if (build->nested_elements > 0) {
+            --build->nested_elements;
+            return;
+        }
+        if (build->type == (uint8_t)mpack_type_map) {
+            build->key_needs_value = !build->key_needs_value;
+            if (build->key_needs_value)
+                return; // count pairs, not keys
+        }
+        if (build->count == UINT32_MAX) {
+            mpack_writer_flag_error(writer, mpack_error_too_big);
+            return;
+        }
+        ++build->count;
+    }
+    #endif
+
+    #if !MPACK_WRITE_TRACKING && !MPACK_BUILDER
+    MPACK_UNUSED(writer);
+    #endif
+}
+
+// Tracks the elements of a map or array of known size being started, so
+// that they are not counted as elements of the current build.
+MPACK_STATIC_INLINE void mpack_writer_track_nested(mpack_writer_t* writer, uint64_t elements) {
+    #if MPACK_BUILDER
+    mpack_build_t* build = writer->builder.current_build;
+    if (build != NULL)
+        build->nested_elements += elements;
+    #else
+    MPACK_UNUSED(writer);
+    MPACK_UNUSED(elements);
+    #endif
+}
+
 static void mpack_writer_clear(mpack_writer_t* writer) {
     #if MPACK_COMPATIBILITY
     writer->version = mpack_version_current;
     #endif
     writer->flush = NULL;
+    writer->flush_iov = NULL;
+    writer->submit = NULL;
+    writer->wait = NULL;
     writer->error_fn = NULL;
     writer->teardown = NULL;
     writer->context = NULL;
@@ -65,10 +243,32 @@ static void mpack_writer_clear(mpack_writer_t* writer) {
     writer->current = NULL;
     writer->end = NULL;
     writer->error = mpack_ok;
+    writer->spare = NULL;
+    writer->in_flight = false;
+    writer->compact_doubles = false;
+    writer->borrowed_count = 0;
+
+    #ifdef MPACK_MALLOC
+    mpack_memset(&writer->allocator, 0, sizeof(writer->allocator));
+    #endif
 
     #if MPACK_WRITE_TRACKING
     mpack_memset(&writer->track, 0, sizeof(writer->track));
     #endif
+
+    #if MPACK_STATS
+    mpack_memset(&writer->stats, 0, sizeof(writer->stats));
+    #endif
+
+    #if MPACK_BUILDER
+    writer->builder.current_build = NULL;
+    writer->builder.latest_build = NULL;
+    writer->builder.current_page = NULL;
+    writer->builder.pages = NULL;
+    writer->builder.stash_buffer = NULL;
+    writer->builder.stash_current = NULL;
+    writer->builder.stash_end = NULL;
+    #endif
 }
 
 void mpack_writer_init(mpack_writer_t* writer, char* buffer, size_t size) {
@@ -79,7 +279,7 @@ void mpack_writer_init(mpack_writer_t* writer, char* buffer, size_t size) {
     writer->end = writer->buffer + size;
 
     #if MPACK_WRITE_TRACKING
-    mpack_writer_flag_if_error(writer, mpack_track_init(&writer->track));
+    mpack_writer_flag_if_error(writer, mpack_track_init(&writer->track, &writer->allocator));
     #endif
 
     mpack_log("===========================\n");
@@ -108,6 +308,79 @@ void mpack_writer_set_flush(mpack_writer_t* writer, mpack_writer_flush_t flush)
     }
 
     writer->flush = flush;
+    writer->flush_iov = NULL;
+    writer->submit = NULL;
+    writer->wait = NULL;
+}
+
+// Adapts a single-span flush to the vectored flush function. This is only
+// used by code that calls the flush function directly (such as the teardown
+// flush of an intrusive flush); the writer itself gathers spans with
+// mpack_writer_flush_gather().
+static void mpack_writer_flush_iov_single(mpack_writer_t* writer, const char* buffer, size_t count) {
+    mpack_iovec_t iov;
+    iov.data = buffer;
+    iov.count = count;
+    writer->flush_iov(writer, &iov, 1);
+}
+
+void mpack_writer_set_flush_iov(mpack_writer_t* writer, mpack_writer_flush_iov_t flush_iov) {
+    mpack_assert(flush_iov != NULL, "vectored flush function cannot be NULL");
+    mpack_writer_set_flush(writer, mpack_writer_flush_iov_single);
+    if (writer->flush == mpack_writer_flush_iov_single)
+        writer->flush_iov = flush_iov;
+}
+
+// Waits for the flush in flight of an asynchronous writer, if any. Returns
+// false if an error is flagged.
+static bool mpack_writer_async_wait(mpack_writer_t* writer) {
+    if (writer->in_flight) {
+        mpack_log("waiting for in-flight async flush\n");
+        writer->wait(writer);
+        writer->in_flight = false;
+    }
+    return mpack_writer_error(writer) == mpack_ok;
+}
+
+// The flush function of an asynchronous writer. Like the growable writer's
+// flush, this is intrusive: rather than waiting for the buffer to be written,
+// it submits the buffer and swaps in the spare one.
+static void mpack_writer_async_flush(mpack_writer_t* writer, const char* data, size_t count) {
+    if (!mpack_writer_async_wait(writer) || count == 0)
+        return;
+
+    // data outside the buffer belongs to the caller, so it must be
+    // flushed before we return
+    if (data != writer->buffer) {
+        writer->in_flight = true;
+        writer->submit(writer, data, count);
+        mpack_writer_async_wait(writer);
+        return;
+    }
+
+    size_t size = mpack_writer_buffer_size(writer);
+    char* flushed = writer->buffer;
+    writer->in_flight = true;
+    writer->submit(writer, flushed, count);
+
+    // the submitted buffer is now in flight; we continue in the spare one
+    writer->buffer = writer->spare;
+    writer->current = writer->spare;
+    writer->end = writer->spare + size;
+    writer->spare = flushed;
+}
+
+void mpack_writer_set_async(mpack_writer_t* writer, char* spare,
+        mpack_writer_submit_t submit, mpack_writer_wait_t wait)
+{
+    mpack_assert(spare != NULL, "spare buffer cannot be NULL");
+    mpack_assert(submit != NULL && wait != NULL, "submit and wait functions cannot be NULL");
+    mpack_writer_set_flush(writer, mpack_writer_async_flush);
+    if (writer->flush == mpack_writer_async_flush) {
+        writer->spare = spare;
+        writer->submit = submit;
+        writer->wait = wait;
+    }
 }
 
 #ifdef MPACK_MALLOC
@@ -160,19 +433,29 @@ static void mpack_growable_writer_flush(mpack_writer_t* writer, const char* data
             (int)count, (int)mpack_writer_buffer_left(writer), (int)used, (int)size);
 
     // grow to fit the data
-    // TODO: this really needs to correctly test for overflow
-    size_t new_size = size * 2;
-    while (new_size < used + count)
+    if (count > SIZE_MAX - used) {
+        mpack_writer_flag_error(writer, mpack_error_memory);
+        return;
+    }
+    size_t new_size = size;
+    do {
+        if (new_size > SIZE_MAX / 2) {
+            mpack_writer_flag_error(writer, mpack_error_memory);
+            return;
+        }
         new_size *= 2;
+    } while (new_size < used + count);
 
     mpack_log("flush growing buffer size from %i to %i\n", (int)size, (int)new_size);
 
     // grow the buffer
-    char* new_buffer = (char*)mpack_realloc(writer->buffer, used, new_size);
+    char* new_buffer = (char*)mpack_allocator_realloc(&writer->allocator, writer->buffer, used, new_size);
     if (new_buffer == NULL) {
         mpack_writer_flag_error(writer, mpack_error_memory);
         return;
     }
+    mpack_stats_add(&writer->stats, growths, 1);
+    mpack_stats_add(&writer->stats, bytes_copied, used);
     writer->current = new_buffer + used;
     writer->buffer = new_buffer;
     writer->end = writer->buffer + new_size;
@@ -192,8 +475,10 @@ static void mpack_growable_writer_teardown(mpack_writer_t* writer) {
     if (mpack_writer_error(writer) == mpack_ok) {
 
         // shrink the buffer to an appropriate size if the data is
-        // much smaller than the buffer
-        if (mpack_writer_buffer_used(writer) < mpack_writer_buffer_size(writer) / 2) {
+        // much smaller than the buffer. (there's no point if the allocator
+        // never frees.)
+        bool frees = writer->allocator.alloc_fn == NULL || writer->allocator.free_fn != NULL;
+        if (frees && mpack_writer_buffer_used(writer) < mpack_writer_buffer_size(writer) / 2) {
             size_t used = mpack_writer_buffer_used(writer);
 
             // We always return a non-null pointer that must be freed, even if
@@ -201,9 +486,9 @@ static void mpack_growable_writer_teardown(mpack_writer_t* writer) {
             // do this so we enforce it ourselves.
             size_t size = (used != 0) ? used : 1;
 
-            char* buffer = (char*)mpack_realloc(writer->buffer, used, size);
+            char* buffer = (char*)mpack_allocator_realloc(&writer->allocator, writer->buffer, used, size);
             if (!buffer) {
-                MPACK_FREE(writer->buffer);
+                mpack_allocator_free(&writer->allocator, writer->buffer);
                 mpack_writer_flag_error(writer, mpack_error_memory);
                 return;
             }
@@ -216,7 +501,7 @@ static void mpack_growable_writer_teardown(mpack_writer_t* writer) {
         writer->buffer = NULL;
 
     } else if (writer->buffer) {
-        MPACK_FREE(writer->buffer);
+        mpack_allocator_free(&writer->allocator, writer->buffer);
         writer->buffer = NULL;
     }
 
@@ -248,6 +533,255 @@ void mpack_writer_init_growable(mpack_writer_t* writer, char** target_data, size
     mpack_writer_set_flush(writer, mpack_growable_writer_flush);
     mpack_writer_set_teardown(writer, mpack_growable_writer_teardown);
 }
+
+typedef struct mpack_chunked_writer_t {
+    mpack_chunks_t* chunks;
+    size_t next_size; // the size of the next chunk, unless more is needed
+} mpack_chunked_writer_t;
+
+// Keeps the first count bytes of the writer's buffer as a chunk, taking
+// ownership of the buffer. An empty buffer is freed rather than kept.
+static bool mpack_chunked_writer_keep(mpack_writer_t* writer, size_t count) {
+    mpack_chunked_writer_t* chunked_writer = (mpack_chunked_writer_t*)mpack_writer_get_reserved(writer);
+    mpack_chunks_t* chunks = chunked_writer->chunks;
+
+    if (count == 0) {
+        mpack_allocator_free(&writer->allocator, writer->buffer);
+    } else {
+        if (chunks->count == chunks->capacity) {
+            size_t capacity = (chunks->capacity == 0) ? 8 : chunks->capacity * 2;
+            mpack_iovec_t* iov = NULL;
+            if (chunks->iov == NULL)
+                iov = (mpack_iovec_t*)mpack_allocator_alloc(&writer->allocator, sizeof(mpack_iovec_t) * capacity);
+            else if (capacity <= SIZE_MAX / sizeof(mpack_iovec_t))
+                iov = (mpack_iovec_t*)mpack_allocator_realloc(&writer->allocator, chunks->iov,
+                        sizeof(mpack_iovec_t) * chunks->count, sizeof(mpack_iovec_t) * capacity);
+            if (iov == NULL) {
+                mpack_writer_flag_error(writer, mpack_error_memory);
+                return false;
+            }
+            chunks->iov = iov;
+            chunks->capacity = capacity;
+        }
+        chunks->iov[chunks->count].data = writer->buffer;
+        chunks->iov[chunks->count].count = count;
+        ++chunks->count;
+        chunks->size += count;
+    }
+
+    writer->buffer = NULL;
+    writer->current = NULL;
+    writer->end = NULL;
+    return true;
+}
+
+// Keeps the first count bytes of the writer's buffer as a chunk and starts a
+// new chunk with room for at least min_size bytes.
+static void mpack_chunked_writer_next(mpack_writer_t* writer, size_t count, size_t min_size) {
+    mpack_chunked_writer_t* chunked_writer = (mpack_chunked_writer_t*)mpack_writer_get_reserved(writer);
+    if (!mpack_chunked_writer_keep(writer, count))
+        return;
+
+    size_t size = chunked_writer->next_size;
+    if (size < min_size)
+        size = min_size;
+    if (chunked_writer->next_size < MPACK_WRITER_CHUNK_MAX_SIZE / 2)
+        chunked_writer->next_size *= 2;
+    else if (chunked_writer->next_size < MPACK_WRITER_CHUNK_MAX_SIZE)
+        chunked_writer->next_size = MPACK_WRITER_CHUNK_MAX_SIZE;
+
+    mpack_log("chunked writer starting chunk %i of size %i\n", (int)chunked_writer->chunks->count, (int)size);
+    char* buffer = (char*)mpack_allocator_alloc(&writer->allocator, size);
+    if (buffer == NULL) {
+        mpack_writer_flag_error(writer, mpack_error_memory);
+        return;
+    }
+    mpack_stats_add(&writer->stats, growths, 1);
+    writer->buffer = buffer;
+    writer->current = buffer;
+    writer->end = buffer + size;
+}
+
+static void mpack_chunked_writer_flush(mpack_writer_t* writer, const char* data, size_t count) {
+
+    // Like the growable writer's flush, this is intrusive. The same three
+    // cases apply, but rather than growing the buffer we keep it as a chunk
+    // and continue in a new one, so data is never moved.
+
+    if (data == writer->buffer) {
+
+        // teardown, do nothing
+        if (mpack_writer_buffer_used(writer) == count)
+            return;
+
+        mpack_chunked_writer_next(writer, count, 0);
+        return;
+    }
+
+    // fill the rest of the buffer with the extra data and start a chunk big
+    // enough for the remainder
+    size_t step = mpack_writer_buffer_left(writer);
+    if (step > count)
+        step = count;
+    if (step > 0) {
+        mpack_memcpy(writer->current, data, step);
+        writer->current += step;
+        data += step;
+        count -= step;
+    }
+    if (count == 0)
+        return;
+
+    mpack_chunked_writer_next(writer, mpack_writer_buffer_used(writer), count);
+    if (mpack_writer_error(writer) != mpack_ok)
+        return;
+    mpack_memcpy(writer->current, data, count);
+    writer->current += count;
+}
+
+static void mpack_chunked_writer_teardown(mpack_writer_t* writer) {
+    mpack_chunked_writer_t* chunked_writer = (mpack_chunked_writer_t*)mpack_writer_get_reserved(writer);
+    mpack_chunks_t* chunks = chunked_writer->chunks;
+
+    // keep the last chunk
+    if (mpack_writer_error(writer) == mpack_ok && writer->buffer != NULL)
+        mpack_chunked_writer_keep(writer, mpack_writer_buffer_used(writer));
+
+    if (writer->buffer != NULL) {
+        mpack_allocator_free(&writer->allocator, writer->buffer);
+        writer->buffer = NULL;
+    }
+
+    chunks->allocator = writer->allocator;
+    if (mpack_writer_error(writer) != mpack_ok)
+        mpack_chunks_destroy(chunks);
+    writer->context = NULL;
+}
+
+void mpack_writer_init_chunked(mpack_writer_t* writer, mpack_chunks_t* chunks) {
+    mpack_assert(chunks != NULL, "cannot initialize writer without a destination for the chunks");
+    mpack_memset(chunks, 0, sizeof(*chunks));
+
+    MPACK_STATIC_ASSERT(sizeof(mpack_chunked_writer_t) <= sizeof(writer->reserved),
+            "not enough reserved space for chunked writer!");
+    mpack_chunked_writer_t* chunked_writer = (mpack_chunked_writer_t*)mpack_writer_get_reserved(writer);
+
+    chunked_writer->chunks = chunks;
+    chunked_writer->next_size = MPACK_BUFFER_SIZE * 2;
+    if (chunked_writer->next_size > MPACK_WRITER_CHUNK_MAX_SIZE)
+        chunked_writer->next_size = MPACK_WRITER_CHUNK_MAX_SIZE;
+    if (chunked_writer->next_size < MPACK_BUFFER_SIZE)
+        chunked_writer->next_size = MPACK_BUFFER_SIZE;
+
+    size_t capacity = MPACK_BUFFER_SIZE;
+    char* buffer = (char*)MPACK_MALLOC(capacity);
+    if (buffer == NULL) {
+        mpack_writer_init_error(writer, mpack_error_memory);
+        return;
+    }
+
+    mpack_writer_init(writer, buffer, capacity);
+    mpack_writer_set_flush(writer, mpack_chunked_writer_flush);
+    mpack_writer_set_teardown(writer, mpack_chunked_writer_teardown);
+}
+
+char* mpack_chunks_coalesce(mpack_chunks_t* chunks, size_t* size) {
+    size_t total = chunks->size;
+    char* data;
+
+    if (chunks->count == 1) {
+        char* chunk = (char*)(uintptr_t)chunks->iov[0].data;
+        data = (char*)mpack_allocator_realloc(&chunks->allocator, chunk, total, total);
+        if (data == NULL)
+            return NULL;
+    } else {
+        // as with the growable writer, we never return NULL on success
+        data = (char*)mpack_allocator_alloc(&chunks->allocator, (total != 0) ? total : 1);
+        if (data == NULL)
+            return NULL;
+        size_t offset = 0;
+        size_t i;
+        for (i = 0; i < chunks->count; ++i) {
+            mpack_memcpy(data + offset, chunks->iov[i].data, chunks->iov[i].count);
+            offset += chunks->iov[i].count;
+            mpack_allocator_free(&chunks->allocator, (void*)(uintptr_t)chunks->iov[i].data);
+        }
+    }
+
+    chunks->count = 0;
+    mpack_chunks_destroy(chunks);
+    *size = total;
+    return data;
+}
+
+void mpack_chunks_destroy(mpack_chunks_t* chunks) {
+    size_t i;
+    for (i = 0; i < chunks->count; ++i)
+        mpack_allocator_free(&chunks->allocator, (void*)(uintptr_t)chunks->iov[i].data);
+    if (chunks->iov != NULL)
+        mpack_allocator_free(&chunks->allocator, chunks->iov);
+    chunks->iov = NULL;
+    chunks->count = 0;
+    chunks->capacity = 0;
+    chunks->size = 0;
+}
+
+#if MPACK_FD
+static bool mpack_fd_writer_move(mpack_writer_t* writer, const mpack_allocator_t* allocator);
+#endif
+
+void mpack_writer_set_allocator(mpack_writer_t* writer, const mpack_allocator_t* allocator) {
+    if (mpack_writer_error(writer) != mpack_ok)
+        return;
+
+    bool started = mpack_writer_buffer_used(writer) != 0;
+    #if MPACK_WRITE_TRACKING
+    started = started || writer->track.count != 0;
+    #endif
+    #if MPACK_BUILDER
+    started = started || writer->builder.pages != NULL;
+    #endif
+    if (started) {
+        mpack_break("cannot set the allocator after writing has started!");
+        mpack_writer_flag_error(writer, mpack_error_bug);
+        return;
+    }
+
+    mpack_allocator_t old_allocator = writer->allocator;
+    mpack_allocator_t new_allocator;
+    if (allocator != NULL)
+        new_allocator = *allocator;
+    else
+        mpack_memset(&new_allocator, 0, sizeof(new_allocator));
+
+    #if MPACK_FD
+    if (!mpack_fd_writer_move(writer, &new_allocator))
+        return;
+    #endif
+    writer->allocator = new_allocator;
+
+    // move anything allocated at init to the new allocator
+    #if MPACK_WRITE_TRACKING
+    mpack_track_t* track = &writer->track;
+    track->allocator = &old_allocator;
+    mpack_track_destroy(track, true);
+    mpack_writer_flag_if_error(writer, mpack_track_init(track, &writer->allocator));
+    #endif
+
+    if (writer->flush == mpack_growable_writer_flush || writer->flush == mpack_chunked_writer_flush) {
+        size_t size = mpack_writer_buffer_size(writer);
+        char* buffer = (char*)mpack_allocator_alloc(&writer->allocator, size);
+        mpack_allocator_free(&old_allocator, writer->buffer);
+        writer->buffer = buffer;
+        writer->current = buffer;
+        writer->end = buffer;
+        if (buffer == NULL) {
+            mpack_writer_flag_error(writer, mpack_error_memory);
+            return;
+        }
+        writer->end = buffer + size;
+    }
+}
 #endif
 
 #if MPACK_STDIO
@@ -310,6 +844,125 @@ void mpack_writer_init_filename(mpack_writer_t* writer, const char* filename) {
 }
 #endif
 
+#if MPACK_FD
+typedef struct mpack_fd_writer_t {
+    int fd;
+    bool close_when_done;
+} mpack_fd_writer_t;
+
+// The number of spans passed to each call to writev(). POSIX guarantees that
+// IOV_MAX is at least this.
+#define MPACK_FD_WRITER_IOV_MAX 16
+
+static void mpack_fd_writer_flush_iov(mpack_writer_t* writer, const mpack_iovec_t* iov, size_t iovcnt) {
+    mpack_fd_writer_t* fd_writer = (mpack_fd_writer_t*)writer->context;
+    size_t offset = 0; // bytes of iov[0] already written
+
+    while (true) {
+        while (iovcnt > 0 && offset == iov->count) {
+            ++iov;
+            --iovcnt;
+            offset = 0;
+        }
+        if (iovcnt == 0)
+            return;
+
+        struct iovec vec[MPACK_FD_WRITER_IOV_MAX];
+        int count = 0;
+        for (; count < MPACK_FD_WRITER_IOV_MAX && (size_t)count < iovcnt; ++count) {
+            size_t skipped = (count == 0) ? offset : 0;
+            vec[count].iov_base = (void*)(uintptr_t)(iov[count].data + skipped);
+            vec[count].iov_len = iov[count].count - skipped;
+        }
+
+        ssize_t ret = writev(fd_writer->fd, vec, count);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret <= 0) {
+            mpack_writer_flag_error(writer, mpack_error_io);
+            return;
+        }
+
+        // advance past what was written, which may end partway through a span
+        size_t written = (size_t)ret;
+        while (written > 0) {
+            size_t left = iov->count - offset;
+            if (written < left) {
+                offset += written;
+                break;
+            }
+            written -= left;
+            ++iov;
+            --iovcnt;
+            offset = 0;
+        }
+    }
+}
+
+static void mpack_fd_writer_teardown(mpack_writer_t* writer) {
+    mpack_fd_writer_t* fd_writer = (mpack_fd_writer_t*)writer->context;
+
+    if (fd_writer->close_when_done && close(fd_writer->fd) != 0)
+        mpack_writer_flag_error(writer, mpack_error_io);
+
+    // the buffer is allocated along with the context
+    mpack_allocator_free(&writer->allocator, fd_writer);
+    writer->buffer = NULL;
+    writer->context = NULL;
+}
+
+// Moves the context and buffer of a file descriptor writer to the given
+// allocator. Returns false if the writer is placed in an error state. Other
+// writers are left alone. Nothing has been written, so the buffer is empty.
+static bool mpack_fd_writer_move(mpack_writer_t* writer, const mpack_allocator_t* allocator) {
+    if (writer->teardown != mpack_fd_writer_teardown)
+        return true;
+
+    size_t size = mpack_writer_buffer_size(writer);
+    mpack_fd_writer_t* fd_writer = (mpack_fd_writer_t*)mpack_allocator_alloc(allocator,
+            sizeof(mpack_fd_writer_t) + size);
+    if (fd_writer == NULL) {
+        mpack_writer_flag_error(writer, mpack_error_memory);
+        return false;
+    }
+    *fd_writer = *(mpack_fd_writer_t*)writer->context;
+    mpack_allocator_free(&writer->allocator, writer->context);
+
+    writer->context = fd_writer;
+    writer->buffer = (char*)(fd_writer + 1);
+    writer->current = writer->buffer;
+    writer->end = writer->buffer + size;
+    return true;
+}
+
+void mpack_writer_init_fd(mpack_writer_t* writer, int fd, size_t buffer_size, bool close_when_done) {
+    mpack_assert(fd >= 0, "fd is invalid");
+    if (buffer_size == 0)
+        buffer_size = MPACK_FD_BUFFER_SIZE;
+
+    mpack_fd_writer_t* fd_writer = (mpack_fd_writer_t*)MPACK_MALLOC(sizeof(mpack_fd_writer_t) + buffer_size);
+    if (fd_writer == NULL) {
+        mpack_writer_init_error(writer, mpack_error_memory);
+        if (close_when_done)
+            close(fd);
+        return;
+    }
+    fd_writer->fd = fd;
+    fd_writer->close_when_done = close_when_done;
+
+    mpack_writer_init(writer, (char*)(fd_writer + 1), buffer_size);
+    mpack_writer_set_context(writer, fd_writer);
+    mpack_writer_set_flush_iov(writer, mpack_fd_writer_flush_iov);
+    mpack_writer_set_teardown(writer, mpack_fd_writer_teardown);
+}
+#endif
+
+#if MPACK_STATS
+void mpack_writer_reset_stats(mpack_writer_t* writer) {
+    mpack_memset(&writer->stats, 0, sizeof(writer->stats));
+}
+#endif
+
 void mpack_writer_flag_error(mpack_writer_t* writer, mpack_error_t error) {
     mpack_log("writer %p setting error %i: %s\n", (void*)writer, (int)error, mpack_error_to_string(error));
 
@@ -320,12 +973,66 @@ void mpack_writer_flag_error(mpack_writer_t* writer, mpack_error_t error) {
     }
 }
 
+// Flushes the buffer interleaved with any borrowed data, followed by the
+// given extra data, in a single call to the vectored flush function.
+static void mpack_writer_flush_gather(mpack_writer_t* writer, const char* extra, size_t extra_count) {
+    mpack_iovec_t iov[MPACK_WRITER_BORROWED_MAX * 2 + 2];
+    size_t iovcnt = 0;
+    size_t offset = 0;
+    size_t used = mpack_writer_buffer_used(writer);
+
+    size_t i;
+    for (i = 0; i < writer->borrowed_count; ++i) {
+        size_t borrowed_offset = writer->borrowed[i].offset;
+        if (borrowed_offset > offset) {
+            iov[iovcnt].data = writer->buffer + offset;
+            iov[iovcnt].count = borrowed_offset - offset;
+            ++iovcnt;
+            offset = borrowed_offset;
+        }
+        iov[iovcnt].data = writer->borrowed[i].data;
+        iov[iovcnt].count = writer->borrowed[i].count;
+        ++iovcnt;
+    }
+
+    if (used > offset) {
+        iov[iovcnt].data = writer->buffer + offset;
+        iov[iovcnt].count = used - offset;
+        ++iovcnt;
+    }
+
+    if (extra_count > 0) {
+        iov[iovcnt].data = extra;
+        iov[iovcnt].count = extra_count;
+        ++iovcnt;
+    }
+
+    mpack_log("gathering flush of %i spans\n", (int)iovcnt);
+    writer->current = writer->buffer;
+    writer->borrowed_count = 0;
+    if (iovcnt > 0) {
+        #if MPACK_STATS
+        for (i = 0; i < iovcnt; ++i)
+            mpack_stats_add(&writer->stats, bytes, iov[i].count);
+        mpack_stats_add(&writer->stats, flushes, 1);
+        #endif
+        writer->flush_iov(writer, iov, iovcnt);
+    }
+}
+
 MPACK_STATIC_INLINE void mpack_writer_flush_unchecked(mpack_writer_t* writer) {
+    if (writer->flush_iov != NULL) {
+        mpack_writer_flush_gather(writer, NULL, 0);
+        return;
+    }
+
     // This is a bit ugly; we reset used before calling flush so that
     // a flush function can distinguish between flushing the buffer
     // versus flushing external data. see mpack_growable_writer_flush()
     size_t used = mpack_writer_buffer_used(writer);
     writer->current = writer->buffer;
+    mpack_stats_add(&writer->stats, flushes, 1);
+    mpack_stats_add(&writer->stats, bytes, used);
     writer->flush(writer, writer->buffer, used);
 }
 
@@ -339,13 +1046,21 @@ void mpack_writer_flush_message(mpack_writer_t* writer) {
         return;
     #endif
 
+    #if MPACK_BUILDER
+    if (writer->builder.current_build != NULL) {
+        mpack_break("cannot call mpack_writer_flush_message() while there are elements open in a builder!");
+        mpack_writer_flag_error(writer, mpack_error_bug);
+        return;
+    }
+    #endif
+
     if (writer->flush == NULL) {
         mpack_break("cannot call mpack_writer_flush_message() without a flush function!");
         mpack_writer_flag_error(writer, mpack_error_bug);
         return;
     }
 
-    if (mpack_writer_buffer_used(writer) > 0)
+    if (mpack_writer_buffer_used(writer) > 0 || writer->borrowed_count > 0)
         mpack_writer_flush_unchecked(writer);
 }
 
@@ -366,6 +1081,12 @@ MPACK_NOINLINE static bool mpack_writer_ensure(mpack_writer_t* writer, size_t co
     if (mpack_writer_error(writer) != mpack_ok)
         return false;
 
+    // a new builder page always has room for the minimum buffer size
+    #if MPACK_BUILDER
+    if (writer->builder.current_build != NULL)
+        return mpack_builder_flip_page(writer);
+    #endif
+
     if (writer->flush == NULL) {
         mpack_writer_flag_error(writer, mpack_error_too_big);
         return false;
@@ -398,12 +1119,37 @@ MPACK_NOINLINE static void mpack_write_native_straddle(mpack_writer_t* writer, c
             "space in buffer. should have called mpack_write_native() instead",
             (int)count, (int)(mpack_writer_buffer_left(writer)));
 
+    // while building, the data is split across builder pages
+    #if MPACK_BUILDER
+    if (writer->builder.current_build != NULL) {
+        while (count > 0) {
+            if (mpack_writer_buffer_left(writer) == 0 && !mpack_builder_flip_page(writer))
+                return;
+            size_t step = count;
+            if (step > mpack_writer_buffer_left(writer))
+                step = mpack_writer_buffer_left(writer);
+            mpack_memcpy(writer->current, p, step);
+            writer->current += step;
+            p += step;
+            count -= step;
+        }
+        return;
+    }
+    #endif
+
     // we'll need a flush function
     if (!writer->flush) {
         mpack_writer_flag_error(writer, mpack_error_too_big);
         return;
     }
 
+    // a vectored flush can take data that doesn't fit in the buffer
+    // along with the buffer itself, so we don't need to copy it
+    if (writer->flush_iov != NULL && count > mpack_writer_buffer_size(writer)) {
+        mpack_writer_flush_gather(writer, p, count);
+        return;
+    }
+
     // flush the buffer
     mpack_writer_flush_unchecked(writer);
     if (mpack_writer_error(writer) != mpack_ok)
@@ -415,6 +1161,8 @@ MPACK_NOINLINE static void mpack_write_native_straddle(mpack_writer_t* writer, c
 
     // flush the extra data directly if it doesn't fit in the buffer
     if (count > mpack_writer_buffer_left(writer)) {
+        mpack_stats_add(&writer->stats, flushes, 1);
+        mpack_stats_add(&writer->stats, bytes, count);
         writer->flush(writer, p, count);
         if (mpack_writer_error(writer) != mpack_ok)
             return;
@@ -443,12 +1191,55 @@ mpack_error_t mpack_writer_destroy(mpack_writer_t* writer) {
     mpack_track_destroy(&writer->track, writer->error != mpack_ok);
     #endif
 
+    // restore the writer's buffer if a build is incomplete, and free the
+    // builder pages
+    #if MPACK_BUILDER
+    mpack_builder_t* builder = &writer->builder;
+    if (builder->current_build != NULL) {
+        if (mpack_writer_error(writer) == mpack_ok) {
+            mpack_break("writer cannot be destroyed with an incomplete builder unless "
+                    "an error was flagged!");
+            mpack_writer_flag_error(writer, mpack_error_bug);
+        }
+        writer->buffer = builder->stash_buffer;
+        writer->current = builder->stash_current;
+        writer->end = builder->stash_end;
+        builder->current_build = NULL;
+    }
+    #ifdef MPACK_MALLOC
+    mpack_builder_page_t* page = builder->pages;
+    #if MPACK_BUILDER_INTERNAL_STORAGE
+    if (page != NULL)
+        page = page->next; // the first page is internal
+    #endif
+    while (page != NULL) {
+        mpack_builder_page_t* next = page->next;
+        mpack_allocator_free(&writer->allocator, page);
+        page = next;
+    }
+    #endif
+    builder->pages = NULL;
+    #endif
+
     // flush any outstanding data
-    if (mpack_writer_error(writer) == mpack_ok && mpack_writer_buffer_used(writer) != 0 && writer->flush != NULL) {
+    if (mpack_writer_error(writer) == mpack_ok && writer->flush_iov != NULL) {
+        mpack_writer_flush_gather(writer, NULL, 0);
+        writer->flush = NULL;
+        writer->flush_iov = NULL;
+    } else if (mpack_writer_error(writer) == mpack_ok && mpack_writer_buffer_used(writer) != 0 && writer->flush != NULL) {
+        mpack_stats_add(&writer->stats, flushes, 1);
+        mpack_stats_add(&writer->stats, bytes, mpack_writer_buffer_used(writer));
         writer->flush(writer, writer->buffer, mpack_writer_buffer_used(writer));
         writer->flush = NULL;
     }
 
+    // the buffers of an async writer can't be released until the last
+    // flush completes
+    if (writer->in_flight) {
+        writer->wait(writer);
+        writer->in_flight = false;
+    }
+
     if (writer->teardown) {
         writer->teardown(writer);
         writer->teardown = NULL;
@@ -799,9 +1590,7 @@ void mpack_write_u32(mpack_writer_t* writer, uint32_t value) {
     #endif
 }
 
-void mpack_write_u64(mpack_writer_t* writer, uint64_t value) {
-    mpack_writer_track_element(writer);
-
+MPACK_STATIC_INLINE void mpack_write_u64_notrack(mpack_writer_t* writer, uint64_t value) {
     if (value <= 127) {
         MPACK_WRITE_ENCODED(mpack_encode_fixuint, MPACK_TAG_SIZE_FIXUINT, (uint8_t)value);
     } else if (value <= UINT8_MAX) {
@@ -815,6 +1604,11 @@ void mpack_write_u64(mpack_writer_t* writer, uint64_t value) {
     }
 }
 
+void mpack_write_u64(mpack_writer_t* writer, uint64_t value) {
+    mpack_writer_track_element(writer);
+    mpack_write_u64_notrack(writer, value);
+}
+
 void mpack_write_i8(mpack_writer_t* writer, int8_t value) {
     #if MPACK_OPTIMIZE_FOR_SIZE
     mpack_write_i64(writer, value);
@@ -877,16 +1671,15 @@ void mpack_write_i32(mpack_writer_t* writer, int32_t value) {
     #endif
 }
 
-void mpack_write_i64(mpack_writer_t* writer, int64_t value) {
+MPACK_STATIC_INLINE void mpack_write_i64_notrack(mpack_writer_t* writer, int64_t value) {
     #if MPACK_OPTIMIZE_FOR_SIZE
     if (value > 127) {
         // for non-fix positive ints we call the u64 writer to save space
-        mpack_write_u64(writer, (uint64_t)value);
+        mpack_write_u64_notrack(writer, (uint64_t)value);
         return;
     }
     #endif
 
-    mpack_writer_track_element(writer);
     if (value >= -32) {
         #if MPACK_OPTIMIZE_FOR_SIZE
         MPACK_WRITE_ENCODED(mpack_encode_fixint, MPACK_TAG_SIZE_FIXINT, (int8_t)value);
@@ -914,14 +1707,76 @@ void mpack_write_i64(mpack_writer_t* writer, int64_t value) {
     }
 }
 
+void mpack_write_i64(mpack_writer_t* writer, int64_t value) {
+    mpack_writer_track_element(writer);
+    mpack_write_i64_notrack(writer, value);
+}
+
 void mpack_write_float(mpack_writer_t* writer, float value) {
     mpack_writer_track_element(writer);
     MPACK_WRITE_ENCODED(mpack_encode_float, MPACK_TAG_SIZE_FLOAT, value);
 }
 
+#if MPACK_DOUBLES
+// Writes a double in the smallest encoding that reads back as exactly the
+// same value, without tracking it. See mpack_writer_set_compact_doubles().
+static void mpack_write_double_compact_notrack(mpack_writer_t* writer, double value) {
+    union {
+        double d;
+        uint64_t u;
+    } bits, narrowed;
+    bits.d = value;
+
+    // integral values are written as ints if that's smaller than a float,
+    // or if they're too precise for a float. ints wider than 32 bits are no
+    // smaller than doubles. negative zero must keep its sign.
+    size_t int_size = 0;
+    if (value >= -2147483648.0 && value <= 4294967295.0 &&
+            value == (double)(int64_t)value && bits.u != UINT64_C(0x8000000000000000))
+    {
+        int64_t i = (int64_t)value;
+        if (i >= 0)
+            int_size = (i <= 127) ? MPACK_TAG_SIZE_FIXUINT : (i <= UINT8_MAX) ? MPACK_TAG_SIZE_U8 :
+                    (i <= UINT16_MAX) ? MPACK_TAG_SIZE_U16 : MPACK_TAG_SIZE_U32;
+        else
+            int_size = (i >= -32) ? MPACK_TAG_SIZE_FIXINT : (i >= INT8_MIN) ? MPACK_TAG_SIZE_I8 :
+                    (i >= INT16_MIN) ? MPACK_TAG_SIZE_I16 : MPACK_TAG_SIZE_I32;
+        if (int_size < MPACK_TAG_SIZE_FLOAT) {
+            mpack_stats_add(&writer->stats, bytes_saved, MPACK_TAG_SIZE_DOUBLE - int_size);
+            mpack_write_i64_notrack(writer, i);
+            return;
+        }
+    }
+
+    // the range check excludes infinities and NaNs, and avoids undefined
+    // conversions of values out of range of a float
+    if (value >= -FLT_MAX && value <= FLT_MAX) {
+        float f = (float)value;
+        narrowed.d = (double)f;
+        if (narrowed.u == bits.u) {
+            mpack_stats_add(&writer->stats, bytes_saved, MPACK_TAG_SIZE_DOUBLE - MPACK_TAG_SIZE_FLOAT);
+            MPACK_WRITE_ENCODED(mpack_encode_float, MPACK_TAG_SIZE_FLOAT, f);
+            return;
+        }
+    }
+
+    if (int_size != 0) {
+        mpack_stats_add(&writer->stats, bytes_saved, MPACK_TAG_SIZE_DOUBLE - int_size);
+        mpack_write_i64_notrack(writer, (int64_t)value);
+        return;
+    }
+
+    MPACK_WRITE_ENCODED(mpack_encode_double, MPACK_TAG_SIZE_DOUBLE, value);
+}
+#endif
+
 void mpack_write_double(mpack_writer_t* writer, double value) {
     mpack_writer_track_element(writer);
     #if MPACK_DOUBLES
+    if (writer->compact_doubles) {
+        mpack_write_double_compact_notrack(writer, value);
+        return;
+    }
     MPACK_WRITE_ENCODED(mpack_encode_double, MPACK_TAG_SIZE_DOUBLE, value);
     #else
     MPACK_WRITE_ENCODED(mpack_encode_float, MPACK_TAG_SIZE_FLOAT, (float)value);
@@ -956,9 +1811,7 @@ void mpack_write_timestamp(mpack_writer_t* writer, int64_t seconds, uint32_t nan
 }
 #endif
 
-void mpack_start_array(mpack_writer_t* writer, uint32_t count) {
-    mpack_writer_track_element(writer);
-
+static void mpack_start_array_notrack(mpack_writer_t* writer, uint32_t count) {
     if (count <= 15) {
         MPACK_WRITE_ENCODED(mpack_encode_fixarray, MPACK_TAG_SIZE_FIXARRAY, (uint8_t)count);
     } else if (count <= UINT16_MAX) {
@@ -966,13 +1819,9 @@ void mpack_start_array(mpack_writer_t* writer, uint32_t count) {
     } else {
         MPACK_WRITE_ENCODED(mpack_encode_array32, MPACK_TAG_SIZE_ARRAY32, (uint32_t)count);
     }
-
-    mpack_writer_track_push(writer, mpack_type_array, count);
 }
 
-void mpack_start_map(mpack_writer_t* writer, uint32_t count) {
-    mpack_writer_track_element(writer);
-
+static void mpack_start_map_notrack(mpack_writer_t* writer, uint32_t count) {
     if (count <= 15) {
         MPACK_WRITE_ENCODED(mpack_encode_fixmap, MPACK_TAG_SIZE_FIXMAP, (uint8_t)count);
     } else if (count <= UINT16_MAX) {
@@ -980,10 +1829,400 @@ void mpack_start_map(mpack_writer_t* writer, uint32_t count) {
     } else {
         MPACK_WRITE_ENCODED(mpack_encode_map32, MPACK_TAG_SIZE_MAP32, (uint32_t)count);
     }
+}
+
+void mpack_start_array(mpack_writer_t* writer, uint32_t count) {
+    mpack_writer_track_element(writer);
+    mpack_start_array_notrack(writer, count);
+    mpack_writer_track_nested(writer, count);
+    mpack_writer_track_push(writer, mpack_type_array, count);
+}
 
+void mpack_start_map(mpack_writer_t* writer, uint32_t count) {
+    mpack_writer_track_element(writer);
+    mpack_start_map_notrack(writer, count);
+    mpack_writer_track_nested(writer, (uint64_t)count * 2);
     mpack_writer_track_push(writer, mpack_type_map, count);
 }
 
+// The number of ints classified together by the mpack_write_array_*()
+// functions.
+#define MPACK_WRITER_ARRAY_BLOCK 16
+
+// Starts an array to be written by the mpack_write_array_*() functions and
+// tracks all of its elements up front, so they can be encoded in bulk.
+static bool mpack_write_array_start(mpack_writer_t* writer, uint32_t count) {
+    mpack_start_array(writer, count);
+
+    #if MPACK_WRITE_TRACKING
+    uint32_t i;
+    for (i = 0; i < count && writer->error == mpack_ok; ++i)
+        mpack_writer_flag_if_error(writer, mpack_track_element(&writer->track, false));
+    #endif
+
+    #if MPACK_BUILDER
+    // the elements were counted as nested by mpack_start_array()
+    mpack_build_t* build = writer->builder.current_build;
+    if (build != NULL && writer->error == mpack_ok)
+        build->nested_elements -= count;
+    #endif
+
+    return writer->error == mpack_ok;
+}
+
+// Returns the number of elements of the given encoded size (at most count)
+// that can be encoded directly into the buffer, flushing if none fit. Returns
+// 0 if an error occurs.
+MPACK_STATIC_INLINE size_t mpack_write_array_fit(mpack_writer_t* writer, size_t size, size_t count) {
+    if (mpack_writer_buffer_left(writer) < size && !mpack_writer_ensure(writer, size))
+        return 0;
+    size_t fit = mpack_writer_buffer_left(writer) / size;
+    return fit < count ? fit : count;
+}
+
+// Returns the tag of the smallest encoding of an int, or 0 for a fixint.
+// These match mpack_write_u64() and mpack_write_i64(). Each tag covers a
+// contiguous range of values, so if the smallest and largest ints in a block
+// have the same tag, every int in the block has it.
+MPACK_STATIC_INLINE uint8_t mpack_write_array_tag_u64(uint64_t value) {
+    if (value <= 127)
+        return 0;
+    if (value <= UINT8_MAX)
+        return 0xcc;
+    if (value <= UINT16_MAX)
+        return 0xcd;
+    if (value <= UINT32_MAX)
+        return 0xce;
+    return 0xcf;
+}
+
+MPACK_STATIC_INLINE uint8_t mpack_write_array_tag_i64(int64_t value) {
+    if (value >= -32)
+        return mpack_write_array_tag_u64(value <= 127 ? 0 : (uint64_t)value);
+    if (value >= INT8_MIN)
+        return 0xd0;
+    if (value >= INT16_MIN)
+        return 0xd1;
+    if (value >= INT32_MIN)
+        return 0xd2;
+    return 0xd3;
+}
+
+// Writes a run of ints that all have the given tag from their two's
+// complement bits. The tag fixes the encoded size, so each loop encodes
+// as many ints as fit in the buffer without branching on their values.
+static void mpack_write_array_run(mpack_writer_t* writer, const uint64_t* bits, size_t count, uint8_t tag) {
+    // the low bits of each int tag give its width (0xcc/0xd0 are 1 byte,
+    // 0xcd/0xd1 are 2 bytes, and so on)
+    size_t size = (tag == 0) ? 1 : 1 + ((size_t)1 << (tag & 3));
+
+    while (count > 0) {
+        size_t fit = mpack_write_array_fit(writer, size, count);
+        if (fit == 0)
+            return;
+
+        char* p = writer->current;
+        size_t i;
+        switch (size) {
+            case 1:
+                for (i = 0; i < fit; ++i)
+                    mpack_store_u8(p + i, (uint8_t)bits[i]);
+                break;
+            case 2:
+                for (i = 0; i < fit; ++i, p += 2) {
+                    mpack_store_u8(p, tag);
+                    mpack_store_u8(p + 1, (uint8_t)bits[i]);
+                }
+                break;
+            case 3:
+                for (i = 0; i < fit; ++i, p += 3) {
+                    mpack_store_u8(p, tag);
+                    mpack_store_u16(p + 1, (uint16_t)bits[i]);
+                }
+                break;
+            case 5:
+                for (i = 0; i < fit; ++i, p += 5) {
+                    mpack_store_u8(p, tag);
+                    mpack_store_u32(p + 1, (uint32_t)bits[i]);
+                }
+                break;
+            default:
+                for (i = 0; i < fit; ++i, p += 9) {
+                    mpack_store_u8(p, tag);
+                    mpack_store_u64(p + 1, bits[i]);
+                }
+                break;
+        }
+
+        writer->current += fit * size;
+        bits += fit;
+        count -= fit;
+    }
+}
+
+// Writes the elements of an int array in blocks. Each block is classified by
+// its smallest and largest values; blocks whose ints all share an encoding
+// are written as a run, and the rest are written one int at a time.
+#define MPACK_WRITE_ARRAY_INTS(type, values, count, tag_fn, write_fn) do { \
+    uint64_t bits[MPACK_WRITER_ARRAY_BLOCK];                                \
+    while (count > 0 && mpack_writer_error(writer) == mpack_ok) {          \
+        size_t n = (count < MPACK_WRITER_ARRAY_BLOCK) ?                     \
+                count : MPACK_WRITER_ARRAY_BLOCK;                           \
+        type lo = values[0];                                                \
+        type hi = values[0];                                                \
+        size_t i;                                                           \
+        for (i = 0; i < n; ++i) {                                           \
+            bits[i] = (uint64_t)values[i];                                  \
+            lo = (values[i] < lo) ? values[i] : lo;                         \
+            hi = (values[i] > hi) ? values[i] : hi;                         \
+        }                                                                   \
+        uint8_t tag = tag_fn(lo);                                           \
+        if (tag == tag_fn(hi)) {                                            \
+            mpack_write_array_run(writer, bits, n, tag);                    \
+        } else {                                                            \
+            for (i = 0; i < n; ++i)                                         \
+                write_fn(writer, values[i]);                                \
+        }                                                                   \
+        values += n;                                                        \
+        count -= (uint32_t)n;                                               \
+    }                                                                       \
+} while (0)
+
+void mpack_write_array_u32(mpack_writer_t* writer, const uint32_t* values, uint32_t count) {
+    if (!mpack_write_array_start(writer, count))
+        return;
+    MPACK_WRITE_ARRAY_INTS(uint32_t, values, count, mpack_write_array_tag_u64, mpack_write_u64_notrack);
+    mpack_finish_array(writer);
+}
+
+void mpack_write_array_u64(mpack_writer_t* writer, const uint64_t* values, uint32_t count) {
+    if (!mpack_write_array_start(writer, count))
+        return;
+    MPACK_WRITE_ARRAY_INTS(uint64_t, values, count, mpack_write_array_tag_u64, mpack_write_u64_notrack);
+    mpack_finish_array(writer);
+}
+
+void mpack_write_array_i32(mpack_writer_t* writer, const int32_t* values, uint32_t count) {
+    if (!mpack_write_array_start(writer, count))
+        return;
+    MPACK_WRITE_ARRAY_INTS(int32_t, values, count, mpack_write_array_tag_i64, mpack_write_i64_notrack);
+    mpack_finish_array(writer);
+}
+
+void mpack_write_array_i64(mpack_writer_t* writer, const int64_t* values, uint32_t count) {
+    if (!mpack_write_array_start(writer, count))
+        return;
+    MPACK_WRITE_ARRAY_INTS(int64_t, values, count, mpack_write_array_tag_i64, mpack_write_i64_notrack);
+    mpack_finish_array(writer);
+}
+
+void mpack_write_array_float(mpack_writer_t* writer, const float* values, uint32_t count) {
+    if (!mpack_write_array_start(writer, count))
+        return;
+    while (count > 0) {
+        size_t fit = mpack_write_array_fit(writer, MPACK_TAG_SIZE_FLOAT, count);
+        if (fit == 0)
+            return;
+        size_t i;
+        for (i = 0; i < fit; ++i, writer->current += MPACK_TAG_SIZE_FLOAT)
+            mpack_encode_float(writer->current, values[i]);
+        values += fit;
+        count -= (uint32_t)fit;
+    }
+    mpack_finish_array(writer);
+}
+
+void mpack_write_array_double(mpack_writer_t* writer, const double* values, uint32_t count) {
+    #if MPACK_DOUBLES
+    const size_t size = MPACK_TAG_SIZE_DOUBLE;
+    #else
+    const size_t size = MPACK_TAG_SIZE_FLOAT;
+    #endif
+
+    if (!mpack_write_array_start(writer, count))
+        return;
+
+    // compact doubles vary in size, so they're written one at a time
+    #if MPACK_DOUBLES
+    if (writer->compact_doubles) {
+        for (; count > 0; ++values, --count)
+            mpack_write_double_compact_notrack(writer, *values);
+        mpack_finish_array(writer);
+        return;
+    }
+    #endif
+
+    while (count > 0) {
+        size_t fit = mpack_write_array_fit(writer, size, count);
+        if (fit == 0)
+            return;
+        size_t i;
+        for (i = 0; i < fit; ++i, writer->current += size) {
+            #if MPACK_DOUBLES
+            mpack_encode_double(writer->current, values[i]);
+            #else
+            mpack_encode_float(writer->current, (float)values[i]);
+            #endif
+        }
+        values += fit;
+        count -= (uint32_t)fit;
+    }
+    mpack_finish_array(writer);
+}
+
+#if MPACK_BUILDER
+static void mpack_builder_build(mpack_writer_t* writer, mpack_type_t type) {
+    mpack_writer_track_element(writer);
+    #if MPACK_WRITE_TRACKING
+    if (writer->error == mpack_ok)
+        mpack_writer_flag_if_error(writer, mpack_track_push_builder(&writer->track, type));
+    #endif
+    if (mpack_writer_error(writer) != mpack_ok)
+        return;
+
+    mpack_builder_t* builder = &writer->builder;
+    if (builder->current_build == NULL) {
+
+        // get the first page
+        mpack_builder_page_t* page = builder->pages;
+        if (page == NULL) {
+            #if MPACK_BUILDER_INTERNAL_STORAGE
+            MPACK_STATIC_ASSERT(MPACK_BUILDER_INTERNAL_STORAGE_SIZE >= MPACK_BUILDER_PAGE_HEADER_SIZE +
+                    sizeof(mpack_build_t) + MPACK_WRITER_MINIMUM_BUFFER_SIZE,
+                    "builder internal storage size is too small!");
+            page = (mpack_builder_page_t*)(void*)builder->internal.bytes;
+            #else
+            page = (mpack_builder_page_t*)mpack_allocator_alloc(&writer->allocator, MPACK_BUILDER_PAGE_SIZE);
+            if (page == NULL) {
+                mpack_writer_flag_error(writer, mpack_error_memory);
+                return;
+            }
+            mpack_stats_add(&writer->stats, pages, 1);
+            #endif
+            page->next = NULL;
+            builder->pages = page;
+        }
+
+        // stash the writer's buffer and write into the pages instead
+        builder->stash_buffer = writer->buffer;
+        builder->stash_current = writer->current;
+        builder->stash_end = writer->end;
+        builder->latest_build = NULL;
+        mpack_builder_set_page(writer, page);
+    }
+
+    mpack_build_t* build = mpack_builder_add_record(writer, type);
+    if (build != NULL)
+        builder->current_build = build;
+}
+
+// Writes all completed builds to the writer's own buffer.
+static void mpack_builder_resolve(mpack_writer_t* writer) {
+    mpack_builder_t* builder = &writer->builder;
+    mpack_builder_page_t* last_page = builder->current_page;
+    last_page->bytes_used = (size_t)(writer->current - (char*)last_page);
+
+    writer->buffer = builder->stash_buffer;
+    writer->current = builder->stash_current;
+    writer->end = builder->stash_end;
+    builder->current_build = NULL;
+    builder->latest_build = NULL;
+
+    mpack_builder_page_t* page = builder->pages;
+    size_t offset = MPACK_BUILDER_PAGE_HEADER_SIZE;
+    while (mpack_writer_error(writer) == mpack_ok) {
+
+        // find the next record
+        offset = mpack_builder_align(offset);
+        if (offset + sizeof(mpack_build_t) > page->bytes_used) {
+            if (page == last_page)
+                break;
+            page = page->next;
+            offset = MPACK_BUILDER_PAGE_HEADER_SIZE;
+            continue;
+        }
+        const mpack_build_t* build = (const mpack_build_t*)(const void*)((const char*)page + offset);
+        offset += sizeof(mpack_build_t);
+
+        if (build->type == (uint8_t)mpack_type_array) {
+            mpack_start_array_notrack(writer, build->count);
+        } else if (build->type == (uint8_t)mpack_type_map) {
+            mpack_start_map_notrack(writer, build->count);
+        }
+
+        // write its bytes, which may continue in the following pages
+        size_t left = build->bytes;
+        while (left > 0) {
+            if (offset == page->bytes_used) {
+                mpack_assert(page != last_page, "build bytes overrun the last page!");
+                page = page->next;
+                offset = MPACK_BUILDER_PAGE_HEADER_SIZE;
+            }
+            size_t step = page->bytes_used - offset;
+            if (step > left)
+                step = left;
+            mpack_write_native(writer, (const char*)page + offset, step);
+            offset += step;
+            left -= step;
+        }
+    }
+
+    mpack_log("resolved builds, %i bytes in writer buffer\n", (int)mpack_writer_buffer_used(writer));
+}
+
+static void mpack_builder_complete(mpack_writer_t* writer, mpack_type_t type) {
+    #if MPACK_WRITE_TRACKING
+    if (writer->error == mpack_ok)
+        mpack_writer_flag_if_error(writer, mpack_track_pop_builder(&writer->track, type));
+    #endif
+    if (mpack_writer_error(writer) != mpack_ok)
+        return;
+
+    mpack_builder_t* builder = &writer->builder;
+    mpack_build_t* build = builder->current_build;
+    if (build == NULL || build->type != (uint8_t)type) {
+        mpack_break("attempting to complete a %s but the current build is %s!",
+                mpack_type_to_string(type), build ? mpack_type_to_string((mpack_type_t)build->type) : "not open");
+        mpack_writer_flag_error(writer, mpack_error_bug);
+        return;
+    }
+    if (build->key_needs_value || build->nested_elements != 0) {
+        mpack_break("attempting to complete a %s but %s", mpack_type_to_string(type),
+                build->key_needs_value ? "a key has no value" : "elements are missing in a nested compound type");
+        mpack_writer_flag_error(writer, mpack_error_bug);
+        return;
+    }
+
+    mpack_log("completing %s of %i elements\n", mpack_type_to_string(type), (int)build->count);
+
+    if (build->parent == NULL) {
+        mpack_builder_commit_bytes(writer);
+        mpack_builder_resolve(writer);
+        return;
+    }
+
+    // further bytes belong to the parent, so they need a new record
+    builder->current_build = build->parent;
+    mpack_builder_add_record(writer, mpack_type_missing);
+}
+
+void mpack_build_array(mpack_writer_t* writer) {
+    mpack_builder_build(writer, mpack_type_array);
+}
+
+void mpack_build_map(mpack_writer_t* writer) {
+    mpack_builder_build(writer, mpack_type_map);
+}
+
+void mpack_complete_array(mpack_writer_t* writer) {
+    mpack_builder_complete(writer, mpack_type_array);
+}
+
+void mpack_complete_map(mpack_writer_t* writer) {
+    mpack_builder_complete(writer, mpack_type_map);
+}
+#endif
+
 static void mpack_start_str_notrack(mpack_writer_t* writer, uint32_t count) {
     if (count <= 31) {
         MPACK_WRITE_ENCODED(mpack_encode_fixstr, MPACK_TAG_SIZE_FIXSTR, (uint8_t)count);
@@ -1071,6 +2310,138 @@ void mpack_start_ext(mpack_writer_t* writer, int8_t exttype, uint32_t count) {
 
 
 
+/*
+ * Tokens
+ */
+
+static mpack_token_t mpack_token_invalid(void) {
+    mpack_token_t token;
+    mpack_memset(&token, 0, sizeof(token));
+    return token;
+}
+
+// Returns a token of the given encoded data, or an invalid token if it
+// doesn't fit.
+static mpack_token_t mpack_token_encoded(const char* data, size_t size, size_t count) {
+    if (size > MPACK_TOKEN_SIZE || count > UINT8_MAX)
+        return mpack_token_invalid();
+    mpack_token_t token = mpack_token_invalid();
+    mpack_memcpy(&token.lead, data, size);
+    token.size = (uint8_t)size;
+    token.count = (uint8_t)count;
+    return token;
+}
+
+mpack_token_t mpack_token_str(const char* str, uint32_t length) {
+    mpack_assert(length == 0 || str != NULL, "str of length %i is NULL", (int)length);
+    size_t header = (length <= 31) ? MPACK_TAG_SIZE_FIXSTR : MPACK_TAG_SIZE_STR8;
+    if (length > MPACK_TOKEN_SIZE - header)
+        return mpack_token_invalid();
+
+    char data[MPACK_TOKEN_SIZE];
+    if (length <= 31)
+        mpack_encode_fixstr(data, (uint8_t)length);
+    else
+        mpack_encode_str8(data, (uint8_t)length);
+    if (length > 0)
+        mpack_memcpy(data + header, str, length);
+    return mpack_token_encoded(data, header + length, 1);
+}
+
+mpack_token_t mpack_token_cstr(const char* cstr) {
+    mpack_assert(cstr != NULL, "cstr pointer is NULL");
+    size_t length = mpack_strlen(cstr);
+    if (length > MPACK_TOKEN_SIZE)
+        return mpack_token_invalid();
+    return mpack_token_str(cstr, (uint32_t)length);
+}
+
+mpack_token_t mpack_token_uint(uint64_t value) {
+    char data[MPACK_TAG_SIZE_U64];
+    size_t size;
+    if (value <= 127) {
+        mpack_encode_fixuint(data, (uint8_t)value);
+        size = MPACK_TAG_SIZE_FIXUINT;
+    } else if (value <= UINT8_MAX) {
+        mpack_encode_u8(data, (uint8_t)value);
+        size = MPACK_TAG_SIZE_U8;
+    } else if (value <= UINT16_MAX) {
+        mpack_encode_u16(data, (uint16_t)value);
+        size = MPACK_TAG_SIZE_U16;
+    } else if (value <= UINT32_MAX) {
+        mpack_encode_u32(data, (uint32_t)value);
+        size = MPACK_TAG_SIZE_U32;
+    } else {
+        mpack_encode_u64(data, value);
+        size = MPACK_TAG_SIZE_U64;
+    }
+    return mpack_token_encoded(data, size, 1);
+}
+
+mpack_token_t mpack_token_int(int64_t value) {
+    if (value >= 0)
+        return mpack_token_uint((uint64_t)value);
+
+    char data[MPACK_TAG_SIZE_I64];
+    size_t size;
+    if (value >= -32) {
+        mpack_encode_fixint(data, (int8_t)value);
+        size = MPACK_TAG_SIZE_FIXINT;
+    } else if (value >= INT8_MIN) {
+        mpack_encode_i8(data, (int8_t)value);
+        size = MPACK_TAG_SIZE_I8;
+    } else if (value >= INT16_MIN) {
+        mpack_encode_i16(data, (int16_t)value);
+        size = MPACK_TAG_SIZE_I16;
+    } else if (value >= INT32_MIN) {
+        mpack_encode_i32(data, (int32_t)value);
+        size = MPACK_TAG_SIZE_I32;
+    } else {
+        mpack_encode_i64(data, value);
+        size = MPACK_TAG_SIZE_I64;
+    }
+    return mpack_token_encoded(data, size, 1);
+}
+
+mpack_token_t mpack_token_nil(void) {
+    return mpack_token_encoded("\xc0", 1, 1);
+}
+
+mpack_token_t mpack_token_bool(bool value) {
+    return mpack_token_encoded(value ? "\xc3" : "\xc2", 1, 1);
+}
+
+mpack_token_t mpack_token_concat(const mpack_token_t* first, const mpack_token_t* second) {
+    if (!mpack_token_valid(first) || !mpack_token_valid(second))
+        return mpack_token_invalid();
+
+    char data[2 * MPACK_TOKEN_SIZE];
+    mpack_memcpy(data, &first->lead, first->size);
+    mpack_memcpy(data + first->size, &second->lead, second->size);
+    return mpack_token_encoded(data, (size_t)first->size + second->size, (size_t)first->count + second->count);
+}
+
+void mpack_write_token(mpack_writer_t* writer, const mpack_token_t* token) {
+    MPACK_STATIC_ASSERT(offsetof(mpack_token_t, rest) == offsetof(mpack_token_t, lead) + 1,
+            "the encoded data of a token must be contiguous!");
+
+    if (!mpack_token_valid(token)) {
+        mpack_writer_flag_error(writer, mpack_error_too_big);
+        return;
+    }
+    for (size_t i = 0; i < token->count; ++i)
+        mpack_writer_track_element(writer);
+
+    // If there's room, we copy the whole token with a constant size so the
+    // copy can be inlined; the bytes past its data are overwritten later.
+    if (MPACK_LIKELY(mpack_writer_buffer_left(writer) >= MPACK_TOKEN_SIZE)) {
+        mpack_memcpy(writer->current, &token->lead, MPACK_TOKEN_SIZE);
+        writer->current += token->size;
+        return;
+    }
+    mpack_write_native(writer, &token->lead, token->size);
+}
+
 /*
  * Compound helpers and other functions
  */
@@ -1137,6 +2508,13 @@ void mpack_write_bin(mpack_writer_t* writer, const char* data, uint32_t count) {
     mpack_finish_bin(writer);
 }
 
+void mpack_write_bin_borrowed(mpack_writer_t* writer, const char* data, uint32_t count) {
+    mpack_assert(data != NULL, "data pointer for bin of %i bytes is NULL", (int)count);
+    mpack_start_bin(writer, count);
+    mpack_write_bytes_borrowed(writer, data, count);
+    mpack_finish_bin(writer);
+}
+
 #if MPACK_EXTENSIONS
 void mpack_write_ext(mpack_writer_t* writer, int8_t exttype, const char* data, uint32_t count) {
     mpack_assert(data != NULL, "data pointer for ext of type %i and %i bytes is NULL", exttype, (int)count);
@@ -1144,6 +2522,13 @@ void mpack_write_ext(mpack_writer_t* writer, int8_t exttype, const char* data, u
     mpack_write_bytes(writer, data, count);
     mpack_finish_ext(writer);
 }
+
+void mpack_write_ext_borrowed(mpack_writer_t* writer, int8_t exttype, const char* data, uint32_t count) {
+    mpack_assert(data != NULL, "data pointer for ext of type %i and %i bytes is NULL", exttype, (int)count);
+    mpack_start_ext(writer, exttype, count);
+    mpack_write_bytes_borrowed(writer, data, count);
+    mpack_finish_ext(writer);
+}
 #endif
 
 void mpack_write_bytes(mpack_writer_t* writer, const char* data, size_t count) {
@@ -1152,6 +2537,38 @@ void mpack_write_bytes(mpack_writer_t* writer, const char* data, size_t count) {
     mpack_write_native(writer, data, count);
 }
 
+void mpack_write_bytes_borrowed(mpack_writer_t* writer, const char* data, size_t count) {
+    mpack_assert(data != NULL, "data pointer for %i bytes is NULL", (int)count);
+    mpack_writer_track_bytes(writer, count);
+
+    // without a vectored flush (or while building, since the builder's pages
+    // are replayed later) the data has to be copied
+    bool copy = writer->flush_iov == NULL || count == 0;
+    #if MPACK_BUILDER
+    if (writer->builder.current_build != NULL)
+        copy = true;
+    #endif
+    if (copy) {
+        mpack_write_native(writer, data, count);
+        return;
+    }
+
+    if (mpack_writer_error(writer) != mpack_ok)
+        return;
+
+    if (writer->borrowed_count == MPACK_WRITER_BORROWED_MAX) {
+        mpack_writer_flush_unchecked(writer);
+        if (mpack_writer_error(writer) != mpack_ok)
+            return;
+    }
+
+    mpack_log("borrowing %i bytes from %p\n", (int)count, data);
+    writer->borrowed[writer->borrowed_count].offset = mpack_writer_buffer_used(writer);
+    writer->borrowed[writer->borrowed_count].data = data;
+    writer->borrowed[writer->borrowed_count].count = count;
+    ++writer->borrowed_count;
+}
+
 void mpack_write_cstr(mpack_writer_t* writer, const char* cstr) {
     mpack_assert(cstr != NULL, "cstr pointer is NULL");
     size_t length = mpack_strlen(cstr);
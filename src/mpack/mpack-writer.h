@@ -74,6 +74,50 @@ typedef struct mpack_writer_t mpack_writer_t;
  */
 typedef void (*mpack_writer_flush_t)(mpack_writer_t* writer, const char* buffer, size_t count);
 
+/**
+ * A span of bytes passed to a vectored flush function.
+ */
+typedef struct mpack_iovec_t {
+    const char* data; /**< The bytes to write. */
+    size_t count;     /**< The number of bytes to write. */
+} mpack_iovec_t;
+
+/**
+ * A vectored flush function to write several spans of bytes to the output
+ * stream in order, for example with @c writev(). See
+ * mpack_writer_set_flush_iov().
+ *
+ * The spans may point into the writer's buffer or into data borrowed from
+ * the caller; either way they are only valid until this function returns.
+ * It should flag an appropriate error on the writer if flushing fails.
+ *
+ * The specified context for callbacks is at writer->context.
+ */
+typedef void (*mpack_writer_flush_iov_t)(mpack_writer_t* writer, const mpack_iovec_t* iov, size_t iovcnt);
+
+/**
+ * A function to start flushing bytes to the output stream in the background.
+ * See mpack_writer_set_async().
+ *
+ * The bytes must not be touched once the flush has completed, and they
+ * remain valid until then. When the flush completes, call
+ * mpack_writer_async_complete() or return from the wait function. It should
+ * flag an appropriate error on the writer if the flush cannot be started.
+ *
+ * The specified context for callbacks is at writer->context.
+ */
+typedef void (*mpack_writer_submit_t)(mpack_writer_t* writer, const char* data, size_t count);
+
+/**
+ * A function to block until the flush started by the last call to the submit
+ * function completes. See mpack_writer_set_async().
+ *
+ * It should flag an appropriate error on the writer if the flush failed.
+ *
+ * The specified context for callbacks is at writer->context.
+ */
+typedef void (*mpack_writer_wait_t)(mpack_writer_t* writer);
+
 /**
  * An error handler function to be called when an error is flagged on
  * the writer.
@@ -108,11 +152,39 @@ typedef void (*mpack_writer_teardown_t)(mpack_writer_t* writer);
 /* Hide internals from documentation */
 /** @cond */
 
+#if MPACK_BUILDER
+typedef struct mpack_build_t mpack_build_t;
+typedef struct mpack_builder_page_t mpack_builder_page_t;
+
+typedef struct mpack_builder_t {
+    mpack_build_t* current_build;       /* Innermost incomplete build, or NULL if not building */
+    mpack_build_t* latest_build;        /* Build record owning the bytes currently being written */
+    mpack_builder_page_t* current_page; /* Page currently being written */
+    mpack_builder_page_t* pages;        /* All pages, kept for reuse until the writer is destroyed */
+
+    /* The writer's own buffer, stashed while building */
+    char* stash_buffer;
+    char* stash_current;
+    char* stash_end;
+
+    #if MPACK_BUILDER_INTERNAL_STORAGE
+    union {
+        char bytes[MPACK_BUILDER_INTERNAL_STORAGE_SIZE];
+        void* align_pointer;
+        uint64_t align_u64;
+    } internal; /* The first page */
+    #endif
+} mpack_builder_t;
+#endif
+
 struct mpack_writer_t {
     #if MPACK_COMPATIBILITY
     mpack_version_t version;          /* Version of the MessagePack spec to write */
     #endif
     mpack_writer_flush_t flush;       /* Function to write bytes to the output stream */
+    mpack_writer_flush_iov_t flush_iov; /* Vectored flush function, or NULL if not vectored */
+    mpack_writer_submit_t submit;     /* Function to start an asynchronous flush, or NULL if not async */
+    mpack_writer_wait_t wait;         /* Function to wait for an asynchronous flush */
     mpack_writer_error_t error_fn;    /* Function to call on error */
     mpack_writer_teardown_t teardown; /* Function to teardown the context on destroy */
     void* context;                    /* Context for writer callbacks */
@@ -122,10 +194,35 @@ struct mpack_writer_t {
     char* end;            /* The end of the buffer */
     mpack_error_t error;  /* Error state */
 
+    char* spare;          /* The other buffer of an async writer, which may be in flight */
+    bool in_flight;       /* Whether an asynchronous flush has not yet completed */
+    bool compact_doubles; /* Whether doubles are written in their smallest exact encoding */
+
+    #ifdef MPACK_MALLOC
+    mpack_allocator_t allocator; /* Allocator for growable buffers and builder pages */
+    #endif
+
     #if MPACK_WRITE_TRACKING
     mpack_track_t track; /* Stack of map/array/str/bin/ext writes */
     #endif
 
+    #if MPACK_STATS
+    mpack_stats_t stats; /* Statistics counters */
+    #endif
+
+    /* Data borrowed from the caller, to be flushed after the buffer bytes
+     * before the given offset */
+    size_t borrowed_count;
+    struct {
+        size_t offset;
+        const char* data;
+        size_t count;
+    } borrowed[MPACK_WRITER_BORROWED_MAX];
+
+    #if MPACK_BUILDER
+    mpack_builder_t builder; /* State of maps/arrays being built */
+    #endif
+
     #ifdef MPACK_MALLOC
     /* Reserved. You can use this space to allocate a custom
      * context in order to reduce heap allocations. */
@@ -136,7 +233,6 @@ struct mpack_writer_t {
 #if MPACK_WRITE_TRACKING
 void mpack_writer_track_push(mpack_writer_t* writer, mpack_type_t type, uint32_t count);
 void mpack_writer_track_pop(mpack_writer_t* writer, mpack_type_t type);
-void mpack_writer_track_element(mpack_writer_t* writer);
 void mpack_writer_track_bytes(mpack_writer_t* writer, size_t count);
 #else
 MPACK_INLINE void mpack_writer_track_push(mpack_writer_t* writer, mpack_type_t type, uint32_t count) {
@@ -148,9 +244,6 @@ MPACK_INLINE void mpack_writer_track_pop(mpack_writer_t* writer, mpack_type_t ty
     MPACK_UNUSED(writer);
     MPACK_UNUSED(type);
 }
-MPACK_INLINE void mpack_writer_track_element(mpack_writer_t* writer) {
-    MPACK_UNUSED(writer);
-}
 MPACK_INLINE void mpack_writer_track_bytes(mpack_writer_t* writer, size_t count) {
     MPACK_UNUSED(writer);
     MPACK_UNUSED(count);
@@ -188,7 +281,8 @@ void mpack_writer_init(mpack_writer_t* writer, char* buffer, size_t size);
  * and will remain NULL if an error occurs.
  *
  * The allocated data must be freed with MPACK_FREE() (or simply free()
- * if MPack's allocator hasn't been customized.)
+ * if MPack's allocator hasn't been customized), or with the writer's
+ * allocator if one was set with mpack_writer_set_allocator().
  *
  * @throws mpack_error_memory if the buffer fails to grow when
  * flushing.
@@ -198,6 +292,87 @@ void mpack_writer_init(mpack_writer_t* writer, char* buffer, size_t size);
  * @param size Where to write the size of the data.
  */
 void mpack_writer_init_growable(mpack_writer_t* writer, char** data, size_t* size);
+
+/**
+ * The data written by a chunked writer. See mpack_writer_init_chunked().
+ *
+ * The data is a list of chunks in order, each a separate allocation. It can
+ * be passed to a vectored write (such as @c writev() or @c sendmsg()) with
+ * mpack_chunks_iov(), or coalesced into a single buffer with
+ * mpack_chunks_coalesce(). It must be freed with mpack_chunks_destroy().
+ */
+typedef struct mpack_chunks_t {
+    mpack_iovec_t* iov;          /**< The chunks, in order. */
+    size_t count;                /**< The number of chunks. */
+    size_t capacity;             /**< The number of chunks that fit in iov. */
+    size_t size;                 /**< The total number of bytes in all chunks. */
+    mpack_allocator_t allocator; /**< The allocator of the chunks and of iov. */
+} mpack_chunks_t;
+
+/**
+ * Initializes an MPack writer that writes into a list of chunks.
+ *
+ * This is like mpack_writer_init_growable() except that when the buffer is
+ * full, it is kept as a chunk and writing continues in a new one instead of
+ * growing the buffer. Data is never moved, so writing a message of any size
+ * copies each byte once and needs no more memory than the message itself
+ * (plus the unused end of the last chunk.) Chunks grow geometrically up to
+ * @ref MPACK_WRITER_CHUNK_MAX_SIZE.
+ *
+ * The chunks are collected in the given mpack_chunks_t, which must not be
+ * used until the writer is destroyed. If an error occurs, the chunks are
+ * left empty. Either way they must be destroyed with mpack_chunks_destroy().
+ *
+ * The chunks are allocated with the writer's allocator if one was set with
+ * mpack_writer_set_allocator().
+ *
+ * @throws mpack_error_memory if a chunk fails to allocate.
+ *
+ * @param writer The MPack writer.
+ * @param chunks Where to place the chunks.
+ */
+void mpack_writer_init_chunked(mpack_writer_t* writer, mpack_chunks_t* chunks);
+
+/**
+ * Returns the chunks of the given data as spans for a vectored write.
+ * Empty chunks are never included.
+ *
+ * @param chunks The chunks.
+ * @param count Where to write the number of spans.
+ */
+MPACK_INLINE const mpack_iovec_t* mpack_chunks_iov(const mpack_chunks_t* chunks, size_t* count) {
+    *count = chunks->count;
+    return chunks->iov;
+}
+
+/**
+ * Returns the total number of bytes in the given chunks.
+ */
+MPACK_INLINE size_t mpack_chunks_size(const mpack_chunks_t* chunks) {
+    return chunks->size;
+}
+
+/**
+ * Moves the data of the given chunks into a single buffer, leaving the
+ * chunks empty.
+ *
+ * If there is only one chunk, it is shrunk to fit and returned without
+ * copying. Otherwise the chunks are copied into a new buffer and freed. As
+ * with mpack_writer_init_growable(), a non-null pointer is returned even if
+ * there is no data, and it must be freed with the chunks' allocator (or
+ * MPACK_FREE() if none was set.)
+ *
+ * @param chunks The chunks.
+ * @param size Where to write the size of the data.
+ * @return The data, or NULL if the buffer cannot be allocated (in which
+ *     case the chunks are unchanged.)
+ */
+char* mpack_chunks_coalesce(mpack_chunks_t* chunks, size_t* size);
+
+/**
+ * Frees the given chunks.
+ */
+void mpack_chunks_destroy(mpack_chunks_t* chunks);
 #endif
 
 /**
@@ -242,6 +417,36 @@ MPACK_INLINE void mpack_writer_init_file(mpack_writer_t* writer, const char* fil
 void mpack_writer_init_stdfile(mpack_writer_t* writer, FILE* stdfile, bool close_when_done);
 #endif
 
+#if MPACK_FD
+/**
+ * Initializes an MPack writer that writes to a POSIX file descriptor with
+ * writev(). This can be used to write to a file, pipe or socket.
+ *
+ * The buffer is allocated with @ref MPACK_MALLOC. A large buffer means fewer
+ * system calls. The writer uses a vectored flush (see
+ * mpack_writer_set_flush_iov()), so data too large for the buffer and data
+ * written with mpack_write_bytes_borrowed() is written together with the
+ * buffered bytes without being copied.
+ *
+ * @param writer The MPack writer.
+ * @param fd The file descriptor.
+ * @param buffer_size The size of the buffer to allocate, or 0 for @ref
+ *        MPACK_FD_BUFFER_SIZE. It must be at least @ref
+ *        MPACK_WRITER_MINIMUM_BUFFER_SIZE.
+ * @param close_when_done If true, close() will be called on the descriptor
+ *        when it is no longer needed.
+ *
+ * @throws mpack_error_memory if allocation fails
+ * @throws mpack_error_io if writing fails
+ *
+ * @note The writer is buffered. If you want to write other data to the
+ *         descriptor in between messages, you must flush it first.
+ *
+ * @see mpack_writer_flush_message
+ */
+void mpack_writer_init_fd(mpack_writer_t* writer, int fd, size_t buffer_size, bool close_when_done);
+#endif
+
 /** @cond */
 
 #define mpack_writer_init_stack_line_ex(line, writer) \
@@ -314,6 +519,33 @@ MPACK_INLINE void mpack_writer_set_version(mpack_writer_t* writer, mpack_version
 }
 #endif
 
+/**
+ * Sets whether doubles are written in the smallest encoding that reads back
+ * as exactly the same value. This is off by default.
+ *
+ * When enabled, mpack_write_double() and mpack_write_array_double() write
+ * an integral double as an int if its encoding is smaller than a float's,
+ * and otherwise as a float if converting it to float and back is lossless.
+ * An integral double within the range of a 32-bit int (signed or unsigned)
+ * that is too precise for a float, such as 16777217.0, is written as an int
+ * as well, since that is smaller than a double. Other values (including
+ * infinities and NaNs) are written as doubles as usual. For example 12.0
+ * takes 1 byte and 0.5 takes 5 bytes instead of 9.
+ *
+ * Such values are read back exactly by functions that accept any number,
+ * such as mpack_expect_double() and mpack_node_double(), but not by the
+ * strict variants, which reject ints.
+ *
+ * With @ref MPACK_STATS, the bytes saved are counted in @ref
+ * mpack_stats_t.bytes_saved.
+ *
+ * This has no effect if @ref MPACK_DOUBLES is disabled, since doubles are
+ * then always written as floats.
+ */
+MPACK_INLINE void mpack_writer_set_compact_doubles(mpack_writer_t* writer, bool compact_doubles) {
+    writer->compact_doubles = compact_doubles;
+}
+
 /**
  * Sets the custom pointer to pass to the writer callbacks, such as flush
  * or teardown.
@@ -353,6 +585,99 @@ MPACK_INLINE void* mpack_writer_context(mpack_writer_t* writer) {
  */
 void mpack_writer_set_flush(mpack_writer_t* writer, mpack_writer_flush_t flush);
 
+/**
+ * Sets a vectored flush function to write out the data when the buffer is
+ * full. This replaces any flush function set with mpack_writer_set_flush().
+ *
+ * A vectored flush receives the buffered bytes together with data that
+ * doesn't fit in the buffer in a single call, so neither has to be copied or
+ * written separately. It also allows writing data borrowed from the caller
+ * with mpack_write_bytes_borrowed() and mpack_write_bin_borrowed() without
+ * copying it into the buffer at all.
+ *
+ * @param writer The MPack writer.
+ * @param flush_iov The function to write out spans of data.
+ *
+ * @see mpack_writer_flush_iov_t
+ */
+void mpack_writer_set_flush_iov(mpack_writer_t* writer, mpack_writer_flush_iov_t flush_iov);
+
+/**
+ * Sets the writer to flush asynchronously into two alternating buffers. This
+ * replaces any flush function set with mpack_writer_set_flush().
+ *
+ * When the buffer is full, it is handed to the submit function to be flushed
+ * in the background (for example by an I/O thread or with an asynchronous
+ * write call) and the writer continues encoding into the spare buffer. The
+ * writer never has more than one flush in flight: if the spare buffer is still
+ * being flushed when it is needed, the wait function is called to block until
+ * it completes. This applies backpressure when the output stream is slower
+ * than the encoder.
+ *
+ * When a flush completes, call mpack_writer_async_complete() (for example
+ * from a completion event or after polling) so that the writer can reuse its
+ * buffer without waiting. The wait function is only called for flushes that
+ * have not been marked complete.
+ *
+ * Data that doesn't fit in the buffer (such as a large string) belongs to the
+ * caller, so it is submitted and waited for immediately.
+ *
+ * mpack_writer_flush_message() submits the buffered data but does not wait
+ * for it. mpack_writer_destroy() waits for any flush in flight, even if an
+ * error has been flagged, so both buffers can be freed once it returns.
+ *
+ * @param writer The MPack writer.
+ * @param spare A second buffer of the same size as the writer's buffer.
+ * @param submit The function to start flushing data.
+ * @param wait The function to wait for the flush in flight.
+ *
+ * @see mpack_writer_submit_t
+ * @see mpack_writer_wait_t
+ */
+void mpack_writer_set_async(mpack_writer_t* writer, char* spare,
+        mpack_writer_submit_t submit, mpack_writer_wait_t wait);
+
+/**
+ * Marks the flush in flight of an asynchronous writer as complete. See
+ * mpack_writer_set_async().
+ *
+ * This does nothing if no flush is in flight.
+ */
+MPACK_INLINE void mpack_writer_async_complete(mpack_writer_t* writer) {
+    writer->in_flight = false;
+}
+
+/**
+ * Returns true if an asynchronous flush has been submitted and has not yet
+ * completed. See mpack_writer_set_async().
+ */
+MPACK_INLINE bool mpack_writer_async_in_flight(mpack_writer_t* writer) {
+    return writer->in_flight;
+}
+
+#ifdef MPACK_MALLOC
+/**
+ * Sets the allocator for memory allocated by the writer.
+ *
+ * This is used for the buffer of a growable writer (see
+ * mpack_writer_init_growable()), for builder pages (see mpack_build_map())
+ * and for write tracking in debug builds. The buffer of a growable writer
+ * is moved to the allocator, and the final data must then be freed with it.
+ *
+ * This must be called before anything is written. The buffer of a writer
+ * initialized with mpack_writer_init_fd() is moved to the allocator. The
+ * buffer of a writer initialized with mpack_writer_init_filename() or
+ * mpack_writer_init_stdfile() is not affected.
+ *
+ * @param writer The MPack writer.
+ * @param allocator The allocator to use, or NULL to use @ref MPACK_MALLOC.
+ *     It is copied into the writer.
+ *
+ * @note This requires @ref MPACK_MALLOC.
+ */
+void mpack_writer_set_allocator(mpack_writer_t* writer, const mpack_allocator_t* allocator);
+#endif
+
 /**
  * Sets the error function to call when an error is flagged on the writer.
  *
@@ -437,6 +762,30 @@ MPACK_INLINE size_t mpack_writer_buffer_size(mpack_writer_t* writer) {
     return (size_t)(writer->end - writer->buffer);
 }
 
+#if MPACK_STATS
+/**
+ * Returns the statistics counters of the writer.
+ *
+ * The writer counts calls to its flush function and the bytes passed to
+ * them, growths of a growable writer's buffer along with the bytes in it
+ * when it grows (or new chunks of a chunked writer), and builder pages
+ * allocated.
+ *
+ * @note This requires @ref MPACK_STATS.
+ * @see mpack_stats_t
+ */
+MPACK_INLINE const mpack_stats_t* mpack_writer_stats(mpack_writer_t* writer) {
+    return &writer->stats;
+}
+
+/**
+ * Resets the statistics counters of the writer to zero.
+ *
+ * @note This requires @ref MPACK_STATS.
+ */
+void mpack_writer_reset_stats(mpack_writer_t* writer);
+#endif
+
 /**
  * Places the writer in the given error state, calling the error callback if one
  * is set.
@@ -590,6 +939,110 @@ MPACK_INLINE void mpack_write_timestamp_struct(mpack_writer_t* writer, mpack_tim
 }
 #endif
 
+/**
+ * @}
+ */
+
+/**
+ * @name Tokens
+ *
+ * A token holds one or more elements in their final encoded form, such as
+ * a constant map key or a key and a constant value. Writing a token with
+ * mpack_write_token() copies its bytes into the writer with a single
+ * fixed-size copy, skipping the strlen() and the choice of encoding that
+ * mpack_write_cstr() makes for each key of each message.
+ *
+ * @code{.c}
+ * static const mpack_token_t timestamp = MPACK_TOKEN_CSTR("timestamp");
+ * mpack_token_t version = mpack_token_cstr("version");
+ * mpack_token_t value = mpack_token_uint(3);
+ * version = mpack_token_concat(&version, &value); // "version": 3
+ *
+ * mpack_start_map(&writer, 2);
+ * mpack_write_token(&writer, &timestamp);
+ * mpack_write_u64(&writer, now);
+ * mpack_write_token(&writer, &version);
+ * mpack_finish_map(&writer);
+ * @endcode
+ *
+ * @{
+ */
+
+/**
+ * An element or short sequence of elements pre-encoded for writing with
+ * mpack_write_token().
+ *
+ * A token whose data did not fit in @ref MPACK_TOKEN_SIZE bytes is invalid
+ * (its count is zero.) Writing it flags @ref mpack_error_too_big.
+ */
+typedef struct mpack_token_t {
+    uint8_t size;                    /**< The number of encoded bytes. */
+    uint8_t count;                   /**< The number of elements, or zero if the token is invalid. */
+    char lead;                       /**< The first encoded byte. */
+    char rest[MPACK_TOKEN_SIZE - 1]; /**< The remaining encoded bytes. */
+} mpack_token_t;
+
+/**
+ * An initializer for a token of a string literal, computed at compile time.
+ *
+ * The string must have at most 31 characters, and must fit in the token
+ * with its null-terminator (at most @ref MPACK_TOKEN_SIZE - 2 characters.)
+ */
+#define MPACK_TOKEN_CSTR(str) \
+    {(uint8_t)sizeof(str), 1, (char)(0xa0 | (sizeof(str) - 1)), str}
+
+/**
+ * Returns a token of a string.
+ */
+mpack_token_t mpack_token_str(const char* str, uint32_t length);
+
+/**
+ * Returns a token of a null-terminated string.
+ */
+mpack_token_t mpack_token_cstr(const char* cstr);
+
+/**
+ * Returns a token of an unsigned integer in its smallest encoding.
+ */
+mpack_token_t mpack_token_uint(uint64_t value);
+
+/**
+ * Returns a token of a signed integer in its smallest encoding.
+ */
+mpack_token_t mpack_token_int(int64_t value);
+
+/**
+ * Returns a token of a nil.
+ */
+mpack_token_t mpack_token_nil(void);
+
+/**
+ * Returns a token of a boolean.
+ */
+mpack_token_t mpack_token_bool(bool value);
+
+/**
+ * Returns a token of the elements of @p first followed by those of
+ * @p second. The result is invalid if either is invalid or their data
+ * does not fit in one token.
+ */
+mpack_token_t mpack_token_concat(const mpack_token_t* first, const mpack_token_t* second);
+
+/**
+ * Returns true if the token is valid.
+ */
+MPACK_INLINE bool mpack_token_valid(const mpack_token_t* token) {
+    return token->count != 0;
+}
+
+/**
+ * Writes the elements of a token. Each element is counted by write
+ * tracking and by builders as if it were written separately.
+ *
+ * @throws mpack_error_too_big if the token is invalid.
+ */
+void mpack_write_token(mpack_writer_t* writer, const mpack_token_t* token);
+
 /**
  * @}
  */
@@ -651,6 +1104,109 @@ MPACK_INLINE void mpack_finish_map(mpack_writer_t* writer) {
     mpack_writer_track_pop(writer, mpack_type_map);
 }
 
+/**
+ * Writes an array of unsigned 32-bit ints.
+ *
+ * This writes the array header and all of its elements, producing exactly
+ * the same bytes as mpack_start_array() followed by mpack_write_u32() for
+ * each element and mpack_finish_array(). It is faster for large arrays: the
+ * ints are classified in blocks, and blocks whose ints all share an encoding
+ * (for example IDs or timestamps of similar magnitude) are encoded without
+ * branching on each value.
+ *
+ * @param writer The MPack writer.
+ * @param values The ints to write.
+ * @param count The number of ints to write.
+ */
+void mpack_write_array_u32(mpack_writer_t* writer, const uint32_t* values, uint32_t count);
+
+/**
+ * Writes an array of unsigned 64-bit ints. See mpack_write_array_u32().
+ */
+void mpack_write_array_u64(mpack_writer_t* writer, const uint64_t* values, uint32_t count);
+
+/**
+ * Writes an array of signed 32-bit ints. See mpack_write_array_u32().
+ */
+void mpack_write_array_i32(mpack_writer_t* writer, const int32_t* values, uint32_t count);
+
+/**
+ * Writes an array of signed 64-bit ints. See mpack_write_array_u32().
+ */
+void mpack_write_array_i64(mpack_writer_t* writer, const int64_t* values, uint32_t count);
+
+/**
+ * Writes an array of floats, producing the same bytes as writing each with
+ * mpack_write_float(). See mpack_write_array_u32().
+ */
+void mpack_write_array_float(mpack_writer_t* writer, const float* values, uint32_t count);
+
+/**
+ * Writes an array of doubles, producing the same bytes as writing each with
+ * mpack_write_double(). See mpack_write_array_u32().
+ */
+void mpack_write_array_double(mpack_writer_t* writer, const double* values, uint32_t count);
+
+#if MPACK_BUILDER
+/**
+ * Starts building an array.
+ *
+ * Elements must follow, and mpack_complete_array() must be called when done.
+ * The number of elements does not need to be known in advance.
+ *
+ * Everything written between this and the matching mpack_complete_array()
+ * (including nested builds) is buffered in builder pages separate from the
+ * writer's own buffer, and the array is written to the writer with the
+ * smallest correct header once the outermost build is completed. Builds
+ * therefore cost an extra copy of their contents compared to
+ * mpack_start_array(), but they don't require a separate pass to count
+ * elements.
+ *
+ * Builds can be nested within builds and within maps and arrays of known
+ * size, and maps and arrays of known size can be nested within builds.
+ *
+ * @see mpack_complete_array()
+ * @see @ref MPACK_BUILDER
+ */
+void mpack_build_array(mpack_writer_t* writer);
+
+/**
+ * Starts building a map.
+ *
+ * An even number of elements must follow (the keys and values), and
+ * mpack_complete_map() must be called when done. The number of key/value
+ * pairs does not need to be known in advance.
+ *
+ * See mpack_build_array() for more details.
+ *
+ * @see mpack_complete_map()
+ */
+void mpack_build_map(mpack_writer_t* writer);
+
+/**
+ * Completes an array being built.
+ *
+ * This should be called only after a corresponding call to
+ * mpack_build_array() and after the array contents are written. If this
+ * completes the outermost build, the array and all of its contents are
+ * written to the writer.
+ *
+ * @see mpack_build_array()
+ */
+void mpack_complete_array(mpack_writer_t* writer);
+
+/**
+ * Completes a map being built.
+ *
+ * This should be called only after a corresponding call to mpack_build_map()
+ * and after the map contents are written. An odd number of elements in the
+ * map flags @ref mpack_error_bug.
+ *
+ * @see mpack_build_map()
+ */
+void mpack_complete_map(mpack_writer_t* writer);
+#endif
+
 /**
  * @}
  */
@@ -754,6 +1310,17 @@ void mpack_write_utf8_cstr_or_nil(mpack_writer_t* writer, const char* cstr);
  */
 void mpack_write_bin(mpack_writer_t* writer, const char* data, uint32_t count);
 
+/**
+ * Writes a binary blob whose bytes are borrowed from the caller rather than
+ * copied into the writer's buffer.
+ *
+ * See mpack_write_bytes_borrowed() for how long the data must remain valid.
+ *
+ * You should not call mpack_finish_bin() after calling this; this
+ * performs both start and finish.
+ */
+void mpack_write_bin_borrowed(mpack_writer_t* writer, const char* data, uint32_t count);
+
 #if MPACK_EXTENSIONS
 /**
  * Writes an extension type.
@@ -769,6 +1336,16 @@ void mpack_write_bin(mpack_writer_t* writer, const char* data, uint32_t count);
  * @note This requires @ref MPACK_EXTENSIONS.
  */
 void mpack_write_ext(mpack_writer_t* writer, int8_t exttype, const char* data, uint32_t count);
+
+/**
+ * Writes an extension type whose bytes are borrowed from the caller rather
+ * than copied into the writer's buffer.
+ *
+ * See mpack_write_bytes_borrowed() for how long the data must remain valid.
+ *
+ * @note This requires @ref MPACK_EXTENSIONS.
+ */
+void mpack_write_ext_borrowed(mpack_writer_t* writer, int8_t exttype, const char* data, uint32_t count);
 #endif
 
 /**
@@ -838,6 +1415,28 @@ void mpack_start_ext(mpack_writer_t* writer, int8_t exttype, uint32_t count);
  */
 void mpack_write_bytes(mpack_writer_t* writer, const char* data, size_t count);
 
+/**
+ * Writes a portion of bytes for a string, binary blob or extension type
+ * without copying them into the writer's buffer.
+ *
+ * The writer keeps a pointer to the data and passes it to its vectored flush
+ * function (see mpack_writer_set_flush_iov()) along with the surrounding
+ * buffered bytes. The data must therefore remain valid and unchanged until
+ * the next flush returns, which may be as late as mpack_writer_flush_message()
+ * or mpack_writer_destroy().
+ *
+ * If the writer doesn't have a vectored flush function or is building (see
+ * mpack_build_array()), this behaves as mpack_write_bytes() and the data is
+ * copied.
+ *
+ * If @ref MPACK_WRITER_BORROWED_MAX borrowed writes are already pending, the
+ * writer is flushed first and the data is then borrowed as usual. It is not
+ * copied in this case.
+ *
+ * @see mpack_write_bytes()
+ */
+void mpack_write_bytes_borrowed(mpack_writer_t* writer, const char* data, size_t count);
+
 /**
  * Finishes writing a string.
  *
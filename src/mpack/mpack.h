@@ -34,6 +34,11 @@
 #include "mpack-reader.h"
 #include "mpack-expect.h"
 #include "mpack-node.h"
+#include "mpack-codec.h"
+#include "mpack-json.h"
+#include "mpack-query.h"
+#include "mpack-frame.h"
+#include "mpack-patch.h"
 
 #endif
 
@@ -0,0 +1,610 @@
+/*
+ * Copyright (c) 2015-2018 Nicholas Fraser
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * @file
+ *
+ * Declares the optional header-only C++ layer over the MPack API. This
+ * requires C++17.
+ */
+
+#ifndef MPACK_HPP
+#define MPACK_HPP 1
+
+#include "mpack.h"
+
+#if defined(_MSVC_LANG)
+    #define MPACK_HPP_CPLUSPLUS _MSVC_LANG
+#else
+    #define MPACK_HPP_CPLUSPLUS __cplusplus
+#endif
+
+#if MPACK_HPP_CPLUSPLUS < 201703L
+    #error "mpack.hpp requires C++17."
+#endif
+
+#include <array>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#if MPACK_HPP_CPLUSPLUS > 201703L && defined(__has_include)
+    #if __has_include(<span>)
+        #include <span>
+        #define MPACK_HPP_SPAN 1
+    #endif
+#endif
+#ifndef MPACK_HPP_SPAN
+    #define MPACK_HPP_SPAN 0
+#endif
+
+/**
+ * @defgroup cpp C++ Layer
+ *
+ * The C++ layer wraps the writer, reader and tree in move-only RAII types
+ * and provides encode() and decode() templates that pick the MPack function
+ * for a type at compile time.
+ *
+ * Supported types are bool, integers of each width, enums, float, double,
+ * strings (std::string, std::string_view and anything convertible to
+ * std::string_view), std::vector, std::array, std::span (in C++20; encoding
+ * only) and structs that specialize mpack::fields:
+ *
+ * @code{.cpp}
+ * struct point { int32_t x; int32_t y; std::string_view label; };
+ *
+ * template <> struct mpack::fields<point> {
+ *     static constexpr auto list = std::make_tuple(
+ *             mpack::field("x", &point::x),
+ *             mpack::field("y", &point::y),
+ *             mpack::field("label", &point::label));
+ * };
+ *
+ * mpack::writer writer = mpack::writer::growable();
+ * writer.write(point{1, 2, "origin"});
+ * writer.finish();
+ *
+ * mpack::tree tree(writer.data().data(), writer.data().size());
+ * tree.parse();
+ * point p = tree.decode<point>();
+ * @endcode
+ *
+ * Decoded strings are zero-copy views into the tree's data, so they are
+ * only valid as long as the tree (and its data) is.
+ *
+ * Errors are reported as in the C API: they are flagged on the writer,
+ * reader or tree, and checked with error() or finish().
+ *
+ * @{
+ */
+
+namespace mpack {
+
+/**
+ * Describes the map key of a member of a struct. See fields.
+ */
+template <class Class, class Member>
+struct field_t {
+    const char* key;
+    Member Class::* member;
+};
+
+/**
+ * Returns the description of a struct member for a fields specialization.
+ */
+template <class Class, class Member>
+constexpr field_t<Class, Member> field(const char* key, Member Class::* member) {
+    return field_t<Class, Member>{key, member};
+}
+
+/**
+ * Specialize this with a static constexpr tuple @c list of field() entries
+ * to encode and decode a struct as a map.
+ */
+template <class T>
+struct fields;
+
+namespace detail {
+
+template <class T>
+struct dependent_false : std::false_type {};
+
+template <class T, class = void>
+struct has_fields : std::false_type {};
+template <class T>
+struct has_fields<T, std::void_t<decltype(fields<T>::list)>> : std::true_type {};
+
+template <class T>
+struct is_vector : std::false_type {};
+template <class E, class A>
+struct is_vector<std::vector<E, A>> : std::true_type {};
+
+template <class T>
+struct is_std_array : std::false_type {};
+template <class E, size_t N>
+struct is_std_array<std::array<E, N>> : std::true_type {};
+
+template <class T>
+struct is_span : std::false_type {};
+#if MPACK_HPP_SPAN
+template <class E, size_t N>
+struct is_span<std::span<E, N>> : std::true_type {};
+#endif
+
+template <class T>
+constexpr bool is_string_v = std::is_convertible_v<const T&, std::string_view> &&
+        !std::is_same_v<T, std::nullptr_t>;
+
+template <class T>
+constexpr bool is_sequence_v = is_vector<T>::value || is_std_array<T>::value || is_span<T>::value;
+
+} // namespace detail
+
+#if MPACK_WRITER
+template <class T>
+void encode(mpack_writer_t* writer, const T& value);
+
+namespace detail {
+
+template <class T>
+void encode_sequence(mpack_writer_t* writer, const T& values) {
+    using E = std::remove_cv_t<typename T::value_type>;
+    if (values.size() > UINT32_MAX) {
+        mpack_writer_flag_error(writer, mpack_error_too_big);
+        return;
+    }
+    uint32_t count = static_cast<uint32_t>(values.size());
+
+    // contiguous arrays of numbers use the bulk array writers
+    if constexpr (std::is_same_v<E, int32_t>) {
+        mpack_write_array_i32(writer, values.data(), count);
+    } else if constexpr (std::is_same_v<E, int64_t>) {
+        mpack_write_array_i64(writer, values.data(), count);
+    } else if constexpr (std::is_same_v<E, uint32_t>) {
+        mpack_write_array_u32(writer, values.data(), count);
+    } else if constexpr (std::is_same_v<E, uint64_t>) {
+        mpack_write_array_u64(writer, values.data(), count);
+    } else if constexpr (std::is_same_v<E, float>) {
+        mpack_write_array_float(writer, values.data(), count);
+    } else if constexpr (std::is_same_v<E, double>) {
+        mpack_write_array_double(writer, values.data(), count);
+    } else {
+        mpack_start_array(writer, count);
+        for (const auto& element : values)
+            encode(writer, element);
+        mpack_finish_array(writer);
+    }
+}
+
+template <class T>
+void encode_struct(mpack_writer_t* writer, const T& object) {
+    constexpr auto& list = fields<T>::list;
+    mpack_start_map(writer, static_cast<uint32_t>(std::tuple_size_v<std::remove_reference_t<decltype(list)>>));
+    std::apply([&](const auto&... entry) {
+        ((mpack_write_cstr(writer, entry.key), encode(writer, object.*(entry.member))), ...);
+    }, list);
+    mpack_finish_map(writer);
+}
+
+} // namespace detail
+
+/**
+ * Writes a value with the writer function for its type.
+ */
+template <class T>
+void encode(mpack_writer_t* writer, const T& value) {
+    if constexpr (std::is_same_v<T, bool>) {
+        mpack_write_bool(writer, value);
+    } else if constexpr (std::is_enum_v<T>) {
+        encode(writer, static_cast<std::underlying_type_t<T>>(value));
+    } else if constexpr (std::is_integral_v<T> && std::is_signed_v<T>) {
+        if constexpr (sizeof(T) == 1)
+            mpack_write_i8(writer, static_cast<int8_t>(value));
+        else if constexpr (sizeof(T) == 2)
+            mpack_write_i16(writer, static_cast<int16_t>(value));
+        else if constexpr (sizeof(T) == 4)
+            mpack_write_i32(writer, static_cast<int32_t>(value));
+        else
+            mpack_write_i64(writer, static_cast<int64_t>(value));
+    } else if constexpr (std::is_integral_v<T>) {
+        if constexpr (sizeof(T) == 1)
+            mpack_write_u8(writer, static_cast<uint8_t>(value));
+        else if constexpr (sizeof(T) == 2)
+            mpack_write_u16(writer, static_cast<uint16_t>(value));
+        else if constexpr (sizeof(T) == 4)
+            mpack_write_u32(writer, static_cast<uint32_t>(value));
+        else
+            mpack_write_u64(writer, static_cast<uint64_t>(value));
+    } else if constexpr (std::is_same_v<T, float>) {
+        mpack_write_float(writer, value);
+    } else if constexpr (std::is_same_v<T, double>) {
+        mpack_write_double(writer, value);
+    } else if constexpr (detail::is_string_v<T>) {
+        std::string_view str(value);
+        if (str.size() > UINT32_MAX) {
+            mpack_writer_flag_error(writer, mpack_error_too_big);
+            return;
+        }
+        mpack_write_str(writer, str.data(), static_cast<uint32_t>(str.size()));
+    } else if constexpr (detail::is_sequence_v<T>) {
+        detail::encode_sequence(writer, value);
+    } else if constexpr (detail::has_fields<T>::value) {
+        detail::encode_struct(writer, value);
+    } else {
+        static_assert(detail::dependent_false<T>::value, "type cannot be encoded");
+    }
+}
+#endif
+
+#if MPACK_NODE
+template <class T>
+void decode(mpack_node_t node, T& value);
+
+namespace detail {
+
+template <class T>
+void decode_struct(mpack_node_t node, T& object) {
+    std::apply([&](const auto&... entry) {
+        (decode(mpack_node_map_cstr(node, entry.key), object.*(entry.member)), ...);
+    }, fields<T>::list);
+}
+
+} // namespace detail
+
+/**
+ * Reads a value from a node with the node function for its type.
+ *
+ * Strings decoded as std::string_view point into the tree's data.
+ */
+template <class T>
+void decode(mpack_node_t node, T& value) {
+    if constexpr (std::is_same_v<T, bool>) {
+        value = mpack_node_bool(node);
+    } else if constexpr (std::is_enum_v<T>) {
+        std::underlying_type_t<T> underlying{};
+        decode(node, underlying);
+        value = static_cast<T>(underlying);
+    } else if constexpr (std::is_integral_v<T> && std::is_signed_v<T>) {
+        if constexpr (sizeof(T) == 1)
+            value = static_cast<T>(mpack_node_i8(node));
+        else if constexpr (sizeof(T) == 2)
+            value = static_cast<T>(mpack_node_i16(node));
+        else if constexpr (sizeof(T) == 4)
+            value = static_cast<T>(mpack_node_i32(node));
+        else
+            value = static_cast<T>(mpack_node_i64(node));
+    } else if constexpr (std::is_integral_v<T>) {
+        if constexpr (sizeof(T) == 1)
+            value = static_cast<T>(mpack_node_u8(node));
+        else if constexpr (sizeof(T) == 2)
+            value = static_cast<T>(mpack_node_u16(node));
+        else if constexpr (sizeof(T) == 4)
+            value = static_cast<T>(mpack_node_u32(node));
+        else
+            value = static_cast<T>(mpack_node_u64(node));
+    } else if constexpr (std::is_same_v<T, float>) {
+        value = mpack_node_float(node);
+    } else if constexpr (std::is_same_v<T, double>) {
+        value = mpack_node_double(node);
+    } else if constexpr (std::is_same_v<T, std::string_view>) {
+        size_t length = mpack_node_strlen(node);
+        const char* str = mpack_node_str(node);
+        value = (str == NULL) ? std::string_view() : std::string_view(str, length);
+    } else if constexpr (std::is_same_v<T, std::string>) {
+        std::string_view view;
+        decode(node, view);
+        value.assign(view.data(), view.size());
+    } else if constexpr (detail::is_vector<T>::value) {
+        size_t count = mpack_node_array_length(node);
+        value.clear();
+        value.resize(count);
+        for (size_t i = 0; i < count; ++i)
+            decode(mpack_node_array_at(node, i), value[i]);
+    } else if constexpr (detail::is_std_array<T>::value) {
+        size_t count = mpack_node_array_length(node);
+        if (mpack_node_error(node) != mpack_ok)
+            return;
+        if (count != value.size()) {
+            mpack_node_flag_error(node, mpack_error_type);
+            return;
+        }
+        for (size_t i = 0; i < count; ++i)
+            decode(mpack_node_array_at(node, i), value[i]);
+    } else if constexpr (detail::has_fields<T>::value) {
+        detail::decode_struct(node, value);
+    } else {
+        static_assert(detail::dependent_false<T>::value, "type cannot be decoded");
+    }
+}
+
+/**
+ * Reads a value of the given type from a node. See decode(mpack_node_t, T&).
+ */
+template <class T>
+T decode(mpack_node_t node) {
+    T value{};
+    decode(node, value);
+    return value;
+}
+#endif
+
+#if MPACK_WRITER
+/**
+ * A move-only owner of an MPack writer.
+ *
+ * The writer state is allocated once, so moving a writer never copies it or
+ * its buffer.
+ */
+class writer {
+public:
+    /** Initializes a writer into the given buffer. */
+    writer(char* buffer, size_t size) : state_(new state()) {
+        mpack_writer_init(&state_->writer, buffer, size);
+    }
+
+    #ifdef MPACK_MALLOC
+    /**
+     * Creates a growable writer. The data is available from data() after
+     * finish() and is freed with the writer.
+     *
+     * An allocator may be set on get() with mpack_writer_set_allocator()
+     * before writing. The data is then freed with it.
+     */
+    static writer growable() {
+        writer result;
+        mpack_writer_init_growable(&result.state_->writer, &result.state_->data, &result.state_->size);
+        return result;
+    }
+    #endif
+
+    writer(writer&& other) noexcept = default;
+    writer& operator=(writer&& other) noexcept {
+        if (this != &other) {
+            release();
+            state_ = std::move(other.state_);
+        }
+        return *this;
+    }
+    writer(const writer&) = delete;
+    writer& operator=(const writer&) = delete;
+
+    ~writer() {
+        release();
+    }
+
+    /** Returns the underlying writer. */
+    mpack_writer_t* get() {
+        return &state_->writer;
+    }
+
+    /** Returns the error state of the writer. */
+    mpack_error_t error() const {
+        return state_->finished ? state_->error : mpack_writer_error(&state_->writer);
+    }
+
+    /** Writes a value with encode(). */
+    template <class T>
+    void write(const T& value) {
+        encode(get(), value);
+    }
+
+    /** Flushes and destroys the writer, returning its final error state. */
+    mpack_error_t finish() {
+        if (!state_->finished) {
+            state_->error = mpack_writer_destroy(&state_->writer);
+            state_->finished = true;
+        }
+        return state_->error;
+    }
+
+    /** Returns the data of a finished growable writer. */
+    std::string_view data() const {
+        return std::string_view(state_->data, state_->size);
+    }
+
+private:
+    struct state {
+        mpack_writer_t writer;
+        char* data = NULL;
+        size_t size = 0;
+        bool finished = false;
+        mpack_error_t error = mpack_ok;
+    };
+
+    writer() : state_(new state()) {}
+
+    void release() {
+        if (!state_)
+            return;
+        finish();
+        #ifdef MPACK_MALLOC
+        if (state_->data != NULL) {
+            // the data belongs to the writer's allocator, if one was set
+            const mpack_allocator_t& allocator = state_->writer.allocator;
+            if (allocator.alloc_fn == NULL)
+                MPACK_FREE(state_->data);
+            else if (allocator.free_fn != NULL)
+                allocator.free_fn(allocator.context, state_->data);
+        }
+        #endif
+        state_.reset();
+    }
+
+    std::unique_ptr<state> state_;
+};
+#endif
+
+#if MPACK_READER
+/**
+ * A move-only owner of an MPack reader.
+ */
+class reader {
+public:
+    /** Initializes a reader of the given data. */
+    reader(const char* data, size_t size) : state_(new state()) {
+        mpack_reader_init_data(&state_->reader, data, size);
+    }
+
+    reader(reader&& other) noexcept = default;
+    reader& operator=(reader&& other) noexcept {
+        if (this != &other) {
+            release();
+            state_ = std::move(other.state_);
+        }
+        return *this;
+    }
+    reader(const reader&) = delete;
+    reader& operator=(const reader&) = delete;
+
+    ~reader() {
+        release();
+    }
+
+    /** Returns the underlying reader. */
+    mpack_reader_t* get() {
+        return &state_->reader;
+    }
+
+    /** Returns the error state of the reader. */
+    mpack_error_t error() const {
+        return state_->finished ? state_->error : mpack_reader_error(&state_->reader);
+    }
+
+    /** Destroys the reader, returning its final error state. */
+    mpack_error_t finish() {
+        if (!state_->finished) {
+            state_->error = mpack_reader_destroy(&state_->reader);
+            state_->finished = true;
+        }
+        return state_->error;
+    }
+
+private:
+    struct state {
+        mpack_reader_t reader;
+        bool finished = false;
+        mpack_error_t error = mpack_ok;
+    };
+
+    void release() {
+        if (state_) {
+            finish();
+            state_.reset();
+        }
+    }
+
+    std::unique_ptr<state> state_;
+};
+#endif
+
+#if MPACK_NODE
+/**
+ * A move-only owner of an MPack tree.
+ *
+ * Moving a tree never copies its nodes or data, so nodes and decoded strings
+ * remain valid.
+ */
+class tree {
+public:
+    /** Initializes a tree of the given data. Call parse() to parse it. */
+    tree(const char* data, size_t size) : state_(new state()) {
+        mpack_tree_init_data(&state_->tree, data, size);
+    }
+
+    tree(tree&& other) noexcept = default;
+    tree& operator=(tree&& other) noexcept {
+        if (this != &other) {
+            release();
+            state_ = std::move(other.state_);
+        }
+        return *this;
+    }
+    tree(const tree&) = delete;
+    tree& operator=(const tree&) = delete;
+
+    ~tree() {
+        release();
+    }
+
+    /** Returns the underlying tree. */
+    mpack_tree_t* get() {
+        return &state_->tree;
+    }
+
+    /** Parses the next message. See mpack_tree_parse(). */
+    void parse() {
+        mpack_tree_parse(&state_->tree);
+    }
+
+    /** Returns the root node of the parsed message. */
+    mpack_node_t root() {
+        return mpack_tree_root(&state_->tree);
+    }
+
+    /** Decodes the root node with decode(). */
+    template <class T>
+    T decode() {
+        return mpack::decode<T>(root());
+    }
+
+    /** Returns the error state of the tree. */
+    mpack_error_t error() const {
+        return state_->finished ? state_->error : mpack_tree_error(&state_->tree);
+    }
+
+    /** Destroys the tree, returning its final error state. */
+    mpack_error_t finish() {
+        if (!state_->finished) {
+            state_->error = mpack_tree_destroy(&state_->tree);
+            state_->finished = true;
+        }
+        return state_->error;
+    }
+
+private:
+    struct state {
+        mpack_tree_t tree;
+        bool finished = false;
+        mpack_error_t error = mpack_ok;
+    };
+
+    void release() {
+        if (state_) {
+            finish();
+            state_.reset();
+        }
+    }
+
+    std::unique_ptr<state> state_;
+};
+#endif
+
+} // namespace mpack
+
+/**
+ * @}
+ */
+
+#endif
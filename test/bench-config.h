@@ -0,0 +1,14 @@
+#ifndef MPACK_BENCH_CONFIG_H
+#define MPACK_BENCH_CONFIG_H
+
+#define MPACK_BENCH
+
+#include <stddef.h>
+
+// we count allocations to report them alongside throughput
+void* bench_malloc(size_t size);
+void bench_free(void* p);
+#define MPACK_MALLOC bench_malloc
+#define MPACK_FREE bench_free
+
+#endif
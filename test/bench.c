@@ -0,0 +1,484 @@
+/*
+ * Copyright (c) 2015-2018 Nicholas Fraser
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifdef MPACK_BENCH
+
+/*
+ * bench.c is a benchmark of the MPack APIs. It generates a few representative
+ * corpora of MessagePack with the Write API, and then for each corpus it
+ * measures:
+ *
+ * - the Write API, encoding the corpus into a fixed buffer;
+ * - the Reader API, decoding the corpus with mpack_discard();
+ * - the Expect API, decoding the corpus with its known schema;
+ * - and the Node API, parsing each message of the corpus into a tree.
+ *
+ * Each case runs repeatedly for a minimum time. The results are printed to
+ * stdout as one JSON object per line so they can be compared between builds.
+ *
+ * Usage: mpack-bench [-t seconds] [name...]
+ *
+ * If names are given, only cases whose corpus or API matches one of them
+ * are run.
+ */
+
+#include "mpack/mpack.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifndef MPACK_BENCH_CONFIG_H
+#error "This should be built with bench-config.h as a prefix header."
+#endif
+
+
+
+/*
+ * Allocation tracking
+ */
+
+// Each allocation is prefixed with its size so that we can track the
+// current and peak allocated bytes.
+typedef union bench_alloc_header_t {
+    size_t size;
+    double align_double;
+    uint64_t align_u64;
+    void* align_pointer;
+} bench_alloc_header_t;
+
+static size_t bench_alloc_count;
+static size_t bench_alloc_bytes;
+static size_t bench_alloc_peak;
+
+void* bench_malloc(size_t size) {
+    bench_alloc_header_t* header = (bench_alloc_header_t*)malloc(sizeof(bench_alloc_header_t) + size);
+    if (header == NULL)
+        return NULL;
+    header->size = size;
+    ++bench_alloc_count;
+    bench_alloc_bytes += size;
+    if (bench_alloc_bytes > bench_alloc_peak)
+        bench_alloc_peak = bench_alloc_bytes;
+    return header + 1;
+}
+
+void bench_free(void* p) {
+    if (p == NULL)
+        return;
+    bench_alloc_header_t* header = (bench_alloc_header_t*)p - 1;
+    bench_alloc_bytes -= header->size;
+    free(header);
+}
+
+static double bench_now(void) {
+    #if defined(CLOCK_MONOTONIC)
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+    #else
+    return (double)clock() / CLOCKS_PER_SEC;
+    #endif
+}
+
+// Results are accumulated here so that the work can't be optimized away.
+static volatile uint64_t bench_sink;
+
+
+
+/*
+ * Corpora
+ *
+ * Each corpus is written by a function that writes all of its messages with
+ * the given writer. The contents are pseudo-random with a fixed seed, so a
+ * corpus is identical on every run.
+ */
+
+static uint32_t bench_random_state;
+
+static uint32_t bench_random(void) {
+    bench_random_state = bench_random_state * UINT32_C(1103515245) + UINT32_C(12345);
+    return bench_random_state >> 8;
+}
+
+static void bench_write_random_str(mpack_writer_t* writer, uint32_t min, uint32_t max) {
+    static const char chars[] = "abcdefghijklmnopqrstuvwxyz ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+    char buf[512];
+    uint32_t len = min + bench_random() % (max - min + 1);
+    for (uint32_t i = 0; i < len; ++i)
+        buf[i] = chars[bench_random() % (sizeof(chars) - 1)];
+    mpack_write_str(writer, buf, len);
+}
+
+// Small maps, like the objects of a typical web API:
+// {"id": 1234, "name": "...", "active": true, "score": 0.5, "tags": ["...", "..."]}
+#define BENCH_SMALL_MAPS_COUNT 2000
+
+static void bench_write_small_maps(mpack_writer_t* writer) {
+    bench_random_state = 1;
+    for (int i = 0; i < BENCH_SMALL_MAPS_COUNT; ++i) {
+        mpack_start_map(writer, 5);
+        mpack_write_cstr(writer, "id");
+        mpack_write_uint(writer, bench_random() % 100000);
+        mpack_write_cstr(writer, "name");
+        bench_write_random_str(writer, 4, 16);
+        mpack_write_cstr(writer, "active");
+        mpack_write_bool(writer, bench_random() & 1);
+        mpack_write_cstr(writer, "score");
+        mpack_write_double(writer, (double)bench_random() / (1 << 24));
+        mpack_write_cstr(writer, "tags");
+        mpack_start_array(writer, 2);
+        bench_write_random_str(writer, 3, 8);
+        bench_write_random_str(writer, 3, 8);
+        mpack_finish_array(writer);
+        mpack_finish_map(writer);
+    }
+}
+
+// Large numeric arrays, like sensor data or geometry:
+// {"ints": [...], "doubles": [...]}
+#define BENCH_NUMBERS_COUNT 16
+#define BENCH_NUMBERS_LENGTH 4096
+
+static void bench_write_numbers(mpack_writer_t* writer) {
+    bench_random_state = 2;
+    for (int i = 0; i < BENCH_NUMBERS_COUNT; ++i) {
+        mpack_start_map(writer, 2);
+        mpack_write_cstr(writer, "ints");
+        mpack_start_array(writer, BENCH_NUMBERS_LENGTH);
+        for (int j = 0; j < BENCH_NUMBERS_LENGTH; ++j) {
+            // a mix of encoded sizes
+            uint32_t r = bench_random();
+            mpack_write_int(writer, (int64_t)(r >> (r & 15)) - 1000);
+        }
+        mpack_finish_array(writer);
+        mpack_write_cstr(writer, "doubles");
+        mpack_start_array(writer, BENCH_NUMBERS_LENGTH);
+        for (int j = 0; j < BENCH_NUMBERS_LENGTH; ++j)
+            mpack_write_double(writer, (double)bench_random() / 1000.0);
+        mpack_finish_array(writer);
+        mpack_finish_map(writer);
+    }
+}
+
+// String-heavy documents, like logs or text records:
+// [{"key": "...", "text": "..."}, ...]
+#define BENCH_STRINGS_COUNT 100
+#define BENCH_STRINGS_LENGTH 50
+
+static void bench_write_strings(mpack_writer_t* writer) {
+    bench_random_state = 3;
+    for (int i = 0; i < BENCH_STRINGS_COUNT; ++i) {
+        mpack_start_array(writer, BENCH_STRINGS_LENGTH);
+        for (int j = 0; j < BENCH_STRINGS_LENGTH; ++j) {
+            mpack_start_map(writer, 2);
+            mpack_write_cstr(writer, "key");
+            bench_write_random_str(writer, 8, 40);
+            mpack_write_cstr(writer, "text");
+            bench_write_random_str(writer, 100, 400);
+            mpack_finish_map(writer);
+        }
+        mpack_finish_array(writer);
+    }
+}
+
+// Deeply nested data: [0, [1, [2, ... [{"depth": n}] ...]]]
+#define BENCH_NESTED_COUNT 200
+#define BENCH_NESTED_DEPTH 100
+
+static void bench_write_nested(mpack_writer_t* writer) {
+    for (int i = 0; i < BENCH_NESTED_COUNT; ++i) {
+        for (int depth = 0; depth < BENCH_NESTED_DEPTH; ++depth) {
+            mpack_start_array(writer, 2);
+            mpack_write_uint(writer, (uint64_t)depth);
+        }
+        mpack_start_map(writer, 1);
+        mpack_write_cstr(writer, "depth");
+        mpack_write_uint(writer, BENCH_NESTED_DEPTH);
+        mpack_finish_map(writer);
+        for (int depth = 0; depth < BENCH_NESTED_DEPTH; ++depth)
+            mpack_finish_array(writer);
+    }
+}
+
+
+
+/*
+ * Expect API decoders for each corpus
+ */
+
+static void bench_expect_small_maps(mpack_reader_t* reader) {
+    static const char* keys[] = {"id", "name", "active", "score", "tags"};
+    char buf[64];
+    uint64_t sum = 0;
+
+    for (int i = 0; i < BENCH_SMALL_MAPS_COUNT; ++i) {
+        bool found[5] = {false, false, false, false, false};
+        uint32_t count = mpack_expect_map_max(reader, 5);
+        for (uint32_t j = 0; j < count; ++j) {
+            switch (mpack_expect_key_cstr(reader, keys, found, 5)) {
+                case 0: sum += mpack_expect_u32(reader); break;
+                case 1: mpack_expect_cstr(reader, buf, sizeof(buf)); sum += (uint8_t)buf[0]; break;
+                case 2: sum += mpack_expect_bool(reader); break;
+                case 3: sum += (uint64_t)mpack_expect_double(reader); break;
+                case 4: {
+                    uint32_t tags = mpack_expect_array_max(reader, 8);
+                    for (uint32_t k = 0; k < tags; ++k) {
+                        mpack_expect_cstr(reader, buf, sizeof(buf));
+                        sum += (uint8_t)buf[0];
+                    }
+                    mpack_done_array(reader);
+                    break;
+                }
+                default:
+                    mpack_discard(reader);
+                    break;
+            }
+        }
+        mpack_done_map(reader);
+    }
+
+    bench_sink += sum;
+}
+
+static void bench_expect_numbers(mpack_reader_t* reader) {
+    static int64_t ints[BENCH_NUMBERS_LENGTH];
+    static double doubles[BENCH_NUMBERS_LENGTH];
+    uint64_t sum = 0;
+
+    for (int i = 0; i < BENCH_NUMBERS_COUNT; ++i) {
+        mpack_expect_map_match(reader, 2);
+        mpack_expect_cstr_match(reader, "ints");
+        size_t count = mpack_expect_array_i64_into(reader, ints, BENCH_NUMBERS_LENGTH);
+        for (size_t j = 0; j < count; ++j)
+            sum += (uint64_t)ints[j];
+        mpack_expect_cstr_match(reader, "doubles");
+        count = mpack_expect_array_double_into(reader, doubles, BENCH_NUMBERS_LENGTH);
+        for (size_t j = 0; j < count; ++j)
+            sum += (uint64_t)doubles[j];
+        mpack_done_map(reader);
+    }
+
+    bench_sink += sum;
+}
+
+static void bench_expect_strings(mpack_reader_t* reader) {
+    char key[64];
+    char text[512];
+    uint64_t sum = 0;
+
+    for (int i = 0; i < BENCH_STRINGS_COUNT; ++i) {
+        uint32_t count = mpack_expect_array(reader);
+        for (uint32_t j = 0; j < count; ++j) {
+            mpack_expect_map_match(reader, 2);
+            mpack_expect_cstr_match(reader, "key");
+            mpack_expect_cstr(reader, key, sizeof(key));
+            mpack_expect_cstr_match(reader, "text");
+            mpack_expect_cstr(reader, text, sizeof(text));
+            mpack_done_map(reader);
+            sum += (uint64_t)key[0] + (uint64_t)text[0];
+        }
+        mpack_done_array(reader);
+    }
+
+    bench_sink += sum;
+}
+
+static void bench_expect_nested(mpack_reader_t* reader) {
+    uint64_t sum = 0;
+
+    for (int i = 0; i < BENCH_NESTED_COUNT; ++i) {
+        for (int depth = 0; depth < BENCH_NESTED_DEPTH; ++depth) {
+            mpack_expect_array_match(reader, 2);
+            sum += mpack_expect_uint(reader);
+        }
+        mpack_expect_map_match(reader, 1);
+        mpack_expect_cstr_match(reader, "depth");
+        sum += mpack_expect_uint(reader);
+        mpack_done_map(reader);
+        for (int depth = 0; depth < BENCH_NESTED_DEPTH; ++depth)
+            mpack_done_array(reader);
+    }
+
+    bench_sink += sum;
+}
+
+
+
+/*
+ * Benchmark cases
+ */
+
+typedef struct bench_corpus_t {
+    const char* name;
+    void (*write)(mpack_writer_t* writer);
+    void (*expect)(mpack_reader_t* reader);
+    size_t messages;
+
+    char* data;
+    size_t size;
+} bench_corpus_t;
+
+static bench_corpus_t bench_corpora[] = {
+    {"small-maps", bench_write_small_maps, bench_expect_small_maps, BENCH_SMALL_MAPS_COUNT, NULL, 0},
+    {"numbers",    bench_write_numbers,    bench_expect_numbers,    BENCH_NUMBERS_COUNT,    NULL, 0},
+    {"strings",    bench_write_strings,    bench_expect_strings,    BENCH_STRINGS_COUNT,    NULL, 0},
+    {"nested",     bench_write_nested,     bench_expect_nested,     BENCH_NESTED_COUNT,     NULL, 0},
+};
+
+// Runs one iteration of an API over a corpus, returning false on error.
+typedef bool (*bench_run_t)(bench_corpus_t* corpus, char* buffer);
+
+static bool bench_run_write(bench_corpus_t* corpus, char* buffer) {
+    mpack_writer_t writer;
+    mpack_writer_init(&writer, buffer, corpus->size);
+    corpus->write(&writer);
+    bench_sink += mpack_writer_buffer_used(&writer);
+    return mpack_writer_destroy(&writer) == mpack_ok;
+}
+
+static bool bench_run_reader(bench_corpus_t* corpus, char* buffer) {
+    MPACK_UNUSED(buffer);
+    mpack_reader_t reader;
+    mpack_reader_init_data(&reader, corpus->data, corpus->size);
+    for (size_t i = 0; i < corpus->messages; ++i)
+        mpack_discard(&reader);
+    bench_sink += mpack_reader_remaining(&reader, NULL);
+    return mpack_reader_destroy(&reader) == mpack_ok;
+}
+
+static bool bench_run_expect(bench_corpus_t* corpus, char* buffer) {
+    MPACK_UNUSED(buffer);
+    mpack_reader_t reader;
+    mpack_reader_init_data(&reader, corpus->data, corpus->size);
+    corpus->expect(&reader);
+    return mpack_reader_destroy(&reader) == mpack_ok;
+}
+
+static bool bench_run_node(bench_corpus_t* corpus, char* buffer) {
+    MPACK_UNUSED(buffer);
+    mpack_tree_t tree;
+    mpack_tree_init_data(&tree, corpus->data, corpus->size);
+    for (size_t i = 0; i < corpus->messages; ++i) {
+        mpack_tree_parse(&tree);
+        bench_sink += mpack_node_type(mpack_tree_root(&tree));
+    }
+    return mpack_tree_destroy(&tree) == mpack_ok;
+}
+
+static const struct {
+    const char* name;
+    bench_run_t run;
+} bench_apis[] = {
+    {"write",  bench_run_write},
+    {"reader", bench_run_reader},
+    {"expect", bench_run_expect},
+    {"node",   bench_run_node},
+};
+
+static bool bench_corpus_init(bench_corpus_t* corpus) {
+    mpack_writer_t writer;
+    mpack_writer_init_growable(&writer, &corpus->data, &corpus->size);
+    corpus->write(&writer);
+    if (mpack_writer_destroy(&writer) != mpack_ok) {
+        fprintf(stderr, "error writing corpus %s!\n", corpus->name);
+        return false;
+    }
+    return true;
+}
+
+static bool bench_case(bench_corpus_t* corpus, const char* api, bench_run_t run, double min_seconds) {
+    char* buffer = (char*)malloc(corpus->size);
+    if (buffer == NULL) {
+        fprintf(stderr, "out of memory!\n");
+        return false;
+    }
+
+    // warm up, and make sure the case works
+    if (!run(corpus, buffer)) {
+        fprintf(stderr, "error running %s on corpus %s!\n", api, corpus->name);
+        free(buffer);
+        return false;
+    }
+
+    bench_alloc_count = 0;
+    bench_alloc_peak = bench_alloc_bytes;
+    size_t baseline = bench_alloc_bytes;
+
+    size_t iterations = 0;
+    double start = bench_now();
+    double elapsed;
+    do {
+        run(corpus, buffer);
+        ++iterations;
+        elapsed = bench_now() - start;
+    } while (elapsed < min_seconds);
+
+    free(buffer);
+
+    printf("{\"corpus\": \"%s\", \"api\": \"%s\", \"bytes\": %lu, \"messages\": %lu, "
+            "\"iterations\": %lu, \"seconds\": %.6f, \"mb_per_s\": %.3f, \"messages_per_s\": %.1f, "
+            "\"allocations\": %.2f, \"peak_bytes\": %lu}\n",
+            corpus->name, api, (unsigned long)corpus->size, (unsigned long)corpus->messages,
+            (unsigned long)iterations, elapsed,
+            (double)corpus->size * (double)iterations / elapsed / 1e6,
+            (double)corpus->messages * (double)iterations / elapsed,
+            (double)bench_alloc_count / (double)iterations,
+            (unsigned long)(bench_alloc_peak - baseline));
+    fflush(stdout);
+    return true;
+}
+
+static bool bench_selected(int argc, char** argv, int first, const char* corpus, const char* api) {
+    if (first == argc)
+        return true;
+    for (int i = first; i < argc; ++i)
+        if (strcmp(argv[i], corpus) == 0 || strcmp(argv[i], api) == 0)
+            return true;
+    return false;
+}
+
+int main(int argc, char** argv) {
+    double min_seconds = 0.5;
+    int first = 1;
+    if (argc > 2 && strcmp(argv[1], "-t") == 0) {
+        min_seconds = atof(argv[2]);
+        first = 3;
+    }
+
+    bool ok = true;
+    for (size_t i = 0; i < sizeof(bench_corpora) / sizeof(*bench_corpora); ++i) {
+        bench_corpus_t* corpus = &bench_corpora[i];
+        if (!bench_corpus_init(corpus))
+            return EXIT_FAILURE;
+        for (size_t j = 0; j < sizeof(bench_apis) / sizeof(*bench_apis); ++j)
+            if (bench_selected(argc, argv, first, corpus->name, bench_apis[j].name))
+                ok = bench_case(corpus, bench_apis[j].name, bench_apis[j].run, min_seconds) && ok;
+        MPACK_FREE(corpus->data);
+    }
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+#else
+typedef int mpack_pedantic_allow_empty_translation_unit;
+#endif
@@ -103,6 +103,9 @@
 #define MPACK_STACK_SIZE 33
 #define MPACK_BUFFER_SIZE 33
 #define MPACK_NODE_PAGE_SIZE 113
+#define MPACK_NODE_MAP_INDEX_THRESHOLD 4
+#define MPACK_BUILDER_PAGE_SIZE 128
+#define MPACK_WRITER_CHUNK_MAX_SIZE 256
 
 #ifdef MPACK_MALLOC
 #define MPACK_NODE_INITIAL_DEPTH 3
@@ -120,6 +120,53 @@ static size_t test_buffer_fill(mpack_reader_t* reader, char* buffer, size_t coun
     state->remaining -= count;
     return count;
 }
+
+typedef struct test_borrow_state_t {
+    const char* data;
+    size_t remaining;
+    size_t chunk_size;
+    const char* outstanding; // the chunk lent to the reader, or NULL
+    size_t outstanding_size;
+    size_t borrows;
+    size_t releases;
+} test_borrow_state_t;
+
+static size_t test_buffer_borrow(mpack_reader_t* reader, const char** data) {
+    test_borrow_state_t* state = (test_borrow_state_t*)reader->context;
+    TEST_TRUE(state->outstanding == NULL, "previous chunk was not released");
+    size_t count = state->chunk_size;
+    if (state->remaining < count)
+        count = state->remaining;
+    if (count == 0)
+        return 0;
+    *data = state->data;
+    state->outstanding = state->data;
+    state->outstanding_size = count;
+    state->data += count;
+    state->remaining -= count;
+    ++state->borrows;
+    return count;
+}
+
+static void test_buffer_release(mpack_reader_t* reader, const char* data, size_t count) {
+    test_borrow_state_t* state = (test_borrow_state_t*)reader->context;
+    TEST_TRUE(data == state->outstanding && count == state->outstanding_size,
+            "released chunk was not borrowed");
+    state->outstanding = NULL;
+    ++state->releases;
+}
+
+static void test_buffer_init_borrow(mpack_reader_t* reader, char* buffer, size_t size,
+        test_borrow_state_t* state, const char* data, size_t length, size_t chunk_size)
+{
+    memset(state, 0, sizeof(*state));
+    state->data = data;
+    state->remaining = length;
+    state->chunk_size = chunk_size;
+    mpack_reader_init(reader, buffer, size, 0);
+    mpack_reader_set_borrow(reader, test_buffer_borrow, test_buffer_release);
+    mpack_reader_set_context(reader, state);
+}
 #endif
 
 #if MPACK_WRITER
@@ -266,6 +313,26 @@ static void test_expect_buffer(void) {
 }
 #endif
 
+#if MPACK_EXPECT
+static void test_expect_borrow(void) {
+    for (size_t i = 0; i < sizeof(test_buffer_sizes) / sizeof(test_buffer_sizes[0]) + 31; ++i) {
+        size_t chunk_size = (i < 31) ? i + 1 : test_buffer_sizes[i - 31];
+
+        // only a minimal buffer is needed for values straddling chunks
+        char buffer[MPACK_READER_MINIMUM_BUFFER_SIZE];
+        mpack_reader_t reader;
+        test_borrow_state_t state;
+        test_buffer_init_borrow(&reader, buffer, sizeof(buffer), &state,
+                test_numbers, sizeof(test_numbers) - 1, chunk_size);
+
+        test_expect_buffer_values(&reader);
+        TEST_READER_DESTROY_NOERROR(&reader);
+        TEST_TRUE(state.remaining == 0);
+        TEST_TRUE(state.borrows > 0 && state.releases == state.borrows);
+    }
+}
+#endif
+
 #if MPACK_WRITER
 static void test_write_buffer(void) {
     for (size_t i = 0; i < sizeof(test_buffer_sizes) / sizeof(test_buffer_sizes[0]); ++i) {
@@ -346,6 +413,60 @@ static void test_inplace_buffer(void) {
 }
 #endif
 
+#if MPACK_READER
+static void test_inplace_borrow(void) {
+    for (size_t i = 0; i < sizeof(test_buffer_sizes) / sizeof(test_buffer_sizes[0]) + 31; ++i) {
+        size_t chunk_size = (i < 31) ? i + 1 : test_buffer_sizes[i - 31];
+
+        char buffer[MPACK_READER_MINIMUM_BUFFER_SIZE];
+        mpack_reader_t reader;
+        test_borrow_state_t state;
+        test_buffer_init_borrow(&reader, buffer, sizeof(buffer), &state,
+                test_strings, sizeof(test_strings) - 1, chunk_size);
+
+        mpack_tag_t tag = mpack_read_tag(&reader);
+        TEST_TRUE(tag.type == mpack_type_array && tag.v.n == 15);
+
+        // strings within a chunk are read directly out of it. the rest
+        // are copied into the buffer.
+        static const char* ref = "abcdefghijklmn";
+        for (size_t j = 0; j < 15; ++j) {
+            tag = mpack_read_tag(&reader);
+            TEST_TRUE(tag.type == mpack_type_str && tag.v.l == j);
+            const char* val = mpack_read_bytes_inplace(&reader, tag.v.l);
+            TEST_TRUE(mpack_reader_error(&reader) == mpack_ok);
+            TEST_TRUE(memcmp(val, ref, tag.v.l) == 0, "strings do not match!");
+            if (j > 0 && chunk_size >= sizeof(test_strings) - 1)
+                TEST_TRUE(val > test_strings && val + j < test_strings + sizeof(test_strings),
+                        "string was copied out of its chunk");
+            mpack_done_str(&reader);
+        }
+
+        mpack_done_array(&reader);
+        TEST_READER_DESTROY_NOERROR(&reader);
+        TEST_TRUE(state.releases == state.borrows);
+    }
+
+    // skipping passes over chunks without copying them
+    char buffer[MPACK_READER_MINIMUM_BUFFER_SIZE];
+    mpack_reader_t reader;
+    test_borrow_state_t state;
+    test_buffer_init_borrow(&reader, buffer, sizeof(buffer), &state,
+            test_strings, sizeof(test_strings) - 1, 3);
+    mpack_discard(&reader);
+    TEST_TRUE(state.remaining == 0);
+    TEST_READER_DESTROY_NOERROR(&reader);
+    TEST_TRUE(state.releases == state.borrows);
+
+    // running out of chunks is an I/O error
+    test_buffer_init_borrow(&reader, buffer, sizeof(buffer), &state,
+            test_strings, 10, 4);
+    mpack_discard(&reader);
+    TEST_READER_DESTROY_ERROR(&reader, mpack_error_io);
+    TEST_TRUE(state.releases == state.borrows);
+}
+#endif
+
 void test_buffers(void) {
     MPACK_UNUSED(test_numbers);
     MPACK_UNUSED(test_strings);
@@ -353,12 +474,14 @@ void test_buffers(void) {
 
     #if MPACK_EXPECT
     test_expect_buffer();
+    test_expect_borrow();
     #endif
     #if MPACK_WRITER
     test_write_buffer();
     #endif
     #if MPACK_READER
     test_inplace_buffer();
+    test_inplace_borrow();
     #endif
 }
 
@@ -0,0 +1,275 @@
+/*
+ * Copyright (c) 2015-2018 Nicholas Fraser
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "test-codec.h"
+#include "test-reader.h"
+#include "test-write.h"
+
+#if MPACK_CODEC && defined(MPACK_MALLOC) && MPACK_EXPECT && MPACK_WRITER
+
+typedef struct test_point_t {
+    int32_t x;
+    int32_t y;
+    char label[8];
+} test_point_t;
+
+typedef struct test_shape_t {
+    bool visible;
+    int8_t i8;
+    int16_t i16;
+    int64_t i64;
+    uint8_t u8;
+    uint16_t u16;
+    uint32_t u32;
+    uint64_t u64;
+    float f;
+    double d;
+    test_point_t origin;
+} test_shape_t;
+
+static const mpack_field_t test_point_fields[] = {
+    MPACK_FIELD(test_point_t, x, mpack_field_i32),
+    MPACK_FIELD(test_point_t, y, mpack_field_i32),
+    MPACK_FIELD_OPTIONAL(test_point_t, label, mpack_field_cstr),
+};
+
+static mpack_codec_t test_point_codec;
+
+static const mpack_field_t test_shape_fields[] = {
+    MPACK_FIELD(test_shape_t, visible, mpack_field_bool),
+    MPACK_FIELD(test_shape_t, i8, mpack_field_i8),
+    MPACK_FIELD(test_shape_t, i16, mpack_field_i16),
+    MPACK_FIELD(test_shape_t, i64, mpack_field_i64),
+    MPACK_FIELD(test_shape_t, u8, mpack_field_u8),
+    MPACK_FIELD(test_shape_t, u16, mpack_field_u16),
+    MPACK_FIELD(test_shape_t, u32, mpack_field_u32),
+    MPACK_FIELD(test_shape_t, u64, mpack_field_u64),
+    MPACK_FIELD(test_shape_t, f, mpack_field_float),
+    MPACK_FIELD(test_shape_t, d, mpack_field_double),
+    MPACK_FIELD_STRUCT(test_shape_t, origin, &test_point_codec),
+};
+
+static mpack_codec_t test_shape_codec;
+
+#define TEST_COUNT(fields) (sizeof(fields) / sizeof(*(fields)))
+
+static void test_codec_point(void) {
+    mpack_codec_t* codec = &test_point_codec;
+
+    // keys are written in order from their pre-encoded headers
+    test_point_t point = {3, -4, "abc"};
+    char buf[64];
+    mpack_writer_t writer;
+    mpack_writer_init(&writer, buf, sizeof(buf));
+    mpack_write_struct(&writer, codec, &point);
+    size_t used = mpack_writer_buffer_used(&writer);
+    TEST_WRITER_DESTROY_NOERROR(&writer);
+    static const char encoded[] = "\x83\xa1x\x03\xa1y\xfc\xa5label\xa3""abc";
+    TEST_TRUE(used == sizeof(encoded) - 1);
+    TEST_TRUE(memcmp(buf, encoded, used) == 0);
+
+    // keys can be in any order, unknown keys are skipped and optional keys
+    // can be missing
+    mpack_reader_t reader;
+    test_point_t read;
+    memset(&read, 0, sizeof(read));
+    read.label[0] = 'z';
+    static const char reordered[] = "\x84\xa1y\x05\x01\x02\xa1q\x90\xa1x\xd0\x80";
+    mpack_reader_init_data(&reader, reordered, sizeof(reordered) - 1);
+    mpack_expect_struct(&reader, codec, &read);
+    TEST_READER_DESTROY_NOERROR(&reader);
+    TEST_TRUE(read.x == -128 && read.y == 5 && read.label[0] == 'z');
+
+    // a missing required key
+    static const char missing[] = "\x81\xa1x\x01";
+    mpack_reader_init_data(&reader, missing, sizeof(missing) - 1);
+    mpack_expect_struct(&reader, codec, &read);
+    TEST_READER_DESTROY_ERROR(&reader, mpack_error_data);
+
+    // a duplicate key
+    static const char duplicate[] = "\x83\xa1x\x01\xa1y\x01\xa1x\x01";
+    mpack_reader_init_data(&reader, duplicate, sizeof(duplicate) - 1);
+    mpack_expect_struct(&reader, codec, &read);
+    TEST_READER_DESTROY_ERROR(&reader, mpack_error_invalid);
+
+    // a value of the wrong type
+    static const char mistyped[] = "\x82\xa1x\xc3\xa1y\x01";
+    mpack_reader_init_data(&reader, mistyped, sizeof(mistyped) - 1);
+    mpack_expect_struct(&reader, codec, &read);
+    TEST_READER_DESTROY_ERROR(&reader, mpack_error_type);
+
+    // a string too long for its member
+    static const char long_label[] = "\x83\xa1x\x01\xa1y\x01\xa5label\xa8""abcdefgh";
+    mpack_reader_init_data(&reader, long_label, sizeof(long_label) - 1);
+    mpack_expect_struct(&reader, codec, &read);
+    TEST_READER_DESTROY_ERROR(&reader, mpack_error_too_big);
+
+    // not a map
+    mpack_reader_init_data(&reader, "\x90", 1);
+    mpack_expect_struct(&reader, codec, &read);
+    TEST_READER_DESTROY_ERROR(&reader, mpack_error_type);
+
+    // an unterminated string is bounded by its member
+    memcpy(point.label, "abcdefgh", sizeof(point.label));
+    mpack_writer_init(&writer, buf, sizeof(buf));
+    mpack_write_struct(&writer, codec, &point);
+    TEST_WRITER_DESTROY_NOERROR(&writer);
+    TEST_TRUE(memcmp(buf + 13, "\xa8""abcdefgh", 9) == 0);
+}
+
+static void test_codec_shape(void) {
+    test_shape_t shape;
+    memset(&shape, 0, sizeof(shape));
+    shape.visible = true;
+    shape.i8 = -100;
+    shape.i16 = -30000;
+    shape.i64 = INT64_MIN;
+    shape.u8 = 200;
+    shape.u16 = 60000;
+    shape.u32 = 4000000000u;
+    shape.u64 = UINT64_MAX;
+    shape.f = 1.5f;
+    shape.d = -2.25;
+    shape.origin.x = 7;
+    shape.origin.y = 8;
+    strcpy(shape.origin.label, "origin");
+
+    char buf[256];
+    mpack_writer_t writer;
+    mpack_writer_init(&writer, buf, sizeof(buf));
+    mpack_write_struct(&writer, &test_shape_codec, &shape);
+    size_t used = mpack_writer_buffer_used(&writer);
+    TEST_WRITER_DESTROY_NOERROR(&writer);
+
+    test_shape_t read;
+    memset(&read, 0, sizeof(read));
+    mpack_reader_t reader;
+    mpack_reader_init_data(&reader, buf, used);
+    mpack_expect_struct(&reader, &test_shape_codec, &read);
+    TEST_READER_DESTROY_NOERROR(&reader);
+    TEST_TRUE(read.visible == shape.visible);
+    TEST_TRUE(read.i8 == shape.i8);
+    TEST_TRUE(read.i16 == shape.i16);
+    TEST_TRUE(read.i64 == shape.i64);
+    TEST_TRUE(read.u8 == shape.u8);
+    TEST_TRUE(read.u16 == shape.u16);
+    TEST_TRUE(read.u32 == shape.u32);
+    TEST_TRUE(read.u64 == shape.u64);
+    TEST_TRUE(read.f == shape.f);
+    TEST_TRUE(read.d == shape.d);
+    TEST_TRUE(read.origin.x == 7 && read.origin.y == 8);
+    TEST_TRUE(strcmp(read.origin.label, "origin") == 0);
+
+    // the output matches hand-written code
+    char reference[256];
+    mpack_writer_init(&writer, reference, sizeof(reference));
+    mpack_start_map(&writer, 11);
+    mpack_write_cstr(&writer, "visible"); mpack_write_bool(&writer, shape.visible);
+    mpack_write_cstr(&writer, "i8");      mpack_write_i8(&writer, shape.i8);
+    mpack_write_cstr(&writer, "i16");     mpack_write_i16(&writer, shape.i16);
+    mpack_write_cstr(&writer, "i64");     mpack_write_i64(&writer, shape.i64);
+    mpack_write_cstr(&writer, "u8");      mpack_write_u8(&writer, shape.u8);
+    mpack_write_cstr(&writer, "u16");     mpack_write_u16(&writer, shape.u16);
+    mpack_write_cstr(&writer, "u32");     mpack_write_u32(&writer, shape.u32);
+    mpack_write_cstr(&writer, "u64");     mpack_write_u64(&writer, shape.u64);
+    mpack_write_cstr(&writer, "f");       mpack_write_float(&writer, shape.f);
+    mpack_write_cstr(&writer, "d");       mpack_write_double(&writer, shape.d);
+    mpack_write_cstr(&writer, "origin");
+    mpack_start_map(&writer, 3);
+    mpack_write_cstr(&writer, "x");       mpack_write_i32(&writer, 7);
+    mpack_write_cstr(&writer, "y");       mpack_write_i32(&writer, 8);
+    mpack_write_cstr(&writer, "label");   mpack_write_cstr(&writer, "origin");
+    mpack_finish_map(&writer);
+    mpack_finish_map(&writer);
+    TEST_TRUE(mpack_writer_buffer_used(&writer) == used);
+    TEST_TRUE(memcmp(reference, buf, used) == 0);
+    TEST_WRITER_DESTROY_NOERROR(&writer);
+}
+
+static bool test_codec_init(void) {
+    mpack_codec_t codec;
+    if (!mpack_codec_init(&codec, test_point_fields, TEST_COUNT(test_point_fields)))
+        return false;
+    TEST_TRUE(codec.count == 3);
+    mpack_codec_destroy(&codec);
+    return true;
+}
+
+static void test_codec_errors(void) {
+    mpack_codec_t codec;
+    TEST_TRUE(!mpack_codec_init(&codec, test_point_fields, 0));
+    TEST_TRUE(!mpack_codec_init(&codec, test_point_fields, MPACK_CODEC_MAX_FIELDS + 1));
+
+    static const mpack_field_t duplicates[] = {
+        MPACK_FIELD(test_point_t, x, mpack_field_i32),
+        MPACK_FIELD(test_point_t, x, mpack_field_i32),
+    };
+    TEST_TRUE(!mpack_codec_init(&codec, duplicates, TEST_COUNT(duplicates)));
+
+    // the member size must match its type
+    static const mpack_field_t mismatched[] = {
+        MPACK_FIELD(test_point_t, x, mpack_field_i16),
+    };
+    TEST_BREAK(!mpack_codec_init(&codec, mismatched, TEST_COUNT(mismatched)));
+}
+
+static void test_codec_allocator(void) {
+    static char arena_data[1024];
+    test_arena_t arena;
+    mpack_allocator_t allocator = test_arena_init(&arena, arena_data, sizeof(arena_data), true);
+    size_t mallocs = test_malloc_total_count();
+
+    mpack_codec_t codec;
+    TEST_TRUE(mpack_codec_init_allocator(&codec, test_point_fields, TEST_COUNT(test_point_fields), &allocator));
+    TEST_TRUE(test_arena_contains(&arena, codec.storage));
+    mpack_codec_destroy(&codec);
+
+    // a codec that fails to compile frees its storage with the allocator
+    static const mpack_field_t duplicates[] = {
+        MPACK_FIELD(test_point_t, x, mpack_field_i32),
+        MPACK_FIELD(test_point_t, x, mpack_field_i32),
+    };
+    TEST_TRUE(!mpack_codec_init_allocator(&codec, duplicates, TEST_COUNT(duplicates), &allocator));
+
+    // write tracking allocates while the keys are encoded
+    #if !MPACK_WRITE_TRACKING
+    TEST_TRUE(test_malloc_total_count() == mallocs);
+    #else
+    MPACK_UNUSED(mallocs);
+    #endif
+    TEST_TRUE(arena.allocs == 2);
+    TEST_TRUE(arena.frees == arena.allocs);
+}
+
+void test_codec(void) {
+    test_system_fail_until_ok(&test_codec_init);
+    test_codec_errors();
+    test_codec_allocator();
+
+    TEST_TRUE(mpack_codec_init(&test_point_codec, test_point_fields, TEST_COUNT(test_point_fields)));
+    TEST_TRUE(mpack_codec_init(&test_shape_codec, test_shape_fields, TEST_COUNT(test_shape_fields)));
+    test_codec_point();
+    test_codec_shape();
+    mpack_codec_destroy(&test_shape_codec);
+    mpack_codec_destroy(&test_point_codec);
+}
+
+#endif
@@ -267,6 +267,7 @@ static void test_strings() {
     TEST_ERROR_STRING(memory);
     TEST_ERROR_STRING(bug);
     TEST_ERROR_STRING(data);
+    TEST_ERROR_STRING(would_block);
     #undef TEST_ERROR_STRING
 
     #define TEST_ERROR_TYPE(type) test_string(mpack_type_to_string(mpack_type_##type), #type)
@@ -427,15 +428,183 @@ static void test_utf8_check(void) {
     TEST_TRUE(false == mpack_utf8_check(EXPAND_STR_ARGS("test\xC1""testtesttest")));
     TEST_TRUE(false == mpack_utf8_check(EXPAND_STR_ARGS("test\xF5""testtesttest")));
     TEST_TRUE(false == mpack_utf8_check(EXPAND_STR_ARGS("test\xFF""testtesttest")));
+
+    // sequences at every offset in long ASCII strings (to test block checks)
+    char buf[40];
+    for (size_t i = 0; i < sizeof(buf); ++i) {
+        mpack_memset(buf, 'a', sizeof(buf));
+        TEST_TRUE(true  == mpack_utf8_check_no_null(buf, sizeof(buf)));
+
+        buf[i] = '\x00';
+        TEST_TRUE(true  == mpack_utf8_check(buf, sizeof(buf)));
+        TEST_TRUE(false == mpack_utf8_check_no_null(buf, sizeof(buf)));
+        TEST_TRUE(true  == mpack_utf8_check_no_null(buf, i));
+
+        buf[i] = '\xFF';
+        TEST_TRUE(false == mpack_utf8_check(buf, sizeof(buf)));
+        TEST_TRUE(true  == mpack_utf8_check(buf, i));
+
+        if (i + 3 <= sizeof(buf)) {
+            mpack_memcpy(buf + i, "\xE2\x82\xAC", 3); // U+20AC
+            TEST_TRUE(true  == mpack_utf8_check_no_null(buf, sizeof(buf)));
+            TEST_TRUE(false == mpack_utf8_check(buf, i + 2)); // truncated
+            mpack_memcpy(buf + i, "\xED\xA0\x80", 3); // U+D800 (surrogate)
+            TEST_TRUE(false == mpack_utf8_check(buf, sizeof(buf)));
+        }
+    }
+}
+
+static void test_tag_descs(void) {
+    TEST_TRUE(mpack_tag_descs[0x00].type == mpack_type_uint);
+    TEST_TRUE(mpack_tag_descs[0x7f].fixed == 0x7f);
+    TEST_TRUE(mpack_tag_descs[0x8f].type == mpack_type_map);
+    TEST_TRUE(mpack_tag_descs[0x8f].fixed == 15);
+    TEST_TRUE(mpack_tag_descs[0x9a].type == mpack_type_array);
+    TEST_TRUE(mpack_tag_descs[0x9a].fixed == 10);
+    TEST_TRUE(mpack_tag_descs[0xbf].type == mpack_type_str);
+    TEST_TRUE(mpack_tag_descs[0xbf].fixed == 31);
+    TEST_TRUE(mpack_tag_descs[0xc1].type == mpack_type_missing);
+    TEST_TRUE(mpack_tag_descs[0xc3].type == mpack_type_bool);
+    TEST_TRUE(mpack_tag_descs[0xc3].fixed == 1);
+    TEST_TRUE(mpack_tag_descs[0xd8].type == MPACK_TAG_DESC_EXT);
+    TEST_TRUE(mpack_tag_descs[0xd8].fixed == 16);
+    TEST_TRUE(mpack_tag_descs[0xe0].type == mpack_type_int);
+
+    // the headers match the tag sizes
+    TEST_TRUE(mpack_tag_descs[0xc4].header == MPACK_TAG_SIZE_BIN8);
+    TEST_TRUE(mpack_tag_descs[0xc9].header == MPACK_TAG_SIZE_EXT32);
+    TEST_TRUE(mpack_tag_descs[0xcb].header == MPACK_TAG_SIZE_DOUBLE);
+    TEST_TRUE(mpack_tag_descs[0xcf].header == MPACK_TAG_SIZE_U64);
+    TEST_TRUE(mpack_tag_descs[0xd1].header == MPACK_TAG_SIZE_I16);
+    TEST_TRUE(mpack_tag_descs[0xd6].header == MPACK_TAG_SIZE_FIXEXT4);
+    TEST_TRUE(mpack_tag_descs[0xdb].header == MPACK_TAG_SIZE_STR32);
+    TEST_TRUE(mpack_tag_descs[0xdc].header == MPACK_TAG_SIZE_ARRAY16);
+    TEST_TRUE(mpack_tag_descs[0xdf].header == MPACK_TAG_SIZE_MAP32);
+
+    // every non-fix tag has its value at the end, except exts which end
+    // with their exttype
+    size_t i;
+    for (i = 0; i < 256; ++i) {
+        const mpack_tag_desc_t* desc = &mpack_tag_descs[i];
+        size_t extra = (desc->type == MPACK_TAG_DESC_EXT) ? 1 : 0;
+        TEST_TRUE(desc->header == 1 + desc->width + extra);
+    }
+
+    // values are loaded big-endian and ints are sign-extended, whether or not
+    // the data is padded enough to load them without branching on the width
+    static const char u16[9] = "\xcd\x12\x34";
+    TEST_TRUE(mpack_tag_desc_value(&mpack_tag_descs[0xcd], u16, 3) == 0x1234);
+    TEST_TRUE(mpack_tag_desc_value(&mpack_tag_descs[0xcd], u16, 9) == 0x1234);
+    static const char i32[9] = "\xd2\xff\xff\xff\xfe";
+    TEST_TRUE(mpack_tag_desc_int(&mpack_tag_descs[0xd2],
+                mpack_tag_desc_value(&mpack_tag_descs[0xd2], i32, 5)) == -2);
+    TEST_TRUE(mpack_tag_desc_int(&mpack_tag_descs[0xd2],
+                mpack_tag_desc_value(&mpack_tag_descs[0xd2], i32, 9)) == -2);
+    static const char u64[10] = "\xcf\x01\x02\x03\x04\x05\x06\x07\x08";
+    TEST_TRUE(mpack_tag_desc_value(&mpack_tag_descs[0xcf], u64, 9) == UINT64_C(0x0102030405060708));
+    static const char fix[9] = "\xe1\x01";
+    TEST_TRUE(mpack_tag_desc_int(&mpack_tag_descs[0xe1],
+                mpack_tag_desc_value(&mpack_tag_descs[0xe1], fix, 1)) == -31);
+    TEST_TRUE(mpack_tag_desc_int(&mpack_tag_descs[0xe1],
+                mpack_tag_desc_value(&mpack_tag_descs[0xe1], fix, 9)) == -31);
+    static const char i8[9] = "\xd0\x7f\xff";
+    TEST_TRUE(mpack_tag_desc_int(&mpack_tag_descs[0xd0],
+                mpack_tag_desc_value(&mpack_tag_descs[0xd0], i8, 2)) == 127);
+    TEST_TRUE(mpack_tag_desc_int(&mpack_tag_descs[0xd0],
+                mpack_tag_desc_value(&mpack_tag_descs[0xd0], i8, 9)) == 127);
 }
 
+#define TEST_VALIDATE(error, data, limits) \
+    TEST_TRUE(mpack_validate(data, sizeof(data) - 1, limits) == error)
+
+static void test_validate(void) {
+    mpack_validate_limits_t limits;
+    mpack_memset(&limits, 0, sizeof(limits));
+
+    TEST_VALIDATE(mpack_ok, "\x93\x01\xa1" "a" "\xc0", NULL);
+    TEST_VALIDATE(mpack_ok, "\x93\x01\xa1" "a" "\xc0", &limits);
+    TEST_VALIDATE(mpack_ok, "\x82\xa1" "a" "\x90\xa1" "b" "\x80", &limits);
+    TEST_VALIDATE(mpack_ok, "\xcb\x00\x00\x00\x00\x00\x00\x00\x00", &limits);
+    TEST_VALIDATE(mpack_ok, "\x92\xd1\x80\x00\xc4\x02\xff\xff", &limits);
+
+    // incomplete
+    TEST_VALIDATE(mpack_error_eof, "", &limits);
+    TEST_VALIDATE(mpack_error_eof, "\x92\x01", &limits);
+    TEST_VALIDATE(mpack_error_eof, "\xa3" "ab", &limits);
+    TEST_VALIDATE(mpack_error_eof, "\xcd\x01", &limits);
+    TEST_VALIDATE(mpack_error_eof, "\xdd\xff\xff\xff\xff", &limits);
+    TEST_VALIDATE(mpack_error_eof, "\xc6\xff\xff\xff\xff" "a", &limits);
+
+    // malformed
+    TEST_VALIDATE(mpack_error_invalid, "\xc1", &limits);
+    TEST_VALIDATE(mpack_error_invalid, "\x91\xc1", &limits);
+    TEST_VALIDATE(mpack_error_invalid, "\x01\x02", &limits);
+    TEST_VALIDATE(mpack_error_invalid, "\x91\x90\x01", &limits);
+
+    // exts are only allowed if enabled
+    TEST_VALIDATE(mpack_error_unsupported, "\xd4\x01\x02", &limits);
+    TEST_VALIDATE(mpack_ok, "\xd4\x01\x02", NULL);
+    limits.extensions = true;
+    TEST_VALIDATE(mpack_ok, "\x92\xd4\x01\x02\xc7\x01\x05\x00", &limits);
+    TEST_VALIDATE(mpack_error_eof, "\xd8\x01\x02", &limits);
+    limits.extensions = false;
+
+    // utf-8 is only checked if enabled, and only in strings
+    TEST_VALIDATE(mpack_ok, "\xa2\xc3\x28", &limits);
+    limits.utf8 = true;
+    TEST_VALIDATE(mpack_error_invalid, "\xa2\xc3\x28", &limits);
+    TEST_VALIDATE(mpack_ok, "\xa2\xc3\xa9", &limits);
+    TEST_VALIDATE(mpack_ok, "\xc4\x02\xc3\x28", &limits);
+    limits.utf8 = false;
+
+    // depth
+    limits.max_depth = 3;
+    TEST_VALIDATE(mpack_ok, "\x91\x91\x91\x01", &limits);
+    TEST_VALIDATE(mpack_ok, "\x92\x91\x91\x01\x91\x91\x90", &limits);
+    TEST_VALIDATE(mpack_error_too_big, "\x91\x91\x91\x91\x01", &limits);
+    TEST_VALIDATE(mpack_error_too_big, "\x81\x01\x81\x01\x81\x01\x91\x01", &limits);
+    limits.max_depth = 0;
+
+    static char deep[MPACK_VALIDATE_MAX_DEPTH + 1];
+    mpack_memset(deep, '\x91', sizeof(deep));
+    deep[MPACK_VALIDATE_MAX_DEPTH] = '\x01';
+    TEST_TRUE(mpack_validate(deep, sizeof(deep), &limits) == mpack_ok);
+    deep[MPACK_VALIDATE_MAX_DEPTH] = '\x91';
+    TEST_TRUE(mpack_validate(deep, sizeof(deep), &limits) == mpack_error_too_big);
+    TEST_TRUE(mpack_validate(deep, sizeof(deep), NULL) == mpack_error_too_big);
+
+    // elements, counting keys and values
+    limits.max_elements = 5;
+    TEST_VALIDATE(mpack_ok, "\x82\x01\x02\x03\x04", &limits);
+    TEST_VALIDATE(mpack_error_too_big, "\x95\x01\x02\x03\x04\x05", &limits);
+    limits.max_elements = 0;
+
+    // size
+    limits.max_size = 4;
+    TEST_VALIDATE(mpack_ok, "\xa3" "abc", &limits);
+    TEST_VALIDATE(mpack_error_too_big, "\xa4" "abcd", &limits);
+    limits.max_size = 0;
+
+    // lengths of strings and counts of maps and arrays
+    limits.max_length = 2;
+    TEST_VALIDATE(mpack_ok, "\x82\xa2" "ab" "\x01\xc4\x02" "ab" "\x02", &limits);
+    TEST_VALIDATE(mpack_error_too_big, "\xa3" "abc", &limits);
+    TEST_VALIDATE(mpack_error_too_big, "\x93\x01\x02\x03", &limits);
+    TEST_VALIDATE(mpack_error_too_big, "\x83\x01\x01\x02\x02\x03\x03", &limits);
+    TEST_VALIDATE(mpack_error_too_big, "\xdd\xff\xff\xff\xff", &limits);
+}
+
+#undef TEST_VALIDATE
+
 void test_common() {
     test_tags_special();
     test_tags_simple();
     test_tags_reals();
     test_tags_compound();
+    test_tag_descs();
 
     test_strings();
     test_utf8_check();
+    test_validate();
 }
 
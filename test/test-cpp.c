@@ -0,0 +1,222 @@
+/*
+ * Copyright (c) 2015-2018 Nicholas Fraser
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "test-cpp.h"
+
+#if TEST_CPP
+
+#include "mpack/mpack.hpp"
+
+namespace {
+
+enum class test_color : uint8_t { red = 1, green = 200 };
+
+struct test_inner {
+    std::string_view name;
+    std::vector<int64_t> values;
+};
+
+struct test_outer {
+    bool flag;
+    int8_t i8;
+    int16_t i16;
+    int32_t i32;
+    int64_t i64;
+    uint8_t u8;
+    uint16_t u16;
+    uint32_t u32;
+    uint64_t u64;
+    float f;
+    double d;
+    test_color color;
+    std::string owned;
+    std::array<uint16_t, 3> triple;
+    std::vector<test_inner> inners;
+};
+
+} // namespace
+
+template <>
+struct mpack::fields<test_inner> {
+    static constexpr auto list = std::make_tuple(
+            mpack::field("name", &test_inner::name),
+            mpack::field("values", &test_inner::values));
+};
+
+template <>
+struct mpack::fields<test_outer> {
+    static constexpr auto list = std::make_tuple(
+            mpack::field("flag", &test_outer::flag),
+            mpack::field("i8", &test_outer::i8),
+            mpack::field("i16", &test_outer::i16),
+            mpack::field("i32", &test_outer::i32),
+            mpack::field("i64", &test_outer::i64),
+            mpack::field("u8", &test_outer::u8),
+            mpack::field("u16", &test_outer::u16),
+            mpack::field("u32", &test_outer::u32),
+            mpack::field("u64", &test_outer::u64),
+            mpack::field("f", &test_outer::f),
+            mpack::field("d", &test_outer::d),
+            mpack::field("color", &test_outer::color),
+            mpack::field("owned", &test_outer::owned),
+            mpack::field("triple", &test_outer::triple),
+            mpack::field("inners", &test_outer::inners));
+};
+
+static void test_cpp_encode() {
+    // each integer width picks the matching writer function
+    char buf[64];
+    mpack::writer writer(buf, sizeof(buf));
+    writer.write(int8_t(-1));
+    writer.write(uint16_t(300));
+    writer.write(int64_t(-200));
+    writer.write(test_color::green);
+    writer.write(std::string_view("hi"));
+    writer.write(std::array<double, 1>{{0.5}});
+    TEST_TRUE(mpack_writer_buffer_used(writer.get()) == 22);
+    TEST_TRUE(writer.finish() == mpack_ok);
+    TEST_TRUE(memcmp(buf, "\xff\xcd\x01\x2c\xd1\xff\x38\xcc\xc8\xa2hi\x91\xcb\x3f\xe0\0\0\0\0\0\0", 22) == 0);
+
+    // a moved writer keeps its state and buffer
+    mpack::writer first(buf, sizeof(buf));
+    first.write(true);
+    mpack::writer second = std::move(first);
+    second.write(false);
+    TEST_TRUE(second.finish() == mpack_ok);
+    TEST_TRUE(memcmp(buf, "\xc3\xc2", 2) == 0);
+
+    #if MPACK_HPP_SPAN
+    // spans are written as arrays
+    const int16_t shorts[] = {1, -1000};
+    mpack::writer span_writer(buf, sizeof(buf));
+    span_writer.write(std::span<const int16_t>(shorts));
+    TEST_TRUE(span_writer.finish() == mpack_ok);
+    TEST_TRUE(memcmp(buf, "\x92\x01\xd1\xfc\x18", 5) == 0);
+    #endif
+
+    // errors are flagged on the writer
+    mpack::writer small(buf, 2);
+    small.write(std::string_view("hello"));
+    TEST_TRUE(small.finish() == mpack_error_too_big);
+}
+
+static void test_cpp_roundtrip() {
+    mpack::writer writer = mpack::writer::growable();
+
+    test_outer outer{};
+    outer.flag = true;
+    outer.i8 = -5;
+    outer.i16 = -1000;
+    outer.i32 = 100000;
+    outer.i64 = INT64_MIN;
+    outer.u8 = 255;
+    outer.u16 = 65535;
+    outer.u32 = 70000;
+    outer.u64 = UINT64_MAX;
+    outer.f = 2.5f;
+    outer.d = -0.125;
+    outer.color = test_color::green;
+    outer.owned = "owned string";
+    outer.triple = {{1, 2, 3}};
+    outer.inners.push_back(test_inner{"first", {1, -2, 300000}});
+    outer.inners.push_back(test_inner{"second", {}});
+    writer.write(outer);
+    TEST_TRUE(writer.finish() == mpack_ok);
+    std::string_view data = writer.data();
+    TEST_TRUE(!data.empty());
+
+    mpack::tree tree(data.data(), data.size());
+    tree.parse();
+    mpack::tree moved = std::move(tree);
+    test_outer read = moved.decode<test_outer>();
+    TEST_TRUE(moved.error() == mpack_ok);
+    TEST_TRUE(read.flag && read.i8 == -5 && read.i16 == -1000 && read.i32 == 100000);
+    TEST_TRUE(read.i64 == INT64_MIN && read.u8 == 255 && read.u16 == 65535);
+    TEST_TRUE(read.u32 == 70000 && read.u64 == UINT64_MAX);
+    TEST_TRUE(read.f == 2.5f && read.d == -0.125);
+    TEST_TRUE(read.color == test_color::green);
+    TEST_TRUE(read.owned == "owned string");
+    TEST_TRUE(read.triple[0] == 1 && read.triple[1] == 2 && read.triple[2] == 3);
+    TEST_TRUE(read.inners.size() == 2);
+    TEST_TRUE(read.inners[0].name == "first" && read.inners[1].name == "second");
+    TEST_TRUE(read.inners[0].values == std::vector<int64_t>({1, -2, 300000}));
+    TEST_TRUE(read.inners[1].values.empty());
+
+    // string views point into the tree's data without copying
+    TEST_TRUE(read.inners[0].name.data() >= data.data() &&
+            read.inners[0].name.data() < data.data() + data.size());
+    TEST_TRUE(moved.finish() == mpack_ok);
+}
+
+static void test_cpp_allocator() {
+    // a growable writer's data is freed with the allocator it was set to
+    static char arena_data[4096];
+    test_arena_t arena;
+    mpack_allocator_t allocator = test_arena_init(&arena, arena_data, sizeof(arena_data), true);
+    size_t mallocs;
+    {
+        mpack::writer writer = mpack::writer::growable();
+        mpack_writer_set_allocator(writer.get(), &allocator);
+        mallocs = test_malloc_total_count();
+        writer.write(std::string_view("hello"));
+        TEST_TRUE(writer.finish() == mpack_ok);
+        TEST_TRUE(test_arena_contains(&arena, writer.data().data()));
+    }
+    TEST_TRUE(arena.allocs > 0);
+    TEST_TRUE(arena.frees == arena.allocs);
+    TEST_TRUE(test_malloc_total_count() == mallocs);
+}
+
+static void test_cpp_decode_errors() {
+    // an array of the wrong length
+    mpack::tree tree("\x92\x01\x02", 3);
+    tree.parse();
+    std::array<int, 3> triple = tree.decode<std::array<int, 3>>();
+    TEST_TRUE(triple[0] == 0);
+    TEST_TRUE(tree.finish() == mpack_error_type);
+
+    // a missing struct key
+    mpack::tree missing("\x81\xa4name\xa1x", 8);
+    missing.parse();
+    missing.decode<test_inner>();
+    TEST_TRUE(missing.finish() == mpack_error_data);
+
+    // a value out of range
+    mpack::tree range("\xcd\x01\x00", 3);
+    range.parse();
+    TEST_TRUE(range.decode<uint8_t>() == 0);
+    TEST_TRUE(range.finish() == mpack_error_type);
+
+    // the reader is wrapped for use with the C API
+    mpack::reader reader("\x05", 1);
+    TEST_TRUE(mpack_expect_u8(reader.get()) == 5);
+    mpack::reader moved = std::move(reader);
+    TEST_TRUE(moved.finish() == mpack_ok);
+}
+
+void test_cpp(void) {
+    test_cpp_encode();
+    test_cpp_roundtrip();
+    test_cpp_allocator();
+    test_cpp_decode_errors();
+}
+
+#endif
@@ -0,0 +1,48 @@
+/*
+ * Copyright (c) 2015-2018 Nicholas Fraser
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef MPACK_TEST_CPP_H
+#define MPACK_TEST_CPP_H 1
+
+#include "test.h"
+
+// the C++ layer is only tested when the suite is compiled as C++17
+#if defined(__cplusplus) && __cplusplus >= 201703L && defined(MPACK_MALLOC) && \
+        MPACK_WRITER && MPACK_READER && MPACK_EXPECT && MPACK_NODE
+#define TEST_CPP 1
+#else
+#define TEST_CPP 0
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if TEST_CPP
+void test_cpp(void);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
@@ -784,6 +784,44 @@ static void test_expect_str() {
 
 }
 
+#ifdef MPACK_MALLOC
+static void test_expect_allocator(void) {
+    static const char data[] = "\x93\xa5hello\x93\x01\x02\x03\xa5he\x00lo";
+    char arena_data[1024];
+    test_arena_t arena;
+    mpack_allocator_t allocator = test_arena_init(&arena, arena_data, sizeof(arena_data), true);
+    size_t active = test_malloc_active_count();
+
+    mpack_reader_t reader;
+    mpack_reader_init_data(&reader, data, sizeof(data) - 1);
+    mpack_reader_set_allocator(&reader, &allocator);
+    size_t mallocs = test_malloc_total_count();
+    TEST_TRUE(mpack_expect_array(&reader) == 3);
+
+    char* str = mpack_expect_cstr_alloc(&reader, 100);
+    TEST_TRUE(str != NULL && strcmp(str, "hello") == 0);
+    TEST_TRUE(test_arena_contains(&arena, str));
+
+    uint32_t count;
+    uint8_t* array = mpack_expect_array_alloc(&reader, uint8_t, 10, &count);
+    TEST_TRUE(count == 3 && test_arena_contains(&arena, array));
+    array[0] = mpack_expect_u8(&reader);
+    array[1] = mpack_expect_u8(&reader);
+    array[2] = mpack_expect_u8(&reader);
+    mpack_done_array(&reader);
+    TEST_TRUE(array[0] == 1 && array[1] == 2 && array[2] == 3);
+
+    // the rejected string is given back to the allocator
+    size_t frees = arena.frees;
+    TEST_TRUE(NULL == mpack_expect_cstr_alloc(&reader, 100));
+    TEST_TRUE(arena.frees == frees + 1);
+    TEST_READER_DESTROY_ERROR(&reader, mpack_error_type);
+
+    TEST_TRUE(test_malloc_total_count() == mallocs);
+    TEST_TRUE(test_malloc_active_count() == active);
+}
+#endif
+
 static void test_expect_bin() {
     char buf[256];
 
@@ -1156,6 +1194,68 @@ static void test_expect_key_cstr_duplicate() {
     #undef KEY_COUNT
 }
 
+static void test_expect_keyset() {
+    // many keys, with enough slots for a perfect hash and with the minimum
+    static char names[40][4];
+    static const char* keys[40];
+    for (size_t i = 0; i < 40; ++i) {
+        names[i][0] = 'k';
+        names[i][1] = (char)('0' + i / 10);
+        names[i][2] = (char)('0' + i % 10);
+        names[i][3] = '\0';
+        keys[i] = names[i];
+    }
+
+    mpack_keyset_slot_t slots[MPACK_KEYSET_SLOT_COUNT(40)];
+    size_t slot_counts[] = {MPACK_KEYSET_SLOT_COUNT(40), 41, 40};
+    for (size_t k = 0; k < sizeof(slot_counts) / sizeof(*slot_counts); ++k) {
+        mpack_keyset_t keyset;
+        TEST_TRUE(mpack_keyset_init(&keyset, keys, 40, slots, slot_counts[k]));
+        for (size_t i = 0; i < 40; ++i)
+            TEST_TRUE(mpack_keyset_find(&keyset, keys[i], 3) == i);
+        TEST_TRUE(mpack_keyset_find(&keyset, "k40", 3) == 40);
+        TEST_TRUE(mpack_keyset_find(&keyset, "k0", 2) == 40);
+        TEST_TRUE(mpack_keyset_find(&keyset, "", 0) == 40);
+    }
+
+    // invalid sets
+    mpack_keyset_t keyset;
+    static const char* duplicates[] = {"a", "b", "a"};
+    TEST_TRUE(!mpack_keyset_init(&keyset, duplicates, 3, slots, 12));
+    TEST_TRUE(!mpack_keyset_init(&keyset, keys, 40, slots, 39));
+    TEST_TRUE(!mpack_keyset_init(&keyset, keys, 0, slots, 12));
+
+    // enums
+    static const char* fruits[] = {"apple", "banana", "orange"};
+    TEST_TRUE(mpack_keyset_init(&keyset, fruits, 3, slots, MPACK_KEYSET_SLOT_COUNT(3)));
+    TEST_SIMPLE_READ("\xa6""banana", 1 == mpack_expect_enum_set(&reader, &keyset));
+    TEST_SIMPLE_READ("\xa5""apple", 0 == mpack_expect_enum_set_optional(&reader, &keyset));
+    TEST_SIMPLE_READ("\xa4""pear", 3 == mpack_expect_enum_set_optional(&reader, &keyset));
+    TEST_SIMPLE_READ("\x01", 3 == mpack_expect_enum_set_optional(&reader, &keyset));
+    TEST_SIMPLE_READ_ERROR("\xa4""pear", 3 == mpack_expect_enum_set(&reader, &keyset), mpack_error_type);
+    TEST_SIMPLE_READ_ERROR("\x01", 3 == mpack_expect_enum_set(&reader, &keyset), mpack_error_type);
+
+    // map keys, with duplicate detection
+    static const char data[] = "\x84\xA3""dup\xC0\x01\xC0\xA5""valid\xC0\xA3""dup\xC0";
+    mpack_reader_t reader;
+    mpack_reader_init_data(&reader, data, sizeof(data)-1);
+
+    static const char* map_keys[] = { "valid", "dup" };
+    TEST_TRUE(mpack_keyset_init(&keyset, map_keys, 2, slots, MPACK_KEYSET_SLOT_COUNT(2)));
+    bool found[2] = {false, false};
+
+    TEST_TRUE(4 == mpack_expect_map(&reader));
+    TEST_TRUE(1 == mpack_expect_key_set(&reader, &keyset, found));
+    mpack_expect_nil(&reader);
+    TEST_TRUE(2 == mpack_expect_key_set(&reader, &keyset, found)); // not a string
+    mpack_discard(&reader);
+    TEST_TRUE(0 == mpack_expect_key_set(&reader, &keyset, found));
+    mpack_expect_nil(&reader);
+    TEST_TRUE(found[0] && found[1]);
+    TEST_TRUE(2 == mpack_expect_key_set(&reader, &keyset, found)); // duplicate
+    TEST_READER_DESTROY_ERROR(&reader, mpack_error_invalid);
+}
+
 static void test_expect_key_uint() {
     static const char data[] = "\x85\x02\xC0\x00\xC0\xC3\xC0\x03\xC0\x03\xC0";
     mpack_reader_t reader;
@@ -1246,6 +1346,87 @@ static void test_expect_streaming() {
     }
 }
 
+static void test_expect_arrays_into() {
+    double d[4];
+    float f[4];
+    int64_t i64[3];
+    int32_t i32[3];
+    uint64_t u64[2];
+    uint32_t u32[3];
+
+    // uniform and mixed encodings
+    TEST_SIMPLE_READ("\x93\xcb\x3f\xf0\x00\x00\x00\x00\x00\x00"
+            "\xcb\x40\x04\x00\x00\x00\x00\x00\x00\xcb\xc0\x08\x00\x00\x00\x00\x00\x00",
+            3 == mpack_expect_array_double_into(&reader, d, 4));
+    TEST_TRUE(d[0] == 1.0 && d[1] == 2.5 && d[2] == -3.0);
+    TEST_SIMPLE_READ("\x94\x01\xd0\xff\xca\x3f\xc0\x00\x00\xcd\x01\x00",
+            4 == mpack_expect_array_double_into(&reader, d, 4));
+    TEST_TRUE(d[0] == 1.0 && d[1] == -1.0 && d[2] == 1.5 && d[3] == 256.0);
+    TEST_SIMPLE_READ("\x94\x01\xd0\xff\xca\x3f\xc0\x00\x00\xcd\x01\x00",
+            4 == mpack_expect_array_float_into(&reader, f, 4));
+    TEST_TRUE(f[0] == 1.0f && f[1] == -1.0f && f[2] == 1.5f && f[3] == 256.0f);
+    TEST_SIMPLE_READ("\x90", 0 == mpack_expect_array_float_into(&reader, f, 0));
+
+    TEST_SIMPLE_READ("\x93\x01\xd0\xff\xce\x7f\xff\xff\xff",
+            3 == mpack_expect_array_i64_into(&reader, i64, 3));
+    TEST_TRUE(i64[0] == 1 && i64[1] == -1 && i64[2] == INT32_MAX);
+    TEST_SIMPLE_READ("\x93\x01\xd2\x80\x00\x00\x00\x7f",
+            3 == mpack_expect_array_i32_into(&reader, i32, 3));
+    TEST_TRUE(i32[0] == 1 && i32[1] == INT32_MIN && i32[2] == 127);
+    TEST_SIMPLE_READ("\x92\x00\xcf\xff\xff\xff\xff\xff\xff\xff\xff",
+            2 == mpack_expect_array_u64_into(&reader, u64, 2));
+    TEST_TRUE(u64[0] == 0 && u64[1] == UINT64_MAX);
+    TEST_SIMPLE_READ("\x93\xce\xff\xff\xff\xff\xce\x00\x00\x00\x01\x05",
+            3 == mpack_expect_array_u32_into(&reader, u32, 3));
+    TEST_TRUE(u32[0] == UINT32_MAX && u32[1] == 1 && u32[2] == 5);
+
+    // errors
+    TEST_SIMPLE_READ_ERROR("\x93\x01\xd0\xff\x02",
+            0 == mpack_expect_array_u32_into(&reader, u32, 3), mpack_error_type);
+    TEST_SIMPLE_READ_ERROR("\x91\xcf\xff\xff\xff\xff\xff\xff\xff\xff",
+            0 == mpack_expect_array_i32_into(&reader, i32, 3), mpack_error_type);
+    TEST_SIMPLE_READ_ERROR("\x93\x01\x02\x03",
+            0 == mpack_expect_array_i64_into(&reader, i64, 2), mpack_error_type);
+    TEST_SIMPLE_READ_ERROR("\x92\x01\xc0",
+            0 == mpack_expect_array_double_into(&reader, d, 2), mpack_error_type);
+    TEST_SIMPLE_READ_ERROR("\x81\x01\x01",
+            0 == mpack_expect_array_double_into(&reader, d, 2), mpack_error_type);
+    TEST_SIMPLE_READ_ERROR("\x92\xcb\x3f\xf0\x00",
+            0 == mpack_expect_array_double_into(&reader, d, 2), mpack_error_invalid);
+
+    // a long array with runs split across fills
+    char data[3 + 40 * 9];
+    char* p = data;
+    *p++ = (char)0xdc;
+    mpack_store_u16(p, 40);
+    p += 2;
+    for (int i = 0; i < 40; ++i) {
+        if (i % 7 == 6) {
+            *p++ = (char)i;
+        } else {
+            *p++ = (char)0xcb;
+            mpack_store_double(p, i + 0.5);
+            p += 8;
+        }
+    }
+
+    size_t sizes[] = {1, 2, 3, 5, 7, 11, 64};
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(*sizes); ++i) {
+        test_expect_stream_t context = {data, (size_t)(p - data), sizes[i]};
+        mpack_reader_t reader;
+        char buffer[MPACK_READER_MINIMUM_BUFFER_SIZE];
+        mpack_reader_init(&reader, buffer, sizeof(buffer), 0);
+        mpack_reader_set_context(&reader, &context);
+        mpack_reader_set_fill(&reader, &test_expect_stream_fill);
+
+        double values[40];
+        TEST_TRUE(mpack_expect_array_double_into(&reader, values, 40) == 40);
+        for (int j = 0; j < 40; ++j)
+            TEST_TRUE(values[j] == (j % 7 == 6 ? (double)j : j + 0.5));
+        TEST_READER_DESTROY_NOERROR(&reader);
+    }
+}
+
 #if MPACK_EXTENSIONS
 static bool test_timestamp_match(int64_t seconds, uint32_t nanoseconds, mpack_timestamp_t timestamp) {
     TEST_TRUE(seconds == timestamp.seconds);
@@ -1312,6 +1493,9 @@ void test_expect() {
     test_expect_bin_size_buf();
     test_expect_arrays();
     test_expect_maps();
+    #ifdef MPACK_MALLOC
+    test_expect_allocator();
+    #endif
 
     // extension types
     #if MPACK_EXTENSIONS
@@ -1324,6 +1508,7 @@ void test_expect() {
     test_expect_key_cstr_mixed();
     test_expect_key_cstr_duplicate();
     test_expect_key_uint();
+    test_expect_keyset();
 
     // other
     test_expect_misc();
@@ -1335,6 +1520,7 @@ void test_expect() {
     test_expect_bad_type();
     test_expect_pre_error();
     test_expect_streaming();
+    test_expect_arrays_into();
 }
 
 #endif
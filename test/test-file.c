@@ -15,6 +15,9 @@
 #define PSEUDOJSON_FILES_PATH "..\\..\\test\\pseudojson\\"
 #else
 #include <unistd.h>
+#if MPACK_FD
+#include <fcntl.h>
+#endif
 #define MESSAGEPACK_FILES_PATH "test/messagepack/"
 #define PSEUDOJSON_FILES_PATH "test/pseudojson/"
 #endif
@@ -780,6 +783,31 @@ static void test_file_node(void) {
     test_fclose(file);
 }
 
+#if MPACK_MMAP
+static void test_file_node_mmap(void) {
+    mpack_tree_t tree;
+
+    // a regular file is mapped rather than read, so the only allocation
+    // before parsing is the file tree context
+    size_t allocation_count = test_malloc_total_count();
+    mpack_tree_init_filename(&tree, test_filename, 0);
+    TEST_TRUE(test_malloc_total_count() - allocation_count == 1);
+    test_file_tree_successful_parse(&tree);
+
+    // the mapping outlives a FILE closed by the tree
+    FILE* file = test_fopen(test_filename, "rb");
+    TEST_TRUE(file != NULL);
+    mpack_tree_init_stdfile(&tree, file, 0, true);
+    test_file_tree_successful_parse(&tree);
+
+    // files that can't be mapped fall back to the normal read errors
+    mpack_tree_init_filename(&tree, test_filename, 100);
+    TEST_TREE_DESTROY_ERROR(&tree, mpack_error_too_big);
+    mpack_tree_init_filename(&tree, test_blank_filename, 0);
+    TEST_TREE_DESTROY_ERROR(&tree, mpack_error_invalid);
+}
+#endif
+
 typedef struct test_file_stream_t {
     size_t length;
     char* data;
@@ -934,6 +962,145 @@ static bool test_file_node_failure(void) {
 }
 #endif
 
+#if MPACK_FD
+static void test_file_fd_write(void) {
+    // write the test file through a descriptor with the smallest buffer, so
+    // that most data is written straight from its source
+    mpack_writer_t writer;
+    int fd = open(test_filename, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    TEST_TRUE(fd >= 0, "failed to open file for writing! filename %s", test_filename);
+    mpack_writer_init_fd(&writer, fd, MPACK_WRITER_MINIMUM_BUFFER_SIZE, true);
+    test_file_write_contents(&writer);
+    TEST_WRITER_DESTROY_NOERROR(&writer);
+
+    // a full device fails on flush
+    fd = open("/dev/full", O_WRONLY);
+    TEST_TRUE(fd >= 0);
+    mpack_writer_init_fd(&writer, fd, 0, false);
+    mpack_write_cstr(&writer, quick_brown_fox);
+    TEST_WRITER_DESTROY_ERROR(&writer, mpack_error_io);
+    TEST_TRUE(close(fd) == 0);
+
+    // the buffer is moved to the writer's allocator
+    static char arena_data[8192];
+    test_arena_t arena;
+    mpack_allocator_t allocator = test_arena_init(&arena, arena_data, sizeof(arena_data), true);
+    fd = open("/dev/null", O_WRONLY);
+    TEST_TRUE(fd >= 0);
+    mpack_writer_init_fd(&writer, fd, 1024, true);
+    mpack_writer_set_allocator(&writer, &allocator);
+    size_t mallocs = test_malloc_total_count();
+    TEST_TRUE(test_arena_contains(&arena, writer.buffer));
+    mpack_write_cstr(&writer, quick_brown_fox);
+    TEST_WRITER_DESTROY_NOERROR(&writer);
+    TEST_TRUE(test_malloc_total_count() == mallocs);
+    TEST_TRUE(arena.allocs > 0 && arena.frees == arena.allocs);
+}
+
+#if MPACK_EXPECT
+static void test_file_fd_read(void) {
+    // both the default and the smallest buffer, the latter of which seeks
+    // past most of the contents
+    size_t sizes[] = {0, MPACK_READER_MINIMUM_BUFFER_SIZE};
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(*sizes); ++i) {
+        int fd = open(test_filename, O_RDONLY);
+        TEST_TRUE(fd >= 0, "failed to open file! filename %s", test_filename);
+        mpack_reader_t reader;
+        mpack_reader_init_fd(&reader, fd, sizes[i], true);
+        test_file_read_contents(&reader);
+        TEST_READER_DESTROY_NOERROR(&reader);
+    }
+
+    // the buffer is moved to the reader's allocator
+    static char arena_data[8192];
+    test_arena_t arena;
+    mpack_allocator_t allocator = test_arena_init(&arena, arena_data, sizeof(arena_data), true);
+    int fd = open(test_filename, O_RDONLY);
+    TEST_TRUE(fd >= 0, "failed to open file! filename %s", test_filename);
+    mpack_reader_t reader;
+    mpack_reader_init_fd(&reader, fd, 1024, true);
+    mpack_reader_set_allocator(&reader, &allocator);
+    size_t mallocs = test_malloc_total_count();
+    TEST_TRUE(test_arena_contains(&arena, reader.buffer));
+    test_file_read_contents(&reader);
+    TEST_READER_DESTROY_NOERROR(&reader);
+    TEST_TRUE(test_malloc_total_count() == mallocs);
+    TEST_TRUE(arena.allocs > 0 && arena.frees == arena.allocs);
+
+    // the allocator cannot be changed once data has been buffered
+    fd = open(test_filename, O_RDONLY);
+    TEST_TRUE(fd >= 0);
+    mpack_reader_init_fd(&reader, fd, 1024, true);
+    mpack_reader_set_allocator(&reader, &allocator);
+    mpack_expect_array(&reader);
+    TEST_BREAK((mpack_reader_set_allocator(&reader, NULL), true));
+    TEST_READER_DESTROY_ERROR(&reader, mpack_error_bug);
+
+    // a non-blocking pipe flags would_block until the whole message arrives
+    int fds[2];
+    TEST_TRUE(pipe(fds) == 0);
+    TEST_TRUE(fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK) == 0);
+    mpack_reader_init_fd(&reader, fds[0], 0, true);
+    mpack_reader_checkpoint(&reader);
+    TEST_TRUE(write(fds[1], "\x92\xa3""ab", 4) == 4);
+    TEST_TRUE(mpack_expect_array(&reader) == 2);
+    mpack_expect_cstr_match(&reader, "abc");
+    TEST_TRUE(mpack_reader_error(&reader) == mpack_error_would_block);
+    TEST_TRUE(mpack_reader_rollback(&reader));
+    TEST_TRUE(write(fds[1], "c\x07", 2) == 2);
+    TEST_TRUE(mpack_expect_array(&reader) == 2);
+    mpack_expect_cstr_match(&reader, "abc");
+    TEST_TRUE(mpack_expect_uint(&reader) == 7);
+    mpack_done_array(&reader);
+    mpack_reader_clear_checkpoint(&reader);
+    TEST_READER_DESTROY_NOERROR(&reader);
+    TEST_TRUE(close(fds[1]) == 0);
+}
+#endif
+
+#if MPACK_NODE
+static void test_file_fd_node(void) {
+    mpack_tree_t tree;
+    int fd = open(test_filename, O_RDONLY);
+    TEST_TRUE(fd >= 0, "failed to open file! filename %s", test_filename);
+    mpack_tree_init_fd(&tree, fd, 0, true);
+    test_file_tree_successful_parse(&tree);
+
+    // the limit and empty files are checked against the file's size
+    fd = open(test_filename, O_RDONLY);
+    TEST_TRUE(fd >= 0);
+    mpack_tree_init_fd(&tree, fd, 100, false);
+    TEST_TREE_DESTROY_ERROR(&tree, mpack_error_too_big);
+    TEST_TRUE(close(fd) == 0);
+    fd = open(test_blank_filename, O_RDONLY);
+    TEST_TRUE(fd >= 0);
+    mpack_tree_init_fd(&tree, fd, 0, true);
+    TEST_TREE_DESTROY_ERROR(&tree, mpack_error_invalid);
+
+    // a pipe is read to end of file, up to the limit
+    char message[95];
+    memcpy(message, "\x93\x01\xd9\x5a", 4);
+    memset(message + 4, 'x', 90);
+    message[94] = '\xc0';
+    for (size_t max_bytes = sizeof(message) - 1; max_bytes <= sizeof(message) + 1; ++max_bytes) {
+        int fds[2];
+        TEST_TRUE(pipe(fds) == 0);
+        TEST_TRUE(write(fds[1], message, sizeof(message)) == (ssize_t)sizeof(message));
+        TEST_TRUE(close(fds[1]) == 0);
+        mpack_tree_init_fd(&tree, fds[0], max_bytes, true);
+        mpack_tree_parse(&tree);
+        if (max_bytes < sizeof(message)) {
+            TEST_TREE_DESTROY_ERROR(&tree, mpack_error_too_big);
+            continue;
+        }
+        TEST_TRUE(mpack_node_array_length(mpack_tree_root(&tree)) == 3);
+        TEST_TRUE(mpack_node_strlen(mpack_node_array_at(mpack_tree_root(&tree), 1)) == 90);
+        TEST_TREE_DESTROY_NOERROR(&tree);
+    }
+}
+#endif
+#endif
+
 void test_file(void) {
     // write a blank file for test purposes
     FILE* blank = fopen(test_blank_filename, "wb");
@@ -966,9 +1133,22 @@ void test_file(void) {
     #endif
     #if MPACK_NODE
     test_file_node();
+    #if MPACK_MMAP
+    test_file_node_mmap();
+    #endif
     test_file_node_stream();
     #endif
 
+    #if MPACK_FD
+    test_file_fd_write();
+    #if MPACK_EXPECT
+    test_file_fd_read();
+    #endif
+    #if MPACK_NODE
+    test_file_fd_node();
+    #endif
+    #endif
+
     #if MPACK_WRITER
     test_system_fail_until_ok(&test_file_write_failure);
     #endif
@@ -0,0 +1,437 @@
+/*
+ * Copyright (c) 2015-2018 Nicholas Fraser
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "test-frame.h"
+#include "test-write.h"
+#include "test-reader.h"
+#include "test-node.h"
+
+#if MPACK_FRAME && defined(MPACK_MALLOC)
+
+// A run-length codec for tests. Any context disables compression.
+
+static size_t test_frame_bound(void* context, size_t size) {
+    return (context != NULL) ? 0 : size * 2;
+}
+
+static size_t test_frame_compress(void* context, const char* src, size_t src_size, char* dst, size_t dst_size) {
+    MPACK_UNUSED(context);
+    size_t out = 0;
+    for (size_t i = 0; i < src_size;) {
+        size_t run = 1;
+        while (i + run < src_size && run < 255 && src[i + run] == src[i])
+            ++run;
+        TEST_TRUE(out + 2 <= dst_size);
+        dst[out++] = (char)run;
+        dst[out++] = src[i];
+        i += run;
+    }
+    return out;
+}
+
+static bool test_frame_decompress(void* context, const char* src, size_t src_size, char* dst, size_t dst_size) {
+    MPACK_UNUSED(context);
+    size_t out = 0;
+    for (size_t i = 0; i + 1 < src_size; i += 2) {
+        size_t run = (uint8_t)src[i];
+        if (run == 0 || out + run > dst_size)
+            return false;
+        memset(dst + out, src[i + 1], run);
+        out += run;
+    }
+    return (src_size % 2) == 0 && out == dst_size;
+}
+
+static const mpack_frame_codec_t test_frame_codec = {
+    test_frame_bound, test_frame_compress, test_frame_decompress, NULL};
+
+#if MPACK_WRITER
+static char test_frame_stored_context;
+
+static const mpack_frame_codec_t test_frame_codec_stored = {
+    test_frame_bound, test_frame_compress, test_frame_decompress, &test_frame_stored_context};
+
+typedef struct test_frame_stream_t {
+    char buf[4096];
+    size_t size;
+    size_t pos;
+    size_t step;  // the most bytes returned by each input call
+    size_t fail;  // the number of output calls before output fails, or 0
+} test_frame_stream_t;
+
+static bool test_frame_output(void* context, const char* data, size_t count) {
+    test_frame_stream_t* stream = (test_frame_stream_t*)context;
+    if (stream->fail != 0 && --stream->fail == 0)
+        return false;
+    TEST_TRUE(stream->size + count <= sizeof(stream->buf));
+    memcpy(stream->buf + stream->size, data, count);
+    stream->size += count;
+    return true;
+}
+
+#if MPACK_READER || MPACK_NODE
+static size_t test_frame_input(void* context, char* buffer, size_t count) {
+    test_frame_stream_t* stream = (test_frame_stream_t*)context;
+    if (stream->fail != 0)
+        return (size_t)(-1);
+    size_t left = stream->size - stream->pos;
+    if (count > left)
+        count = left;
+    if (stream->step != 0 && count > stream->step)
+        count = stream->step;
+    memcpy(buffer, stream->buf + stream->pos, count);
+    stream->pos += count;
+    return count;
+}
+#endif
+#endif
+
+static void test_frame_headers(void) {
+    size_t size, raw_size;
+    char decoded[8];
+
+    // a stored frame and a compressed frame
+    static const char stored[] = "\x00\x00\x00\x03\x00\x00\x00\x03\x93\x01\x02";
+    TEST_TRUE(mpack_frame_size(stored, sizeof(stored) - 1, &size, &raw_size) == mpack_ok);
+    TEST_TRUE(size == 11 && raw_size == 3);
+    TEST_TRUE(mpack_frame_decode(&test_frame_codec, stored, size, decoded, raw_size) == mpack_ok);
+    TEST_TRUE(memcmp(decoded, "\x93\x01\x02", 3) == 0);
+
+    static const char compressed[] = "\x00\x00\x00\x04\x00\x00\x00\x06\x01\x95\x05\xc0";
+    TEST_TRUE(mpack_frame_size(compressed, sizeof(compressed) - 1, &size, &raw_size) == mpack_ok);
+    TEST_TRUE(size == 12 && raw_size == 6);
+    TEST_TRUE(mpack_frame_decode(&test_frame_codec, compressed, size, decoded, raw_size) == mpack_ok);
+    TEST_TRUE(memcmp(decoded, "\x95\xc0\xc0\xc0\xc0\xc0", 6) == 0);
+
+    // a corrupt payload
+    static const char corrupt[] = "\x00\x00\x00\x04\x00\x00\x00\x07\x01\x95\x05\xc0";
+    TEST_TRUE(mpack_frame_size(corrupt, sizeof(corrupt) - 1, &size, &raw_size) == mpack_ok);
+    TEST_TRUE(mpack_frame_decode(&test_frame_codec, corrupt, size, decoded, raw_size) == mpack_error_invalid);
+
+    // truncated headers and payloads
+    TEST_TRUE(mpack_frame_size(stored, 7, &size, &raw_size) == mpack_error_eof);
+    TEST_TRUE(mpack_frame_size(stored, 10, &size, &raw_size) == mpack_error_eof);
+
+    // malformed and oversized headers
+    TEST_TRUE(mpack_frame_size("\x00\x00\x00\x00\x00\x00\x00\x00", 8, &size, &raw_size) == mpack_error_invalid);
+    TEST_TRUE(mpack_frame_size("\x00\x00\x00\x04\x00\x00\x00\x03", 8, &size, &raw_size) == mpack_error_invalid);
+    TEST_TRUE(mpack_frame_size("\x00\x00\x00\x01\xff\xff\xff\xff", 8, &size, &raw_size) == mpack_error_too_big);
+}
+
+#if MPACK_WRITER
+#define TEST_FRAME_MESSAGES 40
+
+// Writes the test messages [i, "aaa...", nil] to the stream, with a
+// string of i bytes in each.
+static void test_frame_write(test_frame_stream_t* stream, const mpack_frame_codec_t* codec, size_t frame_size) {
+    char str[TEST_FRAME_MESSAGES];
+    memset(str, 'a', sizeof(str));
+
+    mpack_writer_t writer;
+    mpack_writer_init_frame(&writer, codec, frame_size, test_frame_output, stream);
+    for (size_t i = 0; i < TEST_FRAME_MESSAGES; ++i) {
+        mpack_start_array(&writer, 3);
+        mpack_write_u32(&writer, (uint32_t)i);
+        mpack_write_str(&writer, str, (uint32_t)i);
+        mpack_write_nil(&writer);
+        mpack_finish_array(&writer);
+        mpack_writer_frame_message(&writer);
+    }
+    TEST_WRITER_DESTROY_NOERROR(&writer);
+}
+
+static void test_frame_writer(void) {
+    test_frame_stream_t stream;
+    memset(&stream, 0, sizeof(stream));
+    test_frame_write(&stream, &test_frame_codec, 64);
+
+    // every frame holds whole messages and at least frame_size bytes,
+    // except the last
+    mpack_frame_index_t frames;
+    mpack_frame_index_init(&frames, stream.buf, stream.size);
+    TEST_TRUE(mpack_frame_index_error(&frames) == mpack_ok);
+    size_t count = mpack_frame_index_count(&frames);
+    TEST_TRUE(count > 1);
+
+    size_t total = 0;
+    size_t compressed = 0;
+    #if MPACK_NODE
+    size_t message = 0;
+    #endif
+    for (size_t i = 0; i < count; ++i) {
+        size_t size, raw_size;
+        const char* frame = mpack_frame_index_frame(&frames, i, &size, &raw_size);
+        if (size < raw_size + MPACK_FRAME_HEADER_SIZE)
+            ++compressed;
+        TEST_TRUE(i + 1 == count || raw_size >= 64);
+        total += size;
+
+        char decoded[512];
+        TEST_TRUE(raw_size <= sizeof(decoded));
+        TEST_TRUE(mpack_frame_decode(&test_frame_codec, frame, size, decoded, raw_size) == mpack_ok);
+
+        #if MPACK_NODE
+        mpack_message_index_t messages;
+        mpack_message_index_init(&messages, decoded, raw_size);
+        for (size_t j = 0; j < mpack_message_index_count(&messages); ++j) {
+            size_t message_size;
+            const char* data = mpack_message_index_message(&messages, j, &message_size);
+            TEST_TRUE((uint8_t)data[1] == message, "frame %i has message %i instead of %i",
+                    (int)i, (int)(uint8_t)data[1], (int)message);
+            ++message;
+        }
+        TEST_TRUE(mpack_message_index_destroy(&messages) == mpack_ok);
+        #endif
+    }
+    TEST_TRUE(total == stream.size);
+    TEST_TRUE(compressed > 0);
+    #if MPACK_NODE
+    TEST_TRUE(message == TEST_FRAME_MESSAGES);
+    #endif
+    TEST_TRUE(mpack_frame_index_destroy(&frames) == mpack_ok);
+
+    // incompressible frames are stored
+    memset(&stream, 0, sizeof(stream));
+    test_frame_write(&stream, &test_frame_codec_stored, 0);
+    TEST_TRUE(mpack_load_u32(stream.buf) == stream.size - MPACK_FRAME_HEADER_SIZE);
+    TEST_TRUE(mpack_load_u32(stream.buf + 4) == stream.size - MPACK_FRAME_HEADER_SIZE);
+
+    // a message larger than the buffer isn't split, and frames can be
+    // flushed early
+    memset(&stream, 0, sizeof(stream));
+    char str[200];
+    memset(str, 'b', sizeof(str));
+    mpack_writer_t writer;
+    mpack_writer_init_frame(&writer, &test_frame_codec, 1, test_frame_output, &stream);
+    mpack_write_str(&writer, str, sizeof(str));
+    mpack_writer_frame_message(&writer);
+    TEST_TRUE(stream.size == 14);
+    TEST_TRUE(memcmp(stream.buf, "\x00\x00\x00\x06\x00\x00\x00\xca\x01\xd9\x01\xc8\xc8\x62", 14) == 0);
+    mpack_write_nil(&writer);
+    mpack_writer_flush_frame(&writer);
+    mpack_writer_flush_frame(&writer);
+    TEST_TRUE(stream.size == 23);
+    TEST_TRUE(memcmp(stream.buf + 14, "\x00\x00\x00\x01\x00\x00\x00\x01\xc0", 9) == 0);
+    TEST_WRITER_DESTROY_NOERROR(&writer);
+    TEST_TRUE(stream.size == 23);
+
+    // output errors
+    memset(&stream, 0, sizeof(stream));
+    stream.fail = 1;
+    mpack_writer_init_frame(&writer, &test_frame_codec, 0, test_frame_output, &stream);
+    mpack_write_nil(&writer);
+    TEST_WRITER_DESTROY_ERROR(&writer, mpack_error_io);
+}
+#endif
+
+#if MPACK_WRITER && MPACK_READER
+static void test_frame_read_messages(const mpack_frame_codec_t* codec, test_frame_stream_t* stream) {
+    mpack_reader_t reader;
+    mpack_reader_init_frame(&reader, codec, test_frame_input, stream);
+    for (size_t i = 0; i < TEST_FRAME_MESSAGES; ++i) {
+        TEST_TRUE(mpack_expect_array(&reader) == 3);
+        TEST_TRUE(mpack_expect_u32(&reader) == i);
+        uint32_t length = mpack_expect_str(&reader);
+        TEST_TRUE(length == i);
+        const char* str = mpack_read_bytes_inplace(&reader, length);
+        TEST_TRUE(mpack_reader_error(&reader) != mpack_ok || length == 0 || str[length - 1] == 'a');
+        mpack_done_str(&reader);
+        mpack_expect_nil(&reader);
+        mpack_done_array(&reader);
+    }
+    TEST_TRUE(mpack_reader_error(&reader) == mpack_ok);
+
+    // the input ends cleanly between frames
+    mpack_discard(&reader);
+    TEST_READER_DESTROY_ERROR(&reader, mpack_error_eof);
+}
+
+static void test_frame_reader(void) {
+    test_frame_stream_t stream;
+    memset(&stream, 0, sizeof(stream));
+    test_frame_write(&stream, &test_frame_codec, 64);
+    test_frame_read_messages(&test_frame_codec, &stream);
+    stream.pos = 0;
+    stream.step = 3;
+    test_frame_read_messages(&test_frame_codec, &stream);
+
+    memset(&stream, 0, sizeof(stream));
+    test_frame_write(&stream, &test_frame_codec_stored, 100);
+    test_frame_read_messages(&test_frame_codec_stored, &stream);
+
+    // truncated headers and payloads
+    mpack_reader_t reader;
+    stream.pos = 0;
+    stream.size = 5;
+    mpack_reader_init_frame(&reader, &test_frame_codec, test_frame_input, &stream);
+    mpack_discard(&reader);
+    TEST_READER_DESTROY_ERROR(&reader, mpack_error_invalid);
+    stream.pos = 0;
+    stream.size = 12;
+    mpack_reader_init_frame(&reader, &test_frame_codec, test_frame_input, &stream);
+    mpack_discard(&reader);
+    TEST_READER_DESTROY_ERROR(&reader, mpack_error_invalid);
+
+    // input errors
+    stream.pos = 0;
+    stream.fail = 1;
+    mpack_reader_init_frame(&reader, &test_frame_codec, test_frame_input, &stream);
+    mpack_discard(&reader);
+    TEST_READER_DESTROY_ERROR(&reader, mpack_error_io);
+
+    // corrupt payloads
+    static const char corrupt[] = "\x00\x00\x00\x04\x00\x00\x00\x07\x01\x95\x05\xc0";
+    memset(&stream, 0, sizeof(stream));
+    memcpy(stream.buf, corrupt, sizeof(corrupt) - 1);
+    stream.size = sizeof(corrupt) - 1;
+    mpack_reader_init_frame(&reader, &test_frame_codec, test_frame_input, &stream);
+    mpack_discard(&reader);
+    TEST_READER_DESTROY_ERROR(&reader, mpack_error_invalid);
+}
+#endif
+
+#if MPACK_WRITER && MPACK_NODE
+static void test_frame_tree_messages(const mpack_frame_codec_t* codec, test_frame_stream_t* stream) {
+    mpack_tree_t tree;
+    mpack_tree_init_frame(&tree, codec, test_frame_input, stream, 1024, 64);
+    for (size_t i = 0; i < TEST_FRAME_MESSAGES; ++i) {
+        mpack_tree_parse(&tree);
+        mpack_node_t root = mpack_tree_root(&tree);
+        TEST_TRUE(mpack_node_array_length(root) == 3);
+        TEST_TRUE(mpack_node_u32(mpack_node_array_at(root, 0)) == i);
+        TEST_TRUE(mpack_node_strlen(mpack_node_array_at(root, 1)) == i);
+        TEST_TRUE(mpack_tree_error(&tree) == mpack_ok);
+    }
+
+    // the input ends cleanly between frames
+    mpack_tree_parse(&tree);
+    TEST_TREE_DESTROY_ERROR(&tree, mpack_error_eof);
+}
+
+static void test_frame_tree(void) {
+    test_frame_stream_t stream;
+    memset(&stream, 0, sizeof(stream));
+    test_frame_write(&stream, &test_frame_codec, 64);
+    test_frame_tree_messages(&test_frame_codec, &stream);
+    stream.pos = 0;
+    stream.step = 5;
+    test_frame_tree_messages(&test_frame_codec, &stream);
+
+    // frames larger than the tree's buffer are copied in pieces
+    memset(&stream, 0, sizeof(stream));
+    test_frame_write(&stream, &test_frame_codec_stored, 1000);
+    test_frame_tree_messages(&test_frame_codec_stored, &stream);
+
+    // corrupt payloads
+    static const char corrupt[] = "\x00\x00\x00\x04\x00\x00\x00\x07\x01\x95\x05\xc0";
+    memset(&stream, 0, sizeof(stream));
+    memcpy(stream.buf, corrupt, sizeof(corrupt) - 1);
+    stream.size = sizeof(corrupt) - 1;
+    mpack_tree_t tree;
+    mpack_tree_init_frame(&tree, &test_frame_codec, test_frame_input, &stream, 1024, 64);
+    mpack_tree_parse(&tree);
+    TEST_TREE_DESTROY_ERROR(&tree, mpack_error_invalid);
+}
+#endif
+
+#if MPACK_WRITER
+// Everything allocated after init comes from the allocator.
+static void test_frame_allocator(void) {
+    static char arena_data[65536];
+    test_arena_t arena;
+    mpack_allocator_t allocator = test_arena_init(&arena, arena_data, sizeof(arena_data), true);
+
+    test_frame_stream_t stream;
+    memset(&stream, 0, sizeof(stream));
+    mpack_writer_t writer;
+    mpack_writer_init_frame(&writer, &test_frame_codec, 64, test_frame_output, &stream);
+    mpack_writer_set_allocator(&writer, &allocator);
+    size_t mallocs = test_malloc_total_count();
+    for (size_t i = 0; i < TEST_FRAME_MESSAGES; ++i) {
+        mpack_start_array(&writer, 2);
+        mpack_write_u32(&writer, (uint32_t)i);
+        mpack_write_cstr(&writer, "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa");
+        mpack_finish_array(&writer);
+        mpack_writer_frame_message(&writer);
+    }
+    TEST_TRUE(test_arena_contains(&arena, writer.buffer));
+    TEST_WRITER_DESTROY_NOERROR(&writer);
+    TEST_TRUE(test_malloc_total_count() == mallocs);
+    TEST_TRUE(arena.allocs > 1 && arena.frees == arena.allocs);
+
+    size_t allocs = arena.allocs;
+    mpack_frame_index_t frames;
+    mpack_frame_index_init_allocator(&frames, stream.buf, stream.size, &allocator);
+    TEST_TRUE(mpack_frame_index_count(&frames) > 1);
+    TEST_TRUE(mpack_frame_index_destroy(&frames) == mpack_ok);
+    TEST_TRUE(test_malloc_total_count() == mallocs);
+    TEST_TRUE(arena.allocs > allocs && arena.frees == arena.allocs);
+
+    #if MPACK_READER
+    allocs = arena.allocs;
+    mpack_reader_t reader;
+    mpack_reader_init_frame(&reader, &test_frame_codec, test_frame_input, &stream);
+    mpack_reader_set_allocator(&reader, &allocator);
+    mallocs = test_malloc_total_count();
+    for (size_t i = 0; i < TEST_FRAME_MESSAGES; ++i) {
+        TEST_TRUE(mpack_expect_array(&reader) == 2);
+        TEST_TRUE(mpack_expect_u32(&reader) == i);
+        mpack_discard(&reader);
+        mpack_done_array(&reader);
+    }
+    TEST_READER_DESTROY_NOERROR(&reader);
+    TEST_TRUE(test_malloc_total_count() == mallocs);
+    TEST_TRUE(arena.allocs > allocs && arena.frees == arena.allocs);
+    #endif
+
+    #if MPACK_NODE
+    allocs = arena.allocs;
+    stream.pos = 0;
+    mpack_tree_t tree;
+    mpack_tree_init_frame(&tree, &test_frame_codec, test_frame_input, &stream, 1024, 64);
+    mpack_tree_set_allocator(&tree, &allocator);
+    mallocs = test_malloc_total_count();
+    for (size_t i = 0; i < TEST_FRAME_MESSAGES; ++i) {
+        mpack_tree_parse(&tree);
+        TEST_TRUE(mpack_node_u32(mpack_node_array_at(mpack_tree_root(&tree), 0)) == i);
+    }
+    TEST_TREE_DESTROY_NOERROR(&tree);
+    TEST_TRUE(test_malloc_total_count() == mallocs);
+    TEST_TRUE(arena.allocs > allocs && arena.frees == arena.allocs);
+    #endif
+}
+#endif
+
+void test_frame(void) {
+    test_frame_headers();
+    #if MPACK_WRITER
+    test_frame_writer();
+    test_frame_allocator();
+    #if MPACK_READER
+    test_frame_reader();
+    #endif
+    #if MPACK_NODE
+    test_frame_tree();
+    #endif
+    #endif
+}
+
+#endif
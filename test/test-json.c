@@ -0,0 +1,303 @@
+/*
+ * Copyright (c) 2015-2018 Nicholas Fraser
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "test-json.h"
+#include "test-reader.h"
+
+#if MPACK_JSON && MPACK_READER && MPACK_STDIO
+
+// transcodes the given message, checking the resulting error and, if given,
+// the resulting text
+static void test_json_check(mpack_json_t* json, const char* data, size_t length,
+        mpack_error_t error, const char* text)
+{
+    mpack_reader_t reader;
+    mpack_reader_init_data(&reader, data, length);
+    mpack_error_t actual = mpack_json_transcode(json, &reader);
+    TEST_TRUE(actual == error, "error is %s instead of %s for \"%.*s\"",
+            mpack_error_to_string(actual), mpack_error_to_string(error), (int)mpack_json_buffer_used(json), json->buffer);
+    if (error == mpack_ok)
+        TEST_TRUE(mpack_reader_remaining(&reader, NULL) == 0);
+    if (error == mpack_ok && text != NULL) {
+        TEST_TRUE(mpack_json_buffer_used(json) == strlen(text),
+                "json is %i bytes instead of %i", (int)mpack_json_buffer_used(json), (int)strlen(text));
+        TEST_TRUE(memcmp(json->buffer, text, strlen(text)) == 0,
+                "json is \"%.*s\" instead of \"%s\"", (int)mpack_json_buffer_used(json), json->buffer, text);
+    }
+    mpack_reader_destroy(&reader);
+}
+
+#define TEST_JSON(data, text) do { \
+    char buffer[256]; \
+    mpack_json_t json; \
+    mpack_json_init(&json, buffer, sizeof(buffer)); \
+    test_json_check(&json, data, sizeof(data) - 1, mpack_ok, text); \
+    TEST_TRUE(mpack_json_destroy(&json) == mpack_ok); \
+} while (0)
+
+#define TEST_JSON_ERROR(data, error) do { \
+    char buffer[256]; \
+    mpack_json_t json; \
+    mpack_json_init(&json, buffer, sizeof(buffer)); \
+    test_json_check(&json, data, sizeof(data) - 1, error, NULL); \
+    TEST_TRUE(mpack_json_destroy(&json) == error); \
+} while (0)
+
+static void test_json_scalars(void) {
+    TEST_JSON("\xc0", "null");
+    TEST_JSON("\xc3", "true");
+    TEST_JSON("\xc2", "false");
+    TEST_JSON("\x00", "0");
+    TEST_JSON("\x7f", "127");
+    TEST_JSON("\xff", "-1");
+    TEST_JSON("\xcd\x30\x39", "12345");
+    TEST_JSON("\xd3\x80\x00\x00\x00\x00\x00\x00\x00", "-9223372036854775808");
+    TEST_JSON("\xcf\xff\xff\xff\xff\xff\xff\xff\xff", "18446744073709551615");
+
+    TEST_JSON("\xcb\x3f\xf8\x00\x00\x00\x00\x00\x00", "1.5");
+    TEST_JSON("\xcb\x3f\xb9\x99\x99\x99\x99\x99\x9a", "0.10000000000000001");
+    TEST_JSON("\xcb\xc0\x08\x00\x00\x00\x00\x00\x00", "-3");
+    TEST_JSON("\xcb\x43\x50\x00\x00\x00\x00\x00\x00", "18014398509481984");
+    TEST_JSON("\xcb\x80\x00\x00\x00\x00\x00\x00\x00", "-0");
+    TEST_JSON("\xca\x3f\xc0\x00\x00", "1.5");
+    TEST_JSON("\xca\x42\x28\x00\x00", "42");
+
+    // infinities and NaN aren't supported in finite math mode
+    #if !MPACK_FINITE_MATH
+    TEST_JSON("\xcb\x7f\xf0\x00\x00\x00\x00\x00\x00", "null");
+    TEST_JSON("\xcb\x7f\xf8\x00\x00\x00\x00\x00\x00", "null");
+    TEST_JSON("\xca\xff\x80\x00\x00", "null");
+    #endif
+}
+
+static void test_json_strings(void) {
+    TEST_JSON("\xa0", "\"\"");
+    TEST_JSON("\xa5hello", "\"hello\"");
+    TEST_JSON("\xa9q\"b\\\n\t\x01\x1f\x7f", "\"q\\\"b\\\\\\n\\t\\u0001\\u001f\x7f\"");
+    TEST_JSON("\xa9\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80", "\"\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80\"");
+
+    // invalid UTF-8
+    TEST_JSON_ERROR("\xa1\xff", mpack_error_invalid);
+    TEST_JSON_ERROR("\xa2\xc3\x28", mpack_error_invalid);
+    TEST_JSON_ERROR("\xa1\xc3", mpack_error_invalid);
+    TEST_JSON_ERROR("\xa2\xc0\x80", mpack_error_invalid);         // overlong
+    TEST_JSON_ERROR("\xa3\xe0\x80\x80", mpack_error_invalid);     // overlong
+    TEST_JSON_ERROR("\xa3\xed\xa0\x80", mpack_error_invalid);     // surrogate
+    TEST_JSON_ERROR("\xa4\xf4\x90\x80\x80", mpack_error_invalid); // above U+10FFFF
+
+    // invalid UTF-8 can be replaced
+    char buffer[64];
+    mpack_json_t json;
+    mpack_json_init(&json, buffer, sizeof(buffer));
+    mpack_json_set_replace_invalid(&json, true);
+    test_json_check(&json, "\xa6""a\xff\xc3(\xe2\x82", 7, mpack_ok, "\"a\\ufffd\\ufffd(\\ufffd\"");
+    TEST_TRUE(mpack_json_destroy(&json) == mpack_ok);
+
+    mpack_json_init(&json, buffer, sizeof(buffer));
+    mpack_json_write_str(&json, "x\"", 2);
+    mpack_json_write_raw(&json, ",", 1);
+    mpack_json_write_str(&json, "\xc3", 1);
+    TEST_TRUE(mpack_json_destroy(&json) == mpack_error_invalid);
+    TEST_TRUE(memcmp(buffer, "\"x\\\"\",\"", 7) == 0);
+}
+
+static void test_json_bins(void) {
+    TEST_JSON("\xc4\x00", "\"\"");
+    TEST_JSON("\xc4\x01""f", "\"Zg==\"");
+    TEST_JSON("\xc4\x02""fo", "\"Zm8=\"");
+    TEST_JSON("\xc4\x03""foo", "\"Zm9v\"");
+    TEST_JSON("\xc4\x04""foob", "\"Zm9vYg==\"");
+    TEST_JSON("\xc4\x06""foobar", "\"Zm9vYmFy\"");
+    TEST_JSON("\xc4\x03\xfb\xff\x00", "\"+/8A\"");
+}
+
+static void test_json_compound(void) {
+    TEST_JSON("\x90", "[]");
+    TEST_JSON("\x80", "{}");
+    TEST_JSON("\x93\x01\x92\xc0\xc3\x80", "[1,[null,true],{}]");
+    TEST_JSON("\x82\xa1""a\x01\xa1""b\x91\xa0", "{\"a\":1,\"b\":[\"\"]}");
+
+    // non-string keys are quoted
+    TEST_JSON("\x86\x01\x02\xff\x03\xc3\x04\xc0\x05\xcb\x3f\xf8\x00\x00\x00\x00\x00\x00\x06\xc4\x01""f\x07",
+            "{\"1\":2,\"-1\":3,\"true\":4,\"null\":5,\"1.5\":6,\"Zg==\":7}");
+    TEST_JSON_ERROR("\x81\x90\x01", mpack_error_type);
+    TEST_JSON_ERROR("\x81\x80\x01", mpack_error_type);
+
+    // truncated data
+    TEST_JSON_ERROR("\x92\x01", mpack_error_invalid);
+    TEST_JSON_ERROR("\xa5hel", mpack_error_invalid);
+
+    // nesting is limited
+    char deep[MPACK_JSON_MAX_DEPTH + 1];
+    memset(deep, 0x91, sizeof(deep) - 1);
+    deep[sizeof(deep) - 1] = '\xc0';
+    char buffer[MPACK_JSON_MAX_DEPTH * 2 + 8];
+    mpack_json_t json;
+    mpack_json_init(&json, buffer, sizeof(buffer));
+    test_json_check(&json, deep, sizeof(deep), mpack_ok, NULL);
+    TEST_TRUE(buffer[MPACK_JSON_MAX_DEPTH] == 'n');
+    TEST_TRUE(mpack_json_destroy(&json) == mpack_ok);
+    deep[sizeof(deep) - 1] = '\x90';
+    mpack_json_init(&json, buffer, sizeof(buffer));
+    test_json_check(&json, deep, sizeof(deep), mpack_error_too_big, NULL);
+    TEST_TRUE(mpack_json_destroy(&json) == mpack_error_too_big);
+}
+
+#if MPACK_EXTENSIONS
+static void test_json_ext_handler(mpack_json_t* json, mpack_reader_t* reader, mpack_tag_t tag) {
+    TEST_TRUE(mpack_tag_ext_exttype(&tag) == 5);
+    char data[2];
+    mpack_read_bytes(reader, data, sizeof(data));
+    mpack_done_ext(reader);
+    mpack_json_write_str(json, data, sizeof(data));
+}
+
+static void test_json_exts(void) {
+    static const char test[] = "\x92\xd5\x05""ab\xc0";
+    TEST_JSON_ERROR(test, mpack_error_type);
+
+    char buffer[64];
+    mpack_json_t json;
+    mpack_json_init(&json, buffer, sizeof(buffer));
+    mpack_json_set_ext_mode(&json, mpack_json_ext_null);
+    test_json_check(&json, test, sizeof(test) - 1, mpack_ok, "[null,null]");
+    TEST_TRUE(mpack_json_destroy(&json) == mpack_ok);
+
+    mpack_json_init(&json, buffer, sizeof(buffer));
+    mpack_json_set_ext_mode(&json, mpack_json_ext_object);
+    test_json_check(&json, test, sizeof(test) - 1, mpack_ok, "[{\"type\":5,\"data\":\"YWI=\"},null]");
+    TEST_TRUE(mpack_json_destroy(&json) == mpack_ok);
+
+    mpack_json_init(&json, buffer, sizeof(buffer));
+    mpack_json_set_ext_handler(&json, &test_json_ext_handler);
+    test_json_check(&json, test, sizeof(test) - 1, mpack_ok, "[\"ab\",null]");
+    TEST_TRUE(mpack_json_destroy(&json) == mpack_ok);
+
+    // ext keys are not allowed
+    mpack_json_init(&json, buffer, sizeof(buffer));
+    mpack_json_set_ext_mode(&json, mpack_json_ext_null);
+    test_json_check(&json, "\x81\xd4\x01\x00\xc0", 5, mpack_error_type, NULL);
+    TEST_TRUE(mpack_json_destroy(&json) == mpack_error_type);
+}
+#endif
+
+typedef struct test_json_stream_t {
+    const char* data;
+    size_t left;
+    char output[4096];
+    size_t used;
+    size_t flushes;
+} test_json_stream_t;
+
+static size_t test_json_stream_fill(mpack_reader_t* reader, char* buffer, size_t count) {
+    test_json_stream_t* stream = (test_json_stream_t*)reader->context;
+    if (count > 3)
+        count = 3;
+    if (count > stream->left)
+        count = stream->left;
+    memcpy(buffer, stream->data, count);
+    stream->data += count;
+    stream->left -= count;
+    return count;
+}
+
+static void test_json_stream_flush(mpack_json_t* json, const char* data, size_t count) {
+    test_json_stream_t* stream = (test_json_stream_t*)mpack_json_context(json);
+    if (count > sizeof(stream->output) - stream->used) {
+        mpack_json_flag_error(json, mpack_error_io);
+        return;
+    }
+    memcpy(stream->output + stream->used, data, count);
+    stream->used += count;
+    ++stream->flushes;
+}
+
+static void test_json_stream(void) {
+    // a long string of multi-byte characters and a long bin, which are read
+    // from a small reader in chunks that split characters and groups
+    char message[1200];
+    size_t length = 0;
+    message[length++] = '\x93';
+    message[length++] = '\xda';
+    message[length++] = (char)(600 >> 8);
+    message[length++] = (char)(600 & 0xff);
+    for (int i = 0; i < 200; ++i) {
+        message[length++] = '\xe2';
+        message[length++] = '\x82';
+        message[length++] = '\xac';
+    }
+    message[length++] = '\xc4';
+    message[length++] = (char)200;
+    for (int i = 0; i < 200; ++i)
+        message[length++] = (char)i;
+    message[length++] = '\x01';
+
+    char buffer[1600];
+    mpack_json_t json;
+    mpack_json_init(&json, buffer, sizeof(buffer));
+    test_json_check(&json, message, length, mpack_ok, NULL);
+    size_t expected_length = mpack_json_buffer_used(&json);
+    TEST_TRUE(mpack_json_destroy(&json) == mpack_ok);
+    TEST_TRUE(expected_length == 1 + 602 + 1 + 2 + 268 + 1 + 1 + 1);
+
+    static test_json_stream_t stream;
+    memset(&stream, 0, sizeof(stream));
+    stream.data = message;
+    stream.left = length;
+
+    char reader_buffer[MPACK_READER_MINIMUM_BUFFER_SIZE * 2];
+    mpack_reader_t reader;
+    mpack_reader_init(&reader, reader_buffer, sizeof(reader_buffer), 0);
+    mpack_reader_set_context(&reader, &stream);
+    mpack_reader_set_fill(&reader, &test_json_stream_fill);
+
+    char small[MPACK_JSON_MINIMUM_BUFFER_SIZE];
+    mpack_json_init(&json, small, sizeof(small));
+    mpack_json_set_context(&json, &stream);
+    mpack_json_set_flush(&json, &test_json_stream_flush);
+    TEST_TRUE(mpack_json_transcode(&json, &reader) == mpack_ok);
+    mpack_json_write_raw(&json, "\n", 1);
+    TEST_TRUE(mpack_json_destroy(&json) == mpack_ok);
+    TEST_TRUE(mpack_reader_destroy(&reader) == mpack_ok);
+
+    TEST_TRUE(stream.flushes > 10);
+    TEST_TRUE(stream.used == expected_length + 1);
+    TEST_TRUE(memcmp(stream.output, buffer, expected_length) == 0);
+    TEST_TRUE(stream.output[expected_length] == '\n');
+
+    // without a flush function the output must fit in the buffer
+    mpack_json_init(&json, small, sizeof(small));
+    test_json_check(&json, message, length, mpack_error_too_big, NULL);
+    TEST_TRUE(mpack_json_destroy(&json) == mpack_error_too_big);
+}
+
+void test_json(void) {
+    test_json_scalars();
+    test_json_strings();
+    test_json_bins();
+    test_json_compound();
+    #if MPACK_EXTENSIONS
+    test_json_exts();
+    #endif
+    test_json_stream();
+}
+
+#endif
@@ -949,6 +949,106 @@ static void test_node_read_map_search() {
     TEST_SIMPLE_TREE_READ_ERROR(test, false == mpack_node_map_contains_cstr(node, "carl"), mpack_error_data);
 }
 
+#if MPACK_NODE_MAP_INDEX && defined(MPACK_MALLOC)
+static bool test_node_read_map_index_eager(bool eager) {
+    static const char test[] =
+            "\x89\x00\x01\xd0\x7f\x02\xfe\x03\xa5""alice\x04\xa3"
+            "bob\x05\xa4""carl\x06\xa4""carl\x07\x10\x08\x10\x09";
+
+    mpack_tree_t tree;
+    mpack_tree_init(&tree, test, sizeof(test) - 1);
+    mpack_tree_set_eager_map_index(&tree, eager);
+    mpack_tree_parse(&tree);
+    if (mpack_tree_error(&tree) == mpack_error_memory) {
+        mpack_tree_destroy(&tree);
+        return false;
+    }
+    mpack_node_t node = mpack_tree_root(&tree);
+
+    // lookups are repeated to make sure they work with the index built
+    for (int i = 0; i < 2; ++i) {
+        TEST_TRUE(1 == mpack_node_i32(mpack_node_map_uint(node, 0)));
+        TEST_TRUE(1 == mpack_node_i32(mpack_node_map_int(node, 0)));
+        TEST_TRUE(2 == mpack_node_i32(mpack_node_map_uint(node, 127)));
+        TEST_TRUE(2 == mpack_node_i32(mpack_node_map_int(node, 127)));
+        TEST_TRUE(3 == mpack_node_i32(mpack_node_map_int(node, -2)));
+        TEST_TRUE(4 == mpack_node_i32(mpack_node_map_str(node, "alice", 5)));
+        TEST_TRUE(5 == mpack_node_i32(mpack_node_map_cstr(node, "bob")));
+
+        TEST_TRUE(false == mpack_node_map_contains_int(node, 1));
+        TEST_TRUE(false == mpack_node_map_contains_uint(node, 1));
+        TEST_TRUE(false == mpack_node_map_contains_int(node, -3));
+        TEST_TRUE(false == mpack_node_map_contains_uint(node, (uint64_t)-2));
+        TEST_TRUE(false == mpack_node_map_contains_str(node, "eve", 3));
+        TEST_TRUE(false == mpack_node_map_contains_str(node, "ali", 3));
+        TEST_TRUE(mpack_node_is_missing(mpack_node_map_cstr_optional(node, "eve")));
+        TEST_TRUE(mpack_tree_error(&tree) == mpack_ok);
+    }
+
+    // duplicate keys flag an error only when looked up
+    TEST_TRUE(false == mpack_node_map_contains_cstr(node, "carl"));
+    TEST_TREE_DESTROY_ERROR(&tree, mpack_error_data);
+
+    mpack_tree_init(&tree, test, sizeof(test) - 1);
+    mpack_tree_set_eager_map_index(&tree, eager);
+    mpack_tree_parse(&tree);
+    if (mpack_tree_error(&tree) == mpack_error_memory) {
+        mpack_tree_destroy(&tree);
+        return false;
+    }
+    TEST_TRUE(false == mpack_node_map_contains_int(mpack_tree_root(&tree), 16));
+    TEST_TREE_DESTROY_ERROR(&tree, mpack_error_data);
+
+    return true;
+}
+
+static bool test_node_read_map_index_lazy(void) {
+    return test_node_read_map_index_eager(false);
+}
+
+static bool test_node_read_map_index_parse(void) {
+    return test_node_read_map_index_eager(true);
+}
+
+static void test_node_read_map_index_nested(void) {
+    // an array of large maps nested in a large map, with a large map
+    // as a key. pages are small in the unit tests so these span pages.
+    static const char test[] =
+            "\x85"
+                "\xa1""a\x92"
+                    "\x84\x01\x02\x03\x04\x05\x06\x07\x08"
+                    "\x84\x01\x12\x03\x14\x05\x16\x07\x18"
+                "\xa1""b\x00"
+                "\xa1""c\x01"
+                "\x84\x01\x02\x03\x04\x05\x06\x07\x08""\x02"
+                "\xa1""d\x84\xa1""x\xc3\xa1""y\xc2\xa1""z\xc0\xa1""w\x80";
+
+    for (int eager = 0; eager < 2; ++eager) {
+        mpack_tree_t tree;
+        mpack_tree_init(&tree, test, sizeof(test) - 1);
+        mpack_tree_set_eager_map_index(&tree, eager != 0);
+        mpack_tree_parse(&tree);
+        mpack_node_t root = mpack_tree_root(&tree);
+
+        mpack_node_t a = mpack_node_map_cstr(root, "a");
+        TEST_TRUE(8 == mpack_node_u8(mpack_node_map_uint(mpack_node_array_at(a, 0), 7)));
+        TEST_TRUE(0x18 == mpack_node_u8(mpack_node_map_int(mpack_node_array_at(a, 1), 7)));
+        TEST_TRUE(0 == mpack_node_u8(mpack_node_map_cstr(root, "b")));
+        TEST_TRUE(1 == mpack_node_u8(mpack_node_map_cstr(root, "c")));
+        TEST_TRUE(4 == mpack_node_u8(mpack_node_map_uint(mpack_node_map_key_at(root, 3), 3)));
+        TEST_TRUE(2 == mpack_node_u8(mpack_node_map_value_at(root, 3)));
+
+        mpack_node_t d = mpack_node_map_cstr(root, "d");
+        TEST_TRUE(true == mpack_node_bool(mpack_node_map_cstr(d, "x")));
+        TEST_TRUE(false == mpack_node_bool(mpack_node_map_cstr(d, "y")));
+        TEST_TRUE(mpack_node_is_nil(mpack_node_map_cstr(d, "z")));
+        TEST_TRUE(0 == mpack_node_map_count(mpack_node_map_cstr(d, "w")));
+
+        TEST_TREE_DESTROY_NOERROR(&tree);
+    }
+}
+#endif
+
 static void test_node_read_compound_errors(void) {
     mpack_node_data_t pool[128];
 
@@ -1055,6 +1155,161 @@ static void test_node_read_data(void) {
     TEST_TREE_DESTROY_NOERROR(&tree);
 }
 
+static size_t test_node_array_copy(const char* data, size_t data_size,
+        size_t (*copy)(mpack_node_t node, void* out, size_t count),
+        void* out, size_t count, mpack_error_t error)
+{
+    mpack_tree_t tree;
+    TEST_TREE_INIT(&tree, data, data_size);
+    mpack_tree_parse(&tree);
+    size_t ret = copy(mpack_tree_root(&tree), out, count);
+    TEST_TREE_DESTROY_ERROR(&tree, error);
+    return ret;
+}
+
+static size_t test_node_copy_double(mpack_node_t node, void* out, size_t count) {
+    return mpack_node_array_copy_double(node, (double*)out, count);
+}
+
+static size_t test_node_copy_float(mpack_node_t node, void* out, size_t count) {
+    return mpack_node_array_copy_float(node, (float*)out, count);
+}
+
+static size_t test_node_copy_i64(mpack_node_t node, void* out, size_t count) {
+    return mpack_node_array_copy_i64(node, (int64_t*)out, count);
+}
+
+static size_t test_node_copy_i32(mpack_node_t node, void* out, size_t count) {
+    return mpack_node_array_copy_i32(node, (int32_t*)out, count);
+}
+
+static size_t test_node_copy_u64(mpack_node_t node, void* out, size_t count) {
+    return mpack_node_array_copy_u64(node, (uint64_t*)out, count);
+}
+
+static size_t test_node_copy_u32(mpack_node_t node, void* out, size_t count) {
+    return mpack_node_array_copy_u32(node, (uint32_t*)out, count);
+}
+
+#define TEST_NODE_ARRAY_COPY(data, copy, out, count, error) \
+    test_node_array_copy(data, sizeof(data) - 1, copy, out, count, error)
+
+static void test_node_read_array_copy(void) {
+    static const char doubles[] = "\x93\xcb\x3f\xf0\x00\x00\x00\x00\x00\x00"
+        "\xcb\x40\x04\x00\x00\x00\x00\x00\x00\xcb\xc0\x08\x00\x00\x00\x00\x00\x00";
+    static const char mixed[] = "\x94\x01\xd0\xff\xca\x3f\xc0\x00\x00\xcd\x01\x00";
+    static const char ints[] = "\x93\x01\xd0\xff\xce\x7f\xff\xff\xff";
+    static const char large[] = "\x92\x00\xcf\xff\xff\xff\xff\xff\xff\xff\xff";
+
+    // uniform and mixed encodings
+    double d[4];
+    TEST_TRUE(TEST_NODE_ARRAY_COPY(doubles, test_node_copy_double, d, 4, mpack_ok) == 3);
+    TEST_TRUE(d[0] == 1.0 && d[1] == 2.5 && d[2] == -3.0);
+    TEST_TRUE(TEST_NODE_ARRAY_COPY(mixed, test_node_copy_double, d, 4, mpack_ok) == 4);
+    TEST_TRUE(d[0] == 1.0 && d[1] == -1.0 && d[2] == 1.5 && d[3] == 256.0);
+
+    float f[4];
+    TEST_TRUE(TEST_NODE_ARRAY_COPY(mixed, test_node_copy_float, f, 4, mpack_ok) == 4);
+    TEST_TRUE(f[0] == 1.0f && f[1] == -1.0f && f[2] == 1.5f && f[3] == 256.0f);
+    TEST_TRUE(TEST_NODE_ARRAY_COPY("\x90", test_node_copy_float, f, 0, mpack_ok) == 0);
+
+    int64_t i64[3];
+    TEST_TRUE(TEST_NODE_ARRAY_COPY(ints, test_node_copy_i64, i64, 3, mpack_ok) == 3);
+    TEST_TRUE(i64[0] == 1 && i64[1] == -1 && i64[2] == INT32_MAX);
+    int32_t i32[3];
+    TEST_TRUE(TEST_NODE_ARRAY_COPY(ints, test_node_copy_i32, i32, 3, mpack_ok) == 3);
+    TEST_TRUE(i32[0] == 1 && i32[1] == -1 && i32[2] == INT32_MAX);
+    uint64_t u64[2];
+    TEST_TRUE(TEST_NODE_ARRAY_COPY(large, test_node_copy_u64, u64, 2, mpack_ok) == 2);
+    TEST_TRUE(u64[0] == 0 && u64[1] == UINT64_MAX);
+
+    // errors leave the buffer untouched
+    uint32_t u32[3] = {7, 7, 7};
+    TEST_TRUE(TEST_NODE_ARRAY_COPY(ints, test_node_copy_u32, u32, 3, mpack_error_type) == 0);
+    TEST_TRUE(u32[0] == 7 && u32[1] == 7 && u32[2] == 7);
+    i32[0] = 7;
+    TEST_TRUE(TEST_NODE_ARRAY_COPY(large, test_node_copy_i32, i32, 3, mpack_error_type) == 0);
+    TEST_TRUE(i32[0] == 7);
+    TEST_TRUE(TEST_NODE_ARRAY_COPY(mixed, test_node_copy_i64, i64, 3, mpack_error_too_big) == 0);
+    TEST_TRUE(TEST_NODE_ARRAY_COPY(mixed, test_node_copy_i64, i64, 4, mpack_error_type) == 0);
+    d[0] = 7.0;
+    TEST_TRUE(TEST_NODE_ARRAY_COPY("\x92\x01\xc0", test_node_copy_double, d, 2, mpack_error_type) == 0);
+    TEST_TRUE(TEST_NODE_ARRAY_COPY("\x81\x01\x01", test_node_copy_double, d, 2, mpack_error_type) == 0);
+    TEST_TRUE(d[0] == 7.0);
+}
+
+static void test_node_array_columns_error(const char* data, size_t data_size,
+        mpack_column_t* columns, size_t column_count, mpack_error_t error)
+{
+    mpack_tree_t tree;
+    TEST_TREE_INIT(&tree, data, data_size);
+    mpack_tree_parse(&tree);
+    TEST_TRUE(mpack_node_array_columns(mpack_tree_root(&tree), columns, column_count, 4) == 0);
+    TEST_TREE_DESTROY_ERROR(&tree, error);
+}
+
+static void test_node_read_array_columns(void) {
+    // the third record has its keys in a different order and a nil value,
+    // and the fourth is missing a key
+    static const char records[] = "\x94"
+        "\x83\xa2ts\x01\xa4host\xa1""a\xa1v\xcb\x3f\xe0\x00\x00\x00\x00\x00\x00"
+        "\x83\xa2ts\x02\xa4host\xa2""bc\xa1v\x02"
+        "\x83\xa1v\xc0\xa4host\xa1""d\xa2ts\x03"
+        "\x82\xa2ts\xff\xa4host\xa2""ee";
+
+    int64_t ts[4];
+    double v[4];
+    size_t offsets[4];
+    uint32_t lengths[4];
+    uint8_t nulls = 0xff;
+    mpack_column_t columns[3];
+    memset(columns, 0, sizeof(columns));
+    columns[0].key = "ts";
+    columns[0].type = mpack_column_i64;
+    columns[0].i64 = ts;
+    columns[1].key = "host";
+    columns[1].type = mpack_column_str;
+    columns[1].offsets = offsets;
+    columns[1].lengths = lengths;
+    columns[2].key = "v";
+    columns[2].type = mpack_column_double;
+    columns[2].f64 = v;
+    columns[2].nulls = &nulls;
+
+    mpack_tree_t tree;
+    TEST_TREE_INIT(&tree, records, sizeof(records) - 1);
+    mpack_tree_parse(&tree);
+    TEST_TRUE(mpack_node_array_columns(mpack_tree_root(&tree), columns, 3, 4) == 4);
+    TEST_TRUE(ts[0] == 1 && ts[1] == 2 && ts[2] == 3 && ts[3] == -1);
+    TEST_TRUE(v[0] == 0.5 && v[1] == 2.0 && v[2] == 0.0 && v[3] == 0.0);
+    TEST_TRUE(nulls == 0xfc, "nulls is %x", (unsigned)nulls);
+    static const char* hosts[] = {"a", "bc", "d", "ee"};
+    for (size_t i = 0; i < 4; ++i) {
+        TEST_TRUE(lengths[i] == strlen(hosts[i]));
+        TEST_TRUE(memcmp(mpack_tree_data(&tree) + offsets[i], hosts[i], lengths[i]) == 0);
+    }
+    TEST_TRUE(mpack_node_array_columns(mpack_tree_root(&tree), columns, 3, 3) == 0);
+    TEST_TREE_DESTROY_ERROR(&tree, mpack_error_too_big);
+
+    // nil and missing values without a null bitmap
+    columns[2].nulls = NULL;
+    test_node_array_columns_error(records, sizeof(records) - 1, columns, 3, mpack_error_type);
+    static const char missing[] = "\x91\x82\xa2ts\xff\xa4host\xa2""ee";
+    test_node_array_columns_error(missing, sizeof(missing) - 1, columns, 3, mpack_error_data);
+
+    // mismatched types, non-map records and duplicate keys
+    static const char string_ts[] = "\x91\x81\xa2ts\xa1x";
+    static const char large_ts[] = "\x91\x81\xa2ts\xcf\x80\x00\x00\x00\x00\x00\x00\x00";
+    static const char not_array[] = "\x81\xa2ts\x01";
+    static const char not_map[] = "\x92\x81\xa2ts\x01\x01";
+    static const char duplicate[] = "\x91\x82\xa2ts\x01\xa2ts\x02";
+    test_node_array_columns_error(string_ts, sizeof(string_ts) - 1, columns, 1, mpack_error_type);
+    test_node_array_columns_error(large_ts, sizeof(large_ts) - 1, columns, 1, mpack_error_type);
+    test_node_array_columns_error(not_array, sizeof(not_array) - 1, columns, 1, mpack_error_type);
+    test_node_array_columns_error(not_map, sizeof(not_map) - 1, columns, 1, mpack_error_type);
+    test_node_array_columns_error(duplicate, sizeof(duplicate) - 1, columns, 1, mpack_error_data);
+}
+
 static void test_node_read_deep_stack(void) {
     static const int depth = 1200;
     char buf[4096];
@@ -1220,6 +1475,981 @@ static bool test_node_multiple_allocs_stream3(void) {
 static bool test_node_multiple_allocs_stream4096(void) {
     return test_node_multiple_allocs(true, 4096);
 }
+
+static void test_node_allocator(void) {
+    static const int depth = 100;
+    char buf[512];
+
+    // a deep message so the parsing stack is allocated, followed by a
+    // string to allocate from the tree
+    uint8_t* p = (uint8_t*)buf;
+    for (int i = 0; i < depth; ++i) {
+        *p++ = 0x81; // one pair map
+        *p++ = 0x04; // key four
+        *p++ = 0x91; // value one element array
+    }
+    memcpy(p, "\xa5hello", 6);
+    p += 6;
+
+    static char arena_data[65536];
+    test_arena_t arena;
+    for (int frees = 0; frees < 2; ++frees) {
+        mpack_allocator_t allocator = test_arena_init(&arena, arena_data, sizeof(arena_data), frees != 0);
+        size_t mallocs = test_malloc_total_count();
+
+        test_node_stream_t stream_context;
+        stream_context.data = buf;
+        stream_context.length = (size_t)(p - (uint8_t*)buf);
+        stream_context.pos = 0;
+        stream_context.step = 7;
+
+        mpack_tree_t tree;
+        mpack_tree_init_stream(&tree, &test_node_stream_read, &stream_context, 1000, 1000);
+        mpack_tree_set_allocator(&tree, &allocator);
+        mpack_tree_parse(&tree);
+        TEST_TRUE(mpack_tree_error(&tree) == mpack_ok);
+
+        mpack_node_t node = mpack_tree_root(&tree);
+        for (int i = 0; i < depth; ++i)
+            node = mpack_node_array_at(mpack_node_map_int(node, 4), 0);
+        char* str = mpack_node_cstr_alloc(node, 100);
+        TEST_TRUE(str != NULL && strcmp(str, "hello") == 0);
+        TEST_TRUE(test_arena_contains(&arena, str));
+        TEST_TREE_DESTROY_NOERROR(&tree);
+
+        // everything came from the arena, and everything but the string was
+        // given back
+        TEST_TRUE(test_malloc_total_count() == mallocs);
+        TEST_TRUE(arena.allocs > 1);
+        TEST_TRUE(arena.frees == (frees ? arena.allocs - 1 : 0));
+    }
+
+    // the allocator cannot be changed once parsing has started
+    mpack_tree_t tree;
+    mpack_tree_init(&tree, "\x90", 1);
+    mpack_tree_parse(&tree);
+    TEST_BREAK((mpack_tree_set_allocator(&tree, NULL), true));
+    TEST_TREE_DESTROY_ERROR(&tree, mpack_error_bug);
+}
+
+static void test_node_page_size(void) {
+    // 50 arrays of two elements, whose children take many small pages
+    char buf[3 + 50 * 3];
+    memcpy(buf, "\xdc\x00\x32", 3);
+    for (int i = 0; i < 50; ++i)
+        memcpy(buf + 3 + i * 3, "\x92\x01\x02", 3);
+
+    static const size_t sizes[] = {1, 64, 256, 100000, 0};
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(*sizes); ++i) {
+        mpack_tree_t tree;
+        mpack_tree_init_data(&tree, buf, sizeof(buf));
+        mpack_tree_set_page_size(&tree, sizes[i]);
+        mpack_tree_parse(&tree);
+        mpack_node_t root = mpack_tree_root(&tree);
+        TEST_TRUE(mpack_node_array_length(root) == 50);
+        for (size_t j = 0; j < 50; ++j) {
+            mpack_node_t array = mpack_node_array_at(root, j);
+            TEST_TRUE(mpack_node_array_length(array) == 2);
+            TEST_TRUE(mpack_node_int(mpack_node_array_at(array, 1)) == 2);
+        }
+        TEST_TREE_DESTROY_NOERROR(&tree);
+    }
+
+    // the page size cannot be changed once parsing has started
+    mpack_tree_t tree;
+    mpack_tree_init(&tree, "\x90", 1);
+    mpack_tree_parse(&tree);
+    TEST_BREAK((mpack_tree_set_page_size(&tree, 64), true));
+    TEST_TREE_DESTROY_ERROR(&tree, mpack_error_bug);
+}
+
+static void test_node_page_cache(void) {
+    static const char test[] = "\x82\xa1""a\x92\x01\x02\xa1""b\x91\x03";
+
+    mpack_page_cache_t cache;
+    mpack_page_cache_init(&cache, 128, 4);
+    TEST_TRUE(mpack_page_cache_count(&cache) == 0);
+    TEST_TRUE(mpack_page_cache_reserve(&cache, 8));
+    TEST_TRUE(mpack_page_cache_count(&cache) == 4);
+
+    for (int i = 0; i < 3; ++i) {
+        size_t mallocs = test_malloc_total_count();
+        mpack_tree_t tree;
+        mpack_tree_init_data(&tree, test, sizeof(test) - 1);
+        mpack_tree_set_page_cache(&tree, &cache);
+        mpack_tree_parse(&tree);
+        TEST_TRUE(mpack_node_int(mpack_node_array_at(mpack_node_map_cstr(mpack_tree_root(&tree), "b"), 0)) == 3);
+        TEST_TRUE(mpack_page_cache_count(&cache) < 4);
+        TEST_TREE_DESTROY_NOERROR(&tree);
+
+        // pages were taken from and given back to the cache
+        TEST_TRUE(mpack_page_cache_count(&cache) == 4);
+        #if !MPACK_NODE_COMPACT
+        TEST_TRUE(test_malloc_total_count() == mallocs);
+        #else
+        // the node index table is still allocated by each tree
+        MPACK_UNUSED(mallocs);
+        #endif
+    }
+
+    // a full cache frees the pages it cannot hold
+    mpack_page_cache_t small;
+    mpack_page_cache_init(&small, 0, 0);
+    TEST_TRUE(mpack_page_cache_reserve(&small, 1));
+    mpack_tree_t tree;
+    mpack_tree_init_data(&tree, test, sizeof(test) - 1);
+    mpack_tree_set_page_cache(&tree, &small);
+    mpack_tree_parse(&tree);
+    TEST_TREE_DESTROY_NOERROR(&tree);
+    TEST_TRUE(mpack_page_cache_count(&small) == 0);
+    mpack_page_cache_destroy(&small);
+
+    mpack_tree_init(&tree, "\x90", 1);
+    mpack_tree_parse(&tree);
+    TEST_BREAK((mpack_tree_set_page_cache(&tree, &cache), true));
+    TEST_TREE_DESTROY_ERROR(&tree, mpack_error_bug);
+
+    mpack_page_cache_destroy(&cache);
+    TEST_TRUE(mpack_page_cache_count(&cache) == 0);
+}
+
+static void test_node_feed(void) {
+    // two messages and the start of a third
+    char chunk[] = "\x92\xa3""abc\x01\xa5""hello\x82\xa1""a";
+    size_t chunk_length = sizeof(chunk) - 1;
+
+    mpack_tree_t tree;
+    mpack_tree_init_feed(&tree, 1000, 1000);
+    TEST_TRUE(mpack_tree_feed(&tree, NULL, 0) == mpack_tree_feed_incomplete);
+
+    // messages wholly within the chunk are parsed in place
+    TEST_TRUE(mpack_tree_feed(&tree, chunk, chunk_length) == mpack_tree_feed_complete);
+    mpack_node_t root = mpack_tree_root(&tree);
+    TEST_TRUE(mpack_node_array_length(root) == 2);
+    TEST_TRUE(mpack_node_str(mpack_node_array_at(root, 0)) == chunk + 2);
+    TEST_TRUE(mpack_node_uint(mpack_node_array_at(root, 1)) == 1);
+
+    TEST_TRUE(mpack_tree_feed(&tree, NULL, 0) == mpack_tree_feed_complete);
+    root = mpack_tree_root(&tree);
+    TEST_TRUE(mpack_node_str(root) == chunk + 7);
+    TEST_TRUE(mpack_node_strlen(root) == 5);
+    TEST_TRUE(mpack_tree_error(&tree) == mpack_ok);
+
+    // the partial message is copied out so the chunk can be reused
+    TEST_TRUE(mpack_tree_feed(&tree, NULL, 0) == mpack_tree_feed_incomplete);
+    memset(chunk, 0, sizeof(chunk));
+    TEST_TRUE(mpack_tree_feed(&tree, "\xc3\xa1", 2) == mpack_tree_feed_incomplete);
+    TEST_TRUE(mpack_tree_feed(&tree, "b\xc2\xc0", 3) == mpack_tree_feed_complete);
+    root = mpack_tree_root(&tree);
+    TEST_TRUE(mpack_node_bool(mpack_node_map_cstr(root, "a")) == true);
+    TEST_TRUE(mpack_node_bool(mpack_node_map_cstr(root, "b")) == false);
+
+    // the trailing nil is left in the buffer
+    TEST_TRUE(mpack_tree_feed(&tree, NULL, 0) == mpack_tree_feed_complete);
+    mpack_node_nil(mpack_tree_root(&tree));
+    TEST_TRUE(mpack_tree_feed(&tree, NULL, 0) == mpack_tree_feed_incomplete);
+    TEST_TREE_DESTROY_NOERROR(&tree);
+
+    // errors
+    mpack_tree_init_feed(&tree, 1000, 1000);
+    TEST_TRUE(mpack_tree_feed(&tree, "\x91\xc1", 2) == mpack_tree_feed_error);
+    TEST_TRUE(mpack_tree_feed(&tree, "\xc0", 1) == mpack_tree_feed_error);
+    TEST_TREE_DESTROY_ERROR(&tree, mpack_error_invalid);
+
+    // the size limit applies to messages parsed in place as well
+    mpack_tree_init_feed(&tree, 16, 1000);
+    TEST_TRUE(mpack_tree_feed(&tree, "\xa7""abc", 4) == mpack_tree_feed_incomplete);
+    TEST_TRUE(mpack_tree_feed(&tree, "defg", 4) == mpack_tree_feed_complete);
+    TEST_TRUE(mpack_tree_feed(&tree, "\xb4""abcdefghijklmnopqrst", 21) == mpack_tree_feed_error);
+    TEST_TREE_DESTROY_ERROR(&tree, mpack_error_too_big);
+
+    // only fed trees can be fed
+    mpack_tree_init_data(&tree, "\xc0", 1);
+    TEST_BREAK(mpack_tree_feed(&tree, "\xc0", 1) == mpack_tree_feed_error);
+    TEST_TREE_DESTROY_ERROR(&tree, mpack_error_bug);
+}
+
+// Feeds a stream of messages in chunks of the given size, checking that they
+// all parse.
+static bool test_node_feed_chunks(size_t step) {
+    static const char test[] =
+        "\x82\xa4""true\xc3\xa5""false\xc2"
+        "\x9a\x01\x02\x03\x04\x05\x06\x07\x08\x09\x0a"
+        "\xd9\x28""0123456789012345678901234567890123456789"
+        "\x93\xff\xfe\xfd";
+    size_t length = sizeof(test) - 1;
+
+    mpack_tree_t tree;
+    mpack_tree_init_feed(&tree, 1000, 1000);
+
+    size_t messages = 0;
+    for (size_t pos = 0; pos < length; pos += step) {
+        size_t count = (length - pos < step) ? length - pos : step;
+        mpack_tree_feed_status_t status = mpack_tree_feed(&tree, test + pos, count);
+        while (status == mpack_tree_feed_complete) {
+            mpack_node_t root = mpack_tree_root(&tree);
+            switch (messages++) {
+                case 0: TEST_TRUE(mpack_node_bool(mpack_node_map_cstr(root, "true")) == true); break;
+                case 1: TEST_TRUE(mpack_node_uint(mpack_node_array_at(root, 9)) == 10); break;
+                case 2: TEST_TRUE(mpack_node_strlen(root) == 40 &&
+                                memcmp(mpack_node_str(root), test + 27, 40) == 0); break;
+                default: TEST_TRUE(mpack_node_int(mpack_node_array_at(root, 2)) == -3); break;
+            }
+            status = mpack_tree_feed(&tree, NULL, 0);
+        }
+        if (status == mpack_tree_feed_error) {
+            TEST_TRUE(mpack_tree_error(&tree) == mpack_error_memory);
+            mpack_tree_destroy(&tree);
+            return false;
+        }
+    }
+
+    TEST_TRUE(messages == 4);
+    TEST_TREE_DESTROY_NOERROR(&tree);
+    return true;
+}
+
+static bool test_node_feed_chunks1(void) {return test_node_feed_chunks(1);}
+static bool test_node_feed_chunks5(void) {return test_node_feed_chunks(5);}
+static bool test_node_feed_chunks4096(void) {return test_node_feed_chunks(4096);}
+
+#if MPACK_STATS
+static void test_node_stats(void) {
+    static const char test[] = "\x92\x91\x91\xc0\x01\xc3";
+
+    test_node_stream_t stream_context;
+    stream_context.data = test;
+    stream_context.length = sizeof(test) - 1;
+    stream_context.pos = 0;
+    stream_context.step = 1;
+
+    mpack_tree_t tree;
+    mpack_tree_init_stream(&tree, &test_node_stream_read, &stream_context, 1000, 1000);
+    const mpack_stats_t* stats = mpack_tree_stats(&tree);
+    TEST_TRUE(stats->fills == 0 && stats->messages == 0);
+
+    mpack_tree_parse(&tree);
+    TEST_TRUE(mpack_tree_error(&tree) == mpack_ok);
+    TEST_TRUE(stats->fills == 5);
+    TEST_TRUE(stats->bytes == 5);
+    TEST_TRUE(stats->growths >= 1);
+    TEST_TRUE(stats->pages >= 1);
+    TEST_TRUE(stats->messages == 1);
+    TEST_TRUE(stats->nodes == 5);
+    TEST_TRUE(stats->max_depth == 3);
+
+    // counters accumulate over messages
+    mpack_tree_parse(&tree);
+    TEST_TRUE(mpack_tree_error(&tree) == mpack_ok);
+    TEST_TRUE(stats->fills == 6);
+    TEST_TRUE(stats->bytes == 6);
+    TEST_TRUE(stats->messages == 2);
+    TEST_TRUE(stats->nodes == 6);
+    TEST_TRUE(stats->max_depth == 3);
+    TEST_TRUE(stats->flushes == 0);
+
+    mpack_tree_reset_stats(&tree);
+    TEST_TRUE(stats->fills == 0 && stats->bytes == 0 && stats->messages == 0 &&
+            stats->nodes == 0 && stats->max_depth == 0 && stats->pages == 0);
+    TEST_TREE_DESTROY_NOERROR(&tree);
+}
+
+static void test_node_stats_pipelined(void) {
+    // a stream of many small messages, read in large chunks
+    char buf[300];
+    for (size_t i = 0; i < sizeof(buf); i += 5)
+        memcpy(buf + i, "\xce\x00\x01\x00\x00", 5);
+
+    test_node_stream_t stream_context;
+    stream_context.data = buf;
+    stream_context.length = sizeof(buf);
+    stream_context.pos = 0;
+    stream_context.step = 1000;
+
+    mpack_tree_t tree;
+    mpack_tree_init_stream(&tree, &test_node_stream_read, &stream_context, 1000, 1000);
+    for (size_t i = 0; i < sizeof(buf) / 5; ++i) {
+        mpack_tree_parse(&tree);
+        TEST_TRUE(mpack_node_u32(mpack_tree_root(&tree)) == 65536);
+    }
+
+    // the remaining data is not moved after each message. it is only moved
+    // when a message runs off the end of the buffer.
+    const mpack_stats_t* stats = mpack_tree_stats(&tree);
+    TEST_TRUE(stats->messages == sizeof(buf) / 5);
+    TEST_TRUE(stats->bytes_copied < sizeof(buf) / 5);
+    TEST_TREE_DESTROY_NOERROR(&tree);
+}
+#endif
+#endif
+
+static void test_node_message_size(void) {
+    static const struct {
+        const char* data;
+        size_t length;
+    } messages[] = {
+        {"\x00", 1},
+        {"\xe0", 1},
+        {"\xc3", 1},
+        {"\x92\x01\xa3""abc", 6},
+        {"\x81\xa1k\x93\x01\x02\x03", 7},
+        {"\xdc\x00\x02\xcb\x3f\xf0\x00\x00\x00\x00\x00\x00\xd3\x00\x00\x00\x00\x00\x00\x00\x00", 21},
+        {"\xde\x00\x01\xd0\xff\xca\x00\x00\x00\x00", 10},
+        {"\xdd\x00\x00\x00\x01\xc4\x02\x01\x02", 9},
+        {"\xdf\x00\x00\x00\x01\xda\x00\x01x\x90", 10},
+        {"\x91\xc7\x01\x05\x00", 5},
+        {"\x91\xd8\x01\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00", 19},
+        {"\x93\xc6\x00\x00\x00\x00\xc9\x00\x00\x00\x00\x01\xd4\x01\x00", 15},
+    };
+
+    for (size_t i = 0; i < sizeof(messages) / sizeof(*messages); ++i) {
+        size_t size = 0;
+
+        // trailing data is not part of the message
+        TEST_TRUE(mpack_message_size(messages[i].data, messages[i].length + 1, &size) == mpack_ok);
+        TEST_TRUE(size == messages[i].length, "message %i has size %i", (int)i, (int)size);
+
+        for (size_t length = 0; length < messages[i].length; ++length)
+            TEST_TRUE(mpack_message_size(messages[i].data, length, &size) == mpack_error_eof);
+    }
+
+    size_t size;
+    TEST_TRUE(mpack_message_size("\x92\x01\xc1", 3, &size) == mpack_error_invalid);
+    TEST_TRUE(mpack_message_size("\xdd\xff\xff\xff\xff\x00", 6, &size) == mpack_error_eof);
+    TEST_TRUE(mpack_message_size("\xdb\xff\xff\xff\xff\x00", 6, &size) == mpack_error_eof);
+}
+
+#if MPACK_NODE_COMPACT
+static void test_node_compact(void) {
+    TEST_TRUE(sizeof(mpack_node_data_t) == (MPACK_NODE_SPANS ? 12 : 8));
+
+    // numbers that don't fit in 32 bits are read from the data
+    static const char test[] =
+        "\x98"
+        "\xcf\xff\xff\xff\xff\xff\xff\xff\xff" // UINT64_MAX
+        "\xd3\x80\x00\x00\x00\x00\x00\x00\x00" // INT64_MIN
+        "\xce\xff\xff\xff\xff"                 // UINT32_MAX
+        "\xd2\x80\x00\x00\x00"                 // INT32_MIN
+        "\xcb\x3f\xf8\x00\x00\x00\x00\x00\x00" // 1.5
+        "\xcf\x00\x00\x00\x01\x00\x00\x00\x00" // 2^32
+        "\xcf\x00\x00\x00\x00\x00\x00\x00\x05" // 5
+        "\xd3\xff\xff\xff\xff\xff\xff\xff\xfe" // -2
+        ;
+    mpack_node_data_t pool[9];
+    mpack_tree_t tree;
+    mpack_tree_init_pool(&tree, test, sizeof(test) - 1, pool, sizeof(pool) / sizeof(*pool));
+    mpack_tree_parse(&tree);
+    mpack_node_t root = mpack_tree_root(&tree);
+    TEST_TRUE(mpack_node_u64(mpack_node_array_at(root, 0)) == UINT64_MAX);
+    TEST_TRUE(mpack_node_tag(mpack_node_array_at(root, 0)).v.u == UINT64_MAX);
+    TEST_TRUE(mpack_node_i64(mpack_node_array_at(root, 1)) == INT64_MIN);
+    TEST_TRUE(mpack_node_u32(mpack_node_array_at(root, 2)) == UINT32_MAX);
+    TEST_TRUE(mpack_node_i64(mpack_node_array_at(root, 2)) == UINT32_MAX);
+    TEST_TRUE(mpack_node_i32(mpack_node_array_at(root, 3)) == INT32_MIN);
+    TEST_TRUE(mpack_node_float(mpack_node_array_at(root, 4)) == 1.5f);
+    TEST_TRUE(mpack_node_u64(mpack_node_array_at(root, 5)) == UINT64_C(0x100000000));
+    TEST_TRUE(mpack_node_i64(mpack_node_array_at(root, 5)) == INT64_C(0x100000000));
+    TEST_TRUE(mpack_node_u8(mpack_node_array_at(root, 6)) == 5);
+    TEST_TRUE(mpack_node_int(mpack_node_array_at(root, 7)) == -2);
+    TEST_TREE_DESTROY_NOERROR(&tree);
+
+    #ifdef MPACK_MALLOC
+    // children larger than a page are indexed across several pages
+    char data[3 + 100 * 2];
+    data[0] = (char)0xdc;
+    data[1] = 0;
+    data[2] = 100;
+    for (int i = 0; i < 100; ++i) {
+        data[3 + i * 2] = (char)0x91;
+        data[4 + i * 2] = (char)i;
+    }
+    mpack_tree_init_data(&tree, data, sizeof(data));
+    mpack_tree_parse(&tree);
+    root = mpack_tree_root(&tree);
+    for (int i = 0; i < 100; ++i)
+        TEST_TRUE(mpack_node_int(mpack_node_array_at(mpack_node_array_at(root, (size_t)i), 0)) == i);
+    TEST_TREE_DESTROY_NOERROR(&tree);
+
+    // an empty container parsed when the preceding nodes exactly fill the
+    // last page of a full page table doesn't index past the table
+    #define TEST_PAGE MPACK_NODES_PER_PAGE
+    static const size_t lengths[] = {5 * TEST_PAGE + 1, TEST_PAGE - 6, TEST_PAGE / 2, TEST_PAGE - TEST_PAGE / 2};
+    char full[1 + 4 * 3 + 8 * TEST_PAGE + 1];
+    size_t pos = 0;
+    full[pos++] = (char)0x95;
+    for (size_t i = 0; i < sizeof(lengths) / sizeof(*lengths); ++i) {
+        full[pos++] = (char)0xdc;
+        full[pos++] = (char)(lengths[i] >> 8);
+        full[pos++] = (char)lengths[i];
+        memset(full + pos, 0xc0, lengths[i]);
+        pos += lengths[i];
+    }
+    full[pos++] = (char)0x90;
+    #undef TEST_PAGE
+    mpack_tree_init_data(&tree, full, pos);
+    mpack_tree_parse(&tree);
+    root = mpack_tree_root(&tree);
+    for (size_t i = 0; i < sizeof(lengths) / sizeof(*lengths); ++i)
+        TEST_TRUE(mpack_node_array_length(mpack_node_array_at(root, i)) == lengths[i]);
+    TEST_TRUE(mpack_node_array_length(mpack_node_array_at(root, 4)) == 0);
+    TEST_TRUE(mpack_node_data_children(&tree, mpack_node_array_at(root, 4).data) != NULL);
+    TEST_TREE_DESTROY_NOERROR(&tree);
+    #endif
+}
+#endif
+
+#if MPACK_NODE_LAZY
+// {"route": "a", "id": <id>, "body": {"x": [1, 2, [3, 4]], "y": "str"}, "list": [1, 2, 3]}
+#define TEST_NODE_LAZY_MESSAGE(id) \
+    "\x84\xa5route\xa1""a\xa2id" id "\xa4""body\x82\xa1x\x93\x01\x02\x92\x03\x04" \
+    "\xa1y\xa3str\xa4list\x93\x01\x02\x03"
+
+static void test_node_lazy_check(mpack_tree_t* tree, int id) {
+    mpack_node_t root = mpack_tree_root(tree);
+
+    // only the root has been parsed
+    TEST_TRUE(tree->node_count == 9);
+    TEST_TRUE(mpack_node_int(mpack_node_map_cstr(root, "id")) == id);
+    mpack_node_t body = mpack_node_map_cstr(root, "body");
+    TEST_TRUE(mpack_node_type(body) == mpack_type_map);
+    TEST_TRUE(mpack_node_map_count(body) == 2);
+    TEST_TRUE(mpack_node_array_length(mpack_node_map_cstr(root, "list")) == 3);
+    TEST_TRUE(tree->node_count == 9);
+
+    // descending expands only what is accessed
+    mpack_node_t x = mpack_node_map_cstr(body, "x");
+    TEST_TRUE(tree->node_count == 13);
+    TEST_TRUE(mpack_node_int(mpack_node_array_at(mpack_node_array_at(x, 2), 1)) == 4);
+    TEST_TRUE(tree->node_count == 18);
+    TEST_TRUE(mpack_node_int(mpack_node_array_at(x, 0)) == 1);
+    TEST_TRUE(mpack_node_strlen(mpack_node_map_cstr(body, "y")) == 3);
+    TEST_TRUE(tree->node_count == 18);
+    TEST_TRUE(mpack_tree_error(tree) == mpack_ok);
+}
+
+static void test_node_lazy(void) {
+    static const char test[] = TEST_NODE_LAZY_MESSAGE("\x05");
+    mpack_node_data_t pool[32];
+    mpack_tree_t tree;
+
+    mpack_tree_init_pool(&tree, test, sizeof(test) - 1, pool, sizeof(pool) / sizeof(*pool));
+    mpack_tree_set_lazy_depth(&tree, 1);
+    mpack_tree_parse(&tree);
+    test_node_lazy_check(&tree, 5);
+
+    // a bulk copy expands its array
+    int64_t values[3];
+    TEST_TRUE(mpack_node_array_copy_i64(mpack_node_map_cstr(mpack_tree_root(&tree), "list"), values, 3) == 3);
+    TEST_TRUE(values[0] == 1 && values[1] == 2 && values[2] == 3);
+    TEST_TREE_DESTROY_NOERROR(&tree);
+
+    // deeper lazy depths expand several levels at once
+    mpack_tree_init_pool(&tree, test, sizeof(test) - 1, pool, sizeof(pool) / sizeof(*pool));
+    mpack_tree_set_lazy_depth(&tree, 2);
+    mpack_tree_parse(&tree);
+    TEST_TRUE(tree.node_count == 16);
+    mpack_node_t x = mpack_node_map_cstr(mpack_node_map_cstr(mpack_tree_root(&tree), "body"), "x");
+    TEST_TRUE(mpack_node_int(mpack_node_array_at(mpack_node_array_at(x, 2), 0)) == 3);
+    TEST_TRUE(tree.node_count == 21);
+    TEST_TREE_DESTROY_NOERROR(&tree);
+
+    // expanding can run out of nodes
+    mpack_tree_init_pool(&tree, test, sizeof(test) - 1, pool, 12);
+    mpack_tree_set_lazy_depth(&tree, 1);
+    mpack_tree_parse(&tree);
+    TEST_TRUE(mpack_tree_error(&tree) == mpack_ok);
+    x = mpack_node_map_cstr(mpack_node_map_cstr(mpack_tree_root(&tree), "body"), "x");
+    TEST_TRUE(mpack_node_is_nil(x));
+    TEST_TREE_DESTROY_ERROR(&tree, mpack_error_too_big);
+
+    // lazy spans are still checked for truncation and invalid bytes
+    mpack_tree_init_pool(&tree, "\x81\xa1k\x92\x01", 5, pool, sizeof(pool) / sizeof(*pool));
+    mpack_tree_set_lazy_depth(&tree, 1);
+    mpack_tree_parse(&tree);
+    TEST_TREE_DESTROY_ERROR(&tree, mpack_error_invalid);
+    mpack_tree_init_pool(&tree, "\x81\xa1k\x92\x01\xc1", 6, pool, sizeof(pool) / sizeof(*pool));
+    mpack_tree_set_lazy_depth(&tree, 1);
+    mpack_tree_parse(&tree);
+    TEST_TREE_DESTROY_ERROR(&tree, mpack_error_invalid);
+
+    // empty compound types are never lazy
+    mpack_tree_init_pool(&tree, "\x92\x90\x80", 3, pool, sizeof(pool) / sizeof(*pool));
+    mpack_tree_set_lazy_depth(&tree, 1);
+    mpack_tree_parse(&tree);
+    TEST_TRUE(mpack_node_array_length(mpack_node_array_at(mpack_tree_root(&tree), 0)) == 0);
+    TEST_TRUE(mpack_node_map_count(mpack_node_array_at(mpack_tree_root(&tree), 1)) == 0);
+    TEST_TREE_DESTROY_NOERROR(&tree);
+}
+
+#ifdef MPACK_MALLOC
+static void test_node_lazy_stream(void) {
+    static const char test[] = TEST_NODE_LAZY_MESSAGE("\x05") TEST_NODE_LAZY_MESSAGE("\x06");
+
+    for (size_t step = 1; step < 12; ++step) {
+        test_node_stream_t stream_context;
+        stream_context.data = test;
+        stream_context.length = sizeof(test) - 1;
+        stream_context.pos = 0;
+        stream_context.step = step;
+
+        mpack_tree_t tree;
+        mpack_tree_init_stream(&tree, &test_node_stream_read, &stream_context, 1000, 1000);
+        mpack_tree_set_lazy_depth(&tree, 1);
+        mpack_tree_parse(&tree);
+        test_node_lazy_check(&tree, 5);
+        mpack_tree_parse(&tree);
+        test_node_lazy_check(&tree, 6);
+        TEST_TREE_DESTROY_NOERROR(&tree);
+    }
+
+    // a deeply nested message is expanded one level at a time
+    static const size_t depth = 1000;
+    char* data = (char*)MPACK_MALLOC(depth * 3 + 1);
+    TEST_TRUE(data != NULL);
+    if (data == NULL)
+        return;
+    char* p = data;
+    for (size_t i = 0; i < depth; ++i) {
+        *p++ = (char)0x81; // one pair map
+        *p++ = (char)0xa0; // empty key
+        *p++ = (char)0x91; // value one element array
+    }
+    *p++ = 0x07;
+
+    mpack_tree_t tree;
+    mpack_tree_init_data(&tree, data, (size_t)(p - data));
+    mpack_tree_set_lazy_depth(&tree, 1);
+    #if MPACK_NODE_MAP_INDEX
+    mpack_tree_set_eager_map_index(&tree, true);
+    #endif
+    mpack_tree_parse(&tree);
+    TEST_TRUE(tree.node_count == 3);
+    mpack_node_t node = mpack_tree_root(&tree);
+    for (size_t i = 0; i < depth; ++i)
+        node = mpack_node_array_at(mpack_node_map_str(node, "", 0), 0);
+    TEST_TRUE(mpack_node_uint(node) == 7);
+    TEST_TRUE(tree.node_count == depth * 3 + 1);
+    TEST_TREE_DESTROY_NOERROR(&tree);
+    MPACK_FREE(data);
+
+    // a large lazy map is indexed once expanded
+    static const char map[] = "\x91\x85\xa1""a\x01\xa1""b\x02\xa1""c\x03\xa1""d\x04\xa1""e\x05";
+    mpack_tree_init_data(&tree, map, sizeof(map) - 1);
+    mpack_tree_set_lazy_depth(&tree, 1);
+    mpack_tree_parse(&tree);
+    node = mpack_node_array_at(mpack_tree_root(&tree), 0);
+    TEST_TRUE(mpack_node_int(mpack_node_map_cstr(node, "d")) == 4);
+    TEST_TRUE(mpack_node_int(mpack_node_map_cstr(node, "a")) == 1);
+    TEST_TREE_DESTROY_NOERROR(&tree);
+}
+#endif
+#endif
+
+#ifdef MPACK_MALLOC
+typedef struct test_node_index_results_t {
+    int64_t values[150];
+    size_t calls;
+    size_t stop;
+} test_node_index_results_t;
+
+static void test_node_index_handle(mpack_tree_t* tree, size_t message, void* context) {
+    test_node_index_results_t* results = (test_node_index_results_t*)context;
+    ++results->calls;
+    if (message == results->stop) {
+        mpack_tree_flag_error(tree, mpack_error_data);
+        return;
+    }
+    mpack_node_t root = mpack_tree_root(tree);
+    results->values[message] = mpack_node_i64(mpack_node_array_at(root, 0));
+    TEST_TRUE(mpack_node_strlen(mpack_node_array_at(root, 1)) == message % 20);
+}
+
+static void test_node_message_index(void) {
+    static const size_t message_count = 150;
+
+    // messages of varying sizes
+    char data[150 * 22];
+    char* p = data;
+    for (size_t i = 0; i < message_count; ++i) {
+        *p++ = (char)0x92;
+        *p++ = (char)(0xe0 + i % 32);
+        *p++ = (char)(0xa0 + i % 20);
+        for (size_t j = 0; j < i % 20; ++j)
+            *p++ = 'x';
+    }
+    size_t length = (size_t)(p - data);
+
+    mpack_message_index_t index;
+    mpack_message_index_init(&index, data, length);
+    TEST_TRUE(mpack_message_index_error(&index) == mpack_ok);
+    TEST_TRUE(mpack_message_index_count(&index) == message_count);
+    for (size_t i = 0; i < message_count; ++i) {
+        size_t size;
+        const char* message = mpack_message_index_message(&index, i, &size);
+        TEST_TRUE(size == 3 + i % 20);
+        TEST_TRUE((uint8_t)message[1] == 0xe0 + i % 32);
+    }
+
+    // parts cover every message in order, and results land in order
+    size_t part_counts[] = {1, 2, 3, 7, 200};
+    for (size_t k = 0; k < sizeof(part_counts) / sizeof(*part_counts); ++k) {
+        size_t parts = part_counts[k];
+        test_node_index_results_t results;
+        mpack_memset(&results, 0, sizeof(results));
+        results.stop = SIZE_MAX;
+
+        size_t next = 0;
+        for (size_t part = 0; part < parts; ++part) {
+            size_t first, count;
+            mpack_message_index_partition(&index, part, parts, &first, &count);
+            TEST_TRUE(first == next);
+            next += count;
+            TEST_TRUE(mpack_message_index_parse(&index, first, count,
+                        &test_node_index_handle, &results) == mpack_ok);
+        }
+        TEST_TRUE(next == message_count);
+        TEST_TRUE(results.calls == message_count);
+        for (size_t i = 0; i < message_count; ++i)
+            TEST_TRUE(results.values[i] == (int64_t)(i % 32) - 32);
+    }
+
+    // flagging an error stops parsing the range
+    test_node_index_results_t results;
+    mpack_memset(&results, 0, sizeof(results));
+    results.stop = 5;
+    TEST_TRUE(mpack_message_index_parse(&index, 0, message_count,
+                &test_node_index_handle, &results) == mpack_error_data);
+    TEST_TRUE(results.calls == 6);
+    TEST_TRUE(mpack_message_index_destroy(&index) == mpack_ok);
+
+    // an index with an allocator builds and parses without MPACK_MALLOC
+    static char arena_data[65536];
+    test_arena_t arena;
+    mpack_allocator_t allocator = test_arena_init(&arena, arena_data, sizeof(arena_data), true);
+    size_t mallocs = test_malloc_total_count();
+    mpack_message_index_init_allocator(&index, data, length, &allocator);
+    TEST_TRUE(mpack_message_index_count(&index) == message_count);
+    TEST_TRUE(test_arena_contains(&arena, index.offsets));
+    mpack_memset(&results, 0, sizeof(results));
+    results.stop = SIZE_MAX;
+    TEST_TRUE(mpack_message_index_parse(&index, 0, message_count,
+                &test_node_index_handle, &results) == mpack_ok);
+    TEST_TRUE(results.calls == message_count);
+    TEST_TRUE(mpack_message_index_destroy(&index) == mpack_ok);
+    TEST_TRUE(test_malloc_total_count() == mallocs);
+    TEST_TRUE(arena.allocs > 1);
+    TEST_TRUE(arena.frees == arena.allocs);
+
+    // a truncated or invalid message leaves the previous messages indexed
+    mpack_message_index_init(&index, data, length - 1);
+    TEST_TRUE(mpack_message_index_count(&index) == message_count - 1);
+    TEST_TRUE(mpack_message_index_destroy(&index) == mpack_error_eof);
+    data[3] = (char)0xc1;
+    mpack_message_index_init(&index, data, length);
+    TEST_TRUE(mpack_message_index_count(&index) == 1);
+    TEST_TRUE(mpack_message_index_destroy(&index) == mpack_error_invalid);
+
+    mpack_message_index_init(&index, data, 0);
+    size_t first, count;
+    mpack_message_index_partition(&index, 1, 4, &first, &count);
+    TEST_TRUE(count == 0);
+    TEST_TRUE(mpack_message_index_parse(&index, first, count,
+                &test_node_index_handle, &results) == mpack_ok);
+    TEST_TRUE(mpack_message_index_destroy(&index) == mpack_ok);
+}
+#endif
+
+#if MPACK_NODE_SPANS
+// checks that each child of the given array spans the next message in the data
+static void test_node_spans_check(mpack_node_t array, const char* data, size_t length) {
+    size_t pos = 1;
+    for (size_t i = 0; i < mpack_node_array_length(array); ++i) {
+        size_t size = 0;
+        TEST_TRUE(mpack_message_size(data + pos, length - pos, &size) == mpack_ok);
+        const char* bytes;
+        size_t count;
+        TEST_TRUE(mpack_node_bytes(mpack_node_array_at(array, i), &bytes, &count));
+        TEST_TRUE(bytes == data + pos && count == size, "element %i", (int)i);
+        pos += size;
+    }
+    TEST_TRUE(pos == length);
+}
+
+static void test_node_spans(void) {
+    // [5, 256, INT64_MIN, 1.5, 1.5f, "abc", <bin>, [], {}, {"a": [nil], "b": [true, [""]]}, false, nil]
+    static const char test[] =
+        "\x9c\x05\xcd\x01\x00\xd3\x80\x00\x00\x00\x00\x00\x00\x00"
+        "\xcb\x3f\xf8\x00\x00\x00\x00\x00\x00\xca\x3f\xc0\x00\x00"
+        "\xd9\x03""abc\xc4\x02\x01\x02\x90\xde\x00\x00"
+        "\x82\xa1""a\x91\xc0\xa1""b\x92\xc3\xdc\x00\x01\xa0\xc2\xc0";
+    const size_t length = sizeof(test) - 1;
+    mpack_node_data_t pool[32];
+    mpack_tree_t tree;
+
+    mpack_tree_init_pool(&tree, test, length, pool, sizeof(pool) / sizeof(*pool));
+    mpack_tree_parse(&tree);
+    mpack_node_t root = mpack_tree_root(&tree);
+    const char* bytes;
+    size_t count;
+    TEST_TRUE(mpack_node_bytes(root, &bytes, &count));
+    TEST_TRUE(bytes == test && count == length);
+    test_node_spans_check(root, test, length);
+
+    // nested nodes end where their last leaf ends
+    mpack_node_t map = mpack_node_array_at(root, 9);
+    TEST_TRUE(mpack_node_bytes(mpack_node_map_cstr(map, "b"), &bytes, &count));
+    TEST_TRUE(count == 6 && memcmp(bytes, "\x92\xc3\xdc\x00\x01\xa0", count) == 0);
+
+    // subtrees are forwarded verbatim
+    char buffer[64];
+    mpack_writer_t forward;
+    mpack_writer_init(&forward, buffer, sizeof(buffer));
+    mpack_start_array(&forward, 2);
+    mpack_write_node(&forward, map);
+    mpack_write_node(&forward, mpack_node_array_at(root, 1));
+    mpack_finish_array(&forward);
+    size_t used = mpack_writer_buffer_used(&forward);
+    TEST_TRUE(mpack_writer_destroy(&forward) == mpack_ok);
+    TEST_TRUE(used == 17);
+    TEST_TRUE(memcmp(buffer, "\x92\x82\xa1""a\x91\xc0\xa1""b\x92\xc3\xdc\x00\x01\xa0\xcd\x01\x00", used) == 0);
+
+    // a missing optional key has no bytes
+    TEST_TRUE(!mpack_node_bytes(mpack_node_map_cstr_optional(map, "c"), &bytes, &count));
+    TEST_TRUE(bytes == NULL && count == 0);
+    TEST_TREE_DESTROY_ERROR(&tree, mpack_error_type);
+
+    // nothing can be forwarded from a tree in an error state
+    mpack_tree_init_pool(&tree, test, length, pool, sizeof(pool) / sizeof(*pool));
+    mpack_tree_parse(&tree);
+    mpack_tree_flag_error(&tree, mpack_error_invalid);
+    mpack_writer_init(&forward, buffer, sizeof(buffer));
+    mpack_write_node(&forward, mpack_tree_root(&tree));
+    TEST_TRUE(mpack_writer_destroy(&forward) == mpack_error_data);
+    TEST_TREE_DESTROY_ERROR(&tree, mpack_error_invalid);
+
+    #if MPACK_NODE_LAZY
+    // lazy nodes have spans before and after they are expanded
+    mpack_tree_init_pool(&tree, test, length, pool, sizeof(pool) / sizeof(*pool));
+    mpack_tree_set_lazy_depth(&tree, 1);
+    mpack_tree_parse(&tree);
+    map = mpack_node_array_at(mpack_tree_root(&tree), 9);
+    TEST_TRUE(mpack_node_bytes(map, &bytes, &count));
+    TEST_TRUE(bytes == test + 41 && count == 13);
+    TEST_TRUE(mpack_node_bytes(mpack_node_map_cstr(map, "b"), &bytes, &count));
+    TEST_TRUE(bytes == test + 48 && count == 6);
+    TEST_TRUE(mpack_node_bytes(map, &bytes, &count));
+    TEST_TRUE(bytes == test + 41 && count == 13);
+    test_node_spans_check(mpack_tree_root(&tree), test, length);
+    TEST_TREE_DESTROY_NOERROR(&tree);
+    #endif
+
+    #if MPACK_EXTENSIONS
+    static const char ext[] = "\x93\xd4\x01\x02\xc7\x02\x05\xaa\xbb\xc7\x00\x05";
+    mpack_tree_init_pool(&tree, ext, sizeof(ext) - 1, pool, sizeof(pool) / sizeof(*pool));
+    mpack_tree_parse(&tree);
+    test_node_spans_check(mpack_tree_root(&tree), ext, sizeof(ext) - 1);
+    TEST_TREE_DESTROY_NOERROR(&tree);
+    #endif
+}
+#endif
+
+#if defined(MPACK_MALLOC) && MPACK_NODE_INTERN
+static bool test_node_intern_table(void) {
+    mpack_intern_t intern;
+    mpack_intern_init(&intern);
+
+    // enough keys to grow the table several times
+    char key[3] = {'k', 0, 0};
+    for (uint32_t i = 0; i < 100; ++i) {
+        key[1] = (char)('0' + i / 10);
+        key[2] = (char)('0' + i % 10);
+        uint32_t id = mpack_intern(&intern, key, sizeof(key));
+        if (id == 0) {
+            TEST_TRUE(mpack_intern_destroy(&intern) == mpack_error_memory);
+            return false;
+        }
+        TEST_TRUE(id == i + 1);
+    }
+    uint32_t empty = mpack_intern(&intern, "", 0);
+    if (empty == 0) {
+        TEST_TRUE(mpack_intern_destroy(&intern) == mpack_error_memory);
+        return false;
+    }
+    TEST_TRUE(empty == 101);
+    TEST_TRUE(mpack_intern_count(&intern) == 101);
+
+    // interning again finds the existing IDs
+    for (uint32_t i = 0; i < 100; ++i) {
+        key[1] = (char)('0' + i / 10);
+        key[2] = (char)('0' + i % 10);
+        TEST_TRUE(mpack_intern_find(&intern, key, sizeof(key)) == i + 1);
+        TEST_TRUE(mpack_intern(&intern, key, sizeof(key)) == i + 1);
+        size_t length;
+        const char* bytes = mpack_intern_key(&intern, i + 1, &length);
+        TEST_TRUE(length == sizeof(key) && memcmp(bytes, key, length) == 0);
+    }
+    TEST_TRUE(mpack_intern_find(&intern, "", 0) == empty);
+    TEST_TRUE(mpack_intern_find(&intern, "k1", 2) == 0);
+    TEST_TRUE(mpack_intern_count(&intern) == 101);
+
+    // a full table gives new keys no ID
+    mpack_intern_set_limit(&intern, 101);
+    TEST_TRUE(mpack_intern_cstr(&intern, "new") == 0);
+    TEST_TRUE(mpack_intern_cstr(&intern, "k42") == 43);
+    TEST_TRUE(mpack_intern_count(&intern) == 101);
+
+    TEST_TRUE(mpack_intern_destroy(&intern) == mpack_ok);
+    return true;
+}
+
+static void test_node_intern_allocator(void) {
+    static char arena_data[8192];
+    test_arena_t arena;
+    mpack_allocator_t allocator = test_arena_init(&arena, arena_data, sizeof(arena_data), true);
+    size_t mallocs = test_malloc_total_count();
+
+    mpack_intern_t intern;
+    mpack_intern_init(&intern);
+    mpack_intern_set_allocator(&intern, &allocator);
+    char key[3] = {'k', 0, 0};
+    for (uint32_t i = 0; i < 100; ++i) {
+        key[1] = (char)('0' + i / 10);
+        key[2] = (char)('0' + i % 10);
+        TEST_TRUE(mpack_intern(&intern, key, sizeof(key)) == i + 1);
+    }
+    size_t length;
+    TEST_TRUE(test_arena_contains(&arena, mpack_intern_key(&intern, 1, &length)));
+    TEST_TRUE(mpack_intern_destroy(&intern) == mpack_ok);
+    TEST_TRUE(test_malloc_total_count() == mallocs);
+    TEST_TRUE(arena.allocs > 3);
+    TEST_TRUE(arena.frees == arena.allocs);
+
+    // the allocator cannot be changed once keys are interned
+    mpack_intern_init(&intern);
+    TEST_TRUE(mpack_intern_cstr(&intern, "id") == 1);
+    TEST_BREAK((mpack_intern_set_allocator(&intern, &allocator), true));
+    TEST_TRUE(mpack_intern_destroy(&intern) == mpack_error_bug);
+}
+
+// {"id": 1, "name": "a", "tags": {"x": true, "y": false}}
+#define TEST_NODE_INTERN_FIRST "\x83\xa2id\x01\xa4name\xa1""a\xa4tags\x82\xa1x\xc3\xa1y\xc2"
+// {"tags": {"y": true}, "id": 2, "extra": [{"id": 3}]}
+#define TEST_NODE_INTERN_SECOND "\x83\xa4tags\x81\xa1y\xc3\xa2id\x02\xa5""extra\x91\x81\xa2id\x03"
+
+static bool test_node_intern_fail(mpack_tree_t* tree, mpack_intern_t* intern) {
+    if (mpack_tree_error(tree) != mpack_error_memory)
+        return false;
+    mpack_tree_destroy(tree);
+    mpack_intern_destroy(intern);
+    return true;
+}
+
+static bool test_node_intern_parse(void) {
+    static const char test[] = TEST_NODE_INTERN_FIRST TEST_NODE_INTERN_SECOND;
+    mpack_intern_t intern;
+    mpack_intern_init(&intern);
+    uint32_t id = mpack_intern_cstr(&intern, "id");
+    uint32_t name = mpack_intern_cstr(&intern, "name");
+    uint32_t tags = mpack_intern_cstr(&intern, "tags");
+    uint32_t x = mpack_intern_cstr(&intern, "x");
+    uint32_t y = mpack_intern_cstr(&intern, "y");
+    if (mpack_intern_error(&intern) != mpack_ok) {
+        TEST_TRUE(mpack_intern_destroy(&intern) == mpack_error_memory);
+        return false;
+    }
+
+    // keys are matched by ID across successive messages
+    mpack_tree_t tree;
+    mpack_tree_init_data(&tree, test, sizeof(test) - 1);
+    mpack_tree_set_intern(&tree, &intern);
+    mpack_tree_parse(&tree);
+    if (test_node_intern_fail(&tree, &intern))
+        return false;
+    mpack_node_t root = mpack_tree_root(&tree);
+    TEST_TRUE(mpack_node_int(mpack_node_map_key_id(root, id)) == 1);
+    TEST_TRUE(mpack_node_map_key_id_at(root, 1) == name);
+    mpack_node_t map = mpack_node_map_key_id(root, tags);
+    TEST_TRUE(mpack_node_bool(mpack_node_map_key_id(map, x)) == true);
+    TEST_TRUE(mpack_node_bool(mpack_node_map_key_id(map, y)) == false);
+    TEST_TRUE(mpack_intern_count(&intern) == 5);
+
+    mpack_tree_parse(&tree);
+    if (test_node_intern_fail(&tree, &intern))
+        return false;
+    root = mpack_tree_root(&tree);
+    TEST_TRUE(mpack_node_int(mpack_node_map_key_id(root, id)) == 2);
+    TEST_TRUE(mpack_node_bool(mpack_node_map_key_id(mpack_node_map_key_id(root, tags), y)) == true);
+    TEST_TRUE(mpack_intern_count(&intern) == 6);
+    uint32_t extra = mpack_node_map_key_id_at(root, 2);
+    TEST_TRUE(extra == 6 && extra == mpack_intern_find(&intern, "extra", 5));
+    mpack_node_t nested = mpack_node_array_at(mpack_node_map_key_id(root, extra), 0);
+    TEST_TRUE(mpack_node_int(mpack_node_map_key_id(nested, id)) == 3);
+    TEST_TRUE(mpack_node_is_missing(mpack_node_map_key_id_optional(root, name)));
+    TEST_TRUE(mpack_node_is_missing(mpack_node_map_key_id_optional(root, 0)));
+    TEST_TRUE(mpack_tree_error(&tree) == mpack_ok);
+    TEST_TRUE(mpack_node_is_nil(mpack_node_map_key_id(root, name)));
+    TEST_TREE_DESTROY_ERROR(&tree, mpack_error_data);
+
+    // large indexed maps, non-str keys and duplicate keys
+    static const char large[] = "\x86\xa1""a\x01\xa1""b\x02\xa1x\x03\xa1y\x04\x05\x05\xa1""a\x06";
+    mpack_tree_init_data(&tree, large, sizeof(large) - 1);
+    mpack_tree_set_intern(&tree, &intern);
+    mpack_tree_parse(&tree);
+    if (test_node_intern_fail(&tree, &intern))
+        return false;
+    root = mpack_tree_root(&tree);
+    TEST_TRUE(mpack_node_int(mpack_node_map_key_id(root, y)) == 4);
+    TEST_TRUE(mpack_node_int(mpack_node_map_cstr(root, "x")) == 3);
+    TEST_TRUE(mpack_node_int(mpack_node_map_key_id(root, x)) == 3);
+    TEST_TRUE(mpack_node_map_key_id_at(root, 4) == 0);
+    TEST_TRUE(mpack_node_map_key_id_at(root, 5) == mpack_node_map_key_id_at(root, 0));
+    TEST_TRUE(mpack_node_map_key_id_at(root, 6) == 0);
+    TEST_TREE_DESTROY_ERROR(&tree, mpack_error_data);
+    mpack_tree_init_data(&tree, large, sizeof(large) - 1);
+    mpack_tree_set_intern(&tree, &intern);
+    mpack_tree_parse(&tree);
+    if (test_node_intern_fail(&tree, &intern))
+        return false;
+    TEST_TRUE(mpack_node_is_nil(mpack_node_map_key_id(mpack_tree_root(&tree), mpack_intern_find(&intern, "a", 1))));
+    TEST_TREE_DESTROY_ERROR(&tree, mpack_error_data);
+
+    #if MPACK_NODE_LAZY
+    // lazy maps are interned when they are expanded
+    mpack_tree_init_data(&tree, test, sizeof(test) - 1);
+    mpack_tree_set_intern(&tree, &intern);
+    mpack_tree_set_lazy_depth(&tree, 1);
+    mpack_tree_parse(&tree);
+    if (test_node_intern_fail(&tree, &intern))
+        return false;
+    map = mpack_node_map_key_id(mpack_tree_root(&tree), tags);
+    uint32_t second = mpack_node_map_key_id_at(map, 1);
+    if (test_node_intern_fail(&tree, &intern))
+        return false;
+    TEST_TRUE(second == y);
+    TEST_TRUE(mpack_node_bool(mpack_node_map_key_id(map, x)) == true);
+    TEST_TREE_DESTROY_NOERROR(&tree);
+    #endif
+
+    // interned trees can use a pool
+    mpack_node_data_t pool[16];
+    mpack_tree_init_pool(&tree, test, sizeof(TEST_NODE_INTERN_FIRST) - 1, pool, sizeof(pool) / sizeof(*pool));
+    mpack_tree_set_intern(&tree, &intern);
+    mpack_tree_parse(&tree);
+    if (test_node_intern_fail(&tree, &intern))
+        return false;
+    map = mpack_node_map_key_id(mpack_tree_root(&tree), tags);
+    TEST_TRUE(mpack_node_bool(mpack_node_map_key_id(map, y)) == false);
+    TEST_TREE_DESTROY_NOERROR(&tree);
+
+    // lookups by ID need an intern table
+    mpack_tree_init_pool(&tree, test, sizeof(TEST_NODE_INTERN_FIRST) - 1, pool, sizeof(pool) / sizeof(*pool));
+    mpack_tree_parse(&tree);
+    TEST_BREAK((mpack_node_map_key_id(mpack_tree_root(&tree), id), true));
+    TEST_TREE_DESTROY_ERROR(&tree, mpack_error_bug);
+
+    TEST_TRUE(mpack_intern_destroy(&intern) == mpack_ok);
+    return true;
+}
 #endif
 
 #if MPACK_DEBUG && MPACK_STDIO
@@ -1266,6 +2496,101 @@ static void test_node_print_buffer_bounds() {
 }
 #endif
 
+// {"route": "a", "id": 5, "body": {"x": [1, 2, [3, 4]], "y": "str"}, "list": [1, 2, 3], "z": nil}
+#define TEST_NODE_VIEWS_MESSAGE \
+    "\x85\xa5route\xa1""a\xa2id\x05\xa4""body\x82\xa1x\x93\x01\x02\x92\x03\x04" \
+    "\xa1y\xa3str\xa4list\x93\x01\x02\x03\xa1z\xc0"
+
+static void test_node_views_error(mpack_tree_t* tree, mpack_error_t error) {
+    *(mpack_error_t*)mpack_tree_context(tree) = error;
+}
+
+// Parses and freezes the tree and reads it through views. Returns false if
+// the tree ran out of memory.
+static bool test_node_views_check(mpack_tree_t* tree) {
+    #if MPACK_NODE_LAZY
+    mpack_tree_set_lazy_depth(tree, 1);
+    #endif
+    mpack_tree_parse(tree);
+    if (mpack_tree_freeze(tree) == mpack_error_memory) {
+        mpack_tree_destroy(tree);
+        return false;
+    }
+
+    // freezing expands all lazy nodes and builds all map indices
+    TEST_TRUE(tree->node_count == 23);
+    #if defined(MPACK_MALLOC) && MPACK_NODE_MAP_INDEX
+    if (tree->pool == NULL)
+        TEST_TRUE((tree->root->value.children - 1)->type != mpack_type_nil);
+    #endif
+    TEST_TRUE(mpack_tree_freeze(tree) == mpack_ok);
+
+    mpack_tree_view_t first;
+    mpack_tree_view_t second;
+    mpack_tree_view_init(&first, tree);
+    mpack_tree_view_init(&second, tree);
+
+    // errors are flagged only on the view whose nodes flagged them
+    mpack_error_t flagged = mpack_ok;
+    mpack_tree_view_set_context(&first, &flagged);
+    mpack_tree_view_set_error_handler(&first, &test_node_views_error);
+    mpack_node_t root = mpack_tree_view_root(&first);
+    TEST_TRUE(mpack_node_is_nil(mpack_node_map_cstr(root, "missing")));
+    TEST_TRUE(mpack_tree_view_error(&first) == mpack_error_data);
+    TEST_TRUE(flagged == mpack_error_data);
+    TEST_TRUE(mpack_node_is_nil(mpack_node_map_cstr(root, "id")));
+
+    root = mpack_tree_view_root(&second);
+    TEST_TRUE(mpack_node_int(mpack_node_map_cstr(root, "id")) == 5);
+    mpack_node_t x = mpack_node_map_cstr(mpack_node_map_cstr(root, "body"), "x");
+    TEST_TRUE(mpack_node_int(mpack_node_array_at(mpack_node_array_at(x, 2), 1)) == 4);
+    TEST_TRUE(mpack_node_is_nil(mpack_node_map_cstr(root, "z")));
+    TEST_TRUE(mpack_tree_view_destroy(&second) == mpack_ok);
+    TEST_TRUE(mpack_tree_error(tree) == mpack_ok);
+    TEST_TRUE(tree->node_count == 23);
+
+    // a view is reinitialized to clear its error
+    TEST_TRUE(mpack_tree_view_destroy(&first) == mpack_error_data);
+    mpack_tree_view_init(&first, tree);
+    TEST_TRUE(mpack_node_strlen(mpack_node_map_cstr(mpack_tree_view_root(&first), "route")) == 1);
+    TEST_TRUE(mpack_tree_view_destroy(&first) == mpack_ok);
+
+    TEST_TREE_DESTROY_NOERROR(tree);
+    return true;
+}
+
+static void test_node_views_pool(void) {
+    static const char test[] = TEST_NODE_VIEWS_MESSAGE;
+    mpack_node_data_t pool[32];
+    mpack_tree_t tree;
+    mpack_tree_init_pool(&tree, test, sizeof(test) - 1, pool, sizeof(pool) / sizeof(*pool));
+    TEST_TRUE(test_node_views_check(&tree));
+
+    // a tree must be parsed before it is frozen
+    mpack_tree_init_pool(&tree, test, sizeof(test) - 1, pool, sizeof(pool) / sizeof(*pool));
+    TEST_BREAK(mpack_tree_freeze(&tree) == mpack_error_bug);
+    TEST_TREE_DESTROY_ERROR(&tree, mpack_error_bug);
+
+    #if MPACK_NODE_LAZY
+    // freezing can run out of nodes while expanding
+    mpack_tree_init_pool(&tree, test, sizeof(test) - 1, pool, 14);
+    mpack_tree_set_lazy_depth(&tree, 1);
+    mpack_tree_parse(&tree);
+    TEST_TRUE(mpack_tree_error(&tree) == mpack_ok);
+    TEST_TRUE(mpack_tree_freeze(&tree) == mpack_error_too_big);
+    TEST_TREE_DESTROY_ERROR(&tree, mpack_error_too_big);
+    #endif
+}
+
+#ifdef MPACK_MALLOC
+static bool test_node_views_malloc(void) {
+    static const char test[] = TEST_NODE_VIEWS_MESSAGE;
+    mpack_tree_t tree;
+    mpack_tree_init_data(&tree, test, sizeof(test) - 1);
+    return test_node_views_check(&tree);
+}
+#endif
+
 void test_node(void) {
     #if MPACK_DEBUG && MPACK_STDIO
     test_node_print_buffer();
@@ -1300,8 +2625,15 @@ void test_node(void) {
     test_node_read_array();
     test_node_read_map();
     test_node_read_map_search();
+    #if MPACK_NODE_MAP_INDEX && defined(MPACK_MALLOC)
+    test_system_fail_until_ok(&test_node_read_map_index_lazy);
+    test_system_fail_until_ok(&test_node_read_map_index_parse);
+    test_node_read_map_index_nested();
+    #endif
     test_node_read_compound_errors();
     test_node_read_data();
+    test_node_read_array_copy();
+    test_node_read_array_columns();
     test_node_read_deep_stack();
 
     // message streams
@@ -1312,6 +2644,52 @@ void test_node(void) {
     test_system_fail_until_ok(&test_node_multiple_allocs_stream2);
     test_system_fail_until_ok(&test_node_multiple_allocs_stream3);
     test_system_fail_until_ok(&test_node_multiple_allocs_stream4096);
+    test_node_allocator();
+    test_node_page_size();
+    test_node_page_cache();
+    test_node_feed();
+    test_system_fail_until_ok(&test_node_feed_chunks1);
+    test_system_fail_until_ok(&test_node_feed_chunks5);
+    test_system_fail_until_ok(&test_node_feed_chunks4096);
+    #if MPACK_STATS
+    test_node_stats();
+    test_node_stats_pipelined();
+    #endif
+    #endif
+
+    #if MPACK_NODE_COMPACT
+    test_node_compact();
+    #endif
+
+    // lazy parsing
+    #if MPACK_NODE_LAZY
+    test_node_lazy();
+    #ifdef MPACK_MALLOC
+    test_node_lazy_stream();
+    #endif
+    #endif
+
+    // message index
+    test_node_message_size();
+    #ifdef MPACK_MALLOC
+    test_node_message_index();
+    #endif
+
+    #if MPACK_NODE_SPANS
+    test_node_spans();
+    #endif
+
+    // tree views
+    test_node_views_pool();
+    #ifdef MPACK_MALLOC
+    test_system_fail_until_ok(&test_node_views_malloc);
+    #endif
+
+    // key interning
+    #if defined(MPACK_MALLOC) && MPACK_NODE_INTERN
+    test_system_fail_until_ok(&test_node_intern_table);
+    test_node_intern_allocator();
+    test_system_fail_until_ok(&test_node_intern_parse);
     #endif
 }
 
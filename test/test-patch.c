@@ -0,0 +1,245 @@
+/*
+ * Copyright (c) 2015-2018 Nicholas Fraser
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "test-patch.h"
+#include "test-write.h"
+#include "test-node.h"
+
+// Patches splice node spans, so these tests only run in the node-spans
+// builds of tools/unittest.lua.
+#if MPACK_PATCH && MPACK_NODE && MPACK_NODE_SPANS && MPACK_WRITER && defined(MPACK_MALLOC)
+
+// {"id": 7, "status": "new", "tags": ["a", "b"], "meta": {"x": 1, "deep": {"k": [1, 2, 3]}}}
+static const char test_patch_message[] =
+    "\x84\xa2""id\x07\xa6""status\xa3""new\xa4""tags\x92\xa1""a\xa1""b"
+    "\xa4""meta\x82\xa1""x\x01\xa4""deep\x81\xa1""k\x93\x01\x02\x03";
+
+// writes the patch and checks that it produces the expected bytes
+static void test_patch_check(mpack_patch_t* patch, const char* expect, size_t length) {
+    char buffer[1024];
+    mpack_writer_t out;
+    mpack_writer_init(&out, buffer, sizeof(buffer));
+    mpack_patch_write(patch, &out);
+    size_t used = mpack_writer_buffer_used(&out);
+    TEST_WRITER_DESTROY_NOERROR(&out);
+    TEST_TRUE(used == length, "wrote %i bytes instead of %i", (int)used, (int)length);
+    TEST_TRUE(used == length && memcmp(buffer, expect, length) == 0);
+}
+
+static void test_patch_edits(void) {
+    mpack_node_data_t pool[32];
+    mpack_tree_t tree;
+    mpack_tree_init_pool(&tree, test_patch_message, sizeof(test_patch_message) - 1,
+            pool, sizeof(pool) / sizeof(*pool));
+    mpack_tree_parse(&tree);
+    mpack_node_t root = mpack_tree_root(&tree);
+
+    // an empty patch writes the original message
+    mpack_patch_t patch;
+    mpack_patch_init(&patch, &tree);
+    test_patch_check(&patch, test_patch_message, sizeof(test_patch_message) - 1);
+
+    mpack_node_t tags = mpack_node_map_cstr(root, "tags");
+    mpack_patch_map_set_cstr(&patch, root, "status", "\xa4""done", 5);
+    mpack_patch_map_remove_cstr(&patch, root, "id");
+    mpack_patch_array_insert(&patch, tags, 0, "\x07", 1);
+    mpack_patch_array_remove(&patch, tags, 1);
+    mpack_patch_array_remove(&patch, tags, 1);
+    mpack_patch_array_insert(&patch, tags, 2, "\xc3", 1);
+    mpack_patch_map_set_cstr(&patch, root, "new", "\xc0", 1);
+    mpack_node_t k = mpack_node_map_cstr(mpack_node_map_cstr(mpack_node_map_cstr(root, "meta"), "deep"), "k");
+    mpack_patch_set(&patch, mpack_node_array_at(k, 1), "\xcc\xfe", 2);
+    mpack_patch_set(&patch, mpack_node_array_at(k, 1), "\xcc\xff", 2);
+    TEST_TRUE(mpack_patch_count(&patch) == 7);
+
+    static const char edited[] =
+        "\x84\xa6""status\xa4""done\xa4""tags\x93\x07\xa1""a\xc3"
+        "\xa4""meta\x82\xa1""x\x01\xa4""deep\x81\xa1""k\x93\x01\xcc\xff\x03"
+        "\xa3""new\xc0";
+    test_patch_check(&patch, edited, sizeof(edited) - 1);
+
+    // restoring a removed key and removing an added key undo those edits
+    mpack_patch_map_set_cstr(&patch, root, "id", "\x08", 1);
+    mpack_patch_map_remove_cstr(&patch, root, "new");
+    mpack_patch_map_remove_cstr(&patch, root, "missing");
+    static const char restored[] =
+        "\x84\xa2""id\x08\xa6""status\xa4""done\xa4""tags\x93\x07\xa1""a\xc3"
+        "\xa4""meta\x82\xa1""x\x01\xa4""deep\x81\xa1""k\x93\x01\xcc\xff\x03";
+    test_patch_check(&patch, restored, sizeof(restored) - 1);
+
+    // replacing a container discards the edits inside it
+    mpack_patch_set(&patch, tags, "\x90", 1);
+    mpack_patch_set(&patch, mpack_node_map_key_at(root, 0), "\xa3""num", 4);
+    static const char replaced[] =
+        "\x84\xa3""num\x08\xa6""status\xa4""done\xa4""tags\x90"
+        "\xa4""meta\x82\xa1""x\x01\xa4""deep\x81\xa1""k\x93\x01\xcc\xff\x03";
+    test_patch_check(&patch, replaced, sizeof(replaced) - 1);
+
+    mpack_patch_set(&patch, root, "\x91\xc2", 2);
+    test_patch_check(&patch, "\x91\xc2", 2);
+
+    TEST_TRUE(mpack_patch_destroy(&patch) == mpack_ok);
+    TEST_TREE_DESTROY_NOERROR(&tree);
+}
+
+static void test_patch_errors(void) {
+    mpack_node_data_t pool[32];
+    mpack_tree_t tree;
+    mpack_tree_init_pool(&tree, test_patch_message, sizeof(test_patch_message) - 1,
+            pool, sizeof(pool) / sizeof(*pool));
+    mpack_tree_parse(&tree);
+    mpack_node_t root = mpack_tree_root(&tree);
+    char buffer[128];
+    mpack_writer_t out;
+
+    // values must be exactly one complete element
+    mpack_patch_t patch;
+    mpack_patch_init(&patch, &tree);
+    mpack_patch_map_set_cstr(&patch, root, "status", "\xa4""do", 3);
+    TEST_TRUE(mpack_patch_error(&patch) == mpack_error_invalid);
+    mpack_writer_init(&out, buffer, sizeof(buffer));
+    mpack_patch_write(&patch, &out);
+    TEST_WRITER_DESTROY_ERROR(&out, mpack_error_invalid);
+    TEST_TRUE(mpack_patch_destroy(&patch) == mpack_error_invalid);
+
+    mpack_patch_init(&patch, &tree);
+    mpack_patch_set(&patch, root, "\x01\x02", 2);
+    TEST_TRUE(mpack_patch_destroy(&patch) == mpack_error_invalid);
+
+    // containers of the wrong type flag errors on the tree
+    mpack_patch_init(&patch, &tree);
+    mpack_patch_array_insert(&patch, root, 0, "\x01", 1);
+    TEST_TRUE(mpack_patch_count(&patch) == 0);
+    TEST_TRUE(mpack_patch_destroy(&patch) == mpack_ok);
+    TEST_TREE_DESTROY_ERROR(&tree, mpack_error_type);
+
+    mpack_tree_init_pool(&tree, test_patch_message, sizeof(test_patch_message) - 1,
+            pool, sizeof(pool) / sizeof(*pool));
+    mpack_tree_parse(&tree);
+    mpack_patch_init(&patch, &tree);
+    mpack_patch_array_remove(&patch, mpack_node_map_cstr(mpack_tree_root(&tree), "tags"), 2);
+    TEST_TREE_DESTROY_ERROR(&tree, mpack_error_data);
+
+    // a tree in an error state cannot be written
+    mpack_writer_init(&out, buffer, sizeof(buffer));
+    mpack_patch_write(&patch, &out);
+    TEST_WRITER_DESTROY_ERROR(&out, mpack_error_data);
+    TEST_TRUE(mpack_patch_destroy(&patch) == mpack_ok);
+}
+
+#if MPACK_NODE_LAZY
+static void test_patch_lazy(void) {
+    mpack_node_data_t pool[32];
+    mpack_tree_t tree;
+    mpack_tree_init_pool(&tree, test_patch_message, sizeof(test_patch_message) - 1,
+            pool, sizeof(pool) / sizeof(*pool));
+    mpack_tree_set_lazy_depth(&tree, 1);
+    mpack_tree_parse(&tree);
+
+    // edits deep inside lazy containers expand only the path to them
+    mpack_patch_t patch;
+    mpack_patch_init(&patch, &tree);
+    mpack_node_t deep = mpack_node_map_cstr(mpack_node_map_cstr(mpack_tree_root(&tree), "meta"), "deep");
+    mpack_patch_map_set_cstr(&patch, deep, "k", "\x90", 1);
+    static const char edited[] =
+        "\x84\xa2""id\x07\xa6""status\xa3""new\xa4""tags\x92\xa1""a\xa1""b"
+        "\xa4""meta\x82\xa1""x\x01\xa4""deep\x81\xa1""k\x90";
+    test_patch_check(&patch, edited, sizeof(edited) - 1);
+
+    TEST_TRUE(mpack_patch_destroy(&patch) == mpack_ok);
+    TEST_TREE_DESTROY_NOERROR(&tree);
+}
+#endif
+
+// writes an array of 100 small maps, the 43rd of which has the given value
+static size_t test_patch_many_message(char* buffer, size_t size, int value) {
+    mpack_writer_t source;
+    mpack_writer_init(&source, buffer, size);
+    mpack_start_array(&source, 100);
+    for (int i = 0; i < 100; ++i) {
+        mpack_start_map(&source, 1);
+        mpack_write_cstr(&source, "n");
+        mpack_write_int(&source, (i == 42) ? value : i);
+        mpack_finish_map(&source);
+    }
+    mpack_finish_array(&source);
+    size_t used = mpack_writer_buffer_used(&source);
+    TEST_WRITER_DESTROY_NOERROR(&source);
+    return used;
+}
+
+static void test_patch_many(void) {
+    char message[1024];
+    size_t size = test_patch_many_message(message, sizeof(message), 42);
+    mpack_tree_t tree;
+    TEST_TREE_INIT(&tree, message, size);
+    mpack_tree_parse(&tree);
+
+    mpack_patch_t patch;
+    mpack_patch_init(&patch, &tree);
+    mpack_patch_map_set_cstr(&patch, mpack_node_array_at(mpack_tree_root(&tree), 42), "n", "\xd0\xd6", 2);
+
+    char expect[1024];
+    size_t expect_size = test_patch_many_message(expect, sizeof(expect), -42);
+    test_patch_check(&patch, expect, expect_size);
+
+    TEST_TRUE(mpack_patch_destroy(&patch) == mpack_ok);
+    TEST_TREE_DESTROY_NOERROR(&tree);
+}
+
+static void test_patch_allocator(void) {
+    static char arena_data[8192];
+    test_arena_t arena;
+    mpack_allocator_t allocator = test_arena_init(&arena, arena_data, sizeof(arena_data), true);
+    mpack_tree_t tree;
+    mpack_tree_init_data(&tree, test_patch_message, sizeof(test_patch_message) - 1);
+    mpack_tree_set_allocator(&tree, &allocator);
+    size_t mallocs = test_malloc_total_count();
+    mpack_tree_parse(&tree);
+
+    // the patch grows its edits and buffer with the tree's allocator
+    mpack_patch_t patch;
+    mpack_patch_init(&patch, &tree);
+    mpack_node_t k = mpack_node_map_cstr(mpack_node_map_cstr(mpack_node_map_cstr(
+                mpack_tree_root(&tree), "meta"), "deep"), "k");
+    for (size_t i = 0; i < 20; ++i)
+        mpack_patch_array_insert(&patch, k, 3, "\xa8""inserted", 9);
+    TEST_TRUE(mpack_patch_count(&patch) == 20);
+    TEST_TRUE(test_arena_contains(&arena, patch.edits));
+    TEST_TRUE(test_arena_contains(&arena, patch.buffer));
+    TEST_TRUE(mpack_patch_destroy(&patch) == mpack_ok);
+    TEST_TREE_DESTROY_NOERROR(&tree);
+
+    TEST_TRUE(test_malloc_total_count() == mallocs);
+    TEST_TRUE(arena.frees == arena.allocs);
+}
+
+void test_patch(void) {
+    test_patch_edits();
+    test_patch_errors();
+    #if MPACK_NODE_LAZY
+    test_patch_lazy();
+    #endif
+    test_patch_many();
+    test_patch_allocator();
+}
+
+#endif
@@ -0,0 +1,241 @@
+/*
+ * Copyright (c) 2015-2018 Nicholas Fraser
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "test-query.h"
+#include "test-reader.h"
+
+#if MPACK_QUERY && MPACK_READER
+
+#define TEST_QUERY_LONG_KEY "kkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkz"
+
+// {"meta": {"tenant": 5, "region": "eu"}, "items": [{"price": 1}, {"price": 2, "x": nil}],
+//  "trace": {"id": 77}, "arr": [[1, 2], [3, 4]], TEST_QUERY_LONG_KEY: 9, 1: 2}
+static const char test_query_message[] =
+    "\x86"
+    "\xa4meta\x82\xa6tenant\x05\xa6region\xa2""eu"
+    "\xa5items\x92\x81\xa5price\x01\x82\xa5price\x02\xa1x\xc0"
+    "\xa5trace\x81\xa2id\x4d"
+    "\xa3""arr\x92\x92\x01\x02\x92\x03\x04"
+    "\xd9\x28" TEST_QUERY_LONG_KEY "\x09"
+    "\x01\x02";
+
+static void test_query_compile_error(const char* path, mpack_error_t error) {
+    mpack_query_t query;
+    mpack_query_init(&query);
+    size_t index = mpack_query_compile(&query, path);
+    TEST_TRUE(index == MPACK_QUERY_MAX_PATHS, "\"%s\" compiled", path);
+    TEST_TRUE(mpack_query_error(&query) == error, "\"%s\" flagged %s", path,
+            mpack_error_to_string(mpack_query_error(&query)));
+}
+
+static void test_query_compile(void) {
+    test_query_compile_error(".a", mpack_error_invalid);
+    test_query_compile_error("a.", mpack_error_invalid);
+    test_query_compile_error("a..b", mpack_error_invalid);
+    test_query_compile_error("a[]", mpack_error_invalid);
+    test_query_compile_error("a[1", mpack_error_invalid);
+    test_query_compile_error("a[x]", mpack_error_invalid);
+    test_query_compile_error("a[-1]", mpack_error_invalid);
+    test_query_compile_error("[4294967296]", mpack_error_invalid);
+    test_query_compile_error("a[0]b", mpack_error_invalid);
+
+    char path[3 * (MPACK_QUERY_MAX_STEPS + 1) + 1];
+    for (size_t i = 0; i <= MPACK_QUERY_MAX_STEPS; ++i)
+        memcpy(path + 3 * i, "[*]", 3);
+    path[sizeof(path) - 1] = '\0';
+    test_query_compile_error(path, mpack_error_too_big);
+
+    // valid paths get consecutive indices, and errors are sticky
+    mpack_query_t query;
+    mpack_query_init(&query);
+    TEST_TRUE(mpack_query_compile(&query, "") == 0);
+    TEST_TRUE(mpack_query_compile(&query, "[4294967295]") == 1);
+    TEST_TRUE(mpack_query_compile(&query, "a.*[*].b[0]") == 2);
+    for (size_t i = 3; i < MPACK_QUERY_MAX_PATHS; ++i)
+        TEST_TRUE(mpack_query_compile(&query, "*") == i);
+    TEST_TRUE(mpack_query_compile(&query, "*") == MPACK_QUERY_MAX_PATHS);
+    TEST_TRUE(mpack_query_error(&query) == mpack_error_too_big);
+    TEST_TRUE(mpack_query_compile(&query, "a") == MPACK_QUERY_MAX_PATHS);
+
+    // a query in an error state flags its error on the reader
+    mpack_reader_t reader;
+    mpack_reader_init_data(&reader, test_query_message, sizeof(test_query_message) - 1);
+    TEST_TRUE(mpack_query_run(&query, &reader) == mpack_error_too_big);
+    TEST_READER_DESTROY_ERROR(&reader, mpack_error_too_big);
+}
+
+static void test_query_tags(mpack_reader_t* reader) {
+    mpack_query_t query;
+    mpack_query_init(&query);
+    size_t tenant = mpack_query_compile(&query, "meta.tenant");
+    size_t first = mpack_query_compile(&query, "items[0]");
+    size_t price = mpack_query_compile(&query, "items[*].price");
+    size_t id = mpack_query_compile(&query, "trace.id");
+    size_t element = mpack_query_compile(&query, "arr[1][0]");
+    size_t meta = mpack_query_compile(&query, "meta.*");
+    size_t missing = mpack_query_compile(&query, "trace.name");
+    size_t wrong = mpack_query_compile(&query, "kkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkky");
+    size_t longer = mpack_query_compile(&query, TEST_QUERY_LONG_KEY);
+    size_t number = mpack_query_compile(&query, "1");
+    size_t index = mpack_query_compile(&query, "meta[0]");
+    TEST_TRUE(mpack_query_error(&query) == mpack_ok);
+
+    TEST_TRUE(mpack_query_run(&query, reader) == mpack_ok);
+    TEST_READER_DESTROY_NOERROR(reader);
+
+    mpack_tag_t tag = mpack_query_tag(&query, tenant);
+    TEST_TRUE(mpack_query_count(&query, tenant) == 1);
+    TEST_TRUE(mpack_tag_type(&tag) == mpack_type_uint && mpack_tag_uint_value(&tag) == 5);
+
+    // items[0] hides the first price from items[*].price
+    tag = mpack_query_tag(&query, first);
+    TEST_TRUE(mpack_query_count(&query, first) == 1);
+    TEST_TRUE(mpack_tag_type(&tag) == mpack_type_map && mpack_tag_map_count(&tag) == 1);
+    tag = mpack_query_tag(&query, price);
+    TEST_TRUE(mpack_query_count(&query, price) == 1);
+    TEST_TRUE(mpack_tag_type(&tag) == mpack_type_uint && mpack_tag_uint_value(&tag) == 2);
+
+    tag = mpack_query_tag(&query, id);
+    TEST_TRUE(mpack_query_count(&query, id) == 1);
+    TEST_TRUE(mpack_tag_type(&tag) == mpack_type_uint && mpack_tag_uint_value(&tag) == 77);
+
+    tag = mpack_query_tag(&query, element);
+    TEST_TRUE(mpack_query_count(&query, element) == 1);
+    TEST_TRUE(mpack_tag_type(&tag) == mpack_type_uint && mpack_tag_uint_value(&tag) == 3);
+
+    // meta.tenant is claimed by the earlier path
+    tag = mpack_query_tag(&query, meta);
+    TEST_TRUE(mpack_query_count(&query, meta) == 1);
+    TEST_TRUE(mpack_tag_type(&tag) == mpack_type_str && mpack_tag_str_length(&tag) == 2);
+
+    tag = mpack_query_tag(&query, longer);
+    TEST_TRUE(mpack_query_count(&query, longer) == 1);
+    TEST_TRUE(mpack_tag_type(&tag) == mpack_type_uint && mpack_tag_uint_value(&tag) == 9);
+
+    // keys must be strings and indices apply only to arrays
+    size_t unmatched[] = {missing, wrong, number, index};
+    for (size_t i = 0; i < sizeof(unmatched) / sizeof(*unmatched); ++i) {
+        tag = mpack_query_tag(&query, unmatched[i]);
+        TEST_TRUE(mpack_query_count(&query, unmatched[i]) == 0);
+        TEST_TRUE(mpack_tag_type(&tag) == mpack_type_missing);
+    }
+}
+
+typedef struct test_query_stream_t {
+    const char* data;
+    size_t left;
+} test_query_stream_t;
+
+static size_t test_query_fill(mpack_reader_t* reader, char* buffer, size_t count) {
+    test_query_stream_t* stream = (test_query_stream_t*)reader->context;
+    if (count > 2)
+        count = 2;
+    if (count > stream->left)
+        count = stream->left;
+    memcpy(buffer, stream->data, count);
+    stream->data += count;
+    stream->left -= count;
+    return count;
+}
+
+static void test_query_sum(mpack_query_t* query, mpack_reader_t* reader, size_t path) {
+    uint64_t* sums = (uint64_t*)mpack_query_context(query);
+    mpack_tag_t tag = mpack_peek_tag(reader);
+    if (mpack_tag_type(&tag) != mpack_type_uint) {
+        mpack_discard(reader);
+        return;
+    }
+    mpack_read_tag(reader);
+    sums[path] += mpack_tag_uint_value(&tag);
+}
+
+static void test_query_match(void) {
+    uint64_t sums[3] = {0, 0, 0};
+    mpack_query_t query;
+    mpack_query_init(&query);
+    mpack_query_set_match(&query, &test_query_sum);
+    mpack_query_set_context(&query, sums);
+    TEST_TRUE(mpack_query_compile(&query, "items[*].price") == 0);
+    TEST_TRUE(mpack_query_compile(&query, "arr[*][*]") == 1);
+    TEST_TRUE(mpack_query_compile(&query, "trace.*") == 2);
+
+    mpack_reader_t reader;
+    mpack_reader_init_data(&reader, test_query_message, sizeof(test_query_message) - 1);
+    TEST_TRUE(mpack_query_run(&query, &reader) == mpack_ok);
+    TEST_READER_DESTROY_NOERROR(&reader);
+
+    TEST_TRUE(sums[0] == 3 && mpack_query_count(&query, 0) == 2);
+    TEST_TRUE(sums[1] == 10 && mpack_query_count(&query, 1) == 4);
+    TEST_TRUE(sums[2] == 77 && mpack_query_count(&query, 2) == 1);
+    TEST_TRUE(mpack_tag_type(&query.tags[0]) == mpack_type_missing);
+}
+
+static void test_query_root(void) {
+    mpack_query_t query;
+    mpack_query_init(&query);
+    TEST_TRUE(mpack_query_compile(&query, "") == 0);
+    TEST_TRUE(mpack_query_compile(&query, "meta") == 1);
+
+    mpack_reader_t reader;
+    mpack_reader_init_data(&reader, test_query_message, sizeof(test_query_message) - 1);
+    TEST_TRUE(mpack_query_run(&query, &reader) == mpack_ok);
+    TEST_TRUE(mpack_reader_remaining(&reader, NULL) == 0);
+    TEST_READER_DESTROY_NOERROR(&reader);
+
+    mpack_tag_t tag = mpack_query_tag(&query, 0);
+    TEST_TRUE(mpack_tag_type(&tag) == mpack_type_map && mpack_tag_map_count(&tag) == 6);
+    TEST_TRUE(mpack_query_count(&query, 1) == 0);
+}
+
+static void test_query_truncated(void) {
+    mpack_query_t query;
+    mpack_query_init(&query);
+    mpack_query_compile(&query, "arr[1][0]");
+    mpack_query_compile(&query, TEST_QUERY_LONG_KEY);
+    for (size_t i = 0; i < sizeof(test_query_message) - 1; ++i) {
+        mpack_reader_t reader;
+        mpack_reader_init_data(&reader, test_query_message, i);
+        TEST_TRUE(mpack_query_run(&query, &reader) == mpack_error_invalid);
+        TEST_READER_DESTROY_ERROR(&reader, mpack_error_invalid);
+    }
+}
+
+void test_query(void) {
+    test_query_compile();
+    test_query_match();
+    test_query_root();
+    test_query_truncated();
+
+    mpack_reader_t reader;
+    mpack_reader_init_data(&reader, test_query_message, sizeof(test_query_message) - 1);
+    test_query_tags(&reader);
+
+    // a stream that returns two bytes at a time into the smallest buffer
+    // makes the long key straddle refills
+    test_query_stream_t stream = {test_query_message, sizeof(test_query_message) - 1};
+    char buffer[MPACK_READER_MINIMUM_BUFFER_SIZE];
+    mpack_reader_init(&reader, buffer, sizeof(buffer), 0);
+    mpack_reader_set_context(&reader, &stream);
+    mpack_reader_set_fill(&reader, &test_query_fill);
+    test_query_tags(&reader);
+}
+
+#endif
@@ -158,6 +158,271 @@ static void test_count_messages(void) {
     TEST_TRUE(!count_messages(test2, sizeof(test2)-1, &message_count));
 }
 
+typedef struct test_reader_stream_t {
+    const char* data;
+    size_t left;
+    size_t skips;
+} test_reader_stream_t;
+
+static size_t test_reader_stream_fill(mpack_reader_t* reader, char* buffer, size_t count) {
+    test_reader_stream_t* stream = (test_reader_stream_t*)reader->context;
+    if (count > 2)
+        count = 2;
+    if (count > stream->left)
+        count = stream->left;
+    memcpy(buffer, stream->data, count);
+    stream->data += count;
+    stream->left -= count;
+    return count;
+}
+
+static void test_reader_stream_skip(mpack_reader_t* reader, size_t count) {
+    test_reader_stream_t* stream = (test_reader_stream_t*)reader->context;
+    if (count > stream->left) {
+        mpack_reader_flag_error(reader, mpack_error_io);
+        return;
+    }
+    stream->data += count;
+    stream->left -= count;
+    ++stream->skips;
+}
+
+// {"a": [1, "xyz", {"b": -70000, "c": [nil, 1.5]}], "d": bin[300], "e": [[[]]]} 7
+#define TEST_READER_DISCARD_HEADER \
+    "\x83\xa1""a\x93\x01\xa3xyz\x82\xa1""b\xd2\xff\xfe\xee\x90\xa1""c\x92\xc0" \
+    "\xcb\x3f\xf8\x00\x00\x00\x00\x00\x00\xa1""d\xc5\x01\x2c"
+#define TEST_READER_DISCARD_TRAILER "\xa1""e\x91\x91\x90\x07"
+
+static void test_reader_discard(void) {
+    char data[sizeof(TEST_READER_DISCARD_HEADER) - 1 + 300 + sizeof(TEST_READER_DISCARD_TRAILER) - 1];
+    memcpy(data, TEST_READER_DISCARD_HEADER, sizeof(TEST_READER_DISCARD_HEADER) - 1);
+    for (size_t i = 0; i < 300; ++i)
+        data[sizeof(TEST_READER_DISCARD_HEADER) - 1 + i] = (char)i;
+    memcpy(data + sizeof(data) - (sizeof(TEST_READER_DISCARD_TRAILER) - 1),
+            TEST_READER_DISCARD_TRAILER, sizeof(TEST_READER_DISCARD_TRAILER) - 1);
+
+    // the whole map is skipped, and every truncation of it is an error
+    mpack_reader_t reader;
+    for (size_t length = 0; length <= sizeof(data); ++length) {
+        mpack_reader_init_data(&reader, data, length);
+        mpack_discard(&reader);
+        if (length < sizeof(data) - 1) {
+            TEST_READER_DESTROY_ERROR(&reader, mpack_error_invalid);
+            continue;
+        }
+        TEST_TRUE(mpack_reader_remaining(&reader, NULL) == length - (sizeof(data) - 1));
+        mpack_reader_destroy(&reader);
+    }
+
+    // the same from a stream arriving two bytes at a time, using the skip
+    // function to jump over the bin
+    for (int skip = 0; skip < 2; ++skip) {
+        test_reader_stream_t stream = {data, sizeof(data), 0};
+        char buffer[64];
+        mpack_reader_init(&reader, buffer, sizeof(buffer), 0);
+        mpack_reader_set_context(&reader, &stream);
+        mpack_reader_set_fill(&reader, &test_reader_stream_fill);
+        if (skip)
+            mpack_reader_set_skip(&reader, &test_reader_stream_skip);
+        mpack_discard(&reader);
+        mpack_tag_t tag = mpack_read_tag(&reader);
+        TEST_TRUE(mpack_tag_type(&tag) == mpack_type_uint && mpack_tag_uint_value(&tag) == 7);
+        TEST_READER_DESTROY_NOERROR(&reader);
+        TEST_TRUE(stream.skips == (skip ? 1u : 0u));
+    }
+
+    // discarded elements count as one element in their parent
+    mpack_reader_init_data(&reader, "\x92\x91\xc0\xa1x", 5);
+    mpack_tag_t tag = mpack_read_tag(&reader);
+    TEST_TRUE(mpack_tag_type(&tag) == mpack_type_array && mpack_tag_array_count(&tag) == 2);
+    mpack_discard(&reader);
+    mpack_discard(&reader);
+    mpack_done_array(&reader);
+    TEST_READER_DESTROY_NOERROR(&reader);
+
+    // invalid and unsupported types
+    mpack_reader_init_data(&reader, "\x92\x01\xc1", 3);
+    mpack_discard(&reader);
+    TEST_READER_DESTROY_ERROR(&reader, mpack_error_invalid);
+    mpack_reader_init_data(&reader, "\x91\xd4\x01\x00", 4);
+    mpack_discard(&reader);
+    #if MPACK_EXTENSIONS
+    TEST_READER_DESTROY_NOERROR(&reader);
+    #else
+    TEST_READER_DESTROY_ERROR(&reader, mpack_error_unsupported);
+    #endif
+}
+
+// a non-blocking source that only has some of its data available
+typedef struct test_reader_nonblocking_t {
+    const char* data;
+    size_t left;
+    size_t available;
+} test_reader_nonblocking_t;
+
+static size_t test_reader_nonblocking_fill(mpack_reader_t* reader, char* buffer, size_t count) {
+    test_reader_nonblocking_t* source = (test_reader_nonblocking_t*)reader->context;
+    if (source->available == 0) {
+        mpack_reader_flag_error(reader, mpack_error_would_block);
+        return 0;
+    }
+    if (count > 3)
+        count = 3;
+    if (count > source->available)
+        count = source->available;
+    memcpy(buffer, source->data, count);
+    source->data += count;
+    source->left -= count;
+    source->available -= count;
+    return count;
+}
+
+// [str[20], bin[40], {"x": [1, 2]}, n]
+static size_t test_reader_checkpoint_message(char* message, uint8_t n) {
+    size_t length = 0;
+    message[length++] = '\x94';
+    message[length++] = '\xb4';
+    for (int i = 0; i < 20; ++i)
+        message[length++] = (char)('a' + i);
+    message[length++] = '\xc4';
+    message[length++] = 40;
+    for (int i = 0; i < 40; ++i)
+        message[length++] = (char)i;
+    memcpy(message + length, "\x81\xa1x\x92\x01\x02", 6);
+    length += 6;
+    message[length++] = (char)n;
+    return length;
+}
+
+static uint64_t test_reader_checkpoint_read(mpack_reader_t* reader, char* str) {
+    mpack_read_tag(reader);
+    mpack_tag_t tag = mpack_read_tag(reader);
+    mpack_read_bytes(reader, str, tag.v.l);
+    mpack_done_str(reader);
+    tag = mpack_read_tag(reader);
+    mpack_skip_bytes(reader, tag.v.l);
+    mpack_done_bin(reader);
+    mpack_discard(reader);
+    tag = mpack_read_tag(reader);
+    mpack_done_array(reader);
+    return tag.v.u;
+}
+
+static void test_reader_checkpoint(void) {
+    char data[200];
+    size_t first = test_reader_checkpoint_message(data, 1);
+    size_t length = first + test_reader_checkpoint_message(data + first, 2);
+
+    // messages are retried as data trickles in, with each attempt seeing
+    // all the data from the start of the message
+    test_reader_nonblocking_t source = {data, length, 0};
+    char buffer[128];
+    mpack_reader_t reader;
+    mpack_reader_init(&reader, buffer, sizeof(buffer), 0);
+    mpack_reader_set_context(&reader, &source);
+    mpack_reader_set_fill(&reader, &test_reader_nonblocking_fill);
+    int attempts = 0;
+    for (uint64_t n = 1; n <= 2;) {
+        mpack_reader_checkpoint(&reader);
+        char str[20];
+        uint64_t value = test_reader_checkpoint_read(&reader, str);
+        if (mpack_reader_rollback(&reader)) {
+            source.available += (source.left < 7) ? source.left : 7;
+            ++attempts;
+            continue;
+        }
+        TEST_TRUE(mpack_reader_error(&reader) == mpack_ok);
+        TEST_TRUE(value == n);
+        TEST_TRUE(memcmp(str, "abcdefghijklmnopqrst", 20) == 0);
+        ++n;
+    }
+    TEST_TRUE(attempts >= (int)(length / 7));
+    TEST_TRUE(source.left == 0);
+    mpack_reader_clear_checkpoint(&reader);
+    TEST_TRUE(!mpack_reader_rollback(&reader));
+    TEST_READER_DESTROY_NOERROR(&reader);
+
+    // other errors are not rolled back
+    test_reader_stream_t truncated = {data, 10, 0};
+    mpack_reader_init(&reader, buffer, sizeof(buffer), 0);
+    mpack_reader_set_context(&reader, &truncated);
+    mpack_reader_set_fill(&reader, &test_reader_stream_fill);
+    mpack_reader_checkpoint(&reader);
+    mpack_discard(&reader);
+    TEST_TRUE(!mpack_reader_rollback(&reader));
+    TEST_READER_DESTROY_ERROR(&reader, mpack_error_io);
+
+    // the rest of a message must fit in the buffer, even with a skip function
+    test_reader_stream_t large = {data, length, 0};
+    char small[48];
+    mpack_reader_init(&reader, small, sizeof(small), 0);
+    mpack_reader_set_context(&reader, &large);
+    mpack_reader_set_fill(&reader, &test_reader_stream_fill);
+    mpack_reader_set_skip(&reader, &test_reader_stream_skip);
+    mpack_reader_checkpoint(&reader);
+    test_reader_checkpoint_read(&reader, buffer);
+    TEST_TRUE(!mpack_reader_rollback(&reader));
+    TEST_READER_DESTROY_ERROR(&reader, mpack_error_too_big);
+    TEST_TRUE(large.skips == 0);
+
+    #if MPACK_READ_TRACKING
+    // checkpoints must be between messages
+    mpack_reader_init_data(&reader, data, length);
+    mpack_read_tag(&reader);
+    TEST_BREAK((mpack_reader_checkpoint(&reader), true));
+    TEST_READER_DESTROY_ERROR(&reader, mpack_error_bug);
+    #endif
+}
+
+#if MPACK_STATS
+static void test_reader_stats(void) {
+    static const char test[] = "\x92\xa5hello\xcd\x01\x00";
+    test_reader_stream_t stream = {test, sizeof(test) - 1, 0};
+
+    char buffer[MPACK_READER_MINIMUM_BUFFER_SIZE];
+    mpack_reader_t reader;
+    mpack_reader_init(&reader, buffer, sizeof(buffer), 0);
+    mpack_reader_set_context(&reader, &stream);
+    mpack_reader_set_fill(&reader, &test_reader_stream_fill);
+    const mpack_stats_t* stats = mpack_reader_stats(&reader);
+    TEST_TRUE(stats->fills == 0 && stats->bytes == 0);
+
+    mpack_discard(&reader);
+    TEST_TRUE(mpack_reader_error(&reader) == mpack_ok);
+    TEST_TRUE(stats->fills >= 5);
+    TEST_TRUE(stats->bytes == sizeof(test) - 1);
+    TEST_TRUE(stats->flushes == 0 && stats->messages == 0);
+
+    mpack_reader_reset_stats(&reader);
+    TEST_TRUE(stats->fills == 0 && stats->bytes == 0 && stats->bytes_copied == 0);
+    TEST_TRUE(mpack_reader_destroy(&reader) == mpack_ok);
+}
+
+static void test_reader_stats_pipelined(void) {
+    // a stream of many small values arriving a couple of bytes at a time
+    char data[300];
+    for (size_t i = 0; i < sizeof(data); i += 5)
+        memcpy(data + i, "\xce\x00\x01\x00\x00", 5);
+    test_reader_stream_t stream = {data, sizeof(data), 0};
+
+    char buffer[64];
+    mpack_reader_t reader;
+    mpack_reader_init(&reader, buffer, sizeof(buffer), 0);
+    mpack_reader_set_context(&reader, &stream);
+    mpack_reader_set_fill(&reader, &test_reader_stream_fill);
+    for (size_t i = 0; i < sizeof(data) / 5; ++i) {
+        mpack_tag_t tag = mpack_read_tag(&reader);
+        TEST_TRUE(mpack_tag_type(&tag) == mpack_type_uint && mpack_tag_uint_value(&tag) == 65536);
+    }
+
+    // unread data is only moved back when it nears the end of the buffer
+    const mpack_stats_t* stats = mpack_reader_stats(&reader);
+    TEST_TRUE(stats->bytes == sizeof(data));
+    TEST_TRUE(stats->bytes_copied < sizeof(data) / 10);
+    TEST_TRUE(mpack_reader_destroy(&reader) == mpack_ok);
+}
+#endif
+
 void test_reader() {
     #if MPACK_DEBUG && MPACK_STDIO
     test_print_buffer();
@@ -168,6 +433,12 @@ void test_reader() {
     test_reader_should_inplace();
     test_reader_miscellaneous();
     test_count_messages();
+    test_reader_discard();
+    test_reader_checkpoint();
+    #if MPACK_STATS
+    test_reader_stats();
+    test_reader_stats_pipelined();
+    #endif
 }
 
 #endif
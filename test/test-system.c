@@ -160,6 +160,44 @@ void test_free(void* p) {
     free(p);
 }
 
+static void* test_arena_alloc(void* context, size_t size) {
+    test_arena_t* arena = (test_arena_t*)context;
+    TEST_TRUE(size != 0, "cannot allocate zero bytes!");
+
+    size_t offset = (arena->used + 7) & ~(size_t)7;
+    if (size > arena->capacity || offset > arena->capacity - size)
+        return NULL;
+    arena->used = offset + size;
+    ++arena->allocs;
+    return arena->data + offset;
+}
+
+static void test_arena_free(void* context, void* p) {
+    test_arena_t* arena = (test_arena_t*)context;
+    TEST_TRUE((char*)p >= arena->data && (char*)p < arena->data + arena->capacity,
+            "freeing pointer that is not in the arena");
+    ++arena->frees;
+}
+
+mpack_allocator_t test_arena_init(test_arena_t* arena, char* data, size_t capacity, bool frees) {
+    arena->data = data;
+    arena->capacity = capacity;
+    arena->used = 0;
+    arena->allocs = 0;
+    arena->frees = 0;
+
+    mpack_allocator_t allocator;
+    allocator.alloc_fn = test_arena_alloc;
+    allocator.realloc_fn = NULL;
+    allocator.free_fn = frees ? test_arena_free : NULL;
+    allocator.context = arena;
+    return allocator;
+}
+
+bool test_arena_contains(test_arena_t* arena, const void* p) {
+    return (const char*)p >= arena->data && (const char*)p < arena->data + arena->used;
+}
+
 #endif
 
 
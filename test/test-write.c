@@ -798,6 +798,121 @@ static bool test_write_deep_growth(void) {
     return true;
 
 }
+
+static void test_write_chunked_contents(mpack_writer_t* writer) {
+    static char blob[1000];
+    size_t i;
+    for (i = 0; i < sizeof(blob); ++i)
+        blob[i] = (char)i;
+
+    mpack_start_array(writer, 203);
+    for (i = 0; i < 200; ++i)
+        mpack_write_u64(writer, (uint64_t)i * UINT64_C(0x0101010101));
+    mpack_write_cstr(writer, lipsum);
+    mpack_write_bin(writer, blob, sizeof(blob)); // larger than any chunk
+    mpack_write_cstr(writer, "hello");
+    mpack_finish_array(writer);
+}
+
+static void test_write_chunked(void) {
+    char* expected_data;
+    size_t expected_size;
+    mpack_writer_t writer;
+    mpack_writer_init_growable(&writer, &expected_data, &expected_size);
+    test_write_chunked_contents(&writer);
+    TEST_WRITER_DESTROY_NOERROR(&writer);
+
+    // the chunks hold the same data as the growable writer
+    mpack_chunks_t chunks;
+    mpack_writer_init_chunked(&writer, &chunks);
+    test_write_chunked_contents(&writer);
+    TEST_WRITER_DESTROY_NOERROR(&writer);
+    TEST_TRUE(mpack_chunks_size(&chunks) == expected_size);
+
+    size_t count;
+    const mpack_iovec_t* iov = mpack_chunks_iov(&chunks, &count);
+    TEST_TRUE(count > 2);
+    size_t offset = 0;
+    size_t i;
+    for (i = 0; i < count; ++i) {
+        TEST_TRUE(iov[i].count > 0);
+        TEST_TRUE(offset + iov[i].count <= expected_size);
+        TEST_TRUE(memcmp(iov[i].data, expected_data + offset, iov[i].count) == 0);
+        offset += iov[i].count;
+
+        // chunks grow up to the maximum size, except where the blob needed
+        // a larger one
+        if (iov[i].count > MPACK_WRITER_CHUNK_MAX_SIZE)
+            TEST_TRUE(iov[i].count < 1000 + MPACK_WRITER_CHUNK_MAX_SIZE);
+    }
+    TEST_TRUE(offset == expected_size);
+
+    size_t size;
+    char* data = mpack_chunks_coalesce(&chunks, &size);
+    TEST_TRUE(data != NULL);
+    TEST_TRUE(size == expected_size);
+    TEST_TRUE(memcmp(data, expected_data, size) == 0);
+    TEST_TRUE(mpack_chunks_size(&chunks) == 0);
+    MPACK_FREE(data);
+    mpack_chunks_destroy(&chunks);
+    MPACK_FREE(expected_data);
+
+    // a single chunk is coalesced without copying
+    mpack_writer_init_chunked(&writer, &chunks);
+    mpack_write_cstr(&writer, "hello");
+    TEST_WRITER_DESTROY_NOERROR(&writer);
+    iov = mpack_chunks_iov(&chunks, &count);
+    TEST_TRUE(count == 1);
+    data = mpack_chunks_coalesce(&chunks, &size);
+    TEST_TRUE(size == 6 && memcmp(data, "\xa5" "hello", 6) == 0);
+    MPACK_FREE(data);
+    mpack_chunks_destroy(&chunks);
+
+    // nothing written leaves no chunks, but still coalesces to a buffer
+    mpack_writer_init_chunked(&writer, &chunks);
+    TEST_WRITER_DESTROY_NOERROR(&writer);
+    iov = mpack_chunks_iov(&chunks, &count);
+    TEST_TRUE(count == 0 && mpack_chunks_size(&chunks) == 0);
+    data = mpack_chunks_coalesce(&chunks, &size);
+    TEST_TRUE(data != NULL && size == 0);
+    MPACK_FREE(data);
+    mpack_chunks_destroy(&chunks);
+
+    // an error leaves the chunks empty
+    mpack_writer_init_chunked(&writer, &chunks);
+    test_write_chunked_contents(&writer);
+    mpack_writer_flag_error(&writer, mpack_error_data);
+    TEST_WRITER_DESTROY_ERROR(&writer, mpack_error_data);
+    iov = mpack_chunks_iov(&chunks, &count);
+    TEST_TRUE(count == 0 && mpack_chunks_size(&chunks) == 0);
+    mpack_chunks_destroy(&chunks);
+}
+
+static bool test_write_chunked_growth(void) {
+    mpack_chunks_t chunks;
+    mpack_writer_t writer;
+    mpack_writer_init_chunked(&writer, &chunks);
+    test_write_chunked_contents(&writer);
+    mpack_error_t error = mpack_writer_destroy(&writer);
+
+    size_t count;
+    mpack_chunks_iov(&chunks, &count);
+    if (error == mpack_error_memory) {
+        TEST_TRUE(count == 0);
+        mpack_chunks_destroy(&chunks);
+        return false;
+    }
+    TEST_TRUE(error == mpack_ok, "unexpected error state %i (%s)", (int)error, mpack_error_to_string(error));
+    TEST_TRUE(count > 2);
+
+    size_t size;
+    char* data = mpack_chunks_coalesce(&chunks, &size);
+    mpack_chunks_destroy(&chunks);
+    if (data == NULL)
+        return false;
+    MPACK_FREE(data);
+    return true;
+}
 #endif
 
 #if MPACK_WRITE_TRACKING
@@ -861,6 +976,192 @@ static void test_write_tracking() {
 }
 #endif
 
+#if MPACK_BUILDER
+static void test_write_builder_basic(void) {
+    char buf[4096];
+
+    TEST_SIMPLE_WRITE("\x90", (mpack_build_array(&writer), mpack_complete_array(&writer)));
+    TEST_SIMPLE_WRITE("\x80", (mpack_build_map(&writer), mpack_complete_map(&writer)));
+    TEST_SIMPLE_WRITE("\x91\xc0", (mpack_build_array(&writer), mpack_write_nil(&writer),
+                mpack_complete_array(&writer)));
+    TEST_SIMPLE_WRITE("\x81\x01\x02", (mpack_build_map(&writer), mpack_write_int(&writer, 1),
+                mpack_write_int(&writer, 2), mpack_complete_map(&writer)));
+
+    // nested builds, and builds mixed with maps and arrays of known size
+    TEST_SIMPLE_WRITE("\x93\x81\xc0\x92\x01\x02\x90\x03",
+            (mpack_build_array(&writer),
+                mpack_build_map(&writer),
+                    mpack_write_nil(&writer),
+                    mpack_start_array(&writer, 2),
+                        mpack_write_int(&writer, 1),
+                        mpack_write_int(&writer, 2),
+                    mpack_finish_array(&writer),
+                mpack_complete_map(&writer),
+                mpack_build_array(&writer),
+                mpack_complete_array(&writer),
+                mpack_write_int(&writer, 3),
+            mpack_complete_array(&writer)));
+    TEST_SIMPLE_WRITE("\x92\x91\x81\xa1""a\xc0\xc3",
+            (mpack_start_array(&writer, 2),
+                mpack_build_array(&writer),
+                    mpack_start_map(&writer, 1),
+                        mpack_write_cstr(&writer, "a"),
+                        mpack_write_nil(&writer),
+                    mpack_finish_map(&writer),
+                mpack_complete_array(&writer),
+                mpack_write_true(&writer),
+            mpack_finish_array(&writer)));
+
+    // the smallest header is chosen for the count
+    TEST_SIMPLE_WRITE("\xdc\x00\x10\x00\x01\x02\x03\x04\x05\x06\x07\x08\x09\x0a\x0b\x0c\x0d\x0e\x0f",
+            do {
+                mpack_build_array(&writer);
+                for (int i = 0; i < 16; ++i)
+                    mpack_write_int(&writer, i);
+                mpack_complete_array(&writer);
+            } while (0));
+
+    // consecutive builds in the same writer
+    TEST_SIMPLE_WRITE("\x91\xc0\x91\xc2",
+            (mpack_build_array(&writer), mpack_write_nil(&writer), mpack_complete_array(&writer),
+             mpack_build_array(&writer), mpack_write_false(&writer), mpack_complete_array(&writer)));
+}
+
+#if MPACK_DEBUG
+static void test_write_builder_errors(void) {
+    char buf[4096];
+    mpack_writer_t writer;
+
+    // map with a key but no value
+    mpack_writer_init(&writer, buf, sizeof(buf));
+    mpack_build_map(&writer);
+    mpack_write_nil(&writer);
+    TEST_BREAK((mpack_complete_map(&writer), true));
+    TEST_WRITER_DESTROY_ERROR(&writer, mpack_error_bug);
+
+    // completing the wrong type
+    mpack_writer_init(&writer, buf, sizeof(buf));
+    mpack_build_map(&writer);
+    TEST_BREAK((mpack_complete_array(&writer), true));
+    TEST_WRITER_DESTROY_ERROR(&writer, mpack_error_bug);
+
+    // completing with an unfinished array of known size
+    mpack_writer_init(&writer, buf, sizeof(buf));
+    mpack_build_array(&writer);
+    mpack_start_array(&writer, 2);
+    mpack_write_nil(&writer);
+    TEST_BREAK((mpack_complete_array(&writer), true));
+    TEST_WRITER_DESTROY_ERROR(&writer, mpack_error_bug);
+
+    // completing when nothing was built
+    mpack_writer_init(&writer, buf, sizeof(buf));
+    TEST_BREAK((mpack_complete_array(&writer), true));
+    TEST_WRITER_DESTROY_ERROR(&writer, mpack_error_bug);
+
+    // destroying with an incomplete build
+    mpack_writer_init(&writer, buf, sizeof(buf));
+    mpack_build_array(&writer);
+    mpack_write_nil(&writer);
+    TEST_BREAK((mpack_writer_destroy(&writer), true));
+    TEST_TRUE(mpack_writer_error(&writer) == mpack_error_bug);
+
+    // an error cancels the build
+    mpack_writer_init(&writer, buf, sizeof(buf));
+    mpack_build_map(&writer);
+    mpack_build_array(&writer);
+    mpack_writer_flag_error(&writer, mpack_error_data);
+    TEST_WRITER_DESTROY_ERROR(&writer, mpack_error_data);
+}
+#endif
+
+// Writes nested arrays, each containing an int, a string and the next array.
+// The innermost array contains numbers; if it has enough, elements span
+// several builder pages.
+static void test_write_builder_nested(mpack_writer_t* writer, bool build, int depth, int nums) {
+    for (int i = 0; i < depth; ++i) {
+        if (build)
+            mpack_build_array(writer);
+        else
+            mpack_start_array(writer, 3);
+        mpack_write_int(writer, i);
+        mpack_write_cstr(writer, quick_brown_fox);
+    }
+
+    if (build)
+        mpack_build_array(writer);
+    else
+        mpack_start_array(writer, (uint32_t)nums);
+    for (int i = 0; i < nums; ++i)
+        mpack_write_u64(writer, UINT64_MAX - (uint64_t)i);
+    if (build)
+        mpack_complete_array(writer);
+    else
+        mpack_finish_array(writer);
+
+    for (int i = 0; i < depth; ++i) {
+        if (build)
+            mpack_complete_array(writer);
+        else
+            mpack_finish_array(writer);
+    }
+}
+
+#ifdef MPACK_MALLOC
+static bool test_write_builder_growth(void) {
+    char* expected;
+    size_t expected_size;
+    char* buf;
+    size_t size;
+    mpack_writer_t writer;
+
+    mpack_writer_init_growable(&writer, &expected, &expected_size);
+    test_write_builder_nested(&writer, false, 20, 300);
+    if (mpack_writer_destroy(&writer) != mpack_ok)
+        return false;
+
+    // a data string larger than a builder page is split across pages
+    char data[MPACK_BUILDER_PAGE_SIZE * 3];
+    memset(data, 'x', sizeof(data));
+
+    mpack_writer_init_growable(&writer, &buf, &size);
+    mpack_start_array(&writer, 2);
+    test_write_builder_nested(&writer, true, 20, 300);
+    mpack_build_map(&writer);
+    mpack_write_cstr(&writer, "data");
+    mpack_write_str(&writer, data, sizeof(data));
+    mpack_complete_map(&writer);
+    mpack_finish_array(&writer);
+
+    mpack_error_t error = mpack_writer_destroy(&writer);
+    if (error == mpack_error_memory) {
+        MPACK_FREE(expected);
+        TEST_TRUE(buf == NULL);
+        return false;
+    }
+    TEST_TRUE(error == mpack_ok, "unexpected error state %i (%s)", (int)error, mpack_error_to_string(error));
+
+    if (buf) {
+        size_t data_size = 1 + MPACK_TAG_SIZE_FIXSTR + 4 + MPACK_TAG_SIZE_STR16 + sizeof(data);
+        TEST_TRUE(size == 1 + expected_size + data_size);
+        TEST_TRUE(memcmp(buf + 1, expected, expected_size) == 0);
+        TEST_TRUE(memcmp(buf + size - sizeof(data), data, sizeof(data)) == 0);
+        MPACK_FREE(buf);
+    }
+    MPACK_FREE(expected);
+    return true;
+}
+#else
+static void test_write_builder_storage(void) {
+    char buf[4096];
+
+    // without malloc, builds are limited to the internal storage
+    TEST_SIMPLE_WRITE_NOERROR(test_write_builder_nested(&writer, true, 1, 3));
+    TEST_SIMPLE_WRITE_ERROR(test_write_builder_nested(&writer, true, 1,
+                MPACK_BUILDER_INTERNAL_STORAGE_SIZE), mpack_error_too_big);
+}
+#endif
+#endif
+
 #if MPACK_HAS_GENERIC
 static void test_write_generic(void) {
     char buf[4096];
@@ -1125,6 +1426,512 @@ static void test_write_flush_message(void) {
     TEST_WRITER_DESTROY_ERROR(&writer, mpack_error_bug);
 }
 
+#if MPACK_STATS
+static void test_write_stats(void) {
+    char out[4096];
+    test_write_flush_t flush = {out, sizeof(out), 0};
+
+    mpack_writer_t writer;
+    mpack_writer_init_stack(&writer);
+    mpack_writer_set_context(&writer, &flush);
+    mpack_writer_set_flush(&writer, &test_write_flush_callback);
+    const mpack_stats_t* stats = mpack_writer_stats(&writer);
+
+    mpack_write_cstr(&writer, "hello world!");
+    TEST_TRUE(stats->flushes == 0 && stats->bytes == 0);
+    mpack_writer_flush_message(&writer);
+    TEST_TRUE(stats->flushes == 1 && stats->bytes == 13);
+    mpack_write_nil(&writer);
+    mpack_writer_flush_message(&writer);
+    TEST_TRUE(stats->flushes == 2 && stats->bytes == 14);
+    TEST_TRUE(stats->fills == 0 && stats->growths == 0);
+
+    mpack_writer_reset_stats(&writer);
+    TEST_TRUE(stats->flushes == 0 && stats->bytes == 0);
+    TEST_WRITER_DESTROY_NOERROR(&writer);
+
+    #ifdef MPACK_MALLOC
+    // a growable writer counts the growths of its buffer
+    char* buf;
+    size_t size;
+    mpack_writer_init_growable(&writer, &buf, &size);
+    if (mpack_writer_error(&writer) == mpack_error_memory)
+        return;
+    stats = mpack_writer_stats(&writer);
+    mpack_start_array(&writer, 100);
+    for (int i = 0; i < 100; ++i)
+        mpack_write_u16(&writer, 1000);
+    mpack_finish_array(&writer);
+    TEST_TRUE(stats->growths >= 1);
+    TEST_TRUE(stats->bytes_copied >= MPACK_BUFFER_SIZE);
+    TEST_WRITER_DESTROY_NOERROR(&writer);
+    TEST_TRUE(size == 3 + 100 * 3);
+    MPACK_FREE(buf);
+    #endif
+}
+#endif
+
+typedef struct test_write_flush_iov_t {
+    test_write_flush_t flush;
+    const char* borrowed; // data expected to be passed without copying
+    size_t borrowed_count;
+    size_t calls;
+    size_t spans;
+    size_t found; // number of spans pointing at borrowed data
+} test_write_flush_iov_t;
+
+static void test_write_flush_iov_callback(mpack_writer_t* writer, const mpack_iovec_t* iov, size_t iovcnt) {
+    test_write_flush_iov_t* flush_iov = (test_write_flush_iov_t*)writer->context;
+    ++flush_iov->calls;
+    size_t i;
+    for (i = 0; i < iovcnt; ++i) {
+        TEST_TRUE(iov[i].count > 0);
+        if (iov[i].data >= flush_iov->borrowed &&
+                iov[i].data < flush_iov->borrowed + flush_iov->borrowed_count)
+            ++flush_iov->found;
+        ++flush_iov->spans;
+        test_write_flush_t* flush = &flush_iov->flush;
+        if (iov[i].count > flush->capacity - flush->count) {
+            mpack_writer_flag_error(writer, mpack_error_io);
+            return;
+        }
+        memcpy(flush->out + flush->count, iov[i].data, iov[i].count);
+        flush->count += iov[i].count;
+    }
+}
+
+static void test_write_flush_iov_contents(mpack_writer_t* writer, const char* data, bool borrowed) {
+    mpack_start_array(writer, MPACK_WRITER_BORROWED_MAX + 6);
+    if (borrowed) {
+        mpack_write_bin_borrowed(writer, data, 100);
+        #if MPACK_EXTENSIONS
+        mpack_write_ext_borrowed(writer, 7, data + 100, 20);
+        #else
+        mpack_write_bin_borrowed(writer, data + 100, 20);
+        #endif
+    } else {
+        mpack_write_bin(writer, data, 100);
+        #if MPACK_EXTENSIONS
+        mpack_write_ext(writer, 7, data + 100, 20);
+        #else
+        mpack_write_bin(writer, data + 100, 20);
+        #endif
+    }
+    mpack_write_cstr(writer, "hello");
+    mpack_write_str(writer, data, 300); // larger than the buffer
+    mpack_write_int(writer, -1);
+
+    // more borrowed writes than can be held until a flush
+    int i;
+    for (i = 0; i <= MPACK_WRITER_BORROWED_MAX; ++i) {
+        if (borrowed)
+            mpack_write_bin_borrowed(writer, data + i * 8, 8);
+        else
+            mpack_write_bin(writer, data + i * 8, 8);
+    }
+    mpack_finish_array(writer);
+}
+
+#if MPACK_BUILDER && defined(MPACK_MALLOC)
+static void test_write_allocator(void) {
+    char* reference;
+    size_t reference_size;
+    mpack_writer_t writer;
+    mpack_writer_init_growable(&writer, &reference, &reference_size);
+    test_write_builder_nested(&writer, false, 5, 300);
+    TEST_WRITER_DESTROY_NOERROR(&writer);
+
+    static char arena_data[65536];
+    test_arena_t arena;
+    int frees;
+    for (frees = 0; frees < 2; ++frees) {
+        mpack_allocator_t allocator = test_arena_init(&arena, arena_data, sizeof(arena_data), frees != 0);
+        size_t active = test_malloc_active_count();
+
+        char* buf;
+        size_t size;
+        mpack_writer_init_growable(&writer, &buf, &size);
+        mpack_writer_set_allocator(&writer, &allocator);
+        TEST_TRUE(test_malloc_active_count() == active);
+        size_t mallocs = test_malloc_total_count();
+
+        test_write_builder_nested(&writer, true, 5, 300);
+        TEST_WRITER_DESTROY_NOERROR(&writer);
+
+        TEST_TRUE(size == reference_size);
+        TEST_TRUE(memcmp(buf, reference, size) == 0);
+        TEST_TRUE(test_arena_contains(&arena, buf));
+
+        // everything came from the arena, and everything but the output was
+        // given back
+        TEST_TRUE(test_malloc_total_count() == mallocs);
+        TEST_TRUE(arena.allocs > 1);
+        TEST_TRUE(arena.frees == (frees ? arena.allocs - 1 : 0));
+    }
+    MPACK_FREE(reference);
+
+    // the allocator cannot be changed once writing has started
+    char buf[16];
+    mpack_writer_init(&writer, buf, sizeof(buf));
+    mpack_write_nil(&writer);
+    TEST_BREAK((mpack_writer_set_allocator(&writer, NULL), true));
+    TEST_WRITER_DESTROY_ERROR(&writer, mpack_error_bug);
+}
+#endif
+
+static void test_write_borrowed_copy(void) {
+    // borrowed writes without a vectored flush are copied
+    char buf[16];
+    TEST_SIMPLE_WRITE("\xc4\x03" "abc", mpack_write_bin_borrowed(&writer, "abc", 3));
+    #if MPACK_EXTENSIONS
+    TEST_SIMPLE_WRITE("\xd5\x07" "ab", mpack_write_ext_borrowed(&writer, 7, "ab", 2));
+    #endif
+    TEST_SIMPLE_WRITE("\xa2" "ab", (mpack_start_str(&writer, 2),
+                mpack_write_bytes_borrowed(&writer, "ab", 2), mpack_finish_str(&writer)));
+}
+
+static void test_write_flush_iov(void) {
+    char data[300];
+    int i;
+    for (i = 0; i < (int)sizeof(data); ++i)
+        data[i] = (char)('a' + i % 26);
+
+    // write the reference output with a normal flush
+    char reference[4096];
+    test_write_flush_t flush = {reference, sizeof(reference), 0};
+    char buffer[64];
+    mpack_writer_t writer;
+    mpack_writer_init(&writer, buffer, sizeof(buffer));
+    mpack_writer_set_context(&writer, &flush);
+    mpack_writer_set_flush(&writer, &test_write_flush_callback);
+    test_write_flush_iov_contents(&writer, data, false);
+    TEST_WRITER_DESTROY_NOERROR(&writer);
+
+    // write it with borrowed data and a vectored flush
+    char out[4096];
+    test_write_flush_iov_t flush_iov;
+    mpack_memset(&flush_iov, 0, sizeof(flush_iov));
+    flush_iov.flush.out = out;
+    flush_iov.flush.capacity = sizeof(out);
+    flush_iov.borrowed = data;
+    flush_iov.borrowed_count = sizeof(data);
+    mpack_writer_init(&writer, buffer, sizeof(buffer));
+    mpack_writer_set_context(&writer, &flush_iov);
+    mpack_writer_set_flush_iov(&writer, &test_write_flush_iov_callback);
+    test_write_flush_iov_contents(&writer, data, true);
+    TEST_TRUE(flush_iov.calls > 0);
+    mpack_writer_flush_message(&writer);
+    TEST_WRITER_DESTROY_NOERROR(&writer);
+
+    TEST_TRUE(flush_iov.flush.count == flush.count);
+    TEST_TRUE(memcmp(out, reference, flush.count) == 0);
+
+    // the borrowed writes and the large str are all passed without copying.
+    // the writer flushes along with the large str, when too many borrowed
+    // writes are pending, and for the message.
+    TEST_TRUE(flush_iov.found == MPACK_WRITER_BORROWED_MAX + 4);
+    TEST_TRUE(flush_iov.calls == 3);
+
+    // flushing on destroy includes borrowed data
+    mpack_memset(&flush_iov, 0, sizeof(flush_iov));
+    flush_iov.flush.out = out;
+    flush_iov.flush.capacity = sizeof(out);
+    flush_iov.borrowed = data;
+    flush_iov.borrowed_count = sizeof(data);
+    mpack_writer_init(&writer, buffer, sizeof(buffer));
+    mpack_writer_set_context(&writer, &flush_iov);
+    mpack_writer_set_flush_iov(&writer, &test_write_flush_iov_callback);
+    mpack_write_bin_borrowed(&writer, data, 3);
+    TEST_TRUE(flush_iov.calls == 0);
+    TEST_WRITER_DESTROY_NOERROR(&writer);
+    TEST_TRUE(flush_iov.calls == 1);
+    TEST_TRUE(flush_iov.spans == 2);
+    TEST_TRUE(flush_iov.flush.count == 5);
+    TEST_TRUE(memcmp(out, "\xc4\x03" "abc", 5) == 0);
+
+    // io errors from a vectored flush are flagged
+    flush_iov.flush.count = 0;
+    flush_iov.flush.capacity = 10;
+    mpack_writer_init(&writer, buffer, sizeof(buffer));
+    mpack_writer_set_context(&writer, &flush_iov);
+    mpack_writer_set_flush_iov(&writer, &test_write_flush_iov_callback);
+    mpack_write_bin_borrowed(&writer, data, 100);
+    mpack_writer_flush_message(&writer);
+    TEST_WRITER_DESTROY_ERROR(&writer, mpack_error_io);
+}
+
+typedef struct test_write_async_t {
+    test_write_flush_t flush;
+    const char* pending;  // the data in flight
+    size_t pending_count;
+    char snapshot[256];   // a copy of the data in flight, to check that it isn't touched
+    size_t submits;
+    size_t waits;
+    bool complete;        // whether to complete flushes immediately
+} test_write_async_t;
+
+static void test_write_async_finish(mpack_writer_t* writer) {
+    test_write_async_t* async = (test_write_async_t*)writer->context;
+    TEST_TRUE(async->pending != NULL);
+    if (async->pending_count <= sizeof(async->snapshot))
+        TEST_TRUE(memcmp(async->pending, async->snapshot, async->pending_count) == 0);
+    test_write_flush_callback(writer, async->pending, async->pending_count);
+    async->pending = NULL;
+}
+
+static void test_write_async_submit(mpack_writer_t* writer, const char* data, size_t count) {
+    test_write_async_t* async = (test_write_async_t*)writer->context;
+    TEST_TRUE(async->pending == NULL);
+    TEST_TRUE(mpack_writer_async_in_flight(writer));
+    ++async->submits;
+    async->pending = data;
+    async->pending_count = count;
+    if (count <= sizeof(async->snapshot))
+        memcpy(async->snapshot, data, count);
+    if (async->complete) {
+        test_write_async_finish(writer);
+        mpack_writer_async_complete(writer);
+    }
+}
+
+static void test_write_async_wait(mpack_writer_t* writer) {
+    test_write_async_t* async = (test_write_async_t*)writer->context;
+    ++async->waits;
+    test_write_async_finish(writer);
+}
+
+static void test_write_async_init(mpack_writer_t* writer, test_write_async_t* async,
+        char* buffer, char* spare, size_t size, char* out, size_t capacity)
+{
+    mpack_memset(async, 0, sizeof(*async));
+    async->flush.out = out;
+    async->flush.capacity = capacity;
+    mpack_writer_init(writer, buffer, size);
+    mpack_writer_set_context(writer, async);
+    mpack_writer_set_async(writer, spare, &test_write_async_submit, &test_write_async_wait);
+}
+
+static void test_write_async(void) {
+    char data[300];
+    int i;
+    for (i = 0; i < (int)sizeof(data); ++i)
+        data[i] = (char)('a' + i % 26);
+
+    // write the reference output with a normal flush
+    char reference[4096];
+    test_write_flush_t flush = {reference, sizeof(reference), 0};
+    char buffer[64];
+    char spare[64];
+    mpack_writer_t writer;
+    mpack_writer_init(&writer, buffer, sizeof(buffer));
+    mpack_writer_set_context(&writer, &flush);
+    mpack_writer_set_flush(&writer, &test_write_flush_callback);
+    test_write_flush_iov_contents(&writer, data, false);
+    TEST_WRITER_DESTROY_NOERROR(&writer);
+
+    // write it asynchronously. each flush waits for the previous one, and the
+    // large str waits for itself, so only the last flush is still in flight.
+    char out[4096];
+    test_write_async_t async;
+    test_write_async_init(&writer, &async, buffer, spare, sizeof(buffer), out, sizeof(out));
+    test_write_flush_iov_contents(&writer, data, false);
+    TEST_TRUE(async.submits > 2);
+    TEST_TRUE(async.waits == async.submits - 1);
+    TEST_TRUE(mpack_writer_async_in_flight(&writer));
+    TEST_WRITER_DESTROY_NOERROR(&writer);
+    TEST_TRUE(!mpack_writer_async_in_flight(&writer));
+    TEST_TRUE(async.pending == NULL);
+    TEST_TRUE(async.flush.count == flush.count);
+    TEST_TRUE(memcmp(out, reference, flush.count) == 0);
+
+    // flushes that are marked complete are never waited for
+    test_write_async_init(&writer, &async, buffer, spare, sizeof(buffer), out, sizeof(out));
+    async.complete = true;
+    test_write_flush_iov_contents(&writer, data, false);
+    TEST_WRITER_DESTROY_NOERROR(&writer);
+    TEST_TRUE(async.submits > 2);
+    TEST_TRUE(async.waits == 0);
+    TEST_TRUE(async.flush.count == flush.count);
+    TEST_TRUE(memcmp(out, reference, flush.count) == 0);
+
+    // flushing a message submits it without waiting
+    test_write_async_init(&writer, &async, buffer, spare, sizeof(buffer), out, sizeof(out));
+    mpack_write_cstr(&writer, "hello world!");
+    mpack_writer_flush_message(&writer);
+    TEST_TRUE(async.submits == 1);
+    TEST_TRUE(async.waits == 0);
+    TEST_TRUE(async.flush.count == 0);
+    TEST_TRUE(mpack_writer_buffer_used(&writer) == 0);
+    TEST_TRUE(writer.buffer == spare);
+    mpack_write_int(&writer, 3);
+    mpack_writer_flush_message(&writer);
+    TEST_TRUE(async.submits == 2);
+    TEST_TRUE(async.waits == 1);
+    TEST_TRUE(async.flush.count == 13);
+    TEST_TRUE(writer.buffer == buffer);
+    mpack_writer_flush_message(&writer); // no-op
+    TEST_TRUE(async.submits == 2);
+    TEST_WRITER_DESTROY_NOERROR(&writer);
+    TEST_TRUE(async.waits == 2);
+    TEST_TRUE(async.flush.count == 14);
+    TEST_TRUE(memcmp(out, "\xachello world!\x03", 14) == 0);
+
+    // destroy waits for the flush in flight even after an error
+    test_write_async_init(&writer, &async, buffer, spare, sizeof(buffer), out, sizeof(out));
+    mpack_write_cstr(&writer, "hello world!");
+    mpack_writer_flush_message(&writer);
+    mpack_writer_flag_error(&writer, mpack_error_data);
+    TEST_WRITER_DESTROY_ERROR(&writer, mpack_error_data);
+    TEST_TRUE(async.waits == 1);
+    TEST_TRUE(async.pending == NULL);
+
+    // io errors from a completed flush stop further flushes
+    test_write_async_init(&writer, &async, buffer, spare, sizeof(buffer), out, 10);
+    mpack_write_bin(&writer, data, 40);
+    mpack_writer_flush_message(&writer);
+    TEST_TRUE(mpack_writer_error(&writer) == mpack_ok);
+    mpack_write_bin(&writer, data, 40);
+    mpack_writer_flush_message(&writer);
+    TEST_TRUE(async.submits == 1);
+    TEST_WRITER_DESTROY_ERROR(&writer, mpack_error_io);
+
+    // the buffers must be large enough for flushing
+    mpack_writer_init(&writer, buffer, MPACK_WRITER_MINIMUM_BUFFER_SIZE - 1);
+    TEST_BREAK((mpack_writer_set_async(&writer, spare, &test_write_async_submit, &test_write_async_wait), true));
+    TEST_WRITER_DESTROY_ERROR(&writer, mpack_error_bug);
+}
+
+// writes an int array both in bulk and one element at a time, checking that
+// the output matches
+static void test_write_array_ints(const int64_t* values, uint32_t count) {
+    uint64_t uvalues[64];
+    uint32_t u32values[64];
+    int32_t i32values[64];
+    uint32_t i;
+    TEST_TRUE(count <= 64);
+    for (i = 0; i < count; ++i) {
+        uvalues[i] = (uint64_t)values[i];
+        u32values[i] = (uint32_t)values[i];
+        i32values[i] = (int32_t)values[i];
+    }
+
+    int type;
+    for (type = 0; type < 4; ++type) {
+        char reference[1024];
+        char out[1024];
+        test_write_flush_t flush = {reference, sizeof(reference), 0};
+        mpack_writer_t writer;
+
+        mpack_writer_init_stack(&writer);
+        mpack_writer_set_context(&writer, &flush);
+        mpack_writer_set_flush(&writer, &test_write_flush_callback);
+        mpack_start_array(&writer, count);
+        for (i = 0; i < count; ++i) {
+            switch (type) {
+                case 0: mpack_write_i64(&writer, values[i]); break;
+                case 1: mpack_write_u64(&writer, uvalues[i]); break;
+                case 2: mpack_write_i32(&writer, i32values[i]); break;
+                default: mpack_write_u32(&writer, u32values[i]); break;
+            }
+        }
+        mpack_finish_array(&writer);
+        TEST_WRITER_DESTROY_NOERROR(&writer);
+
+        // write it in bulk with a flush, to split runs across flushes
+        test_write_flush_t bulk = {out, sizeof(out), 0};
+        mpack_writer_init_stack(&writer);
+        mpack_writer_set_context(&writer, &bulk);
+        mpack_writer_set_flush(&writer, &test_write_flush_callback);
+        mpack_write_cstr(&writer, "x"); // misalign the runs
+        switch (type) {
+            case 0: mpack_write_array_i64(&writer, values, count); break;
+            case 1: mpack_write_array_u64(&writer, uvalues, count); break;
+            case 2: mpack_write_array_i32(&writer, i32values, count); break;
+            default: mpack_write_array_u32(&writer, u32values, count); break;
+        }
+        TEST_WRITER_DESTROY_NOERROR(&writer);
+        TEST_TRUE(bulk.count == flush.count + 2);
+        TEST_TRUE(memcmp(out + 2, reference, flush.count) == 0);
+    }
+}
+
+static void test_write_array(void) {
+    static const int64_t boundaries[] = {
+        -32, -33, 127, 128, 255, 256, 65535, 65536, 4294967295LL, 4294967296LL,
+        -128, -129, -32768, -32769, INT32_MIN, (int64_t)INT32_MIN - 1,
+        INT64_MIN, INT64_MAX, 0, -1,
+    };
+    test_write_array_ints(boundaries, (uint32_t)(sizeof(boundaries) / sizeof(*boundaries)));
+    test_write_array_ints(boundaries, 0);
+
+    // uniform runs of each encoding, with a partial block at the end
+    static const int64_t starts[] = {
+        -32, 128, 256, 65536, 4294967296LL, -33, -129, -32769, (int64_t)INT32_MIN - 100,
+    };
+    int64_t values[64];
+    size_t j;
+    for (j = 0; j < sizeof(starts) / sizeof(*starts); ++j) {
+        uint32_t i;
+        for (i = 0; i < 40; ++i)
+            values[i] = starts[j] + ((starts[j] < 0) ? -(int64_t)i : (int64_t)i) % 16;
+        test_write_array_ints(values, 40);
+    }
+
+    // floats and doubles
+    float floats[20];
+    double doubles[20];
+    uint32_t i;
+    for (i = 0; i < 20; ++i) {
+        floats[i] = (float)i * 1.5f - 7.0f;
+        doubles[i] = (double)i * -2.25 + 1e10;
+    }
+    char reference[512];
+    char out[512];
+    test_write_flush_t flush = {reference, sizeof(reference), 0};
+    mpack_writer_t writer;
+    mpack_writer_init_stack(&writer);
+    mpack_writer_set_context(&writer, &flush);
+    mpack_writer_set_flush(&writer, &test_write_flush_callback);
+    mpack_start_array(&writer, 20);
+    for (i = 0; i < 20; ++i)
+        mpack_write_float(&writer, floats[i]);
+    mpack_finish_array(&writer);
+    mpack_start_array(&writer, 20);
+    for (i = 0; i < 20; ++i)
+        mpack_write_double(&writer, doubles[i]);
+    mpack_finish_array(&writer);
+    TEST_WRITER_DESTROY_NOERROR(&writer);
+
+    test_write_flush_t bulk = {out, sizeof(out), 0};
+    mpack_writer_init_stack(&writer);
+    mpack_writer_set_context(&writer, &bulk);
+    mpack_writer_set_flush(&writer, &test_write_flush_callback);
+    mpack_write_array_float(&writer, floats, 20);
+    mpack_write_array_double(&writer, doubles, 20);
+    TEST_WRITER_DESTROY_NOERROR(&writer);
+    TEST_TRUE(bulk.count == flush.count);
+    TEST_TRUE(memcmp(out, reference, flush.count) == 0);
+
+    // arrays that don't fit flag an error
+    mpack_writer_init(&writer, out, 30);
+    mpack_write_array_i64(&writer, starts, 9);
+    TEST_WRITER_DESTROY_ERROR(&writer, mpack_error_too_big);
+    mpack_writer_init(&writer, out, 30);
+    mpack_write_array_double(&writer, doubles, 20);
+    TEST_WRITER_DESTROY_ERROR(&writer, mpack_error_too_big);
+
+    #if MPACK_BUILDER
+    // arrays are counted as single elements of a build
+    mpack_writer_init(&writer, out, sizeof(out));
+    mpack_build_array(&writer);
+    mpack_write_array_i64(&writer, starts, 9);
+    mpack_write_array_float(&writer, floats, 2);
+    mpack_complete_array(&writer);
+    TEST_WRITER_DESTROY_NOERROR(&writer);
+    TEST_TRUE(memcmp(out, "\x92\x99\xe0", 3) == 0);
+    #endif
+}
+
 static void test_misc(void) {
 
     // writing too much data without a flush callback
@@ -1213,6 +2020,167 @@ static void test_write_compatibility() {
 }
 #endif
 
+#if MPACK_DOUBLES
+#define TEST_COMPACT_WRITE(expect, value) \
+    TEST_SIMPLE_WRITE(expect, (mpack_writer_set_compact_doubles(&writer, true), mpack_write_double(&writer, value)))
+
+static void test_write_compact_doubles(void) {
+    char buf[64];
+
+    // integral values as small ints
+    TEST_COMPACT_WRITE("\x00", 0.0);
+    TEST_COMPACT_WRITE("\x0c", 12.0);
+    TEST_COMPACT_WRITE("\xcc\xc8", 200.0);
+    TEST_COMPACT_WRITE("\xcd\xff\xff", 65535.0);
+    TEST_COMPACT_WRITE("\xe0", -32.0);
+    TEST_COMPACT_WRITE("\xd0\xdf", -33.0);
+    TEST_COMPACT_WRITE("\xd1\x80\x00", -32768.0);
+
+    // floats when exact, including where an int wouldn't be smaller
+    TEST_COMPACT_WRITE("\xca\x3f\x00\x00\x00", 0.5);
+    TEST_COMPACT_WRITE("\xca\x80\x00\x00\x00", -0.0);
+    TEST_COMPACT_WRITE("\xca\x47\x80\x00\x00", 65536.0);
+    TEST_COMPACT_WRITE("\xca\x50\x15\x02\xf9", 1e10);
+    TEST_COMPACT_WRITE("\xca\x7f\x7f\xff\xff", 3.4028234663852886e38);
+
+    // 32-bit ints too precise for a float
+    TEST_COMPACT_WRITE("\xce\x01\x00\x00\x01", 16777217.0);
+    TEST_COMPACT_WRITE("\xce\xff\xff\xff\xff", 4294967295.0);
+    TEST_COMPACT_WRITE("\xd2\xfe\xff\xff\xff", -16777217.0);
+
+    // everything else stays a double
+    TEST_COMPACT_WRITE("\xcb\x40\x09\x21\xfb\x53\xc8\xd4\xf1", 3.14159265);
+    TEST_COMPACT_WRITE("\xcb\x3f\xb9\x99\x99\x99\x99\x99\x9a", 0.1);
+    TEST_COMPACT_WRITE("\xcb\xc1\xe0\x00\x00\x00\x20\x00\x00", -2147483649.0);
+    TEST_COMPACT_WRITE("\xcb\x47\xef\xff\xff\xf0\x00\x00\x00", 3.4028235677973366e38);
+    TEST_COMPACT_WRITE("\xcb\x7f\xf0\x00\x00\x00\x00\x00\x00", 1e300 * 1e300);
+
+    // arrays match writing each element, and the savings are counted
+    const double values[] = {0.5, 12.0, 0.1, -0.0, 16777217.0};
+    char reference[64];
+    test_write_flush_t flush = {reference, sizeof(reference), 0};
+    mpack_writer_t writer;
+    mpack_writer_init_stack(&writer);
+    mpack_writer_set_context(&writer, &flush);
+    mpack_writer_set_flush(&writer, &test_write_flush_callback);
+    mpack_writer_set_compact_doubles(&writer, true);
+    mpack_start_array(&writer, 5);
+    for (size_t i = 0; i < 5; ++i)
+        mpack_write_double(&writer, values[i]);
+    mpack_finish_array(&writer);
+    #if MPACK_STATS
+    TEST_TRUE(mpack_writer_stats(&writer)->bytes_saved == 4 + 8 + 0 + 4 + 4);
+    #endif
+    TEST_WRITER_DESTROY_NOERROR(&writer);
+    TEST_TRUE(flush.count == 1 + 5 + 1 + 9 + 5 + 5);
+
+    char out[64];
+    test_write_flush_t bulk = {out, sizeof(out), 0};
+    mpack_writer_init_stack(&writer);
+    mpack_writer_set_context(&writer, &bulk);
+    mpack_writer_set_flush(&writer, &test_write_flush_callback);
+    mpack_writer_set_compact_doubles(&writer, true);
+    mpack_write_array_double(&writer, values, 5);
+    TEST_WRITER_DESTROY_NOERROR(&writer);
+    TEST_TRUE(bulk.count == flush.count);
+    TEST_TRUE(memcmp(out, reference, flush.count) == 0);
+}
+#endif
+
+static void test_write_tokens(void) {
+    char buf[64];
+
+    static const mpack_token_t timestamp = MPACK_TOKEN_CSTR("timestamp");
+    TEST_SIMPLE_WRITE("\xa9timestamp", mpack_write_token(&writer, &timestamp));
+    mpack_token_t token = mpack_token_cstr("timestamp");
+    TEST_TRUE(token.size == timestamp.size && token.count == 1);
+    TEST_TRUE(memcmp(&token.lead, &timestamp.lead, token.size) == 0);
+    token = mpack_token_cstr("");
+    TEST_SIMPLE_WRITE("\xa0", mpack_write_token(&writer, &token));
+
+    // numbers use their smallest encodings, as when written directly
+    token = mpack_token_uint(127);
+    TEST_SIMPLE_WRITE("\x7f", mpack_write_token(&writer, &token));
+    token = mpack_token_uint(200);
+    TEST_SIMPLE_WRITE("\xcc\xc8", mpack_write_token(&writer, &token));
+    token = mpack_token_uint(UINT32_MAX);
+    TEST_SIMPLE_WRITE("\xce\xff\xff\xff\xff", mpack_write_token(&writer, &token));
+    token = mpack_token_uint(UINT64_MAX);
+    TEST_SIMPLE_WRITE("\xcf\xff\xff\xff\xff\xff\xff\xff\xff", mpack_write_token(&writer, &token));
+    token = mpack_token_int(5);
+    TEST_SIMPLE_WRITE("\x05", mpack_write_token(&writer, &token));
+    token = mpack_token_int(-32);
+    TEST_SIMPLE_WRITE("\xe0", mpack_write_token(&writer, &token));
+    token = mpack_token_int(-33);
+    TEST_SIMPLE_WRITE("\xd0\xdf", mpack_write_token(&writer, &token));
+    token = mpack_token_int(-32769);
+    TEST_SIMPLE_WRITE("\xd2\xff\xff\x7f\xff", mpack_write_token(&writer, &token));
+    token = mpack_token_int(INT64_MIN);
+    TEST_SIMPLE_WRITE("\xd3\x80\x00\x00\x00\x00\x00\x00\x00", mpack_write_token(&writer, &token));
+    token = mpack_token_nil();
+    TEST_SIMPLE_WRITE("\xc0", mpack_write_token(&writer, &token));
+    token = mpack_token_bool(true);
+    TEST_SIMPLE_WRITE("\xc3", mpack_write_token(&writer, &token));
+
+    // concatenated tokens count each of their elements
+    mpack_token_t key = mpack_token_cstr("v");
+    mpack_token_t value = mpack_token_bool(false);
+    mpack_token_t pair = mpack_token_concat(&key, &value);
+    TEST_TRUE(pair.count == 2);
+    TEST_SIMPLE_WRITE("\x82\xa1v\xc2\xa9timestamp\x01", (
+            mpack_start_map(&writer, 2),
+            mpack_write_token(&writer, &pair),
+            mpack_write_token(&writer, &timestamp),
+            mpack_write_u8(&writer, 1),
+            mpack_finish_map(&writer)));
+    #if MPACK_BUILDER
+    TEST_SIMPLE_WRITE("\x82\xa1v\xc2\xa1v\xc2", (
+            mpack_build_map(&writer),
+            mpack_write_token(&writer, &pair),
+            mpack_write_token(&writer, &pair),
+            mpack_complete_map(&writer)));
+    #endif
+
+    // tokens that don't fit are invalid
+    char long_key[MPACK_TOKEN_SIZE + 1];
+    memset(long_key, 'k', sizeof(long_key) - 1);
+    long_key[sizeof(long_key) - 1] = '\0';
+    token = mpack_token_cstr(long_key);
+    TEST_TRUE(!mpack_token_valid(&token));
+    TEST_SIMPLE_WRITE_ERROR(mpack_write_token(&writer, &token), mpack_error_too_big);
+    token = mpack_token_str(long_key, MPACK_TOKEN_SIZE - 1);
+    TEST_TRUE(mpack_token_valid(&token) == (MPACK_TOKEN_SIZE - 1 <= 31));
+    token = mpack_token_concat(&timestamp, &timestamp);
+    while (mpack_token_valid(&token) && token.count < 10)
+        token = mpack_token_concat(&token, &timestamp);
+    TEST_TRUE(!mpack_token_valid(&token));
+    token = mpack_token_concat(&token, &key);
+    TEST_TRUE(!mpack_token_valid(&token));
+
+    // tokens are written through flushes when the buffer is nearly full
+    char out[512];
+    test_write_flush_t flush = {out, sizeof(out), 0};
+    char small[MPACK_WRITER_MINIMUM_BUFFER_SIZE];
+    mpack_writer_t writer;
+    mpack_writer_init(&writer, small, sizeof(small));
+    mpack_writer_set_context(&writer, &flush);
+    mpack_writer_set_flush(&writer, &test_write_flush_callback);
+    for (size_t i = 0; i < 20; ++i)
+        mpack_write_token(&writer, &timestamp);
+    TEST_WRITER_DESTROY_NOERROR(&writer);
+    TEST_TRUE(flush.count == 20 * 10);
+    for (size_t i = 0; i < 20; ++i)
+        TEST_TRUE(memcmp(out + i * 10, "\xa9timestamp", 10) == 0);
+
+    #if MPACK_WRITE_TRACKING
+    // a pair is too many elements for an array of one
+    mpack_writer_init(&writer, buf, sizeof(buf));
+    mpack_start_array(&writer, 1);
+    TEST_BREAK((mpack_write_token(&writer, &pair), true));
+    TEST_WRITER_DESTROY_ERROR(&writer, mpack_error_bug);
+    #endif
+}
+
 void test_writes() {
     /*
     const char c[] =
@@ -1246,13 +2214,41 @@ void test_writes() {
     test_write_basic_structures();
     test_write_small_structure_trees();
     test_system_fail_until_ok(&test_write_deep_growth);
+    test_write_chunked();
+    test_system_fail_until_ok(&test_write_chunked_growth);
     #endif
 
     #if MPACK_WRITE_TRACKING
     test_write_tracking();
     #endif
 
+    #if MPACK_BUILDER
+    test_write_builder_basic();
+    #if MPACK_DEBUG
+    test_write_builder_errors();
+    #endif
+    #ifdef MPACK_MALLOC
+    test_system_fail_until_ok(&test_write_builder_growth);
+    #else
+    test_write_builder_storage();
+    #endif
+    #endif
+
     test_write_flush_message();
+    #if MPACK_STATS
+    test_write_stats();
+    #endif
+    #if MPACK_BUILDER && defined(MPACK_MALLOC)
+    test_write_allocator();
+    #endif
+    test_write_borrowed_copy();
+    test_write_flush_iov();
+    test_write_async();
+    test_write_array();
+    #if MPACK_DOUBLES
+    test_write_compact_doubles();
+    #endif
+    test_write_tokens();
     test_misc();
 }
 
@@ -28,6 +28,12 @@
 #include "test-expect.h"
 #include "test-write.h"
 #include "test-buffer.h"
+#include "test-codec.h"
+#include "test-json.h"
+#include "test-query.h"
+#include "test-frame.h"
+#include "test-patch.h"
+#include "test-cpp.h"
 #include "test-common.h"
 #include "test-node.h"
 #include "test-file.h"
@@ -98,6 +104,24 @@ int main(void) {
     #if MPACK_NODE
     test_node();
     #endif
+    #if MPACK_CODEC && defined(MPACK_MALLOC) && MPACK_EXPECT && MPACK_WRITER
+    test_codec();
+    #endif
+    #if MPACK_JSON && MPACK_READER && MPACK_STDIO
+    test_json();
+    #endif
+    #if MPACK_QUERY && MPACK_READER
+    test_query();
+    #endif
+    #if MPACK_FRAME && defined(MPACK_MALLOC)
+    test_frame();
+    #endif
+    #if MPACK_PATCH && MPACK_NODE && MPACK_NODE_SPANS && MPACK_WRITER && defined(MPACK_MALLOC)
+    test_patch();
+    #endif
+    #if TEST_CPP
+    test_cpp();
+    #endif
     #if MPACK_STDIO
     test_file();
     #endif
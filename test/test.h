@@ -214,6 +214,25 @@ extern bool test_break_hit;
 
 #endif
 
+#ifdef MPACK_MALLOC
+// A bump allocator over a fixed buffer for testing custom allocators.
+// Memory is never reused; frees are only counted.
+typedef struct test_arena_t {
+    char* data;
+    size_t capacity;
+    size_t used;
+    size_t allocs;
+    size_t frees;
+} test_arena_t;
+
+// Initializes an arena and returns an allocator for it. If frees is
+// false, the allocator has no free function.
+mpack_allocator_t test_arena_init(test_arena_t* arena, char* data, size_t capacity, bool frees);
+
+// Returns true if the given pointer was allocated from the arena.
+bool test_arena_contains(test_arena_t* arena, const void* p);
+#endif
+
 #ifdef __cplusplus
 }
 #endif
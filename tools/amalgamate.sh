@@ -13,6 +13,11 @@ HEADERS="\
     mpack/mpack-reader.h \
     mpack/mpack-expect.h \
     mpack/mpack-node.h \
+    mpack/mpack-codec.h \
+    mpack/mpack-json.h \
+    mpack/mpack-query.h \
+    mpack/mpack-frame.h \
+    mpack/mpack-patch.h \
     "
 
 SOURCES="\
@@ -22,6 +27,11 @@ SOURCES="\
     mpack/mpack-reader.c \
     mpack/mpack-expect.c \
     mpack/mpack-node.c \
+    mpack/mpack-codec.c \
+    mpack/mpack-json.c \
+    mpack/mpack-query.c \
+    mpack/mpack-frame.c \
+    mpack/mpack-patch.c \
     "
 
 TOOLS="\
@@ -81,6 +91,9 @@ for f in $SOURCES; do
     sed -e 's@^#include ".*@/* & */@' -e '0,/^ \*\/$/d' src/$f >> $SOURCE
 done
 
+# the C++ layer is header-only and includes the amalgamated mpack.h
+cp src/mpack/mpack.hpp build/amalgamation/src/mpack/
+
 # assemble package contents
 cp -ar $FILES build/amalgamation
 mkdir -p build/amalgamation/projects/{vs,xcode/MPack.xcodeproj}
@@ -0,0 +1,14 @@
+#!/bin/bash
+
+# Builds and runs mpack-bench. Arguments are passed to the benchmark; for
+# example, to run only the Node API cases for at least two seconds each:
+#
+#     tools/bench.sh -t 2 node
+#
+# Results are printed as one JSON object per line. Redirect them to a file to
+# compare them between builds.
+
+cd "$(dirname "$0")"/..
+
+make -f test/Makefile bench >&2 || exit 1
+build/bench/mpack-bench "$@"
@@ -316,6 +316,7 @@ addDebugReleaseBuilds('embed-reader', concatArrays({"-DMPACK_READER=1"}, cflags)
 addDebugReleaseBuilds('embed-expect', concatArrays({"-DMPACK_READER=1", "-DMPACK_EXPECT=1"}, cflags));
 addDebugReleaseBuilds('embed-node', concatArrays({"-DMPACK_NODE=1"}, cflags));
 addDebugReleaseBuilds('embed-nobuiltins', concatArrays({"-DMPACK_NO_BUILTINS=1"}, allfeatures, cflags));
+addDebugReleaseBuilds('embed-builder', concatArrays(allfeatures, cflags, {"-DMPACK_BUILDER_INTERNAL_STORAGE=1"}));
 
 -- language versions
 if checkFlag("-std=c11") then
@@ -325,7 +326,9 @@ end
 for _, version in ipairs({"c++11", "gnu++11", "c++14", "c++17"}) do
     local flags = concatArrays(cxxflags, {"-std=" .. version})
     if checkFlag(table.concat(flags, ' ')) then
-        addDebugReleaseBuilds(version, concatArrays(allfeatures, allconfigs, flags));
+        -- C++17 builds also test mpack.hpp, which uses the standard library
+        local ldflags = (version == "c++17") and {"-lstdc++"} or nil
+        addDebugReleaseBuilds(version, concatArrays(allfeatures, allconfigs, flags), ldflags);
     end
 end
 
@@ -378,6 +381,15 @@ addBuild('coverage', concatArrays(allfeatures, allconfigs, cflags,
         {"--coverage"})
 addBuild('notrack', concatArrays(allfeatures, allconfigs, cflags, debugflags, {"-DMPACK_NO_TRACKING=1"}))
 addDebugReleaseBuilds('realloc', concatArrays(allfeatures, allconfigs, cflags, {"-DMPACK_REALLOC=test_realloc"}))
+addDebugReleaseBuilds('mmap', concatArrays(allfeatures, allconfigs, cflags, {"-DMPACK_MMAP=1", "-D_POSIX_C_SOURCE=200112L"}))
+addDebugReleaseBuilds('fd', concatArrays(allfeatures, allconfigs, cflags, {"-DMPACK_FD=1", "-D_POSIX_C_SOURCE=200112L"}))
+addDebugReleaseBuilds('nosimd', concatArrays(allfeatures, allconfigs, cflags, {"-DMPACK_SIMD=0"}))
+addDebugReleaseBuilds('builder-internal', concatArrays(allfeatures, allconfigs, cflags, {"-DMPACK_BUILDER_INTERNAL_STORAGE=1"}))
+addDebugReleaseBuilds('node-compact', concatArrays(allfeatures, allconfigs, cflags, {"-DMPACK_NODE_COMPACT=1", "-DMPACK_NODE_MAP_INDEX=0"}))
+addDebugReleaseBuilds('node-spans', concatArrays(allfeatures, allconfigs, cflags, {"-DMPACK_NODE_SPANS=1"}))
+addDebugReleaseBuilds('node-spans-realloc', concatArrays(allfeatures, allconfigs, cflags, {"-DMPACK_NODE_SPANS=1", "-DMPACK_REALLOC=test_realloc"}))
+addDebugReleaseBuilds('node-spans-compact', concatArrays(allfeatures, allconfigs, cflags, {"-DMPACK_NODE_SPANS=1", "-DMPACK_NODE_COMPACT=1", "-DMPACK_NODE_MAP_INDEX=0"}))
+addDebugReleaseBuilds('stats', concatArrays(allfeatures, allconfigs, cflags, {"-DMPACK_STATS=1"}))
 builds["fastmath"].run_wrapper = "valgrind"
 builds["coverage"].exclude = true -- don't run during "all". run separately by travis.
 if hasOg then